@@ -0,0 +1,106 @@
+/*
+ * Throughput benchmark for the checksum kernels in src/util-checksum.h
+ *
+ * Build and run with:
+ *
+ *   gcc -O2 -o checksum benches/checksum.c && ./checksum
+ *
+ * The AVX2 kernel is picked at runtime, so no -m flags are needed.
+ * Optional argument: number of bytes to sum per size.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/util-checksum.h"
+
+ChecksumSumFunc checksum_sum = NULL;
+
+/* the loop the decoders used before the kernels */
+static uint32_t WordLoopSum(const uint8_t *buf, uint32_t len) {
+    const uint16_t *pkt = (const uint16_t *)buf;
+    uint16_t pad = 0;
+    uint32_t csum = 0;
+
+    while (len >= 32) {
+        csum += pkt[0] + pkt[1] + pkt[2] + pkt[3] + pkt[4] + pkt[5] + pkt[6] +
+            pkt[7] + pkt[8] + pkt[9] + pkt[10] + pkt[11] + pkt[12] + pkt[13] +
+            pkt[14] + pkt[15];
+        len -= 32;
+        pkt += 16;
+    }
+    while (len > 1) {
+        csum += pkt[0];
+        pkt += 1;
+        len -= 2;
+    }
+    if (len == 1) {
+        *(uint8_t *)(&pad) = (*(uint8_t *)pkt);
+        csum += pad;
+    }
+    return ChecksumFold(csum);
+}
+
+static double Now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static volatile uint32_t sink;
+
+static void Run(const char *name, ChecksumSumFunc Sum, const uint8_t *buf,
+                uint32_t size, uint64_t total) {
+    uint64_t n = total / size;
+    uint64_t i;
+    uint32_t acc = 0;
+    double start = Now();
+
+    for (i = 0; i < n; i++)
+        acc += Sum(buf + (i & 63), size);
+
+    double secs = Now() - start;
+    sink = acc;
+    printf("  %-10s %8.2f GB/s %8.2f ns/call\n", name,
+           (double)n * size / secs / 1e9, secs * 1e9 / n);
+}
+
+int main(int argc, char **argv) {
+    static const uint32_t sizes[] = { 64, 576, 1500, 9000, 65535 };
+    uint64_t total = 2ULL * 1024 * 1024 * 1024;
+    const char *best = NULL;
+    size_t s;
+
+    if (argc > 1)
+        total = strtoull(argv[1], NULL, 10);
+
+    uint8_t *buf = malloc(65535 + 64);
+    if (buf == NULL)
+        exit(EXIT_FAILURE);
+    for (s = 0; s < 65535 + 64; s++)
+        buf[s] = (uint8_t)(s * 31);
+
+    checksum_sum = ChecksumSelectKernel(&best);
+    printf("runtime kernel: %s\n", best);
+
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        printf("%u bytes:\n", sizes[s]);
+        Run("wordloop", WordLoopSum, buf, sizes[s], total);
+        Run("scalar", ChecksumSumScalar, buf, sizes[s], total);
+#ifdef CHECKSUM_HAVE_SSE2
+        Run("sse2", ChecksumSumSSE2, buf, sizes[s], total);
+#endif
+#ifdef CHECKSUM_HAVE_AVX2
+        if (__builtin_cpu_supports("avx2"))
+            Run("avx2", ChecksumSumAVX2, buf, sizes[s], total);
+#endif
+        Run("dispatch", checksum_sum, buf, sizes[s], total);
+    }
+
+    free(buf);
+    exit(EXIT_SUCCESS);
+}
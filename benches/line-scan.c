@@ -0,0 +1,104 @@
+/*
+ * Micro benchmark for the line scanners in src/util-line.h
+ *
+ * Build and run with the instruction set to test, e.g.:
+ *
+ *   gcc -O2 -o line-scan benches/line-scan.c && ./line-scan
+ *   gcc -O2 -msse2 -o line-scan benches/line-scan.c && ./line-scan
+ *   gcc -O2 -mavx2 -o line-scan benches/line-scan.c && ./line-scan
+ *
+ * Optional arguments: line length and number of passes.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/util-line.h"
+
+#define BUF_SIZE (4 * 1024 * 1024)
+
+static uint8_t *ByteLoopFindLF(const uint8_t *buf, uint32_t len) {
+    uint32_t i;
+    for (i = 0; i < len; i++) {
+        if (buf[i] == 0x0a)
+            return (uint8_t *)buf + i;
+    }
+    return NULL;
+}
+
+static uint8_t *MemchrFindLF(const uint8_t *buf, uint32_t len) {
+    return memchr(buf, 0x0a, len);
+}
+
+static uint8_t *SCLineFindLFWrapper(const uint8_t *buf, uint32_t len) {
+    return SCLineFindLF(buf, len);
+}
+
+static double Now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void Run(const char *name, uint8_t *(*Find)(const uint8_t *, uint32_t),
+                const uint8_t *buf, uint32_t len, int passes) {
+    uint64_t lines = 0;
+    int p;
+    double start = Now();
+
+    for (p = 0; p < passes; p++) {
+        const uint8_t *ptr = buf;
+        uint32_t left = len;
+        uint8_t *lf;
+
+        /* split the buffer the way the smtp parser does */
+        while (left > 0 && (lf = Find(ptr, left)) != NULL) {
+            left -= (lf - ptr) + 1;
+            ptr = lf + 1;
+            lines++;
+        }
+    }
+
+    double secs = Now() - start;
+    printf("%-10s %8.2f MB/s  %12"PRIu64" lines\n", name,
+           ((double)len * passes) / secs / (1024 * 1024), lines);
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t line_len = 76;  /* typical base64 encoded mail body line */
+    int passes = 100;
+    uint32_t i;
+
+    if (argc > 1)
+        line_len = atoi(argv[1]);
+    if (argc > 2)
+        passes = atoi(argv[2]);
+    if (line_len < 2) {
+        fprintf(stderr, "line length must be at least 2\n");
+        exit(EXIT_FAILURE);
+    }
+
+    uint8_t *buf = malloc(BUF_SIZE);
+    if (buf == NULL)
+        exit(EXIT_FAILURE);
+
+    for (i = 0; i < BUF_SIZE; i++) {
+        buf[i] = 'A' + (i % 26);
+        if ((i % line_len) == line_len - 2)
+            buf[i] = 0x0d;
+        else if ((i % line_len) == line_len - 1)
+            buf[i] = 0x0a;
+    }
+
+    printf("line length %u, %d passes over %u bytes\n", line_len, passes, BUF_SIZE);
+    Run("byteloop", ByteLoopFindLF, buf, BUF_SIZE, passes);
+    Run("memchr", MemchrFindLF, buf, BUF_SIZE, passes);
+    Run("SCLine", SCLineFindLFWrapper, buf, BUF_SIZE, passes);
+
+    free(buf);
+    exit(0);
+}
@@ -0,0 +1,144 @@
+/*
+ * Micro benchmark for PACKET_RECYCLE in src/decode.h
+ *
+ * Needs the config.h of a configured tree. Build and run from the top
+ * level directory with:
+ *
+ *   gcc -O2 -DHAVE_CONFIG_H -I. -Isrc -Ilibhtp -o packet-recycle \
+ *       benches/packet-recycle.c -lpthread && ./packet-recycle
+ *
+ * Optional arguments: number of packets in the pool and number of passes.
+ *
+ * Every pass "decodes" each packet by setting the fields an ethernet,
+ * ipv4, tcp packet sets, then recycles it. This is compared to clearing
+ * the whole Packet like PACKET_INITIALIZE does, and to recycling packets
+ * that also had alerts, events and a pkt var set.
+ */
+
+#include "suricata-common.h"
+#include "decode.h"
+#include "flow.h"
+#include "host.h"
+#include "util-profiling.h"
+
+#include <time.h>
+
+/* the recycle macros call these, nothing is allocated here */
+void PktVarFree(PktVar *pv) {
+}
+
+void AppLayerDataChunkFree(struct AppLayerDataChunk_ *chunk) {
+}
+
+void FlowDecrUsecnt(Flow *f) {
+}
+
+#ifdef PROFILING
+int profiling_packets_enabled = 0;
+#endif
+
+#define STRIDE  ((sizeof(Packet) + 64 + 63) & ~((size_t)63))
+
+static uint8_t pkt_data[64];
+static PktVar dummy_var;
+
+static double Now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void FakeDecode(Packet *p, int cold) {
+    p->pktlen = sizeof(pkt_data);
+    p->datalink = LINKTYPE_ETHERNET;
+    p->ts.tv_sec = 1;
+    p->ethh = (EthernetHdr *)pkt_data;
+    p->ip4h = (IPV4Hdr *)(pkt_data + 14);
+    p->src.family = AF_INET;
+    p->src.addr_data32[0] = 0x0a000001;
+    p->dst.family = AF_INET;
+    p->dst.addr_data32[0] = 0x0a000002;
+    p->tcph = (TCPHdr *)(pkt_data + 34);
+    p->sp = 1024;
+    p->dp = 80;
+    p->proto = IPPROTO_TCP;
+    p->payload = pkt_data + 54;
+    p->payload_len = 10;
+
+    if (cold) {
+        ENGINE_SET_EVENT(p, IPV4_OPT_PAD_REQUIRED);
+        p->alerts.cnt = 1;
+        PACKET_SET_DIRTY(p, PKT_DIRTY_ALERTS);
+        p->pktvar = &dummy_var;
+        PACKET_SET_DIRTY(p, PKT_DIRTY_PKTVAR);
+    }
+}
+
+static void FullReset(Packet *p) {
+    memset(p, 0x00, sizeof(Packet));
+    PACKET_RESET_CHECKSUMS(p);
+    p->pkt = ((uint8_t *)p) + sizeof(Packet);
+}
+
+static void Run(const char *name, uint8_t *pool, int cnt, int passes,
+                int cold, int full) {
+    int pass, i;
+    double start = Now();
+
+    for (pass = 0; pass < passes; pass++) {
+        for (i = 0; i < cnt; i++) {
+            Packet *p = (Packet *)(pool + i * STRIDE);
+
+            FakeDecode(p, cold);
+            if (full)
+                FullReset(p);
+            else
+                PACKET_RECYCLE(p);
+        }
+    }
+
+    double secs = Now() - start;
+    printf("%-24s %8.2f ns/packet\n", name,
+           secs * 1e9 / ((double)cnt * passes));
+}
+
+int main(int argc, char **argv) {
+    int cnt = 1024;
+    int passes = 10000;
+    int i;
+
+    if (argc > 1)
+        cnt = atoi(argv[1]);
+    if (argc > 2)
+        passes = atoi(argv[2]);
+    if (cnt <= 0 || passes <= 0) {
+        fprintf(stderr, "usage: %s [packets] [passes]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    default_packet_size = 64;
+
+    uint8_t *pool = NULL;
+    if (posix_memalign((void **)&pool, 64, (size_t)cnt * STRIDE) != 0) {
+        fprintf(stderr, "allocating %d packets failed\n", cnt);
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < cnt; i++) {
+        Packet *p = (Packet *)(pool + i * STRIDE);
+        PACKET_INITIALIZE(p);
+    }
+
+    printf("sizeof(Packet) %u, %d packets, %d passes\n",
+           (unsigned int)sizeof(Packet), cnt, passes);
+
+    Run("recycle", pool, cnt, passes, 0, 0);
+    Run("recycle, cold sections", pool, cnt, passes, 1, 0);
+    Run("memset Packet", pool, cnt, passes, 0, 1);
+
+    for (i = 0; i < cnt; i++) {
+        Packet *p = (Packet *)(pool + i * STRIDE);
+        PACKET_CLEANUP(p);
+    }
+    free(pool);
+    exit(EXIT_SUCCESS);
+}
@@ -170,6 +170,8 @@ typedef struct DCERPCRequest_ {
     uint8_t *stub_data_buffer;
     /* length of the above buffer */
     uint32_t stub_data_buffer_len;
+    /* allocated size of the above buffer */
+    uint32_t stub_data_buffer_size;
     /* used by the dce preproc to indicate fresh entry in the stub data buffer */
     uint8_t stub_data_fresh;
     uint8_t first_request_seen;
@@ -180,6 +182,8 @@ typedef struct DCERPCResponse_ {
     uint8_t *stub_data_buffer;
     /* length of the above buffer */
     uint32_t stub_data_buffer_len;
+    /* allocated size of the above buffer */
+    uint32_t stub_data_buffer_size;
     /* used by the dce preproc to indicate fresh entry in the stub data buffer */
     uint8_t stub_data_fresh;
 } DCERPCResponse;
@@ -196,6 +200,9 @@ typedef struct DCERPC_ {
     /* indicates if the dcerpc pdu state is in the middle of processing
      * a fragmented pdu */
     uint8_t pdu_fragged;
+    /* stub fragments truncated since the parser last added them to the
+     * thread's counter */
+    uint16_t stub_truncated;
 } DCERPC;
 
 typedef struct DCERPCUDP_ {
@@ -208,6 +215,9 @@ typedef struct DCERPCUDP_ {
     uint8_t *frag_data;
     DCERPCUuidEntry *uuid_entry;
     TAILQ_HEAD(, uuid_entry) uuid_list;
+    /* stub fragments truncated since the parser last added them to the
+     * thread's counter */
+    uint16_t stub_truncated;
 } DCERPCUDP;
 
 /** First fragment */
@@ -239,6 +249,11 @@ typedef struct DCERPCUDP_ {
 #define NO_PSAP_AVAILABLE               7 /* not used */
 
 int32_t DCERPCParser(DCERPC *, uint8_t *, uint32_t);
+uint32_t DCERPCStubDataAppend(uint8_t **, uint32_t *, uint32_t *,
+                              const uint8_t *, uint32_t, uint16_t *);
+void *DCERPCThreadCtxAlloc(ThreadVars *);
+void DCERPCThreadCtxFree(void *);
+void DCERPCThreadCtxCountTruncated(void *, uint16_t *);
 void hexdump(const void *buf, size_t len);
 void printUUID(char *type, DCERPCUuidEntry *uuid);
 
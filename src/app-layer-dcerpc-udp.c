@@ -51,6 +51,7 @@ static uint32_t FragmentDataParser(Flow *f, void *dcerpcudp_state,
 	DCERPCUDPState *sstate = (DCERPCUDPState *) dcerpcudp_state;
     uint8_t **stub_data_buffer = NULL;
     uint32_t *stub_data_buffer_len = NULL;
+    uint32_t *stub_data_buffer_size = NULL;
     uint8_t *stub_data_fresh = NULL;
     uint16_t stub_len = 0;
 
@@ -58,12 +59,14 @@ static uint32_t FragmentDataParser(Flow *f, void *dcerpcudp_state,
     if (sstate->dcerpc.dcerpchdrudp.type == REQUEST) {
         stub_data_buffer = &sstate->dcerpc.dcerpcrequest.stub_data_buffer;
         stub_data_buffer_len = &sstate->dcerpc.dcerpcrequest.stub_data_buffer_len;
+        stub_data_buffer_size = &sstate->dcerpc.dcerpcrequest.stub_data_buffer_size;
         stub_data_fresh = &sstate->dcerpc.dcerpcrequest.stub_data_fresh;
 
     /* response PDU.  Retrieve the response stub buffer */
     } else {
         stub_data_buffer = &sstate->dcerpc.dcerpcresponse.stub_data_buffer;
         stub_data_buffer_len = &sstate->dcerpc.dcerpcresponse.stub_data_buffer_len;
+        stub_data_buffer_size = &sstate->dcerpc.dcerpcresponse.stub_data_buffer_size;
         stub_data_fresh = &sstate->dcerpc.dcerpcresponse.stub_data_fresh;
     }
 
@@ -80,16 +83,15 @@ static uint32_t FragmentDataParser(Flow *f, void *dcerpcudp_state,
         *stub_data_buffer_len = 0;
     }
 
-    *stub_data_buffer = SCRealloc(*stub_data_buffer, *stub_data_buffer_len + stub_len);
+    /* data past the max stub size is consumed, but not buffered */
+    (void)DCERPCStubDataAppend(stub_data_buffer, stub_data_buffer_len,
+                               stub_data_buffer_size, input, stub_len,
+                               &sstate->dcerpc.stub_truncated);
     if (*stub_data_buffer == NULL) {
-        SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
         goto end;
     }
-    memcpy(*stub_data_buffer + *stub_data_buffer_len, input, stub_len);
 
     *stub_data_fresh = 1;
-    /* length of the buffered stub */
-    *stub_data_buffer_len += stub_len;
 
    sstate->dcerpc.fraglenleft -= stub_len;
    sstate->dcerpc.bytesprocessed += stub_len;
@@ -674,6 +676,7 @@ static int DCERPCUDPParse(Flow *f, void *dcerpc_state,
 	if (sstate->bytesprocessed == sstate->dcerpc.dcerpchdrudp.fraglen) {
 		sstate->bytesprocessed = 0;
 	}
+	DCERPCThreadCtxCountTruncated(local_data, &sstate->dcerpc.stub_truncated);
 	if (pstate == NULL)
 		SCReturnInt(-1);
 
@@ -705,11 +708,13 @@ static void DCERPCUDPStateFree(void *s) {
         SCFree(sstate->dcerpc.dcerpcrequest.stub_data_buffer);
         sstate->dcerpc.dcerpcrequest.stub_data_buffer = NULL;
         sstate->dcerpc.dcerpcrequest.stub_data_buffer_len = 0;
+        sstate->dcerpc.dcerpcrequest.stub_data_buffer_size = 0;
     }
     if (sstate->dcerpc.dcerpcresponse.stub_data_buffer != NULL) {
         SCFree(sstate->dcerpc.dcerpcresponse.stub_data_buffer);
         sstate->dcerpc.dcerpcresponse.stub_data_buffer = NULL;
         sstate->dcerpc.dcerpcresponse.stub_data_buffer_len = 0;
+        sstate->dcerpc.dcerpcresponse.stub_data_buffer_size = 0;
     }
 	if (s) {
 		SCFree(s);
@@ -729,6 +734,8 @@ void RegisterDCERPCUDPParsers(void) {
 			DCERPCUDPParse);
 	AppLayerRegisterStateFuncs(ALPROTO_DCERPC_UDP, DCERPCUDPStateAlloc,
 			DCERPCUDPStateFree);
+	AppLayerRegisterLocalStorageFunc(ALPROTO_DCERPC_UDP, DCERPCThreadCtxAlloc,
+			DCERPCThreadCtxFree);
 }
 
 /* UNITTESTS */
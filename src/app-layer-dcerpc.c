@@ -44,6 +44,8 @@
 #include "debug.h"
 #include "decode.h"
 #include "threads.h"
+#include "threadvars.h"
+#include "counters.h"
 
 #include "util-print.h"
 #include "util-pool.h"
@@ -63,6 +65,8 @@
 
 #include "util-spm.h"
 #include "util-unittest.h"
+#include "util-misc.h"
+#include "conf.h"
 
 #include "app-layer-dcerpc.h"
 
@@ -76,6 +80,146 @@ enum {
     DCERPC_FIELD_MAX,
 };
 
+/** smallest allocation for a stub data buffer */
+#define DCERPC_STUB_DATA_MIN_SIZE       4096
+/** default max size of a stub data buffer, per direction */
+#define DCERPC_STUB_DATA_DEFAULT_MAX    (1024 * 1024)
+
+/** max bytes of stub data buffered per direction, set through
+ *  dcerpc.stub-data-max-size. Shared by the TCP, UDP and SMB parsers. */
+static uint32_t dcerpc_stub_data_max = DCERPC_STUB_DATA_DEFAULT_MAX;
+
+/** per thread parser storage, shared by the TCP, UDP and SMB parsers */
+typedef struct DCERPCThreadCtx_ {
+    ThreadVars *tv;
+    /** stub fragments (partly) not buffered because of
+     *  dcerpc_stub_data_max */
+    uint16_t counter_stub_truncated;
+} DCERPCThreadCtx;
+
+/**
+ *  \brief alloc the per thread parser storage and register its counters
+ *
+ *  Called at thread init, before the thread sets up its counter array.
+ */
+void *DCERPCThreadCtxAlloc(ThreadVars *tv)
+{
+    DCERPCThreadCtx *ctx = SCMalloc(sizeof(DCERPCThreadCtx));
+    if (unlikely(ctx == NULL))
+        return NULL;
+    memset(ctx, 0, sizeof(DCERPCThreadCtx));
+
+    ctx->tv = tv;
+    if (tv != NULL) {
+        ctx->counter_stub_truncated =
+            SCPerfTVRegisterCounter("dcerpc.stub_truncated", tv,
+                                    SC_PERF_TYPE_UINT64, "NULL");
+    }
+    return ctx;
+}
+
+void DCERPCThreadCtxFree(void *data)
+{
+    if (data != NULL)
+        SCFree(data);
+}
+
+/**
+ *  \brief add the truncations a flow's parser counted to the thread's
+ *         counter and clear them
+ *
+ *  \param data the parser's local storage, may be NULL
+ *  \param truncated the flow's pending truncation count
+ */
+void DCERPCThreadCtxCountTruncated(void *data, uint16_t *truncated)
+{
+    DCERPCThreadCtx *ctx = (DCERPCThreadCtx *)data;
+
+    if (*truncated == 0)
+        return;
+    if (ctx != NULL && ctx->tv != NULL) {
+        SCPerfCounterAddUI64(ctx->counter_stub_truncated,
+                             ctx->tv->sc_perf_pca, *truncated);
+    }
+    *truncated = 0;
+}
+
+/**
+ *  \brief append stub data to a request/response stub buffer
+ *
+ *  The buffer grows geometrically, so a PDU fragmented over many frags
+ *  doesn't realloc and copy the whole stub for each of them. Data beyond
+ *  dcerpc.stub-data-max-size is not buffered.
+ *
+ *  \param buffer pointer to the stub buffer, may point to NULL
+ *  \param len pointer to the used length of the buffer
+ *  \param size pointer to the allocated size of the buffer
+ *  \param data stub data to add
+ *  \param data_len length of data
+ *  \param truncated incremented if data is not (fully) buffered
+ *
+ *  \retval bytes of data that were added to the buffer
+ */
+uint32_t DCERPCStubDataAppend(uint8_t **buffer, uint32_t *len, uint32_t *size,
+                              const uint8_t *data, uint32_t data_len,
+                              uint16_t *truncated)
+{
+    uint32_t add = data_len;
+
+    if (*len >= dcerpc_stub_data_max || add > dcerpc_stub_data_max - *len) {
+        add = (*len >= dcerpc_stub_data_max) ? 0 : dcerpc_stub_data_max - *len;
+        if (*truncated < UINT16_MAX)
+            (*truncated)++;
+        SCLogDebug("stub data truncated at %"PRIu32" bytes", dcerpc_stub_data_max);
+        if (add == 0)
+            return 0;
+    }
+
+    if (*buffer == NULL || *len + add > *size) {
+        uint32_t new_size = (*buffer == NULL || *size == 0) ?
+                             DCERPC_STUB_DATA_MIN_SIZE : *size;
+
+        while (new_size < *len + add) {
+            if (new_size > (UINT32_MAX / 2)) {
+                new_size = *len + add;
+                break;
+            }
+            new_size *= 2;
+        }
+        if (new_size > dcerpc_stub_data_max)
+            new_size = dcerpc_stub_data_max;
+
+        uint8_t *ptr = SCRealloc(*buffer, new_size);
+        if (ptr == NULL) {
+            SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
+            return 0;
+        }
+        *buffer = ptr;
+        *size = new_size;
+    }
+
+    memcpy(*buffer + *len, data, add);
+    *len += add;
+    return add;
+}
+
+/** \brief read the dcerpc config */
+static void DCERPCParseConfig(void) {
+    char *str = NULL;
+
+    if (ConfGet("dcerpc.stub-data-max-size", &str) == 1 && str != NULL) {
+        uint32_t max = 0;
+        if (ParseSizeStringU32(str, &max) < 0 || max == 0) {
+            SCLogError(SC_ERR_SIZE_PARSE, "Error parsing dcerpc.stub-data-max-size "
+                       "from conf file - %s.  Killing engine", str);
+            exit(EXIT_FAILURE);
+        }
+        dcerpc_stub_data_max = max;
+    }
+
+    SCLogDebug("dcerpc stub data max size %"PRIu32, dcerpc_stub_data_max);
+}
+
 /* \brief hexdump function from libdnet, used for debugging only */
 void hexdump(/*Flow *f,*/ const void *buf, size_t len) {
     /* dumps len bytes of *buf to stdout. Looks like:
@@ -1085,6 +1229,7 @@ static uint32_t StubDataParser(DCERPC *dcerpc, uint8_t *input, uint32_t input_le
     SCEnter();
     uint8_t **stub_data_buffer = NULL;
     uint32_t *stub_data_buffer_len = NULL;
+    uint32_t *stub_data_buffer_size = NULL;
     uint8_t *stub_data_fresh = NULL;
     uint16_t stub_len = 0;
 
@@ -1092,12 +1237,14 @@ static uint32_t StubDataParser(DCERPC *dcerpc, uint8_t *input, uint32_t input_le
     if (dcerpc->dcerpchdr.type == REQUEST) {
         stub_data_buffer = &dcerpc->dcerpcrequest.stub_data_buffer;
         stub_data_buffer_len = &dcerpc->dcerpcrequest.stub_data_buffer_len;
+        stub_data_buffer_size = &dcerpc->dcerpcrequest.stub_data_buffer_size;
         stub_data_fresh = &dcerpc->dcerpcrequest.stub_data_fresh;
 
     /* response PDU.  Retrieve the response stub buffer */
     } else {
         stub_data_buffer = &dcerpc->dcerpcresponse.stub_data_buffer;
         stub_data_buffer_len = &dcerpc->dcerpcresponse.stub_data_buffer_len;
+        stub_data_buffer_size = &dcerpc->dcerpcresponse.stub_data_buffer_size;
         stub_data_fresh = &dcerpc->dcerpcresponse.stub_data_fresh;
     }
 
@@ -1133,16 +1280,15 @@ static uint32_t StubDataParser(DCERPC *dcerpc, uint8_t *input, uint32_t input_le
         dcerpc->pdu_fragged = 1;
     }
 
-    *stub_data_buffer = SCRealloc(*stub_data_buffer, *stub_data_buffer_len + stub_len);
+    /* data past the max stub size is consumed, but not buffered */
+    (void)DCERPCStubDataAppend(stub_data_buffer, stub_data_buffer_len,
+                               stub_data_buffer_size, input, stub_len,
+                               &dcerpc->stub_truncated);
     if (*stub_data_buffer == NULL) {
-        SCLogError(SC_ERR_MEM_ALLOC, "Error allocating memory");
         goto end;
     }
-    memcpy(*stub_data_buffer + *stub_data_buffer_len, input, stub_len);
 
     *stub_data_fresh = 1;
-    /* length of the buffered stub */
-    *stub_data_buffer_len += stub_len;
     /* To see the total reassembled stubdata */
     //hexdump(*stub_data_buffer, *stub_data_buffer_len);
 
@@ -1786,6 +1932,7 @@ static int DCERPCParse(Flow *f, void *dcerpc_state,
     }
 
     retval = DCERPCParser(&sstate->dcerpc, input, input_len);
+    DCERPCThreadCtxCountTruncated(local_data, &sstate->dcerpc.stub_truncated);
     if (retval == -1) {
         SCReturnInt(0);
     }
@@ -1853,11 +2000,13 @@ static void DCERPCStateFree(void *s) {
         SCFree(sstate->dcerpc.dcerpcrequest.stub_data_buffer);
         sstate->dcerpc.dcerpcrequest.stub_data_buffer = NULL;
         sstate->dcerpc.dcerpcrequest.stub_data_buffer_len = 0;
+        sstate->dcerpc.dcerpcrequest.stub_data_buffer_size = 0;
     }
     if (sstate->dcerpc.dcerpcresponse.stub_data_buffer != NULL) {
         SCFree(sstate->dcerpc.dcerpcresponse.stub_data_buffer);
         sstate->dcerpc.dcerpcresponse.stub_data_buffer = NULL;
         sstate->dcerpc.dcerpcresponse.stub_data_buffer_len = 0;
+        sstate->dcerpc.dcerpcresponse.stub_data_buffer_size = 0;
     }
 
     if (s) {
@@ -1894,6 +2043,10 @@ void RegisterDCERPCParsers(void) {
             DCERPCStateFree);
     AppLayerRegisterTransactionIdFuncs(ALPROTO_DCERPC,
             DCERPCUpdateTransactionId, NULL);
+    AppLayerRegisterLocalStorageFunc(ALPROTO_DCERPC, DCERPCThreadCtxAlloc,
+            DCERPCThreadCtxFree);
+
+    DCERPCParseConfig();
 }
 
 /* UNITTESTS */
@@ -6018,6 +6171,120 @@ end:
     return result;
 }
 
+/**
+ * \test Stub data buffer growth and truncation at the max stub size.
+ */
+int DCERPCParserTest20(void)
+{
+    int result = 0;
+    uint8_t frag[1000];
+    uint8_t *buffer = NULL;
+    uint32_t len = 0;
+    uint32_t size = 0;
+    uint32_t max = dcerpc_stub_data_max;
+    uint16_t truncated = 0;
+    int i;
+
+    memset(frag, 'a', sizeof(frag));
+    dcerpc_stub_data_max = 10000;
+
+    for (i = 0; i < 9; i++) {
+        if (DCERPCStubDataAppend(&buffer, &len, &size, frag, sizeof(frag), &truncated) != sizeof(frag)) {
+            printf("frag %d not added: ", i);
+            goto end;
+        }
+    }
+    /* 4096 -> 8192 -> capped at 10000 */
+    if (len != 9000 || size != 10000) {
+        printf("len %"PRIu32" (expected 9000), size %"PRIu32" (expected 10000): ",
+                len, size);
+        goto end;
+    }
+
+    /* exact fit */
+    if (DCERPCStubDataAppend(&buffer, &len, &size, frag, sizeof(frag), &truncated) != sizeof(frag) ||
+        len != 10000) {
+        printf("expected a full buffer: ");
+        goto end;
+    }
+    if (truncated != 0) {
+        printf("exact fit counted as truncation: ");
+        goto end;
+    }
+
+    /* full buffer: nothing is added */
+    if (DCERPCStubDataAppend(&buffer, &len, &size, frag, 500, &truncated) != 0 || len != 10000) {
+        printf("data added to a full buffer: ");
+        goto end;
+    }
+
+    /* partial fit */
+    len = 9500;
+    if (DCERPCStubDataAppend(&buffer, &len, &size, frag, sizeof(frag), &truncated) != 500 ||
+        len != 10000) {
+        printf("expected 500 bytes to be added: ");
+        goto end;
+    }
+    if (truncated != 2) {
+        printf("truncations not counted: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    dcerpc_stub_data_max = max;
+    if (buffer != NULL)
+        SCFree(buffer);
+    return result;
+}
+
+/**
+ * \test Truncations are added to the thread's counter.
+ */
+int DCERPCParserTest21(void)
+{
+    int result = 0;
+    ThreadVars tv;
+    DCERPCThreadCtx *ctx = NULL;
+    uint16_t truncated = 3;
+
+    memset(&tv, 0, sizeof(ThreadVars));
+    tv.name = "DCERPCParserTest21";
+
+    ctx = DCERPCThreadCtxAlloc(&tv);
+    if (ctx == NULL || ctx->counter_stub_truncated == 0) {
+        printf("counter not registered: ");
+        goto end;
+    }
+    tv.sc_perf_pca = SCPerfGetAllCountersArray(&tv, &tv.sc_perf_pctx);
+    if (tv.sc_perf_pca == NULL)
+        goto end;
+
+    DCERPCThreadCtxCountTruncated(ctx, &truncated);
+    truncated = 2;
+    DCERPCThreadCtxCountTruncated(ctx, &truncated);
+    /* no thread storage: the count is dropped */
+    truncated = 1;
+    DCERPCThreadCtxCountTruncated(NULL, &truncated);
+
+    if (truncated != 0) {
+        printf("pending count not cleared: ");
+        goto end;
+    }
+    if (tv.sc_perf_pca->head[ctx->counter_stub_truncated].ui64_cnt != 5) {
+        printf("counter %"PRIu64" (expected 5): ",
+               tv.sc_perf_pca->head[ctx->counter_stub_truncated].ui64_cnt);
+        goto end;
+    }
+
+    result = 1;
+end:
+    DCERPCThreadCtxFree(ctx);
+    SCPerfReleasePerfCounterS(tv.sc_perf_pctx.head);
+    SCPerfReleasePCA(tv.sc_perf_pca);
+    return result;
+}
+
 #endif /* UNITTESTS */
 
 void DCERPCParserRegisterTests(void) {
@@ -6041,6 +6308,8 @@ void DCERPCParserRegisterTests(void) {
     UtRegisterTest("DCERPCParserTest17", DCERPCParserTest17, 1);
     UtRegisterTest("DCERPCParserTest18", DCERPCParserTest18, 1);
     UtRegisterTest("DCERPCParserTest19", DCERPCParserTest19, 1);
+    UtRegisterTest("DCERPCParserTest20", DCERPCParserTest20, 1);
+    UtRegisterTest("DCERPCParserTest21", DCERPCParserTest21, 1);
 #endif /* UNITTESTS */
 
     return;
@@ -719,7 +719,7 @@ void *AppLayerDetectProtoThread(void *td)
         }
 
         if (TmThreadsCheckFlag(tv, THV_KILL)) {
-            SCPerfSyncCounters(tv, 0);
+            SCPerfSyncCounters(tv);
             run = 0;
         }
     }
@@ -71,6 +71,7 @@
 #include "conf.h"
 
 #include "util-memcmp.h"
+#include "util-line.h"
 
 #ifndef HAVE_HTP_SET_PATH_DECODE_U_ENCODING
 void htp_config_set_path_decode_u_encoding(htp_cfg_t *cfg, int decode_u_encoding);
@@ -1167,7 +1168,7 @@ static void HtpRequestBodyMultipartParseHeader(HtpState *hstate,
 #endif
 
     while (header_len > 0) {
-        uint8_t *next_line = Bs2bmSearch(header, header_len, (uint8_t *)"\r\n", 2);
+        uint8_t *next_line = SCLineFindCRLF(header, header_len);
         uint8_t *line = header;
         uint32_t line_len;
 
@@ -54,6 +54,7 @@
 #include "app-layer-smtp.h"
 
 #include "util-spm.h"
+#include "util-line.h"
 
 #include "util-debug.h"
 #include "decode-events.h"
@@ -357,6 +358,24 @@ int AlpParseFieldByEOF(AppLayerParserResult *output, AppLayerParserState *pstate
     SCReturnInt(0);
 }
 
+/**
+ * \internal
+ * \brief Find a delimiter in the input. The common single byte and CRLF
+ *        delimiters of the line based protocols use the vectorized line
+ *        scanners, anything else goes through the spm.
+ */
+static inline uint8_t *AlpFindDelimiter(uint8_t *input, uint32_t input_len,
+                                        const uint8_t *delim, uint8_t delim_len)
+{
+    if (delim_len == 1) {
+        return SCLineFindByte(input, input_len, delim[0]);
+    } else if (delim_len == 2 && delim[0] == 0x0d && delim[1] == 0x0a) {
+        return SCLineFindCRLF(input, input_len);
+    }
+
+    return SpmSearch(input, input_len, (uint8_t *)delim, delim_len);
+}
+
 /** \brief Parse a field up to a delimeter.
  *
  * \retval  1 Field found and stored.
@@ -372,7 +391,7 @@ int AlpParseFieldByDelimiter(AppLayerParserResult *output, AppLayerParserState *
                 pstate->store_len, delim_len);
 
     if (pstate->store_len == 0) {
-        uint8_t *ptr = SpmSearch(input, input_len, (uint8_t*)delim, delim_len);
+        uint8_t *ptr = AlpFindDelimiter(input, input_len, delim, delim_len);
         if (ptr != NULL) {
             uint32_t len = ptr - input;
             SCLogDebug(" len %" PRIu32 "", len);
@@ -401,7 +420,7 @@ int AlpParseFieldByDelimiter(AppLayerParserResult *output, AppLayerParserState *
             pstate->store_len = input_len;
         }
     } else {
-        uint8_t *ptr = SpmSearch(input, input_len, (uint8_t*)delim, delim_len);
+        uint8_t *ptr = AlpFindDelimiter(input, input_len, delim, delim_len);
         if (ptr != NULL) {
             uint32_t len = ptr - input;
             SCLogDebug("len %" PRIu32 " + %" PRIu32 " = %" PRIu32 "", len,
@@ -442,8 +461,8 @@ int AlpParseFieldByDelimiter(AppLayerParserResult *output, AppLayerParserState *
                     SCLogDebug("input_len < delim_len, checking pstate->store");
 
                     if (pstate->store_len >= delim_len) {
-                        ptr = SpmSearch(pstate->store, pstate->store_len, (uint8_t*)delim,
-                                        delim_len);
+                        ptr = AlpFindDelimiter(pstate->store, pstate->store_len,
+                                                 delim, delim_len);
                         if (ptr != NULL) {
                             SCLogDebug("now we found the delim");
 
@@ -489,7 +508,7 @@ int AlpParseFieldByDelimiter(AppLayerParserResult *output, AppLayerParserState *
             if (delim_len > input_len && delim_len <= pstate->store_len) {
                 SCLogDebug("input_len < delim_len, checking pstate->store");
 
-                ptr = SpmSearch(pstate->store, pstate->store_len, (uint8_t*)delim, delim_len);
+                ptr = AlpFindDelimiter(pstate->store, pstate->store_len, delim, delim_len);
                 if (ptr != NULL) {
                     SCLogDebug("now we found the delim");
 
@@ -690,8 +709,8 @@ void AppLayerRegisterLogger(uint16_t proto) {
 
 AppLayerParserStateStore *AppLayerParserStateStoreAlloc(void)
 {
-    AppLayerParserStateStore *s = (AppLayerParserStateStore *)SCMalloc
-                                    (sizeof(AppLayerParserStateStore));
+    AppLayerParserStateStore *s = (AppLayerParserStateStore *)SCRegionMalloc
+                                    (MEM_REGION_APPLAYER, sizeof(AppLayerParserStateStore));
     if (s == NULL)
         return NULL;
 
@@ -715,7 +734,7 @@ void AppLayerParserStateStoreFree(AppLayerParserStateStore *s)
         AppLayerDecoderEventsFreeEvents(s->decoder_events);
     s->decoder_events = NULL;
 
-    SCFree(s);
+    SCRegionFree(s);
 }
 
 static void AppLayerParserResultCleanup(AppLayerParserResult *result)
@@ -990,6 +1009,14 @@ int AppLayerParse(void *local_data, Flow *f, uint8_t proto,
         }
     }
 
+    /* the parser is done with this direction for good, let the stream
+     * engine stop reassembling and storing its segments */
+    if (parser_state->flags & APP_LAYER_PARSER_BYPASS) {
+        if (ssn != NULL && f->proto == IPPROTO_TCP) {
+            StreamTcpSetSessionBypassFlag(ssn, flags & STREAM_TOCLIENT ? 1 : 0);
+        }
+    }
+
     /* update the transaction id */
     if (p->StateUpdateTransactionId != NULL) {
         p->StateUpdateTransactionId(app_layer_state, &parser_state_store->avail_id);
@@ -91,6 +91,10 @@ typedef struct AppLayerParserResult_ {
 #define APP_LAYER_PARSER_NO_REASSEMBLY  0x10    /**< Flag to indicate no more
                                                      packets reassembly for this
                                                      session */
+#define APP_LAYER_PARSER_BYPASS         0x20    /**< Flag to indicate nothing
+                                                     in this direction needs
+                                                     parsing, reassembly or
+                                                     inspection anymore */
 
 #define APP_LAYER_TRANSACTION_EOF       0x01    /**< Session done, last transaction
                                                      as well */
@@ -1056,6 +1056,9 @@ static int SMBParse(Flow *f, void *smb_state, AppLayerParserState *pstate,
     int hdrretval = 0;
     int counter = 0;
 
+    /* stub truncations left pending by an early return of the last call */
+    DCERPCThreadCtxCountTruncated(local_data, &sstate->dcerpc.stub_truncated);
+
     if (pstate == NULL) {
         SCLogDebug("pstate == NULL");
         SCReturnInt(0);
@@ -1260,6 +1263,7 @@ static int SMBParse(Flow *f, void *smb_state, AppLayerParserState *pstate,
     pstate->parse_field = 0;
 
     sstate->data_needed_for_dir = dir;
+    DCERPCThreadCtxCountTruncated(local_data, &sstate->dcerpc.stub_truncated);
     SCReturnInt(1);
 }
 
@@ -1339,11 +1343,13 @@ static void SMBStateFree(void *s) {
         SCFree(sstate->dcerpc.dcerpcrequest.stub_data_buffer);
         sstate->dcerpc.dcerpcrequest.stub_data_buffer = NULL;
         sstate->dcerpc.dcerpcrequest.stub_data_buffer_len = 0;
+        sstate->dcerpc.dcerpcrequest.stub_data_buffer_size = 0;
     }
     if (sstate->dcerpc.dcerpcresponse.stub_data_buffer != NULL) {
         SCFree(sstate->dcerpc.dcerpcresponse.stub_data_buffer);
         sstate->dcerpc.dcerpcresponse.stub_data_buffer = NULL;
         sstate->dcerpc.dcerpcresponse.stub_data_buffer_len = 0;
+        sstate->dcerpc.dcerpcresponse.stub_data_buffer_size = 0;
     }
 
     if (s) {
@@ -1425,6 +1431,8 @@ void RegisterSMBParsers(void) {
     AppLayerRegisterStateFuncs(ALPROTO_SMB, SMBStateAlloc, SMBStateFree);
     AppLayerRegisterTransactionIdFuncs(ALPROTO_SMB,
             SMBUpdateTransactionId, NULL);
+    AppLayerRegisterLocalStorageFunc(ALPROTO_SMB, DCERPCThreadCtxAlloc,
+            DCERPCThreadCtxFree);
 
     AppLayerRegisterProbingParser(&alp_proto_ctx,
                                   139,
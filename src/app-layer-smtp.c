@@ -42,6 +42,7 @@
 #include "util-byte.h"
 #include "util-unittest-helper.h"
 #include "util-memcmp.h"
+#include "util-line.h"
 #include "flow-util.h"
 
 #include "detect-engine.h"
@@ -187,209 +188,132 @@ SCEnumCharMap smtp_reply_map[ ] = {
 
 /**
  * \internal
- * \brief Get the next line from input.  It doesn't do any length validation.
+ * \brief Get the next line from input for one direction.  It doesn't do any
+ *        length validation.
+ *
+ *        Complete lines are returned as a pointer into the input (zero copy).
+ *        Only lines that are fragmented over multiple input chunks are
+ *        collected in the direction's partial line buffer.
  *
  * \param state The smtp state.
+ * \param db Partial line buffer of the direction.
+ * \param db_len Used length of the partial line buffer.
+ * \param db_size Allocated size of the partial line buffer.
+ * \param current_line_db Set if the current line lives in the buffer.
+ * \param current_line_lf_seen Set if we have seen the lf of the current line.
  *
  * \retval  0 On suceess.
  * \retval -1 Either when we don't have any new lines to supply anymore or
  *            on failure.
  */
-static int SMTPGetLine(SMTPState *state)
+static int SMTPGetLineDirection(SMTPState *state, uint8_t **db, int32_t *db_len,
+                                uint32_t *db_size, uint8_t *current_line_db,
+                                uint8_t *current_line_lf_seen)
 {
-    SCEnter();
+    if (*current_line_lf_seen == 1) {
+        /* we have seen the lf for the previous line.  Clear the parser
+         * details to parse new line */
+        *current_line_lf_seen = 0;
+        if (*current_line_db == 1) {
+            *current_line_db = 0;
+            SCFree(*db);
+            *db = NULL;
+            *db_len = 0;
+            *db_size = 0;
+            state->current_line = NULL;
+            state->current_line_len = 0;
+        }
+    }
 
-    /* we have run out of input */
-    if (state->input_len <= 0)
-        return -1;
+    uint8_t *lf_idx = SCLineFindLF(state->input, (uint32_t)state->input_len);
 
-    /* toserver */
-    if (state->direction == 0) {
-        if (state->ts_current_line_lf_seen == 1) {
-            /* we have seen the lf for the previous line.  Clear the parser
-             * details to parse new line */
-            state->ts_current_line_lf_seen = 0;
-            if (state->ts_current_line_db == 1) {
-                state->ts_current_line_db = 0;
-                SCFree(state->ts_db);
-                state->ts_db = NULL;
-                state->ts_db_len = 0;
-                state->current_line = NULL;
-                state->current_line_len = 0;
-            }
+    if (lf_idx == NULL) {
+        /* fragmented lines.  Decoder event for special cases.  Not all
+         * fragmented lines should be treated as a possible evasion
+         * attempt.  With multi payload smtp chunks we can have valid
+         * cases of fragmentation.  But within the same segment chunk
+         * if we see fragmentation then it's definitely something you
+         * should alert about */
+        if (SCLineBufferAppend(db, db_len, db_size, state->input,
+                               (uint32_t)state->input_len) < 0) {
+            return -1;
         }
+        *current_line_db = 1;
+        state->input += state->input_len;
+        state->input_len = 0;
 
-        uint8_t *lf_idx = memchr(state->input, 0x0a, state->input_len);
-
-        if (lf_idx == NULL) {
-            /* fragmented lines.  Decoder event for special cases.  Not all
-             * fragmented lines should be treated as a possible evasion
-             * attempt.  With multi payload smtp chunks we can have valid
-             * cases of fragmentation.  But within the same segment chunk
-             * if we see fragmentation then it's definitely something you
-             * should alert about */
-            if (state->ts_current_line_db == 0) {
-                state->ts_db = SCMalloc(state->input_len);
-                if (state->ts_db == NULL) {
-                    return -1;
-                }
-                state->ts_current_line_db = 1;
-                memcpy(state->ts_db, state->input, state->input_len);
-                state->ts_db_len = state->input_len;
-            } else {
-                state->ts_db = SCRealloc(state->ts_db, (state->ts_db_len +
-                                                        state->input_len));
-                if (state->ts_db == NULL) {
-                    return -1;
-                }
-                memcpy(state->ts_db + state->ts_db_len,
-                       state->input, state->input_len);
-                state->ts_db_len += state->input_len;
-            } /* else */
-            state->input += state->input_len;
-            state->input_len = 0;
+        return -1;
+    }
+
+    *current_line_lf_seen = 1;
 
+    if (*current_line_db == 1) {
+        if (SCLineBufferAppend(db, db_len, db_size, state->input,
+                               (uint32_t)(lf_idx + 1 - state->input)) < 0) {
             return -1;
+        }
 
+        if (*db_len > 1 && (*db)[*db_len - 2] == 0x0D) {
+            *db_len -= 2;
+            state->current_line_delimiter_len = 2;
         } else {
-            state->ts_current_line_lf_seen = 1;
-
-            if (state->ts_current_line_db == 1) {
-                state->ts_db = SCRealloc(state->ts_db,
-                                         (state->ts_db_len +
-                                          (lf_idx + 1 - state->input)));
-                if (state->ts_db == NULL) {
-                    return -1;
-                }
-                memcpy(state->ts_db + state->ts_db_len,
-                       state->input, (lf_idx + 1 - state->input));
-                state->ts_db_len += (lf_idx + 1 - state->input);
-
-                if (state->ts_db_len > 1 &&
-                    state->ts_db[state->ts_db_len - 2] == 0x0D) {
-                    state->ts_db_len -= 2;
-                    state->current_line_delimiter_len = 2;
-                } else {
-                    state->ts_db_len -= 1;
-                    state->current_line_delimiter_len = 1;
-                }
-
-                state->current_line = state->ts_db;
-                state->current_line_len = state->ts_db_len;
-
-            } else {
-                state->current_line = state->input;
-                state->current_line_len = lf_idx - state->input;
-
-                if (state->input != lf_idx &&
-                    *(lf_idx - 1) == 0x0D) {
-                    state->current_line_len--;
-                    state->current_line_delimiter_len = 2;
-                } else {
-                    state->current_line_delimiter_len = 1;
-                }
-            }
-
-            state->input_len -= (lf_idx - state->input) + 1;
-            state->input = (lf_idx + 1);
-
-            return 0;
+            *db_len -= 1;
+            state->current_line_delimiter_len = 1;
         }
 
-        /* toclient */
+        state->current_line = *db;
+        state->current_line_len = *db_len;
+
     } else {
-        if (state->tc_current_line_lf_seen == 1) {
-            /* we have seen the lf for the previous line.  Clear the parser
-             * details to parse new line */
-            state->tc_current_line_lf_seen = 0;
-            if (state->tc_current_line_db == 1) {
-                state->tc_current_line_db = 0;
-                SCFree(state->tc_db);
-                state->tc_db = NULL;
-                state->tc_db_len = 0;
-                state->current_line = NULL;
-                state->current_line_len = 0;
-            }
+        state->current_line = state->input;
+        state->current_line_len = lf_idx - state->input;
+
+        if (state->input != lf_idx &&
+            *(lf_idx - 1) == 0x0D) {
+            state->current_line_len--;
+            state->current_line_delimiter_len = 2;
+        } else {
+            state->current_line_delimiter_len = 1;
         }
+    }
 
-        uint8_t *lf_idx = memchr(state->input, 0x0a, state->input_len);
-
-        if (lf_idx == NULL) {
-            /* fragmented lines.  Decoder event for special cases.  Not all
-             * fragmented lines should be treated as a possible evasion
-             * attempt.  With multi payload smtp chunks we can have valid
-             * cases of fragmentation.  But within the same segment chunk
-             * if we see fragmentation then it's definitely something you
-             * should alert about */
-            if (state->tc_current_line_db == 0) {
-                state->tc_db = SCMalloc(state->input_len);
-                if (state->tc_db == NULL) {
-                    return -1;
-                }
-                state->tc_current_line_db = 1;
-                memcpy(state->tc_db, state->input, state->input_len);
-                state->tc_db_len = state->input_len;
-            } else {
-                state->tc_db = SCRealloc(state->tc_db, (state->tc_db_len +
-                                                        state->input_len));
-                if (state->tc_db == NULL) {
-                    return -1;
-                }
-                memcpy(state->tc_db + state->tc_db_len,
-                       state->input, state->input_len);
-                state->tc_db_len += state->input_len;
-            } /* else */
-            state->input += state->input_len;
-            state->input_len = 0;
+    state->input_len -= (lf_idx - state->input) + 1;
+    state->input = (lf_idx + 1);
 
-            return -1;
+    return 0;
+}
 
-        } else {
-            state->tc_current_line_lf_seen = 1;
-
-            if (state->tc_current_line_db == 1) {
-                state->tc_db = SCRealloc(state->tc_db,
-                                         (state->tc_db_len +
-                                          (lf_idx + 1 - state->input)));
-                if (state->tc_db == NULL) {
-                    return -1;
-                }
-                memcpy(state->tc_db + state->tc_db_len,
-                       state->input, (lf_idx + 1 - state->input));
-                state->tc_db_len += (lf_idx + 1 - state->input);
-
-                if (state->tc_db_len > 1 &&
-                    state->tc_db[state->tc_db_len - 2] == 0x0D) {
-                    state->tc_db_len -= 2;
-                    state->current_line_delimiter_len = 2;
-                } else {
-                    state->tc_db_len -= 1;
-                    state->current_line_delimiter_len = 1;
-                }
-
-                state->current_line = state->tc_db;
-                state->current_line_len = state->tc_db_len;
-
-            } else {
-                state->current_line = state->input;
-                state->current_line_len = lf_idx - state->input;
-
-                if (state->input != lf_idx &&
-                    *(lf_idx - 1) == 0x0D) {
-                    state->current_line_len--;
-                    state->current_line_delimiter_len = 2;
-                } else {
-                    state->current_line_delimiter_len = 1;
-                }
-            }
+/**
+ * \internal
+ * \brief Get the next line from input.  It doesn't do any length validation.
+ *
+ * \param state The smtp state.
+ *
+ * \retval  0 On suceess.
+ * \retval -1 Either when we don't have any new lines to supply anymore or
+ *            on failure.
+ */
+static int SMTPGetLine(SMTPState *state)
+{
+    SCEnter();
 
-            state->input_len -= (lf_idx - state->input) + 1;
-            state->input = (lf_idx + 1);
+    /* we have run out of input */
+    if (state->input_len <= 0)
+        return -1;
 
-            return 0;
-        } /* else - if (lf_idx == NULL) */
+    /* toserver */
+    if (state->direction == 0) {
+        return SMTPGetLineDirection(state, &state->ts_db, &state->ts_db_len,
+                                    &state->ts_db_size,
+                                    &state->ts_current_line_db,
+                                    &state->ts_current_line_lf_seen);
+    /* toclient */
+    } else {
+        return SMTPGetLineDirection(state, &state->tc_db, &state->tc_db_len,
+                                    &state->tc_db_size,
+                                    &state->tc_current_line_db,
+                                    &state->tc_current_line_lf_seen);
     }
-
 }
 
 static int SMTPInsertCommandIntoCommandBuffer(uint8_t command, SMTPState *state, Flow *f)
@@ -71,6 +71,9 @@ SCEnumCharMap tls_decoder_event_table[ ] = {
 
 typedef struct SslConfig_ {
     int no_reassemble;
+    /** stop all processing of a direction once it carries encrypted
+     *  application data */
+    int bypass_encrypted;
 } SslConfig;
 
 SslConfig ssl_config;
@@ -577,6 +580,15 @@ static int SSLv2Decode(uint8_t direction, SSLState *ssl_state,
                     SCLogDebug("SSLv2 Server side has started the encryption");
                 }
 
+                if (ssl_config.bypass_encrypted == 1 &&
+                    (ssl_state->flags & (direction ? SSL_AL_FLAG_SSL_SERVER_SSN_ENCRYPTED :
+                                                     SSL_AL_FLAG_SSL_CLIENT_SSN_ENCRYPTED))) {
+                    pstate->flags |= APP_LAYER_PARSER_DONE;
+                    pstate->flags |= APP_LAYER_PARSER_BYPASS;
+                    SCLogDebug("SSLv2 %s encrypted, bypassing",
+                               direction ? "toclient" : "toserver");
+                }
+
                 if ((ssl_state->flags & SSL_AL_FLAG_SSL_CLIENT_SSN_ENCRYPTED) &&
                     (ssl_state->flags & SSL_AL_FLAG_SSL_SERVER_SSN_ENCRYPTED)) {
                     pstate->flags |= APP_LAYER_PARSER_DONE;
@@ -651,6 +663,17 @@ static int SSLv3Decode(uint8_t direction, SSLState *ssl_state,
         case SSLV3_ALERT_PROTOCOL:
             break;
         case SSLV3_APPLICATION_PROTOCOL:
+            /* this direction is encrypted from here on, nothing left for us
+             * or the detection engine to look at */
+            if (ssl_config.bypass_encrypted == 1 &&
+                (ssl_state->flags & (direction ? SSL_AL_FLAG_SERVER_CHANGE_CIPHER_SPEC :
+                                                 SSL_AL_FLAG_CLIENT_CHANGE_CIPHER_SPEC))) {
+                pstate->flags |= APP_LAYER_PARSER_DONE;
+                pstate->flags |= APP_LAYER_PARSER_BYPASS;
+                SCLogDebug("SSLv3 %s encrypted, bypassing",
+                           direction ? "toclient" : "toserver");
+            }
+
             if ((ssl_state->flags & SSL_AL_FLAG_CLIENT_CHANGE_CIPHER_SPEC) &&
                 (ssl_state->flags & SSL_AL_FLAG_SERVER_CHANGE_CIPHER_SPEC)) {
                 /* set flags */
@@ -994,6 +1017,9 @@ void RegisterSSLParsers(void)
     if (ConfGetBool("tls.no-reassemble", &ssl_config.no_reassemble) != 1)
         ssl_config.no_reassemble = 1;
 
+    if (ConfGetBool("tls.bypass-encrypted", &ssl_config.bypass_encrypted) != 1)
+        ssl_config.bypass_encrypted = 0;
+
     return;
 }
 
@@ -3144,6 +3170,68 @@ end:
     return result;
 }
 
+/**
+ * \test Test the per direction bypass of encrypted application data.
+ */
+static int SSLParserTest25(void)
+{
+    int result = 0;
+    Flow f;
+    TcpSession ssn;
+    uint8_t ccs[] = { 0x14, 0x03, 0x01, 0x00, 0x01, 0x01 };
+    uint8_t app_data[] = { 0x17, 0x03, 0x01, 0x00, 0x04,
+                           0xde, 0xad, 0xbe, 0xef };
+
+    memset(&f, 0, sizeof(f));
+    memset(&ssn, 0, sizeof(ssn));
+    FLOW_INITIALIZE(&f);
+    f.protoctx = (void *)&ssn;
+    f.proto = IPPROTO_TCP;
+
+    StreamTcpInitConfig(TRUE);
+    ssl_config.bypass_encrypted = 1;
+
+    int r = AppLayerParse(NULL, &f, ALPROTO_TLS, STREAM_TOSERVER|STREAM_START,
+                          ccs, sizeof(ccs));
+    if (r != 0) {
+        printf("toserver ccs returned %" PRId32 ", expected 0: ", r);
+        goto end;
+    }
+    if (ssn.client.flags & STREAMTCP_STREAM_FLAG_BYPASS) {
+        printf("bypass set before app data: ");
+        goto end;
+    }
+
+    r = AppLayerParse(NULL, &f, ALPROTO_TLS, STREAM_TOSERVER, app_data,
+                      sizeof(app_data));
+    if (r != 0) {
+        printf("toserver app data returned %" PRId32 ", expected 0: ", r);
+        goto end;
+    }
+
+    if (!(ssn.client.flags & STREAMTCP_STREAM_FLAG_BYPASS) ||
+        !(ssn.client.flags & STREAMTCP_STREAM_FLAG_NOREASSEMBLY)) {
+        printf("toserver should be bypassed: ");
+        goto end;
+    }
+    /* server side hasn't switched to encryption */
+    if (ssn.server.flags & (STREAMTCP_STREAM_FLAG_BYPASS|STREAMTCP_STREAM_FLAG_NOREASSEMBLY)) {
+        printf("toclient should not be bypassed: ");
+        goto end;
+    }
+    if (f.flags & FLOW_NOPAYLOAD_INSPECTION) {
+        printf("flow should still be inspected: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    ssl_config.bypass_encrypted = 0;
+    StreamTcpFreeConfig(TRUE);
+    FLOW_DESTROY(&f);
+    return result;
+}
+
 #endif /* UNITTESTS */
 
 void SSLParserRegisterTests(void)
@@ -3175,6 +3263,7 @@ void SSLParserRegisterTests(void)
     UtRegisterTest("SSLParserTest22", SSLParserTest22, 1);
     UtRegisterTest("SSLParserTest23", SSLParserTest23, 1);
     UtRegisterTest("SSLParserTest24", SSLParserTest24, 1);
+    UtRegisterTest("SSLParserTest25", SSLParserTest25, 1);
 
     UtRegisterTest("SSLParserMultimsgTest01", SSLParserMultimsgTest01, 1);
     UtRegisterTest("SSLParserMultimsgTest02", SSLParserMultimsgTest02, 1);
@@ -0,0 +1,296 @@
+/* Copyright (C) 2007-2013 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * App layer thread module for the autofp runmodes.
+ *
+ * Normally the TCP app layer parsers run inline in the stream engine. If
+ * threading.app-layer-threads is set, the stream engine still runs the
+ * protocol detection, as the reassembly depends on its outcome, but copies
+ * the data for the parser into chunks attached to the packet. The packet
+ * is then passed on with the "flow" queue handler, so all packets of a
+ * flow end up in the same app layer thread, where the chunks are parsed
+ * in order before detection runs.
+ *
+ * Parser side effects on the session, like disabling reassembly, are seen
+ * by the stream engine a few packets later than in the inline case.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "conf.h"
+#include "decode.h"
+#include "threads.h"
+#include "threadvars.h"
+#include "tm-threads.h"
+#include "flow.h"
+#include "flow-util.h"
+
+#include "stream-tcp.h"
+#include "stream.h"
+
+#include "app-layer.h"
+#include "app-layer-thread.h"
+
+#include "util-debug.h"
+#include "util-unittest.h"
+#include "util-profiling.h"
+
+typedef struct AppLayerThreadData_ {
+    AlpProtoDetectThreadCtx dp_ctx;
+
+    uint16_t counter_chunks;
+} AppLayerThreadData;
+
+/** app layer data is deferred to the app layer threads */
+int app_layer_threads_active = 0;
+
+TmEcode AppLayerThread(ThreadVars *, Packet *, void *, PacketQueue *, PacketQueue *);
+TmEcode AppLayerThreadInit(ThreadVars *, void *, void **);
+TmEcode AppLayerThreadDeinit(ThreadVars *, void *);
+void AppLayerThreadRegisterTests(void);
+
+void TmModuleAppLayerRegister (void)
+{
+    tmm_modules[TMM_APPLAYER].name = "AppLayer";
+    tmm_modules[TMM_APPLAYER].ThreadInit = AppLayerThreadInit;
+    tmm_modules[TMM_APPLAYER].Func = AppLayerThread;
+    tmm_modules[TMM_APPLAYER].ThreadExitPrintStats = NULL;
+    tmm_modules[TMM_APPLAYER].ThreadDeinit = AppLayerThreadDeinit;
+    tmm_modules[TMM_APPLAYER].RegisterTests = AppLayerThreadRegisterTests;
+    tmm_modules[TMM_APPLAYER].cap_flags = 0;
+}
+
+/**
+ *  \brief get the number of app layer threads from the config
+ *
+ *  \retval cnt number of threads, 0 if the app layer runs in the
+ *              stream threads
+ */
+int AppLayerThreadsGetCount(void)
+{
+    intmax_t cnt = 0;
+
+    if (ConfGetInt("threading.app-layer-threads", &cnt) != 1)
+        return 0;
+
+    if (cnt < 0 || cnt > 1024) {
+        SCLogWarning(SC_ERR_INVALID_ARGUMENT, "invalid value %"PRIdMAX" for "
+                "threading.app-layer-threads, app layer will run in the "
+                "stream threads", cnt);
+        return 0;
+    }
+
+    return (int)cnt;
+}
+
+/**
+ *  \brief make the stream engine defer the app layer data
+ *
+ *  Called by the runmode before the threads are spawned.
+ */
+void AppLayerThreadsEnable(void)
+{
+    app_layer_threads_active = 1;
+}
+
+/**
+ *  \brief copy reassembled app layer data into a chunk on the packet
+ *
+ *  The flow must be locked by the caller.
+ *
+ *  \param p packet the data is passed along with
+ *  \param data data, may be NULL for the empty EOF msg
+ *  \param data_len length of data
+ *  \param flags STREAM_* flags
+ *
+ *  \retval 0 ok
+ *  \retval -1 error, app layer inspection is disabled for the flow
+ */
+int AppLayerDataChunkAppend(Packet *p, uint8_t *data, uint32_t data_len,
+                            uint8_t flags)
+{
+    AppLayerDataChunk *chunk = SCMalloc(sizeof(AppLayerDataChunk) + data_len);
+    if (unlikely(chunk == NULL)) {
+        /* parsing the rest of the stream would only produce garbage */
+        FlowSetSessionNoApplayerInspectionFlag(p->flow);
+        return -1;
+    }
+
+    chunk->next = NULL;
+    chunk->data_len = data_len;
+    chunk->flags = flags;
+    if (data_len > 0)
+        memcpy(chunk->data, data, data_len);
+
+    /* keep stream order, there are only a few chunks per packet */
+    AppLayerDataChunk **tail = &p->app_data;
+    while (*tail != NULL)
+        tail = &(*tail)->next;
+    *tail = chunk;
+    PACKET_SET_DIRTY(p, PKT_DIRTY_APPDATA);
+
+    return 0;
+}
+
+void AppLayerDataChunkFree(AppLayerDataChunk *chunk)
+{
+    while (chunk != NULL) {
+        AppLayerDataChunk *next = chunk->next;
+        SCFree(chunk);
+        chunk = next;
+    }
+}
+
+TmEcode AppLayerThread(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, PacketQueue *postpq)
+{
+    AppLayerThreadData *atd = (AppLayerThreadData *)data;
+    uint64_t cnt = 0;
+
+    if (p->app_data == NULL)
+        return TM_ECODE_OK;
+
+    if (p->flow != NULL) {
+        PACKET_PROFILING_APP_RESET(&atd->dp_ctx);
+
+        FLOWLOCK_WRLOCK(p->flow);
+        AppLayerDataChunk *chunk;
+        for (chunk = p->app_data; chunk != NULL; chunk = chunk->next) {
+            AppLayerParseTCPData(&atd->dp_ctx, p->flow,
+                    chunk->data_len ? chunk->data : NULL,
+                    chunk->data_len, chunk->flags);
+            cnt++;
+        }
+        FLOWLOCK_UNLOCK(p->flow);
+
+        PACKET_PROFILING_APP_STORE(&atd->dp_ctx, p);
+    }
+
+    AppLayerDataChunkFree(p->app_data);
+    p->app_data = NULL;
+
+    SCPerfCounterAddUI64(atd->counter_chunks, tv->sc_perf_pca, cnt);
+    return TM_ECODE_OK;
+}
+
+TmEcode AppLayerThreadInit(ThreadVars *tv, void *initdata, void **data)
+{
+    SCEnter();
+
+    AppLayerThreadData *atd = SCMalloc(sizeof(AppLayerThreadData));
+    if (unlikely(atd == NULL))
+        SCReturnInt(TM_ECODE_FAILED);
+    memset(atd, 0, sizeof(AppLayerThreadData));
+
+    AlpProtoFinalize2Thread(tv, &atd->dp_ctx);
+
+    atd->counter_chunks = SCPerfTVRegisterCounter("app_layer.chunks", tv,
+                                                  SC_PERF_TYPE_UINT64,
+                                                  "NULL");
+    tv->sc_perf_pca = SCPerfGetAllCountersArray(tv, &tv->sc_perf_pctx);
+    SCPerfAddToClubbedTMTable(tv->name, &tv->sc_perf_pctx);
+
+    *data = (void *)atd;
+    SCReturnInt(TM_ECODE_OK);
+}
+
+TmEcode AppLayerThreadDeinit(ThreadVars *tv, void *data)
+{
+    AppLayerThreadData *atd = (AppLayerThreadData *)data;
+    if (atd == NULL)
+        return TM_ECODE_OK;
+
+    AlpProtoDeFinalize2Thread(&atd->dp_ctx);
+    SCFree(atd);
+    return TM_ECODE_OK;
+}
+
+#ifdef UNITTESTS
+
+/** \test chunks are kept in stream order and consumed by the thread */
+static int AppLayerThreadTest01(void)
+{
+    int result = 0;
+    Packet *p = SCMalloc(SIZE_OF_PACKET);
+    if (unlikely(p == NULL))
+        return 0;
+    Flow f;
+    ThreadVars tv;
+    AppLayerThreadData atd;
+    uint8_t buf1[] = "abc";
+    uint8_t buf2[] = "defgh";
+
+    memset(p, 0, SIZE_OF_PACKET);
+    p->pkt = (uint8_t *)(p + 1);
+    memset(&f, 0, sizeof(Flow));
+    memset(&tv, 0, sizeof(ThreadVars));
+    memset(&atd, 0, sizeof(AppLayerThreadData));
+    FLOW_INITIALIZE(&f);
+    /* keep the parsers out of it */
+    f.flags |= FLOW_NO_APPLAYER_INSPECTION;
+    p->flow = &f;
+
+    if (AppLayerDataChunkAppend(p, buf1, 3, STREAM_TOSERVER|STREAM_START) != 0)
+        goto end;
+    if (AppLayerDataChunkAppend(p, buf2, 5, STREAM_TOSERVER) != 0)
+        goto end;
+    if (AppLayerDataChunkAppend(p, NULL, 0, STREAM_TOSERVER|STREAM_EOF) != 0)
+        goto end;
+
+    AppLayerDataChunk *chunk = p->app_data;
+    if (chunk == NULL || chunk->data_len != 3 || memcmp(chunk->data, "abc", 3) != 0) {
+        printf("first chunk wrong: ");
+        goto end;
+    }
+    chunk = chunk->next;
+    if (chunk == NULL || chunk->data_len != 5 || memcmp(chunk->data, "defgh", 5) != 0) {
+        printf("second chunk wrong: ");
+        goto end;
+    }
+    chunk = chunk->next;
+    if (chunk == NULL || chunk->data_len != 0 || !(chunk->flags & STREAM_EOF) ||
+        chunk->next != NULL) {
+        printf("third chunk wrong: ");
+        goto end;
+    }
+
+    if (AppLayerThread(&tv, p, &atd, NULL, NULL) != TM_ECODE_OK)
+        goto end;
+    if (p->app_data != NULL) {
+        printf("chunks not consumed: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    if (p->app_data != NULL)
+        AppLayerDataChunkFree(p->app_data);
+    FLOW_DESTROY(&f);
+    SCFree(p);
+    return result;
+}
+
+#endif /* UNITTESTS */
+
+void AppLayerThreadRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("AppLayerThreadTest01", AppLayerThreadTest01, 1);
+#endif /* UNITTESTS */
+}
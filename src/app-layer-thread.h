@@ -0,0 +1,45 @@
+/* Copyright (C) 2007-2013 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ */
+
+#ifndef __APP_LAYER_THREAD_H__
+#define __APP_LAYER_THREAD_H__
+
+#include "decode.h"
+
+/** chunk of reassembled data, in stream order, waiting for the app
+ *  layer thread of the flow */
+typedef struct AppLayerDataChunk_ {
+    struct AppLayerDataChunk_ *next;
+    uint32_t data_len;
+    uint8_t flags;              /**< STREAM_* flags */
+    uint8_t data[];
+} AppLayerDataChunk;
+
+/** set by the runmode when the app layer runs in its own threads */
+extern int app_layer_threads_active;
+
+int AppLayerThreadsGetCount(void);
+void AppLayerThreadsEnable(void);
+int AppLayerDataChunkAppend(Packet *, uint8_t *, uint32_t, uint8_t);
+
+void TmModuleAppLayerRegister(void);
+
+#endif /* __APP_LAYER_THREAD_H__ */
@@ -27,6 +27,7 @@
 
 #include "app-layer.h"
 #include "app-layer-detect-proto.h"
+#include "app-layer-thread.h"
 #include "stream-tcp-reassemble.h"
 #include "stream-tcp-private.h"
 #include "flow.h"
@@ -99,22 +100,28 @@ void *AppLayerGetProtoStateFromFlow(Flow *f) {
 extern AlpProtoDetectCtx alp_proto_ctx;
 
 /**
- *  \brief Handle a chunk of TCP data
- *
- *  If the protocol is yet unknown, the proto detection code is run first.
- *
- *  \param dp_ctx Thread app layer detect context
- *  \param f Flow
- *  \param ssn TCP Session
- *  \param data ptr to reassembled data
- *  \param data_len length of the data chunk
- *  \param flags control flags
+ *  \brief Run the parser of the detected protocol on a chunk of TCP data,
+ *         or defer it to the app layer thread of the flow.
  *
- *  \retval 0 ok
- *  \retval -1 error
+ *  \param defer_p packet to attach the data to, NULL to parse right away
  */
-int AppLayerHandleTCPData(AlpProtoDetectThreadCtx *dp_ctx, Flow *f,
-        TcpSession *ssn, uint8_t *data, uint32_t data_len, uint8_t flags)
+static inline int AppLayerParseTCPChunk(AlpProtoDetectThreadCtx *dp_ctx, Flow *f,
+        Packet *defer_p, uint8_t *data, uint32_t data_len, uint8_t flags)
+{
+    int r;
+
+    if (defer_p != NULL)
+        return AppLayerDataChunkAppend(defer_p, data, data_len, flags);
+
+    PACKET_PROFILING_APP_START(dp_ctx, f->alproto);
+    r = AppLayerParse(dp_ctx->alproto_local_storage[f->alproto], f, f->alproto, flags, data, data_len);
+    PACKET_PROFILING_APP_END(dp_ctx, f->alproto);
+    return r;
+}
+
+static int AppLayerHandleTCPDataDo(AlpProtoDetectThreadCtx *dp_ctx, Flow *f,
+        TcpSession *ssn, Packet *defer_p, uint8_t *data, uint32_t data_len,
+        uint8_t flags)
 {
     SCEnter();
 
@@ -157,9 +164,7 @@ int AppLayerHandleTCPData(AlpProtoDetectThreadCtx *dp_ctx, Flow *f,
             if (f->alproto != ALPROTO_UNKNOWN) {
                 ssn->flags |= STREAMTCP_FLAG_APPPROTO_DETECTION_COMPLETED;
 
-                PACKET_PROFILING_APP_START(dp_ctx, f->alproto);
-                r = AppLayerParse(dp_ctx->alproto_local_storage[f->alproto], f, f->alproto, flags, data, data_len);
-                PACKET_PROFILING_APP_END(dp_ctx, f->alproto);
+                r = AppLayerParseTCPChunk(dp_ctx, f, defer_p, data, data_len, flags);
             } else {
                 if ((f->flags & FLOW_TS_PM_PP_ALPROTO_DETECT_DONE) &&
                     (f->flags & FLOW_TC_PM_PP_ALPROTO_DETECT_DONE)) {
@@ -182,9 +187,7 @@ int AppLayerHandleTCPData(AlpProtoDetectThreadCtx *dp_ctx, Flow *f,
             /* if we don't have a data object here we are not getting it
              * a start msg should have gotten us one */
             if (f->alproto != ALPROTO_UNKNOWN) {
-                PACKET_PROFILING_APP_START(dp_ctx, f->alproto);
-                r = AppLayerParse(dp_ctx->alproto_local_storage[f->alproto], f, f->alproto, flags, data, data_len);
-                PACKET_PROFILING_APP_END(dp_ctx, f->alproto);
+                r = AppLayerParseTCPChunk(dp_ctx, f, defer_p, data, data_len, flags);
             } else {
                 SCLogDebug(" smsg not start, but no l7 data? Weird");
             }
@@ -196,6 +199,76 @@ int AppLayerHandleTCPData(AlpProtoDetectThreadCtx *dp_ctx, Flow *f,
     SCReturnInt(r);
 }
 
+/**
+ *  \brief Handle a chunk of TCP data
+ *
+ *  If the protocol is yet unknown, the proto detection code is run first.
+ *
+ *  \param dp_ctx Thread app layer detect context
+ *  \param f Flow
+ *  \param ssn TCP Session
+ *  \param data ptr to reassembled data
+ *  \param data_len length of the data chunk
+ *  \param flags control flags
+ *
+ *  \retval 0 ok
+ *  \retval -1 error
+ */
+int AppLayerHandleTCPData(AlpProtoDetectThreadCtx *dp_ctx, Flow *f,
+        TcpSession *ssn, uint8_t *data, uint32_t data_len, uint8_t flags)
+{
+    return AppLayerHandleTCPDataDo(dp_ctx, f, ssn, NULL, data, data_len, flags);
+}
+
+/**
+ *  \brief Handle a chunk of TCP data for the app layer threads
+ *
+ *  Like AppLayerHandleTCPData(), but only the proto detection runs here.
+ *  The stream engine depends on its outcome right away. The data for the
+ *  parser is copied and attached to the packet, see app-layer-thread.c.
+ *
+ *  \param dp_ctx Thread app layer detect context
+ *  \param p packet with a LOCKED flow the data is passed along with
+ *  \param ssn TCP Session
+ *  \param data ptr to reassembled data
+ *  \param data_len length of the data chunk
+ *  \param flags control flags
+ *
+ *  \retval 0 ok
+ *  \retval -1 error
+ */
+int AppLayerDeferTCPData(AlpProtoDetectThreadCtx *dp_ctx, Packet *p,
+        TcpSession *ssn, uint8_t *data, uint32_t data_len, uint8_t flags)
+{
+    return AppLayerHandleTCPDataDo(dp_ctx, p->flow, ssn, p, data, data_len, flags);
+}
+
+/**
+ *  \brief Parse a chunk of TCP data deferred by AppLayerDeferTCPData()
+ *
+ *  \param dp_ctx Thread app layer detect context of the app layer thread
+ *  \param f LOCKED flow
+ *  \param data ptr to the data
+ *  \param data_len length of the data chunk
+ *  \param flags control flags
+ *
+ *  \retval 0 ok
+ *  \retval -1 error
+ */
+int AppLayerParseTCPData(AlpProtoDetectThreadCtx *dp_ctx, Flow *f,
+        uint8_t *data, uint32_t data_len, uint8_t flags)
+{
+    SCEnter();
+
+    DEBUG_ASSERT_FLOW_LOCKED(f);
+
+    /* parser may have given up on the flow since the data was queued */
+    if ((f->flags & FLOW_NO_APPLAYER_INSPECTION) || f->alproto == ALPROTO_UNKNOWN)
+        SCReturnInt(0);
+
+    SCReturnInt(AppLayerParseTCPChunk(dp_ctx, f, NULL, data, data_len, flags));
+}
+
 /**
  *  \brief Attach a stream message to the TCP session for inspection
  *         in the detection engine.
@@ -39,6 +39,8 @@ uint16_t AppLayerGetProtoFromPacket(Packet *);
 void *AppLayerGetProtoStateFromPacket(Packet *);
 void *AppLayerGetProtoStateFromFlow(Flow *);
 int AppLayerHandleTCPData(AlpProtoDetectThreadCtx *, Flow *, TcpSession *, uint8_t *, uint32_t, uint8_t);
+int AppLayerDeferTCPData(AlpProtoDetectThreadCtx *, Packet *, TcpSession *, uint8_t *, uint32_t, uint8_t);
+int AppLayerParseTCPData(AlpProtoDetectThreadCtx *, Flow *, uint8_t *, uint32_t, uint8_t);
 int AppLayerHandleTCPMsg(AlpProtoDetectThreadCtx *, StreamMsg *);
 //int AppLayerHandleMsg(AlpProtoDetectThreadCtx *, StreamMsg *);
 int AppLayerHandleUdp(AlpProtoDetectThreadCtx *, Flow *, Packet *p);
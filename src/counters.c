@@ -29,15 +29,19 @@
 #include "threadvars.h"
 #include "tm-threads.h"
 #include "conf.h"
+#include "tm-modules.h"
 #include "util-time.h"
 #include "util-unittest.h"
 #include "util-debug.h"
 #include "util-privs.h"
 #include "util-signal.h"
 #include "unix-manager.h"
+#include "util-latency.h"
+#include "util-logopenfile.h"
 
 /** \todo Get the default log directory from some global resource. */
 #define SC_PERF_DEFAULT_LOG_FILENAME "stats.log"
+#define SC_PERF_DEFAULT_JSON_FILENAME "stats.json"
 
 /* Used to parse the interval for Timebased counters */
 #define SC_PERF_PCRE_TIMEBASED_INTERVAL "^(?:(\\d+)([shm]))(?:(\\d+)([shm]))?(?:(\\d+)([shm]))?$"
@@ -50,42 +54,12 @@ static uint32_t sc_counter_tts = SC_PERF_MGMTT_TTS;
 static char sc_counter_enabled = TRUE;
 /** append or overwrite? 1: append, 0: overwrite */
 static char sc_counter_append = TRUE;
+/** write the stats.log table? */
+static char sc_counter_text = TRUE;
+/** add the latency percentiles to the file output? */
+static char sc_counter_latency = FALSE;
 
-/**
- * \brief Adds a value of type uint64_t to the local counter.
- *
- * \param id  ID of the counter as set by the API
- * \param pca Counter array that holds the local counter for this TM
- * \param x   Value to add to this local counter
- */
-void SCPerfCounterAddUI64(uint16_t id, SCPerfCounterArray *pca, uint64_t x)
-{
-    if (!pca) {
-        SCLogDebug("counterarray is NULL");
-        return;
-    }
-    if ((id < 1) || (id > pca->size)) {
-        SCLogDebug("counter doesn't exist");
-        return;
-    }
-
-    switch (pca->head[id].pc->value->type) {
-        case SC_PERF_TYPE_UINT64:
-            pca->head[id].ui64_cnt += x;
-            break;
-        case SC_PERF_TYPE_DOUBLE:
-            pca->head[id].d_cnt += x;
-            break;
-    }
-
-    if (pca->head[id].syncs == ULONG_MAX) {
-        pca->head[id].syncs = 0;
-        pca->head[id].wrapped_syncs++;
-    }
-    pca->head[id].syncs++;
-
-    return;
-}
+static void SCPerfCollectCounters(void);
 
 /**
  * \brief Adds a value of type double to the local counter
@@ -105,57 +79,22 @@ void SCPerfCounterAddDouble(uint16_t id, SCPerfCounterArray *pca, double x)
         return;
     }
 
+    SCPCAElem *pcae = &pca->head[id];
+
+    SC_PERF_WRITE_BEGIN(pcae->seq);
     /* incase you are trying to add a double to a counter of type SC_PERF_TYPE_UINT64
      * it will be truncated */
-    switch (pca->head[id].pc->value->type) {
-        case SC_PERF_TYPE_UINT64:
-            pca->head[id].ui64_cnt += x;
-            break;
-        case SC_PERF_TYPE_DOUBLE:
-            pca->head[id].d_cnt += x;
-            break;
-    }
-
-    if (pca->head[id].syncs == ULONG_MAX) {
-        pca->head[id].syncs = 0;
-        pca->head[id].wrapped_syncs++;
-    }
-    pca->head[id].syncs++;
-
-    return;
-}
-
-/**
- * \brief Increments the local counter
- *
- * \param id  Index of the counter in the counter array
- * \param pca Counter array that holds the local counters for this TM
- */
-void SCPerfCounterIncr(uint16_t id, SCPerfCounterArray *pca)
-{
-    if (pca == NULL) {
-        SCLogDebug("counterarray is NULL");
-        return;
-    }
-    if ((id < 1) || (id > pca->size)) {
-        SCLogDebug("counter doesn't exist");
-        return;
-    }
-
-    switch (pca->head[id].pc->value->type) {
+    switch (pcae->type) {
         case SC_PERF_TYPE_UINT64:
-            pca->head[id].ui64_cnt++;
+            SC_PERF_STORE(pcae->ui64_cnt, pcae->ui64_cnt + x);
             break;
         case SC_PERF_TYPE_DOUBLE:
-            pca->head[id].d_cnt++;
+            SC_PERF_STORE(pcae->d_cnt, pcae->d_cnt + x);
             break;
     }
 
-    if (pca->head[id].syncs == ULONG_MAX) {
-        pca->head[id].syncs = 0;
-        pca->head[id].wrapped_syncs++;
-    }
-    pca->head[id].syncs++;
+    SCPerfCounterUpdated(pcae);
+    SC_PERF_WRITE_END(pcae->seq);
 
     return;
 }
@@ -180,32 +119,32 @@ void SCPerfCounterSetUI64(uint16_t id, SCPerfCounterArray *pca,
         return;
     }
 
-    switch (pca->head[id].pc->value->type) {
+    SCPCAElem *pcae = &pca->head[id];
+
+    SC_PERF_WRITE_BEGIN(pcae->seq);
+    switch (pcae->type) {
         case SC_PERF_TYPE_UINT64:
-            if ( (pca->head[id].pc->type_q->type & SC_PERF_TYPE_Q_MAXIMUM) &&
-                 (x > pca->head[id].ui64_cnt)) {
-                pca->head[id].ui64_cnt = x;
-            } else if (pca->head[id].pc->type_q->type & SC_PERF_TYPE_Q_NORMAL) {
-                pca->head[id].ui64_cnt = x;
+            if ( (pcae->type_q & SC_PERF_TYPE_Q_MAXIMUM) &&
+                 (x > pcae->ui64_cnt)) {
+                SC_PERF_STORE(pcae->ui64_cnt, x);
+            } else if (pcae->type_q & SC_PERF_TYPE_Q_NORMAL) {
+                SC_PERF_STORE(pcae->ui64_cnt, x);
             }
 
             break;
         case SC_PERF_TYPE_DOUBLE:
-            if ( (pca->head[id].pc->type_q->type & SC_PERF_TYPE_Q_MAXIMUM) &&
-                 (x > pca->head[id].d_cnt)) {
-                pca->head[id].d_cnt = x;
-            } else if (pca->head[id].pc->type_q->type & SC_PERF_TYPE_Q_NORMAL) {
-                pca->head[id].d_cnt = x;
+            if ( (pcae->type_q & SC_PERF_TYPE_Q_MAXIMUM) &&
+                 (x > pcae->d_cnt)) {
+                SC_PERF_STORE(pcae->d_cnt, x);
+            } else if (pcae->type_q & SC_PERF_TYPE_Q_NORMAL) {
+                SC_PERF_STORE(pcae->d_cnt, x);
             }
 
             break;
     }
 
-    if (pca->head[id].syncs == ULONG_MAX) {
-        pca->head[id].syncs = 0;
-        pca->head[id].wrapped_syncs++;
-    }
-    pca->head[id].syncs++;
+    SCPerfCounterUpdated(pcae);
+    SC_PERF_WRITE_END(pcae->seq);
 
     return;
 }
@@ -230,32 +169,32 @@ void SCPerfCounterSetDouble(uint16_t id, SCPerfCounterArray *pca,
         return;
     }
 
-    switch (pca->head[id].pc->value->type) {
+    SCPCAElem *pcae = &pca->head[id];
+
+    SC_PERF_WRITE_BEGIN(pcae->seq);
+    switch (pcae->type) {
         case SC_PERF_TYPE_UINT64:
-            if ( (pca->head[id].pc->type_q->type & SC_PERF_TYPE_Q_MAXIMUM) &&
-                 (x > pca->head[id].ui64_cnt)) {
-                pca->head[id].ui64_cnt = x;
-            } else if (pca->head[id].pc->type_q->type & SC_PERF_TYPE_Q_NORMAL) {
-                pca->head[id].ui64_cnt = x;
+            if ( (pcae->type_q & SC_PERF_TYPE_Q_MAXIMUM) &&
+                 (x > pcae->ui64_cnt)) {
+                SC_PERF_STORE(pcae->ui64_cnt, x);
+            } else if (pcae->type_q & SC_PERF_TYPE_Q_NORMAL) {
+                SC_PERF_STORE(pcae->ui64_cnt, x);
             }
 
             break;
         case SC_PERF_TYPE_DOUBLE:
-            if ( (pca->head[id].pc->type_q->type & SC_PERF_TYPE_Q_MAXIMUM) &&
-                 (x > pca->head[id].d_cnt)) {
-                pca->head[id].d_cnt = x;
-            } else if (pca->head[id].pc->type_q->type & SC_PERF_TYPE_Q_NORMAL) {
-                pca->head[id].d_cnt = x;
+            if ( (pcae->type_q & SC_PERF_TYPE_Q_MAXIMUM) &&
+                 (x > pcae->d_cnt)) {
+                SC_PERF_STORE(pcae->d_cnt, x);
+            } else if (pcae->type_q & SC_PERF_TYPE_Q_NORMAL) {
+                SC_PERF_STORE(pcae->d_cnt, x);
             }
 
             break;
     }
 
-    if (pca->head[id].syncs == ULONG_MAX) {
-        pca->head[id].syncs = 0;
-        pca->head[id].wrapped_syncs++;
-    }
-    pca->head[id].syncs++;
+    SCPerfCounterUpdated(pcae);
+    SC_PERF_WRITE_END(pcae->seq);
 
     return;
 }
@@ -303,6 +242,124 @@ static char *SCPerfGetLogFilename(ConfNode *stats)
     return log_filename;
 }
 
+/**
+ * \brief Releases the json output context
+ */
+static void SCPerfReleaseJsonCtx(SCPerfJsonCtx *jctx)
+{
+    uint32_t u = 0;
+
+    if (jctx == NULL)
+        return;
+
+    if (jctx->file_ctx != NULL)
+        LogFileFreeCtx(jctx->file_ctx);
+
+    if (jctx->counters != NULL) {
+        for (u = 0; u < jctx->counters_cnt; u++)
+            SCFree(jctx->counters[u]);
+        SCFree(jctx->counters);
+    }
+
+    if (jctx->buf != NULL)
+        SCFree(jctx->buf);
+    if (jctx->totals != NULL)
+        SCFree(jctx->totals);
+
+    SCFree(jctx);
+
+    return;
+}
+
+/**
+ * \brief Sets up the json output of the counters, a record per interval
+ *        written by the stats thread
+ *
+ * \param conf the "json" node of the stats output
+ *
+ * \retval jctx the json output context, NULL if disabled or on error
+ */
+static SCPerfJsonCtx *SCPerfInitJsonCtx(ConfNode *conf)
+{
+    SCPerfJsonCtx *jctx = NULL;
+    ConfNode *counters = NULL;
+    ConfNode *node = NULL;
+    const char *val = NULL;
+
+    if (conf == NULL)
+        return NULL;
+
+    val = ConfNodeLookupChildValue(conf, "enabled");
+    if (val == NULL || !ConfValIsTrue(val))
+        return NULL;
+
+    if ( (jctx = SCMalloc(sizeof(SCPerfJsonCtx))) == NULL)
+        return NULL;
+    memset(jctx, 0, sizeof(SCPerfJsonCtx));
+
+    jctx->threads = 1;
+    val = ConfNodeLookupChildValue(conf, "threads");
+    if (val != NULL)
+        jctx->threads = ConfValIsTrue(val);
+
+    jctx->deltas = 1;
+    val = ConfNodeLookupChildValue(conf, "deltas");
+    if (val != NULL)
+        jctx->deltas = ConfValIsTrue(val);
+
+    counters = ConfNodeLookupChild(conf, "counters");
+    if (counters != NULL) {
+        TAILQ_FOREACH(node, &counters->head, next) {
+            jctx->counters_cnt++;
+        }
+
+        if (jctx->counters_cnt > 0) {
+            jctx->counters = SCMalloc(jctx->counters_cnt * sizeof(char *));
+            if (jctx->counters == NULL) {
+                jctx->counters_cnt = 0;
+                goto error;
+            }
+            memset(jctx->counters, 0, jctx->counters_cnt * sizeof(char *));
+
+            jctx->counters_cnt = 0;
+            TAILQ_FOREACH(node, &counters->head, next) {
+                if (node->val == NULL)
+                    continue;
+                if ( (jctx->counters[jctx->counters_cnt] =
+                            SCStrdup(node->val)) == NULL)
+                    goto error;
+                jctx->counters_cnt++;
+            }
+        }
+    }
+
+    /* the records are written with fwrite */
+    val = ConfNodeLookupChildValue(conf, "filetype");
+    if (val != NULL && strcasecmp(val, "tile_pcie") == 0) {
+        SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "the json stats output "
+                   "doesn't support the tile_pcie filetype");
+        goto error;
+    }
+
+    if ( (jctx->file_ctx = LogFileNewCtx()) == NULL)
+        goto error;
+
+    if (SCConfLogOpenGeneric(conf, jctx->file_ctx,
+                             SC_PERF_DEFAULT_JSON_FILENAME) < 0)
+        goto error;
+
+    /* the first deltas are since the engine started */
+    gettimeofday(&jctx->ts, NULL);
+
+    return jctx;
+
+error:
+    SCLogError(SC_ERR_INITIALIZATION, "error setting up the json stats "
+               "output, disabling it");
+    SCPerfReleaseJsonCtx(jctx);
+    return NULL;
+}
+
 /**
  * \brief Initializes the output interface context
  *
@@ -337,6 +394,15 @@ static void SCPerfInitOPCtx(void)
         const char *append = ConfNodeLookupChildValue(stats, "append");
         if (append != NULL)
             sc_counter_append = ConfValIsTrue(append);
+
+        const char *latency = ConfNodeLookupChildValue(stats,
+                "latency-percentiles");
+        if (latency != NULL)
+            sc_counter_latency = ConfValIsTrue(latency);
+
+        const char *text = ConfNodeLookupChildValue(stats, "text");
+        if (text != NULL)
+            sc_counter_text = !ConfValIsFalse(text);
     }
 
     /* Store the engine start time */
@@ -350,6 +416,13 @@ static void SCPerfInitOPCtx(void)
 
     sc_perf_op_ctx->iface = SC_PERF_IFACE_FILE;
 
+    if (stats != NULL)
+        sc_perf_op_ctx->json = SCPerfInitJsonCtx(ConfNodeLookupChild(stats,
+                    "json"));
+
+    if (!sc_counter_text)
+        goto skip_file;
+
     if ( (sc_perf_op_ctx->file = SCPerfGetLogFilename(stats)) == NULL) {
         SCLogInfo("Error retrieving Perf Counter API output file path");
     }
@@ -375,6 +448,7 @@ static void SCPerfInitOPCtx(void)
         }
     }
 
+skip_file:
     /* club the counter from multiple instances of the tm before o/p */
     sc_perf_op_ctx->club_tm = 1;
 
@@ -408,6 +482,8 @@ static void SCPerfReleaseOPCtx()
     if (sc_perf_op_ctx->file != NULL)
         SCFree(sc_perf_op_ctx->file);
 
+    SCPerfReleaseJsonCtx(sc_perf_op_ctx->json);
+
     while (pctmi != NULL) {
         if (pctmi->tm_name != NULL)
             SCFree(pctmi->tm_name);
@@ -493,112 +569,6 @@ static void *SCPerfMgmtThread(void *arg)
     return NULL;
 }
 
-/**
- * \brief Wake up thread.  This thread wakes up every TTS(time to sleep) seconds
- *        and sets the flag for every ThreadVars' SCPerfContext
- *
- * \param arg is NULL always
- *
- * \retval NULL This is the value that is always returned
- */
-static void *SCPerfWakeupThread(void *arg)
-{
-    /* block usr2.  usr2 to be handled by the main thread only */
-    UtilSignalBlock(SIGUSR2);
-
-    ThreadVars *tv_local = (ThreadVars *)arg;
-    uint8_t run = 1;
-    ThreadVars *tv = NULL;
-    PacketQueue *q = NULL;
-    struct timespec cond_time;
-
-    /* Set the thread name */
-    if (SCSetThreadName(tv_local->name) < 0) {
-        SCLogWarning(SC_ERR_THREAD_INIT, "Unable to set thread name");
-    }
-
-    if (tv_local->thread_setup_flags != 0)
-        TmThreadSetupOptions(tv_local);
-
-    /* Set the threads capability */
-    tv_local->cap_flags = 0;
-
-    SCDropCaps(tv_local);
-
-    if (sc_perf_op_ctx == NULL) {
-        SCLogError(SC_ERR_PERF_STATS_NOT_INIT, "Perf Counter API not init"
-                   "SCPerfInitCounterApi() has to be called first");
-        TmThreadsSetFlag(tv_local, THV_CLOSED | THV_RUNNING_DONE);
-        return NULL;
-    }
-
-    TmThreadsSetFlag(tv_local, THV_INIT_DONE);
-    while (run) {
-        if (TmThreadsCheckFlag(tv_local, THV_PAUSE)) {
-            TmThreadsSetFlag(tv_local, THV_PAUSED);
-            TmThreadTestThreadUnPaused(tv_local);
-            TmThreadsUnsetFlag(tv_local, THV_PAUSED);
-        }
-
-        cond_time.tv_sec = time(NULL) + SC_PERF_WUT_TTS;
-        cond_time.tv_nsec = 0;
-
-        SCPtMutexLock(tv_local->m);
-        SCPtCondTimedwait(tv_local->cond, tv_local->m, &cond_time);
-        SCPtMutexUnlock(tv_local->m);
-
-        tv = tv_root[TVT_PPT];
-        while (tv != NULL) {
-            if (tv->sc_perf_pctx.head == NULL) {
-                tv = tv->next;
-                continue;
-            }
-
-            /* assuming the assignment of an int to be atomic, and even if it's
-             * not, it should be okay */
-            tv->sc_perf_pctx.perf_flag = 1;
-
-            if (tv->inq != NULL) {
-                q = &trans_q[tv->inq->id];
-#ifdef __tile__
-                SCMutexLock(&q->mutex_q);
-                q->cond_q = 1;
-                SCMutexUnlock(&q->mutex_q);
-#else
-                SCCondSignal(&q->cond_q);
-#endif
-            }
-
-            tv = tv->next;
-        }
-
-        /* mgt threads for flow manager */
-        tv = tv_root[TVT_MGMT];
-        while (tv != NULL) {
-            if (tv->sc_perf_pctx.head == NULL) {
-                tv = tv->next;
-                continue;
-            }
-
-            /* assuming the assignment of an int to be atomic, and even if it's
-             * not, it should be okay */
-            tv->sc_perf_pctx.perf_flag = 1;
-
-            tv = tv->next;
-        }
-
-        if (TmThreadsCheckFlag(tv_local, THV_KILL)) {
-            run = 0;
-        }
-    }
-
-    TmThreadsSetFlag(tv_local, THV_RUNNING_DONE);
-    TmThreadWaitForFlag(tv_local, THV_DEINIT);
-
-    TmThreadsSetFlag(tv_local, THV_CLOSED);
-    return NULL;
-}
-
 /**
  * \brief Parses a time based counter interval
  *
@@ -882,35 +852,53 @@ static uint16_t SCPerfRegisterQualifiedCounter(char *cname, char *tm_name,
  *        SCPerfCounterArray to its corresponding global counterpart.  Used
  *        internally by SCPerfUpdateCounterArray()
  *
+ *        The local counter may be updated by its thread while we read it, so
+ *        it's loaded once.  Timebased counters add the change of the local
+ *        counter since the last copy to the global one, instead of resetting
+ *        the local counter, which would race with the thread updating it.
+ *
+ *        The local counters are never written, so the thread owning them
+ *        is their only writer.
+ *
  * \param pcae     Pointer to the SCPerfCounterArray which holds the local
  *                 versions of the counters
- * \param reset_lc Flag which indicates if the values of the local counters
- *                 in the SCPerfCounterArray has to be reset or not
  */
-static void SCPerfCopyCounterValue(SCPCAElem *pcae, int reset_lc)
+static void SCPerfCopyCounterValue(SCPCAElem *pcae)
 {
     SCPerfCounter *pc = NULL;
     double d_temp = 0;
     uint64_t ui64_temp = 0;
+    uint64_t syncs = 0;
+    uint64_t wrapped_syncs = 0;
+    uint32_t seq = 0;
 
     struct timeval curr_ts;
 
     uint64_t u = 0;
 
+    /* a consistent copy of the fields the owner updates */
+    do {
+        seq = SC_PERF_READ_BEGIN(pcae->seq);
+        if (pcae->type == SC_PERF_TYPE_DOUBLE)
+            d_temp = SC_PERF_LOAD(pcae->d_cnt);
+        else
+            ui64_temp = SC_PERF_LOAD(pcae->ui64_cnt);
+        syncs = SC_PERF_LOAD(pcae->syncs);
+        wrapped_syncs = SC_PERF_LOAD(pcae->wrapped_syncs);
+    } while (SC_PERF_READ_RETRY(pcae->seq, seq));
+
     pc = pcae->pc;
-    switch (pc->value->type) {
+    switch (pcae->type) {
         case SC_PERF_TYPE_UINT64:
-            ui64_temp = pcae->ui64_cnt;
-
-            if (pc->type_q->type & SC_PERF_TYPE_Q_AVERAGE) {
-                for (u = 0; u < pcae->wrapped_syncs; u++)
+            if (pcae->type_q & SC_PERF_TYPE_Q_AVERAGE) {
+                for (u = 0; u < wrapped_syncs; u++)
                     ui64_temp /= ULONG_MAX;
 
-                if (pcae->syncs != 0)
-                    ui64_temp /= pcae->syncs;
+                if (syncs != 0)
+                    ui64_temp /= syncs;
 
                 *((uint64_t *)pc->value->cvalue) = ui64_temp;
-            } else if (pc->type_q->type & SC_PERF_TYPE_Q_TIMEBASED) {
+            } else if (pcae->type_q & SC_PERF_TYPE_Q_TIMEBASED) {
                 /* we have a timebased counter.  Awesome.  Time for some more processing */
                 TimeGet(&curr_ts);
                 pc->type_q->tbc_secs += ((curr_ts.tv_sec + curr_ts.tv_usec / 1000000.0) -
@@ -918,50 +906,47 @@ static void SCPerfCopyCounterValue(SCPCAElem *pcae, int reset_lc)
 
                 /* special treatment for timebased counters.  We add instead of
                  * copying to the global counters.  The job of resetting the
-                 * global counters is done by the output function */
-                *((uint64_t *)pc->value->cvalue) += ui64_temp;
-                pcae->ui64_cnt = 0;
+                 * global counters is done by the output function.  A local
+                 * counter lower than at the last copy has been reset */
+                if (ui64_temp >= pcae->ui64_last)
+                    *((uint64_t *)pc->value->cvalue) += ui64_temp - pcae->ui64_last;
+                else
+                    *((uint64_t *)pc->value->cvalue) += ui64_temp;
+                pcae->ui64_last = ui64_temp;
                 /* reset it to the current time */
                 TimeGet(&pcae->ts);
             } else {
                 *((uint64_t *)pc->value->cvalue) = ui64_temp;
             }
 
-            if (reset_lc)
-                pcae->ui64_cnt = 0;
-
             break;
         case SC_PERF_TYPE_DOUBLE:
-            d_temp = pcae->d_cnt;
-
-            if (pc->type_q->type & SC_PERF_TYPE_Q_AVERAGE) {
-                for (u = 0; u < pcae->wrapped_syncs; u++)
+            if (pcae->type_q & SC_PERF_TYPE_Q_AVERAGE) {
+                for (u = 0; u < wrapped_syncs; u++)
                     d_temp /= ULONG_MAX;
 
-                if (pcae->syncs != 0)
-                    d_temp /= pcae->syncs;
+                if (syncs != 0)
+                    d_temp /= syncs;
 
                 *((double *)pc->value->cvalue) = d_temp;
-            } else if (pc->type_q->type & SC_PERF_TYPE_Q_TIMEBASED) {
+            } else if (pcae->type_q & SC_PERF_TYPE_Q_TIMEBASED) {
                 /* we have a timebased counter.  Awesome.  Time for some more processing */
                 TimeGet(&curr_ts);
                 pc->type_q->tbc_secs += ((curr_ts.tv_sec + curr_ts.tv_usec / 1000000.0) -
                                          (pcae->ts.tv_sec + pcae->ts.tv_usec / 1000000.0));
 
-                /* special treatment for timebased counters.  We add instead of
-                 * copying to the global counters.  The job of resetting the
-                 * global counters is done by the output function */
-                *((double *)pc->value->cvalue) += d_temp;
-                pcae->d_cnt = 0;
+                /* see above */
+                if (d_temp >= pcae->d_last)
+                    *((double *)pc->value->cvalue) += d_temp - pcae->d_last;
+                else
+                    *((double *)pc->value->cvalue) += d_temp;
+                pcae->d_last = d_temp;
                 /* reset it to the current time */
                 TimeGet(&pcae->ts);
             } else {
                 *((double *)pc->value->cvalue) = d_temp;
             }
 
-            if (reset_lc)
-                pcae->d_cnt = 0;
-
             break;
     }
 
@@ -969,19 +954,17 @@ static void SCPerfCopyCounterValue(SCPCAElem *pcae, int reset_lc)
 }
 
 /**
- * \brief Calculates counter value that should be sent as output
+ * \brief Gets the counter value that should be sent as output
  *
  *        If we aren't dealing with timebased counters, we just return the
- *        the counter value.  In case of Timebased counters, if we haven't
- *        crossed the interval, we display the current value without any
- *        modifications.  If we have crossed the limit, we calculate the counter
- *        value for the time period and also return 1, to indicate that the
- *        counter value can be reset after use
+ *        the counter value.  In case of Timebased counters the value is
+ *        averaged over the interval.  Nothing is reset, see
+ *        SCPerfResetTimebasedCounter()
  *
- * \param pc Pointer to the PerfCounter for which the timebased counter has to
- *           be calculated
+ * \param pc Pointer to the PerfCounter for which the value has to be
+ *           calculated
  */
-static void SCPerfOutputCalculateCounterValue(SCPerfCounter *pc, void *cvalue_op)
+static void SCPerfGetCounterValue(SCPerfCounter *pc, void *cvalue_op)
 {
     double divisor = 0;
 
@@ -1007,6 +990,10 @@ static void SCPerfOutputCalculateCounterValue(SCPerfCounter *pc, void *cvalue_op
     divisor += ((double)(pc->type_q->tbc_secs % pc->type_q->total_secs)/
                 pc->type_q->total_secs);
 
+    /* no time accounted since the last reset */
+    if (divisor <= 0)
+        return;
+
     switch (pc->value->type) {
         case SC_PERF_TYPE_UINT64:
             *((uint64_t *)cvalue_op) /= divisor;
@@ -1018,6 +1005,19 @@ static void SCPerfOutputCalculateCounterValue(SCPerfCounter *pc, void *cvalue_op
             break;
     }
 
+    return;
+}
+
+/**
+ * \brief Resets a timebased counter, once its value is out
+ *
+ * \param pc Pointer to the PerfCounter, other counters are left alone
+ */
+static void SCPerfResetTimebasedCounter(SCPerfCounter *pc)
+{
+    if (pc->value == NULL || !(pc->type_q->type & SC_PERF_TYPE_Q_TIMEBASED))
+        return;
+
     pc->type_q->tbc_secs = 0;
     /* reset the local counter back to 0 */
     memset(pc->value->cvalue, 0, pc->value->size);
@@ -1025,6 +1025,45 @@ static void SCPerfOutputCalculateCounterValue(SCPerfCounter *pc, void *cvalue_op
     return;
 }
 
+/**
+ * \brief Calculates counter value that should be sent as output, and
+ *        resets the counter if it's timebased
+ *
+ * \param pc Pointer to the PerfCounter for which the timebased counter has to
+ *           be calculated
+ */
+static void SCPerfOutputCalculateCounterValue(SCPerfCounter *pc, void *cvalue_op)
+{
+    SCPerfGetCounterValue(pc, cvalue_op);
+    SCPerfResetTimebasedCounter(pc);
+
+    return;
+}
+
+/**
+ * \brief Resets the timebased counters of all threads, after all the
+ *        outputs had their values
+ */
+static void SCPerfResetTimebasedCounters(void)
+{
+    ThreadVars *tv = NULL;
+    SCPerfCounter *pc = NULL;
+    uint32_t u = 0;
+
+    SCMutexLock(&tv_root_lock);
+    for (u = 0; u < TVT_MAX; u++) {
+        for (tv = tv_root[u]; tv != NULL; tv = tv->next) {
+            SCMutexLock(&tv->sc_perf_pctx.m);
+            for (pc = tv->sc_perf_pctx.head; pc != NULL; pc = pc->next)
+                SCPerfResetTimebasedCounter(pc);
+            SCMutexUnlock(&tv->sc_perf_pctx.m);
+        }
+    }
+    SCMutexUnlock(&tv_root_lock);
+
+    return;
+}
+
 /**
  * \brief The file output interface for the Perf Counter api
  */
@@ -1086,121 +1125,486 @@ static int SCPerfOutputCounterFileIface()
             //if (pc_heads == NULL || pc_heads[u] == NULL)
             //    continue;
 
-            while (tv != NULL) {
-                SCMutexLock(&tv->sc_perf_pctx.m);
-                pc = tv->sc_perf_pctx.head;
+            while (tv != NULL) {
+                SCMutexLock(&tv->sc_perf_pctx.m);
+                pc = tv->sc_perf_pctx.head;
+
+                while (pc != NULL) {
+                    if (pc->disp == 0 || pc->value == NULL) {
+                        pc = pc->next;
+                        continue;
+                    }
+
+                    switch (pc->value->type) {
+                        case SC_PERF_TYPE_UINT64:
+                            SCPerfGetCounterValue(pc,
+                                    &ui64_temp);
+                            fprintf(sc_perf_op_ctx->fp, "%-25s | %-25s | "
+                                    "%-" PRIu64 "\n", pc->name->cname,
+                                    pc->name->tm_name, ui64_temp);
+                            break;
+                        case SC_PERF_TYPE_DOUBLE:
+                            SCPerfGetCounterValue(pc,
+                                    &double_temp);
+                            fprintf(sc_perf_op_ctx->fp, "%-25s | %-25s |"
+                                    " %-lf\n", pc->name->cname,
+                                    pc->name->tm_name, double_temp);
+                            break;
+                    }
+
+                    pc = pc->next;
+                }
+
+                SCMutexUnlock(&tv->sc_perf_pctx.m);
+                tv = tv->next;
+            }
+            fflush(sc_perf_op_ctx->fp);
+        }
+
+        return 1;
+    }
+
+    pctmi = sc_perf_op_ctx->pctmi;
+    while (pctmi != NULL) {
+        if ((pc_heads = SCMalloc(pctmi->size * sizeof(SCPerfCounter *))) == NULL)
+            return 0;
+        memset(pc_heads, 0, pctmi->size * sizeof(SCPerfCounter *));
+
+        for (u = 0; u < pctmi->size; u++) {
+            pc_heads[u] = pctmi->head[u]->head;
+
+            SCMutexLock(&pctmi->head[u]->m);
+
+            while(pc_heads[u] != NULL && strcmp(pctmi->tm_name, pc_heads[u]->name->tm_name)) {
+                pc_heads[u] = pc_heads[u]->next;
+            }
+        }
+
+        flag = 1;
+        while(flag) {
+            ui64_result = 0;
+            double_result = 0;
+            if (pc_heads[0] == NULL)
+                break;
+            pc = pc_heads[0];
+
+            for (u = 0; u < pctmi->size; u++) {
+                switch (pc->value->type) {
+                    case SC_PERF_TYPE_UINT64:
+                        SCPerfGetCounterValue(pc_heads[u], &ui64_temp);
+                        ui64_result += ui64_temp;
+
+                        break;
+                    case SC_PERF_TYPE_DOUBLE:
+                        SCPerfGetCounterValue(pc_heads[u], &double_temp);
+                        double_result += double_temp;
+
+                        break;
+                }
+
+                if (pc_heads[u] != NULL)
+                    pc_heads[u] = pc_heads[u]->next;
+
+                if (pc_heads[u] == NULL ||
+                    (pc_heads[0] != NULL &&
+                        strcmp(pctmi->tm_name, pc_heads[0]->name->tm_name))) {
+                    flag = 0;
+                }
+            }
+
+            if (pc->disp == 0 || pc->value == NULL)
+                continue;
+
+            switch (pc->value->type) {
+                case SC_PERF_TYPE_UINT64:
+                    fprintf(sc_perf_op_ctx->fp, "%-25s | %-25s | %-" PRIu64 "\n",
+                            pc->name->cname, pctmi->tm_name, ui64_result);
+
+                    break;
+                case SC_PERF_TYPE_DOUBLE:
+                    fprintf(sc_perf_op_ctx->fp, "%-25s | %-25s | %0.0lf\n",
+                            pc->name->cname, pctmi->tm_name, double_result);
+
+                    break;
+            }
+        }
+
+        for (u = 0; u < pctmi->size; u++)
+            SCMutexUnlock(&pctmi->head[u]->m);
+
+        pctmi = pctmi->next;
+
+        SCFree(pc_heads);
+
+        fflush(sc_perf_op_ctx->fp);
+    }
+
+    return 1;
+}
+
+/**
+ * \brief Appends to the json record, growing the buffer when needed
+ *
+ * \retval 0 on success, -1 on error
+ */
+static int SCPerfJsonAppend(SCPerfJsonCtx *jctx, const char *fmt, ...)
+{
+    va_list ap;
+    int len = 0;
+
+    while (1) {
+        va_start(ap, fmt);
+        len = vsnprintf(jctx->buf + jctx->buf_len,
+                        jctx->buf_size - jctx->buf_len, fmt, ap);
+        va_end(ap);
+
+        if (len < 0)
+            return -1;
+        if ((uint32_t)len < jctx->buf_size - jctx->buf_len)
+            break;
+
+        uint32_t size = (jctx->buf_size * 2) + len + 1;
+        char *buf = SCRealloc(jctx->buf, size);
+        if (buf == NULL)
+            return -1;
+        jctx->buf = buf;
+        jctx->buf_size = size;
+    }
+
+    jctx->buf_len += len;
+    return 0;
+}
+
+/**
+ * \brief Appends a json string, escaping the characters that need it
+ */
+static int SCPerfJsonAppendString(SCPerfJsonCtx *jctx, const char *str)
+{
+    const char *c = NULL;
+
+    if (SCPerfJsonAppend(jctx, "\"") < 0)
+        return -1;
+
+    for (c = str; *c != '\0'; c++) {
+        int r = 0;
+
+        if (*c == '"' || *c == '\\')
+            r = SCPerfJsonAppend(jctx, "\\%c", *c);
+        else if ((unsigned char)*c < 0x20)
+            r = SCPerfJsonAppend(jctx, "\\u%04x", (unsigned char)*c);
+        else
+            r = SCPerfJsonAppend(jctx, "%c", *c);
+
+        if (r < 0)
+            return -1;
+    }
+
+    return SCPerfJsonAppend(jctx, "\"");
+}
+
+/**
+ * \brief Appends a counter value, with its delta and rate if enabled
+ *
+ * \param interval seconds since the previous record
+ */
+static int SCPerfJsonAppendValue(SCPerfJsonCtx *jctx, SCPerfJsonValue *jv,
+                                 int comma, double interval)
+{
+    uint64_t ui64 = jv->ui64;
+    double d = jv->d;
+
+    /* the total of an average counter is the average of the threads */
+    if ((jv->type_q & SC_PERF_TYPE_Q_AVERAGE) && jv->cnt > 1) {
+        ui64 /= jv->cnt;
+        d /= jv->cnt;
+    }
+
+    if (comma && SCPerfJsonAppend(jctx, ",") < 0)
+        return -1;
+    if (SCPerfJsonAppendString(jctx, jv->cname) < 0)
+        return -1;
+    if (SCPerfJsonAppend(jctx, ":") < 0)
+        return -1;
+
+    if (jctx->deltas && SCPerfJsonAppend(jctx, "{\"value\":") < 0)
+        return -1;
+
+    switch (jv->type) {
+        case SC_PERF_TYPE_UINT64:
+            if (SCPerfJsonAppend(jctx, "%"PRIu64, ui64) < 0)
+                return -1;
+            break;
+        case SC_PERF_TYPE_DOUBLE:
+            if (SCPerfJsonAppend(jctx, "%0.3lf", d) < 0)
+                return -1;
+            break;
+    }
+
+    if (!jctx->deltas)
+        return 0;
+
+    if (jv->type_q & SC_PERF_TYPE_Q_NORMAL) {
+        switch (jv->type) {
+            case SC_PERF_TYPE_UINT64:
+                if (SCPerfJsonAppend(jctx, ",\"delta\":%"PRIu64",\"rate\":"
+                            "%0.3lf", jv->ui64_delta, interval > 0 ?
+                            jv->ui64_delta / interval : 0) < 0)
+                    return -1;
+                break;
+            case SC_PERF_TYPE_DOUBLE:
+                if (SCPerfJsonAppend(jctx, ",\"delta\":%0.3lf,\"rate\":"
+                            "%0.3lf", jv->d_delta, interval > 0 ?
+                            jv->d_delta / interval : 0) < 0)
+                    return -1;
+                break;
+        }
+    }
+
+    return SCPerfJsonAppend(jctx, "}");
+}
+
+/**
+ * \brief Checks if a counter is in the counters selected for the json
+ *        output
+ */
+static int SCPerfJsonCounterSelected(SCPerfJsonCtx *jctx, const char *cname)
+{
+    uint32_t u = 0;
+
+    if (jctx->counters_cnt == 0)
+        return 1;
 
-                while (pc != NULL) {
-                    if (pc->disp == 0 || pc->value == NULL) {
-                        pc = pc->next;
-                        continue;
-                    }
+    for (u = 0; u < jctx->counters_cnt; u++) {
+        if (strncmp(cname, jctx->counters[u], strlen(jctx->counters[u])) == 0)
+            return 1;
+    }
 
-                    switch (pc->value->type) {
-                        case SC_PERF_TYPE_UINT64:
-                            SCPerfOutputCalculateCounterValue(pc,
-                                    &ui64_temp);
-                            fprintf(sc_perf_op_ctx->fp, "%-25s | %-25s | "
-                                    "%-" PRIu64 "\n", pc->name->cname,
-                                    pc->name->tm_name, ui64_temp);
-                            break;
-                        case SC_PERF_TYPE_DOUBLE:
-                            SCPerfOutputCalculateCounterValue(pc,
-                                    &double_temp);
-                            fprintf(sc_perf_op_ctx->fp, "%-25s | %-25s |"
-                                    " %-lf\n", pc->name->cname,
-                                    pc->name->tm_name, double_temp);
-                            break;
-                    }
+    return 0;
+}
 
-                    pc = pc->next;
-                }
+/**
+ * \brief Adds the value of a thread's counter to the total of all threads
+ *
+ * \retval 0 on success, -1 on error
+ */
+static int SCPerfJsonAddTotal(SCPerfJsonCtx *jctx, SCPerfJsonValue *jv)
+{
+    SCPerfJsonValue *total = NULL;
+    uint32_t u = 0;
 
-                SCMutexUnlock(&tv->sc_perf_pctx.m);
-                tv = tv->next;
-            }
-            fflush(sc_perf_op_ctx->fp);
+    for (u = 0; u < jctx->totals_cnt; u++) {
+        if (jctx->totals[u].type == jv->type &&
+            strcmp(jctx->totals[u].cname, jv->cname) == 0) {
+            total = &jctx->totals[u];
+            break;
         }
+    }
 
-        return 1;
+    if (total == NULL) {
+        if (jctx->totals_cnt == jctx->totals_size) {
+            uint32_t size = (jctx->totals_size == 0) ? 64 :
+                            jctx->totals_size * 2;
+            SCPerfJsonValue *totals = SCRealloc(jctx->totals,
+                                                size * sizeof(SCPerfJsonValue));
+            if (totals == NULL)
+                return -1;
+            jctx->totals = totals;
+            jctx->totals_size = size;
+        }
+
+        total = &jctx->totals[jctx->totals_cnt++];
+        *total = *jv;
+        total->cnt = 1;
+        return 0;
     }
 
-    pctmi = sc_perf_op_ctx->pctmi;
-    while (pctmi != NULL) {
-        if ((pc_heads = SCMalloc(pctmi->size * sizeof(SCPerfCounter *))) == NULL)
-            return 0;
-        memset(pc_heads, 0, pctmi->size * sizeof(SCPerfCounter *));
+    total->cnt++;
+    switch (jv->type) {
+        case SC_PERF_TYPE_UINT64:
+            if (jv->type_q & SC_PERF_TYPE_Q_MAXIMUM) {
+                if (jv->ui64 > total->ui64)
+                    total->ui64 = jv->ui64;
+            } else {
+                total->ui64 += jv->ui64;
+            }
+            total->ui64_delta += jv->ui64_delta;
+            break;
+        case SC_PERF_TYPE_DOUBLE:
+            if (jv->type_q & SC_PERF_TYPE_Q_MAXIMUM) {
+                if (jv->d > total->d)
+                    total->d = jv->d;
+            } else {
+                total->d += jv->d;
+            }
+            total->d_delta += jv->d_delta;
+            break;
+    }
 
-        for (u = 0; u < pctmi->size; u++) {
-            pc_heads[u] = pctmi->head[u]->head;
+    return 0;
+}
 
-            SCMutexLock(&pctmi->head[u]->m);
+/**
+ * \brief Writes the json record, bypassing stdio that may split it, so a
+ *        datagram socket gets the record in one piece
+ *
+ *        A stream socket or file may take less than the whole record, so
+ *        the rest is written until it's out.  If that fails halfway, the
+ *        line is torn and the output is closed, instead of having the
+ *        next records appended to the torn one.
+ *
+ * \retval 1 if the record is written, 0 otherwise
+ */
+static int SCPerfJsonWrite(SCPerfJsonCtx *jctx)
+{
+    int fd = fileno(jctx->file_ctx->fp);
+    uint32_t written = 0;
 
-            while(pc_heads[u] != NULL && strcmp(pctmi->tm_name, pc_heads[u]->name->tm_name)) {
-                pc_heads[u] = pc_heads[u]->next;
+    while (written < jctx->buf_len) {
+        ssize_t w = write(fd, jctx->buf + written, jctx->buf_len - written);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0) {
+            if (written == 0) {
+                SCLogDebug("error writing the json stats record: %s",
+                           strerror(errno));
+                return 0;
             }
+
+            SCLogError(SC_ERR_FWRITE, "error writing the json stats record, "
+                       "%"PRIu32" of %"PRIu32" bytes written, closing the "
+                       "json stats output: %s", written, jctx->buf_len,
+                       (w < 0) ? strerror(errno) : "nothing written");
+            fclose(jctx->file_ctx->fp);
+            jctx->file_ctx->fp = NULL;
+            return 0;
         }
+        written += (uint32_t)w;
+    }
 
-        flag = 1;
-        while(flag) {
-            ui64_result = 0;
-            double_result = 0;
-            if (pc_heads[0] == NULL)
-                break;
-            pc = pc_heads[0];
+    return 1;
+}
+
+/**
+ * \brief The json output of the counters.  Writes a record, on a single
+ *        line, with the totals of the counters of all threads and, if
+ *        enabled, the counters of every thread.
+ *
+ *        Called from the stats thread after the counters are collected.
+ *        The packet threads are never waited for, see
+ *        SCPerfCollectCounters().
+ *
+ * \param jctx the json output context
+ * \param tval time of the record
+ *
+ * \retval 1 if the record is written, 0 otherwise
+ */
+static int SCPerfOutputCounterJson(SCPerfJsonCtx *jctx, struct timeval *tval)
+{
+    ThreadVars *tv = NULL;
+    SCPerfCounter *pc = NULL;
+    SCPerfJsonValue jv;
+    struct tm local_tm;
+    struct tm *tms = NULL;
+    double interval = 0;
+    uint32_t u = 0;
+    int first_tv = 1;
+    int r = 0;
+
+    if (jctx == NULL || jctx->file_ctx == NULL || jctx->file_ctx->fp == NULL)
+        return 0;
+
+    interval = (tval->tv_sec - jctx->ts.tv_sec) +
+               ((double)tval->tv_usec - jctx->ts.tv_usec) / 1000000;
+    jctx->ts = *tval;
+
+    jctx->buf_len = 0;
+    jctx->totals_cnt = 0;
+
+    tms = SCLocalTime(tval->tv_sec, &local_tm);
+    r |= SCPerfJsonAppend(jctx, "{\"timestamp\":\"%04d-%02d-%02dT%02d:%02d:"
+                          "%02d.%06u\",\"uptime\":%d,\"interval\":%0.3lf",
+                          tms->tm_year + 1900, tms->tm_mon + 1, tms->tm_mday,
+                          tms->tm_hour, tms->tm_min, tms->tm_sec,
+                          (uint32_t)tval->tv_usec,
+                          (int)difftime(tval->tv_sec, sc_start_time),
+                          interval);
+
+    if (jctx->threads)
+        r |= SCPerfJsonAppend(jctx, ",\"threads\":{");
+
+    SCMutexLock(&tv_root_lock);
+    for (u = 0; u < TVT_MAX; u++) {
+        for (tv = tv_root[u]; tv != NULL; tv = tv->next) {
+            int first_pc = 1;
+
+            SCMutexLock(&tv->sc_perf_pctx.m);
+            for (pc = tv->sc_perf_pctx.head; pc != NULL; pc = pc->next) {
+                if (pc->disp == 0 || pc->value == NULL)
+                    continue;
+                if (!SCPerfJsonCounterSelected(jctx, pc->name->cname))
+                    continue;
+
+                memset(&jv, 0, sizeof(jv));
+                jv.cname = pc->name->cname;
+                jv.type = pc->value->type;
+                jv.type_q = pc->type_q->type;
 
-            for (u = 0; u < pctmi->size; u++) {
                 switch (pc->value->type) {
                     case SC_PERF_TYPE_UINT64:
-                        SCPerfOutputCalculateCounterValue(pc_heads[u], &ui64_temp);
-                        ui64_result += ui64_temp;
-
+                        SCPerfGetCounterValue(pc, &jv.ui64);
+                        /* counters can be reset, then the delta is the
+                         * new value */
+                        jv.ui64_delta = (jv.ui64 >= pc->ui64_out) ?
+                                        jv.ui64 - pc->ui64_out : jv.ui64;
+                        pc->ui64_out = jv.ui64;
                         break;
                     case SC_PERF_TYPE_DOUBLE:
-                        SCPerfOutputCalculateCounterValue(pc_heads[u], &double_temp);
-                        double_result += double_temp;
-
+                        SCPerfGetCounterValue(pc, &jv.d);
+                        jv.d_delta = (jv.d >= pc->d_out) ?
+                                     jv.d - pc->d_out : jv.d;
+                        pc->d_out = jv.d;
                         break;
+                    default:
+                        continue;
                 }
 
-                if (pc_heads[u] != NULL)
-                    pc_heads[u] = pc_heads[u]->next;
+                r |= SCPerfJsonAddTotal(jctx, &jv);
 
-                if (pc_heads[u] == NULL ||
-                    (pc_heads[0] != NULL &&
-                        strcmp(pctmi->tm_name, pc_heads[0]->name->tm_name))) {
-                    flag = 0;
+                if (!jctx->threads)
+                    continue;
+
+                if (first_pc) {
+                    if (!first_tv)
+                        r |= SCPerfJsonAppend(jctx, ",");
+                    r |= SCPerfJsonAppendString(jctx, tv->name);
+                    r |= SCPerfJsonAppend(jctx, ":{");
+                    first_tv = 0;
                 }
+                r |= SCPerfJsonAppendValue(jctx, &jv, !first_pc, interval);
+                first_pc = 0;
             }
+            SCMutexUnlock(&tv->sc_perf_pctx.m);
 
-            if (pc->disp == 0 || pc->value == NULL)
-                continue;
-
-            switch (pc->value->type) {
-                case SC_PERF_TYPE_UINT64:
-                    fprintf(sc_perf_op_ctx->fp, "%-25s | %-25s | %-" PRIu64 "\n",
-                            pc->name->cname, pctmi->tm_name, ui64_result);
-
-                    break;
-                case SC_PERF_TYPE_DOUBLE:
-                    fprintf(sc_perf_op_ctx->fp, "%-25s | %-25s | %0.0lf\n",
-                            pc->name->cname, pctmi->tm_name, double_result);
-
-                    break;
-            }
+            if (jctx->threads && !first_pc)
+                r |= SCPerfJsonAppend(jctx, "}");
         }
+    }
+    SCMutexUnlock(&tv_root_lock);
 
-        for (u = 0; u < pctmi->size; u++)
-            SCMutexUnlock(&pctmi->head[u]->m);
-
-        pctmi = pctmi->next;
+    if (jctx->threads)
+        r |= SCPerfJsonAppend(jctx, "}");
 
-        SCFree(pc_heads);
+    r |= SCPerfJsonAppend(jctx, ",\"totals\":{");
+    for (u = 0; u < jctx->totals_cnt; u++)
+        r |= SCPerfJsonAppendValue(jctx, &jctx->totals[u], u > 0, interval);
+    r |= SCPerfJsonAppend(jctx, "}}\n");
 
-        fflush(sc_perf_op_ctx->fp);
+    if (r != 0) {
+        SCLogDebug("error building the json stats record, skipping it");
+        return 0;
     }
 
-    return 1;
+    return SCPerfJsonWrite(jctx);
 }
 
 #ifdef BUILD_UNIX_SOCKET
@@ -1230,6 +1634,8 @@ TmEcode SCPerfOutputCounterSocket(json_t *cmd,
         return TM_ECODE_FAILED;
     }
 
+    SCPerfCollectCounters();
+
     if (sc_perf_op_ctx->club_tm == 0) {
         json_t *tm_array;
 
@@ -1411,8 +1817,7 @@ void SCPerfInitCounterApi(void)
 }
 
 /**
- * \brief Spawns the wakeup, and the management thread used by the perf
- *        counter api
+ * \brief Spawns the management thread used by the perf counter api
  */
 void SCPerfSpawnThreads(void)
 {
@@ -1422,27 +1827,8 @@ void SCPerfSpawnThreads(void)
         SCReturn;
     }
 
-    ThreadVars *tv_wakeup = NULL;
     ThreadVars *tv_mgmt = NULL;
 
-    /* spawn the stats wakeup thread */
-    tv_wakeup = TmThreadCreateMgmtThread("SCPerfWakeupThread",
-                                         SCPerfWakeupThread, 1);
-    if (tv_wakeup == NULL) {
-        SCLogError(SC_ERR_THREAD_CREATE, "TmThreadCreateMgmtThread "
-                   "failed");
-        exit(EXIT_FAILURE);
-    }
-#ifdef __tile__
-    TmThreadSetCPUAffinity(tv_wakeup, 0);
-#endif
-
-    if (TmThreadSpawn(tv_wakeup) != 0) {
-        SCLogError(SC_ERR_THREAD_SPAWN, "TmThreadSpawn failed for "
-                   "SCPerfWakeupThread");
-        exit(EXIT_FAILURE);
-    }
-
     /* spawn the stats mgmt thread */
     tv_mgmt = TmThreadCreateMgmtThread("SCPerfMgmtThread",
                                        SCPerfMgmtThread, 1);
@@ -1457,7 +1843,7 @@ void SCPerfSpawnThreads(void)
 
     if (TmThreadSpawn(tv_mgmt) != 0) {
         SCLogError(SC_ERR_THREAD_SPAWN, "TmThreadSpawn failed for "
-                   "SCPerfWakeupThread");
+                   "SCPerfMgmtThread");
         exit(EXIT_FAILURE);
     }
 
@@ -1793,6 +2179,7 @@ SCPerfCounterArray *SCPerfGetCounterArrayRange(ThreadVars *tv, uint16_t s_id, ui
     SCPerfCounter *pc = NULL;
     SCPerfCounterArray *pca = NULL;
     uint32_t i = 0;
+    size_t size = 0;
 
     if (pctx == NULL) {
         SCLogDebug("pctx is NULL");
@@ -1813,9 +2200,15 @@ SCPerfCounterArray *SCPerfGetCounterArrayRange(ThreadVars *tv, uint16_t s_id, ui
         return NULL;
     memset(pca, 0, sizeof(SCPerfCounterArray));
 
-    if ( (pca->head = SCThreadMalloc(tv, sizeof(SCPCAElem) * (e_id - s_id  + 2))) == NULL)
+    /* the stats thread reads the local counters while the thread updates
+     * them, keep them on cache lines of their own */
+    size = sizeof(SCPCAElem) * (e_id - s_id  + 2);
+    size = (size + 63) & ~((size_t)63);
+    if ( (pca->head = SCMallocAligned(size, 64)) == NULL) {
+        SCFree(pca);
         return NULL;
-    memset(pca->head, 0, sizeof(SCPCAElem) * (e_id - s_id  + 2));
+    }
+    memset(pca->head, 0, size);
 
     pc = pctx->head;
     while (pc->id != s_id)
@@ -1825,6 +2218,8 @@ SCPerfCounterArray *SCPerfGetCounterArrayRange(ThreadVars *tv, uint16_t s_id, ui
     while ((pc != NULL) && (pc->id <= e_id)) {
         pca->head[i].pc = pc;
         pca->head[i].id = pc->id;
+        pca->head[i].type = pc->value->type;
+        pca->head[i].type_q = pc->type_q->type;
         if (pc->type_q->type & SC_PERF_TYPE_Q_TIMEBASED)
             TimeGet(&pca->head[i].ts);
         pc = pc->next;
@@ -1837,7 +2232,8 @@ SCPerfCounterArray *SCPerfGetCounterArrayRange(ThreadVars *tv, uint16_t s_id, ui
 
 /**
  * \brief Returns a counter array for all counters registered for this tm
- *        instance
+ *        instance.  The stats thread syncs it with the global counters
+ *        before writing them out.
  *
  * \param pctx Pointer to the tv's SCPerfContext
  *
@@ -1850,6 +2246,12 @@ SCPerfCounterArray *SCPerfGetAllCountersArray(ThreadVars *tv, SCPerfContext *pct
                                SCPerfGetCounterArrayRange(tv, 1, pctx->curr_id, pctx):
                                NULL);
 
+    if (pca != NULL) {
+        SCMutexLock(&pctx->m);
+        pctx->pca = pca;
+        SCMutexUnlock(&pctx->m);
+    }
+
     return pca;
 }
 
@@ -1894,13 +2296,11 @@ int SCPerfCounterDisplay(uint16_t id, SCPerfContext *pctx, int disp)
  *
  * \param pca      Pointer to the SCPerfCounterArray
  * \param pctx     Pointer the the tv's SCPerfContext
- * \param reset_lc Indicates whether the local counter has to be reset or not
  *
  * \retval  0 on success
  * \retval -1 on error
  */
-int SCPerfUpdateCounterArray(SCPerfCounterArray *pca, SCPerfContext *pctx,
-                             int reset_lc)
+int SCPerfUpdateCounterArray(SCPerfCounterArray *pca, SCPerfContext *pctx)
 {
     SCPerfCounter  *pc = NULL;
     SCPCAElem *pcae = NULL;
@@ -1923,7 +2323,7 @@ int SCPerfUpdateCounterArray(SCPerfCounterArray *pca, SCPerfContext *pctx,
                 continue;
             }
 
-            SCPerfCopyCounterValue(&pcae[i], reset_lc);
+            SCPerfCopyCounterValue(&pcae[i]);
 
             pc->updated++;
 
@@ -1934,8 +2334,6 @@ int SCPerfUpdateCounterArray(SCPerfCounterArray *pca, SCPerfContext *pctx,
 
     SCMutexUnlock(&pctx->m);
 
-    pctx->perf_flag = 0;
-
     return 1;
 }
 
@@ -1975,14 +2373,56 @@ double SCPerfGetLocalCounterValue(uint16_t id, SCPerfCounterArray *pca)
     }
 }
 
+/**
+ * \brief Syncs the counter arrays of all threads with the global counters.
+ *        The local counters are read without stopping the threads updating
+ *        them.
+ */
+static void SCPerfCollectCounters(void)
+{
+    ThreadVars *tv = NULL;
+    SCPerfCounterArray *pca = NULL;
+    uint32_t u = 0;
+
+    /* not held by the callers, and released before the output functions
+     * that take it again, like LatencyOutputStats() */
+    SCMutexLock(&tv_root_lock);
+    for (u = 0; u < TVT_MAX; u++) {
+        for (tv = tv_root[u]; tv != NULL; tv = tv->next) {
+            SCMutexLock(&tv->sc_perf_pctx.m);
+            pca = tv->sc_perf_pctx.pca;
+            SCMutexUnlock(&tv->sc_perf_pctx.m);
+
+            if (pca != NULL)
+                SCPerfUpdateCounterArray(pca, &tv->sc_perf_pctx);
+        }
+    }
+    SCMutexUnlock(&tv_root_lock);
+
+    return;
+}
+
 /**
  * \brief The output interface dispatcher for the counter api
  */
 void SCPerfOutputCounters()
 {
+    SCPerfCollectCounters();
+
     switch (sc_perf_op_ctx->iface) {
         case SC_PERF_IFACE_FILE:
+            if (sc_perf_op_ctx->json != NULL) {
+                struct timeval tval;
+                gettimeofday(&tval, NULL);
+                SCPerfOutputCounterJson(sc_perf_op_ctx->json, &tval);
+            }
+
             SCPerfOutputCounterFileIface();
+            if (sc_counter_latency && sc_perf_op_ctx->fp != NULL)
+                LatencyOutputStats(sc_perf_op_ctx->fp);
+
+            /* both outputs have the values of this interval now */
+            SCPerfResetTimebasedCounters();
 
             break;
         case SC_PERF_IFACE_CONSOLE:
@@ -2037,7 +2477,7 @@ void SCPerfReleasePCA(SCPerfCounterArray *pca)
 {
     if (pca != NULL) {
         if (pca->head != NULL)
-            SCFree(pca->head);
+            SCFreeAligned(pca->head);
 
         SCFree(pca);
     }
@@ -2250,7 +2690,7 @@ static int SCPerfTestUpdateGlobalCounter10()
     SCPerfCounterIncr(id3, pca);
     SCPerfCounterAddUI64(id3, pca, 100);
 
-    SCPerfUpdateCounterArray(pca, &tv.sc_perf_pctx, 0);
+    SCPerfUpdateCounterArray(pca, &tv.sc_perf_pctx);
 
     result = (1 == *((uint64_t *)tv.sc_perf_pctx.head->value->cvalue) );
     result &= (100 == *((uint64_t *)tv.sc_perf_pctx.head->next->value->cvalue) );
@@ -2288,7 +2728,7 @@ static int SCPerfTestCounterValues11()
     SCPerfCounterAddUI64(id3, pca, 257);
     SCPerfCounterAddUI64(id4, pca, 16843024);
 
-    SCPerfUpdateCounterArray(pca, &tv.sc_perf_pctx, 0);
+    SCPerfUpdateCounterArray(pca, &tv.sc_perf_pctx);
 
     uint64_t *u64p = (uint64_t *)tv.sc_perf_pctx.head->value->cvalue;
     result &= (1 == *u64p);
@@ -2332,7 +2772,7 @@ static int SCPerfTestAverageQual12()
     SCPerfCounterAddDouble(id1, pca, 5);
     SCPerfCounterAddDouble(id1, pca, 6);
 
-    SCPerfUpdateCounterArray(pca, &tv.sc_perf_pctx, 0);
+    SCPerfUpdateCounterArray(pca, &tv.sc_perf_pctx);
 
     result &= (21 == pca->head[1].d_cnt);
     result &= (6 == pca->head[1].syncs);
@@ -2346,7 +2786,7 @@ static int SCPerfTestAverageQual12()
     SCPerfCounterAddUI64(id2, pca, 5.76);
     SCPerfCounterAddDouble(id2, pca, 6.99999);
 
-    SCPerfUpdateCounterArray(pca, &tv.sc_perf_pctx, 0);
+    SCPerfUpdateCounterArray(pca, &tv.sc_perf_pctx);
 
     result &= (21 == pca->head[2].ui64_cnt);
     result &= (6 == pca->head[2].syncs);
@@ -2377,20 +2817,20 @@ static int SCPerfTestMaxQual13()
     SCPerfCounterSetDouble(id1, pca, 5.13562);
     SCPerfCounterSetDouble(id1, pca, 1.2342);
 
-    SCPerfUpdateCounterArray(pca, &tv.sc_perf_pctx, 0);
+    SCPerfUpdateCounterArray(pca, &tv.sc_perf_pctx);
     result &= (5.13562 == *((double *)tv.sc_perf_pctx.head->value->cvalue));
 
     SCPerfCounterSetDouble(id1, pca, 8);
     SCPerfCounterSetDouble(id1, pca, 7);
 
-    SCPerfUpdateCounterArray(pca, &tv.sc_perf_pctx, 0);
+    SCPerfUpdateCounterArray(pca, &tv.sc_perf_pctx);
     result &= (8 == *((double *)tv.sc_perf_pctx.head->value->cvalue));
 
     SCPerfCounterSetDouble(id1, pca, 6);
     SCPerfCounterSetUI64(id1, pca, 10);
     SCPerfCounterSetDouble(id1, pca, 9.562);
 
-    SCPerfUpdateCounterArray(pca, &tv.sc_perf_pctx, 0);
+    SCPerfUpdateCounterArray(pca, &tv.sc_perf_pctx);
     result &= (10 == *((double *)tv.sc_perf_pctx.head->value->cvalue));
 
     return result;
@@ -2531,7 +2971,7 @@ static int SCPerfTestIntervalQual16()
     /* forward the time 6 seconds */
     TimeSetIncrementTime(6);
 
-    SCPerfUpdateCounterArray(pca, &tv.sc_perf_pctx, 0);
+    SCPerfUpdateCounterArray(pca, &tv.sc_perf_pctx);
 
     SCPerfOutputCalculateCounterValue(tv.sc_perf_pctx.head, &d_temp);
 
@@ -2565,7 +3005,7 @@ static int SCPerfTestIntervalQual17()
     /* forward the time 3 seconds */
     TimeSetIncrementTime(3);
 
-    SCPerfUpdateCounterArray(pca, &tv.sc_perf_pctx, 0);
+    SCPerfUpdateCounterArray(pca, &tv.sc_perf_pctx);
 
     SCPerfOutputCalculateCounterValue(tv.sc_perf_pctx.head, &d_temp);
 
@@ -2598,7 +3038,7 @@ static int SCPerfTestIntervalQual18()
     /* forward the time 3 seconds */
     TimeSetIncrementTime(3);
 
-    SCPerfUpdateCounterArray(pca, &tv.sc_perf_pctx, 0);
+    SCPerfUpdateCounterArray(pca, &tv.sc_perf_pctx);
 
     SCPerfCounterAddDouble(id1, pca, 1);
     SCPerfCounterAddDouble(id1, pca, 2);
@@ -2607,7 +3047,7 @@ static int SCPerfTestIntervalQual18()
     /* forward the time 3 seconds */
     TimeSetIncrementTime(3);
 
-    SCPerfUpdateCounterArray(pca, &tv.sc_perf_pctx, 0);
+    SCPerfUpdateCounterArray(pca, &tv.sc_perf_pctx);
 
     SCPerfCounterAddDouble(id1, pca, 3);
     SCPerfCounterAddDouble(id1, pca, 3);
@@ -2626,7 +3066,7 @@ static int SCPerfTestIntervalQual18()
     /* forward the time 3 seconds */
     TimeSetIncrementTime(3);
 
-    SCPerfUpdateCounterArray(pca, &tv.sc_perf_pctx, 0);
+    SCPerfUpdateCounterArray(pca, &tv.sc_perf_pctx);
 
     SCPerfCounterAddDouble(id1, pca, 1);
     SCPerfCounterAddDouble(id1, pca, 2);
@@ -2644,7 +3084,7 @@ static int SCPerfTestIntervalQual18()
     /* forward the time 1 second */
     TimeSetIncrementTime(1);
 
-    SCPerfUpdateCounterArray(pca, &tv.sc_perf_pctx, 0);
+    SCPerfUpdateCounterArray(pca, &tv.sc_perf_pctx);
 
     SCPerfOutputCalculateCounterValue(tv.sc_perf_pctx.head, &d_temp);
 
@@ -2652,6 +3092,254 @@ static int SCPerfTestIntervalQual18()
 
     return result;
 }
+/**
+ * \test the counter array is registered with the context, so the stats thread
+ *       can sync it, and syncing doesn't reset the local counters
+ */
+static int SCPerfTestCollect19()
+{
+    ThreadVars tv;
+    SCPerfCounterArray *pca = NULL;
+    int result = 1;
+
+    uint16_t id1;
+
+    memset(&tv, 0, sizeof(ThreadVars));
+
+    id1 = SCPerfRegisterCounter("t1", "c1", SC_PERF_TYPE_UINT64, NULL,
+                                &tv.sc_perf_pctx);
+
+    pca = SCPerfGetAllCountersArray(&tv, &tv.sc_perf_pctx);
+    if (pca == NULL)
+        return 0;
+
+    result &= (tv.sc_perf_pctx.pca == pca);
+    result &= (((uintptr_t)pca->head & 63) == 0);
+
+    SCPerfCounterIncr(id1, pca);
+    SCPerfCounterIncr(id1, pca);
+    SCPerfCounterAddUI64(id1, pca, 3);
+
+    SCPerfUpdateCounterArray(tv.sc_perf_pctx.pca, &tv.sc_perf_pctx);
+
+    result &= (*((uint64_t *)tv.sc_perf_pctx.head->value->cvalue) == 5);
+
+    SCPerfCounterIncr(id1, pca);
+
+    SCPerfUpdateCounterArray(tv.sc_perf_pctx.pca, &tv.sc_perf_pctx);
+
+    result &= (*((uint64_t *)tv.sc_perf_pctx.head->value->cvalue) == 6);
+    result &= (pca->head[id1].ui64_cnt == 6);
+
+    SCPerfReleasePerfCounterS(tv.sc_perf_pctx.head);
+    SCPerfReleasePCA(pca);
+
+    return result;
+}
+
+/**
+ * \test the json output has the counters of the threads and their totals,
+ *       with the deltas since the previous record, and only the counters
+ *       selected
+ */
+static int SCPerfTestJson20()
+{
+    ThreadVars tv1;
+    ThreadVars tv2;
+    ThreadVars *tv_root_save = tv_root[TVT_PPT];
+    SCPerfCounterArray *pca1 = NULL;
+    SCPerfCounterArray *pca2 = NULL;
+    SCPerfJsonCtx jctx;
+    char *counters[] = { "t1." };
+    struct timeval tval;
+    char buf[2048];
+    char *line2 = NULL;
+    size_t len = 0;
+    int result = 0;
+
+    uint16_t id1, id2, id3;
+
+    memset(&tv1, 0, sizeof(ThreadVars));
+    memset(&tv2, 0, sizeof(ThreadVars));
+    memset(&jctx, 0, sizeof(jctx));
+    tv1.name = "tv1";
+    tv2.name = "tv2";
+    tv1.next = &tv2;
+
+    id1 = SCPerfRegisterCounter("t1.pkts", "c1", SC_PERF_TYPE_UINT64, NULL,
+                                &tv1.sc_perf_pctx);
+    id2 = SCPerfRegisterCounter("t2.pkts", "c1", SC_PERF_TYPE_UINT64, NULL,
+                                &tv1.sc_perf_pctx);
+    id3 = SCPerfRegisterCounter("t1.pkts", "c2", SC_PERF_TYPE_UINT64, NULL,
+                                &tv2.sc_perf_pctx);
+
+    pca1 = SCPerfGetAllCountersArray(&tv1, &tv1.sc_perf_pctx);
+    pca2 = SCPerfGetAllCountersArray(&tv2, &tv2.sc_perf_pctx);
+    if (pca1 == NULL || pca2 == NULL)
+        goto end;
+
+    jctx.threads = 1;
+    jctx.deltas = 1;
+    jctx.counters = counters;
+    jctx.counters_cnt = 1;
+    jctx.ts.tv_sec = 100;
+    if ( (jctx.file_ctx = LogFileNewCtx()) == NULL)
+        goto end;
+    if ( (jctx.file_ctx->fp = tmpfile()) == NULL)
+        goto end;
+
+    tv_root[TVT_PPT] = &tv1;
+
+    SCPerfCounterAddUI64(id1, pca1, 10);
+    SCPerfCounterAddUI64(id2, pca1, 5);
+    SCPerfCounterAddUI64(id3, pca2, 20);
+    SCPerfUpdateCounterArray(pca1, &tv1.sc_perf_pctx);
+    SCPerfUpdateCounterArray(pca2, &tv2.sc_perf_pctx);
+
+    tval.tv_sec = 102;
+    tval.tv_usec = 0;
+    if (SCPerfOutputCounterJson(&jctx, &tval) != 1)
+        goto end;
+
+    SCPerfCounterAddUI64(id1, pca1, 6);
+    SCPerfUpdateCounterArray(pca1, &tv1.sc_perf_pctx);
+
+    tval.tv_sec = 104;
+    if (SCPerfOutputCounterJson(&jctx, &tval) != 1)
+        goto end;
+
+    rewind(jctx.file_ctx->fp);
+    len = fread(buf, 1, sizeof(buf) - 1, jctx.file_ctx->fp);
+    buf[len] = '\0';
+
+    line2 = strchr(buf, '\n');
+    if (line2 == NULL)
+        goto end;
+    *line2++ = '\0';
+
+    if (strstr(buf, "\"interval\":2.000") == NULL ||
+        strstr(buf, "\"totals\":{\"t1.pkts\":{\"value\":30,\"delta\":30,"
+               "\"rate\":15.000}}}") == NULL) {
+        printf("unexpected first record %s: ", buf);
+        goto end;
+    }
+
+    if (strstr(line2, "\"threads\":{\"tv1\":{\"t1.pkts\":{\"value\":16,"
+               "\"delta\":6,\"rate\":3.000}},\"tv2\":{\"t1.pkts\":{\"value\""
+               ":20,\"delta\":0,\"rate\":0.000}}}") == NULL ||
+        strstr(line2, "\"totals\":{\"t1.pkts\":{\"value\":36,\"delta\":6,"
+               "\"rate\":3.000}}}\n") == NULL) {
+        printf("unexpected second record %s: ", line2);
+        goto end;
+    }
+
+    if (strstr(buf, "t2.pkts") != NULL || strstr(line2, "t2.pkts") != NULL) {
+        printf("counter not selected in the output: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    tv_root[TVT_PPT] = tv_root_save;
+    if (jctx.file_ctx != NULL)
+        LogFileFreeCtx(jctx.file_ctx);
+    if (jctx.buf != NULL)
+        SCFree(jctx.buf);
+    if (jctx.totals != NULL)
+        SCFree(jctx.totals);
+    SCPerfReleasePerfCounterS(tv1.sc_perf_pctx.head);
+    SCPerfReleasePerfCounterS(tv2.sc_perf_pctx.head);
+    SCPerfReleasePCA(pca1);
+    SCPerfReleasePCA(pca2);
+
+    return result;
+}
+
+/**
+ * \test the json output has the value of a timebased counter over its
+ *       interval, and the timebased counters are reset after the output
+ */
+static int SCPerfTestJson21()
+{
+    ThreadVars tv;
+    ThreadVars *tv_root_save = tv_root[TVT_PPT];
+    SCPerfCounterArray *pca = NULL;
+    SCPerfJsonCtx jctx;
+    struct timeval tval;
+    char buf[1024];
+    size_t len = 0;
+    int result = 0;
+
+    uint16_t id1;
+
+    memset(&tv, 0, sizeof(ThreadVars));
+    memset(&jctx, 0, sizeof(jctx));
+    tv.name = "tv1";
+
+    id1 = SCPerfRegisterIntervalCounter("t1", "c1", SC_PERF_TYPE_DOUBLE, NULL,
+                                        &tv.sc_perf_pctx, "3s");
+
+    pca = SCPerfGetAllCountersArray(&tv, &tv.sc_perf_pctx);
+    if (pca == NULL)
+        goto end;
+
+    jctx.ts.tv_sec = 100;
+    if ( (jctx.file_ctx = LogFileNewCtx()) == NULL)
+        goto end;
+    if ( (jctx.file_ctx->fp = tmpfile()) == NULL)
+        goto end;
+
+    tv_root[TVT_PPT] = &tv;
+
+    SCPerfCounterAddDouble(id1, pca, 1);
+    SCPerfCounterAddDouble(id1, pca, 2);
+    SCPerfCounterAddDouble(id1, pca, 3);
+    SCPerfCounterAddDouble(id1, pca, 4);
+    SCPerfCounterAddDouble(id1, pca, 5);
+    SCPerfCounterAddDouble(id1, pca, 6);
+
+    /* forward the time 6 seconds */
+    TimeSetIncrementTime(6);
+
+    SCPerfUpdateCounterArray(pca, &tv.sc_perf_pctx);
+
+    tval.tv_sec = 106;
+    tval.tv_usec = 0;
+    if (SCPerfOutputCounterJson(&jctx, &tval) != 1)
+        goto end;
+
+    rewind(jctx.file_ctx->fp);
+    len = fread(buf, 1, sizeof(buf) - 1, jctx.file_ctx->fp);
+    buf[len] = '\0';
+
+    /* 21 over two intervals of 3s */
+    if (strstr(buf, "\"totals\":{\"t1\":10.500}}") == NULL) {
+        printf("unexpected record %s: ", buf);
+        goto end;
+    }
+
+    SCPerfResetTimebasedCounters();
+    if (*((double *)tv.sc_perf_pctx.head->value->cvalue) != 0 ||
+        tv.sc_perf_pctx.head->type_q->tbc_secs != 0) {
+        printf("timebased counter not reset: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    tv_root[TVT_PPT] = tv_root_save;
+    if (jctx.file_ctx != NULL)
+        LogFileFreeCtx(jctx.file_ctx);
+    if (jctx.buf != NULL)
+        SCFree(jctx.buf);
+    if (jctx.totals != NULL)
+        SCFree(jctx.totals);
+    SCPerfReleasePerfCounterS(tv.sc_perf_pctx.head);
+    SCPerfReleasePCA(pca);
+
+    return result;
+}
+
 #endif
 
 void SCPerfRegisterTests()
@@ -2676,5 +3364,8 @@ void SCPerfRegisterTests()
     UtRegisterTest("SCPerfTestIntervalQual16", SCPerfTestIntervalQual16, 1);
     UtRegisterTest("SCPerfTestIntervalQual17", SCPerfTestIntervalQual17, 1);
     UtRegisterTest("SCPerfTestIntervalQual18", SCPerfTestIntervalQual18, 1);
+    UtRegisterTest("SCPerfTestCollect19", SCPerfTestCollect19, 1);
+    UtRegisterTest("SCPerfTestJson20", SCPerfTestJson20, 1);
+    UtRegisterTest("SCPerfTestJson21", SCPerfTestJson21, 1);
 #endif
 }
@@ -26,9 +26,7 @@
 
 /* forward declaration of the ThreadVars structure */
 struct ThreadVars_;
-
-/* Time interval for syncing the local counters with the global ones */
-#define SC_PERF_WUT_TTS 3
+struct LogFileCtx_;
 
 /* Time interval at which the mgmt thread o/p the stats */
 #define SC_PERF_MGMTT_TTS 8
@@ -122,6 +120,13 @@ typedef struct SCPerfCounter_ {
     /* counter qualifier */
     SCPerfCounterTypeQ *type_q;
 
+    /* value at the last json output, for the deltas.  Only used by the
+     * stats thread */
+    union {
+        uint64_t ui64_out;
+        double d_out;
+    };
+
     /* the next perfcounter for this tv's tm instance */
     struct SCPerfCounter_ *next;
 } SCPerfCounter;
@@ -133,8 +138,9 @@ typedef struct SCPerfContext_ {
     /* pointer to the head of a list of counters assigned under this context */
     SCPerfCounter *head;
 
-    /* flag set by the wakeup thread, to inform the client threads to sync */
-    uint32_t perf_flag;
+    /* counter array of the thread owning this context, the stats thread
+     * copies its values to the counters above before output */
+    struct SCPerfCounterArray_ *pca;
 
     /* holds the total no of counters already assigned for this perf context */
     uint16_t curr_id;
@@ -153,6 +159,14 @@ typedef struct SCPCAElem_ {
     /* counter id of the above counter(pc) */
     uint16_t id;
 
+    /* copies of pc->value->type and pc->type_q->type, so updates don't
+     * touch the global counter */
+    uint16_t type;
+    uint32_t type_q;
+
+    /* odd while the owner updates the counter, see SC_PERF_WRITE_BEGIN */
+    uint32_t seq;
+
     union {
         uint64_t ui64_cnt;
         double d_cnt;
@@ -167,11 +181,22 @@ typedef struct SCPCAElem_ {
     /* timestamp to indicate the time, when the counter was last used to update
      * the global counter.  It is used for timebased counter calculations */
     struct timeval ts;
+
+    /* value of the local counter at that time.  Like ts, only used by the
+     * thread syncing the counter */
+    union {
+        uint64_t ui64_last;
+        double d_last;
+    };
 } SCPCAElem;
 
 /**
  * \brief The SCPerfCounterArray used to hold the local version of the counters
  *        registered
+ *
+ * The local counters are only written by the thread owning the array, and
+ * read by the stats thread without locking.  The elements are cache line
+ * aligned and padded, so they don't share a line with anything else.
  */
 typedef struct SCPerfCounterArray_ {
     /* points to the array holding PCAElems */
@@ -194,6 +219,62 @@ typedef struct SCPerfClubTMInst_ {
     struct SCPerfClubTMInst_ *next;
 } SCPerfClubTMInst;
 
+/**
+ * \brief Value of a counter in a json stats record, of a thread or the total
+ *        of all threads
+ */
+typedef struct SCPerfJsonValue_ {
+    const char *cname;
+
+    /* SC_PERF_TYPE_* and SC_PERF_TYPE_Q_* of the counter */
+    uint32_t type;
+    int type_q;
+
+    /* no of threads added to a total */
+    uint32_t cnt;
+
+    union {
+        uint64_t ui64;
+        double d;
+    };
+
+    /* change since the previous record, only for normal counters */
+    union {
+        uint64_t ui64_delta;
+        double d_delta;
+    };
+} SCPerfJsonValue;
+
+/**
+ * \brief Context of the json stats output, one record per line
+ */
+typedef struct SCPerfJsonCtx_ {
+    struct LogFileCtx_ *file_ctx;
+
+    /* add the counters of every thread, not only the totals */
+    int threads;
+
+    /* add the deltas and rates since the previous record */
+    int deltas;
+
+    /* prefixes of the counters to output, all counters if cnt is 0 */
+    char **counters;
+    uint32_t counters_cnt;
+
+    /* time of the previous record */
+    struct timeval ts;
+
+    /* the record, written with a single write */
+    char *buf;
+    uint32_t buf_size;
+    uint32_t buf_len;
+
+    /* totals of the counters of all threads */
+    SCPerfJsonValue *totals;
+    uint32_t totals_cnt;
+    uint32_t totals_size;
+} SCPerfJsonCtx;
+
 /**
  * \brief Holds the output interface context for the counter api
  */
@@ -213,6 +294,9 @@ typedef struct SCPerfOPIfaceContext_ {
 
     SCPerfClubTMInst *pctmi;
     SCMutex pctmi_lock;
+
+    /* machine readable output, NULL if disabled */
+    SCPerfJsonCtx *json;
 } SCPerfOPIfaceContext;
 
 /* the initialization functions */
@@ -239,7 +323,7 @@ SCPerfCounterArray *SCPerfGetCounterArrayRange(struct ThreadVars_ *, uint16_t, u
 SCPerfCounterArray * SCPerfGetAllCountersArray(struct ThreadVars_ *, SCPerfContext *);
 int SCPerfCounterDisplay(uint16_t, SCPerfContext *, int);
 
-int SCPerfUpdateCounterArray(SCPerfCounterArray *, SCPerfContext *, int);
+int SCPerfUpdateCounterArray(SCPerfCounterArray *, SCPerfContext *);
 double SCPerfGetLocalCounterValue(uint16_t, SCPerfCounterArray *);
 
 void SCPerfOutputCounters(void);
@@ -251,23 +335,98 @@ void SCPerfReleasePCA(SCPerfCounterArray *);
 
 void SCPerfCounterSetUI64(uint16_t, SCPerfCounterArray *, uint64_t);
 void SCPerfCounterSetDouble(uint16_t, SCPerfCounterArray *, double);
-void SCPerfCounterIncr(uint16_t, SCPerfCounterArray *);
 
 void SCPerfRegisterTests(void);
 
 /* functions used to update local counter values */
-void SCPerfCounterAddUI64(uint16_t, SCPerfCounterArray *, uint64_t);
 void SCPerfCounterAddDouble(uint16_t, SCPerfCounterArray *, double);
 
-#define SCPerfSyncCounters(tv, reset_lc) \
-    SCPerfUpdateCounterArray((tv)->sc_perf_pca, &(tv)->sc_perf_pctx, (reset_lc)); \
+/* Accessors for the local counters, which have a single writer and are read
+ * by the stats thread.  No lock or atomic instruction. */
+#define SC_PERF_LOAD(x)         (*(volatile __typeof__(x) *)&(x))
+#define SC_PERF_STORE(x, v)     (*(volatile __typeof__(x) *)&(x) = (v))
+
+/* Aligned 64 bit loads and stores don't tear on 64 bit platforms, so there
+ * all that is needed is to keep the compiler from caching or splitting them.
+ * On 32 bit platforms, like TILEPro, they take two instructions.  There the
+ * writer makes a sequence count odd while it updates, and the reader reads
+ * again if the count was odd or changed. */
+#if __WORDSIZE == 64
+#define SC_PERF_WRITE_BEGIN(seq)
+#define SC_PERF_WRITE_END(seq)
+#define SC_PERF_READ_BEGIN(seq)     0
+#define SC_PERF_READ_RETRY(seq, s)  0
+#else
+#define SC_PERF_WRITE_BEGIN(seq) do { \
+    SC_PERF_STORE((seq), (seq) + 1); \
+    hw_barrier(); \
+} while (0)
+#define SC_PERF_WRITE_END(seq) do { \
+    hw_barrier(); \
+    SC_PERF_STORE((seq), (seq) + 1); \
+} while (0)
+#define SC_PERF_READ_BEGIN(seq) ({ \
+    uint32_t _s; \
+    while ((_s = SC_PERF_LOAD(seq)) & 1) \
+        cc_barrier(); \
+    hw_barrier(); \
+    _s; \
+})
+#define SC_PERF_READ_RETRY(seq, s) ({ \
+    hw_barrier(); \
+    SC_PERF_LOAD(seq) != (s); \
+})
+#endif
+
+/**
+ * \brief Counts an update of the local counter, for averages
+ */
+static inline void SCPerfCounterUpdated(SCPCAElem *pcae)
+{
+    if (pcae->syncs == ULONG_MAX) {
+        SC_PERF_STORE(pcae->syncs, 0);
+        SC_PERF_STORE(pcae->wrapped_syncs, pcae->wrapped_syncs + 1);
+    }
+    SC_PERF_STORE(pcae->syncs, pcae->syncs + 1);
+}
+
+/**
+ * \brief Adds a value of type uint64_t to the local counter.
+ *
+ * \param id  ID of the counter as set by the API
+ * \param pca Counter array that holds the local counter for this TM
+ * \param x   Value to add to this local counter
+ */
+static inline void SCPerfCounterAddUI64(uint16_t id, SCPerfCounterArray *pca,
+                                        uint64_t x)
+{
+    if (pca == NULL || id < 1 || id > pca->size)
+        return;
+
+    SCPCAElem *pcae = &pca->head[id];
+    SC_PERF_WRITE_BEGIN(pcae->seq);
+    if (pcae->type == SC_PERF_TYPE_UINT64)
+        SC_PERF_STORE(pcae->ui64_cnt, pcae->ui64_cnt + x);
+    else if (pcae->type == SC_PERF_TYPE_DOUBLE)
+        SC_PERF_STORE(pcae->d_cnt, pcae->d_cnt + x);
+
+    SCPerfCounterUpdated(pcae);
+    SC_PERF_WRITE_END(pcae->seq);
+}
+
+/**
+ * \brief Increments the local counter
+ *
+ * \param id  Index of the counter in the counter array
+ * \param pca Counter array that holds the local counters for this TM
+ */
+static inline void SCPerfCounterIncr(uint16_t id, SCPerfCounterArray *pca)
+{
+    SCPerfCounterAddUI64(id, pca, 1);
+}
 
-#define SCPerfSyncCountersIfSignalled(tv, reset_lc)                        \
-    do {                                                        \
-        if ((tv)->sc_perf_pctx.perf_flag == 1) {                            \
-            SCPerfUpdateCounterArray((tv)->sc_perf_pca, &(tv)->sc_perf_pctx, (reset_lc)); \
-        }                                                               \
-    } while (0)
+#define SCPerfSyncCounters(tv) \
+    SCPerfUpdateCounterArray((tv)->sc_perf_pca, &(tv)->sc_perf_pctx); \
 
 #ifdef BUILD_UNIX_SOCKET
 #include <jansson.h>
@@ -370,7 +370,7 @@ void *SCCudaPBTmThreadsSlot1(void *td)
         }
 
         if (TmThreadsCheckFlag(tv, THV_KILL)) {
-            SCPerfSyncCounters(tv, 0);
+            SCPerfSyncCounters(tv);
             run = 0;
         }
     }
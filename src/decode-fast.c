@@ -0,0 +1,464 @@
+/* Copyright (C) 2007-2013 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \ingroup decode
+ *
+ * @{
+ */
+
+
+/**
+ * \file
+ *
+ * Fast path for the common ethernet packets: an optional single vlan tag,
+ * IPv4 without options or fragmentation or IPv6 without extension headers,
+ * and TCP or UDP on top. These are validated and set up in one function
+ * instead of the DecodeEthernet -> DecodeVLAN -> DecodeIPV4 -> DecodeTCP
+ * chain, and the per layer counters are kept in the DecodeThreadVars until
+ * the caller flushes them, usually once per batch.
+ *
+ * Anything else is left to the full decoders. The packet isn't touched
+ * until all layers are validated, so these see it as it came in and set
+ * the events for malformed packets.
+ */
+
+#include "suricata-common.h"
+#include "decode.h"
+#include "decode-fast.h"
+#include "decode-teredo.h"
+
+#include "flow.h"
+#include "host.h"
+#include "pkt-var.h"
+#include "app-layer.h"
+
+#include "util-unittest.h"
+#include "util-debug.h"
+#include "util-profiling.h"
+
+/**
+ * \brief decode an ethernet packet of a common shape in one go
+ *
+ * \param tv pointer to the thread vars
+ * \param dtv pointer code thread vars
+ * \param p pointer to the packet struct
+ * \param pkt pointer to the raw packet
+ * \param len packet len
+ * \param pq pointer to the packet queue
+ *
+ * \retval 1 packet is decoded
+ * \retval 0 packet is untouched, pass it to DecodeEthernet()
+ */
+int DecodeEthernetFast(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p,
+                       uint8_t *pkt, uint16_t len, PacketQueue *pq)
+{
+    VLANHdr *vlanh = NULL;
+    uint8_t *l3 = pkt + ETHERNET_HEADER_LEN;
+    uint16_t l3_len;
+    uint8_t *l4;
+    uint16_t l4_len;
+    uint16_t type;
+    uint8_t proto;
+    uint8_t hlen = 0;
+
+    if (unlikely(len < ETHERNET_HEADER_LEN + IPV4_HEADER_LEN))
+        return 0;
+
+    l3_len = len - ETHERNET_HEADER_LEN;
+    type = ntohs(((EthernetHdr *)pkt)->eth_type);
+    if (type == ETHERNET_TYPE_VLAN) {
+        vlanh = (VLANHdr *)l3;
+        type = GET_VLAN_PROTO(vlanh);
+        l3 += VLAN_HEADER_LEN;
+        l3_len -= VLAN_HEADER_LEN;
+    }
+
+    if (likely(type == ETHERNET_TYPE_IP)) {
+        IPV4Hdr *ip4h = (IPV4Hdr *)l3;
+
+        /* version 4 and no options */
+        if (l3_len < IPV4_HEADER_LEN || ip4h->ip_verhl != 0x45)
+            return 0;
+        uint16_t iplen = ntohs(IPV4_GET_RAW_IPLEN(ip4h));
+        if (iplen < IPV4_HEADER_LEN || iplen > l3_len)
+            return 0;
+        /* fragments go through Defrag() */
+        if (ntohs(IPV4_GET_RAW_IPOFFSET(ip4h)) & 0x3fff)
+            return 0;
+
+        proto = IPV4_GET_RAW_IPPROTO(ip4h);
+        l4 = l3 + IPV4_HEADER_LEN;
+        l4_len = iplen - IPV4_HEADER_LEN;
+    } else if (type == ETHERNET_TYPE_IPV6) {
+        IPV6Hdr *ip6h = (IPV6Hdr *)l3;
+
+        if (l3_len < IPV6_HEADER_LEN || IPV6_GET_RAW_VER(ip6h) != 6)
+            return 0;
+        l4_len = IPV6_GET_RAW_PLEN(ip6h);
+        if (l3_len - IPV6_HEADER_LEN < l4_len)
+            return 0;
+
+        proto = IPV6_GET_RAW_NH(ip6h);
+        l4 = l3 + IPV6_HEADER_LEN;
+    } else {
+        return 0;
+    }
+
+    if (likely(proto == IPPROTO_TCP)) {
+        if (l4_len < TCP_HEADER_LEN)
+            return 0;
+        hlen = TCP_GET_RAW_OFFSET((TCPHdr *)l4) << 2;
+        if (hlen < TCP_HEADER_LEN || hlen > l4_len)
+            return 0;
+    } else if (proto == IPPROTO_UDP) {
+        if (l4_len < UDP_HEADER_LEN || UDP_GET_RAW_LEN((UDPHdr *)l4) != l4_len)
+            return 0;
+    } else {
+        return 0;
+    }
+
+    /* all layers are valid, set up the packet like the full decoders */
+    dtv->fast.eth++;
+    p->ethh = (EthernetHdr *)pkt;
+    if (vlanh != NULL) {
+        dtv->fast.vlan++;
+        p->vlanh = vlanh;
+    }
+
+    if (type == ETHERNET_TYPE_IP) {
+        dtv->fast.ipv4++;
+        p->ip4h = (IPV4Hdr *)l3;
+        SET_IPV4_SRC_ADDR(p, &p->src);
+        SET_IPV4_DST_ADDR(p, &p->dst);
+    } else {
+        dtv->fast.ipv6++;
+        p->ip6h = (IPV6Hdr *)l3;
+        SET_IPV6_SRC_ADDR(p, &p->src);
+        SET_IPV6_DST_ADDR(p, &p->dst);
+        IPV6_SET_L4PROTO(p, proto);
+    }
+
+    if (proto == IPPROTO_TCP) {
+        dtv->fast.tcp++;
+        p->tcph = (TCPHdr *)l4;
+        if (hlen > TCP_HEADER_LEN)
+            DecodeTCPOptions(p, l4 + TCP_HEADER_LEN, hlen - TCP_HEADER_LEN);
+        SET_TCP_SRC_PORT(p, &p->sp);
+        SET_TCP_DST_PORT(p, &p->dp);
+        p->proto = IPPROTO_TCP;
+        p->payload = l4 + hlen;
+        p->payload_len = l4_len - hlen;
+
+        FlowHandlePacket(tv, dtv, p);
+        return 1;
+    }
+
+    dtv->fast.udp++;
+    p->udph = (UDPHdr *)l4;
+    SET_UDP_SRC_PORT(p, &p->sp);
+    SET_UDP_DST_PORT(p, &p->dp);
+    p->proto = IPPROTO_UDP;
+    p->payload = l4 + UDP_HEADER_LEN;
+    p->payload_len = l4_len - UDP_HEADER_LEN;
+
+    /* rest is as in DecodeUDP() */
+    if (DecodeTeredo(tv, dtv, p, p->payload, p->payload_len, pq) == 1) {
+        FlowHandlePacket(tv, dtv, p);
+        return 1;
+    }
+
+    FlowHandlePacket(tv, dtv, p);
+    if (p->flow != NULL) {
+        AppLayerHandleUdp(&dtv->udp_dp_ctx, p->flow, p);
+    }
+    return 1;
+}
+
+/**
+ * \brief add the counts of the fast path to the perf counters
+ *
+ * \param tv pointer to the thread vars
+ * \param dtv pointer code thread vars
+ */
+void DecodeFastFlushCounters(ThreadVars *tv, DecodeThreadVars *dtv)
+{
+    DecodeFastCounters *c = &dtv->fast;
+
+    if (c->eth == 0)
+        return;
+
+    SCPerfCounterAddUI64(dtv->counter_eth, tv->sc_perf_pca, c->eth);
+    if (c->vlan > 0)
+        SCPerfCounterAddUI64(dtv->counter_vlan, tv->sc_perf_pca, c->vlan);
+    if (c->ipv4 > 0)
+        SCPerfCounterAddUI64(dtv->counter_ipv4, tv->sc_perf_pca, c->ipv4);
+    if (c->ipv6 > 0)
+        SCPerfCounterAddUI64(dtv->counter_ipv6, tv->sc_perf_pca, c->ipv6);
+    if (c->tcp > 0)
+        SCPerfCounterAddUI64(dtv->counter_tcp, tv->sc_perf_pca, c->tcp);
+    if (c->udp > 0)
+        SCPerfCounterAddUI64(dtv->counter_udp, tv->sc_perf_pca, c->udp);
+
+    memset(c, 0x00, sizeof(*c));
+}
+
+#ifdef UNITTESTS
+/* eth, vlan 100, ipv4 192.168.1.1 -> 192.168.1.2, tcp 1024 -> 80 with
+ * NOP NOP TS options and 4 bytes of payload */
+static uint8_t fast_vlan_ipv4_tcp[] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x00, 0x06,
+    0x07, 0x08, 0x09, 0x0a, 0x81, 0x00, 0x00, 0x64,
+    0x08, 0x00, 0x45, 0x00, 0x00, 0x38, 0x00, 0x01,
+    0x40, 0x00, 0x40, 0x06, 0x00, 0x00, 0xc0, 0xa8,
+    0x01, 0x01, 0xc0, 0xa8, 0x01, 0x02, 0x04, 0x00,
+    0x00, 0x50, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00,
+    0x00, 0x00, 0x80, 0x18, 0x10, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x01, 0x01, 0x08, 0x0a, 0x00, 0x00,
+    0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x61, 0x62,
+    0x63, 0x64 };
+
+/* eth, ipv6 2001:db8::1 -> 2001:db8::2, tcp 1024 -> 80 without options
+ * and 4 bytes of payload */
+static uint8_t fast_ipv6_tcp[] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x00, 0x06,
+    0x07, 0x08, 0x09, 0x0a, 0x86, 0xdd, 0x60, 0x00,
+    0x00, 0x00, 0x00, 0x18, 0x06, 0x40, 0x20, 0x01,
+    0x0d, 0xb8, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x20, 0x01,
+    0x0d, 0xb8, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x04, 0x00,
+    0x00, 0x50, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00,
+    0x00, 0x00, 0x50, 0x18, 0x10, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x61, 0x62, 0x63, 0x64 };
+
+#define FAST_OFFSET(p, ptr) \
+    ((ptr) == NULL ? -1 : (int)((uint8_t *)(ptr) - GET_PKT_DATA((p))))
+
+/** \brief check the fast path set up a packet like the full decoders */
+static int DecodeFastCompare(Packet *full, Packet *fast)
+{
+    if (FAST_OFFSET(full, full->ethh) != FAST_OFFSET(fast, fast->ethh) ||
+        FAST_OFFSET(full, full->vlanh) != FAST_OFFSET(fast, fast->vlanh) ||
+        FAST_OFFSET(full, full->ip4h) != FAST_OFFSET(fast, fast->ip4h) ||
+        FAST_OFFSET(full, full->ip6h) != FAST_OFFSET(fast, fast->ip6h) ||
+        FAST_OFFSET(full, full->tcph) != FAST_OFFSET(fast, fast->tcph) ||
+        FAST_OFFSET(full, full->payload) != FAST_OFFSET(fast, fast->payload)) {
+        printf("header offsets differ: ");
+        return 0;
+    }
+    if (CMP_ADDR(&full->src, &fast->src) == 0 ||
+        CMP_ADDR(&full->dst, &fast->dst) == 0 ||
+        full->sp != fast->sp || full->dp != fast->dp ||
+        full->proto != fast->proto ||
+        full->payload_len != fast->payload_len) {
+        printf("addresses, ports or payload differ: ");
+        return 0;
+    }
+    if (full->TCP_OPTS_CNT != fast->TCP_OPTS_CNT ||
+        (full->tcpvars.ts == NULL) != (fast->tcpvars.ts == NULL)) {
+        printf("tcp options differ: ");
+        return 0;
+    }
+    if (full->flow == NULL || full->flow != fast->flow) {
+        printf("not in the same flow: ");
+        return 0;
+    }
+    return 1;
+}
+
+static int DecodeFastTest(uint8_t *raw, uint16_t rawlen, int vlan, int ipv6)
+{
+    Packet *full = SCMalloc(SIZE_OF_PACKET);
+    Packet *fast = SCMalloc(SIZE_OF_PACKET);
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+    int result = 0;
+
+    if (unlikely(full == NULL || fast == NULL)) {
+        if (full != NULL)
+            SCFree(full);
+        if (fast != NULL)
+            SCFree(fast);
+        return 0;
+    }
+
+    memset(&tv, 0, sizeof(ThreadVars));
+    memset(&dtv, 0, sizeof(DecodeThreadVars));
+    PACKET_INITIALIZE(full);
+    PACKET_INITIALIZE(fast);
+    FlowInitConfig(FLOW_QUIET);
+
+    PacketCopyData(full, raw, rawlen);
+    DecodeEthernet(&tv, &dtv, full, GET_PKT_DATA(full), GET_PKT_LEN(full), NULL);
+
+    PacketCopyData(fast, raw, rawlen);
+    if (DecodeEthernetFast(&tv, &dtv, fast, GET_PKT_DATA(fast),
+                           GET_PKT_LEN(fast), NULL) != 1) {
+        printf("fast path didn't take the packet: ");
+        goto end;
+    }
+
+    if (DecodeFastCompare(full, fast) == 0)
+        goto end;
+    if (ipv6 && full->ip6vars.l4proto != fast->ip6vars.l4proto) {
+        printf("l4proto differs: ");
+        goto end;
+    }
+
+    if (dtv.fast.eth != 1 || dtv.fast.vlan != (uint32_t)vlan ||
+        dtv.fast.ipv4 != (uint32_t)!ipv6 || dtv.fast.ipv6 != (uint32_t)ipv6 ||
+        dtv.fast.tcp != 1 || dtv.fast.udp != 0) {
+        printf("fast path counts are off: ");
+        goto end;
+    }
+    DecodeFastFlushCounters(&tv, &dtv);
+    if (dtv.fast.eth != 0 || dtv.fast.tcp != 0) {
+        printf("counts not reset by the flush: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    PACKET_RECYCLE(full);
+    PACKET_RECYCLE(fast);
+    FlowShutdown();
+    PACKET_CLEANUP(full);
+    PACKET_CLEANUP(fast);
+    SCFree(full);
+    SCFree(fast);
+    return result;
+}
+
+/** \test vlan, ipv4, tcp with options is decoded like DecodeEthernet does */
+static int DecodeFastTest01(void)
+{
+    return DecodeFastTest(fast_vlan_ipv4_tcp, sizeof(fast_vlan_ipv4_tcp), 1, 0);
+}
+
+/** \test ipv6, tcp is decoded like DecodeEthernet does */
+static int DecodeFastTest02(void)
+{
+    return DecodeFastTest(fast_ipv6_tcp, sizeof(fast_ipv6_tcp), 0, 1);
+}
+
+/** \test fragments, ip options and truncated packets are left untouched */
+static int DecodeFastTest03(void)
+{
+    uint8_t raw[sizeof(fast_vlan_ipv4_tcp)];
+    Packet *p = SCMalloc(SIZE_OF_PACKET);
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+    int result = 0;
+
+    if (unlikely(p == NULL))
+        return 0;
+    memset(&tv, 0, sizeof(ThreadVars));
+    memset(&dtv, 0, sizeof(DecodeThreadVars));
+    PACKET_INITIALIZE(p);
+
+    /* more fragments */
+    memcpy(raw, fast_vlan_ipv4_tcp, sizeof(raw));
+    raw[24] = 0x20;
+    PacketCopyData(p, raw, sizeof(raw));
+    if (DecodeEthernetFast(&tv, &dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), NULL) != 0)
+        goto end;
+
+    /* ip options */
+    memcpy(raw, fast_vlan_ipv4_tcp, sizeof(raw));
+    raw[18] = 0x46;
+    PacketCopyData(p, raw, sizeof(raw));
+    if (DecodeEthernetFast(&tv, &dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), NULL) != 0)
+        goto end;
+
+    /* ip length beyond the captured data */
+    PacketCopyData(p, fast_vlan_ipv4_tcp, sizeof(fast_vlan_ipv4_tcp) - 1);
+    if (DecodeEthernetFast(&tv, &dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), NULL) != 0)
+        goto end;
+
+    if (p->ethh != NULL || p->ip4h != NULL || p->tcph != NULL ||
+        dtv.fast.eth != 0) {
+        printf("packet touched by the fast path: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    PACKET_CLEANUP(p);
+    SCFree(p);
+    return result;
+}
+
+/** \test the counts are flushed after enough packets or a second, not on
+ *        every packet */
+static int DecodeFastTest04(void)
+{
+    Packet *p = SCMalloc(SIZE_OF_PACKET);
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+    int result = 0;
+
+    if (unlikely(p == NULL))
+        return 0;
+    memset(&tv, 0, sizeof(ThreadVars));
+    memset(&dtv, 0, sizeof(DecodeThreadVars));
+    PACKET_INITIALIZE(p);
+
+    p->ts.tv_sec = 100;
+    dtv.fast_flush_ts = 100;
+    dtv.fast.eth = 1;
+    DecodeFastUpdateCounters(&tv, &dtv, p);
+    if (dtv.fast.eth != 1) {
+        printf("flushed after a packet: ");
+        goto end;
+    }
+
+    dtv.fast.eth = DECODE_FAST_FLUSH_PKTS;
+    DecodeFastUpdateCounters(&tv, &dtv, p);
+    if (dtv.fast.eth != 0) {
+        printf("not flushed after %u packets: ", DECODE_FAST_FLUSH_PKTS);
+        goto end;
+    }
+
+    dtv.fast.eth = 1;
+    p->ts.tv_sec = 101;
+    DecodeFastUpdateCounters(&tv, &dtv, p);
+    if (dtv.fast.eth != 0 || dtv.fast_flush_ts != 101) {
+        printf("not flushed on the next second: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    PACKET_CLEANUP(p);
+    SCFree(p);
+    return result;
+}
+#endif /* UNITTESTS */
+
+void DecodeFastRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("DecodeFastTest01", DecodeFastTest01, 1);
+    UtRegisterTest("DecodeFastTest02", DecodeFastTest02, 1);
+    UtRegisterTest("DecodeFastTest03", DecodeFastTest03, 1);
+    UtRegisterTest("DecodeFastTest04", DecodeFastTest04, 1);
+#endif /* UNITTESTS */
+}
+/**
+ * @}
+ */
@@ -0,0 +1,53 @@
+/* Copyright (C) 2007-2013 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ */
+
+#ifndef __DECODE_FAST_H__
+#define __DECODE_FAST_H__
+
+int DecodeEthernetFast(ThreadVars *, DecodeThreadVars *, Packet *,
+                       uint8_t *, uint16_t, PacketQueue *);
+void DecodeFastFlushCounters(ThreadVars *, DecodeThreadVars *);
+void DecodeFastRegisterTests(void);
+
+/** fast path packets after which the counts are flushed */
+#define DECODE_FAST_FLUSH_PKTS  256
+
+/**
+ * \brief flush the counts of the fast path if there are enough of them or
+ *        the packet time moved on to another second
+ *
+ *        For decoders that get one packet at a time, the batched ones
+ *        flush once per batch.
+ */
+static inline void DecodeFastUpdateCounters(ThreadVars *tv,
+        DecodeThreadVars *dtv, Packet *p)
+{
+    if (dtv->fast.eth == 0)
+        return;
+    if (dtv->fast.eth < DECODE_FAST_FLUSH_PKTS &&
+        (uint32_t)p->ts.tv_sec == dtv->fast_flush_ts)
+        return;
+
+    DecodeFastFlushCounters(tv, dtv);
+    dtv->fast_flush_ts = (uint32_t)p->ts.tv_sec;
+}
+
+#endif /* __DECODE_FAST_H__ */
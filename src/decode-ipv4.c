@@ -1925,6 +1925,233 @@ end:
     return result;
 }
 
+/**
+ * \test IPv6 in IPv4 tunnel decoded in place: the tunnel packet refers
+ *       to the data of its parent.
+ */
+int DecodeIPV4TunnelInPlaceTest01(void)
+{
+    uint8_t raw[] = {
+        /* ipv4, proto 41 */
+        0x45, 0x00, 0x00, 0x3c, 0x00, 0x01, 0x00, 0x00,
+        0x40, 0x29, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x01,
+        0x0a, 0x00, 0x00, 0x02,
+        /* ipv6, no next header */
+        0x60, 0x00, 0x00, 0x00, 0x00, 0x00, 0x3b, 0x40,
+        0x20, 0x01, 0x0d, 0xb8, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+        0x20, 0x01, 0x0d, 0xb8, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02,
+    };
+    Packet *p = SCMalloc(SIZE_OF_PACKET);
+    if (unlikely(p == NULL))
+        return 0;
+    Packet *tp = NULL;
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+    PacketQueue pq;
+    int result = 0;
+
+    memset(&tv, 0, sizeof(ThreadVars));
+    memset(&dtv, 0, sizeof(DecodeThreadVars));
+    memset(&pq, 0, sizeof(PacketQueue));
+
+    PACKET_INITIALIZE(p);
+    decode_tunnel_in_place = 1;
+
+    PacketCopyData(p, raw, sizeof(raw));
+    DecodeIPV4(&tv, &dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), &pq);
+
+    tp = PacketDequeue(&pq);
+    if (tp == NULL) {
+        printf("no tunnel packet: ");
+        goto end;
+    }
+    if (!(tp->flags & PKT_ZERO_COPY) || !(tp->flags & PKT_ALLOC)) {
+        printf("tunnel packet is not an alloc'd zero copy packet: ");
+        goto end;
+    }
+    if (GET_PKT_DATA(tp) != GET_PKT_DATA(p) + IPV4_HEADER_LEN ||
+        GET_PKT_LEN(tp) != sizeof(raw) - IPV4_HEADER_LEN) {
+        printf("tunnel packet doesn't refer to the parent's data: ");
+        goto end;
+    }
+    if (tp->root != p || !IS_TUNNEL_PKT(p) || tp->ip6h == NULL) {
+        printf("tunnel packet not set up or decoded: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    decode_tunnel_in_place = 0;
+    if (tp != NULL) {
+        PacketViewRelease(tp);
+    }
+    PACKET_CLEANUP(p);
+    SCFree(p);
+    return result;
+}
+
+/**
+ * \test IPv4 in IPv6 in IPv4 with tunnel-in-place: only the first tunnel
+ *       packet refers to the data of its parent, the nested one gets a
+ *       copy as its parent can be released before it.
+ */
+int DecodeIPV4TunnelInPlaceTest02(void)
+{
+    uint8_t raw[] = {
+        /* ipv4, proto 41 */
+        0x45, 0x00, 0x00, 0x50, 0x00, 0x01, 0x00, 0x00,
+        0x40, 0x29, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x01,
+        0x0a, 0x00, 0x00, 0x02,
+        /* ipv6, next header ipv4 */
+        0x60, 0x00, 0x00, 0x00, 0x00, 0x14, 0x04, 0x40,
+        0x20, 0x01, 0x0d, 0xb8, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+        0x20, 0x01, 0x0d, 0xb8, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02,
+        /* ipv4, proto 255 */
+        0x45, 0x00, 0x00, 0x14, 0x00, 0x01, 0x00, 0x00,
+        0x40, 0xff, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x03,
+        0x0a, 0x00, 0x00, 0x04,
+    };
+    Packet *p = SCMalloc(SIZE_OF_PACKET);
+    if (unlikely(p == NULL))
+        return 0;
+    Packet *tp1 = NULL, *tp2 = NULL;
+    ThreadVars tv;
+    DecodeThreadVars dtv;
+    PacketQueue pq;
+    int result = 0;
+
+    memset(&tv, 0, sizeof(ThreadVars));
+    memset(&dtv, 0, sizeof(DecodeThreadVars));
+    memset(&pq, 0, sizeof(PacketQueue));
+
+    PACKET_INITIALIZE(p);
+    decode_tunnel_in_place = 1;
+
+    PacketCopyData(p, raw, sizeof(raw));
+    DecodeIPV4(&tv, &dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), &pq);
+
+    /* the nested tunnel packet is queued first */
+    tp2 = PacketDequeue(&pq);
+    tp1 = PacketDequeue(&pq);
+    if (tp1 == NULL || tp2 == NULL) {
+        printf("no tunnel packets: ");
+        goto end;
+    }
+    if (!(tp1->flags & PKT_ZERO_COPY) ||
+        GET_PKT_DATA(tp1) != GET_PKT_DATA(p) + IPV4_HEADER_LEN) {
+        printf("first tunnel packet doesn't refer to the root's data: ");
+        goto end;
+    }
+    if ((tp2->flags & PKT_ZERO_COPY) ||
+        GET_PKT_DATA(tp2) == GET_PKT_DATA(tp1) + IPV6_HEADER_LEN ||
+        GET_PKT_LEN(tp2) != IPV4_HEADER_LEN ||
+        memcmp(GET_PKT_DATA(tp2), raw + IPV4_HEADER_LEN + IPV6_HEADER_LEN,
+               IPV4_HEADER_LEN) != 0) {
+        printf("nested tunnel packet isn't a copy: ");
+        goto end;
+    }
+    if (tp2->root != p || tp2->ip4h == NULL) {
+        printf("nested tunnel packet not set up or decoded: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    decode_tunnel_in_place = 0;
+    if (tp2 != NULL) {
+        PACKET_CLEANUP(tp2);
+        SCFree(tp2);
+    }
+    if (tp1 != NULL) {
+        PacketViewRelease(tp1);
+    }
+    PACKET_CLEANUP(p);
+    SCFree(p);
+    return result;
+}
+
+extern uint8_t engine_mode;
+
+/**
+ * \test Teredo with tunnel-in-place in IPS mode: the UDP checksum covers
+ *       the tunneled packet, so it's copied rather than edited in place.
+ *       In IDS mode it's not edited and still refers to the parent.
+ */
+int DecodeIPV4TunnelInPlaceTest03(void)
+{
+    uint8_t raw[] = {
+        /* ipv4, udp */
+        0x45, 0x00, 0x00, 0x44, 0x00, 0x01, 0x00, 0x00,
+        0x40, 0x11, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x01,
+        0x0a, 0x00, 0x00, 0x02,
+        /* udp 3544 -> 3544 */
+        0x0d, 0xd8, 0x0d, 0xd8, 0x00, 0x30, 0x12, 0x34,
+        /* ipv6, no next header */
+        0x60, 0x00, 0x00, 0x00, 0x00, 0x00, 0x3b, 0x40,
+        0x20, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+        0x20, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02,
+    };
+    uint8_t save_engine_mode = engine_mode;
+    Packet *p = SCMalloc(SIZE_OF_PACKET);
+    if (unlikely(p == NULL))
+        return 0;
+    Packet *tp = NULL;
+    uint8_t *inner;
+    int result = 0;
+
+    PACKET_INITIALIZE(p);
+    decode_tunnel_in_place = 1;
+
+    PacketCopyData(p, raw, sizeof(raw));
+    p->ip4h = (IPV4Hdr *)GET_PKT_DATA(p);
+    p->udph = (UDPHdr *)(GET_PKT_DATA(p) + IPV4_HEADER_LEN);
+    inner = GET_PKT_DATA(p) + IPV4_HEADER_LEN + UDP_HEADER_LEN;
+
+    SET_ENGINE_MODE_IPS(engine_mode);
+    tp = PacketPseudoPktSetup(p, inner, IPV6_HEADER_LEN, IPPROTO_IPV6);
+    if (tp == NULL)
+        goto end;
+    if ((tp->flags & PKT_ZERO_COPY) || GET_PKT_DATA(tp) == inner ||
+        memcmp(GET_PKT_DATA(tp), inner, IPV6_HEADER_LEN) != 0) {
+        printf("teredo packet isn't a copy in ips mode: ");
+        goto end;
+    }
+    PACKET_CLEANUP(tp);
+    SCFree(tp);
+    tp = NULL;
+
+    SET_ENGINE_MODE_IDS(engine_mode);
+    tp = PacketPseudoPktSetup(p, inner, IPV6_HEADER_LEN, IPPROTO_IPV6);
+    if (tp == NULL)
+        goto end;
+    if (!(tp->flags & PKT_ZERO_COPY) || GET_PKT_DATA(tp) != inner) {
+        printf("teredo packet doesn't refer to the parent in ids mode: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    engine_mode = save_engine_mode;
+    decode_tunnel_in_place = 0;
+    if (tp != NULL) {
+        if (tp->flags & PKT_VIEW) {
+            PacketViewRelease(tp);
+        } else {
+            PACKET_CLEANUP(tp);
+            SCFree(tp);
+        }
+    }
+    PACKET_CLEANUP(p);
+    SCFree(p);
+    return result;
+}
+
 #endif /* UNITTESTS */
 
 void DecodeIPV4RegisterTests(void) {
@@ -1964,6 +2191,12 @@ void DecodeIPV4RegisterTests(void) {
     UtRegisterTest("DecodeIPV4DefragTest01", DecodeIPV4DefragTest01, 1);
     UtRegisterTest("DecodeIPV4DefragTest02", DecodeIPV4DefragTest02, 1);
     UtRegisterTest("DecodeIPV4DefragTest03", DecodeIPV4DefragTest03, 1);
+    UtRegisterTest("DecodeIPV4TunnelInPlaceTest01",
+                   DecodeIPV4TunnelInPlaceTest01, 1);
+    UtRegisterTest("DecodeIPV4TunnelInPlaceTest02",
+                   DecodeIPV4TunnelInPlaceTest02, 1);
+    UtRegisterTest("DecodeIPV4TunnelInPlaceTest03",
+                   DecodeIPV4TunnelInPlaceTest03, 1);
 #endif /* UNITTESTS */
 }
 /**
@@ -50,6 +50,7 @@ void DecodePPP(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, uint8_t *pkt, u
     }
 
     p->ppph = (PPPHdr *)pkt;
+    PACKET_SET_DIRTY(p, PKT_DIRTY_PPP);
     if(p->ppph == NULL)
         return;
 
@@ -58,6 +58,7 @@ void DecodePPPOEDiscovery(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, uint
     p->pppoedh = NULL;
 
     p->pppoedh = (PPPOEDiscoveryHdr *)pkt;
+    PACKET_SET_DIRTY(p, PKT_DIRTY_PPP);
     if (p->pppoedh == NULL)
         return;
 
@@ -137,6 +138,7 @@ void DecodePPPOESession(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p, uint8_
     }
 
     p->pppoesh = (PPPOESessionHdr *)pkt;
+    PACKET_SET_DIRTY(p, PKT_DIRTY_PPP);
     if (p->pppoesh == NULL)
         return;
 
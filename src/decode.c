@@ -58,6 +58,9 @@
 #include "util-print.h"
 #include "tmqh-packetpool.h"
 #include "util-profiling.h"
+#include "decode-gre.h"
+#include "host.h"
+#include "pkt-var.h"
 
 void DecodeTunnel(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p,
         uint8_t *pkt, uint16_t len, PacketQueue *pq, uint8_t proto)
@@ -98,6 +101,155 @@ Packet *PacketGetFromAlloc(void)
     return p;
 }
 
+/** view packets are allocated in chunks of this many */
+#define PACKET_VIEW_CHUNK       64
+/** max free view packets a thread keeps before handing half back */
+#define PACKET_VIEW_CACHE_MAX   (2 * PACKET_VIEW_CHUNK)
+
+typedef struct PacketViewChunk_ {
+    struct PacketViewChunk_ *next;
+    Packet pkts[PACKET_VIEW_CHUNK];
+} PacketViewChunk;
+
+/** free view packets of this thread, linked through p->next */
+static __thread Packet *packet_view_cache = NULL;
+static __thread uint32_t packet_view_cache_cnt = 0;
+
+/** views handed back by threads that release more than they get, e.g.
+ *  the last stage of an autofp pipeline, and all chunks for cleanup */
+static SCMutex packet_view_lock = PTHREAD_MUTEX_INITIALIZER;
+static Packet *packet_view_free = NULL;
+static PacketViewChunk *packet_view_chunks = NULL;
+
+/**
+ * \brief Refill the thread's view cache from the shared free list, or
+ *        from a new chunk if that is empty.
+ */
+static void PacketViewRefill(void)
+{
+    uint32_t i;
+
+    SCMutexLock(&packet_view_lock);
+    while (packet_view_free != NULL && packet_view_cache_cnt < PACKET_VIEW_CHUNK) {
+        Packet *p = packet_view_free;
+        packet_view_free = p->next;
+
+        p->next = packet_view_cache;
+        packet_view_cache = p;
+        packet_view_cache_cnt++;
+    }
+    SCMutexUnlock(&packet_view_lock);
+
+    if (packet_view_cache != NULL)
+        return;
+
+    PacketViewChunk *c = SCMalloc(sizeof(PacketViewChunk));
+    if (unlikely(c == NULL))
+        return;
+
+    for (i = 0; i < PACKET_VIEW_CHUNK; i++) {
+        Packet *p = &c->pkts[i];
+        PACKET_INITIALIZE(p);
+        /* there is no data after the Packet */
+        p->pkt = NULL;
+
+        p->next = packet_view_cache;
+        packet_view_cache = p;
+        packet_view_cache_cnt++;
+    }
+
+    SCMutexLock(&packet_view_lock);
+    c->next = packet_view_chunks;
+    packet_view_chunks = c;
+    SCMutexUnlock(&packet_view_lock);
+}
+
+/**
+ * \brief Get a packet without room for data, for tunnel packets that
+ *        refer to the data of their parent.
+ *
+ * Views come from a per thread cache and go back to the cache of the
+ * thread releasing them, see PacketViewRelease.
+ *
+ * \retval p packet, NULL on error
+ */
+static Packet *PacketGetView(void)
+{
+    if (packet_view_cache == NULL) {
+        PacketViewRefill();
+        if (packet_view_cache == NULL)
+            return NULL;
+    }
+
+    Packet *p = packet_view_cache;
+    packet_view_cache = p->next;
+    packet_view_cache_cnt--;
+    p->next = NULL;
+
+    p->flags |= PKT_ALLOC | PKT_VIEW;
+
+    PACKET_PROFILING_START(p);
+    return p;
+}
+
+/**
+ * \brief Return a view packet to the cache of the calling thread.
+ *
+ * Only the recycle reset is done, the tunnel mutex and the NULL data
+ * pointer are kept.
+ *
+ * \param p view packet from PacketPseudoPktSetup
+ */
+void PacketViewRelease(Packet *p)
+{
+    PACKET_RECYCLE(p);
+
+    p->next = packet_view_cache;
+    packet_view_cache = p;
+    packet_view_cache_cnt++;
+
+    if (packet_view_cache_cnt < PACKET_VIEW_CACHE_MAX)
+        return;
+
+    /* hand half of the cache back for the threads getting the views */
+    SCMutexLock(&packet_view_lock);
+    while (packet_view_cache_cnt > PACKET_VIEW_CHUNK) {
+        Packet *v = packet_view_cache;
+        packet_view_cache = v->next;
+        packet_view_cache_cnt--;
+
+        v->next = packet_view_free;
+        packet_view_free = v;
+    }
+    SCMutexUnlock(&packet_view_lock);
+}
+
+/**
+ * \brief Free all view packets. Only called at shutdown, when no view
+ *        is in use anymore.
+ */
+void PacketViewPoolDestroy(void)
+{
+    uint32_t i;
+
+    SCMutexLock(&packet_view_lock);
+    while (packet_view_chunks != NULL) {
+        PacketViewChunk *c = packet_view_chunks;
+        packet_view_chunks = c->next;
+
+        for (i = 0; i < PACKET_VIEW_CHUNK; i++) {
+            PACKET_CLEANUP(&c->pkts[i]);
+        }
+        SCFree(c);
+    }
+    packet_view_free = NULL;
+    SCMutexUnlock(&packet_view_lock);
+
+    /* the caches of the other threads went away with them */
+    packet_view_cache = NULL;
+    packet_view_cache_cnt = 0;
+}
+
 /**
  *  \brief Get a packet. We try to get a packet from the packetpool first, but
  *         if that is empty we alloc a packet that is free'd again after
@@ -178,6 +330,40 @@ inline int PacketCopyDataOffset(Packet *p, int offset, uint8_t *data, int datale
     return 0;
 }
 
+/**
+ *  \brief Make sure the data of a Packet can hold len bytes
+ *
+ * Sets up Packet::ext_pkt if len doesn't fit in the space allocated
+ * with the Packet, moving the current data (GET_PKT_LEN bytes) there.
+ * Callers that know the final size of a packet can then write to
+ * GET_PKT_DATA directly, instead of using PacketCopyDataOffset for
+ * each piece.
+ *
+ *  \param Pointer to the Packet
+ *  \param Length the data needs to fit in
+ *
+ *  \retval 0 ok, -1 too big or allocation failed
+ */
+int PacketReserveData(Packet *p, int len)
+{
+    if (len > MAX_PAYLOAD_SIZE) {
+        /* too big */
+        return -1;
+    }
+
+    if (p->ext_pkt != NULL || len <= (int)default_packet_size)
+        return 0;
+
+    p->ext_pkt = SCMalloc(MAX_PAYLOAD_SIZE);
+    if (p->ext_pkt == NULL) {
+        SET_PKT_LEN(p, 0);
+        return -1;
+    }
+    if (GET_PKT_LEN(p) > 0)
+        memcpy(p->ext_pkt, GET_PKT_DIRECT_DATA(p), GET_PKT_LEN(p));
+    return 0;
+}
+
 /**
  *  \brief Copy data to Packet payload and set packet length
  *
@@ -193,9 +379,41 @@ inline int PacketCopyData(Packet *p, uint8_t *pktdata, int pktlen)
 
 
 
+extern uint8_t engine_mode;
+
+/**
+ *  \brief check if a tunnel packet can refer to the data of its parent
+ *
+ *  Only for the first tunnel layer: a parent that is a tunnel packet
+ *  itself can be released before its own tunnel packets are. And not in
+ *  IPS mode if the carrier has a checksum over the tunneled packet, like
+ *  the UDP checksum of Teredo: inline edits of the tunnel packet would
+ *  change the parent's bytes and leave that checksum wrong.
+ */
+static int PacketPseudoPktInPlace(Packet *parent)
+{
+    if (!decode_tunnel_in_place || parent->root != NULL)
+        return 0;
+
+    if (IS_ENGINE_MODE_IPS(engine_mode)) {
+        if (parent->udph != NULL)
+            return 0;
+        if (parent->greh != NULL && GRE_FLAG_ISSET_CHKSUM(parent->greh))
+            return 0;
+    }
+    return 1;
+}
+
 /**
  *  \brief Setup a pseudo packet (tunnel)
  *
+ *  With tunnel-in-place the pseudo packet isn't taken from the packet
+ *  pool and doesn't get a copy of the data. It's a malloced Packet that
+ *  refers to the data in the parent's buffer. That buffer stays valid:
+ *  the root packet isn't released before all its tunnel packets are,
+ *  see TmqhOutputPacketpool(). See PacketPseudoPktInPlace() for when
+ *  the data is copied anyway.
+ *
  *  \param parent parent packet for this pseudo pkt
  *  \param pkt raw packet data
  *  \param len packet data length
@@ -207,12 +425,19 @@ Packet *PacketPseudoPktSetup(Packet *parent, uint8_t *pkt, uint16_t len, uint8_t
 {
     SCEnter();
 
+    Packet *p = NULL;
+    int in_place = PacketPseudoPktInPlace(parent);
+
     /* get us a packet */
+    if (in_place) {
+        p = PacketGetView();
+    } else {
 #ifdef __tile__
-    Packet *p = PacketGetFromQueueOrAlloc(parent->mpipe_v.pool);
+        p = PacketGetFromQueueOrAlloc(parent->mpipe_v.pool);
 #else
-    Packet *p = PacketGetFromQueueOrAlloc();
+        p = PacketGetFromQueueOrAlloc();
 #endif
+    }
     if (p == NULL) {
         SCReturnPtr(NULL, "Packet");
     }
@@ -223,8 +448,13 @@ Packet *PacketPseudoPktSetup(Packet *parent, uint8_t *pkt, uint16_t len, uint8_t
     else
         p->root = parent;
 
-    /* copy packet and set lenght, proto */
-    PacketCopyData(p, pkt, len);
+    if (in_place) {
+        /* refer to the data, PKT_ZERO_COPY keeps it from being freed */
+        PacketSetData(p, pkt, len);
+    } else {
+        /* copy packet and set lenght, proto */
+        PacketCopyData(p, pkt, len);
+    }
     p->recursion_level = parent->recursion_level + 1;
     p->ts.tv_sec = parent->ts.tv_sec;
     p->ts.tv_usec = parent->ts.tv_usec;
@@ -384,6 +614,15 @@ void DecodeRegisterPerfCounters(DecodeThreadVars *dtv, ThreadVars *tv)
     dtv->counter_defrag_max_hit =
         SCPerfTVRegisterCounter("defrag.max_frag_hits", tv,
             SC_PERF_TYPE_UINT64, "NULL");
+    dtv->counter_flow_bypassed_pkts =
+        SCPerfTVRegisterCounter("flow.bypassed_pkts", tv,
+            SC_PERF_TYPE_UINT64, "NULL");
+    dtv->counter_flow_bypassed_bytes =
+        SCPerfTVRegisterCounter("flow.bypassed_bytes", tv,
+            SC_PERF_TYPE_UINT64, "NULL");
+    dtv->counter_flow_new =
+        SCPerfTVRegisterCounter("flow.new", tv,
+            SC_PERF_TYPE_UINT64, "NULL");
 
     tv->sc_perf_pca = SCPerfGetAllCountersArray(tv, &tv->sc_perf_pctx);
     SCPerfAddToClubbedTMTable(tv->name, &tv->sc_perf_pctx);
@@ -59,6 +59,8 @@ enum {
 
 #include "action-globals.h"
 
+#include "util-checksum.h"
+
 #include "decode-ethernet.h"
 #include "decode-gre.h"
 #include "decode-ppp.h"
@@ -331,6 +333,7 @@ typedef struct PktProfiling_ {
     PktProfilingAppData app[ALPROTO_MAX];
     PktProfilingDetectData detect[PROF_DETECT_SIZE];
     uint64_t proto_detect;
+    uint64_t flow_lookup;   /**< ticks spent getting the flow from the hash */
 } PktProfiling;
 
 #endif /* PROFILING */
@@ -338,6 +341,25 @@ typedef struct PktProfiling_ {
 /* forward declartion since Packet struct definition requires this */
 struct PacketQueue_;
 
+/* app layer data deferred by the stream engine, see app-layer-thread.c */
+struct AppLayerDataChunk_;
+void AppLayerDataChunkFree(struct AppLayerDataChunk_ *);
+
+/** \brief Packet::dirty bits, set when a cold section of the packet is
+ *         written so PACKET_DO_RECYCLE only clears what was used */
+#define PKT_DIRTY_ALERTS    0x01    /**< alerts were appended */
+#define PKT_DIRTY_EVENTS    0x02    /**< engine events were set */
+#define PKT_DIRTY_PKTVAR    0x04    /**< pkt vars were added */
+#define PKT_DIRTY_APPDATA   0x08    /**< app layer data chunks are queued */
+#define PKT_DIRTY_HOST      0x10    /**< host_src/host_dst hold references */
+#define PKT_DIRTY_PPP       0x20    /**< ppp/pppoe header pointers are set */
+
+#ifndef __tile__
+#define PACKET_SET_DIRTY(p, d)  ((p)->dirty |= (d))
+#else
+#define PACKET_SET_DIRTY(p, d) do { } while (0)
+#endif
+
 /* sizes of the members:
  * src: 17 bytes
  * dst: 17 bytes
@@ -353,6 +375,14 @@ struct PacketQueue_;
  * flowflags: 1 byte
  *
  * sum of above 44/48 bytes
+ *
+ * Layout: the first two cache lines hold what every packet needs on the
+ * decode, flow and detect path. The header pointers follow, then the
+ * layer vars, which are only touched if their header is set. The cold
+ * sections come last and are only cleared on recycle if their dirty bit
+ * (or PKT_TUNNEL for the tunnel counters) is set. The packet pool puts
+ * every packet on a cache line boundary, see PACKET_POOL_STRIDE. There is
+ * no alignment attribute as packets are SCMalloc'd as well.
  */
 #ifndef __tile__
 
@@ -376,103 +406,136 @@ typedef struct Packet_
      * has the exact same tuple as the lower levels */
     uint8_t recursion_level;
 
-    /* Pkt Flags */
-    uint32_t flags;
-
     /* flow */
     uint8_t flowflags;
 
     uint8_t pkt_src;
 
-    struct Flow_ *flow;
+    /* Pkt Flags */
+    uint32_t flags;
 
-    struct timeval ts;
+    /** NUMA node of the packet pool the packet is returned to */
+    uint8_t pool_node;
 
-    union {
-        /* nfq stuff */
-#ifdef NFQ
-        NFQPacketVars nfq_v;
-#endif /* NFQ */
-#ifdef IPFW
-        IPFWPacketVars ipfw_v;
-#endif /* IPFW */
-#ifdef AF_PACKET
-        AFPPacketVars afp_v;
-#endif
+    /* IPS action to take */
+    uint8_t action;
 
-        /** libpcap vars: shared by Pcap Live mode and Pcap File mode */
-        PcapPacketVars pcap_v;
-    };
+    /* ptr to the payload of the packet
+     * with it's length. */
+    uint16_t payload_len;
+
+    struct Flow_ *flow;
+
+    /* second cache line */
+    uint8_t *payload;
+
+    /* storage: set to pointer to heap and extended via allocation if necessary */
+    uint8_t *pkt;
+    uint32_t pktlen;
 
     /** data linktype in host order */
     int datalink;
 
-    /* IPS action to take */
-    uint8_t action;
+    struct timeval ts;
 
-    /* used to hold flowbits only if debuglog is enabled */
-    int debuglog_flowbits_names_len;
-    const char **debuglog_flowbits_names;
+    /* tunnel/encapsulation handling */
+    struct Packet_ *root; /* in case of tunnel this is a ptr
+                           * to the 'real' packet, the one we
+                           * need to set the verdict on --
+                           * It should always point to the lowest
+                           * packet in a encapsulated packet */
+
+    /* double linked list ptrs */
+    struct Packet_ *next;
+    struct Packet_ *prev;
+
+    /** PKT_DIRTY_* bits of the cold sections in use */
+    uint8_t dirty;
+
+    /** flow hash computed by the kernel or the NIC, 0 if the capture
+     *  method doesn't provide one */
+    uint32_t rxhash;
+
+    /** ticks when the packet was put in a flow queue, 0 if it's not
+     *  sampled for the queue latency */
+    uint64_t queue_ticks;
+
+    /** packet number in the pcap file, matches wireshark */
+    uint64_t pcap_cnt;
+
+    /* Incoming interface */
+    struct LiveDevice_ *livedev;
+
+    uint8_t *ext_pkt;
 
     /** The release function for packet data */
     TmEcode (*ReleaseData)(ThreadVars *, struct Packet_ *);
 
-    /* pkt vars */
-    PktVar *pktvar;
+    /** Capture specific function to bypass the rest of the packet's flow
+     *  in the capture method itself, set by the capture module if it
+     *  supports it */
+    int (*BypassPacketsFlow)(struct Packet_ *);
 
     /* header pointers */
     EthernetHdr *ethh;
+    VLANHdr *vlanh;
 
     IPV4Hdr *ip4h;
-    IPV4Vars ip4vars;
-
     IPV6Hdr *ip6h;
-    IPV6Vars ip6vars;
-    IPV6ExtHdrs ip6eh;
-
     TCPHdr *tcph;
-    TCPVars tcpvars;
-
     UDPHdr *udph;
-    UDPVars udpvars;
-
     SCTPHdr *sctph;
-
     ICMPV4Hdr *icmpv4h;
-    ICMPV4Vars icmpv4vars;
-
     ICMPV6Hdr *icmpv6h;
-    ICMPV6Vars icmpv6vars;
+    GREHdr *greh;
 
+    /* PKT_DIRTY_PPP */
     PPPHdr *ppph;
     PPPOESessionHdr *pppoesh;
     PPPOEDiscoveryHdr *pppoedh;
 
-    GREHdr *greh;
+    /* layer vars, cleared if the header above is set */
+    IPV4Vars ip4vars;
 
-    VLANHdr *vlanh;
+    IPV6Vars ip6vars;
+    IPV6ExtHdrs ip6eh;
 
-    /* ptr to the payload of the packet
-     * with it's length. */
-    uint8_t *payload;
-    uint16_t payload_len;
+    TCPVars tcpvars;
 
-    /* storage: set to pointer to heap and extended via allocation if necessary */
-    uint8_t *pkt;
-    uint8_t *ext_pkt;
-    uint32_t pktlen;
+    UDPVars udpvars;
 
-    /* Incoming interface */
-    struct LiveDevice_ *livedev;
+    ICMPV4Vars icmpv4vars;
 
-    PacketAlerts alerts;
+    ICMPV6Vars icmpv6vars;
+
+    union {
+        /* nfq stuff */
+#ifdef NFQ
+        NFQPacketVars nfq_v;
+#endif /* NFQ */
+#ifdef IPFW
+        IPFWPacketVars ipfw_v;
+#endif /* IPFW */
+#ifdef AF_PACKET
+        AFPPacketVars afp_v;
+#endif
 
+        /** libpcap vars: shared by Pcap Live mode and Pcap File mode */
+        PcapPacketVars pcap_v;
+    };
+
+    /* PKT_DIRTY_PKTVAR: pkt vars */
+    PktVar *pktvar;
+
+    /* PKT_DIRTY_APPDATA: reassembled app layer data deferred to the app
+     * layer threads */
+    struct AppLayerDataChunk_ *app_data;
+
+    /* PKT_DIRTY_HOST */
     struct Host_ *host_src;
     struct Host_ *host_dst;
 
-    /** packet number in the pcap file, matches wireshark */
-    uint64_t pcap_cnt;
-
+    /* PKT_TUNNEL */
     /** mutex to protect access to:
      *  - tunnel_rtv_cnt
      *  - tunnel_tpr_cnt
@@ -483,19 +546,15 @@ typedef struct Packet_
     /* tunnel packet ref count */
     uint16_t tunnel_tpr_cnt;
 
-    /* engine events */
-    PacketEngineEvents events;
+    /* used to hold flowbits only if debuglog is enabled */
+    int debuglog_flowbits_names_len;
+    const char **debuglog_flowbits_names;
 
-    /* double linked list ptrs */
-    struct Packet_ *next;
-    struct Packet_ *prev;
+    /* PKT_DIRTY_EVENTS: engine events */
+    PacketEngineEvents events;
 
-    /* tunnel/encapsulation handling */
-    struct Packet_ *root; /* in case of tunnel this is a ptr
-                           * to the 'real' packet, the one we
-                           * need to set the verdict on --
-                           * It should always point to the lowest
-                           * packet in a encapsulated packet */
+    /* PKT_DIRTY_ALERTS */
+    PacketAlerts alerts;
 
     /* required for cuda support */
 #ifdef __SC_CUDA_SUPPORT__
@@ -518,6 +577,7 @@ typedef struct Packet_
 #endif
 
 #ifdef PROFILING
+    /* reset on recycle if packet profiling is enabled */
     PktProfiling profile;
 #endif
 } Packet;
@@ -577,6 +637,14 @@ typedef struct Packet_
     /** The release function for packet data */
     TmEcode (*ReleaseData)(ThreadVars *, struct Packet_ *);
 
+    /** Capture specific function to bypass the rest of the packet's flow
+     *  in the capture method itself, set by the capture module if it
+     *  supports it */
+    int (*BypassPacketsFlow)(struct Packet_ *);
+
+    /** reassembled app layer data deferred to the app layer threads */
+    struct AppLayerDataChunk_ *app_data;
+
     EthernetHdr *ethh;
 
     /* pkt vars */
@@ -611,6 +679,13 @@ typedef struct Packet_
 
     /* Incoming interface */
     struct LiveDevice_ *livedev;
+    /** flow hash computed by the kernel or the NIC, 0 if the capture
+     *  method doesn't provide one */
+    uint32_t rxhash;
+
+    /** ticks when the packet was put in a flow queue, 0 if it's not
+     *  sampled for the queue latency */
+    uint64_t queue_ticks;
 
 #if 1
     union {
@@ -717,6 +792,11 @@ typedef struct Packet_
 #define MAX_PAYLOAD_SIZE (IPV6_HEADER_LEN + 65536 + 28)
 uint32_t default_packet_size;
 #define SIZE_OF_PACKET (default_packet_size + sizeof(Packet))
+/** tunnel packets are a view on the data of their parent instead of a
+ *  copy, see PacketPseudoPktSetup() */
+uint8_t decode_tunnel_in_place;
+/** the batch decoders try DecodeEthernetFast() before DecodeEthernet() */
+uint8_t decode_fast_path;
 
 typedef struct PacketQueue_ {
     Packet *top;
@@ -763,6 +843,17 @@ typedef struct AlpProtoDetectThreadCtx_ {
 #endif
 } AlpProtoDetectThreadCtx;
 
+/** per layer packet counts of the fast path decoder, added to the perf
+ *  counters by DecodeFastFlushCounters() */
+typedef struct DecodeFastCounters_ {
+    uint32_t eth;
+    uint32_t vlan;
+    uint32_t ipv4;
+    uint32_t ipv6;
+    uint32_t tcp;
+    uint32_t udp;
+} DecodeFastCounters;
+
 /** \brief Structure to hold thread specific data for all decode modules */
 typedef struct DecodeThreadVars_
 {
@@ -803,6 +894,26 @@ typedef struct DecodeThreadVars_
     uint16_t counter_defrag_ipv6_reassembled;
     uint16_t counter_defrag_ipv6_timeouts;
     uint16_t counter_defrag_max_hit;
+
+    /** counts of the fast path decoder not yet in the counters above */
+    DecodeFastCounters fast;
+    /** packet time of the last flush of the counts above, in secs */
+    uint32_t fast_flush_ts;
+    /** packet time of the last flow manager wakeup, pcap file only */
+    double flow_wakeup_ts;
+
+    /** spare defrag trackers of this thread, set up by Defrag() */
+    struct DefragTrackerCache_ *defrag_cache;
+    /** defrag tracker table of this thread if defrag.per-thread is
+     *  enabled, set up by Defrag() */
+    struct DefragThreadTable_ *defrag_table;
+
+    /** packets and bytes of flows that are bypassed */
+    uint16_t counter_flow_bypassed_pkts;
+    uint16_t counter_flow_bypassed_bytes;
+
+    /** flows set up by this thread */
+    uint16_t counter_flow_new;
 } DecodeThreadVars;
 
 /**
@@ -830,7 +941,7 @@ typedef struct DecodeThreadVars_
 }
 #else
 #define PACKET_INITIALIZE(p) { \
-    memset((p), 0x00, SIZE_OF_PACKET); \
+    memset((p), 0x00, sizeof(Packet)); \
     SCMutexInit(&(p)->tunnel_mutex, NULL); \
     PACKET_RESET_CHECKSUMS((p)); \
     (p)->pkt = ((uint8_t *)(p)) + sizeof(Packet); \
@@ -850,7 +961,7 @@ typedef struct DecodeThreadVars_
 }
 #else
 #define PACKET_INITIALIZE(p) { \
-    memset((p), 0x00, SIZE_OF_PACKET); \
+    memset((p), 0x00, sizeof(Packet)); \
     SCMutexInit(&(p)->tunnel_mutex, NULL); \
     PACKET_RESET_CHECKSUMS((p)); \
     SCMutexInit(&(p)->cuda_mutex, NULL); \
@@ -863,7 +974,11 @@ typedef struct DecodeThreadVars_
 
 /**
  *  \brief Recycle a packet structure for reuse.
- *  \todo the mutex destroy & init is necessary because of the memset, reconsider
+ *
+ *  Only the hot part of the packet is cleared unconditionally. The layer
+ *  vars are cleared if their header is set, the cold sections if their
+ *  dirty bit is set. The tunnel mutex is initialized once in
+ *  PACKET_INITIALIZE and kept over recycles.
  */
 #ifndef __tile__
 
@@ -874,19 +989,28 @@ typedef struct DecodeThreadVars_
         (p)->dp = 0;                            \
         (p)->proto = 0;                         \
         (p)->recursion_level = 0;               \
-        (p)->flags = 0;                         \
         (p)->flowflags = 0;                     \
         (p)->pkt_src = 0;                       \
+        (p)->action = 0;                        \
+        (p)->payload_len = 0;                   \
         FlowDeReference(&((p)->flow));          \
+        (p)->payload = NULL;                    \
+        (p)->pktlen = 0;                        \
+        (p)->datalink = 0;                      \
         (p)->ts.tv_sec = 0;                     \
         (p)->ts.tv_usec = 0;                    \
-        (p)->datalink = 0;                      \
-        (p)->action = 0;                        \
-        if ((p)->pktvar != NULL) {              \
-            PktVarFree((p)->pktvar);            \
-            (p)->pktvar = NULL;                 \
-        }                                       \
+        (p)->root = NULL;                       \
+        (p)->next = NULL;                       \
+        (p)->prev = NULL;                       \
+        (p)->rxhash = 0;                        \
+        (p)->queue_ticks = 0;                   \
+        (p)->pcap_cnt = 0;                      \
+        (p)->livedev = NULL;                    \
+        (p)->ReleaseData = NULL;                \
+        (p)->BypassPacketsFlow = NULL;          \
         (p)->ethh = NULL;                       \
+        (p)->vlanh = NULL;                      \
+        (p)->greh = NULL;                       \
         if ((p)->ip4h != NULL) {                \
             CLEAR_IPV4_PACKET((p));             \
         }                                       \
@@ -908,32 +1032,43 @@ typedef struct DecodeThreadVars_
         if ((p)->icmpv6h != NULL) {             \
             CLEAR_ICMPV6_PACKET((p));           \
         }                                       \
-        (p)->ppph = NULL;                       \
-        (p)->pppoesh = NULL;                    \
-        (p)->pppoedh = NULL;                    \
-        (p)->greh = NULL;                       \
-        (p)->vlanh = NULL;                      \
-        (p)->payload = NULL;                    \
-        (p)->payload_len = 0;                   \
-        (p)->pktlen = 0;                        \
-        (p)->alerts.cnt = 0;                    \
-        HostDeReference(&((p)->host_src));      \
-        HostDeReference(&((p)->host_dst));      \
-        (p)->pcap_cnt = 0;                      \
-        (p)->tunnel_rtv_cnt = 0;                \
-        (p)->tunnel_tpr_cnt = 0;                \
-        SCMutexDestroy(&(p)->tunnel_mutex);     \
-        SCMutexInit(&(p)->tunnel_mutex, NULL);  \
-        (p)->events.cnt = 0;                    \
-        (p)->next = NULL;                       \
-        (p)->prev = NULL;                       \
-        (p)->root = NULL;                       \
-        (p)->livedev = NULL;                    \
-        (p)->ReleaseData = NULL;                \
-        PACKET_RESET_CHECKSUMS((p));            \
+        if (unlikely((p)->flags & PKT_TUNNEL)) { \
+            (p)->tunnel_rtv_cnt = 0;            \
+            (p)->tunnel_tpr_cnt = 0;            \
+        }                                       \
+        (p)->flags = 0;                         \
+        if (unlikely((p)->dirty != 0)) {        \
+            PACKET_CLEAR_DIRTY((p));            \
+        }                                       \
         PACKET_PROFILING_RESET((p));            \
     } while (0)
 
+/** \brief clear the cold sections flagged in Packet::dirty */
+#define PACKET_CLEAR_DIRTY(p) do {              \
+        if ((p)->dirty & PKT_DIRTY_ALERTS)      \
+            (p)->alerts.cnt = 0;                \
+        if ((p)->dirty & PKT_DIRTY_EVENTS)      \
+            (p)->events.cnt = 0;                \
+        if ((p)->dirty & PKT_DIRTY_PKTVAR) {    \
+            PktVarFree((p)->pktvar);            \
+            (p)->pktvar = NULL;                 \
+        }                                       \
+        if ((p)->dirty & PKT_DIRTY_APPDATA) {   \
+            AppLayerDataChunkFree((p)->app_data); \
+            (p)->app_data = NULL;               \
+        }                                       \
+        if ((p)->dirty & PKT_DIRTY_HOST) {      \
+            HostDeReference(&((p)->host_src));  \
+            HostDeReference(&((p)->host_dst));  \
+        }                                       \
+        if ((p)->dirty & PKT_DIRTY_PPP) {       \
+            (p)->ppph = NULL;                   \
+            (p)->pppoesh = NULL;                \
+            (p)->pppoedh = NULL;                \
+        }                                       \
+        (p)->dirty = 0;                         \
+    } while (0)
+
 #else
 
 /* __tile__ */
@@ -979,6 +1114,10 @@ typedef struct DecodeThreadVars_
             PktVarFree((p)->pktvar);            \
             (p)->pktvar = NULL;                 \
         }                                       \
+        if ((p)->app_data != NULL) {            \
+            AppLayerDataChunkFree((p)->app_data); \
+            (p)->app_data = NULL;               \
+        }                                       \
         /*(p)->ethh = NULL;*/                       \
         if ((p)->ip4h != NULL) {                \
             CLEAR_IPV4_PACKET((p));             \
@@ -1022,6 +1161,9 @@ typedef struct DecodeThreadVars_
         /*(p)->prev = NULL;*/                   \
         (p)->root = NULL;                       \
         (p)->livedev = NULL;                    \
+        (p)->rxhash = 0;                        \
+        (p)->queue_ticks = 0;                   \
+        (p)->BypassPacketsFlow = NULL;          \
         PACKET_RESET_CHECKSUMS((p));            \
         PACKET_PROFILING_RESET((p));            \
     } while (0)
@@ -1049,6 +1191,9 @@ typedef struct DecodeThreadVars_
         if ((p)->pktvar != NULL) {              \
             PktVarFree((p)->pktvar);            \
         }                                       \
+        if ((p)->app_data != NULL) {            \
+            AppLayerDataChunkFree((p)->app_data); \
+        }                                       \
         SCMutexDestroy(&(p)->tunnel_mutex);     \
     } while (0)
 #else
@@ -1056,6 +1201,9 @@ typedef struct DecodeThreadVars_
     if ((p)->pktvar != NULL) {                  \
         PktVarFree((p)->pktvar);                \
     }                                           \
+    if ((p)->app_data != NULL) {                \
+        AppLayerDataChunkFree((p)->app_data);   \
+    }                                           \
     SCMutexDestroy(&(p)->tunnel_mutex);         \
     SCMutexDestroy(&(p)->cuda_mutex);           \
     SCCondDestroy(&(p)->cuda_cond);             \
@@ -1150,9 +1298,12 @@ Packet *PacketGetFromQueueOrAlloc(int pool);
 Packet *PacketGetFromQueueOrAlloc(void);
 #endif
 Packet *PacketGetFromAlloc(void);
+void PacketViewRelease(Packet *);
+void PacketViewPoolDestroy(void);
 int PacketCopyData(Packet *p, uint8_t *pktdata, int pktlen);
 int PacketSetData(Packet *p, uint8_t *pktdata, int pktlen);
 int PacketCopyDataOffset(Packet *p, int offset, uint8_t *data, int datalen);
+int PacketReserveData(Packet *p, int len);
 
 DecodeThreadVars *DecodeThreadVarsAlloc(ThreadVars *tv);
 
@@ -1198,6 +1349,7 @@ void AddressDebugPrint(Address *);
     if ((p)->events.cnt < PACKET_ENGINE_EVENT_MAX) { \
         (p)->events.events[(p)->events.cnt] = e; \
         (p)->events.cnt++; \
+        PACKET_SET_DIRTY((p), PKT_DIRTY_EVENTS); \
     } \
 } while(0)
 
@@ -1277,6 +1429,10 @@ void AddressDebugPrint(Address *);
 #define PKT_HOST_SRC_LOOKED_UP          (1<<19)
 #define PKT_HOST_DST_LOOKED_UP          (1<<20)
 
+#define PKT_FLOW_BYPASSED               (1<<21)     /**< Packet belongs to a bypassed flow */
+
+#define PKT_VIEW                        (1<<22)     /**< Tunnel packet refering to its parent's data, see PacketViewRelease */
+
 /** \brief return 1 if the packet is a pseudo packet */
 #define PKT_IS_PSEUDOPKT(p) ((p)->flags & PKT_PSEUDO_STREAM_END)
 
@@ -24,11 +24,35 @@
 #include "util-misc.h"
 #include "util-hash-lookup3.h"
 
-static DefragTracker *DefragTrackerGetUsedDefragTracker(void);
+static DefragTracker *DefragTrackerGetUsedDefragTracker(DefragTrackerCache *, Packet *);
 
 /** queue with spare tracker */
 static DefragTrackerQueue defragtracker_spare_q;
 
+/** per thread tracker caches, so we can free them at shutdown */
+static DefragTrackerCache *defragtracker_caches = NULL;
+static uint32_t defragtracker_caches_cnt = 0;
+static SCMutex defragtracker_caches_lock;
+
+/** per thread tracker tables, so we can free them at shutdown. Protected
+ *  by defragtracker_caches_lock as well. */
+static DefragThreadTable *defrag_thread_tables = NULL;
+static uint16_t defrag_thread_tables_cnt = 0;
+
+/** upper hash bits and table id of the last datagram a thread table
+ *  started, per shared hash row. Only used if the thread tables can fall
+ *  back to the shared hash, see DefragThreadTableClaimed(). 32 bits, so
+ *  the slots are atomic on 32 bit platforms as well. */
+typedef struct DefragThreadClaim_ {
+    SC_ATOMIC_DECLARE(unsigned int, claim);
+} DefragThreadClaim;
+
+static DefragThreadClaim *defrag_thread_claims = NULL;
+
+/** rows a prune walk looks at for trackers to add to the thread's cache,
+ *  after it found the tracker it needs */
+#define DEFRAG_TRACKER_CACHE_PRUNE_ROWS 64
+
 uint32_t DefragTrackerSpareQueueGetSize(void) {
     return DefragTrackerQueueLen(&defragtracker_spare_q);
 }
@@ -69,12 +93,41 @@ void DefragTrackerFree(DefragTracker *dt) {
     }
 }
 
+/** \internal
+ *  \brief alloc a tracker for a thread table, within the table's memcap.
+ *         These trackers are never locked. */
+static DefragTracker *DefragThreadTrackerAlloc(DefragThreadTable *t) {
+    if (t->memuse + sizeof(DefragTracker) > t->memcap)
+        return NULL;
+
+    DefragTracker *dt = SCMalloc(sizeof(DefragTracker));
+    if (unlikely(dt == NULL))
+        return NULL;
+
+    memset(dt, 0x00, sizeof(DefragTracker));
+
+    SC_ATOMIC_INIT(dt->use_cnt);
+    dt->table = t;
+    t->memuse += sizeof(DefragTracker);
+    return dt;
+}
+
+static void DefragThreadTrackerFree(DefragThreadTable *t, DefragTracker *dt) {
+    DefragTrackerClearMemory(dt);
+    SCFree(dt);
+    t->memuse -= sizeof(DefragTracker);
+}
+
 #define DefragTrackerIncrUsecnt(dt) \
     SC_ATOMIC_ADD((dt)->use_cnt, 1)
 #define DefragTrackerDecrUsecnt(dt) \
     SC_ATOMIC_SUB((dt)->use_cnt, 1)
 
-static void DefragTrackerInit(DefragTracker *dt, Packet *p) {
+static void DefragTrackerInit(DefragTracker *dt, Packet *p, uint32_t hash) {
+    /* clear what a recycled tracker still has set */
+    DEFRAG_TRACKER_RESET(dt);
+    dt->hash = hash;
+
     /* copy address */
     COPY_ADDRESS(&p->src, &dt->src_addr);
     COPY_ADDRESS(&p->dst, &dt->dst_addr);
@@ -88,15 +141,16 @@ static void DefragTrackerInit(DefragTracker *dt, Packet *p) {
     }
     dt->policy = DefragGetOsPolicy(p);
     TAILQ_INIT(&dt->frags);
-    (void) DefragTrackerIncrUsecnt(dt);
 }
 
+/** \brief alloc a new tracker, it's initialized by the caller, like the
+ *         trackers from the spare queue. Initializing it here too would
+ *         leave it with a use_cnt that is never released. */
 static DefragTracker *DefragTrackerNew(Packet *p) {
     DefragTracker *dt = DefragTrackerAlloc();
     if (dt == NULL)
         goto error;
 
-    DefragTrackerInit(dt, p);
     return dt;
 
 error:
@@ -113,10 +167,38 @@ void DefragTrackerClearMemory(DefragTracker *dt) {
     SC_ATOMIC_DESTROY(dt->use_cnt);
 }
 
+/**
+ *  \brief Set up a tracker cache for a decoder thread
+ *
+ *  The cache is freed by DefragHashShutdown().
+ *
+ *  \retval dc cache or NULL on error
+ */
+DefragTrackerCache *DefragTrackerCacheNew(void) {
+    DefragTrackerCache *dc = SCMalloc(sizeof(DefragTrackerCache));
+    if (unlikely(dc == NULL))
+        return NULL;
+    memset(dc, 0x00, sizeof(DefragTrackerCache));
+
+    SCMutexLock(&defragtracker_caches_lock);
+    /* start the prune walks of the threads in different parts of the
+     * hash, so they don't compete for the same rows */
+    dc->prune_idx = (defragtracker_caches_cnt * 0x9e3779b1U) % defrag_config.hash_size;
+    defragtracker_caches_cnt++;
+    dc->next = defragtracker_caches;
+    defragtracker_caches = dc;
+    SCMutexUnlock(&defragtracker_caches_lock);
+
+    return dc;
+}
+
 #define DEFRAG_DEFAULT_HASHSIZE 4096
 #define DEFRAG_DEFAULT_MEMCAP 16777216
 #define DEFRAG_DEFAULT_PREALLOC 1000
 
+#define DEFRAG_THREAD_DEFAULT_HASHSIZE 4096
+#define DEFRAG_THREAD_DEFAULT_MEMCAP 4194304
+
 /** \brief initialize the configuration
  *  \warning Not thread safe */
 void DefragInitConfig(char quiet)
@@ -128,7 +210,9 @@ void DefragInitConfig(char quiet)
     SC_ATOMIC_INIT(defragtracker_counter);
     SC_ATOMIC_INIT(defrag_memuse);
     SC_ATOMIC_INIT(defragtracker_prune_idx);
+    SC_ATOMIC_INIT(defrag_thread_fallback);
     DefragTrackerQueueInit(&defragtracker_spare_q);
+    SCMutexInit(&defragtracker_caches_lock, NULL);
 
     unsigned int seed = RandomTimePreseed();
     /* set defaults */
@@ -172,6 +256,53 @@ void DefragInitConfig(char quiet)
                "%"PRIu32", prealloc: %"PRIu32, defrag_config.memcap,
                defrag_config.hash_size, defrag_config.prealloc);
 
+    /* tracker tables per thread */
+    int thread_tables = 0;
+    if (ConfGetBool("defrag.per-thread.enabled", &thread_tables) == 1 &&
+            thread_tables)
+    {
+        int fallback = 1;
+
+        defrag_config.thread_tables = 1;
+        defrag_config.thread_hash_size = DEFRAG_THREAD_DEFAULT_HASHSIZE;
+        defrag_config.thread_memcap = DEFRAG_THREAD_DEFAULT_MEMCAP;
+
+        if (ConfGetBool("defrag.per-thread.fallback", &fallback) == 0)
+            fallback = 1;
+        defrag_config.thread_fallback = fallback ? 1 : 0;
+
+        if ((ConfGet("defrag.per-thread.memcap", &conf_val)) == 1)
+        {
+            if (ParseSizeStringU64(conf_val, &defrag_config.thread_memcap) < 0) {
+                SCLogError(SC_ERR_SIZE_PARSE, "Error parsing defrag.per-thread.memcap "
+                           "from conf file - %s.  Killing engine",
+                           conf_val);
+                exit(EXIT_FAILURE);
+            }
+        }
+        if ((ConfGet("defrag.per-thread.hash-size", &conf_val)) == 1)
+        {
+            if (ByteExtractStringUint32(&configval, 10, strlen(conf_val),
+                                        conf_val) > 0 && configval > 0) {
+                defrag_config.thread_hash_size = configval;
+            }
+        }
+
+        uint64_t thread_hash_size = defrag_config.thread_hash_size * sizeof(DefragTracker *);
+        if (thread_hash_size > defrag_config.thread_memcap) {
+            SCLogError(SC_ERR_DEFRAG_INIT, "defrag.per-thread.memcap %"PRIu64" "
+                    "is smaller than the thread hash size %"PRIu64". Calculate "
+                    "the hash size by multiplying \"defrag.per-thread.hash-size\" "
+                    "with %"PRIuMAX".", defrag_config.thread_memcap,
+                    thread_hash_size, (uintmax_t)sizeof(DefragTracker *));
+            exit(EXIT_FAILURE);
+        }
+        SCLogDebug("DefragTracker thread tables: memcap: %"PRIu64", hash-size: "
+                   "%"PRIu32", fallback: %s", defrag_config.thread_memcap,
+                   defrag_config.thread_hash_size,
+                   defrag_config.thread_fallback ? "yes" : "no");
+    }
+
     /* alloc hash memory */
     uint64_t hash_size = defrag_config.hash_size * sizeof(DefragTrackerHashRow);
     if (!(DEFRAG_CHECK_MEMCAP(hash_size))) {
@@ -196,6 +327,18 @@ void DefragInitConfig(char quiet)
     }
     (void) SC_ATOMIC_ADD(defrag_memuse, (defrag_config.hash_size * sizeof(DefragTrackerHashRow)));
 
+    if (defrag_config.thread_tables && defrag_config.thread_fallback) {
+        defrag_thread_claims = SCCalloc(defrag_config.hash_size, sizeof(DefragThreadClaim));
+        if (unlikely(defrag_thread_claims == NULL)) {
+            SCLogError(SC_ERR_FATAL, "Fatal error encountered in DefragTrackerInitConfig. Exiting...");
+            exit(EXIT_FAILURE);
+        }
+        for (i = 0; i < defrag_config.hash_size; i++) {
+            SC_ATOMIC_INIT(defrag_thread_claims[i].claim);
+        }
+        (void) SC_ATOMIC_ADD(defrag_memuse, (defrag_config.hash_size * sizeof(DefragThreadClaim)));
+    }
+
     if (quiet == FALSE) {
         SCLogInfo("allocated %llu bytes of memory for the defrag hash... "
                   "%" PRIu32 " buckets of size %" PRIuMAX "",
@@ -233,6 +376,12 @@ void DefragInitConfig(char quiet)
     if (quiet == FALSE) {
         SCLogInfo("defrag memory usage: %llu bytes, maximum: %"PRIu64,
                 SC_ATOMIC_GET(defrag_memuse), defrag_config.memcap);
+        if (defrag_config.thread_tables) {
+            SCLogInfo("defrag tracker tables per thread: %"PRIu32" buckets, "
+                    "memcap %"PRIu64" bytes, fallback to the shared hash %s",
+                    defrag_config.thread_hash_size, defrag_config.thread_memcap,
+                    defrag_config.thread_fallback ? "enabled" : "disabled");
+        }
     }
 
     return;
@@ -259,6 +408,53 @@ void DefragHashShutdown(void)
         DefragTrackerFree(dt);
     }
 
+    /* free the thread caches, the threads are gone by now */
+    while (defragtracker_caches != NULL) {
+        DefragTrackerCache *dc = defragtracker_caches;
+        defragtracker_caches = dc->next;
+
+        while (dc->cnt > 0) {
+            dt = dc->trackers[--dc->cnt];
+            BUG_ON(SC_ATOMIC_GET(dt->use_cnt) > 0);
+            DefragTrackerFree(dt);
+        }
+        SCFree(dc);
+    }
+    defragtracker_caches_cnt = 0;
+
+    /* free the thread tables, their trackers and pools */
+    while (defrag_thread_tables != NULL) {
+        DefragThreadTable *t = defrag_thread_tables;
+        defrag_thread_tables = t->next;
+
+        for (u = 0; u < t->hash_size; u++) {
+            dt = t->rows[u];
+            while (dt) {
+                DefragTracker *n = dt->hnext;
+                DefragThreadTrackerFree(t, dt);
+                dt = n;
+            }
+        }
+        while ((dt = t->spare) != NULL) {
+            t->spare = dt->lnext;
+            DefragThreadTrackerFree(t, dt);
+        }
+        PoolFree(t->frag_pool);
+        PoolFree(t->frag_data_pool);
+        SCFree(t->rows);
+        SCFree(t);
+    }
+    defrag_thread_tables_cnt = 0;
+    if (defrag_thread_claims != NULL) {
+        for (u = 0; u < defrag_config.hash_size; u++) {
+            SC_ATOMIC_DESTROY(defrag_thread_claims[u].claim);
+        }
+        SCFree(defrag_thread_claims);
+        defrag_thread_claims = NULL;
+        (void) SC_ATOMIC_SUB(defrag_memuse, defrag_config.hash_size * sizeof(DefragThreadClaim));
+    }
+    SCMutexDestroy(&defragtracker_caches_lock);
+
     /* clear and free the hash */
     if (defragtracker_hash != NULL) {
         for (u = 0; u < defrag_config.hash_size; u++) {
@@ -279,6 +475,7 @@ void DefragHashShutdown(void)
     DefragTrackerQueueDestroy(&defragtracker_spare_q);
 
     SC_ATOMIC_DESTROY(defragtracker_prune_idx);
+    SC_ATOMIC_DESTROY(defrag_thread_fallback);
     SC_ATOMIC_DESTROY(defrag_memuse);
     SC_ATOMIC_DESTROY(defragtracker_counter);
     //SC_ATOMIC_DESTROY(flow_flags);
@@ -329,7 +526,8 @@ typedef struct DefragHashKey6_ {
     };
 } DefragHashKey6;
 
-/* calculate the hash key for this packet
+/* calculate the hash for this packet, the shared hash and the thread
+ * tables each take their key from it
  *
  * we're using:
  *  hash_rand -- set at init time
@@ -337,8 +535,8 @@ typedef struct DefragHashKey6_ {
  *  destination address
  *  id
  */
-static inline uint32_t DefragHashGetKey(Packet *p) {
-    uint32_t key;
+static inline uint32_t DefragHashGetHash(Packet *p) {
+    uint32_t hash;
 
     if (p->ip4h != NULL) {
         DefragHashKey4 dhk;
@@ -351,8 +549,7 @@ static inline uint32_t DefragHashGetKey(Packet *p) {
         }
         dhk.id = (uint32_t)IPV4_GET_IPID(p);
 
-        uint32_t hash = hashword(dhk.u32, 3, defrag_config.hash_rand);
-        key = hash % defrag_config.hash_size;
+        hash = hashword(dhk.u32, 3, defrag_config.hash_rand);
     } else if (p->ip6h != NULL) {
         DefragHashKey6 dhk;
         if (DefragHashRawAddressIPv6GtU32(p->src.addr_data32, p->dst.addr_data32)) {
@@ -376,12 +573,11 @@ static inline uint32_t DefragHashGetKey(Packet *p) {
         }
         dhk.id = IPV6_EXTHDR_GET_FH_ID(p);
 
-        uint32_t hash = hashword(dhk.u32, 9, defrag_config.hash_rand);
-        key = hash % defrag_config.hash_size;
+        hash = hashword(dhk.u32, 9, defrag_config.hash_rand);
     } else
-        key = 0;
+        hash = 0;
 
-    return key;
+    return hash;
 }
 
 /* Since two or more trackers can have the same hash key, we need to compare
@@ -410,13 +606,25 @@ static inline int DefragTrackerCompare(DefragTracker *t, Packet *p) {
  *  Get a new defrag tracker. We're checking memcap first and will try to make room
  *  if the memcap is reached.
  *
+ *  \param dc tracker cache of the calling thread, can be NULL
+ *
  *  \retval dt *LOCKED* tracker on succes, NULL on error.
  */
-static DefragTracker *DefragTrackerGetNew(Packet *p) {
+static DefragTracker *DefragTrackerGetNew(DefragTrackerCache *dc, Packet *p) {
     DefragTracker *dt = NULL;
 
-    /* get a tracker from the spare queue */
-    dt = DefragTrackerDequeue(&defragtracker_spare_q);
+    /* get a tracker from the thread's cache, which is refilled from the
+     * spare queue in batches, or from the spare queue directly */
+    if (dc != NULL) {
+        if (dc->cnt == 0) {
+            dc->cnt = DefragTrackerDequeueBatch(&defragtracker_spare_q,
+                    dc->trackers, DEFRAG_TRACKER_CACHE_BATCH);
+        }
+        if (dc->cnt > 0)
+            dt = dc->trackers[--dc->cnt];
+    } else {
+        dt = DefragTrackerDequeue(&defragtracker_spare_q);
+    }
     if (dt == NULL) {
         /* If we reached the max memcap, we get a used tracker */
         if (!(DEFRAG_CHECK_MEMCAP(sizeof(DefragTracker)))) {
@@ -430,7 +638,7 @@ static DefragTracker *DefragTrackerGetNew(Packet *p) {
             //    FlowWakeupFlowManagerThread();
             //}
 
-            dt = DefragTrackerGetUsedDefragTracker();
+            dt = DefragTrackerGetUsedDefragTracker(dc, p);
             if (dt == NULL) {
                 return NULL;
             }
@@ -443,7 +651,7 @@ static DefragTracker *DefragTrackerGetNew(Packet *p) {
                 return NULL;
             }
 
-            /* tracker is initialized but *unlocked* */
+            /* tracker is *unlocked*, the caller initializes it */
         }
     } else {
         /* tracker has been recycled before it went into the spare queue */
@@ -464,19 +672,20 @@ static DefragTracker *DefragTrackerGetNew(Packet *p) {
  *
  * returns a *LOCKED* tracker or NULL
  */
-DefragTracker *DefragGetTrackerFromHash (Packet *p)
+DefragTracker *DefragGetTrackerFromHash (DefragTrackerCache *dc, Packet *p)
 {
     DefragTracker *dt = NULL;
 
     /* get the key to our bucket */
-    uint32_t key = DefragHashGetKey(p);
+    uint32_t hash = DefragHashGetHash(p);
+    uint32_t key = hash % defrag_config.hash_size;
     /* get our hash bucket and lock it */
     DefragTrackerHashRow *hb = &defragtracker_hash[key];
     DRLOCK_LOCK(hb);
 
     /* see if the bucket already has a tracker */
     if (hb->head == NULL) {
-        dt = DefragTrackerGetNew(p);
+        dt = DefragTrackerGetNew(dc, p);
         if (dt == NULL) {
             DRLOCK_UNLOCK(hb);
             return NULL;
@@ -487,7 +696,8 @@ DefragTracker *DefragGetTrackerFromHash (Packet *p)
         hb->tail = dt;
 
         /* got one, now lock, initialize and return */
-        DefragTrackerInit(dt,p);
+        DefragTrackerInit(dt,p,hash);
+        (void) DefragTrackerIncrUsecnt(dt);
 
         DRLOCK_UNLOCK(hb);
         return dt;
@@ -505,7 +715,7 @@ DefragTracker *DefragGetTrackerFromHash (Packet *p)
             dt = dt->hnext;
 
             if (dt == NULL) {
-                dt = pdt->hnext = DefragTrackerGetNew(p);
+                dt = pdt->hnext = DefragTrackerGetNew(dc, p);
                 if (dt == NULL) {
                     DRLOCK_UNLOCK(hb);
                     return NULL;
@@ -517,7 +727,8 @@ DefragTracker *DefragGetTrackerFromHash (Packet *p)
                 dt->hprev = pdt;
 
                 /* initialize and return */
-                DefragTrackerInit(dt,p);
+                DefragTrackerInit(dt,p,hash);
+                (void) DefragTrackerIncrUsecnt(dt);
 
                 DRLOCK_UNLOCK(hb);
                 return dt;
@@ -568,7 +779,7 @@ DefragTracker *DefragLookupTrackerFromHash (Packet *p)
     DefragTracker *dt = NULL;
 
     /* get the key to our bucket */
-    uint32_t key = DefragHashGetKey(p);
+    uint32_t key = DefragHashGetHash(p) % defrag_config.hash_size;
     /* get our hash bucket and lock it */
     DefragTrackerHashRow *hb = &defragtracker_hash[key];
     DRLOCK_LOCK(hb);
@@ -635,11 +846,24 @@ DefragTracker *DefragLookupTrackerFromHash (Packet *p)
  *  sure we don't start at the top each time since that would clear the top of
  *  the hash leading to longer and longer search times under high pressure (observed).
  *
+ *  With a thread cache each thread walks from its own index instead, and
+ *  trackers in the next rows that are reassembled or timed out are moved
+ *  to the cache, so the next few new trackers don't need a walk.
+ *
+ *  \param dc tracker cache of the calling thread, can be NULL
+ *  \param p packet, for the timeout check
+ *
  *  \retval dt tracker or NULL
  */
-static DefragTracker *DefragTrackerGetUsedDefragTracker(void) {
-    uint32_t idx = SC_ATOMIC_GET(defragtracker_prune_idx) % defrag_config.hash_size;
+static DefragTracker *DefragTrackerGetUsedDefragTracker(DefragTrackerCache *dc, Packet *p) {
+    uint32_t idx;
     uint32_t cnt = defrag_config.hash_size;
+    DefragTracker *ret = NULL;
+
+    if (dc != NULL)
+        idx = dc->prune_idx % defrag_config.hash_size;
+    else
+        idx = SC_ATOMIC_GET(defragtracker_prune_idx) % defrag_config.hash_size;
 
     while (cnt--) {
         if (++idx >= defrag_config.hash_size)
@@ -671,6 +895,14 @@ static DefragTracker *DefragTrackerGetUsedDefragTracker(void) {
             continue;
         }
 
+        /* only trackers that are done with go to the cache */
+        if (ret != NULL && !dt->remove &&
+                dt->timeout > (uint32_t)p->ts.tv_sec) {
+            DRLOCK_UNLOCK(hb);
+            SCMutexUnlock(&dt->lock);
+            continue;
+        }
+
         /* remove from the hash */
         if (dt->hprev != NULL)
             dt->hprev->hnext = dt->hnext;
@@ -689,11 +921,260 @@ static DefragTracker *DefragTrackerGetUsedDefragTracker(void) {
 
         SCMutexUnlock(&dt->lock);
 
-        (void) SC_ATOMIC_ADD(defragtracker_prune_idx, (defrag_config.hash_size - cnt));
+        /* not active anymore, DefragTrackerGetNew() counts it again */
+        (void) SC_ATOMIC_SUB(defragtracker_counter, 1);
+
+        if (dc == NULL) {
+            (void) SC_ATOMIC_ADD(defragtracker_prune_idx, (defrag_config.hash_size - cnt));
+            return dt;
+        }
+
+        if (ret == NULL) {
+            ret = dt;
+            if (cnt > DEFRAG_TRACKER_CACHE_PRUNE_ROWS)
+                cnt = DEFRAG_TRACKER_CACHE_PRUNE_ROWS;
+        } else {
+            dc->trackers[dc->cnt++] = dt;
+            if (dc->cnt == DEFRAG_TRACKER_CACHE_BATCH)
+                break;
+        }
+    }
+
+    if (dc != NULL)
+        dc->prune_idx = idx;
+    return ret;
+}
+
+
+
+/**
+ *  \brief Set up a tracker table for a decoder thread
+ *
+ *  The table takes over the pools. It's freed by DefragHashShutdown().
+ *
+ *  \param frag_pool pool of fragments for the table
+ *  \param frag_data_pool pool of fragment data buffers for the table
+ *
+ *  \retval t table or NULL on error
+ */
+DefragThreadTable *DefragThreadTableNew(Pool *frag_pool, Pool *frag_data_pool) {
+    DefragThreadTable *t = SCMalloc(sizeof(DefragThreadTable));
+    if (unlikely(t == NULL))
+        return NULL;
+    memset(t, 0x00, sizeof(DefragThreadTable));
+
+    t->hash_size = defrag_config.thread_hash_size;
+    t->memcap = defrag_config.thread_memcap;
+    t->rows = SCCalloc(t->hash_size, sizeof(DefragTracker *));
+    if (unlikely(t->rows == NULL)) {
+        SCFree(t);
+        return NULL;
+    }
+    t->memuse = t->hash_size * sizeof(DefragTracker *);
+    t->frag_pool = frag_pool;
+    t->frag_data_pool = frag_data_pool;
+
+    SCMutexLock(&defragtracker_caches_lock);
+    t->id = ++defrag_thread_tables_cnt;
+    t->next = defrag_thread_tables;
+    defrag_thread_tables = t;
+    SCMutexUnlock(&defragtracker_caches_lock);
+
+    return t;
+}
+
+/** the row of the slot already stands for the lower hash bits, the id is
+ *  > 0 so a claim is never 0 */
+#define DEFRAG_THREAD_CLAIM(t, hash) \
+    (((hash) & 0xffff0000U) | (t)->id)
+
+/** \internal
+ *  \brief check if another thread table started the last datagram with
+ *         this hash
+ *
+ *  With symmetric load balancing all fragments of a datagram go to the
+ *  same thread. If they don't, a fragment shows up on another thread
+ *  than the first fragments, and the datagram can't be reassembled by
+ *  either of them. The claims are only a hint: a slot holds the last
+ *  datagram of its row, so a datagram can be missed.
+ *
+ *  \retval 1 another table has it
+ *  \retval 0 no other table has it
+ */
+static int DefragThreadTableClaimed(DefragThreadTable *t, uint32_t hash) {
+    DefragThreadClaim *slot = &defrag_thread_claims[hash % defrag_config.hash_size];
+    unsigned int claim = SC_ATOMIC_GET(slot->claim);
+
+    if (claim != 0 && (claim & 0xffff0000U) == (hash & 0xffff0000U) &&
+            (uint16_t)claim != t->id)
+        return 1;
+    return 0;
+}
+
+/** \internal
+ *  \brief claim the row slot for a new datagram
+ *
+ *  The slot is only written if it holds another claim, and only once: if
+ *  another thread wrote it in between, its claim is as good a hint. */
+static void DefragThreadTableClaim(DefragThreadTable *t, uint32_t hash) {
+    DefragThreadClaim *slot = &defrag_thread_claims[hash % defrag_config.hash_size];
+    unsigned int claim = SC_ATOMIC_GET(slot->claim);
+
+    if (claim != DEFRAG_THREAD_CLAIM(t, hash))
+        (void) SC_ATOMIC_CAS(&slot->claim, claim, DEFRAG_THREAD_CLAIM(t, hash));
+}
+
+/** \internal
+ *  \brief clear our claim, if it wasn't replaced by another datagram */
+static void DefragThreadTableUnclaim(DefragThreadTable *t, uint32_t hash) {
+    DefragThreadClaim *slot = &defrag_thread_claims[hash % defrag_config.hash_size];
+
+    if (SC_ATOMIC_GET(slot->claim) == DEFRAG_THREAD_CLAIM(t, hash))
+        (void) SC_ATOMIC_CAS(&slot->claim, DEFRAG_THREAD_CLAIM(t, hash), 0);
+}
+
+/** \internal
+ *  \brief take a tracker out of its row */
+static void DefragThreadTableUnlink(DefragThreadTable *t, DefragTracker *dt) {
+    DefragTracker **row = &t->rows[dt->hash % t->hash_size];
+
+    if (dt->hprev != NULL)
+        dt->hprev->hnext = dt->hnext;
+    else
+        *row = dt->hnext;
+    if (dt->hnext != NULL)
+        dt->hnext->hprev = dt->hprev;
+    dt->hnext = NULL;
+    dt->hprev = NULL;
+    t->active--;
+
+    if (defrag_thread_claims != NULL)
+        DefragThreadTableUnclaim(t, dt->hash);
+}
+
+/**
+ *  \brief Remove a tracker from its thread table
+ *
+ *  The fragments are freed and the tracker goes to the table's spare
+ *  list. Only to be called by the thread that owns the table.
+ */
+void DefragThreadTableRemove(DefragThreadTable *t, DefragTracker *dt) {
+    DefragThreadTableUnlink(t, dt);
+    DefragTrackerFreeFrags(dt);
+
+    dt->lnext = t->spare;
+    t->spare = dt;
+}
+
+/** \internal
+ *  \brief Get a tracker from the rows of a thread table
+ *
+ *  Called when the table has no spare trackers and is at its memcap.
+ *  Takes the least recently used tracker of the next row that has one,
+ *  like DefragTrackerGetUsedDefragTracker() does for the shared hash.
+ *
+ *  \retval dt tracker or NULL
+ */
+static DefragTracker *DefragThreadTableGetUsed(DefragThreadTable *t) {
+    uint32_t cnt = t->hash_size;
+
+    while (cnt--) {
+        if (++t->prune_idx >= t->hash_size)
+            t->prune_idx = 0;
+
+        DefragTracker *dt = t->rows[t->prune_idx];
+        if (dt == NULL)
+            continue;
+
+        while (dt->hnext != NULL)
+            dt = dt->hnext;
+
+        DefragThreadTableUnlink(t, dt);
+        DefragTrackerFreeFrags(dt);
         return dt;
     }
 
     return NULL;
 }
 
+/**
+ *  \brief Get the tracker for a fragment from a thread table
+ *
+ *  The trackers of a thread table are not locked. A new datagram goes to
+ *  the shared hash instead if the thread tables fell back to it. That
+ *  happens when fragments of a datagram show up on more than one thread,
+ *  see DefragThreadTableClaimed(). Datagrams the table already has are
+ *  still reassembled by it.
+ *
+ *  \param t table of the calling thread
+ *  \param p fragment
+ *  \param shared set to 1 if the fragment should go to the shared hash
+ *
+ *  \retval dt tracker, NULL if shared is set or there is no tracker left
+ */
+DefragTracker *DefragThreadTableGetTracker(DefragThreadTable *t, Packet *p, int *shared) {
+    uint32_t hash = DefragHashGetHash(p);
+    DefragTracker **row = &t->rows[hash % t->hash_size];
+    DefragTracker *dt;
+
+    *shared = 0;
+
+    for (dt = *row; dt != NULL; dt = dt->hnext) {
+        if (dt->hash != hash || DefragTrackerCompare(dt, p) == 0)
+            continue;
+
+        /* put it on top of the row, this rewards active trackers */
+        if (dt != *row) {
+            dt->hprev->hnext = dt->hnext;
+            if (dt->hnext != NULL)
+                dt->hnext->hprev = dt->hprev;
+            dt->hprev = NULL;
+            dt->hnext = *row;
+            (*row)->hprev = dt;
+            *row = dt;
+        }
+        return dt;
+    }
+
+    /* new datagram */
+    if (SC_ATOMIC_GET(defrag_thread_fallback)) {
+        *shared = 1;
+        return NULL;
+    }
+    if (defrag_thread_claims != NULL && DefragThreadTableClaimed(t, hash)) {
+        if (SC_ATOMIC_CAS(&defrag_thread_fallback, 0, 1)) {
+            SCLogInfo("fragments of a datagram were seen on more than one "
+                    "thread, new datagrams go to the shared defrag hash "
+                    "from now on. Check the load balancing of the capture "
+                    "if this is unexpected.");
+        }
+        *shared = 1;
+        return NULL;
+    }
 
+    dt = t->spare;
+    if (dt != NULL) {
+        t->spare = dt->lnext;
+        dt->lnext = NULL;
+    } else {
+        dt = DefragThreadTrackerAlloc(t);
+        if (dt == NULL) {
+            dt = DefragThreadTableGetUsed(t);
+            if (dt == NULL)
+                return NULL;
+        }
+    }
+
+    DefragTrackerInit(dt, p, hash);
+
+    dt->hnext = *row;
+    if (*row != NULL)
+        (*row)->hprev = dt;
+    *row = dt;
+    t->active++;
+
+    if (defrag_thread_claims != NULL)
+        DefragThreadTableClaim(t, hash);
+
+    return dt;
+}
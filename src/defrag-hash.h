@@ -72,6 +72,14 @@ typedef struct DefragConfig_ {
     uint32_t hash_rand;
     uint32_t hash_size;
     uint32_t prealloc;
+
+    /* defrag.per-thread */
+    uint8_t thread_tables;      /**< use a tracker table per thread */
+    uint8_t thread_fallback;    /**< switch to the shared hash if the
+                                 *   fragments of a datagram show up on
+                                 *   more than one thread */
+    uint32_t thread_hash_size;
+    uint64_t thread_memcap;
 } DefragConfig;
 
 /** \brief check if a memory alloc would fit in the memcap
@@ -88,16 +96,23 @@ DefragConfig defrag_config;
 SC_ATOMIC_DECLARE(unsigned long long int,defrag_memuse);
 SC_ATOMIC_DECLARE(unsigned int,defragtracker_counter);
 SC_ATOMIC_DECLARE(unsigned int,defragtracker_prune_idx);
+/** set once the thread tables fell back to the shared hash */
+SC_ATOMIC_DECLARE(unsigned int,defrag_thread_fallback);
 
 void DefragInitConfig(char quiet);
 void DefragHashShutdown(void);
 
 DefragTracker *DefragLookupTrackerFromHash (Packet *);
-DefragTracker *DefragGetTrackerFromHash (Packet *);
+DefragTracker *DefragGetTrackerFromHash (DefragTrackerCache *, Packet *);
+DefragTrackerCache *DefragTrackerCacheNew(void);
 void DefragTrackerRelease(DefragTracker *);
 void DefragTrackerClearMemory(DefragTracker *);
 void DefragTrackerMoveToSpare(DefragTracker *);
 uint32_t DefragTrackerSpareQueueGetSize(void);
 
+DefragThreadTable *DefragThreadTableNew(Pool *, Pool *);
+DefragTracker *DefragThreadTableGetTracker(DefragThreadTable *, Packet *, int *);
+void DefragThreadTableRemove(DefragThreadTable *, DefragTracker *);
+
 #endif /* __DEFRAG_HASH_H__ */
 
@@ -128,6 +128,49 @@ DefragTracker *DefragTrackerDequeue (DefragTrackerQueue *q) {
     return dt;
 }
 
+/**
+ *  \brief remove up to cnt trackers from the queue
+ *
+ *  Same as calling DefragTrackerDequeue() cnt times, but takes the queue
+ *  lock only once.
+ *
+ *  \param q queue
+ *  \param dts array to store the trackers in
+ *  \param cnt size of the array
+ *
+ *  \retval n number of trackers stored in dts
+ */
+uint32_t DefragTrackerDequeueBatch (DefragTrackerQueue *q, DefragTracker **dts, uint32_t cnt) {
+    uint32_t n = 0;
+
+    DQLOCK_LOCK(q);
+
+    while (n < cnt && q->bot != NULL) {
+        DefragTracker *dt = q->bot;
+
+        if (dt->lprev != NULL) {
+            q->bot = dt->lprev;
+            q->bot->lnext = NULL;
+        } else {
+            q->top = NULL;
+            q->bot = NULL;
+        }
+
+#ifdef DEBUG
+        BUG_ON(q->len == 0);
+#endif
+        if (q->len > 0)
+            q->len--;
+
+        dt->lnext = NULL;
+        dt->lprev = NULL;
+        dts[n++] = dt;
+    }
+
+    DQLOCK_UNLOCK(q);
+    return n;
+}
+
 uint32_t DefragTrackerQueueLen(DefragTrackerQueue *q) {
     uint32_t len;
     DQLOCK_LOCK(q);
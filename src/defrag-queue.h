@@ -78,6 +78,7 @@ void DefragTrackerQueueDestroy (DefragTrackerQueue *);
 
 void DefragTrackerEnqueue (DefragTrackerQueue *, DefragTracker *);
 DefragTracker *DefragTrackerDequeue (DefragTrackerQueue *);
+uint32_t DefragTrackerDequeueBatch (DefragTrackerQueue *, DefragTracker **, uint32_t);
 uint32_t DefragTrackerQueueLen(DefragTrackerQueue *);
 
 #endif /* __DEFRAG_QUEUE_H__ */
@@ -24,6 +24,8 @@
 #include "suricata-common.h"
 #include "defrag.h"
 #include "defrag-hash.h"
+#include "defrag-timeout.h"
+#include "counters.h"
 
 uint32_t DefragTrackerGetSpareCount(void) {
     return DefragTrackerSpareQueueGetSize();
@@ -148,3 +150,49 @@ uint32_t DefragTimeoutHash(struct timeval *ts) {
     return cnt;
 }
 
+
+/**
+ *  \brief time out the trackers of a thread table
+ *
+ *  Called by the thread that owns the table, so nothing is locked. The
+ *  table is walked by its thread instead of by the flow manager, which
+ *  only times out the shared hash.
+ *
+ *  \param tv thread vars of the thread, for the counters, can be NULL
+ *  \param dtv decode thread vars of the thread, can be NULL
+ *  \param t table of the thread
+ *  \param ts timestamp
+ *
+ *  \retval cnt number of timed out trackers
+ */
+uint32_t DefragThreadTableTimeout(ThreadVars *tv, DecodeThreadVars *dtv,
+        DefragThreadTable *t, struct timeval *ts)
+{
+    uint32_t idx = 0;
+    uint32_t cnt = 0;
+
+    for (idx = 0; idx < t->hash_size && t->active > 0; idx++) {
+        DefragTracker *dt = t->rows[idx];
+
+        while (dt != NULL) {
+            DefragTracker *next_dt = dt->hnext;
+
+            if (dt->remove || dt->timeout <= (uint32_t)ts->tv_sec) {
+                if (tv != NULL && dtv != NULL && !dt->remove) {
+                    if (dt->af == AF_INET)
+                        SCPerfCounterIncr(dtv->counter_defrag_ipv4_timeouts,
+                                tv->sc_perf_pca);
+                    else
+                        SCPerfCounterIncr(dtv->counter_defrag_ipv6_timeouts,
+                                tv->sc_perf_pca);
+                }
+                DefragThreadTableRemove(t, dt);
+                cnt++;
+            }
+
+            dt = next_dt;
+        }
+    }
+
+    return cnt;
+}
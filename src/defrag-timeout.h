@@ -24,7 +24,12 @@
 #ifndef __DEFRAG_TIMEOUT_H__
 #define __DEFRAG_TIMEOUT_H__
 
+#include "decode.h"
+#include "defrag.h"
+
 uint32_t DefragTimeoutHash(struct timeval *ts);
+uint32_t DefragThreadTableTimeout(ThreadVars *, DecodeThreadVars *,
+        DefragThreadTable *, struct timeval *);
 
 uint32_t DefragGetSpareCount(void);
 uint32_t DefragGetActiveCount(void);
@@ -25,7 +25,6 @@
  *   - RFC 815
  *   - OpenBSD PF's IP normalizaton (pf_norm.c)
  *
- * \todo pool for frag packet storage
  * \todo policy bsd-right
  * \todo profile hash function
  * \todo log anomalies
@@ -53,6 +52,7 @@
 #include "defrag.h"
 #include "defrag-hash.h"
 #include "defrag-queue.h"
+#include "defrag-timeout.h"
 
 #ifdef UNITTESTS
 #include "util-unittest.h"
@@ -61,6 +61,30 @@
 #define DEFAULT_DEFRAG_HASH_SIZE 0xffff
 #define DEFAULT_DEFRAG_POOL_SIZE 0xffff
 
+/**
+ * Size of the fragment data buffers in the frag data pool. Fits a full
+ * sized fragment of a 1500 byte MTU link, including the headers. Larger
+ * fragments get their own allocation.
+ */
+#define DEFRAG_FRAG_DATA_SIZE 2048
+
+/**
+ * Number of fragment data buffers preallocated.
+ */
+#define DEFAULT_DEFRAG_DATA_PREALLOC 1024
+
+/**
+ * Number of fragments and fragment data buffers preallocated for the
+ * tracker table of a thread.
+ */
+#define DEFAULT_DEFRAG_THREAD_PREALLOC 256
+
+/**
+ * Most memory a fragment of a thread table can use: the frag and its
+ * data buffer. Larger fragments are checked against their own size.
+ */
+#define DEFRAG_THREAD_FRAG_MEMUSE (sizeof(Frag) + DEFRAG_FRAG_DATA_SIZE)
+
 /**
  * Default timeout (in seconds) before a defragmentation tracker will
  * be released.
@@ -120,13 +144,27 @@ DumpFrags(DefragTracker *tracker)
  * \brief Reset a frag for reuse in a pool.
  */
 static void
-DefragFragReset(Frag *frag)
+DefragFragReset(Frag *frag, Pool *frag_data_pool)
 {
-    if (frag->pkt != NULL)
-        SCFree(frag->pkt);
+    if (frag->pkt != NULL) {
+        if (frag->pkt_pooled)
+            PoolReturn(frag_data_pool, frag->pkt);
+        else
+            SCFree(frag->pkt);
+    }
     memset(frag, 0, sizeof(*frag));
 }
 
+/**
+ * \brief Memory of a fragment, as charged to the memcap of its thread
+ *     table.
+ */
+static inline uint32_t
+DefragFragMemuse(const Frag *frag)
+{
+    return sizeof(Frag) + (frag->pkt_pooled ? DEFRAG_FRAG_DATA_SIZE : frag->len);
+}
+
 /**
  * \brief Allocate a new frag for use in a pool.
  */
@@ -139,6 +177,16 @@ DefragFragInit(void *data, void *initdata)
     return 1;
 }
 
+/**
+ * \brief Set up a new buffer for the frag data pool. It's overwritten
+ *     by the fragment data, so no need to clear it.
+ */
+static int
+DefragFragDataInit(void *data, void *initdata)
+{
+    return 1;
+}
+
 /**
  * \brief Free all frags associated with a tracker.
  */
@@ -147,6 +195,18 @@ DefragTrackerFreeFrags(DefragTracker *tracker)
 {
     Frag *frag;
 
+    /* The pools of a thread table are only used by its thread. */
+    if (tracker->table != NULL) {
+        while ((frag = TAILQ_FIRST(&tracker->frags)) != NULL) {
+            TAILQ_REMOVE(&tracker->frags, frag, next);
+
+            tracker->table->memuse -= DefragFragMemuse(frag);
+            DefragFragReset(frag, tracker->table->frag_data_pool);
+            PoolReturn(tracker->table->frag_pool, frag);
+        }
+        return;
+    }
+
     /* Lock the frag pool as we'll be return items to it. */
     SCMutexLock(&defrag_context->frag_pool_lock);
 
@@ -154,7 +214,7 @@ DefragTrackerFreeFrags(DefragTracker *tracker)
         TAILQ_REMOVE(&tracker->frags, frag, next);
 
         /* Don't SCFree the frag, just give it back to its pool. */
-        DefragFragReset(frag);
+        DefragFragReset(frag, defrag_context->frag_data_pool);
         PoolReturn(defrag_context->frag_pool, frag);
     }
 
@@ -187,6 +247,7 @@ DefragContextNew(void)
     if (!ConfGetInt("defrag.max-frags", &frag_pool_size) || frag_pool_size == 0) {
         frag_pool_size = DEFAULT_DEFRAG_POOL_SIZE;
     }
+    dc->max_frags = frag_pool_size;
     intmax_t frag_pool_prealloc = frag_pool_size / 2;
     dc->frag_pool = PoolInit(frag_pool_size, frag_pool_prealloc,
         sizeof(Frag),
@@ -196,6 +257,16 @@ DefragContextNew(void)
             "Defrag: Failed to initialize fragment pool.");
         exit(EXIT_FAILURE);
     }
+    intmax_t frag_data_prealloc = DEFAULT_DEFRAG_DATA_PREALLOC;
+    if (frag_data_prealloc > frag_pool_size)
+        frag_data_prealloc = frag_pool_size;
+    dc->frag_data_pool = PoolInit(frag_pool_size, frag_data_prealloc,
+        DEFRAG_FRAG_DATA_SIZE, NULL, DefragFragDataInit, NULL, NULL, NULL);
+    if (dc->frag_data_pool == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC,
+            "Defrag: Failed to initialize fragment data pool.");
+        exit(EXIT_FAILURE);
+    }
     if (SCMutexInit(&dc->frag_pool_lock, NULL) != 0) {
         SCLogError(SC_ERR_MUTEX,
             "Defrag: Failed to initialize frag pool mutex.");
@@ -238,9 +309,61 @@ DefragContextDestroy(DefragContext *dc)
         return;
 
     PoolFree(dc->frag_pool);
+    PoolFree(dc->frag_data_pool);
     SCFree(dc);
 }
 
+/**
+ * \brief Set up the tracker table of a decoder thread, with its own
+ *     frag pools so the thread doesn't need the frag pool lock.
+ *
+ * The fragments are charged to defrag.per-thread.memcap along with the
+ * trackers, so the pools are sized to what fits in it.
+ *
+ * \retval The table, or NULL on error.
+ */
+static DefragThreadTable *
+DefragThreadTableSetup(void)
+{
+    DefragThreadTable *t = NULL;
+    Pool *frag_pool = NULL;
+    Pool *frag_data_pool = NULL;
+
+    uint64_t max_frags = defrag_config.thread_memcap / DEFRAG_THREAD_FRAG_MEMUSE;
+    if (max_frags > defrag_context->max_frags)
+        max_frags = defrag_context->max_frags;
+    if (max_frags == 0)
+        max_frags = 1;
+
+    uint32_t prealloc = DEFAULT_DEFRAG_THREAD_PREALLOC;
+    if (prealloc > max_frags)
+        prealloc = (uint32_t)max_frags;
+
+    frag_pool = PoolInit((uint32_t)max_frags, prealloc,
+        sizeof(Frag), NULL, DefragFragInit, defrag_context, NULL, NULL);
+    if (frag_pool == NULL)
+        goto error;
+    frag_data_pool = PoolInit((uint32_t)max_frags, prealloc,
+        DEFRAG_FRAG_DATA_SIZE, NULL, DefragFragDataInit, NULL, NULL, NULL);
+    if (frag_data_pool == NULL)
+        goto error;
+
+    t = DefragThreadTableNew(frag_pool, frag_data_pool);
+    if (t == NULL)
+        goto error;
+
+    return t;
+
+error:
+    SCLogError(SC_ERR_MEM_ALLOC, "Defrag: Failed to set up the tracker "
+        "table of a thread, using the shared hash.");
+    if (frag_pool != NULL)
+        PoolFree(frag_pool);
+    if (frag_data_pool != NULL)
+        PoolFree(frag_data_pool);
+    return NULL;
+}
+
 /**
  * Attempt to re-assemble a packet.
  *
@@ -256,9 +379,12 @@ Defrag4Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
         return NULL;
 
     /* Check that we have all the data. Relies on the fact that
-     * fragments are inserted if frag_offset order. */
+     * fragments are inserted if frag_offset order. While at it, work
+     * out how large the re-assembled packet can get. */
     Frag *frag;
     int len = 0;
+    int hdr_len = 0;
+    int end = 0;
     TAILQ_FOREACH(frag, &tracker->frags, next) {
         if (frag->skip)
             continue;
@@ -279,6 +405,12 @@ Defrag4Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
                 len += frag->data_len;
             }
         }
+
+        /* only the first fragment has a data_offset */
+        if (frag->data_offset > hdr_len)
+            hdr_len = frag->data_offset;
+        if (frag->offset + frag->data_len > end)
+            end = frag->offset + frag->data_len;
     }
 
     /* Allocate a Packet for the reassembled packet.  On failure we
@@ -292,6 +424,14 @@ Defrag4Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
     PKT_SET_SRC(rp, PKT_SRC_DEFRAG);
     rp->recursion_level = p->recursion_level;
 
+    /* Size the packet once, the fragments are copied straight into it. */
+    if (PacketReserveData(rp, hdr_len + end) == -1) {
+        SCLogWarning(SC_ERR_REASSEMBLY, "Failed re-assemble "
+                "fragmented packet, exceeds size of packet buffer.");
+        goto remove_tracker;
+    }
+    uint8_t *pkt = GET_PKT_DATA(rp);
+
     int fragmentable_offset = 0;
     int fragmentable_len = 0;
     int hlen = 0;
@@ -305,9 +445,7 @@ Defrag4Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
         if (frag->data_len - frag->ltrim <= 0)
             continue;
         if (frag->offset == 0) {
-
-            if (PacketCopyData(rp, frag->pkt, frag->len) == -1)
-                goto remove_tracker;
+            memcpy(pkt, frag->pkt, frag->len);
 
             hlen = frag->hlen;
             ip_hdr_offset = frag->ip_hdr_offset;
@@ -319,17 +457,9 @@ Defrag4Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
             fragmentable_len = frag->data_len;
         }
         else {
-            int pkt_end = fragmentable_offset + frag->offset + frag->data_len;
-            if (pkt_end > (int)MAX_PAYLOAD_SIZE) {
-                SCLogWarning(SC_ERR_REASSEMBLY, "Failed re-assemble "
-                        "fragmented packet, exceeds size of packet buffer.");
-                goto remove_tracker;
-            }
-            if (PacketCopyDataOffset(rp, fragmentable_offset + frag->offset + frag->ltrim,
+            memcpy(pkt + fragmentable_offset + frag->offset + frag->ltrim,
                 frag->pkt + frag->data_offset + frag->ltrim,
-                frag->data_len - frag->ltrim) == -1) {
-                goto remove_tracker;
-            }
+                frag->data_len - frag->ltrim);
             if (frag->offset + frag->data_len > fragmentable_len)
                 fragmentable_len = frag->offset + frag->data_len;
         }
@@ -369,9 +499,12 @@ Defrag6Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
         return NULL;
 
     /* Check that we have all the data. Relies on the fact that
-     * fragments are inserted if frag_offset order. */
+     * fragments are inserted if frag_offset order. While at it, work
+     * out how large the re-assembled packet can get. */
     Frag *frag;
     int len = 0;
+    int hdr_len = 0;
+    int end = 0;
     TAILQ_FOREACH(frag, &tracker->frags, next) {
         if (frag->skip)
             continue;
@@ -392,12 +525,17 @@ Defrag6Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
                 len += frag->data_len;
             }
         }
+
+        /* only the first fragment has a data_offset */
+        if (frag->data_offset > hdr_len)
+            hdr_len = frag->data_offset;
+        if (frag->offset + frag->data_len > end)
+            end = frag->offset + frag->data_len;
     }
 
     /* Allocate a Packet for the reassembled packet.  On failure we
      * SCFree all the resources held by this tracker. */
-    rp = PacketDefragPktSetup(p, (uint8_t *)p->ip6h,
-            IPV6_GET_PLEN(p) + sizeof(IPV6Hdr), 0);
+    rp = PacketDefragPktSetup(p, NULL, 0, 0);
     if (rp == NULL) {
         SCLogError(SC_ERR_MEM_ALLOC, "Failed to allocate packet for "
                 "fragmentation re-assembly, dumping fragments.");
@@ -405,6 +543,14 @@ Defrag6Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
     }
     PKT_SET_SRC(rp, PKT_SRC_DEFRAG);
 
+    /* Size the packet once, the fragments are copied straight into it. */
+    if (PacketReserveData(rp, hdr_len + end) == -1) {
+        SCLogWarning(SC_ERR_REASSEMBLY, "Failed re-assemble "
+                "fragmented packet, exceeds size of packet buffer.");
+        goto remove_tracker;
+    }
+    uint8_t *pkt = GET_PKT_DATA(rp);
+
     int fragmentable_offset = 0;
     int fragmentable_len = 0;
     int ip_hdr_offset = 0;
@@ -422,12 +568,10 @@ Defrag6Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
             /* This is the first packet, we use this packets link and
              * IPv6 headers. We also copy in its data, but remove the
              * fragmentation header. */
-            if (PacketCopyData(rp, frag->pkt, frag->frag_hdr_offset) == -1)
-                goto remove_tracker;
-            if (PacketCopyDataOffset(rp, frag->frag_hdr_offset,
+            memcpy(pkt, frag->pkt, frag->frag_hdr_offset);
+            memcpy(pkt + frag->frag_hdr_offset,
                 frag->pkt + frag->frag_hdr_offset + sizeof(IPV6FragHdr),
-                frag->data_len) == -1)
-                goto remove_tracker;
+                frag->data_len);
             ip_hdr_offset = frag->ip_hdr_offset;
 
             /* This is the start of the fragmentable portion of the
@@ -437,10 +581,9 @@ Defrag6Reassemble(ThreadVars *tv, DefragTracker *tracker, Packet *p)
             fragmentable_len = frag->data_len;
         }
         else {
-            if (PacketCopyDataOffset(rp, fragmentable_offset + frag->offset + frag->ltrim,
+            memcpy(pkt + fragmentable_offset + frag->offset + frag->ltrim,
                 frag->pkt + frag->data_offset + frag->ltrim,
-                frag->data_len - frag->ltrim) == -1)
-                goto remove_tracker;
+                frag->data_len - frag->ltrim);
             if (frag->offset + frag->data_len > fragmentable_len)
                 fragmentable_len = frag->offset + frag->data_len;
         }
@@ -655,10 +798,46 @@ insert:
         goto done;
     }
 
-    /* Allocate fragment and insert. */
-    SCMutexLock(&defrag_context->frag_pool_lock);
-    Frag *new = PoolGet(defrag_context->frag_pool);
-    SCMutexUnlock(&defrag_context->frag_pool_lock);
+    /* Only the first fragment needs its link and IP headers, of the
+     * others we just keep the data that is used in re-assembly. */
+    uint8_t *pkt_data;
+    uint16_t pkt_len;
+    if (frag_offset + ltrim == 0) {
+        pkt_data = GET_PKT_DATA(p);
+        pkt_len = data_offset + data_len;
+    }
+    else {
+        pkt_data = GET_PKT_DATA(p) + data_offset + ltrim;
+        pkt_len = data_len - ltrim;
+        data_offset = 0;
+    }
+
+    /* Allocate fragment and insert. The data goes into a buffer from
+     * the frag data pool if it fits. A thread table has its own pools,
+     * that are not locked. */
+    Pool *frag_pool = defrag_context->frag_pool;
+    Pool *frag_data_pool = defrag_context->frag_data_pool;
+    Frag *new = NULL;
+    if (tracker->table != NULL) {
+        frag_pool = tracker->table->frag_pool;
+        frag_data_pool = tracker->table->frag_data_pool;
+
+        /* a thread table's fragments count against its memcap */
+        uint64_t need = (pkt_len <= DEFRAG_FRAG_DATA_SIZE) ?
+            DEFRAG_THREAD_FRAG_MEMUSE : sizeof(Frag) + pkt_len;
+        if (tracker->table->memuse + need <= tracker->table->memcap)
+            new = PoolGet(frag_pool);
+    } else {
+        SCMutexLock(&defrag_context->frag_pool_lock);
+        new = PoolGet(frag_pool);
+    }
+    if (new != NULL && pkt_len <= DEFRAG_FRAG_DATA_SIZE) {
+        new->pkt = PoolGet(frag_data_pool);
+        if (new->pkt != NULL)
+            new->pkt_pooled = 1;
+    }
+    if (tracker->table == NULL)
+        SCMutexUnlock(&defrag_context->frag_pool_lock);
     if (new == NULL) {
         if (af == AF_INET) {
             ENGINE_SET_EVENT(p, IPV4_FRAG_IGNORED);
@@ -667,20 +846,28 @@ insert:
         }
         goto done;
     }
-    new->pkt = SCMalloc(GET_PKT_LEN(p));
     if (new->pkt == NULL) {
-        SCMutexLock(&defrag_context->frag_pool_lock);
-        PoolReturn(defrag_context->frag_pool, new);
-        SCMutexUnlock(&defrag_context->frag_pool_lock);
-        if (af == AF_INET) {
-            ENGINE_SET_EVENT(p, IPV4_FRAG_IGNORED);
-        } else {
-            ENGINE_SET_EVENT(p, IPV6_FRAG_IGNORED);
+        new->pkt = SCMalloc(pkt_len);
+        if (new->pkt == NULL) {
+            if (tracker->table != NULL) {
+                PoolReturn(frag_pool, new);
+            } else {
+                SCMutexLock(&defrag_context->frag_pool_lock);
+                PoolReturn(frag_pool, new);
+                SCMutexUnlock(&defrag_context->frag_pool_lock);
+            }
+            if (af == AF_INET) {
+                ENGINE_SET_EVENT(p, IPV4_FRAG_IGNORED);
+            } else {
+                ENGINE_SET_EVENT(p, IPV6_FRAG_IGNORED);
+            }
+            goto done;
         }
-        goto done;
     }
-    memcpy(new->pkt, GET_PKT_DATA(p) + ltrim, GET_PKT_LEN(p) - ltrim);
-    new->len = GET_PKT_LEN(p) - ltrim;
+    memcpy(new->pkt, pkt_data, pkt_len);
+    new->len = pkt_len;
+    if (tracker->table != NULL)
+        tracker->table->memuse += DefragFragMemuse(new);
     new->hlen = hlen;
     new->offset = frag_offset + ltrim;
     new->data_offset = data_offset;
@@ -806,11 +993,32 @@ DefragGetOsPolicy(Packet *p)
 
 /** \internal
  *
- *  \retval NULL or a *LOCKED* tracker */
+ *  \retval NULL or a *LOCKED* tracker, trackers of a thread table are
+ *          not locked */
 static DefragTracker *
 DefragGetTracker(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p)
 {
-    return DefragGetTrackerFromHash(p);
+    DefragTrackerCache *dc = NULL;
+
+    if (dtv != NULL) {
+        if (defrag_config.thread_tables) {
+            if (unlikely(dtv->defrag_table == NULL))
+                dtv->defrag_table = DefragThreadTableSetup();
+            if (dtv->defrag_table != NULL) {
+                int shared = 0;
+                DefragTracker *dt = DefragThreadTableGetTracker(
+                        dtv->defrag_table, p, &shared);
+                if (!shared)
+                    return dt;
+            }
+        }
+
+        if (unlikely(dtv->defrag_cache == NULL))
+            dtv->defrag_cache = DefragTrackerCacheNew();
+        dc = dtv->defrag_cache;
+    }
+
+    return DefragGetTrackerFromHash(dc, p);
 }
 
 /**
@@ -860,13 +1068,28 @@ Defrag(ThreadVars *tv, DecodeThreadVars *dtv, Packet *p)
         }
     }
 
+    /* The thread times out the trackers of its own table, once per
+     * second of packet time. A thread that stops seeing fragments keeps
+     * its trackers until the next one, within the table's memcap. */
+    if (dtv != NULL && dtv->defrag_table != NULL &&
+            dtv->defrag_table->last_timeout != (uint32_t)p->ts.tv_sec) {
+        dtv->defrag_table->last_timeout = (uint32_t)p->ts.tv_sec;
+        (void) DefragThreadTableTimeout(tv, dtv, dtv->defrag_table, &p->ts);
+    }
+
     /* return a locked tracker or NULL */
     tracker = DefragGetTracker(tv, dtv, p);
     if (tracker == NULL)
         return NULL;
 
     Packet *rp = DefragInsertFrag(tv, dtv, tracker, p);
-    DefragTrackerRelease(tracker);
+    if (tracker->table != NULL) {
+        /* not locked, and a tracker that is done is recycled right away */
+        if (tracker->remove)
+            DefragThreadTableRemove(tracker->table, tracker);
+    } else {
+        DefragTrackerRelease(tracker);
+    }
 
     return rp;
 }
@@ -2070,6 +2293,276 @@ end:
     return ret;
 }
 
+/**
+ * Test that a decoder thread takes its trackers from the spare queue
+ * through its tracker cache, and that recycled trackers re-assemble.
+ */
+static int
+DefragTrackerCacheTest(void)
+{
+    DecodeThreadVars dtv;
+    Packet *p1 = NULL, *p2 = NULL, *p3 = NULL, *p4 = NULL;
+    Packet *reassembled = NULL;
+    struct timeval ts;
+    int ret = 0;
+
+    memset(&dtv, 0, sizeof(dtv));
+
+    DefragInit();
+
+    p1 = BuildTestPacket(1, 0, 1, 'A', 8);
+    p2 = BuildTestPacket(1, 1, 0, 'B', 8);
+    p3 = BuildTestPacket(2, 0, 1, 'C', 8);
+    p4 = BuildTestPacket(2, 1, 0, 'D', 8);
+    if (p1 == NULL || p2 == NULL || p3 == NULL || p4 == NULL)
+        goto end;
+
+    if (Defrag(NULL, &dtv, p1) != NULL)
+        goto end;
+    reassembled = Defrag(NULL, &dtv, p2);
+    if (reassembled == NULL)
+        goto end;
+    if (dtv.defrag_cache == NULL)
+        goto end;
+    SCFree(reassembled);
+    reassembled = NULL;
+
+    /* The re-assembled tracker is moved to the spare queue... */
+    ts = p2->ts;
+    if (DefragTimeoutHash(&ts) != 1)
+        goto end;
+    if (DefragTrackerSpareQueueGetSize() != 1)
+        goto end;
+
+    /* ...from where the next new tracker of the thread comes. */
+    if (Defrag(NULL, &dtv, p3) != NULL)
+        goto end;
+    if (DefragTrackerSpareQueueGetSize() != 0)
+        goto end;
+    if (dtv.defrag_cache->cnt != 0)
+        goto end;
+
+    reassembled = Defrag(NULL, &dtv, p4);
+    if (reassembled == NULL)
+        goto end;
+    if (IPV4_GET_IPLEN(reassembled) != 36)
+        goto end;
+    if (GET_PKT_DATA(reassembled)[20] != 'C' ||
+        GET_PKT_DATA(reassembled)[28] != 'D')
+        goto end;
+
+    ret = 1;
+end:
+    if (p1 != NULL)
+        SCFree(p1);
+    if (p2 != NULL)
+        SCFree(p2);
+    if (p3 != NULL)
+        SCFree(p3);
+    if (p4 != NULL)
+        SCFree(p4);
+    if (reassembled != NULL)
+        SCFree(reassembled);
+    DefragDestroy();
+    return ret;
+}
+
+/**
+ * Test that with defrag.per-thread fragments are re-assembled in the
+ * thread's own table, and that fragments of a datagram showing up on
+ * another thread make new datagrams go to the shared hash.
+ */
+static int
+DefragThreadTableTest(void)
+{
+    DecodeThreadVars dtv1, dtv2;
+    Packet *p1 = NULL, *p2 = NULL, *p3 = NULL, *p4 = NULL;
+    Packet *p5 = NULL, *p6 = NULL;
+    Packet *reassembled = NULL;
+    DefragTracker *tracker;
+    int ret = 0;
+
+    memset(&dtv1, 0, sizeof(dtv1));
+    memset(&dtv2, 0, sizeof(dtv2));
+
+    if (ConfSet("defrag.per-thread.enabled", "yes", 1) != 1) {
+        printf("ConfSet failed: ");
+        goto end;
+    }
+
+    DefragInit();
+
+    p1 = BuildTestPacket(1, 0, 1, 'A', 8);
+    p2 = BuildTestPacket(1, 1, 0, 'B', 8);
+    p3 = BuildTestPacket(2, 0, 1, 'C', 8);
+    p4 = BuildTestPacket(2, 1, 0, 'D', 8);
+    p5 = BuildTestPacket(3, 0, 1, 'E', 8);
+    p6 = BuildTestPacket(3, 1, 0, 'F', 8);
+    if (p1 == NULL || p2 == NULL || p3 == NULL || p4 == NULL ||
+        p5 == NULL || p6 == NULL)
+        goto end;
+
+    /* Both fragments on one thread: its table re-assembles them and
+     * recycles the tracker, the shared hash isn't used. */
+    if (Defrag(NULL, &dtv1, p1) != NULL)
+        goto end;
+    if (dtv1.defrag_table == NULL || dtv1.defrag_table->active != 1)
+        goto end;
+    if (DefragLookupTrackerFromHash(p1) != NULL)
+        goto end;
+    reassembled = Defrag(NULL, &dtv1, p2);
+    if (reassembled == NULL)
+        goto end;
+    if (IPV4_GET_IPLEN(reassembled) != 36)
+        goto end;
+    if (GET_PKT_DATA(reassembled)[20] != 'A' ||
+        GET_PKT_DATA(reassembled)[28] != 'B')
+        goto end;
+    SCFree(reassembled);
+    reassembled = NULL;
+    if (dtv1.defrag_table->active != 0 || dtv1.defrag_table->spare == NULL)
+        goto end;
+
+    /* The last fragment shows up on another thread, which falls back to
+     * the shared hash. */
+    if (Defrag(NULL, &dtv1, p3) != NULL)
+        goto end;
+    if (Defrag(NULL, &dtv2, p4) != NULL)
+        goto end;
+    if (SC_ATOMIC_GET(defrag_thread_fallback) != 1)
+        goto end;
+    tracker = DefragLookupTrackerFromHash(p4);
+    if (tracker == NULL)
+        goto end;
+    DefragTrackerRelease(tracker);
+
+    /* New datagrams are re-assembled in the shared hash, whichever
+     * thread their fragments go to. */
+    if (Defrag(NULL, &dtv2, p5) != NULL)
+        goto end;
+    reassembled = Defrag(NULL, &dtv1, p6);
+    if (reassembled == NULL)
+        goto end;
+    if (GET_PKT_DATA(reassembled)[20] != 'E' ||
+        GET_PKT_DATA(reassembled)[28] != 'F')
+        goto end;
+
+    ret = 1;
+end:
+    if (p1 != NULL)
+        SCFree(p1);
+    if (p2 != NULL)
+        SCFree(p2);
+    if (p3 != NULL)
+        SCFree(p3);
+    if (p4 != NULL)
+        SCFree(p4);
+    if (p5 != NULL)
+        SCFree(p5);
+    if (p6 != NULL)
+        SCFree(p6);
+    if (reassembled != NULL)
+        SCFree(reassembled);
+    DefragDestroy();
+    ConfSet("defrag.per-thread.enabled", "no", 1);
+    return ret;
+}
+
+/**
+ * Test that the fragments of a thread table count against
+ * defrag.per-thread.memcap.
+ */
+static int
+DefragThreadTableMemcapTest(void)
+{
+    DecodeThreadVars dtv;
+    Packet *p1 = NULL, *p2 = NULL, *p3 = NULL, *p4 = NULL, *p5 = NULL;
+    Packet *reassembled = NULL;
+    char memcap[32];
+    int ret = 0;
+
+    memset(&dtv, 0, sizeof(dtv));
+
+    /* the rows, two trackers and two fragments */
+    uint64_t rows = 1024 * sizeof(DefragTracker *);
+    uint64_t tracker = sizeof(DefragTracker);
+    uint64_t frag = DEFRAG_THREAD_FRAG_MEMUSE;
+    snprintf(memcap, sizeof(memcap), "%"PRIu64,
+        rows + 2 * tracker + 2 * frag + 64);
+    if (ConfSet("defrag.per-thread.enabled", "yes", 1) != 1 ||
+        ConfSet("defrag.per-thread.hash-size", "1024", 1) != 1 ||
+        ConfSet("defrag.per-thread.memcap", memcap, 1) != 1) {
+        printf("ConfSet failed: ");
+        goto end;
+    }
+
+    DefragInit();
+
+    p1 = BuildTestPacket(1, 0, 1, 'A', 8);
+    p2 = BuildTestPacket(1, 1, 0, 'B', 8);
+    p3 = BuildTestPacket(2, 0, 1, 'C', 8);
+    p4 = BuildTestPacket(3, 0, 1, 'D', 8);
+    p5 = BuildTestPacket(2, 1, 1, 'E', 8);
+    if (p1 == NULL || p2 == NULL || p3 == NULL || p4 == NULL || p5 == NULL)
+        goto end;
+
+    if (Defrag(NULL, &dtv, p1) != NULL)
+        goto end;
+    if (dtv.defrag_table == NULL)
+        goto end;
+    if (dtv.defrag_table->memuse != rows + tracker + frag) {
+        printf("memuse %"PRIu64": ", dtv.defrag_table->memuse);
+        goto end;
+    }
+
+    /* re-assembly gives the memory of the fragments back */
+    reassembled = Defrag(NULL, &dtv, p2);
+    if (reassembled == NULL)
+        goto end;
+    if (dtv.defrag_table->memuse != rows + tracker) {
+        printf("memuse %"PRIu64" after re-assembly: ",
+            dtv.defrag_table->memuse);
+        goto end;
+    }
+
+    /* two datagrams fill the memcap, a third fragment doesn't fit */
+    if (Defrag(NULL, &dtv, p3) != NULL || Defrag(NULL, &dtv, p4) != NULL)
+        goto end;
+    if (ENGINE_ISSET_EVENT(p3, IPV4_FRAG_IGNORED) ||
+        ENGINE_ISSET_EVENT(p4, IPV4_FRAG_IGNORED))
+        goto end;
+    if (Defrag(NULL, &dtv, p5) != NULL)
+        goto end;
+    if (!ENGINE_ISSET_EVENT(p5, IPV4_FRAG_IGNORED)) {
+        printf("fragment over the memcap not ignored: ");
+        goto end;
+    }
+    if (dtv.defrag_table->memuse != rows + 2 * tracker + 2 * frag) {
+        printf("memuse %"PRIu64" at the memcap: ", dtv.defrag_table->memuse);
+        goto end;
+    }
+
+    ret = 1;
+end:
+    if (p1 != NULL)
+        SCFree(p1);
+    if (p2 != NULL)
+        SCFree(p2);
+    if (p3 != NULL)
+        SCFree(p3);
+    if (p4 != NULL)
+        SCFree(p4);
+    if (p5 != NULL)
+        SCFree(p5);
+    if (reassembled != NULL)
+        SCFree(reassembled);
+    DefragDestroy();
+    ConfSet("defrag.per-thread.enabled", "no", 1);
+    ConfSet("defrag.per-thread.hash-size", "4096", 1);
+    ConfSet("defrag.per-thread.memcap", "4mb", 1);
+    return ret;
+}
+
 /**
  * QA found that if you send a packet where more frags is 0, offset is
  * > 0 and there is no data in the packet that the re-assembler will
@@ -2201,6 +2694,12 @@ DefragRegisterTests(void)
 
     UtRegisterTest("DefragTimeoutTest",
         DefragTimeoutTest, 1);
+    UtRegisterTest("DefragTrackerCacheTest",
+        DefragTrackerCacheTest, 1);
+    UtRegisterTest("DefragThreadTableTest",
+        DefragThreadTableTest, 1);
+    UtRegisterTest("DefragThreadTableMemcapTest",
+        DefragThreadTableMemcapTest, 1);
 #endif /* UNITTESTS */
 }
 
@@ -32,8 +32,13 @@
  */
 typedef struct DefragContext_ {
     Pool *frag_pool; /**< Pool of fragments. */
+    Pool *frag_data_pool; /**< Pool of fragment data buffers, protected
+                           *   by frag_pool_lock as well. */
     SCMutex frag_pool_lock;
 
+    uint32_t max_frags; /**< Size of the frag pools, also used for the
+                         *   pools of the thread tables. */
+
     time_t timeout; /**< Default timeout. */
 } DefragContext;
 
@@ -62,7 +67,11 @@ typedef struct Frag_ {
     uint16_t ltrim;             /**< Number of leading bytes to trim when
                                  * re-assembling the packet. */
 
-    uint8_t *pkt;               /**< The actual packet. */
+    uint8_t pkt_pooled;         /**< pkt is from the frag data pool. */
+
+    uint8_t *pkt;               /**< The fragment data. Holds the headers
+                                 * only for the first fragment, for the
+                                 * others data_offset is 0. */
 
 #ifdef DEBUG
     uint64_t pcap_cnt;          /**< pcap_cnt of original packet */
@@ -105,6 +114,9 @@ typedef struct DefragTracker_ {
 
     uint8_t remove; /**< remove */
 
+    uint32_t hash; /**< Hash of the addresses and id, see
+                    *   DefragHashGetHash(). */
+
     Address src_addr; /**< Source address for this tracker. */
     Address dst_addr; /**< Destination address for this tracker. */
 
@@ -126,8 +138,65 @@ typedef struct DefragTracker_ {
     /** list pointers, protected by tracker-queue mutex/spin */
     struct DefragTracker_ *lnext;
     struct DefragTracker_ *lprev;
+
+    /** thread table this tracker belongs to, NULL for the shared hash */
+    struct DefragThreadTable_ *table;
 } DefragTracker;
 
+/** Number of spare trackers a decoder thread keeps for itself. */
+#define DEFRAG_TRACKER_CACHE_SIZE   16
+
+/** Number of trackers taken from the spare queue, or pruned from the
+ *  hash, in one go to fill a thread's cache. */
+#define DEFRAG_TRACKER_CACHE_BATCH  8
+
+/**
+ * Per thread cache of spare trackers. Lets a decoder thread take trackers
+ * from the spare queue, or prune them from the hash, in batches instead of
+ * taking the locks for each new tracker.
+ */
+typedef struct DefragTrackerCache_ {
+    DefragTracker *trackers[DEFRAG_TRACKER_CACHE_SIZE];
+    uint32_t cnt;
+
+    uint32_t prune_idx; /**< Hash row where this thread's next prune
+                         *   walk starts. */
+
+    struct DefragTrackerCache_ *next; /**< List of all caches, so they can
+                                       *   be freed at shutdown. */
+} DefragTrackerCache;
+
+/**
+ * Tracker table of a single decoder thread, used instead of the shared
+ * hash if defrag.per-thread is enabled. Only the owning thread touches
+ * it, so there is no locking. The trackers, fragments and fragment data
+ * come from the table's own spare list and pools, and the thread times
+ * out its own trackers.
+ */
+typedef struct DefragThreadTable_ {
+    DefragTracker **rows;       /**< Hash rows, trackers are linked through
+                                 *   hnext/hprev, most recent first. */
+    uint32_t hash_size;
+
+    uint16_t id;                /**< Id of the table, > 0. */
+
+    DefragTracker *spare;       /**< Spare trackers, linked through lnext. */
+
+    uint32_t active;            /**< Trackers in the rows. */
+    uint64_t memuse;            /**< Memory of the rows, trackers and
+                                 *   fragments. */
+    uint64_t memcap;
+
+    uint32_t prune_idx;         /**< Row where the next memcap prune starts. */
+    uint32_t last_timeout;      /**< Packet time of the last timeout pass. */
+
+    Pool *frag_pool;            /**< Pool of fragments. */
+    Pool *frag_data_pool;       /**< Pool of fragment data buffers. */
+
+    struct DefragThreadTable_ *next; /**< List of all tables, so they can
+                                      *   be freed at shutdown. */
+} DefragThreadTable;
+
 void DefragInit(void);
 void DefragDestroy(void);
 void DefragReload(void); /**< use only in unittests */
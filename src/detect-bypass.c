@@ -0,0 +1,217 @@
+/* Copyright (C) 2007-2013 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Implements the bypass keyword. When the signature matches, the flow
+ * of the packet is bypassed: its next packets skip the stream engine,
+ * app layer and detection, and are dropped by the capture method if
+ * it supports bypass.
+ */
+
+#include "suricata-common.h"
+#include "decode.h"
+#include "detect.h"
+#include "detect-parse.h"
+#include "detect-engine.h"
+#include "detect-engine-mpm.h"
+
+#include "flow.h"
+#include "flow-util.h"
+#include "detect-bypass.h"
+
+#include "util-debug.h"
+#include "util-unittest.h"
+#include "util-unittest-helper.h"
+
+static int DetectBypassMatch (ThreadVars *, DetectEngineThreadCtx *, Packet *, Signature *, SigMatch *);
+static int DetectBypassSetup (DetectEngineCtx *, Signature *, char *);
+static void DetectBypassRegisterTests(void);
+
+void DetectBypassRegister (void) {
+    sigmatch_table[DETECT_BYPASS].name = "bypass";
+    sigmatch_table[DETECT_BYPASS].Match = DetectBypassMatch;
+    sigmatch_table[DETECT_BYPASS].Setup = DetectBypassSetup;
+    sigmatch_table[DETECT_BYPASS].Free  = NULL;
+    sigmatch_table[DETECT_BYPASS].RegisterTests = DetectBypassRegisterTests;
+
+    sigmatch_table[DETECT_BYPASS].flags |= SIGMATCH_NOOPT;
+}
+
+/**
+ *  \brief post match function: bypass the flow of the packet
+ *
+ *  \retval 1 flow bypassed
+ *  \retval 0 packet has no flow
+ */
+static int DetectBypassMatch (ThreadVars *tv, DetectEngineThreadCtx *det_ctx, Packet *p, Signature *s, SigMatch *m)
+{
+    if (p->flow == NULL)
+        return 0;
+
+    FLOWLOCK_WRLOCK(p->flow);
+    FlowSetBypassFlag(p->flow);
+    FLOWLOCK_UNLOCK(p->flow);
+
+    SCLogDebug("sig %"PRIu32" bypassed flow %p", s->id, p->flow);
+    return 1;
+}
+
+static int DetectBypassSetup (DetectEngineCtx *de_ctx, Signature *s, char *nullstr)
+{
+    SigMatch *sm = NULL;
+
+    if (nullstr != NULL) {
+        SCLogError(SC_ERR_INVALID_VALUE, "bypass has no value");
+        return -1;
+    }
+
+    sm = SigMatchAlloc();
+    if (sm == NULL)
+        return -1;
+
+    sm->type = DETECT_BYPASS;
+    sm->ctx = NULL;
+
+    /* only act when the entire sig has matched */
+    SigMatchAppendSMToList(s, sm, DETECT_SM_LIST_POSTMATCH);
+    return 0;
+}
+
+#ifdef UNITTESTS
+
+static int DetectBypassTestParse01(void)
+{
+    int result = 0;
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    if (de_ctx == NULL)
+        return 0;
+
+    de_ctx->flags |= DE_QUIET;
+
+    Signature *s = SigInit(de_ctx, "alert tcp any any -> any any (content:\"abc\"; bypass; sid:1;)");
+    if (s == NULL)
+        goto end;
+
+    if (s->sm_lists[DETECT_SM_LIST_POSTMATCH] == NULL ||
+        s->sm_lists[DETECT_SM_LIST_POSTMATCH]->type != DETECT_BYPASS) {
+        printf("bypass not in the postmatch list: ");
+        goto end;
+    }
+    SigFree(s);
+
+    /* no value allowed */
+    s = SigInit(de_ctx, "alert tcp any any -> any any (content:\"abc\"; bypass:yes; sid:2;)");
+    if (s != NULL) {
+        printf("sig with bypass value should have failed: ");
+        SigFree(s);
+        goto end;
+    }
+
+    result = 1;
+end:
+    DetectEngineCtxFree(de_ctx);
+    return result;
+}
+
+/** \test a matching sig bypasses the flow, a non matching one doesn't */
+static int DetectBypassTestMatch01(void)
+{
+    uint8_t *buf = (uint8_t *)"GET /one/ HTTP/1.1\r\n\r\n";
+    uint16_t buflen = strlen((char *)buf);
+    ThreadVars th_v;
+    DetectEngineThreadCtx *det_ctx = NULL;
+    DetectEngineCtx *de_ctx = NULL;
+    Flow f;
+    int result = 0;
+
+    Packet *p = UTHBuildPacket(buf, buflen, IPPROTO_TCP);
+    if (p == NULL)
+        return 0;
+
+    memset(&th_v, 0, sizeof(th_v));
+    memset(&f, 0, sizeof(Flow));
+    FLOW_INITIALIZE(&f);
+    p->flow = &f;
+    p->flags |= PKT_HAS_FLOW;
+    p->flowflags |= FLOW_PKT_TOSERVER;
+
+    de_ctx = DetectEngineCtxInit();
+    if (de_ctx == NULL)
+        goto end;
+
+    de_ctx->flags |= DE_QUIET;
+
+    de_ctx->sig_list = SigInit(de_ctx, "alert tcp any any -> any any (content:\"POST\"; bypass; sid:1;)");
+    if (de_ctx->sig_list == NULL)
+        goto end;
+
+    SigGroupBuild(de_ctx);
+    DetectEngineThreadCtxInit(&th_v, (void *)de_ctx, (void *)&det_ctx);
+
+    SigMatchSignatures(&th_v, de_ctx, det_ctx, p);
+    if (f.flags & FLOW_BYPASSED) {
+        printf("flow bypassed by non matching sig: ");
+        goto cleanup;
+    }
+
+    DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
+    det_ctx = NULL;
+    SigGroupCleanup(de_ctx);
+    SigCleanSignatures(de_ctx);
+
+    de_ctx->sig_list = SigInit(de_ctx, "alert tcp any any -> any any (content:\"GET\"; bypass; sid:2;)");
+    if (de_ctx->sig_list == NULL)
+        goto end;
+
+    SigGroupBuild(de_ctx);
+    DetectEngineThreadCtxInit(&th_v, (void *)de_ctx, (void *)&det_ctx);
+
+    SigMatchSignatures(&th_v, de_ctx, det_ctx, p);
+    if (!PacketAlertCheck(p, 2)) {
+        printf("sig 2 didn't alert: ");
+        goto cleanup;
+    }
+    if (!(f.flags & FLOW_BYPASSED) || !(f.flags & FLOW_NOPACKET_INSPECTION)) {
+        printf("flow not bypassed: ");
+        goto cleanup;
+    }
+
+    result = 1;
+cleanup:
+    if (det_ctx != NULL)
+        DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
+    SigGroupCleanup(de_ctx);
+    SigCleanSignatures(de_ctx);
+end:
+    if (de_ctx != NULL)
+        DetectEngineCtxFree(de_ctx);
+    FLOW_DESTROY(&f);
+    UTHFreePacket(p);
+    return result;
+}
+
+#endif /* UNITTESTS */
+
+static void DetectBypassRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("DetectBypassTestParse01", DetectBypassTestParse01, 1);
+    UtRegisterTest("DetectBypassTestMatch01", DetectBypassTestMatch01, 1);
+#endif /* UNITTESTS */
+}
@@ -189,6 +189,7 @@ int PacketAlertAppend(DetectEngineThreadCtx *det_ctx, Signature *s, Packet *p, u
 
     /* Update the count */
     p->alerts.cnt++;
+    PACKET_SET_DIRTY(p, PKT_DIRTY_ALERTS);
 
     return 0;
 }
@@ -178,7 +178,7 @@ void SigGroupHeadFree(SigGroupHead *sgh)
 #if defined(__SSE3__)
     if (sgh->mask_array != NULL) {
         /* mask is aligned */
-        SCFreeAligned(sgh->mask_array);
+        SCRegionFree(sgh->mask_array);
         sgh->mask_array = NULL;
     }
 #endif
@@ -191,7 +191,7 @@ void SigGroupHeadFree(SigGroupHead *sgh)
     if (sgh->match_array != NULL) {
         detect_siggroup_matcharray_free_cnt++;
         detect_siggroup_matcharray_memory -= (sgh->sig_cnt * sizeof(Signature *));
-        SCFree(sgh->match_array);
+        SCRegionFree(sgh->match_array);
         sgh->match_array = NULL;
     }
 
@@ -1548,7 +1548,8 @@ int SigGroupHeadBuildMatchArray(DetectEngineCtx *de_ctx, SigGroupHead *sgh,
 
     BUG_ON(sgh->match_array != NULL);
 
-    sgh->match_array = SCMalloc(sgh->sig_cnt * sizeof(Signature *));
+    sgh->match_array = SCRegionMalloc(MEM_REGION_DETECT,
+                                      sgh->sig_cnt * sizeof(Signature *));
     if (sgh->match_array == NULL)
         return -1;
 
@@ -1706,7 +1707,9 @@ int SigGroupHeadBuildHeadArray(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
     }
 #endif /* __WORDSIZE */
 
-    sgh->mask_array = SCMallocAligned((cnt * sizeof(SignatureMask)), 16);
+    /* region memory is 16 byte aligned */
+    sgh->mask_array = SCRegionMalloc(MEM_REGION_DETECT,
+                                     (cnt * sizeof(SignatureMask)));
     if (sgh->mask_array == NULL)
         return -1;
 
@@ -774,7 +774,7 @@ void DetectEngineCtxFree(DetectEngineCtx *de_ctx) {
 
     VariableNameFreeHash(de_ctx);
     if (de_ctx->sig_array)
-        SCFree(de_ctx->sig_array);
+        SCRegionFree(de_ctx->sig_array);
 
     SCClassConfDeInitContext(de_ctx);
     SCRConfDeInitContext(de_ctx);
@@ -105,6 +105,7 @@ static uint8_t GetHostRepSrc(Packet *p, uint8_t cat, uint32_t version) {
             return 0;
 
         HostReference(&p->host_src, h);
+        PACKET_SET_DIRTY(p, PKT_DIRTY_HOST);
     }
 
     if (h->iprep == NULL) {
@@ -144,6 +145,7 @@ static uint8_t GetHostRepDst(Packet *p, uint8_t cat, uint32_t version) {
         }
 
         HostReference(&p->host_dst, h);
+        PACKET_SET_DIRTY(p, PKT_DIRTY_HOST);
     }
 
     if (h->iprep == NULL) {
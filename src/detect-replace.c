@@ -172,20 +172,28 @@ DetectReplaceList * DetectReplaceAddToList(DetectReplaceList *replist, uint8_t *
 void DetectReplaceExecute(Packet *p, DetectReplaceList *replist)
 {
     DetectReplaceList *tlist = NULL;
+    int recalc = 0;
 
     if (p == NULL)
         return;
 
     SCLogDebug("replace: Executing match");
     while(replist) {
+        /* update the checksum for the changed bytes, that's cheaper than
+         * summing the whole packet for every replace */
+        if (recalc == 0 && ChecksumUpdateReplace(p, replist->found,
+                    replist->cd->replace, replist->cd->replace_len) < 0)
+            recalc = 1;
         memcpy(replist->found, replist->cd->replace, replist->cd->replace_len);
         SCLogDebug("replace: injecting '%s'", replist->cd->replace);
         p->flags |= PKT_STREAM_MODIFIED;
-        ReCalculateChecksum(p);
         tlist = replist;
         replist = replist->next;
         SCFree(tlist);
     }
+
+    if (recalc)
+        ReCalculateChecksum(p);
 }
 
 
@@ -106,6 +106,7 @@
 #include "detect-flowint.h"
 #include "detect-pktvar.h"
 #include "detect-noalert.h"
+#include "detect-bypass.h"
 #include "detect-flowbits.h"
 #include "detect-csum.h"
 #include "detect-stream_size.h"
@@ -2560,7 +2561,8 @@ int SigAddressPrepareStage1(DetectEngineCtx *de_ctx) {
 
     de_ctx->sig_array_len = DetectEngineGetMaxSigId(de_ctx);
     de_ctx->sig_array_size = (de_ctx->sig_array_len * sizeof(Signature *));
-    de_ctx->sig_array = (Signature **)SCMalloc(de_ctx->sig_array_size);
+    de_ctx->sig_array = (Signature **)SCRegionMalloc(MEM_REGION_DETECT,
+                                                     de_ctx->sig_array_size);
     if (de_ctx->sig_array == NULL)
         goto error;
     memset(de_ctx->sig_array,0,de_ctx->sig_array_size);
@@ -4799,6 +4801,7 @@ void SigTableSetup(void) {
     DetectFlowintRegister();
     DetectPktvarRegister();
     DetectNoalertRegister();
+    DetectBypassRegister();
     DetectFlowbitsRegister();
     DetectEngineEventRegister();
     DetectIpOptsRegister();
@@ -1059,6 +1059,7 @@ enum {
     DETECT_FLOWINT,
     DETECT_PKTVAR,
     DETECT_NOALERT,
+    DETECT_BYPASS,
     DETECT_FLOWBITS,
     DETECT_FLOWALERTSID,
     DETECT_IPV4_CSUM,
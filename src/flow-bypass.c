@@ -0,0 +1,512 @@
+/* Copyright (C) 2007-2013 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Userspace bypass table for capture methods.
+ *
+ * When the engine bypasses a flow (FLOW_BYPASSED) it calls the packet's
+ * BypassPacketsFlow callback. Capture methods that can't offload the
+ * bypass to the kernel or the NIC add the flow to a FlowBypassTable and
+ * check each captured frame against it before a Packet is even set up,
+ * so the rest of the flow costs a header parse and a table lookup.
+ *
+ * Only untunneled Ethernet (optionally with one or two VLAN tags)
+ * IPv4/IPv6 TCP/UDP frames are looked up, other traffic always goes
+ * through the engine. The vlan ids are part of the key, so the same flow
+ * on another vlan isn't bypassed.
+ */
+
+#include "suricata-common.h"
+#include "decode.h"
+#include "threads.h"
+
+#include "flow-bypass.h"
+
+#include "util-hash-lookup3.h"
+#include "util-debug.h"
+#include "util-unittest.h"
+
+/**
+ *  \brief setup a table entry, ordering the endpoints so that both
+ *         directions of a flow produce the same entry
+ */
+static void FlowBypassEntrySetup(FlowBypassEntry *e, uint8_t proto,
+        const uint32_t *src, const uint32_t *dst, uint16_t sp, uint16_t dp)
+{
+    int cmp = memcmp(src, dst, sizeof(e->addr[0]));
+
+    if (cmp < 0 || (cmp == 0 && sp <= dp)) {
+        memcpy(e->addr[0], src, sizeof(e->addr[0]));
+        memcpy(e->addr[1], dst, sizeof(e->addr[1]));
+        e->port[0] = sp;
+        e->port[1] = dp;
+    } else {
+        memcpy(e->addr[0], dst, sizeof(e->addr[0]));
+        memcpy(e->addr[1], src, sizeof(e->addr[1]));
+        e->port[0] = dp;
+        e->port[1] = sp;
+    }
+    e->proto = proto;
+}
+
+static inline uint32_t FlowBypassEntryHash(const FlowBypassTable *t,
+        const FlowBypassEntry *e)
+{
+    uint32_t key[10];
+
+    memcpy(key, e->addr, sizeof(e->addr));
+    key[8] = ((uint32_t)e->port[0] << 16) | e->port[1];
+    key[9] = ((uint32_t)e->vlan_id[0] << 16) | e->vlan_id[1];
+
+    return hashword(key, 10, e->proto) & (t->size - 1);
+}
+
+static inline int FlowBypassEntryCompare(const FlowBypassEntry *a,
+        const FlowBypassEntry *b)
+{
+    return (a->proto == b->proto &&
+            a->port[0] == b->port[0] && a->port[1] == b->port[1] &&
+            a->vlan_id[0] == b->vlan_id[0] && a->vlan_id[1] == b->vlan_id[1] &&
+            memcmp(a->addr, b->addr, sizeof(a->addr)) == 0);
+}
+
+/**
+ *  \brief setup the table key of a raw ethernet frame
+ *
+ *  Used for both adding and looking up flows, so the keys are built the
+ *  same way.
+ *
+ *  \retval 1 key is set up
+ *  \retval 0 frame is not handled by the table
+ */
+static int FlowBypassEntryFromEthernet(FlowBypassEntry *key,
+        const uint8_t *pkt, uint32_t len)
+{
+    uint32_t src[4] = { 0, 0, 0, 0 };
+    uint32_t dst[4] = { 0, 0, 0, 0 };
+    uint32_t offset = ETHERNET_HEADER_LEN;
+    uint16_t vlan_id[2] = { 0, 0 };
+    uint16_t ether_type;
+    uint8_t proto;
+    int vlans = 0;
+
+    if (len < ETHERNET_HEADER_LEN)
+        return 0;
+    ether_type = (pkt[12] << 8) | pkt[13];
+
+    while (ether_type == ETHERNET_TYPE_VLAN) {
+        if (vlans == 2 || len < offset + VLAN_HEADER_LEN)
+            return 0;
+        vlan_id[vlans++] = ((pkt[offset] << 8) | pkt[offset + 1]) & 0x0fff;
+        ether_type = (pkt[offset + 2] << 8) | pkt[offset + 3];
+        offset += VLAN_HEADER_LEN;
+    }
+
+    if (ether_type == ETHERNET_TYPE_IP) {
+        if (len < offset + IPV4_HEADER_LEN)
+            return 0;
+        const uint8_t *ip = pkt + offset;
+        uint32_t hlen = (ip[0] & 0x0f) << 2;
+        /* fragments are left to the engine, only it can reassemble them */
+        if ((ip[0] >> 4) != 4 || hlen < IPV4_HEADER_LEN ||
+            (((ip[6] << 8) | ip[7]) & 0x3fff) != 0)
+            return 0;
+        proto = ip[9];
+        memcpy(&src[0], ip + 12, 4);
+        memcpy(&dst[0], ip + 16, 4);
+        offset += hlen;
+    } else if (ether_type == ETHERNET_TYPE_IPV6) {
+        if (len < offset + IPV6_HEADER_LEN)
+            return 0;
+        const uint8_t *ip = pkt + offset;
+        if ((ip[0] >> 4) != 6)
+            return 0;
+        /* no extension header parsing here */
+        proto = ip[6];
+        memcpy(src, ip + 8, 16);
+        memcpy(dst, ip + 24, 16);
+        offset += IPV6_HEADER_LEN;
+    } else {
+        return 0;
+    }
+
+    if (proto != IPPROTO_TCP && proto != IPPROTO_UDP)
+        return 0;
+    if (len < offset + 4)
+        return 0;
+
+    memset(key, 0, sizeof(*key));
+    FlowBypassEntrySetup(key, proto, src, dst,
+                         (pkt[offset] << 8) | pkt[offset + 1],
+                         (pkt[offset + 2] << 8) | pkt[offset + 3]);
+    key->vlan_id[0] = vlan_id[0];
+    key->vlan_id[1] = vlan_id[1];
+
+    return 1;
+}
+
+/**
+ *  \brief allocate a bypass table
+ *
+ *  \param size number of slots, rounded up to a power of 2
+ *  \param timeout seconds without packets after which an entry expires
+ *  \param shared set if flows are added by other threads than the one
+ *                looking them up, then the slots are locked.  A table
+ *                that is only used by one thread is not.
+ *
+ *  \retval t the table or NULL on error
+ */
+FlowBypassTable *FlowBypassTableAlloc(uint32_t size, uint32_t timeout,
+                                      int shared)
+{
+    uint32_t slots = 1;
+
+    if (size == 0 || size > (1 << 24)) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "invalid bypass table size %"PRIu32, size);
+        return NULL;
+    }
+    while (slots < size)
+        slots <<= 1;
+
+    FlowBypassTable *t = SCMalloc(sizeof(FlowBypassTable));
+    if (unlikely(t == NULL))
+        return NULL;
+    memset(t, 0, sizeof(FlowBypassTable));
+
+    t->array = SCMalloc(slots * sizeof(FlowBypassEntry));
+    if (unlikely(t->array == NULL)) {
+        SCFree(t);
+        return NULL;
+    }
+    memset(t->array, 0, slots * sizeof(FlowBypassEntry));
+
+    t->size = slots;
+    t->timeout = timeout;
+    t->shared = shared;
+    SCSpinInit(&t->lock, 0);
+    SC_ATOMIC_INIT(t->cnt);
+
+    SCLogDebug("bypass table of %"PRIu32" slots, timeout %"PRIu32", %s",
+               slots, timeout, shared ? "shared" : "thread local");
+    return t;
+}
+
+void FlowBypassTableFree(FlowBypassTable *t)
+{
+    if (t == NULL)
+        return;
+
+    SCSpinDestroy(&t->lock);
+    SC_ATOMIC_DESTROY(t->cnt);
+    SCFree(t->array);
+    SCFree(t);
+}
+
+/**
+ *  \brief add the flow of a packet to the table
+ *
+ *  \retval 1 flow added
+ *  \retval 0 packet can't be bypassed by the table
+ */
+int FlowBypassTableAdd(FlowBypassTable *t, Packet *p)
+{
+    FlowBypassEntry key;
+
+    /* the table only knows the outer headers, which it takes from the
+     * frame like the lookups do */
+    if (p->root != NULL || PKT_IS_PSEUDOPKT(p))
+        return 0;
+    if (p->datalink != LINKTYPE_ETHERNET)
+        return 0;
+    if (!FlowBypassEntryFromEthernet(&key, GET_PKT_DATA(p), GET_PKT_LEN(p)))
+        return 0;
+
+    uint32_t idx = FlowBypassEntryHash(t, &key);
+
+    if (t->shared)
+        SCSpinLock(&t->lock);
+    FlowBypassEntry *e = &t->array[idx];
+    if (!e->used)
+        (void) SC_ATOMIC_ADD(t->cnt, 1);
+    *e = key;
+    e->used = 1;
+    e->lastts = (uint32_t)p->ts.tv_sec;
+    if (t->shared)
+        SCSpinUnlock(&t->lock);
+
+    return 1;
+}
+
+/**
+ *  \brief check a raw ethernet frame against the table
+ *
+ *  \param t table
+ *  \param pkt start of the ethernet header
+ *  \param len captured length of the frame
+ *  \param ts capture time of the frame in seconds
+ *
+ *  \retval 1 frame belongs to a bypassed flow
+ *  \retval 0 frame needs to go through the engine
+ */
+int FlowBypassTableLookupEthernet(FlowBypassTable *t, const uint8_t *pkt,
+                                  uint32_t len, uint32_t ts)
+{
+    FlowBypassEntry key;
+    int r = 0;
+
+    if (SC_ATOMIC_GET(t->cnt) == 0)
+        return 0;
+
+    if (!FlowBypassEntryFromEthernet(&key, pkt, len))
+        return 0;
+
+    uint32_t idx = FlowBypassEntryHash(t, &key);
+
+    if (t->shared)
+        SCSpinLock(&t->lock);
+    FlowBypassEntry *e = &t->array[idx];
+    if (e->used && FlowBypassEntryCompare(e, &key)) {
+        if (ts > e->lastts && ts - e->lastts > t->timeout) {
+            /* idle for too long: give the flow back to the engine, it
+             * will time out there or be bypassed again */
+            e->used = 0;
+            (void) SC_ATOMIC_SUB(t->cnt, 1);
+        } else {
+            e->lastts = ts;
+            r = 1;
+        }
+    }
+    if (t->shared)
+        SCSpinUnlock(&t->lock);
+
+    return r;
+}
+
+#ifdef UNITTESTS
+
+/** \brief build a ethernet/ipv4/tcp frame header for 10.0.0.1:sp -> 10.0.0.2:dp,
+ *         with a vlan tag if vlan isn't 0 */
+static void FlowBypassTestBuildFrame(uint8_t *buf, uint16_t sp, uint16_t dp,
+                                     int reverse, uint16_t vlan)
+{
+    uint8_t a[4] = { 10, 0, 0, 1 };
+    uint8_t b[4] = { 10, 0, 0, 2 };
+    uint8_t *ip = buf + ETHERNET_HEADER_LEN;
+
+    memset(buf, 0, 64);
+    buf[12] = 0x08;
+    buf[13] = 0x00;
+    if (vlan != 0) {
+        buf[12] = 0x81;
+        buf[13] = 0x00;
+        buf[14] = vlan >> 8;
+        buf[15] = vlan & 0xff;
+        buf[16] = 0x08;
+        buf[17] = 0x00;
+        ip += VLAN_HEADER_LEN;
+    }
+    ip[0] = 0x45;
+    ip[9] = IPPROTO_TCP;
+    memcpy(ip + 12, reverse ? b : a, 4);
+    memcpy(ip + 16, reverse ? a : b, 4);
+    if (reverse) {
+        uint16_t tmp = sp;
+        sp = dp;
+        dp = tmp;
+    }
+    ip[20] = sp >> 8;
+    ip[21] = sp & 0xff;
+    ip[22] = dp >> 8;
+    ip[23] = dp & 0xff;
+}
+
+/** \brief packet as the capture sets it up for a frame */
+static Packet *FlowBypassTestBuildPacket(uint8_t *frame, uint32_t len)
+{
+    Packet *p = PacketGetFromAlloc();
+    if (p == NULL)
+        return NULL;
+
+    if (PacketCopyData(p, frame, len) != 0) {
+        SCFree(p);
+        return NULL;
+    }
+    p->datalink = LINKTYPE_ETHERNET;
+    p->ts.tv_sec = 1000;
+
+    return p;
+}
+
+/** \test both directions of a bypassed flow hit, other flows don't */
+static int FlowBypassTest01(void)
+{
+    int result = 0;
+    uint8_t frame[64];
+    uint32_t ts;
+    Packet *p = NULL;
+
+    FlowBypassTable *t = FlowBypassTableAlloc(1024, 60, 0);
+    if (t == NULL)
+        return 0;
+
+    FlowBypassTestBuildFrame(frame, 41424, 80, 0, 0);
+    p = FlowBypassTestBuildPacket(frame, sizeof(frame));
+    if (p == NULL)
+        goto end;
+    ts = (uint32_t)p->ts.tv_sec;
+
+    if (FlowBypassTableLookupEthernet(t, frame, sizeof(frame), ts) != 0) {
+        printf("hit on empty table: ");
+        goto end;
+    }
+
+    if (FlowBypassTableAdd(t, p) != 1) {
+        printf("packet not added: ");
+        goto end;
+    }
+
+    if (FlowBypassTableLookupEthernet(t, frame, sizeof(frame), ts) != 1) {
+        printf("toserver frame not bypassed: ");
+        goto end;
+    }
+    FlowBypassTestBuildFrame(frame, 41424, 80, 1, 0);
+    if (FlowBypassTableLookupEthernet(t, frame, sizeof(frame), ts) != 1) {
+        printf("toclient frame not bypassed: ");
+        goto end;
+    }
+    FlowBypassTestBuildFrame(frame, 41425, 80, 0, 0);
+    if (FlowBypassTableLookupEthernet(t, frame, sizeof(frame), ts) != 0) {
+        printf("other flow bypassed: ");
+        goto end;
+    }
+    /* truncated frame */
+    FlowBypassTestBuildFrame(frame, 41424, 80, 0, 0);
+    if (FlowBypassTableLookupEthernet(t, frame, 36, ts) != 0) {
+        printf("truncated frame bypassed: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    if (p != NULL)
+        SCFree(p);
+    FlowBypassTableFree(t);
+    return result;
+}
+
+/** \test idle entries expire */
+static int FlowBypassTest02(void)
+{
+    int result = 0;
+    uint8_t frame[64];
+    uint32_t ts;
+    Packet *p = NULL;
+
+    FlowBypassTable *t = FlowBypassTableAlloc(1024, 60, 1);
+    if (t == NULL)
+        return 0;
+
+    FlowBypassTestBuildFrame(frame, 41424, 80, 0, 0);
+    p = FlowBypassTestBuildPacket(frame, sizeof(frame));
+    if (p == NULL)
+        goto end;
+    ts = (uint32_t)p->ts.tv_sec;
+
+    FlowBypassTableAdd(t, p);
+
+    /* each hit refreshes the entry */
+    if (FlowBypassTableLookupEthernet(t, frame, sizeof(frame), ts + 50) != 1 ||
+        FlowBypassTableLookupEthernet(t, frame, sizeof(frame), ts + 100) != 1) {
+        printf("active flow not bypassed: ");
+        goto end;
+    }
+    if (FlowBypassTableLookupEthernet(t, frame, sizeof(frame), ts + 161) != 0) {
+        printf("idle flow still bypassed: ");
+        goto end;
+    }
+    if (SC_ATOMIC_GET(t->cnt) != 0) {
+        printf("expired entry still counted: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    if (p != NULL)
+        SCFree(p);
+    FlowBypassTableFree(t);
+    return result;
+}
+
+/** \test a flow bypassed on one vlan isn't bypassed on another */
+static int FlowBypassTest03(void)
+{
+    int result = 0;
+    uint8_t frame[64];
+    uint32_t ts;
+    Packet *p = NULL;
+
+    FlowBypassTable *t = FlowBypassTableAlloc(1024, 60, 0);
+    if (t == NULL)
+        return 0;
+
+    FlowBypassTestBuildFrame(frame, 41424, 80, 0, 10);
+    p = FlowBypassTestBuildPacket(frame, sizeof(frame));
+    if (p == NULL)
+        goto end;
+    ts = (uint32_t)p->ts.tv_sec;
+
+    if (FlowBypassTableAdd(t, p) != 1) {
+        printf("packet not added: ");
+        goto end;
+    }
+
+    FlowBypassTestBuildFrame(frame, 41424, 80, 1, 10);
+    if (FlowBypassTableLookupEthernet(t, frame, sizeof(frame), ts) != 1) {
+        printf("frame on vlan 10 not bypassed: ");
+        goto end;
+    }
+    FlowBypassTestBuildFrame(frame, 41424, 80, 0, 20);
+    if (FlowBypassTableLookupEthernet(t, frame, sizeof(frame), ts) != 0) {
+        printf("frame on vlan 20 bypassed: ");
+        goto end;
+    }
+    FlowBypassTestBuildFrame(frame, 41424, 80, 0, 0);
+    if (FlowBypassTableLookupEthernet(t, frame, sizeof(frame), ts) != 0) {
+        printf("untagged frame bypassed: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    if (p != NULL)
+        SCFree(p);
+    FlowBypassTableFree(t);
+    return result;
+}
+
+#endif /* UNITTESTS */
+
+void FlowBypassRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("FlowBypassTest01", FlowBypassTest01, 1);
+    UtRegisterTest("FlowBypassTest02", FlowBypassTest02, 1);
+    UtRegisterTest("FlowBypassTest03", FlowBypassTest03, 1);
+#endif /* UNITTESTS */
+}
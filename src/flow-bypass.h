@@ -0,0 +1,75 @@
+/* Copyright (C) 2007-2013 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Userspace bypass table for capture methods.
+ */
+
+#ifndef __FLOW_BYPASS_H__
+#define __FLOW_BYPASS_H__
+
+#include "decode.h"
+#include "threads.h"
+#include "util-atomic.h"
+
+/** default number of slots of a bypass table */
+#define FLOW_BYPASS_TABLE_SIZE      65536
+/** default seconds without packets before a bypassed flow is
+ *  handed back to the engine */
+#define FLOW_BYPASS_TIMEOUT         60
+
+/** Bypassed flow, stored with the lower address/port first so both
+ *  directions map to the same entry. The vlan ids of the outer and the
+ *  inner tag are part of the key, an id is 0 if the frame doesn't have
+ *  that tag. Frames with more than two tags aren't bypassed. */
+typedef struct FlowBypassEntry_ {
+    uint32_t addr[2][4];
+    uint16_t port[2];
+    uint16_t vlan_id[2];
+    uint8_t proto;
+    uint8_t used;
+    uint32_t lastts;
+} FlowBypassEntry;
+
+/**
+ *  \brief direct mapped table of bypassed flows.
+ *
+ *  Filled by the engine through Packet::BypassPacketsFlow, looked up by
+ *  the capture thread on the raw frame before a Packet is set up. On a
+ *  collision the older flow is evicted: its packets go through the engine
+ *  again, which bypasses it again on the next packet.
+ */
+typedef struct FlowBypassTable_ {
+    /** only taken if the table is shared, see FlowBypassTableAlloc() */
+    SCSpinlock lock;
+    int shared;
+    FlowBypassEntry *array;
+    uint32_t size;          /**< number of slots, power of 2 */
+    uint32_t timeout;
+    /** number of used slots, so capture can skip the lookup for free */
+    SC_ATOMIC_DECLARE(uint32_t, cnt);
+} FlowBypassTable;
+
+FlowBypassTable *FlowBypassTableAlloc(uint32_t, uint32_t, int);
+void FlowBypassTableFree(FlowBypassTable *);
+int FlowBypassTableAdd(FlowBypassTable *, Packet *);
+int FlowBypassTableLookupEthernet(FlowBypassTable *, const uint8_t *, uint32_t, uint32_t);
+void FlowBypassRegisterTests(void);
+
+#endif /* __FLOW_BYPASS_H__ */
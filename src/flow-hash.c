@@ -41,6 +41,12 @@
 #include "util-debug.h"
 
 #include "util-hash-lookup3.h"
+#include "util-optimize.h"
+#include "util-unittest.h"
+
+#include "decode-ethernet.h"
+#include "decode-sll.h"
+#include "decode-vlan.h"
 
 #define FLOW_DEFAULT_FLOW_PRUNE 5
 
@@ -713,3 +719,252 @@ static Flow *FlowGetUsedFlow(void) {
 
     return NULL;
 }
+
+/**
+ *  \brief compute the hash key of a packet from its raw data
+ *
+ *  Used to prefetch the flow bucket before the packet is decoded. Only
+ *  handles unfragmented TCP and UDP over IPv4 and IPv6 (without extension
+ *  headers), on ethernet (optionally VLAN tagged), SLL or raw links. For
+ *  those packets the key is the same as FlowGetKey gives after decoding.
+ *
+ *  \param pkt raw packet data
+ *  \param len length of the data
+ *  \param datalink link type of the packet
+ *
+ *  \retval key hash key, or FLOW_HASH_KEY_NONE
+ */
+uint32_t FlowGetKeyFromRaw(const uint8_t *pkt, uint32_t len, int datalink)
+{
+    uint32_t offset;
+    uint16_t ether_type;
+    uint8_t proto;
+    uint16_t sp, dp;
+
+    switch (datalink) {
+        case LINKTYPE_ETHERNET:
+            if (len < ETHERNET_HEADER_LEN)
+                return FLOW_HASH_KEY_NONE;
+            ether_type = (pkt[12] << 8) | pkt[13];
+            offset = ETHERNET_HEADER_LEN;
+            /* the vlan id isn't part of the key */
+            while (ether_type == ETHERNET_TYPE_VLAN) {
+                if (len < offset + 4)
+                    return FLOW_HASH_KEY_NONE;
+                ether_type = (pkt[offset + 2] << 8) | pkt[offset + 3];
+                offset += 4;
+            }
+            break;
+        case LINKTYPE_LINUX_SLL:
+            if (len < SLL_HEADER_LEN)
+                return FLOW_HASH_KEY_NONE;
+            ether_type = (pkt[14] << 8) | pkt[15];
+            offset = SLL_HEADER_LEN;
+            break;
+        case LINKTYPE_RAW:
+            if (len < 1)
+                return FLOW_HASH_KEY_NONE;
+            ether_type = ((pkt[0] >> 4) == 6) ? ETHERNET_TYPE_IPV6 : ETHERNET_TYPE_IP;
+            offset = 0;
+            break;
+        default:
+            return FLOW_HASH_KEY_NONE;
+    }
+
+    const uint8_t *ip = pkt + offset;
+    len -= offset;
+
+    if (ether_type == ETHERNET_TYPE_IP) {
+        if (len < IPV4_HEADER_LEN || (ip[0] >> 4) != 4)
+            return FLOW_HASH_KEY_NONE;
+
+        uint32_t hlen = (ip[0] & 0x0f) << 2;
+        /* fragments go through defrag first */
+        if (hlen < IPV4_HEADER_LEN || (((ip[6] << 8) | ip[7]) & 0x3fff) != 0)
+            return FLOW_HASH_KEY_NONE;
+
+        proto = ip[9];
+        if ((proto != IPPROTO_TCP && proto != IPPROTO_UDP) || len < hlen + 4)
+            return FLOW_HASH_KEY_NONE;
+
+        sp = (ip[hlen] << 8) | ip[hlen + 1];
+        dp = (ip[hlen + 2] << 8) | ip[hlen + 3];
+
+        uint32_t src, dst;
+        memcpy(&src, ip + 12, sizeof(src));
+        memcpy(&dst, ip + 16, sizeof(dst));
+
+        FlowHashKey4 fhk;
+        if (src > dst) {
+            fhk.src = src;
+            fhk.dst = dst;
+        } else {
+            fhk.src = dst;
+            fhk.dst = src;
+        }
+        if (sp > dp) {
+            fhk.sp = sp;
+            fhk.dp = dp;
+        } else {
+            fhk.sp = dp;
+            fhk.dp = sp;
+        }
+        fhk.proto = (uint16_t)proto;
+        fhk.recur = 0;
+
+        uint32_t hash = hashword(fhk.u32, 4, flow_config.hash_rand);
+        return hash % flow_config.hash_size;
+
+    } else if (ether_type == ETHERNET_TYPE_IPV6) {
+        if (len < IPV6_HEADER_LEN + 4 || (ip[0] >> 4) != 6)
+            return FLOW_HASH_KEY_NONE;
+
+        proto = ip[6];
+        if (proto != IPPROTO_TCP && proto != IPPROTO_UDP)
+            return FLOW_HASH_KEY_NONE;
+
+        sp = (ip[IPV6_HEADER_LEN] << 8) | ip[IPV6_HEADER_LEN + 1];
+        dp = (ip[IPV6_HEADER_LEN + 2] << 8) | ip[IPV6_HEADER_LEN + 3];
+
+        uint32_t src[4], dst[4];
+        memcpy(src, ip + 8, sizeof(src));
+        memcpy(dst, ip + 24, sizeof(dst));
+
+        FlowHashKey6 fhk;
+        if (FlowHashRawAddressIPv6GtU32(src, dst)) {
+            memcpy(fhk.src, src, sizeof(src));
+            memcpy(fhk.dst, dst, sizeof(dst));
+        } else {
+            memcpy(fhk.src, dst, sizeof(dst));
+            memcpy(fhk.dst, src, sizeof(src));
+        }
+        if (sp > dp) {
+            fhk.sp = sp;
+            fhk.dp = dp;
+        } else {
+            fhk.sp = dp;
+            fhk.dp = sp;
+        }
+        fhk.proto = (uint16_t)proto;
+        fhk.recur = 0;
+
+        uint32_t hash = hashword(fhk.u32, 10, flow_config.hash_rand);
+        return hash % flow_config.hash_size;
+    }
+
+    return FLOW_HASH_KEY_NONE;
+}
+
+/**
+ *  \brief start the flow hash prefetch pipeline for a batch of packets
+ *
+ *  Computes the hash keys of the packets and prefetches the buckets of
+ *  the first ones. FlowHashPrefetchLookahead keeps it going.
+ *
+ *  \param pkts undecoded packets
+ *  \param cnt number of packets
+ *  \param keys array of at least cnt keys to fill
+ *
+ *  \retval lookahead distance, 0 if prefetching is disabled
+ */
+uint16_t FlowHashPrefetchSetup(Packet **pkts, uint16_t cnt, uint32_t *keys)
+{
+    uint16_t lookahead = flow_config.prefetch_lookahead;
+    uint16_t i;
+
+    /* nothing to overlap with */
+    if (lookahead == 0 || cnt < 2)
+        return 0;
+
+    for (i = 0; i < cnt; i++) {
+        Packet *p = pkts[i];
+        keys[i] = FlowGetKeyFromRaw(GET_PKT_DATA(p), GET_PKT_LEN(p), p->datalink);
+        if (i < lookahead && keys[i] != FLOW_HASH_KEY_NONE)
+            SCPrefetch(&flow_hash[keys[i]]);
+    }
+
+    return lookahead;
+}
+
+#ifdef UNITTESTS
+
+/** \test raw key matches the key of the decoded packet */
+static int FlowHashTest01(void)
+{
+    int result = 0;
+    /* ethernet, vlan 10, ipv4 10.0.0.2:41000 -> 10.0.0.1:80 tcp */
+    uint8_t raw4[] = {
+        0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x00, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+        0x81, 0x00, 0x00, 0x0a, 0x08, 0x00,
+        0x45, 0x00, 0x00, 0x28, 0x00, 0x01, 0x40, 0x00, 0x40, 0x06, 0x00, 0x00,
+        0x0a, 0x00, 0x00, 0x02, 0x0a, 0x00, 0x00, 0x01,
+        0xa0, 0x28, 0x00, 0x50, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+        0x50, 0x02, 0x20, 0x00, 0x00, 0x00, 0x00, 0x00 };
+    /* raw ipv6 2001:db8::1:53 -> 2001:db8::2:5353 udp */
+    uint8_t raw6[] = {
+        0x60, 0x00, 0x00, 0x00, 0x00, 0x08, 0x11, 0x40,
+        0x20, 0x01, 0x0d, 0xb8, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+        0x20, 0x01, 0x0d, 0xb8, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02,
+        0x00, 0x35, 0x14, 0xe9, 0x00, 0x08, 0x00, 0x00 };
+    FlowConfig backup = flow_config;
+    Packet *p = SCMalloc(SIZE_OF_PACKET);
+    if (p == NULL)
+        return 0;
+
+    flow_config.hash_rand = 12345;
+    flow_config.hash_size = 65536;
+
+    memset(p, 0, SIZE_OF_PACKET);
+    p->ip4h = (IPV4Hdr *)(raw4 + 18);
+    p->tcph = (TCPHdr *)(raw4 + 38);
+    SET_IPV4_SRC_ADDR(p, &p->src);
+    SET_IPV4_DST_ADDR(p, &p->dst);
+    p->sp = TCP_GET_SRC_PORT(p);
+    p->dp = TCP_GET_DST_PORT(p);
+    p->proto = IPPROTO_TCP;
+
+    uint32_t key = FlowGetKeyFromRaw(raw4, sizeof(raw4), LINKTYPE_ETHERNET);
+    if (key == FLOW_HASH_KEY_NONE || key != FlowGetKey(p)) {
+        printf("ipv4 key %"PRIu32" != %"PRIu32": ", key, FlowGetKey(p));
+        goto end;
+    }
+
+    memset(p, 0, SIZE_OF_PACKET);
+    p->ip6h = (IPV6Hdr *)raw6;
+    p->udph = (UDPHdr *)(raw6 + IPV6_HEADER_LEN);
+    SET_IPV6_SRC_ADDR(p, &p->src);
+    SET_IPV6_DST_ADDR(p, &p->dst);
+    p->sp = UDP_GET_SRC_PORT(p);
+    p->dp = UDP_GET_DST_PORT(p);
+    p->proto = IPPROTO_UDP;
+
+    key = FlowGetKeyFromRaw(raw6, sizeof(raw6), LINKTYPE_RAW);
+    if (key == FLOW_HASH_KEY_NONE || key != FlowGetKey(p)) {
+        printf("ipv6 key %"PRIu32" != %"PRIu32": ", key, FlowGetKey(p));
+        goto end;
+    }
+
+    /* fragments are left alone */
+    raw4[24] |= 0x20;
+    if (FlowGetKeyFromRaw(raw4, sizeof(raw4), LINKTYPE_ETHERNET) != FLOW_HASH_KEY_NONE) {
+        printf("got a key for a fragment: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    flow_config = backup;
+    SCFree(p);
+    return result;
+}
+
+#endif /* UNITTESTS */
+
+void FlowHashRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("FlowHashTest01", FlowHashTest01, 1);
+#endif /* UNITTESTS */
+}
@@ -70,9 +70,43 @@ typedef struct FlowBucket_ {
     #error Enable FBLOCK_SPIN or FBLOCK_MUTEX
 #endif
 
+/** key for packets we can't compute a hash key for before decoding */
+#define FLOW_HASH_KEY_NONE  UINT32_MAX
+
+extern FlowBucket *flow_hash;
+
 /* prototypes */
 
 Flow *FlowGetFlowFromHash(Packet *);
+uint32_t FlowGetKeyFromRaw(const uint8_t *, uint32_t, int);
+uint16_t FlowHashPrefetchSetup(Packet **, uint16_t, uint32_t *);
+void FlowHashRegisterTests(void);
+
+/**
+ *  \brief flow hash prefetch pipeline over a batch of packets
+ *
+ *  Called before processing packet i. Starts loading the bucket of packet
+ *  i + lookahead and the first flow in the bucket of packet i + 1, which
+ *  was requested lookahead - 1 packets ago.
+ *
+ *  \param keys keys from FlowHashPrefetchSetup
+ *  \param cnt number of packets in the batch
+ *  \param i packet about to be processed
+ *  \param lookahead return value of FlowHashPrefetchSetup, not 0
+ */
+static inline void FlowHashPrefetchLookahead(const uint32_t *keys, uint16_t cnt,
+                                             uint16_t i, uint16_t lookahead)
+{
+    if (i + lookahead < cnt && keys[i + lookahead] != FLOW_HASH_KEY_NONE)
+        SCPrefetch(&flow_hash[keys[i + lookahead]]);
+
+    if (i + 1 < cnt && keys[i + 1] != FLOW_HASH_KEY_NONE) {
+        Flow *f = flow_hash[keys[i + 1]].head;
+        /* unlocked peek, only a hint */
+        if (f != NULL)
+            SCPrefetch(f);
+    }
+}
 
 /** enable to print stats on hash lookups in flow-debug.log */
 //#define FLOW_DEBUG_STATS
@@ -426,6 +426,8 @@ void *FlowManagerThread(void *td)
     uint16_t flow_emerg_mode_over = SCPerfTVRegisterCounter("flow.emerg_mode_over", th_v,
             SC_PERF_TYPE_UINT64,
             "NULL");
+    MemRegionPerfCounters mem_region_counters;
+    MemRegionRegisterPerfCounters(th_v, &mem_region_counters);
 
     if (th_v->thread_setup_flags != 0)
         TmThreadSetupOptions(th_v);
@@ -511,6 +513,8 @@ void *FlowManagerThread(void *td)
         FQLOCK_UNLOCK(&flow_spare_q);
         SCPerfCounterSetUI64(flow_mgr_spare, th_v->sc_perf_pca, (uint64_t)len);
 
+        MemRegionUpdatePerfCounters(th_v, &mem_region_counters);
+
         /* Don't fear, FlowManagerThread is here...
          * clear emergency bit if we have at least xx flows pruned. */
         if (emerg == TRUE) {
@@ -541,7 +545,7 @@ void *FlowManagerThread(void *td)
         }
 
         if (TmThreadsCheckFlag(th_v, THV_KILL)) {
-            SCPerfSyncCounters(th_v, 0);
+            SCPerfSyncCounters(th_v);
             break;
         }
 
@@ -552,8 +556,6 @@ void *FlowManagerThread(void *td)
         SCPtMutexUnlock(&flow_manager_mutex);
 
         SCLogDebug("woke up... %s", SC_ATOMIC_GET(flow_flags) & FLOW_EMERGENCY ? "emergency":"");
-
-        SCPerfSyncCountersIfSignalled(th_v, 0);
     }
 
     TmThreadsSetFlag(th_v, THV_RUNNING_DONE);
@@ -34,6 +34,7 @@
 
 #include "util-var.h"
 #include "util-debug.h"
+#include "util-hugepage.h"
 
 #include "detect.h"
 #include "detect-engine-state.h"
@@ -42,7 +43,6 @@
 #define FLOW_ALLOC_CACHE
 #endif
 
-#ifdef FLOW_ALLOC_CACHE
 typedef union FlowCache_
 {
     union FlowCache_ *next;
@@ -51,6 +51,18 @@ typedef union FlowCache_
 
 static union FlowCache_ *FlowAllocList;
 static SCMutex flow_alloc_mutex;
+
+#ifndef FLOW_ALLOC_CACHE
+/** hugepage backed slab holding the preallocated flows, NULL if the
+ *  flows are allocated one by one */
+static FlowCache *flow_slab = NULL;
+static uint32_t flow_slab_cnt = 0;
+
+static inline int FlowInSlab(Flow *f)
+{
+    return (flow_slab != NULL && (FlowCache *)f >= flow_slab &&
+            (FlowCache *)f < flow_slab + flow_slab_cnt);
+}
 #endif
 
 /** \brief allocate a flow
@@ -78,7 +90,19 @@ Flow *FlowAlloc(void)
     SCMutexUnlock(&flow_alloc_mutex);
     f = &fc->flow;
 #else
-    f = SCMalloc(sizeof(Flow));
+    f = NULL;
+    if (flow_slab != NULL) {
+        SCMutexLock(&flow_alloc_mutex);
+        FlowCache *fc = FlowAllocList;
+        if (fc != NULL) {
+            FlowAllocList = fc->next;
+            f = &fc->flow;
+        }
+        SCMutexUnlock(&flow_alloc_mutex);
+    }
+    /* slab exhausted or not in use */
+    if (f == NULL)
+        f = SCRegionMalloc(MEM_REGION_FLOW, sizeof(Flow));
 #endif
     if (unlikely(f == NULL)) {
         (void)SC_ATOMIC_SUB(flow_memuse, sizeof(Flow));
@@ -105,7 +129,15 @@ void FlowFree(Flow *f)
     FlowAllocList = fc;
     SCMutexUnlock(&flow_alloc_mutex);
 #else
-    SCFree(f);
+    if (FlowInSlab(f)) {
+        FlowCache *fc = (FlowCache *)f;
+        SCMutexLock(&flow_alloc_mutex);
+        fc->next = FlowAllocList;
+        FlowAllocList = fc;
+        SCMutexUnlock(&flow_alloc_mutex);
+    } else {
+        SCRegionFree(f);
+    }
 #endif
 
     (void) SC_ATOMIC_SUB(flow_memuse, sizeof(Flow));
@@ -210,6 +242,44 @@ void FlowAllocPoolInit(void)
     p->next = NULL;
     SCMutexInit(&flow_alloc_mutex, NULL);
  
+#else
+    /* back the preallocated flows by hugepages, flows over the prealloc
+     * setting are still allocated one by one */
+    FlowCache *p;
+    uint32_t i;
+
+    if (!UtilHugepageEnabled() || flow_config.prealloc == 0)
+        SCReturn;
+
+    p = UtilHugepageAlloc((size_t)flow_config.prealloc * sizeof(FlowCache),
+                          "flows");
+    if (p == NULL)
+        SCReturn;
+
+    SCMutexInit(&flow_alloc_mutex, NULL);
+    flow_slab = p;
+    flow_slab_cnt = flow_config.prealloc;
+    FlowAllocList = p;
+    for (i = 0; i < flow_slab_cnt - 1; i++) {
+        p->next = (p+1);
+        ++p;
+    }
+    p->next = NULL;
 #endif
     SCReturn;
 }
+
+/** \brief free the flow slab, all flows must have been freed */
+void FlowAllocPoolFree(void)
+{
+#ifndef FLOW_ALLOC_CACHE
+    if (flow_slab == NULL)
+        return;
+
+    UtilHugepageFree(flow_slab);
+    flow_slab = NULL;
+    flow_slab_cnt = 0;
+    FlowAllocList = NULL;
+    SCMutexDestroy(&flow_alloc_mutex);
+#endif
+}
@@ -68,6 +68,8 @@
         (f)->lprev = NULL; \
         SC_ATOMIC_INIT((f)->autofp_tmqh_flow_qid);  \
         (void) SC_ATOMIC_SET((f)->autofp_tmqh_flow_qid, -1);  \
+        SC_ATOMIC_INIT((f)->autofp_tmqh_applayer_qid);  \
+        (void) SC_ATOMIC_SET((f)->autofp_tmqh_applayer_qid, -1);  \
         RESET_COUNTERS((f)); \
     } while (0)
 
@@ -102,6 +104,9 @@
         if (SC_ATOMIC_GET((f)->autofp_tmqh_flow_qid) != -1) {   \
             (void) SC_ATOMIC_SET((f)->autofp_tmqh_flow_qid, -1);   \
         }                                       \
+        if (SC_ATOMIC_GET((f)->autofp_tmqh_applayer_qid) != -1) {   \
+            (void) SC_ATOMIC_SET((f)->autofp_tmqh_applayer_qid, -1);   \
+        }                                       \
         RESET_COUNTERS((f)); \
     } while(0)
 
@@ -117,6 +122,7 @@
         GenericVarFree((f)->flowvar); \
         SCMutexDestroy(&(f)->de_state_m); \
         SC_ATOMIC_DESTROY((f)->autofp_tmqh_flow_qid);   \
+        SC_ATOMIC_DESTROY((f)->autofp_tmqh_applayer_qid);   \
         (f)->tag_list = NULL; \
     } while(0)
 
@@ -135,9 +141,8 @@ Flow *FlowAllocDirect(void);
 void FlowFree(Flow *);
 uint8_t FlowGetProtoMapping(uint8_t);
 void FlowInit(Flow *, Packet *);
-#ifdef __tile__
 void FlowAllocPoolInit(void);
-#endif
+void FlowAllocPoolFree(void);
 
 #endif /* __FLOW_UTIL_H__ */
 
@@ -54,6 +54,8 @@
 
 #include "util-debug.h"
 #include "util-privs.h"
+#include "util-profiling.h"
+#include "util-numa.h"
 
 #include "detect.h"
 #include "detect-engine-state.h"
@@ -69,6 +71,8 @@
 #define FLOW_DEFAULT_MEMCAP      (32 * 1024 * 1024) /* 32 MB */
 
 #define FLOW_DEFAULT_PREALLOC    10000
+#define FLOW_DEFAULT_PREFETCH_LOOKAHEAD 4
+#define FLOW_MAX_PREFETCH_LOOKAHEAD     32
 
 /** atomic int that is used when freeing a flow from the hash. In this
  *  case we walk the hash to find a flow to free. This var records where
@@ -256,20 +260,36 @@ static inline int FlowUpdateSeenFlag(Packet *p)
  * This is called for every packet.
  *
  *  \param tv threadvars
+ *  \param dtv decode thread vars, for the bypass counters. May be NULL.
  *  \param p packet to handle flow for
  */
-void FlowHandlePacket (ThreadVars *tv, Packet *p)
+void FlowHandlePacket (ThreadVars *tv, DecodeThreadVars *dtv, Packet *p)
 {
+#ifdef PROFILING
+    uint64_t flow_ticks = 0;
+#endif
+    PACKET_PROFILING_FLOW_START(flow_ticks);
+
     /* Get this packet's flow from the hash. FlowHandlePacket() will setup
      * a new flow if nescesary. If we get NULL, we're out of flow memory.
      * The returned flow is locked. */
     Flow *f = FlowGetFlowFromHash(p);
+
+    PACKET_PROFILING_FLOW_END(p, flow_ticks);
+
     if (f == NULL)
         return;
 
     /* update the last seen timestamp of this flow */
     f->lastts_sec = p->ts.tv_sec;
 
+    /* no direction seen yet, so we just set it up. In the workers runmodes
+     * this is the number of flows owned by the thread. */
+    if (!(f->flags & (FLOW_TO_DST_SEEN|FLOW_TO_SRC_SEEN)) &&
+            tv != NULL && dtv != NULL) {
+        SCPerfCounterIncr(dtv->counter_flow_new, tv->sc_perf_pca);
+    }
+
     /* update flags and counters */
     if (FlowGetPacketDirection(f,p) == TOSERVER) {
         if (FlowUpdateSeenFlag(p)) {
@@ -307,10 +327,28 @@ void FlowHandlePacket (ThreadVars *tv, Packet *p)
         DecodeSetNoPayloadInspectionFlag(p);
     }
 
+    if (f->flags & FLOW_BYPASSED) {
+        SCLogDebug("flow %p is bypassed", f);
+        p->flags |= PKT_FLOW_BYPASSED;
+    }
+
     FLOWLOCK_UNLOCK(f);
 
     /* set the flow in the packet */
     p->flags |= PKT_HAS_FLOW;
+
+    if (p->flags & PKT_FLOW_BYPASSED) {
+        if (tv != NULL && dtv != NULL) {
+            SCPerfCounterIncr(dtv->counter_flow_bypassed_pkts, tv->sc_perf_pca);
+            SCPerfCounterAddUI64(dtv->counter_flow_bypassed_bytes, tv->sc_perf_pca,
+                                 GET_PKT_LEN(p));
+        }
+        /* let the capture method take over the rest of the flow if it
+         * can, so we don't even see the packets anymore */
+        if (p->BypassPacketsFlow != NULL) {
+            p->BypassPacketsFlow(p);
+        }
+    }
     return;
 }
 
@@ -333,6 +371,7 @@ void FlowInitConfig(char quiet)
     flow_config.hash_size   = FLOW_DEFAULT_HASHSIZE;
     flow_config.memcap      = FLOW_DEFAULT_MEMCAP;
     flow_config.prealloc    = FLOW_DEFAULT_PREALLOC;
+    flow_config.prefetch_lookahead = FLOW_DEFAULT_PREFETCH_LOOKAHEAD;
 
     /* If we have specific config, overwrite the defaults with them,
      * otherwise, leave the default values */
@@ -377,6 +416,14 @@ void FlowInitConfig(char quiet)
             flow_config.prealloc = configval;
         }
     }
+    if (ConfGetInt("flow.prefetch-lookahead", &val) == 1) {
+        if (val >= 0 && val <= FLOW_MAX_PREFETCH_LOOKAHEAD) {
+            flow_config.prefetch_lookahead = (uint16_t)val;
+        } else {
+            SCLogError(SC_ERR_INVALID_VALUE, "flow.prefetch-lookahead must be "
+                    "in the range of 0 and %d", FLOW_MAX_PREFETCH_LOOKAHEAD);
+        }
+    }
     SCLogDebug("Flow config from suricata.yaml: memcap: %"PRIu64", hash-size: "
                "%"PRIu32", prealloc: %"PRIu32, flow_config.memcap,
                flow_config.hash_size, flow_config.prealloc);
@@ -392,12 +439,13 @@ void FlowInitConfig(char quiet)
                 (uintmax_t)sizeof(FlowBucket));
         exit(EXIT_FAILURE);
     }
-    flow_hash = SCCalloc(flow_config.hash_size, sizeof(FlowBucket));
+    /* all threads use all rows, so spread them over the NUMA nodes */
+    flow_hash = UtilNumaAlloc(flow_config.hash_size * sizeof(FlowBucket),
+                              NUMA_NODE_INTERLEAVED, "flow hash");
     if (unlikely(flow_hash == NULL)) {
         SCLogError(SC_ERR_FATAL, "Fatal error encountered in FlowInitConfig. Exiting...");
         exit(EXIT_FAILURE);
     }
-    memset(flow_hash, 0, flow_config.hash_size * sizeof(FlowBucket));
 
     uint32_t i = 0;
     for (i = 0; i < flow_config.hash_size; i++) {
@@ -412,9 +460,7 @@ void FlowInitConfig(char quiet)
                   (uintmax_t)sizeof(FlowBucket));
     }
 
-#ifdef __tile__
     FlowAllocPoolInit();
-#endif
     /* pre allocate flows */
     for (i = 0; i < flow_config.prealloc; i++) {
         if (!(FLOW_CHECK_MEMCAP(sizeof(Flow)))) {
@@ -489,11 +535,13 @@ void FlowShutdown(void)
 
             FBLOCK_DESTROY(&flow_hash[u]);
         }
-        SCFree(flow_hash);
+        UtilNumaFree(flow_hash, flow_config.hash_size * sizeof(FlowBucket),
+                     NUMA_NODE_INTERLEAVED);
         flow_hash = NULL;
     }
     (void) SC_ATOMIC_SUB(flow_memuse, flow_config.hash_size * sizeof(FlowBucket));
     FlowQueueDestroy(&flow_spare_q);
+    FlowAllocPoolFree();
 
     SC_ATOMIC_DESTROY(flow_prune_idx);
     SC_ATOMIC_DESTROY(flow_memuse);
@@ -1088,5 +1136,6 @@ void FlowRegisterTests (void) {
     UtRegisterTest("FlowTest09 -- Test flow Allocations when it reach memcap", FlowTest09, 1);
 
     FlowMgrRegisterTests();
+    FlowHashRegisterTests();
 #endif /* UNITTESTS */
 }
@@ -45,7 +45,9 @@
 /** At least on packet from the destination address was seen */
 #define FLOW_TO_DST_SEEN                  0x00000002
 
-// vacany 1x
+/** Flow is bypassed: all further packets skip stream, app layer and
+ *  detection, and capture methods may drop them before decoding. */
+#define FLOW_BYPASSED                     0x00000004
 
 /** no magic on files in this flow */
 #define FLOW_FILE_NO_MAGIC_TS             0x00000008
@@ -226,6 +228,10 @@ typedef struct FlowCnf_
     uint32_t emerg_timeout_est;
     uint32_t emergency_recovery;
 
+    /** packets to look ahead when prefetching flow buckets in the
+     *  batched decoders, 0 to disable */
+    uint16_t prefetch_lookahead;
+
 } FlowConfig;
 
 /* Hash key for the flow hash */
@@ -300,6 +306,8 @@ typedef struct Flow_
 
     /** flow queue id, used with autofp */
     SC_ATOMIC_DECLARE(int, autofp_tmqh_flow_qid);
+    /** flow queue id of the autofp app layer threads */
+    SC_ATOMIC_DECLARE(int, autofp_tmqh_applayer_qid);
 
     uint32_t probing_parser_toserver_al_proto_masks;
     uint32_t probing_parser_toclient_al_proto_masks;
@@ -389,7 +397,7 @@ typedef struct FlowProto_ {
     int (*GetProtoState)(void *);
 } FlowProto;
 
-void FlowHandlePacket (ThreadVars *, Packet *);
+void FlowHandlePacket (ThreadVars *, DecodeThreadVars *, Packet *);
 void FlowInitConfig (char);
 void FlowPrintQueueInfo (void);
 void FlowShutdown(void);
@@ -415,6 +423,7 @@ static inline void FlowSetNoPacketInspectionFlag(Flow *);
 static inline void FlowLockSetNoPayloadInspectionFlag(Flow *);
 static inline void FlowSetNoPayloadInspectionFlag(Flow *);
 static inline void FlowSetSessionNoApplayerInspectionFlag(Flow *);
+static inline void FlowSetBypassFlag(Flow *);
 
 int FlowGetPacketDirection(Flow *, Packet *);
 
@@ -486,6 +495,20 @@ static inline void FlowSetSessionNoApplayerInspectionFlag(Flow *f) {
     f->flags |= FLOW_NO_APPLAYER_INSPECTION;
 }
 
+/** \brief bypass the flow: no more stream, app layer or detection work
+ *         is done for its packets.
+ *
+ *  The next packet of the flow will ask the capture method to bypass the
+ *  flow as well, if the capture method supports it.
+ *
+ *  \param f *LOCKED* flow
+ */
+static inline void FlowSetBypassFlag(Flow *f) {
+    SCLogDebug("flow %p", f);
+    f->flags |= (FLOW_BYPASSED | FLOW_NOPACKET_INSPECTION |
+                 FLOW_NOPAYLOAD_INSPECTION | FLOW_NO_APPLAYER_INSPECTION);
+}
+
 #define FlowReference(dst_f_ptr, f) do {            \
         if ((f) != NULL) {                          \
             FlowIncrUsecnt((f));                    \
@@ -70,6 +70,8 @@ void PktVarAdd(Packet *p, char *name, uint8_t *value, uint16_t size) {
         pv->value_len = size;
         pv->next = NULL;
 
+        PACKET_SET_DIRTY(p, PKT_DIRTY_PKTVAR);
+
         PktVar *tpv = p->pktvar;
         if (p->pktvar == NULL) p->pktvar = pv;
         else {
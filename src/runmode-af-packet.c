@@ -144,6 +144,8 @@ void *ParseAFPConfig(const char *iface)
     aconf->flags = 0;
     aconf->bpf_filter = NULL;
     aconf->out_iface = NULL;
+    aconf->block_size = AFP_BLOCK_SIZE_DEFAULT;
+    aconf->block_timeout = AFP_BLOCK_TIMEOUT_DEFAULT;
 
     if (ConfGet("bpf-filter", &bpf_filter) == 1) {
         if (strlen(bpf_filter) > 0) {
@@ -206,6 +208,58 @@ void *ParseAFPConfig(const char *iface)
                 aconf->iface);
         aconf->flags |= AFP_EMERGENCY_MODE;
     }
+    boolval = 0;
+    (void)ConfGetChildValueBoolWithDefault(if_root, if_default, "bypass", (int *)&boolval);
+    if (boolval) {
+        if (aconf->flags & AFP_RING_MODE) {
+            SCLogInfo("Enabling flow bypass on iface %s",
+                    aconf->iface);
+            aconf->flags |= AFP_BYPASS;
+        } else {
+            SCLogInfo("Flow bypass activated but use-mmap "
+                      "set to no. Disabling feature");
+        }
+    }
+    boolval = 0;
+    (void)ConfGetChildValueBoolWithDefault(if_root, if_default, "tpacket-v3", (int *)&boolval);
+    if (boolval) {
+#ifdef HAVE_TPACKET_V3
+        if (aconf->flags & AFP_RING_MODE) {
+            SCLogInfo("Enabling tpacket v3 capture on iface %s",
+                    aconf->iface);
+            aconf->flags |= AFP_TPACKET_V3;
+            if (aconf->flags & AFP_EMERGENCY_MODE) {
+                SCLogInfo("Ring emergency flush is not supported with "
+                          "tpacket v3, disabling it on iface %s", aconf->iface);
+                aconf->flags &= ~AFP_EMERGENCY_MODE;
+            }
+        } else {
+            SCLogInfo("tpacket v3 activated but use-mmap "
+                      "set to no. Disabling feature");
+        }
+#else
+        SCLogInfo("tpacket v3 activated but not supported by the system. "
+                  "Disabling feature");
+#endif
+    }
+    if ((ConfGetChildValueIntWithDefault(if_root, if_default, "block-size", &value)) == 1) {
+        int pagesize = getpagesize();
+        if (value < pagesize) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "block-size %"PRIdMAX" is "
+                         "smaller than a page, using %d", value, pagesize);
+            value = pagesize;
+        }
+        /* the kernel wants page aligned blocks */
+        aconf->block_size = (int)((value + pagesize - 1) / pagesize * pagesize);
+    }
+    if ((ConfGetChildValueIntWithDefault(if_root, if_default, "block-timeout", &value)) == 1) {
+        if (value <= 0) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "invalid block-timeout "
+                         "%"PRIdMAX", using %d", value, AFP_BLOCK_TIMEOUT_DEFAULT);
+        } else {
+            aconf->block_timeout = (int)value;
+        }
+    }
 
 
     aconf->copy_mode = AFP_COPY_MODE_NONE;
@@ -34,6 +34,7 @@
 #include "util-time.h"
 #include "util-cpu.h"
 #include "util-affinity.h"
+#include "util-runmodes.h"
 
 static const char *default_mode;
 
@@ -55,6 +56,12 @@ void RunModeErfFileRegister(void)
         "each flow are assigned to a single detect thread",
         RunModeErfFileAutoFp);
 
+    RunModeRegisterNewRunMode(RUNMODE_ERF_FILE, "workers",
+        "Workers ERF file mode.  Packets are spread over the workers "
+        "by flow before decoding, each worker does all tasks from "
+        "decoding to logging",
+        RunModeErfFileWorkers);
+
     return;
 }
 
@@ -172,7 +179,7 @@ int RunModeErfFileAutoFp(DetectEngineCtx *de_ctx)
     ThreadVars *tv =
         TmThreadCreatePacketHandler("ReceiveErfFile",
                                     "packetpool", "packetpool",
-                                    queues, "flow",
+                                    queues, RunModeAutoFpQueueHandler(),
                                     "pktacqloop");
     if (tv == NULL) {
         printf("ERROR: TmThreadsCreate failed\n");
@@ -203,8 +210,12 @@ int RunModeErfFileAutoFp(DetectEngineCtx *de_ctx)
         exit(EXIT_FAILURE);
     }
 
+    char al_queues[2048] = "";
+    int al_threads = RunModeAutoFpAppLayerQueues(al_queues, sizeof(al_queues));
+
     for (thread = 0; thread < thread_max; thread++) {
-        snprintf(tname, sizeof(tname), "Detect%"PRIu16, thread+1);
+        snprintf(tname, sizeof(tname), "%s%"PRIu16,
+                 al_threads ? "Stream" : "Detect", thread+1);
         snprintf(qname, sizeof(qname), "pickup%"PRIu16, thread+1);
 
         SCLogDebug("tname %s, qname %s", tname, qname);
@@ -218,8 +229,9 @@ int RunModeErfFileAutoFp(DetectEngineCtx *de_ctx)
 
         ThreadVars *tv_detect_ncpu =
             TmThreadCreatePacketHandler(thread_name,
-                                        qname, "flow",
-                                        "packetpool", "packetpool",
+                                        qname, RunModeAutoFpQueueHandler(),
+                                        al_threads ? al_queues : "packetpool",
+                                        al_threads ? RunModeAutoFpQueueHandler() : "packetpool",
                                         "varslot");
         if (tv_detect_ncpu == NULL) {
             printf("ERROR: TmThreadsCreate failed\n");
@@ -232,12 +244,18 @@ int RunModeErfFileAutoFp(DetectEngineCtx *de_ctx)
         }
         TmSlotSetFuncAppend(tv_detect_ncpu, tm_module, NULL);
 
-        tm_module = TmModuleGetByName("Detect");
-        if (tm_module == NULL) {
-            printf("ERROR: TmModuleGetByName Detect failed\n");
-            exit(EXIT_FAILURE);
+        /* with app layer threads detection and outputs run there */
+        if (al_threads == 0) {
+            tm_module = TmModuleGetByName("Detect");
+            if (tm_module == NULL) {
+                printf("ERROR: TmModuleGetByName Detect failed\n");
+                exit(EXIT_FAILURE);
+            }
+            TmSlotSetFuncAppend(tv_detect_ncpu, tm_module, (void *)de_ctx);
+
+            /* add outputs as well */
+            SetupOutputs(tv_detect_ncpu);
         }
-        TmSlotSetFuncAppend(tv_detect_ncpu, tm_module, (void *)de_ctx);
 
         if (threading_set_cpu_affinity) {
             TmThreadSetCPUAffinity(tv_detect_ncpu, (int)cpu);
@@ -252,16 +270,13 @@ int RunModeErfFileAutoFp(DetectEngineCtx *de_ctx)
             }
         }
 
-        char *thread_group_name = SCStrdup("Detect");
+        char *thread_group_name = SCStrdup(al_threads ? "Stream" : "Detect");
         if (unlikely(thread_group_name == NULL)) {
             printf("Error allocating memory\n");
             exit(EXIT_FAILURE);
         }
         tv_detect_ncpu->thread_group_name = thread_group_name;
 
-        /* add outputs as well */
-        SetupOutputs(tv_detect_ncpu);
-
         if (TmThreadSpawn(tv_detect_ncpu) != TM_ECODE_OK) {
             printf("ERROR: TmThreadSpawn failed\n");
             exit(EXIT_FAILURE);
@@ -273,7 +288,35 @@ int RunModeErfFileAutoFp(DetectEngineCtx *de_ctx)
             cpu++;
     }
 
+    if (al_threads > 0) {
+        RunModeAutoFpSetupAppLayerThreads(de_ctx, al_threads,
+                                          "packetpool", "packetpool", 0);
+    }
+
     SCLogInfo("RunModeErfFileAutoFp initialised");
 
     SCReturnInt(0);
 }
+
+int RunModeErfFileWorkers(DetectEngineCtx *de_ctx)
+{
+    SCEnter();
+
+    RunModeInitialize();
+
+    char *file = NULL;
+    if (ConfGet("erf-file.file", &file) == 0) {
+        SCLogError(SC_ERR_RUNMODE,
+            "Failed retrieving erf-file.file from config");
+        exit(EXIT_FAILURE);
+    }
+
+    TimeModeSetOffline();
+
+    RunModeSetFileWorkers(de_ctx, "ReceiveErfFile", "DecodeErfFile",
+                          "ReceiveErfFile", file, 1);
+
+    SCLogInfo("RunModeErfFileWorkers initialised");
+
+    SCReturnInt(0);
+}
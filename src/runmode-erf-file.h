@@ -25,6 +25,7 @@
 
 int RunModeErfFileSingle(DetectEngineCtx *);
 int RunModeErfFileAutoFp(DetectEngineCtx *);
+int RunModeErfFileWorkers(DetectEngineCtx *);
 void RunModeErfFileRegister(void);
 const char *RunModeErfFileGetDefaultMode(void);
 
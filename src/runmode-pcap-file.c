@@ -24,6 +24,7 @@
 #include "output.h"
 #include "cuda-packet-batcher.h"
 #include "source-pfring.h"
+#include "source-pcap-file.h"
 #include "detect-engine-mpm.h"
 
 #include "alert-fastlog.h"
@@ -35,6 +36,7 @@
 #include "util-time.h"
 #include "util-cpu.h"
 #include "util-affinity.h"
+#include "util-runmodes.h"
 
 static const char *default_mode = NULL;
 
@@ -59,6 +61,11 @@ void RunModeFilePcapRegister(void)
                               "the same flow can be processed by any detect "
                               "thread",
                               RunModeFilePcapAutoFp);
+    RunModeRegisterNewRunMode(RUNMODE_PCAP_FILE, "workers",
+                              "Workers pcap file mode.  Packets are spread "
+                              "over the workers by flow before decoding, each "
+                              "worker does all tasks from decoding to logging",
+                              RunModeFilePcapWorkers);
 
     return;
 }
@@ -378,7 +385,7 @@ int RunModeFilePcapAuto(DetectEngineCtx *de_ctx)
 int RunModeFilePcapAutoFp(DetectEngineCtx *de_ctx)
 {
     SCEnter();
-    char tname[12];
+    char tname[16];
     char qname[12];
     uint16_t cpu = 0;
     char queues[2048] = "";
@@ -419,39 +426,69 @@ int RunModeFilePcapAutoFp(DetectEngineCtx *de_ctx)
 
     TimeModeSetOffline();
 
-    /* create the threads */
-    ThreadVars *tv_receivepcap =
-        TmThreadCreatePacketHandler("ReceivePcapFile",
-                                    "packetpool", "packetpool",
-                                    queues, "flow",
-                                    "pktacqloop");
-    if (tv_receivepcap == NULL) {
-        printf("ERROR: TmThreadsCreate failed\n");
-        exit(EXIT_FAILURE);
-    }
-    TmModule *tm_module = TmModuleGetByName("ReceivePcapFile");
-    if (tm_module == NULL) {
-        printf("ERROR: TmModuleGetByName failed for ReceivePcap\n");
-        exit(EXIT_FAILURE);
-    }
-    TmSlotSetFuncAppend(tv_receivepcap, tm_module, file);
+    /* with the mmap reader several threads can read the files, the flow
+     * queue handler keeps the packets of a flow on one pickup queue */
+    TmModule *tm_module;
+    int rx_threads = PcapFileGetReceiveThreads();
+    int rx;
+    for (rx = 0; rx < rx_threads; rx++) {
+        char *rx_name = "ReceivePcapFile";
+        if (rx_threads > 1) {
+            snprintf(tname, sizeof(tname), "RxPcapFile%d", rx+1);
+            rx_name = SCStrdup(tname);
+            if (unlikely(rx_name == NULL)) {
+                printf("ERROR: Can not strdup thread name\n");
+                exit(EXIT_FAILURE);
+            }
+        }
 
-    tm_module = TmModuleGetByName("DecodePcapFile");
-    if (tm_module == NULL) {
-        printf("ERROR: TmModuleGetByName DecodePcap failed\n");
-        exit(EXIT_FAILURE);
-    }
-    TmSlotSetFuncAppend(tv_receivepcap, tm_module, NULL);
+        /* create the threads */
+        ThreadVars *tv_receivepcap =
+            TmThreadCreatePacketHandler(rx_name,
+                                        "packetpool", "packetpool",
+                                        queues, RunModeAutoFpQueueHandler(),
+                                        "pktacqloop");
+        if (tv_receivepcap == NULL) {
+            printf("ERROR: TmThreadsCreate failed\n");
+            exit(EXIT_FAILURE);
+        }
+        tm_module = TmModuleGetByName("ReceivePcapFile");
+        if (tm_module == NULL) {
+            printf("ERROR: TmModuleGetByName failed for ReceivePcap\n");
+            exit(EXIT_FAILURE);
+        }
+        TmSlotSetFuncAppend(tv_receivepcap, tm_module, file);
 
-    TmThreadSetCPU(tv_receivepcap, RECEIVE_CPU_SET);
+        tm_module = TmModuleGetByName("DecodePcapFile");
+        if (tm_module == NULL) {
+            printf("ERROR: TmModuleGetByName DecodePcap failed\n");
+            exit(EXIT_FAILURE);
+        }
+        TmSlotSetFuncAppend(tv_receivepcap, tm_module, NULL);
 
-    if (TmThreadSpawn(tv_receivepcap) != TM_ECODE_OK) {
-        printf("ERROR: TmThreadSpawn failed\n");
-        exit(EXIT_FAILURE);
+        if (rx_threads > 1) {
+            char *thread_group_name = SCStrdup("ReceivePcapFile");
+            if (unlikely(thread_group_name == NULL)) {
+                printf("Error allocating memory\n");
+                exit(EXIT_FAILURE);
+            }
+            tv_receivepcap->thread_group_name = thread_group_name;
+        }
+
+        TmThreadSetCPU(tv_receivepcap, RECEIVE_CPU_SET);
+
+        if (TmThreadSpawn(tv_receivepcap) != TM_ECODE_OK) {
+            printf("ERROR: TmThreadSpawn failed\n");
+            exit(EXIT_FAILURE);
+        }
     }
 
+    char al_queues[2048] = "";
+    int al_threads = RunModeAutoFpAppLayerQueues(al_queues, sizeof(al_queues));
+
     for (thread = 0; thread < thread_max; thread++) {
-        snprintf(tname, sizeof(tname), "Detect%"PRIu16, thread+1);
+        snprintf(tname, sizeof(tname), "%s%"PRIu16,
+                 al_threads ? "Stream" : "Detect", thread+1);
         snprintf(qname, sizeof(qname), "pickup%"PRIu16, thread+1);
 
         SCLogDebug("tname %s, qname %s", tname, qname);
@@ -465,8 +502,9 @@ int RunModeFilePcapAutoFp(DetectEngineCtx *de_ctx)
 
         ThreadVars *tv_detect_ncpu =
             TmThreadCreatePacketHandler(thread_name,
-                                        qname, "flow",
-                                        "packetpool", "packetpool",
+                                        qname, RunModeAutoFpQueueHandler(),
+                                        al_threads ? al_queues : "packetpool",
+                                        al_threads ? RunModeAutoFpQueueHandler() : "packetpool",
                                         "varslot");
         if (tv_detect_ncpu == NULL) {
             printf("ERROR: TmThreadsCreate failed\n");
@@ -479,24 +517,27 @@ int RunModeFilePcapAutoFp(DetectEngineCtx *de_ctx)
         }
         TmSlotSetFuncAppend(tv_detect_ncpu, tm_module, NULL);
 
-        tm_module = TmModuleGetByName("Detect");
-        if (tm_module == NULL) {
-            printf("ERROR: TmModuleGetByName Detect failed\n");
-            exit(EXIT_FAILURE);
+        /* with app layer threads detection and outputs run there */
+        if (al_threads == 0) {
+            tm_module = TmModuleGetByName("Detect");
+            if (tm_module == NULL) {
+                printf("ERROR: TmModuleGetByName Detect failed\n");
+                exit(EXIT_FAILURE);
+            }
+            TmSlotSetFuncAppend(tv_detect_ncpu, tm_module, (void *)de_ctx);
+
+            /* add outputs as well */
+            SetupOutputs(tv_detect_ncpu);
         }
-        TmSlotSetFuncAppend(tv_detect_ncpu, tm_module, (void *)de_ctx);
 
 
-        char *thread_group_name = SCStrdup("Detect");
+        char *thread_group_name = SCStrdup(al_threads ? "Stream" : "Detect");
         if (unlikely(thread_group_name == NULL)) {
             printf("Error allocating memory\n");
             exit(EXIT_FAILURE);
         }
         tv_detect_ncpu->thread_group_name = thread_group_name;
 
-        /* add outputs as well */
-        SetupOutputs(tv_detect_ncpu);
-
         TmThreadSetCPU(tv_detect_ncpu, DETECT_CPU_SET);
 
         if (TmThreadSpawn(tv_detect_ncpu) != TM_ECODE_OK) {
@@ -510,5 +551,43 @@ int RunModeFilePcapAutoFp(DetectEngineCtx *de_ctx)
             cpu++;
     }
 
+    if (al_threads > 0) {
+        RunModeAutoFpSetupAppLayerThreads(de_ctx, al_threads,
+                                          "packetpool", "packetpool", 0);
+    }
+
+    return 0;
+}
+
+/**
+ * \brief RunModeFilePcapWorkers set up the following thread packet handlers:
+ *        - Receive thread(s) (from pcap file), passing the packets on by
+ *          flow
+ *        - Worker threads: decode, stream, detect and outputs
+ *
+ * \param de_ctx Pointer to the Detection Engine
+ *
+ * \retval 0 If all goes well. (If any problem is detected the engine will
+ *           exit()).
+ */
+int RunModeFilePcapWorkers(DetectEngineCtx *de_ctx)
+{
+    SCEnter();
+
+    RunModeInitialize();
+
+    char *file = NULL;
+    if (ConfGet("pcap-file.file", &file) == 0) {
+        SCLogError(SC_ERR_RUNMODE, "Failed retrieving pcap-file from Conf");
+        exit(EXIT_FAILURE);
+    }
+    SCLogDebug("file %s", file);
+
+    TimeModeSetOffline();
+
+    RunModeSetFileWorkers(de_ctx, "ReceivePcapFile", "DecodePcapFile",
+                          "RxPcapFile", file, PcapFileGetReceiveThreads());
+
+    SCLogInfo("RunModeFilePcapWorkers initialised");
     return 0;
 }
@@ -26,6 +26,7 @@
 int RunModeFilePcapSingle(DetectEngineCtx *);
 int RunModeFilePcapAuto(DetectEngineCtx *);
 int RunModeFilePcapAutoFp(DetectEngineCtx *de_ctx);
+int RunModeFilePcapWorkers(DetectEngineCtx *de_ctx);
 void RunModeFilePcapRegister(void);
 const char *RunModeFilePcapGetDefaultMode(void);
 
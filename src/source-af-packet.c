@@ -36,6 +36,7 @@
 #include "config.h"
 #include "suricata.h"
 #include "decode.h"
+#include "decode-fast.h"
 #include "packet-queue.h"
 #include "threads.h"
 #include "threadvars.h"
@@ -52,6 +53,8 @@
 #include "util-checksum.h"
 #include "util-ioctl.h"
 #include "tmqh-packetpool.h"
+#include "flow-bypass.h"
+#include "flow-hash.h"
 #include "source-af-packet.h"
 #include "runmodes.h"
 
@@ -156,9 +159,32 @@ enum {
 
 union thdr {
     struct tpacket2_hdr *h2;
+#ifdef HAVE_TPACKET_V3
+    struct tpacket3_hdr *h3;
+#endif
     void *raw;
 };
 
+#ifdef HAVE_TPACKET_V3
+/**
+ * \brief tpacket v3 block state
+ *
+ * Lives in the private area the kernel reserves at the start of each
+ * block. Zero copy packets hold a reference to their block, the block is
+ * handed back to the kernel when the last reference is dropped.
+ */
+typedef struct AFPBlockPriv_ {
+    /** packets in flight plus one for the reader while it walks the block */
+    uint32_t refs;
+    /** set once the reader has walked the block, until it is back with
+     *  the kernel */
+    volatile uint32_t walked;
+} AFPBlockPriv;
+
+#define AFP_BLOCK_PRIV(pbd) \
+    ((AFPBlockPriv *)((uint8_t *)(pbd) + (pbd)->offset_to_priv))
+#endif
+
 /**
  * \brief Structure to hold thread specific variables.
  */
@@ -203,6 +229,10 @@ typedef struct AFPThreadVars_
     int flags;
     uint16_t capture_kernel_packets;
     uint16_t capture_kernel_drops;
+    uint16_t capture_bypassed;
+
+    /** flows bypassed by the engine, dropped before decoding */
+    FlowBypassTable *bypass_table;
 
     int cluster_id;
     int cluster_type;
@@ -211,6 +241,14 @@ typedef struct AFPThreadVars_
     int copy_mode;
 
     struct tpacket_req req;
+#ifdef HAVE_TPACKET_V3
+    struct tpacket_req3 req3;
+    unsigned int block_offset;
+    int block_size;
+    int block_timeout;
+    uint16_t capture_block_fill;
+    uint16_t capture_block_timeouts;
+#endif
     unsigned int tp_hdrlen;
     unsigned int ring_buflen;
     char *ring_buf;
@@ -228,6 +266,7 @@ TmEcode ReceiveAFPLoop(ThreadVars *tv, void *data, void *slot);
 
 TmEcode DecodeAFPThreadInit(ThreadVars *, void *, void **);
 TmEcode DecodeAFP(ThreadVars *, Packet *, void *, PacketQueue *, PacketQueue *);
+TmEcode DecodeAFPBatch(ThreadVars *, Packet **, uint16_t, void *, PacketQueue *, PacketQueue *);
 
 TmEcode AFPSetBPFFilter(AFPThreadVars *ptv);
 static int AFPGetIfnumByDev(int fd, const char *ifname, int verbose);
@@ -458,6 +497,7 @@ void TmModuleDecodeAFPRegister (void) {
     tmm_modules[TMM_DECODEAFP].name = "DecodeAFP";
     tmm_modules[TMM_DECODEAFP].ThreadInit = DecodeAFPThreadInit;
     tmm_modules[TMM_DECODEAFP].Func = DecodeAFP;
+    tmm_modules[TMM_DECODEAFP].FuncBatch = DecodeAFPBatch;
     tmm_modules[TMM_DECODEAFP].ThreadExitPrintStats = NULL;
     tmm_modules[TMM_DECODEAFP].ThreadDeinit = NULL;
     tmm_modules[TMM_DECODEAFP].RegisterTests = NULL;
@@ -601,8 +641,8 @@ int AFPRead(AFPThreadVars *ptv)
         break;
     }
 
+    /* on failure the packet is already back in the pool */
     if (TmThreadsSlotProcessPkt(ptv->tv, ptv->slot, p) != TM_ECODE_OK) {
-        TmqhOutputPacketpool(ptv->tv, p);
         SCReturnInt(AFP_FAILURE);
     }
     SCReturnInt(AFP_READ_OK);
@@ -676,6 +716,89 @@ cleanup:
     return ret;
 }
 
+#ifdef HAVE_TPACKET_V3
+/**
+ * \brief drop a reference to a tpacket v3 block
+ *
+ * The last reference hands the block back to the kernel.
+ */
+static inline void AFPBlockDeref(struct tpacket_block_desc *pbd)
+{
+    AFPBlockPriv *priv = AFP_BLOCK_PRIV(pbd);
+
+    if (SCAtomicSubAndFetch(&priv->refs, 1) == 0) {
+        pbd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+        /* the reader checks walked before the status, so it can't see
+         * the old TP_STATUS_USER of a block that is no longer walked */
+        hw_barrier();
+        priv->walked = 0;
+    }
+}
+
+TmEcode AFPReleaseDataFromBlock(ThreadVars *t, Packet *p)
+{
+    int ret = TM_ECODE_OK;
+    /* Need to be in copy mode and need to detect early release
+       where Ethernet header could not be set (and pseudo packet) */
+    if ((p->afp_v.copy_mode != AFP_COPY_MODE_NONE) && !PKT_IS_PSEUDOPKT(p)) {
+        ret = AFPWritePacket(p);
+    }
+
+    if (AFPDerefSocket(p->afp_v.mpeer) == 0)
+        goto cleanup;
+
+    if (p->afp_v.relptr) {
+        AFPBlockDeref((struct tpacket_block_desc *)p->afp_v.relptr);
+    }
+
+cleanup:
+    AFPV_CLEANUP(&p->afp_v);
+    return ret;
+}
+#endif /* HAVE_TPACKET_V3 */
+
+/**
+ * \brief Bypass callback: add the flow of the packet to the bypass
+ *        table of the capture thread
+ *
+ * \retval 1 flow is bypassed in capture
+ * \retval 0 flow can't be bypassed here
+ */
+static int AFPBypassCallback(Packet *p)
+{
+    if (p->afp_v.bypass_table == NULL)
+        return 0;
+
+    return FlowBypassTableAdd(p->afp_v.bypass_table, p);
+}
+
+/**
+ * \brief set the checksum flags of a packet read from the ring
+ *
+ * \param tp_status status of the frame
+ */
+static inline void AFPSetChecksumMode(AFPThreadVars *ptv, Packet *p,
+                                      uint32_t tp_status)
+{
+    /* We only check for checksum disable */
+    if (ptv->checksum_mode == CHECKSUM_VALIDATION_DISABLE) {
+        p->flags |= PKT_IGNORE_CHECKSUM;
+    } else if (ptv->checksum_mode == CHECKSUM_VALIDATION_AUTO) {
+        if (ptv->livedev->ignore_checksum) {
+            p->flags |= PKT_IGNORE_CHECKSUM;
+        } else if (ChecksumAutoModeCheck(ptv->pkts,
+                    SC_ATOMIC_GET(ptv->livedev->pkts),
+                    SC_ATOMIC_GET(ptv->livedev->invalid_checksums))) {
+            ptv->livedev->ignore_checksum = 1;
+            p->flags |= PKT_IGNORE_CHECKSUM;
+        }
+    } else {
+        if (tp_status & TP_STATUS_CSUMNOTREADY) {
+            p->flags |= PKT_IGNORE_CHECKSUM;
+        }
+    }
+}
+
 /**
  * \brief AF packet read function for ring
  *
@@ -740,6 +863,20 @@ int AFPReadFromRing(AFPThreadVars *ptv)
             goto next_frame;
         }
 
+        /* frames of bypassed flows go straight back to the kernel */
+        if (ptv->bypass_table != NULL && ptv->datalink == LINKTYPE_ETHERNET &&
+            FlowBypassTableLookupEthernet(ptv->bypass_table,
+                (uint8_t *)h.raw + h.h2->tp_mac, h.h2->tp_snaplen,
+                h.h2->tp_sec) == 1)
+        {
+            ptv->pkts++;
+            ptv->bytes += h.h2->tp_len;
+            (void) SC_ATOMIC_ADD(ptv->livedev->pkts, 1);
+            SCPerfCounterIncr(ptv->capture_bypassed, ptv->tv->sc_perf_pca);
+            h.h2->tp_status = TP_STATUS_KERNEL;
+            goto next_frame;
+        }
+
         p = PacketGetFromQueueOrAlloc();
         if (p == NULL) {
             SCReturnInt(AFP_FAILURE);
@@ -793,29 +930,17 @@ int AFPReadFromRing(AFPThreadVars *ptv)
                 SCReturnInt(AFP_FAILURE);
             }
         }
+        if (ptv->bypass_table != NULL) {
+            p->afp_v.bypass_table = ptv->bypass_table;
+            p->BypassPacketsFlow = AFPBypassCallback;
+        }
         /* Timestamp */
         p->ts.tv_sec = h.h2->tp_sec;
         p->ts.tv_usec = h.h2->tp_nsec/1000;
         SCLogDebug("pktlen: %" PRIu32 " (pkt %p, pkt data %p)",
                 GET_PKT_LEN(p), p, GET_PKT_DATA(p));
 
-        /* We only check for checksum disable */
-        if (ptv->checksum_mode == CHECKSUM_VALIDATION_DISABLE) {
-            p->flags |= PKT_IGNORE_CHECKSUM;
-        } else if (ptv->checksum_mode == CHECKSUM_VALIDATION_AUTO) {
-            if (ptv->livedev->ignore_checksum) {
-                p->flags |= PKT_IGNORE_CHECKSUM;
-            } else if (ChecksumAutoModeCheck(ptv->pkts,
-                        SC_ATOMIC_GET(ptv->livedev->pkts),
-                        SC_ATOMIC_GET(ptv->livedev->invalid_checksums))) {
-                ptv->livedev->ignore_checksum = 1;
-                p->flags |= PKT_IGNORE_CHECKSUM;
-            }
-        } else {
-            if (h.h2->tp_status & TP_STATUS_CSUMNOTREADY) {
-                p->flags |= PKT_IGNORE_CHECKSUM;
-            }
-        }
+        AFPSetChecksumMode(ptv, p, h.h2->tp_status);
         if (h.h2->tp_status & TP_STATUS_LOSING) {
             emergency_flush = 1;
             AFPDumpCounters(ptv);
@@ -826,12 +951,12 @@ int AFPReadFromRing(AFPThreadVars *ptv)
             h.h2->tp_status = TP_STATUS_KERNEL;
         }
 
-        if (TmThreadsSlotProcessPkt(ptv->tv, ptv->slot, p) != TM_ECODE_OK) {
+        if (TmThreadsSlotProcessPktBatched(ptv->tv, ptv->slot, p) != TM_ECODE_OK) {
             h.h2->tp_status = TP_STATUS_KERNEL;
             if (++ptv->frame_offset >= ptv->req.tp_frame_nr) {
                 ptv->frame_offset = 0;
             }
-            TmqhOutputPacketpool(ptv->tv, p);
+            /* the packet is already back in the pool */
             SCReturnInt(AFP_FAILURE);
         }
 
@@ -846,6 +971,169 @@ next_frame:
     SCReturnInt(AFP_READ_OK);
 }
 
+#ifdef HAVE_TPACKET_V3
+/**
+ * \brief hand a packet of a tpacket v3 block to the engine
+ *
+ * The packet data stays in the block, the packet holds a reference to
+ * the block until it is released.
+ */
+static inline int AFPParsePacketV3(AFPThreadVars *ptv,
+                                   struct tpacket_block_desc *pbd,
+                                   struct tpacket3_hdr *ppd)
+{
+    Packet *p = NULL;
+    struct sockaddr_ll *from;
+    uint8_t *pkt_data = (uint8_t *)ppd + ppd->tp_mac;
+
+    /* packets of bypassed flows are skipped, the block goes back to the
+     * kernel when the other packets are done */
+    if (ptv->bypass_table != NULL && ptv->datalink == LINKTYPE_ETHERNET &&
+        FlowBypassTableLookupEthernet(ptv->bypass_table, pkt_data,
+            ppd->tp_snaplen, ppd->tp_sec) == 1)
+    {
+        ptv->pkts++;
+        ptv->bytes += ppd->tp_len;
+        (void) SC_ATOMIC_ADD(ptv->livedev->pkts, 1);
+        SCPerfCounterIncr(ptv->capture_bypassed, ptv->tv->sc_perf_pca);
+        return AFP_READ_OK;
+    }
+
+    p = PacketGetFromQueueOrAlloc();
+    if (p == NULL) {
+        return AFP_FAILURE;
+    }
+    PKT_SET_SRC(p, PKT_SRC_WIRE);
+
+    from = (void *)ppd + TPACKET_ALIGN(ptv->tp_hdrlen);
+
+    ptv->pkts++;
+    ptv->bytes += ppd->tp_len;
+    (void) SC_ATOMIC_ADD(ptv->livedev->pkts, 1);
+    p->livedev = ptv->livedev;
+
+    /* add forged header */
+    if (ptv->cooked) {
+        SllHdr * hdrp = (SllHdr *)ptv->data;
+        /* XXX this is minimalist, but this seems enough */
+        hdrp->sll_protocol = from->sll_protocol;
+    }
+
+    p->datalink = ptv->datalink;
+    if (PacketSetData(p, pkt_data, ppd->tp_snaplen) == -1) {
+        TmqhOutputPacketpool(ptv->tv, p);
+        return AFP_FAILURE;
+    }
+    (void) SCAtomicAddAndFetch(&AFP_BLOCK_PRIV(pbd)->refs, 1);
+    p->afp_v.relptr = pbd;
+    p->ReleaseData = AFPReleaseDataFromBlock;
+    p->afp_v.mpeer = ptv->mpeer;
+    AFPRefSocket(ptv->mpeer);
+
+    p->afp_v.copy_mode = ptv->copy_mode;
+    if (p->afp_v.copy_mode != AFP_COPY_MODE_NONE) {
+        p->afp_v.peer = ptv->mpeer->peer;
+    } else {
+        p->afp_v.peer = NULL;
+    }
+    if (ptv->bypass_table != NULL) {
+        p->afp_v.bypass_table = ptv->bypass_table;
+        p->BypassPacketsFlow = AFPBypassCallback;
+    }
+
+    p->rxhash = ppd->hv1.tp_rxhash;
+
+    /* Timestamp */
+    p->ts.tv_sec = ppd->tp_sec;
+    p->ts.tv_usec = ppd->tp_nsec/1000;
+    SCLogDebug("pktlen: %" PRIu32 " (pkt %p, pkt data %p)",
+            GET_PKT_LEN(p), p, GET_PKT_DATA(p));
+
+    AFPSetChecksumMode(ptv, p, ppd->tp_status);
+
+    /* on failure the packet is already back in the pool */
+    if (TmThreadsSlotProcessPktBatched(ptv->tv, ptv->slot, p) != TM_ECODE_OK) {
+        return AFP_FAILURE;
+    }
+    return AFP_READ_OK;
+}
+
+/**
+ * \brief walk the packets of a tpacket v3 block
+ */
+static inline int AFPWalkBlock(AFPThreadVars *ptv, struct tpacket_block_desc *pbd)
+{
+    AFPBlockPriv *priv = AFP_BLOCK_PRIV(pbd);
+    uint32_t num_pkts = pbd->hdr.bh1.num_pkts;
+    struct tpacket3_hdr *ppd = (struct tpacket3_hdr *)((uint8_t *)pbd +
+            pbd->hdr.bh1.offset_to_first_pkt);
+    int r = AFP_READ_OK;
+    uint32_t i;
+
+    /* the reader holds a reference while walking, so the block can't go
+     * back to the kernel before all its packets are out */
+    priv->refs = 1;
+    priv->walked = 1;
+
+    if (pbd->hdr.bh1.block_status & TP_STATUS_BLK_TMO) {
+        SCPerfCounterIncr(ptv->capture_block_timeouts, ptv->tv->sc_perf_pca);
+    }
+    SCPerfCounterAddUI64(ptv->capture_block_fill, ptv->tv->sc_perf_pca,
+            (uint64_t)pbd->hdr.bh1.blk_len * 100 / ptv->req3.tp_block_size);
+
+    for (i = 0; i < num_pkts; i++) {
+        r = AFPParsePacketV3(ptv, pbd, ppd);
+        if (r != AFP_READ_OK)
+            break;
+        ppd = (struct tpacket3_hdr *)((uint8_t *)ppd + ppd->tp_next_offset);
+    }
+
+    AFPBlockDeref(pbd);
+    return r;
+}
+
+/**
+ * \brief AF packet read function for tpacket v3 rings
+ *
+ * Walks the blocks the kernel has retired, in ring order. Stops at the
+ * first block that is still with the kernel or still held by packets of
+ * its previous round.
+ *
+ * \retval AFP_READ_OK or AFP_FAILURE
+ */
+int AFPReadFromBlocks(AFPThreadVars *ptv)
+{
+    unsigned int blocks;
+
+    for (blocks = 0; blocks < ptv->req3.tp_block_nr; blocks++) {
+        if (unlikely(suricata_ctl_flags != 0)) {
+            break;
+        }
+
+        struct tpacket_block_desc *pbd = (struct tpacket_block_desc *)
+            (ptv->ring_buf + ptv->block_offset * ptv->req3.tp_block_size);
+
+        if (AFP_BLOCK_PRIV(pbd)->walked) {
+            SCReturnInt(AFP_READ_OK);
+        }
+        hw_barrier();
+        if (!(pbd->hdr.bh1.block_status & TP_STATUS_USER)) {
+            SCReturnInt(AFP_READ_OK);
+        }
+
+        int r = AFPWalkBlock(ptv, pbd);
+        if (++ptv->block_offset >= ptv->req3.tp_block_nr) {
+            ptv->block_offset = 0;
+        }
+        if (r != AFP_READ_OK) {
+            SCReturnInt(r);
+        }
+    }
+
+    SCReturnInt(AFP_READ_OK);
+}
+#endif /* HAVE_TPACKET_V3 */
+
 /**
  * \brief Reference socket
  *
@@ -1027,7 +1315,16 @@ TmEcode ReceiveAFPLoop(ThreadVars *tv, void *data, void *slot)
             }
         } else if (r > 0) {
             if (ptv->flags & AFP_RING_MODE) {
+#ifdef HAVE_TPACKET_V3
+                if (ptv->flags & AFP_TPACKET_V3)
+                    r = AFPReadFromBlocks(ptv);
+                else
+#endif
                 r = AFPReadFromRing(ptv);
+                /* don't sit on a partial batch while polling */
+                if (TmThreadsSlotFlushBatch(ptv->tv, ptv->slot) != TM_ECODE_OK) {
+                    r = AFP_FAILURE;
+                }
             } else {
                 /* AFPRead will call TmThreadsSlotProcessPkt on read packets */
                 r = AFPRead(ptv);
@@ -1063,7 +1360,6 @@ TmEcode ReceiveAFPLoop(ThreadVars *tv, void *data, void *slot)
             AFPSwitchState(ptv, AFP_STATE_DOWN);
             continue;
         }
-        SCPerfSyncCountersIfSignalled(tv, 0);
     }
 
     SCReturnInt(TM_ECODE_OK);
@@ -1171,6 +1467,90 @@ frame size: TPACKET_ALIGN(snaplen + TPACKET_ALIGN(TPACKET_ALIGN(tp_hdrlen) + siz
     return 1;
 }
 
+#ifdef HAVE_TPACKET_V3
+static int AFPComputeRingParamsV3(AFPThreadVars *ptv)
+{
+    /* packets are packed in the blocks, the frame size is only used by
+     * the kernel to check the ring geometry */
+    int snaplen = default_packet_size;
+    unsigned int frame_size = TPACKET_ALIGN(snaplen + TPACKET_ALIGN(TPACKET_ALIGN(ptv->tp_hdrlen) + sizeof(struct sockaddr_ll) + ETH_HLEN) - ETH_HLEN);
+    unsigned int frames_per_block = ptv->block_size / frame_size;
+    if (frames_per_block == 0) {
+        SCLogError(SC_ERR_AFP_CREATE, "block-size %d is too small for "
+                   "snaplen %d", ptv->block_size, snaplen);
+        return -1;
+    }
+
+    memset(&ptv->req3, 0, sizeof(ptv->req3));
+    ptv->req3.tp_block_size = ptv->block_size;
+    ptv->req3.tp_frame_size = frame_size;
+    ptv->req3.tp_block_nr = ptv->ring_size / frames_per_block + 1;
+    /* exact division */
+    ptv->req3.tp_frame_nr = ptv->req3.tp_block_nr * frames_per_block;
+    ptv->req3.tp_retire_blk_tov = ptv->block_timeout;
+    ptv->req3.tp_sizeof_priv = sizeof(AFPBlockPriv);
+    ptv->req3.tp_feature_req_word = TP_FT_REQ_FILL_RXHASH;
+    SCLogInfo("AF_PACKET V3 RX Ring params: block_size=%d block_nr=%d "
+              "frame_size=%d frame_nr=%d block_timeout=%dms",
+              ptv->req3.tp_block_size, ptv->req3.tp_block_nr,
+              ptv->req3.tp_frame_size, ptv->req3.tp_frame_nr,
+              ptv->req3.tp_retire_blk_tov);
+    return 1;
+}
+
+static int AFPSetupRingV3(AFPThreadVars *ptv, char *devname)
+{
+    int r;
+    int val = TPACKET_V3;
+    unsigned int len = sizeof(val);
+
+    if (getsockopt(ptv->socket, SOL_PACKET, PACKET_HDRLEN, &val, &len) < 0) {
+        if (errno == EINVAL) {
+            SCLogError(SC_ERR_AFP_CREATE,
+                       "Too old kernel for tpacket v3 (need 3.2 at least)");
+        }
+        SCLogError(SC_ERR_AFP_CREATE, "Error when retrieving packet header len");
+        return -1;
+    }
+    ptv->tp_hdrlen = val;
+
+    val = TPACKET_V3;
+    if (setsockopt(ptv->socket, SOL_PACKET, PACKET_VERSION, &val,
+                sizeof(val)) < 0) {
+        SCLogError(SC_ERR_AFP_CREATE,
+                   "Can't activate TPACKET_V3 on packet socket: %s",
+                   strerror(errno));
+        return -1;
+    }
+
+    if (AFPComputeRingParamsV3(ptv) != 1) {
+        return -1;
+    }
+
+    r = setsockopt(ptv->socket, SOL_PACKET, PACKET_RX_RING,
+                   (void *) &ptv->req3, sizeof(ptv->req3));
+    if (r < 0) {
+        SCLogError(SC_ERR_MEM_ALLOC,
+                "Unable to allocate RX Ring for iface %s: (%d) %s",
+                devname,
+                errno,
+                strerror(errno));
+        return -1;
+    }
+
+    /* Allocate the Ring */
+    ptv->ring_buflen = ptv->req3.tp_block_nr * ptv->req3.tp_block_size;
+    ptv->ring_buf = mmap(0, ptv->ring_buflen, PROT_READ|PROT_WRITE,
+            MAP_SHARED, ptv->socket, 0);
+    if (ptv->ring_buf == MAP_FAILED) {
+        SCLogError(SC_ERR_MEM_ALLOC, "Unable to mmap");
+        return -1;
+    }
+    ptv->block_offset = 0;
+    return 0;
+}
+#endif /* HAVE_TPACKET_V3 */
+
 static int AFPCreateSocket(AFPThreadVars *ptv, char *devname, int verbose)
 {
     int r;
@@ -1274,6 +1654,13 @@ static int AFPCreateSocket(AFPThreadVars *ptv, char *devname, int verbose)
         goto frame_err;
     }
 
+#ifdef HAVE_TPACKET_V3
+    if ((ptv->flags & AFP_RING_MODE) && (ptv->flags & AFP_TPACKET_V3)) {
+        if (AFPSetupRingV3(ptv, devname) != 0) {
+            goto socket_err;
+        }
+    } else
+#endif
     if (ptv->flags & AFP_RING_MODE) {
         int val = TPACKET_V2;
         unsigned int len = sizeof(val);
@@ -1491,6 +1878,10 @@ TmEcode ReceiveAFPThreadInit(ThreadVars *tv, void *initdata, void **data) {
 
     ptv->buffer_size = afpconfig->buffer_size;
     ptv->ring_size = afpconfig->ring_size;
+#ifdef HAVE_TPACKET_V3
+    ptv->block_size = afpconfig->block_size;
+    ptv->block_timeout = afpconfig->block_timeout;
+#endif
 
     ptv->promisc = afpconfig->promisc;
     ptv->checksum_mode = afpconfig->checksum_mode;
@@ -1523,9 +1914,48 @@ TmEcode ReceiveAFPThreadInit(ThreadVars *tv, void *initdata, void **data) {
             SC_PERF_TYPE_UINT64,
             "NULL");
 #endif
+#ifdef HAVE_TPACKET_V3
+    if (ptv->flags & AFP_TPACKET_V3) {
+        /* percentage of the block used when it was retired */
+        ptv->capture_block_fill = SCPerfTVRegisterAvgCounter("capture.block_fill",
+                ptv->tv,
+                SC_PERF_TYPE_UINT64,
+                "NULL");
+        /* blocks retired by the timeout instead of filling up */
+        ptv->capture_block_timeouts = SCPerfTVRegisterCounter("capture.block_timeouts",
+                ptv->tv,
+                SC_PERF_TYPE_UINT64,
+                "NULL");
+    }
+#endif
 
     char *active_runmode = RunmodeGetActive();
 
+    if (ptv->flags & AFP_BYPASS) {
+        if (afpconfig->copy_mode != AFP_COPY_MODE_NONE) {
+            /* packets of a bypassed flow would not be copied anymore */
+            SCLogWarning(SC_WARN_UNCOMMON, "bypass is not supported in "
+                         "IPS/TAP mode, disabling it on %s", ptv->iface);
+        } else {
+            /* in workers mode the flows are bypassed by this thread, the
+             * table is only locked if other threads add to it */
+            int shared = !(active_runmode != NULL &&
+                           strcmp(active_runmode, "workers") == 0);
+            ptv->bypass_table = FlowBypassTableAlloc(FLOW_BYPASS_TABLE_SIZE,
+                                                     FLOW_BYPASS_TIMEOUT,
+                                                     shared);
+            if (ptv->bypass_table == NULL) {
+                SCLogWarning(SC_ERR_MEM_ALLOC, "unable to allocate bypass "
+                             "table, disabling bypass on %s", ptv->iface);
+            } else {
+                ptv->capture_bypassed = SCPerfTVRegisterCounter("capture.bypassed",
+                        ptv->tv,
+                        SC_PERF_TYPE_UINT64,
+                        "NULL");
+            }
+        }
+    }
+
     if (active_runmode && !strcmp("workers", active_runmode)) {
         ptv->flags |= AFP_ZERO_COPY;
         SCLogInfo("Enabling zero copy mode");
@@ -1627,6 +2057,31 @@ TmEcode ReceiveAFPThreadDeinit(ThreadVars *tv, void *data) {
  * \param data pointer that gets cast into AFPThreadVars for ptv
  * \param pq pointer to the current PacketQueue
  */
+static inline void DecodeAFPPacket(ThreadVars *tv, DecodeThreadVars *dtv,
+                                   Packet *p, PacketQueue *pq)
+{
+    switch(p->datalink) {
+        case LINKTYPE_LINUX_SLL:
+            DecodeSll(tv, dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), pq);
+            break;
+        case LINKTYPE_ETHERNET:
+            if (decode_fast_path && DecodeEthernetFast(tv, dtv, p,
+                        GET_PKT_DATA(p), GET_PKT_LEN(p), pq) == 1)
+                break;
+            DecodeEthernet(tv, dtv, p,GET_PKT_DATA(p), GET_PKT_LEN(p), pq);
+            break;
+        case LINKTYPE_PPP:
+            DecodePPP(tv, dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), pq);
+            break;
+        case LINKTYPE_RAW:
+            DecodeRaw(tv, dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), pq);
+            break;
+        default:
+            SCLogError(SC_ERR_DATALINK_UNIMPLEMENTED, "Error: datalink type %" PRId32 " not yet supported in module DecodeAFP", p->datalink);
+            break;
+    }
+}
+
 TmEcode DecodeAFP(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, PacketQueue *postpq)
 {
     SCEnter();
@@ -1647,24 +2102,49 @@ TmEcode DecodeAFP(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, Packet
     SCPerfCounterSetUI64(dtv->counter_max_pkt_size, tv->sc_perf_pca, GET_PKT_LEN(p));
 
     /* call the decoder */
-    switch(p->datalink) {
-        case LINKTYPE_LINUX_SLL:
-            DecodeSll(tv, dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), pq);
-            break;
-        case LINKTYPE_ETHERNET:
-            DecodeEthernet(tv, dtv, p,GET_PKT_DATA(p), GET_PKT_LEN(p), pq);
-            break;
-        case LINKTYPE_PPP:
-            DecodePPP(tv, dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), pq);
-            break;
-        case LINKTYPE_RAW:
-            DecodeRaw(tv, dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), pq);
-            break;
-        default:
-            SCLogError(SC_ERR_DATALINK_UNIMPLEMENTED, "Error: datalink type %" PRId32 " not yet supported in module DecodeAFP", p->datalink);
-            break;
+    DecodeAFPPacket(tv, dtv, p, pq);
+    DecodeFastUpdateCounters(tv, dtv, p);
+
+    SCReturnInt(TM_ECODE_OK);
+}
+
+/**
+ * \brief Decode a batch of packets, prefetching the flow buckets ahead of
+ *        the decoder and updating the packet, byte and fast path decoder
+ *        counters once per batch.
+ */
+TmEcode DecodeAFPBatch(ThreadVars *tv, Packet **pkts, uint16_t cnt, void *data, PacketQueue *pq, PacketQueue *postpq)
+{
+    SCEnter();
+    DecodeThreadVars *dtv = (DecodeThreadVars *)data;
+    uint32_t keys[TM_BATCH_SIZE_MAX];
+    uint64_t bytes = 0;
+    uint16_t i;
+
+    /* the flow lookup in the decoder is the likely cache miss, so get
+     * the buckets in ahead of it */
+    uint16_t lookahead = FlowHashPrefetchSetup(pkts, cnt, keys);
+
+    for (i = 0; i < cnt; i++) {
+        Packet *p = pkts[i];
+
+        if (lookahead > 0)
+            FlowHashPrefetchLookahead(keys, cnt, i, lookahead);
+        else if (i + 1 < cnt)
+            SCPrefetch(GET_PKT_DATA(pkts[i + 1]));
+
+        bytes += GET_PKT_LEN(p);
+        SCPerfCounterAddUI64(dtv->counter_avg_pkt_size, tv->sc_perf_pca, GET_PKT_LEN(p));
+        SCPerfCounterSetUI64(dtv->counter_max_pkt_size, tv->sc_perf_pca, GET_PKT_LEN(p));
+
+        DecodeAFPPacket(tv, dtv, p, pq);
     }
 
+    SCPerfCounterAddUI64(dtv->counter_pkts, tv->sc_perf_pca, cnt);
+    SCPerfCounterAddUI64(dtv->counter_pkts_per_sec, tv->sc_perf_pca, cnt);
+    SCPerfCounterAddUI64(dtv->counter_bytes, tv->sc_perf_pca, bytes);
+    DecodeFastFlushCounters(tv, dtv);
+
     SCReturnInt(TM_ECODE_OK);
 }
 
@@ -43,12 +43,19 @@
 #define AFP_ZERO_COPY (1<<1)
 #define AFP_SOCK_PROTECT (1<<2)
 #define AFP_EMERGENCY_MODE (1<<3)
+#define AFP_BYPASS (1<<4)
+#define AFP_TPACKET_V3 (1<<5)
 
 #define AFP_COPY_MODE_NONE  0
 #define AFP_COPY_MODE_TAP   1
 #define AFP_COPY_MODE_IPS   2
 
 #define AFP_FILE_MAX_PKTS 256
+
+/** default tpacket v3 block size */
+#define AFP_BLOCK_SIZE_DEFAULT      (1 << 20)
+/** default tpacket v3 block retire timeout in ms */
+#define AFP_BLOCK_TIMEOUT_DEFAULT   10
 #define AFP_IFACE_NAME_LENGTH 48
 
 typedef struct AFPIfaceConfig_
@@ -60,6 +67,10 @@ typedef struct AFPIfaceConfig_
     int buffer_size;
     /* ring size in number of packets */
     int ring_size;
+    /* tpacket v3 block size in bytes */
+    int block_size;
+    /* tpacket v3 block retire timeout in ms */
+    int block_timeout;
     /* cluster param */
     int cluster_id;
     int cluster_type;
@@ -108,6 +119,9 @@ typedef struct AFPPacketVars_
      * to do reference counting.
      */
     AFPPeer *mpeer;
+    /** bypass table of the capture thread, used by the
+     *  BypassPacketsFlow callback */
+    struct FlowBypassTable_ *bypass_table;
 } AFPPacketVars;
 
 #define AFPV_CLEANUP(afpv) do {           \
@@ -115,6 +129,7 @@ typedef struct AFPPacketVars_
     (afpv)->copy_mode = 0;                \
     (afpv)->peer = NULL;                  \
     (afpv)->mpeer = NULL;                 \
+    (afpv)->bypass_table = NULL;          \
 } while(0)
 
 /**
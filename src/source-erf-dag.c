@@ -358,8 +358,6 @@ TmEcode ReceiveErfDagLoop(ThreadVars *tv, void *data, void *slot)
             SCReturnInt(TM_ECODE_FAILED);
         }
 
-        SCPerfSyncCountersIfSignalled(tv, 0);
-
         SCLogDebug("Read %d records from stream: %d, DAG: %s",
                    pkts_read, dtv->dagstream, dtv->dagname);
     }
@@ -304,8 +304,6 @@ TmEcode ReceiveIPFWLoop(ThreadVars *tv, void *data, void *slot)
             TmqhOutputPacketpool(tv, p);
             SCReturnInt(TM_ECODE_FAILED);
         }
-
-        SCPerfSyncCountersIfSignalled(tv, 0);
     }
 
     SCReturnInt(TM_ECODE_OK);
@@ -595,7 +595,6 @@ TmEcode ReceiveMpipeLoop(ThreadVars *tv, void *data, void *slot) {
                 }
             }
         }
-        SCPerfSyncCountersIfSignalled(tv, 0);
     }
 
     SCReturnInt(TM_ECODE_OK);
@@ -687,7 +686,6 @@ static TmEcode ReceiveMpipePollPair(ThreadVars *tv, MpipeThreadVars *ptv,
                 }
             }
         }
-        SCPerfSyncCountersIfSignalled(tv, 0);
         if (t == 0) {
             if (timestamp == ts_linux) {
                 tilera_fast_gettimeofday(&timeval);
@@ -884,7 +882,6 @@ static TmEcode ReceiveMpipeCapturePollPair(ThreadVars *tv, MpipeThreadVars *ptv,
                 }
             }
         }
-        SCPerfSyncCountersIfSignalled(tv, 0);
         if (timestamp_mode == ts_linux) {
             if (t == 0) {
                 tilera_fast_gettimeofday(&timeval);
@@ -283,7 +283,6 @@ TmEcode ReceiveNetioLoop(ThreadVars *tv, void *data, void *slot) {
                 SCReturnInt(TM_ECODE_FAILED);
             }
         }
-        SCPerfSyncCountersIfSignalled(tv, 0);
     }
 
     SCReturnInt(TM_ECODE_OK);
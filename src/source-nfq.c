@@ -957,8 +957,6 @@ TmEcode ReceiveNFQLoop(ThreadVars *tv, void *data, void *slot)
             break;
         }
         NFQRecvPkt(nq, ntv);
-
-        SCPerfSyncCountersIfSignalled(tv, 0);
     }
     SCReturnInt(TM_ECODE_OK);
 }
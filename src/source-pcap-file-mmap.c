@@ -0,0 +1,871 @@
+/* Copyright (C) 2007-2013 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Memory mapped pcap and pcapng file reader for the pcap file mode.
+ *
+ * The file is mapped privately, so the packets can point straight into the
+ * map. Large classic pcap files can be split into parts at record
+ * boundaries to be read by several receive threads. pcapng files are
+ * always read as a whole, as the interface blocks can show up anywhere in
+ * the file.
+ */
+
+#include "suricata-common.h"
+#include "decode.h"
+#include "util-atomic.h"
+#include "util-byte.h"
+#include "util-debug.h"
+#include "util-unittest.h"
+#include "source-pcap-file-mmap.h"
+
+#include <sys/mman.h>
+
+#define PCAP_MAGIC              0xa1b2c3d4
+#define PCAP_MAGIC_NSEC         0xa1b23c4d
+#define PCAP_GLOBAL_HDR_LEN     24
+#define PCAP_RECORD_HDR_LEN     16
+
+#define PCAPNG_BLOCK_SHB        0x0a0d0d0a
+#define PCAPNG_BLOCK_IDB        0x00000001
+#define PCAPNG_BLOCK_OPB        0x00000002
+#define PCAPNG_BLOCK_SPB        0x00000003
+#define PCAPNG_BLOCK_EPB        0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1a2b3c4d
+#define PCAPNG_OPT_END          0
+#define PCAPNG_OPT_IF_TSRESOL   9
+
+/** records larger than this are taken as file corruption */
+#define PCAP_MMAP_MAX_CAPLEN    262144
+/** consecutive plausible records needed to accept a split point */
+#define PCAP_MMAP_RESYNC_RECORDS 8
+/** max timestamp distance in seconds between records of a resync chain */
+#define PCAP_MMAP_RESYNC_TS_DIFF 3600
+
+static inline uint16_t PcapMmapGet16(const PcapMmapFile *f, const uint8_t *ptr)
+{
+    uint16_t v;
+    memcpy(&v, ptr, sizeof(v));
+    return f->swapped ? SCByteSwap16(v) : v;
+}
+
+static inline uint32_t PcapMmapGet32(const PcapMmapFile *f, const uint8_t *ptr)
+{
+    uint32_t v;
+    memcpy(&v, ptr, sizeof(v));
+    return f->swapped ? SCByteSwap32(v) : v;
+}
+
+/**
+ *  \brief convert a timestamp in units of 1/tsresol seconds
+ */
+static inline void PcapMmapSetTs(struct timeval *tv, uint64_t ts, uint64_t tsresol)
+{
+    uint64_t frac = ts % tsresol;
+
+    tv->tv_sec = (time_t)(ts / tsresol);
+    if (tsresol == 1000000ULL) {
+        tv->tv_usec = (suseconds_t)frac;
+    } else if (tsresol < 10000000000000ULL) {
+        /* frac * 1000000 doesn't overflow */
+        tv->tv_usec = (suseconds_t)(frac * 1000000ULL / tsresol);
+    } else {
+        tv->tv_usec = (suseconds_t)((double)frac * 1000000.0 / (double)tsresol);
+    }
+}
+
+/**
+ *  \brief check the file header and set up the file format fields
+ *
+ *  \retval 0 ok
+ *  \retval -1 not a pcap or pcapng file
+ */
+static int PcapMmapParseHeader(PcapMmapFile *f)
+{
+    uint32_t magic;
+
+    if (f->size < 4)
+        return -1;
+
+    memcpy(&magic, f->map, sizeof(magic));
+    switch (magic) {
+        case PCAP_MAGIC:
+        case PCAP_MAGIC_NSEC:
+            f->swapped = 0;
+            break;
+        case 0xd4c3b2a1:
+        case 0x4d3cb2a1:
+            f->swapped = 1;
+            magic = SCByteSwap32(magic);
+            break;
+        case PCAPNG_BLOCK_SHB:
+            /* the section header block is parsed by the reader like the
+             * ones further down the file */
+            f->pcapng = 1;
+            f->data_offset = 0;
+            return 0;
+        default:
+            return -1;
+    }
+
+    if (f->size < PCAP_GLOBAL_HDR_LEN)
+        return -1;
+    if (PcapMmapGet16(f, f->map + 4) != 2)
+        return -1;
+
+    f->tsresol = (magic == PCAP_MAGIC_NSEC) ? 1000000000ULL : 1000000ULL;
+    f->snaplen = PcapMmapGet32(f, f->map + 16);
+    /* upper bits may hold the FCS length */
+    f->linktype = (int)(PcapMmapGet32(f, f->map + 20) & 0x0fffffff);
+    f->data_offset = PCAP_GLOBAL_HDR_LEN;
+    return 0;
+}
+
+/**
+ *  \brief map a pcap or pcapng file
+ *
+ *  \retval f file with a reference for the caller
+ *  \retval NULL error
+ */
+PcapMmapFile *PcapMmapFileOpen(const char *path)
+{
+    struct stat st;
+    PcapMmapFile *f = NULL;
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        SCLogError(SC_ERR_FOPEN, "failed to open %s: %s", path, strerror(errno));
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        SCLogError(SC_ERR_FOPEN, "%s is not a regular, non empty file", path);
+        close(fd);
+        return NULL;
+    }
+    if ((uintmax_t)st.st_size > (uintmax_t)SIZE_MAX) {
+        SCLogError(SC_ERR_FOPEN, "%s is too large to map", path);
+        close(fd);
+        return NULL;
+    }
+
+    /* private and writable, so a decoder writing to the packet data gets
+     * its own copy of the page instead of changing the file */
+    uint8_t *map = mmap(NULL, (size_t)st.st_size, PROT_READ|PROT_WRITE,
+                        MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        SCLogError(SC_ERR_MEM_ALLOC, "failed to mmap %s: %s", path, strerror(errno));
+        return NULL;
+    }
+    (void)madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    f = SCMalloc(sizeof(PcapMmapFile));
+    if (unlikely(f == NULL))
+        goto error;
+    memset(f, 0, sizeof(PcapMmapFile));
+    f->path = SCStrdup(path);
+    if (unlikely(f->path == NULL))
+        goto error;
+    f->map = map;
+    f->size = (size_t)st.st_size;
+    SC_ATOMIC_INIT(f->ref);
+    (void) SC_ATOMIC_ADD(f->ref, 1);
+
+    if (PcapMmapParseHeader(f) != 0) {
+        SCLogError(SC_ERR_PCAP_OPEN_OFFLINE, "%s is not a pcap or pcapng file", path);
+        goto error;
+    }
+
+    SCLogDebug("mapped %s, %"PRIuMAX" bytes, %s", path, (uintmax_t)f->size,
+               f->pcapng ? "pcapng" : "pcap");
+    return f;
+
+error:
+    munmap(map, (size_t)st.st_size);
+    if (f != NULL) {
+        if (f->path != NULL)
+            SCFree(f->path);
+        SCFree(f);
+    }
+    return NULL;
+}
+
+void PcapMmapFileRef(PcapMmapFile *f)
+{
+    (void) SC_ATOMIC_ADD(f->ref, 1);
+}
+
+/**
+ *  \brief drop a reference, the last one unmaps the file
+ */
+void PcapMmapFileDeref(PcapMmapFile *f)
+{
+    if (SC_ATOMIC_SUB(f->ref, 1) != 0)
+        return;
+
+    SCLogDebug("unmapping %s", f->path);
+    munmap(f->map, f->size);
+    SC_ATOMIC_DESTROY(f->ref);
+    SCFree(f->path);
+    SCFree(f);
+}
+
+/**
+ *  \brief check if a classic pcap record header is sane
+ *
+ *  \param rec_len set to the length of the record incl header
+ *  \param sec set to the timestamp seconds
+ */
+static int PcapMmapRecordPlausible(PcapMmapFile *f, size_t off,
+                                   size_t *rec_len, uint32_t *sec)
+{
+    if (off + PCAP_RECORD_HDR_LEN > f->size)
+        return 0;
+
+    uint8_t *h = f->map + off;
+    uint32_t frac = PcapMmapGet32(f, h + 4);
+    uint32_t caplen = PcapMmapGet32(f, h + 8);
+    uint32_t len = PcapMmapGet32(f, h + 12);
+
+    if (frac >= f->tsresol)
+        return 0;
+    if (caplen == 0 || caplen > len || caplen > PCAP_MMAP_MAX_CAPLEN)
+        return 0;
+    if (f->snaplen != 0 && caplen > f->snaplen)
+        return 0;
+    if (off + PCAP_RECORD_HDR_LEN + caplen > f->size)
+        return 0;
+
+    *rec_len = PCAP_RECORD_HDR_LEN + caplen;
+    *sec = PcapMmapGet32(f, h);
+    return 1;
+}
+
+/**
+ *  \brief find the first record boundary at or after off
+ *
+ *  A candidate is accepted if it starts a chain of plausible records with
+ *  close timestamps, or a shorter chain that ends exactly at the end of
+ *  the file. If caplen == len, a chain read 4 bytes into the real records
+ *  is consistent as well, its "seconds" are the real sub second part
+ *  though. So the timestamps also have to be past min_sec, the time of a
+ *  known record earlier in the file.
+ *
+ *  \retval off offset of the record, f->size if none was found
+ */
+static size_t PcapMmapResync(PcapMmapFile *f, size_t off, uint32_t min_sec)
+{
+    for ( ; off + PCAP_RECORD_HDR_LEN <= f->size; off++) {
+        size_t o = off;
+        size_t rec_len = 0;
+        uint32_t first_sec = 0, sec = 0;
+        int i;
+
+        for (i = 0; i < PCAP_MMAP_RESYNC_RECORDS && o < f->size; i++) {
+            if (!PcapMmapRecordPlausible(f, o, &rec_len, &sec))
+                break;
+            if (sec < min_sec)
+                break;
+            if (i == 0)
+                first_sec = sec;
+            else if (llabs((long long)sec - (long long)first_sec) > PCAP_MMAP_RESYNC_TS_DIFF)
+                break;
+            o += rec_len;
+        }
+        if (i == PCAP_MMAP_RESYNC_RECORDS || (i > 0 && o == f->size))
+            return off;
+    }
+    return f->size;
+}
+
+/**
+ *  \brief split a file into parts of about split_size bytes
+ *
+ *  pcapng files, and files not larger than split_size, get a single part.
+ *  Every part holds a reference to the file and has the time of its first
+ *  record, 0 if it has none.
+ *
+ *  \retval head list of parts, NULL on error
+ */
+PcapMmapPart *PcapMmapFileSplit(PcapMmapFile *f, size_t split_size)
+{
+    PcapMmapPart *head = NULL, *tail = NULL;
+    PcapMmapRecord rec;
+    size_t start = f->data_offset;
+
+    while (start < f->size) {
+        size_t end = f->size;
+
+        if (!f->pcapng && split_size > 0 && f->size - start > split_size) {
+            size_t rec_len;
+            uint32_t sec = 0;
+            uint32_t min_sec = 0;
+
+            /* start is a record boundary, the records after it can't be
+             * much older */
+            if (PcapMmapRecordPlausible(f, start, &rec_len, &sec) &&
+                sec > PCAP_MMAP_RESYNC_TS_DIFF)
+                min_sec = sec - PCAP_MMAP_RESYNC_TS_DIFF;
+            end = PcapMmapResync(f, start + split_size, min_sec);
+        }
+
+        PcapMmapPart *part = SCMalloc(sizeof(PcapMmapPart));
+        if (unlikely(part == NULL))
+            goto error;
+        part->file = f;
+        part->start = start;
+        part->end = end;
+        part->next = NULL;
+        PcapMmapFileRef(f);
+
+        size_t off = start;
+        memset(&rec, 0, sizeof(rec));
+        memset(&part->ts, 0, sizeof(part->ts));
+        if (PcapMmapNext(f, &off, end, &rec) == 1)
+            part->ts = rec.ts;
+
+        if (tail == NULL)
+            head = part;
+        else
+            tail->next = part;
+        tail = part;
+
+        SCLogDebug("%s: part %"PRIuMAX"-%"PRIuMAX, f->path,
+                   (uintmax_t)start, (uintmax_t)end);
+        start = end;
+    }
+
+    if (head == NULL) {
+        /* only a file header, hand out an empty part so the file is still
+         * accounted for */
+        head = SCMalloc(sizeof(PcapMmapPart));
+        if (unlikely(head == NULL))
+            return NULL;
+        head->file = f;
+        head->start = head->end = f->size;
+        memset(&head->ts, 0, sizeof(head->ts));
+        head->next = NULL;
+        PcapMmapFileRef(f);
+    }
+    return head;
+
+error:
+    while (head != NULL) {
+        PcapMmapPart *next = head->next;
+        PcapMmapFileDeref(head->file);
+        SCFree(head);
+        head = next;
+    }
+    return NULL;
+}
+
+/**
+ *  \brief ask the kernel to read ahead of the reader
+ */
+void PcapMmapReadahead(PcapMmapFile *f, size_t offset, size_t end)
+{
+    size_t page = (size_t)getpagesize();
+    size_t start = offset & ~(page - 1);
+    size_t len = PCAP_MMAP_READAHEAD;
+
+    if (end > f->size)
+        end = f->size;
+    if (start >= end)
+        return;
+    if (len > end - start)
+        len = end - start;
+
+    (void)madvise(f->map + start, len, MADV_WILLNEED);
+}
+
+static int PcapMmapNextPcap(PcapMmapFile *f, size_t *offset, size_t end,
+                            PcapMmapRecord *rec)
+{
+    size_t off = *offset;
+
+    if (off >= end)
+        return 0;
+    if (off + PCAP_RECORD_HDR_LEN > f->size) {
+        SCLogWarning(SC_ERR_PCAP_DISPATCH, "%s: truncated record header at "
+                     "offset %"PRIuMAX, f->path, (uintmax_t)off);
+        return 0;
+    }
+
+    uint8_t *h = f->map + off;
+    uint32_t sec = PcapMmapGet32(f, h);
+    uint32_t frac = PcapMmapGet32(f, h + 4);
+    uint32_t caplen = PcapMmapGet32(f, h + 8);
+    uint32_t len = PcapMmapGet32(f, h + 12);
+
+    if (caplen > PCAP_MMAP_MAX_CAPLEN) {
+        SCLogError(SC_ERR_PCAP_DISPATCH, "%s: bogus record length %"PRIu32
+                   " at offset %"PRIuMAX, f->path, caplen, (uintmax_t)off);
+        return -1;
+    }
+    if (off + PCAP_RECORD_HDR_LEN + caplen > f->size) {
+        SCLogWarning(SC_ERR_PCAP_DISPATCH, "%s: truncated record at offset "
+                     "%"PRIuMAX, f->path, (uintmax_t)off);
+        return 0;
+    }
+
+    rec->ts.tv_sec = sec;
+    rec->ts.tv_usec = (f->tsresol == 1000000ULL) ? frac : frac / 1000;
+    rec->caplen = caplen;
+    rec->len = len;
+    rec->datalink = f->linktype;
+    rec->data = h + PCAP_RECORD_HDR_LEN;
+
+    *offset = off + PCAP_RECORD_HDR_LEN + caplen;
+    return 1;
+}
+
+/**
+ *  \brief parse an interface description block
+ */
+static void PcapMmapParseIdb(PcapMmapFile *f, uint8_t *b, uint32_t blen)
+{
+    if (f->iface_cnt >= PCAP_MMAP_MAX_IFACES) {
+        SCLogWarning(SC_ERR_PCAP_DISPATCH, "%s: more than %d interfaces, "
+                     "packets of the others are skipped", f->path,
+                     PCAP_MMAP_MAX_IFACES);
+        return;
+    }
+
+    PcapMmapIface *iface = &f->ifaces[f->iface_cnt++];
+    iface->linktype = PcapMmapGet16(f, b + 8);
+    iface->tsresol = 1000000ULL;
+
+    /* options start after linktype, reserved and snaplen */
+    uint32_t o = 16;
+    while (o + 4 <= blen - 4) {
+        uint16_t code = PcapMmapGet16(f, b + o);
+        uint16_t olen = PcapMmapGet16(f, b + o + 2);
+
+        if (code == PCAPNG_OPT_END)
+            break;
+        if (o + 4 + olen > blen - 4)
+            break;
+
+        if (code == PCAPNG_OPT_IF_TSRESOL && olen == 1) {
+            uint8_t v = b[o + 4];
+            uint64_t res = 1;
+            if (v & 0x80) {
+                /* power of 2 */
+                v &= 0x7f;
+                if (v < 64)
+                    res = 1ULL << v;
+            } else if (v <= 19) {
+                while (v-- > 0)
+                    res *= 10;
+            }
+            iface->tsresol = res;
+        }
+        o += 4 + ((olen + 3) & ~3);
+    }
+}
+
+static int PcapMmapNextPcapng(PcapMmapFile *f, size_t *offset, size_t end,
+                              PcapMmapRecord *rec)
+{
+    while (*offset < end) {
+        size_t off = *offset;
+        if (off + 12 > f->size) {
+            SCLogWarning(SC_ERR_PCAP_DISPATCH, "%s: truncated block at "
+                         "offset %"PRIuMAX, f->path, (uintmax_t)off);
+            return 0;
+        }
+
+        uint8_t *b = f->map + off;
+        uint32_t type;
+        memcpy(&type, b, sizeof(type));
+
+        if (type == PCAPNG_BLOCK_SHB) {
+            /* new section, possibly in another byte order */
+            uint32_t bom;
+            memcpy(&bom, b + 8, sizeof(bom));
+            if (bom == PCAPNG_BYTE_ORDER_MAGIC) {
+                f->swapped = 0;
+            } else if (bom == SCByteSwap32(PCAPNG_BYTE_ORDER_MAGIC)) {
+                f->swapped = 1;
+            } else {
+                SCLogError(SC_ERR_PCAP_DISPATCH, "%s: bad section header at "
+                           "offset %"PRIuMAX, f->path, (uintmax_t)off);
+                return -1;
+            }
+            f->iface_cnt = 0;
+        } else {
+            type = f->swapped ? SCByteSwap32(type) : type;
+        }
+
+        uint32_t blen = PcapMmapGet32(f, b + 4);
+        if (blen < 12 || (blen & 3) || off + blen > f->size) {
+            SCLogError(SC_ERR_PCAP_DISPATCH, "%s: bad block length %"PRIu32
+                       " at offset %"PRIuMAX, f->path, blen, (uintmax_t)off);
+            return -1;
+        }
+        *offset = off + blen;
+
+        uint32_t ifid = 0, caplen = 0, len = 0, hdr = 0;
+        uint64_t ts = 0;
+        switch (type) {
+            case PCAPNG_BLOCK_IDB:
+                if (blen >= 20)
+                    PcapMmapParseIdb(f, b, blen);
+                continue;
+            case PCAPNG_BLOCK_EPB:
+                hdr = 28;
+                if (blen < hdr + 4)
+                    goto bad_block;
+                ifid = PcapMmapGet32(f, b + 8);
+                ts = ((uint64_t)PcapMmapGet32(f, b + 12) << 32) |
+                     PcapMmapGet32(f, b + 16);
+                caplen = PcapMmapGet32(f, b + 20);
+                len = PcapMmapGet32(f, b + 24);
+                break;
+            case PCAPNG_BLOCK_OPB:
+                hdr = 28;
+                if (blen < hdr + 4)
+                    goto bad_block;
+                ifid = PcapMmapGet16(f, b + 8);
+                ts = ((uint64_t)PcapMmapGet32(f, b + 12) << 32) |
+                     PcapMmapGet32(f, b + 16);
+                caplen = PcapMmapGet32(f, b + 20);
+                len = PcapMmapGet32(f, b + 24);
+                break;
+            case PCAPNG_BLOCK_SPB:
+                hdr = 12;
+                len = PcapMmapGet32(f, b + 8);
+                caplen = len;
+                if (caplen > blen - hdr - 4)
+                    caplen = blen - hdr - 4;
+                break;
+            default:
+                /* statistics, name resolution, custom blocks */
+                continue;
+        }
+
+        if (caplen > blen - hdr - 4)
+            goto bad_block;
+        if (ifid >= f->iface_cnt) {
+            SCLogDebug("%s: packet for unknown interface %"PRIu32, f->path, ifid);
+            continue;
+        }
+
+        /* simple packet blocks have no timestamp, the one of the
+         * previous record is left in place */
+        if (type != PCAPNG_BLOCK_SPB)
+            PcapMmapSetTs(&rec->ts, ts, f->ifaces[ifid].tsresol);
+        rec->caplen = caplen;
+        rec->len = len;
+        rec->datalink = f->ifaces[ifid].linktype;
+        rec->data = b + hdr;
+        return 1;
+
+bad_block:
+        SCLogError(SC_ERR_PCAP_DISPATCH, "%s: bad packet block at offset "
+                   "%"PRIuMAX, f->path, (uintmax_t)off);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ *  \brief get the next packet record
+ *
+ *  \param offset in: offset to read from, out: offset of the next record
+ *  \param end records starting at or after end are not returned
+ *  \param rec filled with the packet
+ *
+ *  \retval 1 record returned
+ *  \retval 0 end of the part or of the file
+ *  \retval -1 the file is corrupt
+ */
+int PcapMmapNext(PcapMmapFile *f, size_t *offset, size_t end, PcapMmapRecord *rec)
+{
+    if (f->pcapng)
+        return PcapMmapNextPcapng(f, offset, end, rec);
+    return PcapMmapNextPcap(f, offset, end, rec);
+}
+
+#ifdef UNITTESTS
+
+static void PcapMmapTestPut32(uint8_t *b, uint32_t v, int swap)
+{
+    if (swap)
+        v = SCByteSwap32(v);
+    memcpy(b, &v, sizeof(v));
+}
+
+static void PcapMmapTestPut16(uint8_t *b, uint16_t v, int swap)
+{
+    if (swap)
+        v = SCByteSwap16(v);
+    memcpy(b, &v, sizeof(v));
+}
+
+/** \brief write a pcap file with cnt records of len bytes
+ *  \retval size of the file */
+static size_t PcapMmapTestPcap(uint8_t *buf, uint32_t magic, int swap,
+                               uint32_t cnt, uint32_t len)
+{
+    uint32_t i;
+    size_t o = PCAP_GLOBAL_HDR_LEN;
+
+    memset(buf, 0, PCAP_GLOBAL_HDR_LEN);
+    PcapMmapTestPut32(buf, magic, swap);
+    PcapMmapTestPut16(buf + 4, 2, swap);
+    PcapMmapTestPut16(buf + 6, 4, swap);
+    PcapMmapTestPut32(buf + 16, 65535, swap);
+    PcapMmapTestPut32(buf + 20, LINKTYPE_ETHERNET, swap);
+
+    for (i = 0; i < cnt; i++) {
+        PcapMmapTestPut32(buf + o, 1300000000 + i, swap);
+        PcapMmapTestPut32(buf + o + 4, 1000 * i, swap);
+        PcapMmapTestPut32(buf + o + 8, len, swap);
+        PcapMmapTestPut32(buf + o + 12, len + 4, swap);
+        memset(buf + o + PCAP_RECORD_HDR_LEN, (int)i, len);
+        o += PCAP_RECORD_HDR_LEN + len;
+    }
+    return o;
+}
+
+/** \test classic pcap, native byte order, usec timestamps */
+static int PcapMmapTest01(void)
+{
+    uint8_t buf[PCAP_GLOBAL_HDR_LEN + 2 * (PCAP_RECORD_HDR_LEN + 60)];
+    PcapMmapFile f;
+    PcapMmapRecord rec;
+
+    memset(&f, 0, sizeof(f));
+    f.map = buf;
+    f.size = PcapMmapTestPcap(buf, PCAP_MAGIC, 0, 2, 60);
+    if (PcapMmapParseHeader(&f) != 0 || f.pcapng || f.swapped ||
+        f.linktype != LINKTYPE_ETHERNET) {
+        printf("header: ");
+        return 0;
+    }
+
+    size_t off = f.data_offset;
+    if (PcapMmapNext(&f, &off, f.size, &rec) != 1 ||
+        rec.ts.tv_sec != 1300000000 || rec.ts.tv_usec != 0 ||
+        rec.caplen != 60 || rec.len != 64 ||
+        rec.data != buf + PCAP_GLOBAL_HDR_LEN + PCAP_RECORD_HDR_LEN) {
+        printf("first record: ");
+        return 0;
+    }
+    if (PcapMmapNext(&f, &off, f.size, &rec) != 1 ||
+        rec.ts.tv_sec != 1300000001 || rec.ts.tv_usec != 1000 ||
+        rec.data[0] != 1) {
+        printf("second record: ");
+        return 0;
+    }
+    if (PcapMmapNext(&f, &off, f.size, &rec) != 0) {
+        printf("expected end of file: ");
+        return 0;
+    }
+    return 1;
+}
+
+/** \test classic pcap, other byte order, nsec timestamps */
+static int PcapMmapTest02(void)
+{
+    uint8_t buf[PCAP_GLOBAL_HDR_LEN + 2 * (PCAP_RECORD_HDR_LEN + 60)];
+    PcapMmapFile f;
+    PcapMmapRecord rec;
+
+    memset(&f, 0, sizeof(f));
+    f.map = buf;
+    f.size = PcapMmapTestPcap(buf, PCAP_MAGIC_NSEC, 1, 2, 60);
+    if (PcapMmapParseHeader(&f) != 0 || !f.swapped ||
+        f.tsresol != 1000000000ULL || f.linktype != LINKTYPE_ETHERNET) {
+        printf("header: ");
+        return 0;
+    }
+
+    size_t off = f.data_offset;
+    if (PcapMmapNext(&f, &off, f.size, &rec) != 1 ||
+        PcapMmapNext(&f, &off, f.size, &rec) != 1) {
+        printf("records: ");
+        return 0;
+    }
+    if (rec.ts.tv_sec != 1300000001 || rec.ts.tv_usec != 1 || rec.caplen != 60) {
+        printf("second record: ");
+        return 0;
+    }
+    return 1;
+}
+
+/** \test pcapng with a nsec interface, an enhanced and a simple packet block */
+static int PcapMmapTest03(void)
+{
+    uint8_t buf[256];
+    PcapMmapFile f;
+    PcapMmapRecord rec;
+    size_t o = 0;
+
+    memset(buf, 0, sizeof(buf));
+    /* SHB */
+    PcapMmapTestPut32(buf + o, PCAPNG_BLOCK_SHB, 0);
+    PcapMmapTestPut32(buf + o + 4, 28, 0);
+    PcapMmapTestPut32(buf + o + 8, PCAPNG_BYTE_ORDER_MAGIC, 0);
+    PcapMmapTestPut16(buf + o + 12, 1, 0);
+    memset(buf + o + 16, 0xff, 8);
+    PcapMmapTestPut32(buf + o + 24, 28, 0);
+    o += 28;
+    /* IDB with if_tsresol 9 */
+    PcapMmapTestPut32(buf + o, PCAPNG_BLOCK_IDB, 0);
+    PcapMmapTestPut32(buf + o + 4, 32, 0);
+    PcapMmapTestPut16(buf + o + 8, LINKTYPE_RAW, 0);
+    PcapMmapTestPut32(buf + o + 12, 65535, 0);
+    PcapMmapTestPut16(buf + o + 16, PCAPNG_OPT_IF_TSRESOL, 0);
+    PcapMmapTestPut16(buf + o + 18, 1, 0);
+    buf[o + 20] = 9;
+    PcapMmapTestPut32(buf + o + 28, 32, 0);
+    o += 32;
+    /* EPB, 20 bytes of data */
+    PcapMmapTestPut32(buf + o, PCAPNG_BLOCK_EPB, 0);
+    PcapMmapTestPut32(buf + o + 4, 52, 0);
+    PcapMmapTestPut32(buf + o + 8, 0, 0);
+    uint64_t ts = 1300000000ULL * 1000000000ULL + 5000;
+    PcapMmapTestPut32(buf + o + 12, (uint32_t)(ts >> 32), 0);
+    PcapMmapTestPut32(buf + o + 16, (uint32_t)ts, 0);
+    PcapMmapTestPut32(buf + o + 20, 20, 0);
+    PcapMmapTestPut32(buf + o + 24, 20, 0);
+    memset(buf + o + 28, 0x45, 20);
+    PcapMmapTestPut32(buf + o + 48, 52, 0);
+    size_t epb = o;
+    o += 52;
+    /* SPB, 10 bytes of data padded to 12 */
+    PcapMmapTestPut32(buf + o, PCAPNG_BLOCK_SPB, 0);
+    PcapMmapTestPut32(buf + o + 4, 28, 0);
+    PcapMmapTestPut32(buf + o + 8, 10, 0);
+    PcapMmapTestPut32(buf + o + 24, 28, 0);
+    size_t spb = o;
+    o += 28;
+
+    memset(&f, 0, sizeof(f));
+    f.map = buf;
+    f.size = o;
+    if (PcapMmapParseHeader(&f) != 0 || !f.pcapng) {
+        printf("header: ");
+        return 0;
+    }
+
+    size_t off = f.data_offset;
+    if (PcapMmapNext(&f, &off, f.size, &rec) != 1) {
+        printf("no epb: ");
+        return 0;
+    }
+    if (f.iface_cnt != 1 || f.ifaces[0].tsresol != 1000000000ULL ||
+        rec.datalink != LINKTYPE_RAW || rec.caplen != 20 ||
+        rec.data != buf + epb + 28 || rec.ts.tv_sec != 1300000000 ||
+        rec.ts.tv_usec != 5) {
+        printf("epb wrong: ");
+        return 0;
+    }
+    if (PcapMmapNext(&f, &off, f.size, &rec) != 1) {
+        printf("no spb: ");
+        return 0;
+    }
+    if (rec.caplen != 10 || rec.len != 10 || rec.data != buf + spb + 12 ||
+        rec.ts.tv_sec != 1300000000) {
+        printf("spb wrong: ");
+        return 0;
+    }
+    if (PcapMmapNext(&f, &off, f.size, &rec) != 0) {
+        printf("expected end of file: ");
+        return 0;
+    }
+    return 1;
+}
+
+/** \test split points land on record boundaries and the parts cover all
+ *        records exactly once */
+static int PcapMmapTest04(void)
+{
+    uint32_t cnt = 100;
+    size_t size = PCAP_GLOBAL_HDR_LEN + cnt * (PCAP_RECORD_HDR_LEN + 61);
+    uint8_t *buf = SCMalloc(size);
+    if (unlikely(buf == NULL))
+        return 0;
+    int result = 0;
+    PcapMmapFile f;
+    PcapMmapRecord rec;
+    uint32_t seen = 0, parts = 0;
+
+    memset(&f, 0, sizeof(f));
+    f.map = buf;
+    f.size = PcapMmapTestPcap(buf, PCAP_MAGIC, 0, cnt, 61);
+    SC_ATOMIC_INIT(f.ref);
+    (void) SC_ATOMIC_ADD(f.ref, 1);
+    if (PcapMmapParseHeader(&f) != 0)
+        goto end;
+
+    PcapMmapPart *part = PcapMmapFileSplit(&f, 1000);
+    if (part == NULL)
+        goto end;
+
+    size_t expect = f.data_offset;
+    while (part != NULL) {
+        PcapMmapPart *next = part->next;
+        if (part->start != expect) {
+            printf("part %u starts at %"PRIuMAX", expected %"PRIuMAX": ",
+                   parts, (uintmax_t)part->start, (uintmax_t)expect);
+            goto end;
+        }
+        size_t off = part->start;
+        while (PcapMmapNext(&f, &off, part->end, &rec) == 1) {
+            if (rec.data[0] != (uint8_t)seen) {
+                printf("record %u out of order: ", seen);
+                goto end;
+            }
+            seen++;
+        }
+        if (off != part->end) {
+            printf("part %u read past its end: ", parts);
+            goto end;
+        }
+        expect = part->end;
+        parts++;
+        (void) SC_ATOMIC_SUB(f.ref, 1);
+        SCFree(part);
+        part = next;
+    }
+
+    if (seen != cnt || parts < 2 || expect != f.size) {
+        printf("seen %u records in %u parts: ", seen, parts);
+        goto end;
+    }
+    result = 1;
+end:
+    SCFree(buf);
+    return result;
+}
+
+#endif /* UNITTESTS */
+
+void PcapMmapRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("PcapMmapTest01", PcapMmapTest01, 1);
+    UtRegisterTest("PcapMmapTest02", PcapMmapTest02, 1);
+    UtRegisterTest("PcapMmapTest03", PcapMmapTest03, 1);
+    UtRegisterTest("PcapMmapTest04", PcapMmapTest04, 1);
+#endif /* UNITTESTS */
+}
@@ -0,0 +1,94 @@
+/* Copyright (C) 2007-2013 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ */
+
+#ifndef __SOURCE_PCAP_FILE_MMAP_H__
+#define __SOURCE_PCAP_FILE_MMAP_H__
+
+/** max interfaces in a pcapng section */
+#define PCAP_MMAP_MAX_IFACES    32
+
+/** size of the window the kernel is asked to read ahead of the reader */
+#define PCAP_MMAP_READAHEAD     (4 * 1024 * 1024)
+
+typedef struct PcapMmapIface_ {
+    int linktype;
+    /** timestamp units per second */
+    uint64_t tsresol;
+} PcapMmapIface;
+
+/** \brief a pcap or pcapng file mapped in memory
+ *
+ *  Packets reference their data in the map, so the file is reference
+ *  counted and unmapped when the last packet is released. */
+typedef struct PcapMmapFile_ {
+    char *path;
+    uint8_t *map;
+    size_t size;
+
+    /** offset of the first record (pcap) or block (pcapng) after the
+     *  file header */
+    size_t data_offset;
+
+    uint8_t pcapng;
+    uint8_t swapped;            /**< file byte order is not ours */
+
+    /* classic pcap */
+    int linktype;
+    uint32_t snaplen;
+    uint64_t tsresol;
+
+    /* pcapng, interfaces of the current section */
+    uint16_t iface_cnt;
+    PcapMmapIface ifaces[PCAP_MMAP_MAX_IFACES];
+
+    SC_ATOMIC_DECLARE(unsigned int, ref);
+} PcapMmapFile;
+
+/** \brief a packet record in the map */
+typedef struct PcapMmapRecord_ {
+    struct timeval ts;
+    uint32_t caplen;
+    uint32_t len;
+    int datalink;
+    uint8_t *data;
+} PcapMmapRecord;
+
+/** \brief range of a file for a single receive thread
+ *
+ *  The range starts at a record boundary. Records that start before
+ *  end belong to the part. */
+typedef struct PcapMmapPart_ {
+    PcapMmapFile *file;
+    size_t start;
+    size_t end;
+    struct timeval ts;          /**< time of the first record */
+    struct PcapMmapPart_ *next;
+} PcapMmapPart;
+
+PcapMmapFile *PcapMmapFileOpen(const char *);
+void PcapMmapFileRef(PcapMmapFile *);
+void PcapMmapFileDeref(PcapMmapFile *);
+PcapMmapPart *PcapMmapFileSplit(PcapMmapFile *, size_t);
+int PcapMmapNext(PcapMmapFile *, size_t *, size_t, PcapMmapRecord *);
+void PcapMmapReadahead(PcapMmapFile *, size_t, size_t);
+void PcapMmapRegisterTests(void);
+
+#endif /* __SOURCE_PCAP_FILE_MMAP_H__ */
@@ -26,11 +26,13 @@
 #include "suricata-common.h"
 #include "suricata.h"
 #include "decode.h"
+#include "decode-fast.h"
 #include "packet-queue.h"
 #include "threads.h"
 #include "threadvars.h"
 #include "tm-queuehandlers.h"
 #include "source-pcap-file.h"
+#include "source-pcap-file-mmap.h"
 #include "util-time.h"
 #include "util-debug.h"
 #include "conf.h"
@@ -40,20 +42,92 @@
 #include "tm-threads.h"
 #include "util-optimize.h"
 #include "flow-manager.h"
+#include "flow-hash.h"
 #include "util-profiling.h"
+#include "util-unittest.h"
 #include "runmode-unix-socket.h"
 
+#include <dirent.h>
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+
 extern uint8_t suricata_ctl_flags;
 extern int max_pending_packets;
 
 //static int pcap_max_read_packets = 0;
 
+/** finished files kept for the pcap-dir-stats command */
+#define PCAP_FILE_STATS_HISTORY     64
+/** max time in ms a reader waits for a file in the watched directory
+ *  before checking the engine flags again */
+#define PCAP_FILE_WATCH_POLL_MS     100
+/** max receive threads of the mmap reader */
+#define PCAP_FILE_MAX_THREADS       64
+
+enum {
+    PCAP_FILE_QUEUED = 0,
+    PCAP_FILE_READING,
+    PCAP_FILE_DONE,
+};
+
+/** \brief progress of a file in the mmap reader */
+typedef struct PcapFileStats_ {
+    char *path;
+    /** the file, referenced by its parts. Only valid until the last part
+     *  is done */
+    PcapMmapFile *file;
+    uint8_t state;
+    uint32_t parts;             /**< parts not done yet */
+    uint64_t size;
+    struct timeval first_ts;    /**< timestamp of the first record */
+    time_t mtime;               /**< when the file was written */
+    struct timeval start;       /**< file split up for the readers */
+    struct timeval end;         /**< last part done */
+    uint64_t pkts;
+    uint64_t bytes;
+    struct PcapFileStats_ *next;
+} PcapFileStats;
+
 typedef struct PcapFileGlobalVars_ {
     pcap_t *pcap_handle;
-    void (*Decoder)(ThreadVars *, DecodeThreadVars *, Packet *, u_int8_t *, u_int16_t, PacketQueue *);
     int datalink;
     struct bpf_program filter;
-    uint64_t cnt; /** packet counter */
+    /** packet counter, shared by the readers */
+    SC_ATOMIC_DECLARE(uint64_t, cnt);
+
+    /** held by the thread queueing the files at start up */
+    SCMutex setup_lock;
+    int parts_setup;
+    size_t split_size;
+
+    /* mmap reader, protected by parts_lock */
+    SCMutex parts_lock;
+    /** parts not taken by a thread yet, of all queued files, in the order
+     *  of their first record */
+    PcapMmapPart *parts;
+    /** files in read order: done and reading ones, then the queued ones
+     *  sorted by the timestamp of their first record */
+    PcapFileStats *files;
+    uint32_t files_done;
+    /** receive threads that are still reading */
+    SC_ATOMIC_DECLARE(unsigned int, readers);
+    /** receive threads using the mmap reader */
+    SC_ATOMIC_DECLARE(unsigned int, threads);
+
+    /* merge of the readers by packet time, protected by merge_lock */
+    SCMutex merge_lock;
+    SCCondT merge_cond;
+    int merge_readers;
+    /** per reader: time of its next record. Readers start at 0, so the
+     *  others wait for them to get their first part */
+    struct timeval merge_ts[PCAP_FILE_MAX_THREADS];
+    /** per reader: set when it has no part to read */
+    uint8_t merge_idle[PCAP_FILE_MAX_THREADS];
+
+    /* directory watch mode */
+    char *watch_dir;
+    int watch_fd;
 } PcapFileGlobalVars;
 
 /** max packets < 65536 */
@@ -73,6 +147,18 @@ typedef struct PcapFileThreadVars_
 
     uint8_t done;
     uint32_t errs;
+
+    /* mmap reader */
+    uint8_t mmap;
+    uint8_t rec_pending;    /**< rec is read but not dispatched yet */
+    int reader;             /**< index of the thread in the merge */
+    PcapMmapPart *part;     /**< part being read */
+    size_t offset;          /**< offset of the next record in the part */
+    size_t readahead;       /**< offset at which to issue the next readahead */
+    PcapMmapRecord rec;     /**< next record of the part */
+    PcapFileStats *stats;   /**< file of the part */
+    uint64_t part_pkts;
+    uint64_t part_bytes;
 } PcapFileThreadVars;
 
 static PcapFileGlobalVars pcap_g;
@@ -82,12 +168,22 @@ TmEcode ReceivePcapFileLoop(ThreadVars *, void *, void *);
 TmEcode ReceivePcapFileThreadInit(ThreadVars *, void *, void **);
 void ReceivePcapFileThreadExitStats(ThreadVars *, void *);
 TmEcode ReceivePcapFileThreadDeinit(ThreadVars *, void *);
+void ReceivePcapFileRegisterTests(void);
 
 TmEcode DecodePcapFile(ThreadVars *, Packet *, void *, PacketQueue *, PacketQueue *);
+TmEcode DecodePcapFileBatch(ThreadVars *, Packet **, uint16_t, void *, PacketQueue *, PacketQueue *);
 TmEcode DecodePcapFileThreadInit(ThreadVars *, void *, void **);
 
 void TmModuleReceivePcapFileRegister (void) {
     memset(&pcap_g, 0x00, sizeof(pcap_g));
+    SCMutexInit(&pcap_g.setup_lock, NULL);
+    SCMutexInit(&pcap_g.parts_lock, NULL);
+    SC_ATOMIC_INIT(pcap_g.readers);
+    SC_ATOMIC_INIT(pcap_g.threads);
+    SC_ATOMIC_INIT(pcap_g.cnt);
+    SCMutexInit(&pcap_g.merge_lock, NULL);
+    SCCondInit(&pcap_g.merge_cond, NULL);
+    pcap_g.watch_fd = -1;
 
     tmm_modules[TMM_RECEIVEPCAPFILE].name = "ReceivePcapFile";
     tmm_modules[TMM_RECEIVEPCAPFILE].ThreadInit = ReceivePcapFileThreadInit;
@@ -95,7 +191,7 @@ void TmModuleReceivePcapFileRegister (void) {
     tmm_modules[TMM_RECEIVEPCAPFILE].PktAcqLoop = ReceivePcapFileLoop;
     tmm_modules[TMM_RECEIVEPCAPFILE].ThreadExitPrintStats = ReceivePcapFileThreadExitStats;
     tmm_modules[TMM_RECEIVEPCAPFILE].ThreadDeinit = ReceivePcapFileThreadDeinit;
-    tmm_modules[TMM_RECEIVEPCAPFILE].RegisterTests = NULL;
+    tmm_modules[TMM_RECEIVEPCAPFILE].RegisterTests = ReceivePcapFileRegisterTests;
     tmm_modules[TMM_RECEIVEPCAPFILE].cap_flags = 0;
     tmm_modules[TMM_RECEIVEPCAPFILE].flags = TM_FLAG_RECEIVE_TM;
 }
@@ -104,6 +200,7 @@ void TmModuleDecodePcapFileRegister (void) {
     tmm_modules[TMM_DECODEPCAPFILE].name = "DecodePcapFile";
     tmm_modules[TMM_DECODEPCAPFILE].ThreadInit = DecodePcapFileThreadInit;
     tmm_modules[TMM_DECODEPCAPFILE].Func = DecodePcapFile;
+    tmm_modules[TMM_DECODEPCAPFILE].FuncBatch = DecodePcapFileBatch;
     tmm_modules[TMM_DECODEPCAPFILE].ThreadExitPrintStats = NULL;
     tmm_modules[TMM_DECODEPCAPFILE].ThreadDeinit = NULL;
     tmm_modules[TMM_DECODEPCAPFILE].RegisterTests = NULL;
@@ -131,7 +228,7 @@ void PcapFileCallbackLoop(char *user, struct pcap_pkthdr *h, u_char *pkt) {
     p->ts.tv_usec = h->ts.tv_usec;
     SCLogDebug("p->ts.tv_sec %"PRIuMAX"", (uintmax_t)p->ts.tv_sec);
     p->datalink = pcap_g.datalink;
-    p->pcap_cnt = ++pcap_g.cnt;
+    p->pcap_cnt = SC_ATOMIC_ADD(pcap_g.cnt, 1);
 
     ptv->pkts++;
     ptv->bytes += h->caplen;
@@ -143,7 +240,7 @@ void PcapFileCallbackLoop(char *user, struct pcap_pkthdr *h, u_char *pkt) {
     }
     PACKET_PROFILING_TMM_END(p, TMM_RECEIVEPCAPFILE);
 
-    if (TmThreadsSlotProcessPkt(ptv->tv, ptv->slot, p) != TM_ECODE_OK) {
+    if (TmThreadsSlotProcessPktBatched(ptv->tv, ptv->slot, p) != TM_ECODE_OK) {
         pcap_breakloop(pcap_g.pcap_handle);
         ptv->cb_result = TM_ECODE_FAILED;
     }
@@ -151,6 +248,835 @@ void PcapFileCallbackLoop(char *user, struct pcap_pkthdr *h, u_char *pkt) {
     SCReturn;
 }
 
+/**
+ *  \brief check if the directory given with -r is to be watched for new
+ *         files (pcap-dir mode)
+ */
+int PcapFileWatchEnabled(void)
+{
+    int watch = 0;
+
+    if (ConfGetBool("pcap-file.watch", &watch) != 1)
+        return 0;
+    return watch;
+}
+
+/**
+ *  \brief check if the mmap reader is to be used
+ *
+ *  The mmap reader is not used with a bpf filter or in unix socket mode.
+ *  The directory watch mode implies it.
+ */
+int PcapFileMmapEnabled(void)
+{
+    int mmap_enabled = 0;
+    char *bpf = NULL;
+
+    if (ConfGetBool("pcap-file.mmap", &mmap_enabled) != 1)
+        mmap_enabled = 0;
+    if (!mmap_enabled && !PcapFileWatchEnabled())
+        return 0;
+    if (RunModeUnixSocketIsActive())
+        return 0;
+    if (ConfGet("bpf-filter", &bpf) == 1 && bpf != NULL && strlen(bpf) > 0) {
+        SCLogInfo("bpf-filter set, not using the mmap pcap file reader");
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ *  \brief get the number of pcap file receive threads
+ *
+ *  \retval cnt pcap-file.threads if the mmap reader is used, 1 otherwise
+ */
+int PcapFileGetReceiveThreads(void)
+{
+    intmax_t cnt = 1;
+
+    if (!PcapFileMmapEnabled())
+        return 1;
+    if (ConfGetInt("pcap-file.threads", &cnt) != 1)
+        return 1;
+    if (cnt < 1 || cnt > PCAP_FILE_MAX_THREADS) {
+        SCLogWarning(SC_ERR_INVALID_ARGUMENT, "invalid value %"PRIdMAX" for "
+                     "pcap-file.threads, using 1", cnt);
+        return 1;
+    }
+    return (int)cnt;
+}
+
+static void PcapFileStatsFree(PcapFileStats *fs)
+{
+    SCFree(fs->path);
+    SCFree(fs);
+}
+
+/**
+ *  \brief add a file to the list, queued files are kept in the order of
+ *         their first record
+ *
+ *  Called with parts_lock held.
+ */
+static void PcapFileStatsInsert(PcapFileStats *fs)
+{
+    PcapFileStats **pp = &pcap_g.files;
+
+    while (*pp != NULL && ((*pp)->state != PCAP_FILE_QUEUED ||
+                           !timercmp(&fs->first_ts, &(*pp)->first_ts, <)))
+        pp = &(*pp)->next;
+    fs->next = *pp;
+    *pp = fs;
+}
+
+/**
+ *  \brief mark a file as done and drop the oldest finished file from the
+ *         list if the history is full
+ *
+ *  Called with parts_lock held.
+ */
+static void PcapFileStatsDone(PcapFileStats *fs)
+{
+    fs->state = PCAP_FILE_DONE;
+    fs->file = NULL;
+    gettimeofday(&fs->end, NULL);
+
+    double secs = (fs->end.tv_sec - fs->start.tv_sec) +
+                  (fs->end.tv_usec - fs->start.tv_usec) / 1000000.0;
+    SCLogInfo("%s: %"PRIu64" packets, %"PRIu64" bytes in %.3fs (%.1f Mbit/s), "
+              "lag %"PRIdMAX"s", fs->path, fs->pkts, fs->bytes, secs,
+              secs > 0 ? (fs->bytes * 8) / secs / 1000000.0 : 0.0,
+              (intmax_t)(fs->end.tv_sec - fs->mtime));
+
+    if (++pcap_g.files_done <= PCAP_FILE_STATS_HISTORY)
+        return;
+
+    PcapFileStats **pp = &pcap_g.files;
+    while (*pp != NULL && (*pp)->state != PCAP_FILE_DONE)
+        pp = &(*pp)->next;
+    if (*pp != NULL) {
+        PcapFileStats *old = *pp;
+        *pp = old->next;
+        PcapFileStatsFree(old);
+        pcap_g.files_done--;
+    }
+}
+
+/**
+ *  \brief check if a file is queued, read or was read already
+ *
+ *  Called with parts_lock held.
+ */
+static int PcapFileMmapKnown(const char *path, const struct stat *st)
+{
+    PcapFileStats *fs;
+
+    /* a file can be reported more than once, e.g. when it is written
+     * while the directory is scanned or opened for writing again */
+    for (fs = pcap_g.files; fs != NULL; fs = fs->next) {
+        if (strcmp(fs->path, path) == 0 &&
+            (fs->state != PCAP_FILE_DONE ||
+             (fs->mtime == st->st_mtime && fs->size == (uint64_t)st->st_size)))
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ *  \brief add the parts of a file to the queue, in the order of their
+ *         first record
+ *
+ *  Called with parts_lock held.
+ */
+static void PcapFileMmapPartsInsert(PcapMmapPart *parts)
+{
+    PcapMmapPart **pp = &pcap_g.parts;
+
+    while (parts != NULL) {
+        PcapMmapPart *part = parts;
+        parts = part->next;
+
+        while (*pp != NULL && !timercmp(&part->ts, &(*pp)->ts, <))
+            pp = &(*pp)->next;
+        part->next = *pp;
+        *pp = part;
+        /* the next part of the file is not older */
+        pp = &part->next;
+    }
+}
+
+/**
+ *  \brief queue a file for the readers
+ *
+ *  The file is mapped and split, and the first records of the parts are
+ *  read before the parts are queued, without holding parts_lock.
+ *
+ *  \retval 0 file queued or known already
+ *  \retval -1 error
+ */
+static int PcapFileMmapAddFile(const char *path)
+{
+    PcapFileStats *fs;
+    struct stat st;
+    int known;
+
+    if (stat(path, &st) != 0) {
+        SCLogError(SC_ERR_FOPEN, "failed to stat %s: %s", path, strerror(errno));
+        return -1;
+    }
+    SCMutexLock(&pcap_g.parts_lock);
+    known = PcapFileMmapKnown(path, &st);
+    SCMutexUnlock(&pcap_g.parts_lock);
+    if (known)
+        return 0;
+
+    PcapMmapFile *f = PcapMmapFileOpen(path);
+    if (f == NULL)
+        return -1;
+
+    if (!f->pcapng) {
+        switch (f->linktype) {
+            case LINKTYPE_LINUX_SLL:
+            case LINKTYPE_ETHERNET:
+            case LINKTYPE_PPP:
+            case LINKTYPE_RAW:
+                break;
+            default:
+                SCLogError(SC_ERR_UNIMPLEMENTED, "datalink type %" PRId32 " of "
+                           "%s not (yet) supported in module PcapFile.",
+                           f->linktype, path);
+                PcapMmapFileDeref(f);
+                return -1;
+        }
+    }
+
+    fs = SCMalloc(sizeof(PcapFileStats));
+    if (unlikely(fs == NULL)) {
+        PcapMmapFileDeref(f);
+        return -1;
+    }
+    memset(fs, 0, sizeof(PcapFileStats));
+    fs->path = SCStrdup(path);
+    if (unlikely(fs->path == NULL)) {
+        SCFree(fs);
+        PcapMmapFileDeref(f);
+        return -1;
+    }
+    fs->file = f;
+    fs->size = f->size;
+    fs->mtime = st.st_mtime;
+
+    PcapMmapPart *parts = PcapMmapFileSplit(f, pcap_g.split_size);
+    /* the parts hold the references now */
+    PcapMmapFileDeref(f);
+    if (parts == NULL) {
+        PcapFileStatsFree(fs);
+        return -1;
+    }
+
+    /* parts without records sort first and are done right away */
+    PcapMmapPart *part;
+    for (part = parts; part != NULL; part = part->next)
+        fs->parts++;
+    fs->first_ts = parts->ts;
+
+    SCMutexLock(&pcap_g.parts_lock);
+    known = PcapFileMmapKnown(path, &st);
+    if (!known) {
+        PcapFileStatsInsert(fs);
+        PcapFileMmapPartsInsert(parts);
+    }
+    SCMutexUnlock(&pcap_g.parts_lock);
+
+    if (known) {
+        /* queued by another thread meanwhile */
+        while (parts != NULL) {
+            part = parts;
+            parts = part->next;
+            PcapMmapFileDeref(part->file);
+            SCFree(part);
+        }
+        PcapFileStatsFree(fs);
+    }
+    return 0;
+}
+
+static int PcapFileMmapFilter(const struct dirent *d)
+{
+    return d->d_name[0] != '.';
+}
+
+/**
+ *  \brief queue the files of a directory
+ *
+ *  \retval added number of files queued
+ *  \retval -1 error
+ */
+static int PcapFileMmapAddDir(const char *path)
+{
+    struct dirent **names = NULL;
+    int cnt = scandir(path, &names, PcapFileMmapFilter, alphasort);
+    int i, added = 0;
+
+    if (cnt < 0) {
+        SCLogError(SC_ERR_FOPEN, "failed to read directory %s: %s", path,
+                   strerror(errno));
+        return -1;
+    }
+
+    for (i = 0; i < cnt; i++) {
+        char file[PATH_MAX];
+        struct stat st;
+
+        snprintf(file, sizeof(file), "%s/%s", path, names[i]->d_name);
+        if (stat(file, &st) == 0 && S_ISREG(st.st_mode)) {
+            if (PcapFileMmapAddFile(file) == 0)
+                added++;
+            else
+                SCLogWarning(SC_ERR_PCAP_OPEN_OFFLINE, "skipping %s", file);
+        }
+        free(names[i]);
+    }
+    free(names);
+
+    return added;
+}
+
+/**
+ *  \brief start watching a directory for pcap files and queue the files
+ *         already in it
+ *
+ *  Only files that are closed after writing or moved into the directory
+ *  are picked up, so writers should not leave the files open.
+ */
+static int PcapFileWatchSetup(const char *path)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+    struct stat st;
+
+    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "%s is not a directory, can't "
+                   "watch it for pcap files", path);
+        return -1;
+    }
+    char *dir = SCStrdup(path);
+    if (unlikely(dir == NULL))
+        return -1;
+    /* the pcap-dir-stats command reads it */
+    SCMutexLock(&pcap_g.parts_lock);
+    pcap_g.watch_dir = dir;
+    SCMutexUnlock(&pcap_g.parts_lock);
+
+    pcap_g.watch_fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+    if (pcap_g.watch_fd == -1) {
+        SCLogError(SC_ERR_FOPEN, "inotify_init1 failed: %s", strerror(errno));
+        return -1;
+    }
+    /* watch before the scan, so no file is missed in between */
+    if (inotify_add_watch(pcap_g.watch_fd, path, IN_CLOSE_WRITE|IN_MOVED_TO) == -1) {
+        SCLogError(SC_ERR_FOPEN, "failed to watch %s: %s", path, strerror(errno));
+        return -1;
+    }
+    if (PcapFileMmapAddDir(path) < 0)
+        return -1;
+
+    SCLogInfo("watching %s for pcap files", path);
+    return 0;
+#else
+    SCLogError(SC_ERR_UNIMPLEMENTED, "pcap-file.watch needs inotify, which "
+               "is not available on this system");
+    return -1;
+#endif
+}
+
+#ifdef HAVE_SYS_INOTIFY_H
+/**
+ *  \brief queue the files reported by inotify
+ */
+static void PcapFileWatchRead(void)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    while (1) {
+        ssize_t len = read(pcap_g.watch_fd, buf, sizeof(buf));
+        if (len <= 0)
+            break;
+
+        char *ptr = buf;
+        while (ptr < buf + len) {
+            const struct inotify_event *ev = (const struct inotify_event *)ptr;
+            ptr += sizeof(struct inotify_event) + ev->len;
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                SCLogWarning(SC_ERR_PCAP_DISPATCH, "inotify queue overflow, "
+                             "files written to %s meanwhile are not read",
+                             pcap_g.watch_dir);
+                continue;
+            }
+            if ((ev->mask & IN_ISDIR) || ev->len == 0 || ev->name[0] == '.')
+                continue;
+
+            char file[PATH_MAX];
+            snprintf(file, sizeof(file), "%s/%s", pcap_g.watch_dir, ev->name);
+            if (PcapFileMmapAddFile(file) != 0)
+                SCLogWarning(SC_ERR_PCAP_OPEN_OFFLINE, "skipping %s", file);
+        }
+    }
+}
+#endif
+
+/**
+ *  \brief wait a bit for files to show up in the watched directory
+ */
+static void PcapFileWatchWait(void)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+    struct pollfd pfd;
+
+    pfd.fd = pcap_g.watch_fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, PCAP_FILE_WATCH_POLL_MS) > 0)
+        PcapFileWatchRead();
+#endif
+}
+
+/**
+ *  \brief queue the files for the receive threads, done by the first
+ *         thread. The others wait for it, so none runs out of files
+ *         before they are queued.
+ */
+static int PcapFileMmapSetup(const char *path)
+{
+    int r = 0;
+    intmax_t split_size = 0;
+    struct stat st;
+
+    SCMutexLock(&pcap_g.setup_lock);
+    if (pcap_g.parts_setup) {
+        SCMutexUnlock(&pcap_g.setup_lock);
+        return 0;
+    }
+    pcap_g.parts_setup = 1;
+
+    if (ConfGetInt("pcap-file.split-size", &split_size) != 1 || split_size < 0)
+        split_size = 0;
+    pcap_g.split_size = (size_t)split_size;
+
+    if (PcapFileWatchEnabled()) {
+        r = PcapFileWatchSetup(path);
+    } else if (stat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+        r = (PcapFileMmapAddDir(path) > 0) ? 0 : -1;
+    } else {
+        r = PcapFileMmapAddFile(path);
+    }
+    SCMutexUnlock(&pcap_g.setup_lock);
+
+    return r;
+}
+
+/**
+ *  \brief get the next part to read, the one with the oldest first record
+ *
+ *  \param stats set to the file of the part
+ */
+static PcapMmapPart *PcapFileMmapGetPart(PcapFileStats **stats)
+{
+    SCMutexLock(&pcap_g.parts_lock);
+    PcapMmapPart *part = pcap_g.parts;
+    if (part != NULL) {
+        pcap_g.parts = part->next;
+        part->next = NULL;
+
+        PcapFileStats *fs;
+        for (fs = pcap_g.files; fs != NULL; fs = fs->next) {
+            if (fs->file == part->file && fs->state != PCAP_FILE_DONE)
+                break;
+        }
+        BUG_ON(fs == NULL);
+        if (fs->state == PCAP_FILE_QUEUED) {
+            fs->state = PCAP_FILE_READING;
+            gettimeofday(&fs->start, NULL);
+        }
+        *stats = fs;
+    }
+    SCMutexUnlock(&pcap_g.parts_lock);
+    return part;
+}
+
+/**
+ *  \brief release the part of the thread and add its counts to the file
+ */
+static void PcapFileMmapPartDone(PcapFileThreadVars *ptv)
+{
+    SCMutexLock(&pcap_g.parts_lock);
+    PcapFileStats *fs = ptv->stats;
+    fs->pkts += ptv->part_pkts;
+    fs->bytes += ptv->part_bytes;
+    if (--fs->parts == 0)
+        PcapFileStatsDone(fs);
+    SCMutexUnlock(&pcap_g.parts_lock);
+
+    PcapMmapFileDeref(ptv->part->file);
+    SCFree(ptv->part);
+    ptv->part = NULL;
+    ptv->stats = NULL;
+    ptv->rec_pending = 0;
+    ptv->part_pkts = 0;
+    ptv->part_bytes = 0;
+}
+
+#ifdef BUILD_UNIX_SOCKET
+/**
+ *  \brief unix socket command listing the files of the mmap reader with
+ *         their throughput and lag
+ *
+ *  The lag of a file is the time from its last write to the end of its
+ *  processing, or to now if it is not done yet. The top level lag is the
+ *  one of the oldest file not done.
+ */
+TmEcode PcapFileDirStats(json_t *cmd, json_t *answer, void *data)
+{
+    PcapFileStats *fs;
+    struct timeval now;
+    uint32_t queued = 0;
+    intmax_t lag = 0;
+    json_t *jdata;
+    json_t *jarray;
+
+    jdata = json_object();
+    if (jdata == NULL) {
+        json_object_set_new(answer, "message",
+                            json_string("internal error at json object creation"));
+        return TM_ECODE_FAILED;
+    }
+    jarray = json_array();
+    if (jarray == NULL) {
+        json_decref(jdata);
+        json_object_set_new(answer, "message",
+                            json_string("internal error at json object creation"));
+        return TM_ECODE_FAILED;
+    }
+
+    gettimeofday(&now, NULL);
+
+    SCMutexLock(&pcap_g.parts_lock);
+    for (fs = pcap_g.files; fs != NULL; fs = fs->next) {
+        json_t *jfile = json_object();
+        if (jfile == NULL)
+            continue;
+
+        json_object_set_new(jfile, "filename", json_string(fs->path));
+        json_object_set_new(jfile, "size", json_integer(fs->size));
+        json_object_set_new(jfile, "first-ts", json_integer(fs->first_ts.tv_sec));
+        if (fs->state == PCAP_FILE_DONE) {
+            double secs = (fs->end.tv_sec - fs->start.tv_sec) +
+                          (fs->end.tv_usec - fs->start.tv_usec) / 1000000.0;
+            json_object_set_new(jfile, "state", json_string("done"));
+            json_object_set_new(jfile, "packets", json_integer(fs->pkts));
+            json_object_set_new(jfile, "bytes", json_integer(fs->bytes));
+            json_object_set_new(jfile, "duration", json_real(secs));
+            json_object_set_new(jfile, "mbps", json_real(secs > 0 ?
+                                (fs->bytes * 8) / secs / 1000000.0 : 0.0));
+            json_object_set_new(jfile, "lag",
+                                json_integer(fs->end.tv_sec - fs->mtime));
+        } else {
+            intmax_t flag = now.tv_sec - fs->mtime;
+            if (fs->state == PCAP_FILE_QUEUED) {
+                json_object_set_new(jfile, "state", json_string("queued"));
+                queued++;
+            } else {
+                /* counts are added when a part is done */
+                json_object_set_new(jfile, "state", json_string("reading"));
+                json_object_set_new(jfile, "packets", json_integer(fs->pkts));
+                json_object_set_new(jfile, "bytes", json_integer(fs->bytes));
+            }
+            json_object_set_new(jfile, "lag", json_integer(flag));
+            if (flag > lag)
+                lag = flag;
+        }
+        json_array_append_new(jarray, jfile);
+    }
+    if (pcap_g.watch_dir != NULL)
+        json_object_set_new(jdata, "directory", json_string(pcap_g.watch_dir));
+    SCMutexUnlock(&pcap_g.parts_lock);
+
+    json_object_set_new(jdata, "queued", json_integer(queued));
+    json_object_set_new(jdata, "lag", json_integer(lag));
+    json_object_set_new(jdata, "files", jarray);
+    json_object_set_new(answer, "message", jdata);
+    return TM_ECODE_OK;
+}
+#endif /* BUILD_UNIX_SOCKET */
+
+static TmEcode PcapFileMmapReleaseData(ThreadVars *t, Packet *p)
+{
+    if (p->pcap_v.file != NULL) {
+        PcapMmapFileDeref(p->pcap_v.file);
+        p->pcap_v.file = NULL;
+    }
+    return TM_ECODE_OK;
+}
+
+/**
+ *  \brief hand a record to the engine, the packet points into the map
+ */
+static inline TmEcode PcapFileMmapPacket(PcapFileThreadVars *ptv, PcapMmapRecord *rec)
+{
+    if (unlikely(rec->caplen > MAX_PAYLOAD_SIZE)) {
+        SCLogDebug("record of %"PRIu32" bytes too big", rec->caplen);
+        ptv->errs++;
+        return TM_ECODE_OK;
+    }
+
+#ifdef __tile__
+    Packet *p = PacketGetFromQueueOrAlloc(0);
+#else
+    Packet *p = PacketGetFromQueueOrAlloc();
+#endif
+    if (unlikely(p == NULL)) {
+        return TM_ECODE_OK;
+    }
+    PACKET_PROFILING_TMM_START(p, TMM_RECEIVEPCAPFILE);
+
+    PKT_SET_SRC(p, PKT_SRC_WIRE);
+    p->ts = rec->ts;
+    p->datalink = rec->datalink;
+    /* the merge hands the records out in order, so are the numbers */
+    p->pcap_cnt = SC_ATOMIC_ADD(pcap_g.cnt, 1);
+
+    ptv->pkts++;
+    ptv->bytes += rec->caplen;
+    ptv->part_pkts++;
+    ptv->part_bytes += rec->caplen;
+
+    PacketSetData(p, rec->data, rec->caplen);
+    PcapMmapFileRef(ptv->part->file);
+    p->pcap_v.file = ptv->part->file;
+    p->ReleaseData = PcapFileMmapReleaseData;
+    PACKET_PROFILING_TMM_END(p, TMM_RECEIVEPCAPFILE);
+
+    return TmThreadsSlotProcessPktBatched(ptv->tv, ptv->slot, p);
+}
+
+/**
+ *  \brief set the time of the next record of a reader
+ *
+ *  \param ts time of the next record, NULL if the reader has no part
+ */
+static void PcapFileMergeUpdate(PcapFileThreadVars *ptv, const struct timeval *ts)
+{
+    SCMutexLock(&pcap_g.merge_lock);
+    if (ts != NULL) {
+        pcap_g.merge_ts[ptv->reader] = *ts;
+        pcap_g.merge_idle[ptv->reader] = 0;
+    } else {
+        pcap_g.merge_idle[ptv->reader] = 1;
+    }
+    SCCondBroadcast(&pcap_g.merge_cond);
+    SCMutexUnlock(&pcap_g.merge_lock);
+}
+
+/**
+ *  \brief records up to limit can be dispatched, the one at limit only
+ *         if inclusive is set
+ */
+static inline int PcapFileMergeBefore(const struct timeval *ts,
+                                      const struct timeval *limit, int inclusive)
+{
+    return timercmp(ts, limit, <) || (inclusive && timercmp(ts, limit, ==));
+}
+
+/**
+ *  \brief wait until the next record of the reader is the oldest of the
+ *         readers
+ *
+ *  The readers hand their records to the engine in packet time order, so
+ *  the engine time only moves forward and the packets of a flow that is
+ *  in parts read by different threads stay in order. On equal times the
+ *  reader with the lowest index goes first.
+ *
+ *  \param ts time of the next record of the reader
+ *  \param limit set to the time of the oldest next record of the others
+ *  \param inclusive set if the record at limit is the reader's
+ *
+ *  \retval 1 limit is set
+ *  \retval 0 the other readers have no part, there is no limit
+ *  \retval -1 the engine is stopping
+ */
+static int PcapFileMergeWait(PcapFileThreadVars *ptv, const struct timeval *ts,
+                             struct timeval *limit, int *inclusive)
+{
+    int r;
+
+    SCMutexLock(&pcap_g.merge_lock);
+    pcap_g.merge_ts[ptv->reader] = *ts;
+    pcap_g.merge_idle[ptv->reader] = 0;
+    SCCondBroadcast(&pcap_g.merge_cond);
+
+    while (1) {
+        int i, min = -1;
+        for (i = 0; i < pcap_g.merge_readers; i++) {
+            if (i == ptv->reader || pcap_g.merge_idle[i])
+                continue;
+            if (min == -1 || timercmp(&pcap_g.merge_ts[i], &pcap_g.merge_ts[min], <))
+                min = i;
+        }
+        if (min == -1) {
+            r = 0;
+            break;
+        }
+        *limit = pcap_g.merge_ts[min];
+        *inclusive = (ptv->reader < min);
+        if (PcapFileMergeBefore(ts, limit, *inclusive)) {
+            r = 1;
+            break;
+        }
+        if (suricata_ctl_flags & (SURICATA_STOP | SURICATA_KILL)) {
+            r = -1;
+            break;
+        }
+
+        struct timeval tv_now;
+        struct timespec wait;
+        gettimeofday(&tv_now, NULL);
+        wait.tv_sec = tv_now.tv_sec;
+        wait.tv_nsec = (tv_now.tv_usec + PCAP_FILE_WATCH_POLL_MS * 1000) * 1000;
+        if (wait.tv_nsec >= 1000000000) {
+            wait.tv_sec++;
+            wait.tv_nsec -= 1000000000;
+        }
+        SCCondTimedwait(&pcap_g.merge_cond, &pcap_g.merge_lock, &wait);
+    }
+    SCMutexUnlock(&pcap_g.merge_lock);
+    return r;
+}
+
+/**
+ *  \brief read the next record of the part into ptv->rec
+ *
+ *  \retval 1 record read, 0 end of the part, -1 error
+ */
+static int PcapFileMmapNextRecord(PcapFileThreadVars *ptv)
+{
+    PcapMmapFile *f = ptv->part->file;
+
+    if (ptv->offset >= ptv->readahead) {
+        PcapMmapReadahead(f, ptv->offset, ptv->part->end);
+        ptv->readahead = ptv->offset + PCAP_MMAP_READAHEAD / 2;
+    }
+    int r = PcapMmapNext(f, &ptv->offset, ptv->part->end, &ptv->rec);
+    ptv->rec_pending = (r == 1);
+    return r;
+}
+
+/**
+ *  \brief mmap reader loop: read parts until none are left
+ *
+ *  The last thread to run out of parts stops the engine. In watch mode the
+ *  threads wait for new files instead, until the engine is stopped.
+ */
+static TmEcode ReceivePcapFileMmapLoop(ThreadVars *tv, PcapFileThreadVars *ptv)
+{
+    uint16_t packet_q_len = 0;
+
+    while (1) {
+        if (suricata_ctl_flags & (SURICATA_STOP | SURICATA_KILL)) {
+            SCReturnInt(TM_ECODE_OK);
+        }
+
+        if (ptv->part == NULL) {
+            ptv->part = PcapFileMmapGetPart(&ptv->stats);
+            if (ptv->part == NULL) {
+                PcapFileMergeUpdate(ptv, NULL);
+                if (pcap_g.watch_dir == NULL)
+                    break;
+                PcapFileWatchWait();
+                continue;
+            }
+            ptv->offset = ptv->part->start;
+            ptv->readahead = ptv->offset;
+            SCLogInfo("reading pcap file %s (bytes %"PRIuMAX"-%"PRIuMAX")",
+                      ptv->part->file->path, (uintmax_t)ptv->part->start,
+                      (uintmax_t)ptv->part->end);
+        }
+
+        PcapMmapFile *f = ptv->part->file;
+        int r = 1;
+        if (!ptv->rec_pending)
+            r = PcapFileMmapNextRecord(ptv);
+
+        if (r == 1) {
+            /* make sure we have at least one packet in the packet pool, to prevent
+             * us from alloc'ing packets at line rate */
+            do {
+#ifdef __tile__
+                packet_q_len = PacketPoolSize(0);
+                if (unlikely(packet_q_len == 0)) {
+                    PacketPoolWait(0);
+                }
+#else
+                packet_q_len = PacketPoolSize();
+                if (unlikely(packet_q_len == 0)) {
+                    PacketPoolWait();
+                }
+#endif
+            } while (packet_q_len == 0);
+
+            struct timeval limit;
+            int inclusive = 0;
+            int merge = PcapFileMergeWait(ptv, &ptv->rec.ts, &limit, &inclusive);
+            if (merge == -1)
+                continue;
+
+            uint16_t i;
+            for (i = 0; i < packet_q_len; i++) {
+                if (PcapFileMmapPacket(ptv, &ptv->rec) != TM_ECODE_OK) {
+                    ptv->cb_result = TM_ECODE_FAILED;
+                    break;
+                }
+                r = PcapFileMmapNextRecord(ptv);
+                if (r != 1)
+                    break;
+                /* stop at the next record of another reader */
+                if (merge == 1 && !PcapFileMergeBefore(&ptv->rec.ts, &limit, inclusive))
+                    break;
+            }
+            if (TmThreadsSlotFlushBatch(tv, ptv->slot) != TM_ECODE_OK) {
+                ptv->cb_result = TM_ECODE_FAILED;
+            }
+            /* the batch is out, let the others go. At the end of the part
+             * the time is kept until the next part is known. */
+            if (ptv->rec_pending && merge == 1)
+                PcapFileMergeUpdate(ptv, &ptv->rec.ts);
+        }
+
+        if (ptv->cb_result == TM_ECODE_FAILED) {
+            SCLogError(SC_ERR_PCAP_DISPATCH, "Pcap file thread modules failed");
+            EngineKill();
+            SCReturnInt(TM_ECODE_FAILED);
+        } else if (r == -1) {
+            /* in the error state we just kill the engine */
+            EngineKill();
+            SCReturnInt(TM_ECODE_FAILED);
+        } else if (r == 0) {
+            if (ptv->offset > ptv->part->end) {
+                SCLogWarning(SC_ERR_PCAP_DISPATCH, "%s: split point %"PRIuMAX
+                             " was not a record boundary, the next part was "
+                             "read from a wrong offset", f->path,
+                             (uintmax_t)ptv->part->end);
+            }
+            PcapFileMmapPartDone(ptv);
+        }
+    }
+
+    if (SC_ATOMIC_SUB(pcap_g.readers, 1) == 0) {
+        SCLogInfo("pcap file end of file reached");
+        EngineStop();
+    }
+    SCReturnInt(TM_ECODE_DONE);
+}
+
 /**
  *  \brief Main PCAP file reading Loop function
  */
@@ -166,6 +1092,13 @@ TmEcode ReceivePcapFileLoop(ThreadVars *tv, void *data, void *slot)
     ptv->slot = s->slot_next;
     ptv->cb_result = TM_ECODE_OK;
 
+    if (ptv->mmap) {
+        TmEcode ret = ReceivePcapFileMmapLoop(tv, ptv);
+        /* don't hold up the other readers */
+        PcapFileMergeUpdate(ptv, NULL);
+        return ret;
+    }
+
     while (1) {
         if (suricata_ctl_flags & (SURICATA_STOP | SURICATA_KILL)) {
             SCReturnInt(TM_ECODE_OK);
@@ -190,6 +1123,9 @@ TmEcode ReceivePcapFileLoop(ThreadVars *tv, void *data, void *slot)
         /* Right now we just support reading packets one at a time. */
         r = pcap_dispatch(pcap_g.pcap_handle, (int)packet_q_len,
                           (pcap_handler)PcapFileCallbackLoop, (u_char *)ptv);
+        if (TmThreadsSlotFlushBatch(tv, ptv->slot) != TM_ECODE_OK) {
+            ptv->cb_result = TM_ECODE_FAILED;
+        }
         if (unlikely(r == -1)) {
             SCLogError(SC_ERR_PCAP_DISPATCH, "error code %" PRId32 " %s",
                        r, pcap_geterr(pcap_g.pcap_handle));
@@ -226,7 +1162,6 @@ TmEcode ReceivePcapFileLoop(ThreadVars *tv, void *data, void *slot)
                 SCReturnInt(TM_ECODE_DONE);
             }
         }
-        SCPerfSyncCountersIfSignalled(tv, 0);
     }
 
     SCReturnInt(TM_ECODE_OK);
@@ -247,6 +1182,33 @@ TmEcode ReceivePcapFileThreadInit(ThreadVars *tv, void *initdata, void **data) {
         SCReturnInt(TM_ECODE_FAILED);
     memset(ptv, 0, sizeof(PcapFileThreadVars));
 
+    if (PcapFileWatchEnabled() && !PcapFileMmapEnabled()) {
+        SCLogError(SC_ERR_INVALID_ARGUMENT, "pcap-file.watch needs the mmap "
+                   "reader, which is not used with a bpf-filter or in unix "
+                   "socket mode");
+        SCFree(ptv);
+        SCReturnInt(TM_ECODE_FAILED);
+    }
+
+    if (PcapFileMmapEnabled()) {
+        if (PcapFileMmapSetup((char *)initdata) != 0) {
+            SCLogError(SC_ERR_PCAP_OPEN_OFFLINE, "no pcap file to read in %s",
+                       (char *)initdata);
+            SCFree(ptv);
+            SCReturnInt(TM_ECODE_FAILED);
+        }
+        (void) SC_ATOMIC_ADD(pcap_g.readers, 1);
+        ptv->reader = (int)SC_ATOMIC_ADD(pcap_g.threads, 1) - 1;
+        SCMutexLock(&pcap_g.merge_lock);
+        if (ptv->reader >= pcap_g.merge_readers)
+            pcap_g.merge_readers = ptv->reader + 1;
+        SCMutexUnlock(&pcap_g.merge_lock);
+        ptv->mmap = 1;
+        ptv->tv = tv;
+        *data = (void *)ptv;
+        SCReturnInt(TM_ECODE_OK);
+    }
+
     char errbuf[PCAP_ERRBUF_SIZE] = "";
     pcap_g.pcap_handle = pcap_open_offline((char *)initdata, errbuf);
     if (pcap_g.pcap_handle == NULL) {
@@ -283,16 +1245,9 @@ TmEcode ReceivePcapFileThreadInit(ThreadVars *tv, void *initdata, void **data) {
 
     switch(pcap_g.datalink) {
         case LINKTYPE_LINUX_SLL:
-            pcap_g.Decoder = DecodeSll;
-            break;
         case LINKTYPE_ETHERNET:
-            pcap_g.Decoder = DecodeEthernet;
-            break;
         case LINKTYPE_PPP:
-            pcap_g.Decoder = DecodePPP;
-            break;
         case LINKTYPE_RAW:
-            pcap_g.Decoder = DecodeRaw;
             break;
 
         default:
@@ -325,13 +1280,84 @@ void ReceivePcapFileThreadExitStats(ThreadVars *tv, void *data) {
 TmEcode ReceivePcapFileThreadDeinit(ThreadVars *tv, void *data) {
     SCEnter();
     PcapFileThreadVars *ptv = (PcapFileThreadVars *)data;
-    if (ptv) {
+    if (ptv == NULL)
+        SCReturnInt(TM_ECODE_OK);
+
+    if (!ptv->mmap) {
         SCFree(ptv);
+        SCReturnInt(TM_ECODE_OK);
+    }
+
+    if (ptv->part != NULL)
+        PcapFileMmapPartDone(ptv);
+    SCFree(ptv);
+
+    if (SC_ATOMIC_SUB(pcap_g.threads, 1) != 0)
+        SCReturnInt(TM_ECODE_OK);
+
+    /* last thread: clean up what is left over when the engine was
+     * stopped early */
+    SCMutexLock(&pcap_g.parts_lock);
+    PcapMmapPart *part;
+    while ((part = pcap_g.parts) != NULL) {
+        pcap_g.parts = part->next;
+        PcapMmapFileDeref(part->file);
+        SCFree(part);
     }
+    PcapFileStats *fs;
+    while ((fs = pcap_g.files) != NULL) {
+        pcap_g.files = fs->next;
+        PcapFileStatsFree(fs);
+    }
+    pcap_g.files_done = 0;
+    if (pcap_g.watch_fd != -1) {
+        close(pcap_g.watch_fd);
+        pcap_g.watch_fd = -1;
+    }
+    if (pcap_g.watch_dir != NULL) {
+        SCFree(pcap_g.watch_dir);
+        pcap_g.watch_dir = NULL;
+    }
+    SCMutexUnlock(&pcap_g.parts_lock);
     SCReturnInt(TM_ECODE_OK);
 }
 
-double prev_signaled_ts = 0;
+static inline void DecodePcapFilePacket(ThreadVars *tv, DecodeThreadVars *dtv,
+                                        Packet *p, PacketQueue *pq)
+{
+    double curr_ts = p->ts.tv_sec + p->ts.tv_usec / 1000.0;
+    if (curr_ts < dtv->flow_wakeup_ts || (curr_ts - dtv->flow_wakeup_ts) > 60.0) {
+        dtv->flow_wakeup_ts = curr_ts;
+        FlowWakeupFlowManagerThread();
+    }
+
+    /* update the engine time representation based on the timestamp
+     * of the packet. With several readers the merge hands the packets
+     * out in time order, so the time doesn't go back and forth. */
+    TimeSet(&p->ts);
+
+    /* call the decoder, the mmap reader can mix datalinks */
+    switch (p->datalink) {
+        case LINKTYPE_LINUX_SLL:
+            DecodeSll(tv, dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), pq);
+            break;
+        case LINKTYPE_ETHERNET:
+            if (decode_fast_path && DecodeEthernetFast(tv, dtv, p,
+                        GET_PKT_DATA(p), GET_PKT_LEN(p), pq) == 1)
+                break;
+            DecodeEthernet(tv, dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), pq);
+            break;
+        case LINKTYPE_PPP:
+            DecodePPP(tv, dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), pq);
+            break;
+        case LINKTYPE_RAW:
+            DecodeRaw(tv, dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), pq);
+            break;
+        default:
+            SCLogDebug("datalink %d not supported", p->datalink);
+            break;
+    }
+}
 
 TmEcode DecodePcapFile(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, PacketQueue *postpq)
 {
@@ -351,18 +1377,48 @@ TmEcode DecodePcapFile(ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, P
     SCPerfCounterAddUI64(dtv->counter_avg_pkt_size, tv->sc_perf_pca, GET_PKT_LEN(p));
     SCPerfCounterSetUI64(dtv->counter_max_pkt_size, tv->sc_perf_pca, GET_PKT_LEN(p));
 
-    double curr_ts = p->ts.tv_sec + p->ts.tv_usec / 1000.0;
-    if (curr_ts < prev_signaled_ts || (curr_ts - prev_signaled_ts) > 60.0) {
-        prev_signaled_ts = curr_ts;
-        FlowWakeupFlowManagerThread();
-    }
+    DecodePcapFilePacket(tv, dtv, p, pq);
+    DecodeFastUpdateCounters(tv, dtv, p);
 
-    /* update the engine time representation based on the timestamp
-     * of the packet. */
-    TimeSet(&p->ts);
+    SCReturnInt(TM_ECODE_OK);
+}
 
-    /* call the decoder */
-    pcap_g.Decoder(tv, dtv, p, GET_PKT_DATA(p), GET_PKT_LEN(p), pq);
+/**
+ *  \brief decode a batch of packets, prefetching the flow buckets ahead of
+ *         the decoder and updating the packet, byte and fast path decoder
+ *         counters once per batch
+ */
+TmEcode DecodePcapFileBatch(ThreadVars *tv, Packet **pkts, uint16_t cnt, void *data, PacketQueue *pq, PacketQueue *postpq)
+{
+    SCEnter();
+    DecodeThreadVars *dtv = (DecodeThreadVars *)data;
+    uint32_t keys[TM_BATCH_SIZE_MAX];
+    uint64_t bytes = 0;
+    uint16_t i;
+
+    /* the flow lookup in the decoder is the likely cache miss, so get
+     * the buckets in ahead of it */
+    uint16_t lookahead = FlowHashPrefetchSetup(pkts, cnt, keys);
+
+    for (i = 0; i < cnt; i++) {
+        Packet *p = pkts[i];
+
+        if (lookahead > 0)
+            FlowHashPrefetchLookahead(keys, cnt, i, lookahead);
+        else if (i + 1 < cnt)
+            SCPrefetch(GET_PKT_DATA(pkts[i + 1]));
+
+        bytes += GET_PKT_LEN(p);
+        SCPerfCounterAddUI64(dtv->counter_avg_pkt_size, tv->sc_perf_pca, GET_PKT_LEN(p));
+        SCPerfCounterSetUI64(dtv->counter_max_pkt_size, tv->sc_perf_pca, GET_PKT_LEN(p));
+
+        DecodePcapFilePacket(tv, dtv, p, pq);
+    }
+
+    SCPerfCounterAddUI64(dtv->counter_pkts, tv->sc_perf_pca, cnt);
+    SCPerfCounterAddUI64(dtv->counter_pkts_per_sec, tv->sc_perf_pca, cnt);
+    SCPerfCounterAddUI64(dtv->counter_bytes, tv->sc_perf_pca, bytes);
+    DecodeFastFlushCounters(tv, dtv);
 
     SCReturnInt(TM_ECODE_OK);
 }
@@ -383,5 +1439,168 @@ TmEcode DecodePcapFileThreadInit(ThreadVars *tv, void *initdata, void **data)
     SCReturnInt(TM_ECODE_OK);
 }
 
+
+#ifdef UNITTESTS
+
+/** \test queued files are kept in the order of their first record, after
+ *        the ones being read */
+static int PcapFileTest01(void)
+{
+    int result = 0;
+    PcapFileStats *saved = pcap_g.files;
+    PcapFileStats fs[4];
+    int i;
+
+    memset(&fs, 0, sizeof(fs));
+    fs[0].state = PCAP_FILE_READING;
+    fs[0].first_ts.tv_sec = 50;
+    fs[1].first_ts.tv_sec = 30;
+    fs[2].first_ts.tv_sec = 10;
+    fs[3].first_ts.tv_sec = 20;
+    fs[3].first_ts.tv_usec = 1;
+
+    pcap_g.files = NULL;
+    for (i = 0; i < 4; i++)
+        PcapFileStatsInsert(&fs[i]);
+
+    PcapFileStats *expect[4] = { &fs[0], &fs[2], &fs[3], &fs[1] };
+    PcapFileStats *f = pcap_g.files;
+    for (i = 0; i < 4; i++, f = f->next) {
+        if (f != expect[i]) {
+            printf("entry %d is file with ts %"PRIuMAX": ", i,
+                   f ? (uintmax_t)f->first_ts.tv_sec : 0);
+            goto end;
+        }
+    }
+    if (f != NULL) {
+        printf("list too long: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    pcap_g.files = saved;
+    return result;
+}
+
+/** \test the reader with the oldest next record goes first, on equal
+ *        times the one with the lowest index */
+static int PcapFileTest02(void)
+{
+    int result = 0;
+    PcapFileThreadVars ptv;
+    struct timeval ts, limit;
+    int inclusive = 0;
+    int saved_readers = pcap_g.merge_readers;
+    uint8_t saved_flags = suricata_ctl_flags;
+
+    memset(&ptv, 0, sizeof(ptv));
+    memset(&ts, 0, sizeof(ts));
+    memset(&limit, 0, sizeof(limit));
+    pcap_g.merge_readers = 3;
+    memset(pcap_g.merge_idle, 0, sizeof(pcap_g.merge_idle));
+    pcap_g.merge_ts[1].tv_sec = 20;
+    pcap_g.merge_ts[1].tv_usec = 0;
+    pcap_g.merge_ts[2].tv_sec = 10;
+    pcap_g.merge_ts[2].tv_usec = 0;
+
+    /* oldest record, limited by reader 2 */
+    ptv.reader = 0;
+    ts.tv_sec = 5;
+    if (PcapFileMergeWait(&ptv, &ts, &limit, &inclusive) != 1 ||
+        limit.tv_sec != 10 || inclusive != 1) {
+        printf("reader 0 at 5: limit %"PRIuMAX" inclusive %d: ",
+               (uintmax_t)limit.tv_sec, inclusive);
+        goto end;
+    }
+    /* equal to reader 0, which has the lower index: wait */
+    suricata_ctl_flags = SURICATA_STOP;
+    ptv.reader = 2;
+    if (PcapFileMergeWait(&ptv, &ts, &limit, &inclusive) != -1) {
+        printf("reader 2 at 5 didn't wait: ");
+        goto end;
+    }
+    /* reader 0 at 10 and reader 2 at 10, reader 0 goes first */
+    ptv.reader = 0;
+    ts.tv_sec = 10;
+    pcap_g.merge_ts[2].tv_sec = 10;
+    if (PcapFileMergeWait(&ptv, &ts, &limit, &inclusive) != 1 ||
+        inclusive != 1) {
+        printf("reader 0 at 10 waited: ");
+        goto end;
+    }
+    /* the others are idle, no limit */
+    pcap_g.merge_idle[1] = 1;
+    pcap_g.merge_idle[2] = 1;
+    ts.tv_sec = 30;
+    if (PcapFileMergeWait(&ptv, &ts, &limit, &inclusive) != 0) {
+        printf("reader 0 limited by idle readers: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    suricata_ctl_flags = saved_flags;
+    pcap_g.merge_readers = saved_readers;
+    memset(pcap_g.merge_ts, 0, sizeof(pcap_g.merge_ts));
+    memset(pcap_g.merge_idle, 0, sizeof(pcap_g.merge_idle));
+    return result;
+}
+
+/** \test the parts of a file are queued among the parts of the other
+ *        files by their first record */
+static int PcapFileTest03(void)
+{
+    int result = 0;
+    PcapMmapPart *saved = pcap_g.parts;
+    PcapMmapPart x[3], y[2];
+    int i;
+
+    memset(&x, 0, sizeof(x));
+    memset(&y, 0, sizeof(y));
+    x[0].ts.tv_sec = 0;
+    x[1].ts.tv_sec = 10;
+    x[2].ts.tv_sec = 20;
+    x[0].next = &x[1];
+    x[1].next = &x[2];
+    y[0].ts.tv_sec = 5;
+    y[1].ts.tv_sec = 20;
+    y[0].next = &y[1];
+
+    pcap_g.parts = NULL;
+    PcapFileMmapPartsInsert(&x[0]);
+    PcapFileMmapPartsInsert(&y[0]);
+
+    PcapMmapPart *expect[5] = { &x[0], &y[0], &x[1], &x[2], &y[1] };
+    PcapMmapPart *part = pcap_g.parts;
+    for (i = 0; i < 5; i++, part = part->next) {
+        if (part != expect[i]) {
+            printf("entry %d is part with ts %"PRIuMAX": ", i,
+                   part ? (uintmax_t)part->ts.tv_sec : 0);
+            goto end;
+        }
+    }
+    if (part != NULL) {
+        printf("list too long: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    pcap_g.parts = saved;
+    return result;
+}
+
+#endif /* UNITTESTS */
+
+void ReceivePcapFileRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("PcapFileTest01", PcapFileTest01, 1);
+    UtRegisterTest("PcapFileTest02", PcapFileTest02, 1);
+    UtRegisterTest("PcapFileTest03", PcapFileTest03, 1);
+#endif /* UNITTESTS */
+}
+
 /* eof */
 
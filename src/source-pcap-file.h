@@ -24,8 +24,18 @@
 #ifndef __SOURCE_PCAP_FILE_H__
 #define __SOURCE_PCAP_FILE_H__
 
+#include "unix-manager.h"
+
 void TmModuleReceivePcapFileRegister (void);
 void TmModuleDecodePcapFileRegister (void);
 
+int PcapFileWatchEnabled(void);
+int PcapFileMmapEnabled(void);
+int PcapFileGetReceiveThreads(void);
+
+#ifdef BUILD_UNIX_SOCKET
+TmEcode PcapFileDirStats(json_t *cmd, json_t *answer, void *data);
+#endif
+
 #endif /* __SOURCE_PCAP_FILE_H__ */
 
@@ -39,6 +39,8 @@ char *PcapLiveGetDevice(int);
 /* per packet Pcap vars */
 typedef struct PcapPacketVars_
 {
+    /** mmap'd file the packet data points into, pcap file mode only */
+    struct PcapMmapFile_ *file;
 } PcapPacketVars;
 
 /** needs to be able to contain Windows adapter id's, so
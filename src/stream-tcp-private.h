@@ -52,6 +52,7 @@ typedef struct TcpSegment_ {
     uint8_t *payload;
     uint16_t payload_len;       /**< actual size of the payload */
     uint16_t pool_size;         /**< size of the memory */
+    uint8_t pool_node;          /**< NUMA node of the pool */
     uint32_t seq;
     struct TcpSegment_ *next;
     struct TcpSegment_ *prev;
@@ -151,7 +152,9 @@ enum
 /** Flag to avoid stream reassembly/app layer inspection for the stream */
 #define STREAMTCP_STREAM_FLAG_NOREASSEMBLY      0x02
 
-/** vacancy at 0x04 */
+/** Stream is bypassed: app layer is done with it and nothing will be
+ *  reassembled or inspected anymore. Implies NOREASSEMBLY. */
+#define STREAMTCP_STREAM_FLAG_BYPASS            0x04
 
 /** Stream has reached it's reassembly depth, all further packets are ignored */
 #define STREAMTCP_STREAM_FLAG_DEPTH_REACHED     0x08
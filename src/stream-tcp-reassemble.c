@@ -55,10 +55,13 @@
 #include "util-debug.h"
 #include "app-layer-protos.h"
 #include "app-layer.h"
+#include "app-layer-thread.h"
 
 #include "detect-engine-state.h"
 
 #include "util-profiling.h"
+#include "util-numa.h"
+#include "util-hugepage.h"
 
 #define PSEUDO_PACKET_PAYLOAD_SIZE  65416 /* 64 Kb minus max IP and TCP header */
 
@@ -71,7 +74,12 @@ static uint64_t segment_pool_memcnt = 0;
 /* We define several pools with prealloced segments with fixed size
  * payloads. We do this to prevent having to do an SCMalloc call for every
  * data segment we receive, which would be a large performance penalty.
- * The cost is in memory of course. */
+ * The cost is in memory of course.
+ *
+ * There is a set of pools per NUMA node. Node 0's pools are set up at
+ * init, the others by the first stream thread on that node so the
+ * preallocated segments are local to it. Segments return to the pools of
+ * the node they came from. */
 #define segment_pool_num 8
 static uint16_t segment_pool_pktsizes[segment_pool_num] = {4, 16, 112, 248, 512,
                                                            768, 1448, 0xffff};
@@ -84,8 +92,29 @@ static uint16_t segment_pool_poolsizes[segment_pool_num] = {0, 0, 0,
 static uint16_t segment_pool_poolsizes_prealloc[segment_pool_num] = {256, 512, 512,
                                                             512, 512, 1024,
                                                             1024, 128};
-static Pool *segment_pool[segment_pool_num];
-static SCMutex segment_pool_mutex[segment_pool_num];
+static Pool *segment_pool[NUMA_MAX_NODES][segment_pool_num];
+static SCMutex segment_pool_mutex[NUMA_MAX_NODES][segment_pool_num];
+/** protects setting up the pools of a node */
+static SCMutex segment_pool_node_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int segment_pool_node_init[NUMA_MAX_NODES] = { 0 };
+
+/** init data of a segment pool */
+typedef struct TcpSegmentPoolData_ {
+    uint16_t size;
+    uint8_t node;
+
+    /** part of the node slab for the payloads of the preallocated
+     *  segments, NULL if not used. Protected by the pool mutex. */
+    uint8_t *slab;
+    size_t slab_size;
+    /** free payloads in the slab, linked through their first bytes. The
+     *  payloads are not aligned, so the links are copied with memcpy. */
+    void *slab_free;
+} TcpSegmentPoolData;
+static TcpSegmentPoolData segment_pool_data[NUMA_MAX_NODES][segment_pool_num];
+/** hugepage backed payload slab per node */
+static uint8_t *segment_slab[NUMA_MAX_NODES];
+static size_t segment_slab_size[NUMA_MAX_NODES];
 #ifdef DEBUG
 static SCMutex segment_pool_cnt_mutex;
 static uint64_t segment_pool_cnt = 0;
@@ -175,16 +204,23 @@ void *TcpSegmentPoolAlloc()
     return seg;
 }
 
-int TcpSegmentPoolInit(void *data, void *payload_len)
+int TcpSegmentPoolInit(void *data, void *initdata)
 {
     TcpSegment *seg = (TcpSegment *) data;
+    TcpSegmentPoolData *pd = (TcpSegmentPoolData *) initdata;
 
     memset(seg, 0, sizeof (TcpSegment));
 
-    seg->pool_size = *((uint16_t *) payload_len);
+    seg->pool_size = pd->size;
     seg->payload_len = seg->pool_size;
+    seg->pool_node = pd->node;
 
-    seg->payload = SCMalloc(seg->payload_len);
+    if (pd->slab_free != NULL) {
+        seg->payload = pd->slab_free;
+        memcpy(&pd->slab_free, seg->payload, sizeof(void *));
+    } else {
+        seg->payload = SCRegionMalloc(MEM_REGION_STREAM, seg->payload_len);
+    }
     if (seg->payload == NULL) {
         SCFree(seg);
         return 0;
@@ -199,6 +235,7 @@ int TcpSegmentPoolInit(void *data, void *payload_len)
 #endif
 
     StreamTcpReassembleIncrMemuse((uint32_t)seg->pool_size + sizeof(TcpSegment));
+    UtilNumaMemuseAdd(seg->pool_node, (uint32_t)seg->pool_size + sizeof(TcpSegment));
     return 1;
 }
 
@@ -210,6 +247,7 @@ void TcpSegmentPoolCleanup(void *ptr) {
     TcpSegment *seg = (TcpSegment *) ptr;
 
     StreamTcpReassembleDecrMemuse((uint32_t)seg->pool_size + sizeof(TcpSegment));
+    UtilNumaMemuseSub(seg->pool_node, (uint32_t)seg->pool_size + sizeof(TcpSegment));
 
 #ifdef DEBUG
     SCMutexLock(&segment_pool_memuse_mutex);
@@ -219,7 +257,16 @@ void TcpSegmentPoolCleanup(void *ptr) {
     SCMutexUnlock(&segment_pool_memuse_mutex);
 #endif
 
-    SCFree(seg->payload);
+    TcpSegmentPoolData *pd =
+        &segment_pool_data[seg->pool_node][segment_pool_idx[seg->pool_size]];
+    if (pd->slab != NULL && seg->payload >= pd->slab &&
+        seg->payload < pd->slab + pd->slab_size)
+    {
+        memcpy(seg->payload, &pd->slab_free, sizeof(void *));
+        pd->slab_free = seg->payload;
+    } else {
+        SCRegionFree(seg->payload);
+    }
     return;
 }
 
@@ -237,11 +284,12 @@ void StreamTcpSegmentReturntoPool(TcpSegment *seg)
     seg->prev = NULL;
 
     uint16_t idx = segment_pool_idx[seg->pool_size];
-    SCMutexLock(&segment_pool_mutex[idx]);
-    PoolReturn(segment_pool[idx], (void *) seg);
-    SCLogDebug("segment_pool[%"PRIu16"]->empty_list_size %"PRIu32"",
-               idx,segment_pool[idx]->empty_list_size);
-    SCMutexUnlock(&segment_pool_mutex[idx]);
+    uint8_t node = seg->pool_node;
+    SCMutexLock(&segment_pool_mutex[node][idx]);
+    PoolReturn(segment_pool[node][idx], (void *) seg);
+    SCLogDebug("segment_pool[%"PRIu8"][%"PRIu16"]->empty_list_size %"PRIu32"",
+               node, idx, segment_pool[node][idx]->empty_list_size);
+    SCMutexUnlock(&segment_pool_mutex[node][idx]);
 
 #ifdef DEBUG
     SCMutexLock(&segment_pool_cnt_mutex);
@@ -273,30 +321,138 @@ void StreamTcpReturnStreamSegments (TcpStream *stream)
     stream->seg_list_tail = NULL;
 }
 
-int StreamTcpReassembleInit(char quiet)
+/**
+ *  \brief set up the hugepage backed payload slab of a node
+ *
+ *  The payloads of the preallocated segments of all pools of the node are
+ *  carved from a single slab, segments allocated over that still get their
+ *  payload from SCMalloc.
+ */
+static void StreamTcpReassembleSlabInit(int node)
 {
-    StreamMsgQueuesInit();
+    size_t size = 0;
+    uint16_t u16;
+    uint32_t u;
 
-    /* init the memcap/use tracker */
-    SC_ATOMIC_INIT(ra_memuse);
+    if (!UtilHugepageEnabled())
+        return;
+
+    /* payload must be able to hold the free list link */
+    for (u16 = 0; u16 < segment_pool_num; u16++) {
+        if (segment_pool_pktsizes[u16] >= sizeof(void *))
+            size += (size_t)segment_pool_poolsizes_prealloc[u16] *
+                    segment_pool_pktsizes[u16];
+    }
+    if (size == 0)
+        return;
+
+    segment_slab[node] = UtilNumaAlloc(size, node, "stream segments");
+    if (segment_slab[node] == NULL)
+        return;
+    segment_slab_size[node] = size;
+
+    /* UtilNumaAlloc accounts the slab, but the segments are accounted
+     * when they are set up */
+    UtilNumaMemuseSub(node, size);
+
+    uint8_t *slab = segment_slab[node];
+    for (u16 = 0; u16 < segment_pool_num; u16++) {
+        TcpSegmentPoolData *pd = &segment_pool_data[node][u16];
+        uint32_t cnt = segment_pool_poolsizes_prealloc[u16];
+
+        if (pd->size < sizeof(void *) || cnt == 0)
+            continue;
+
+        pd->slab = slab;
+        pd->slab_size = (size_t)cnt * pd->size;
+        for (u = cnt; u > 0; u--) {
+            uint8_t *payload = pd->slab + (size_t)(u - 1) * pd->size;
+            memcpy(payload, &pd->slab_free, sizeof(void *));
+            pd->slab_free = payload;
+        }
+        slab += pd->slab_size;
+    }
+}
+
+/** \brief free the payload slab of a node, after its pools are freed */
+static void StreamTcpReassembleSlabFree(int node)
+{
+    uint16_t u16;
+
+    if (segment_slab[node] == NULL)
+        return;
+
+    UtilNumaMemuseAdd(node, segment_slab_size[node]);
+    UtilNumaFree(segment_slab[node], segment_slab_size[node], node);
+    segment_slab[node] = NULL;
+    segment_slab_size[node] = 0;
+
+    for (u16 = 0; u16 < segment_pool_num; u16++) {
+        segment_pool_data[node][u16].slab = NULL;
+        segment_pool_data[node][u16].slab_size = 0;
+        segment_pool_data[node][u16].slab_free = NULL;
+    }
+}
+
+/**
+ *  \brief set up the segment pools of a NUMA node
+ *
+ *  Must be called from a thread running on the node, so the preallocated
+ *  segments are allocated locally. Node 0 is set up by
+ *  StreamTcpReassembleInit(), the other nodes by the init of the first
+ *  stream thread on the node.
+ */
+static void StreamTcpReassembleNodePoolsInit(int node)
+{
+    SCMutexLock(&segment_pool_node_mutex);
+    if (segment_pool_node_init[node]) {
+        SCMutexUnlock(&segment_pool_node_mutex);
+        return;
+    }
 
-#ifdef DEBUG
-    SCMutexInit(&segment_pool_memuse_mutex, NULL);
-#endif
     uint16_t u16 = 0;
+    for (u16 = 0; u16 < segment_pool_num; u16++) {
+        TcpSegmentPoolData *pd = &segment_pool_data[node][u16];
+        memset(pd, 0x00, sizeof(*pd));
+        pd->size = segment_pool_pktsizes[u16];
+        pd->node = (uint8_t)node;
+    }
+    StreamTcpReassembleSlabInit(node);
+
     for (u16 = 0; u16 < segment_pool_num; u16++)
     {
-        SCMutexInit(&segment_pool_mutex[u16], NULL);
-        SCMutexLock(&segment_pool_mutex[u16]);
-        segment_pool[u16] = PoolInit(segment_pool_poolsizes[u16],
+        SCMutexInit(&segment_pool_mutex[node][u16], NULL);
+        SCMutexLock(&segment_pool_mutex[node][u16]);
+        segment_pool[node][u16] = PoolInit(segment_pool_poolsizes[u16],
                                      segment_pool_poolsizes_prealloc[u16],
                                      sizeof (TcpSegment),
                                      TcpSegmentPoolAlloc, TcpSegmentPoolInit,
-                                     (void *) &segment_pool_pktsizes[u16],
+                                     (void *) &segment_pool_data[node][u16],
                                      TcpSegmentPoolCleanup, NULL);
-        SCMutexUnlock(&segment_pool_mutex[u16]);
+        SCMutexUnlock(&segment_pool_mutex[node][u16]);
     }
+    if (node != 0)
+        SCLogInfo("segment pools set up for NUMA node %d", node);
+
+    segment_pool_node_init[node] = 1;
+    SCMutexUnlock(&segment_pool_node_mutex);
+}
+
+int StreamTcpReassembleInit(char quiet)
+{
+    StreamMsgQueuesInit();
+
+    /* init the memcap/use tracker */
+    SC_ATOMIC_INIT(ra_memuse);
+
+#ifdef DEBUG
+    SCMutexInit(&segment_pool_memuse_mutex, NULL);
+#endif
+
+    /* node 0 is also the fallback for threads that are not on a node */
+    StreamTcpReassembleNodePoolsInit(0);
 
+    uint16_t u16 = 0;
     uint16_t idx = 0;
     u16 = 0;
     while (1) {
@@ -326,22 +482,30 @@ static uint32_t dbg_app_layer_gap_candidate;
 
 void StreamTcpReassembleFree(char quiet)
 {
+    int node = 0;
     uint16_t u16 = 0;
-    for (u16 = 0; u16 < segment_pool_num; u16++) {
-        SCMutexLock(&segment_pool_mutex[u16]);
-
-        if (quiet == FALSE) {
-            PoolPrintSaturation(segment_pool[u16]);
-            SCLogDebug("segment_pool[u16]->empty_list_size %"PRIu32", "
-                       "segment_pool[u16]->alloc_list_size %"PRIu32", alloced "
-                       "%"PRIu32"", segment_pool[u16]->empty_list_size,
-                       segment_pool[u16]->alloc_list_size,
-                       segment_pool[u16]->allocated);
-        }
-        PoolFree(segment_pool[u16]);
+    for (node = 0; node < NUMA_MAX_NODES; node++) {
+        if (!segment_pool_node_init[node])
+            continue;
+
+        for (u16 = 0; u16 < segment_pool_num; u16++) {
+            SCMutexLock(&segment_pool_mutex[node][u16]);
 
-        SCMutexUnlock(&segment_pool_mutex[u16]);
-        SCMutexDestroy(&segment_pool_mutex[u16]);
+            if (quiet == FALSE) {
+                PoolPrintSaturation(segment_pool[node][u16]);
+                SCLogDebug("segment_pool[u16]->empty_list_size %"PRIu32", "
+                           "segment_pool[u16]->alloc_list_size %"PRIu32", alloced "
+                           "%"PRIu32"", segment_pool[node][u16]->empty_list_size,
+                           segment_pool[node][u16]->alloc_list_size,
+                           segment_pool[node][u16]->allocated);
+            }
+            PoolFree(segment_pool[node][u16]);
+
+            SCMutexUnlock(&segment_pool_mutex[node][u16]);
+            SCMutexDestroy(&segment_pool_mutex[node][u16]);
+        }
+        StreamTcpReassembleSlabFree(node);
+        segment_pool_node_init[node] = 0;
     }
 
     StreamMsgQueuesDeinit(quiet);
@@ -369,6 +533,14 @@ TcpReassemblyThreadCtx *StreamTcpReassembleInitThreadCtx(ThreadVars *tv)
     memset(ra_ctx, 0x00, sizeof(TcpReassemblyThreadCtx));
     ra_ctx->stream_q = StreamMsgQueueGetNew();
 
+    /* the pools of the node are set up here, before the packets come in,
+     * and only if the reassembly is set up. Otherwise node 0 is used. */
+    int node = UtilNumaThreadNode();
+    if (node > 0 && node < UtilNumaNodeCount() && segment_pool_node_init[0]) {
+        StreamTcpReassembleNodePoolsInit(node);
+        ra_ctx->segment_node = (uint8_t)node;
+    }
+
     AlpProtoFinalize2Thread(tv, &ra_ctx->dp_ctx);
     SCReturnPtr(ra_ctx, "TcpReassemblyThreadCtx");
 }
@@ -1675,6 +1847,22 @@ int StreamTcpReassembleHandleSegmentHandleData(ThreadVars *tv, TcpReassemblyThre
     SCReturnInt(0);
 }
 
+/**
+ *  \brief Pass reassembled data to the app layer
+ *
+ *  With app layer threads the parsing is deferred to the app layer thread
+ *  of the flow, see app-layer-thread.c.
+ */
+static inline int StreamTcpReassembleAppLayerData(TcpReassemblyThreadCtx *ra_ctx,
+        Packet *p, TcpSession *ssn, uint8_t *data, uint32_t data_len,
+        uint8_t flags)
+{
+    if (app_layer_threads_active)
+        return AppLayerDeferTCPData(&ra_ctx->dp_ctx, p, ssn, data, data_len, flags);
+
+    return AppLayerHandleTCPData(&ra_ctx->dp_ctx, p->flow, ssn, data, data_len, flags);
+}
+
 #define STREAM_SET_FLAGS(ssn, stream, p, flag) { \
     flag = 0; \
     if (!(ssn->flags & STREAMTCP_FLAG_APPPROTO_DETECTION_COMPLETED)) {\
@@ -1856,7 +2044,7 @@ static int StreamTcpReassembleInlineAppLayer (ThreadVars *tv,
             SCLogDebug("sending empty eof message");
             /* send EOF to app layer */
             STREAM_SET_INLINE_FLAGS(ssn, stream, p, flags);
-            AppLayerHandleTCPData(&ra_ctx->dp_ctx, p->flow, ssn,
+            StreamTcpReassembleAppLayerData(ra_ctx, p, ssn,
                     NULL, 0, flags);
             PACKET_PROFILING_APP_STORE(&ra_ctx->dp_ctx, p);
 
@@ -1935,7 +2123,7 @@ static int StreamTcpReassembleInlineAppLayer (ThreadVars *tv,
                 STREAM_SET_INLINE_FLAGS(ssn, stream, p, flags);
 
                 /* process what we have so far */
-                AppLayerHandleTCPData(&ra_ctx->dp_ctx, p->flow, ssn,
+                StreamTcpReassembleAppLayerData(ra_ctx, p, ssn,
                         data, data_len, flags);
                 PACKET_PROFILING_APP_STORE(&ra_ctx->dp_ctx, p);
 
@@ -1964,7 +2152,7 @@ static int StreamTcpReassembleInlineAppLayer (ThreadVars *tv,
 
                 /* send gap signal */
                 STREAM_SET_INLINE_FLAGS(ssn, stream, p, flags);
-                AppLayerHandleTCPData(&ra_ctx->dp_ctx, p->flow, ssn,
+                StreamTcpReassembleAppLayerData(ra_ctx, p, ssn,
                         NULL, 0, flags|STREAM_GAP);
                 PACKET_PROFILING_APP_STORE(&ra_ctx->dp_ctx, p);
                 data_len = 0;
@@ -2036,7 +2224,7 @@ static int StreamTcpReassembleInlineAppLayer (ThreadVars *tv,
                 /* process what we have so far */
                 STREAM_SET_INLINE_FLAGS(ssn, stream, p, flags);
                 BUG_ON(data_len > sizeof(data));
-                AppLayerHandleTCPData(&ra_ctx->dp_ctx, p->flow, ssn,
+                StreamTcpReassembleAppLayerData(ra_ctx, p, ssn,
                         data, data_len, flags);
                 PACKET_PROFILING_APP_STORE(&ra_ctx->dp_ctx, p);
                 data_sent += data_len;
@@ -2090,7 +2278,7 @@ static int StreamTcpReassembleInlineAppLayer (ThreadVars *tv,
                         /* process what we have so far */
                         STREAM_SET_INLINE_FLAGS(ssn, stream, p, flags);
                         BUG_ON(data_len > sizeof(data));
-                        AppLayerHandleTCPData(&ra_ctx->dp_ctx, p->flow, ssn,
+                        StreamTcpReassembleAppLayerData(ra_ctx, p, ssn,
                                 data, data_len, flags);
                         PACKET_PROFILING_APP_STORE(&ra_ctx->dp_ctx, p);
                         data_sent += data_len;
@@ -2126,7 +2314,7 @@ static int StreamTcpReassembleInlineAppLayer (ThreadVars *tv,
         /* process what we have so far */
         STREAM_SET_INLINE_FLAGS(ssn, stream, p, flags);
         BUG_ON(data_len > sizeof(data));
-        AppLayerHandleTCPData(&ra_ctx->dp_ctx, p->flow, ssn,
+        StreamTcpReassembleAppLayerData(ra_ctx, p, ssn,
                 data, data_len, flags);
         PACKET_PROFILING_APP_STORE(&ra_ctx->dp_ctx, p);
         data_sent += data_len;
@@ -2136,7 +2324,7 @@ static int StreamTcpReassembleInlineAppLayer (ThreadVars *tv,
         SCLogDebug("sending empty eof message");
         /* send EOF to app layer */
         STREAM_SET_INLINE_FLAGS(ssn, stream, p, flags);
-        AppLayerHandleTCPData(&ra_ctx->dp_ctx, p->flow, ssn,
+        StreamTcpReassembleAppLayerData(ra_ctx, p, ssn,
                 NULL, 0, flags);
         PACKET_PROFILING_APP_STORE(&ra_ctx->dp_ctx, p);
     }
@@ -2595,7 +2783,7 @@ static int StreamTcpReassembleAppLayer (ThreadVars *tv,
             SCLogDebug("sending empty eof message");
             /* send EOF to app layer */
             STREAM_SET_FLAGS(ssn, stream, p, flags);
-            AppLayerHandleTCPData(&ra_ctx->dp_ctx, p->flow, ssn,
+            StreamTcpReassembleAppLayerData(ra_ctx, p, ssn,
                     NULL, 0, flags);
             PACKET_PROFILING_APP_STORE(&ra_ctx->dp_ctx, p);
 
@@ -2699,7 +2887,7 @@ static int StreamTcpReassembleAppLayer (ThreadVars *tv,
                 STREAM_SET_FLAGS(ssn, stream, p, flags);
 
                 /* process what we have so far */
-                AppLayerHandleTCPData(&ra_ctx->dp_ctx, p->flow, ssn,
+                StreamTcpReassembleAppLayerData(ra_ctx, p, ssn,
                         data, data_len, flags);
                 PACKET_PROFILING_APP_STORE(&ra_ctx->dp_ctx, p);
                 data_len = 0;
@@ -2726,7 +2914,7 @@ static int StreamTcpReassembleAppLayer (ThreadVars *tv,
 
                 /* send gap signal */
                 STREAM_SET_FLAGS(ssn, stream, p, flags);
-                AppLayerHandleTCPData(&ra_ctx->dp_ctx, p->flow, ssn,
+                StreamTcpReassembleAppLayerData(ra_ctx, p, ssn,
                         NULL, 0, flags|STREAM_GAP);
                 PACKET_PROFILING_APP_STORE(&ra_ctx->dp_ctx, p);
                 data_len = 0;
@@ -2823,7 +3011,7 @@ static int StreamTcpReassembleAppLayer (ThreadVars *tv,
                 /* process what we have so far */
                 STREAM_SET_FLAGS(ssn, stream, p, flags);
                 BUG_ON(data_len > sizeof(data));
-                AppLayerHandleTCPData(&ra_ctx->dp_ctx, p->flow, ssn,
+                StreamTcpReassembleAppLayerData(ra_ctx, p, ssn,
                         data, data_len, flags);
                 PACKET_PROFILING_APP_STORE(&ra_ctx->dp_ctx, p);
                 data_len = 0;
@@ -2883,7 +3071,7 @@ static int StreamTcpReassembleAppLayer (ThreadVars *tv,
                         /* process what we have so far */
                         STREAM_SET_FLAGS(ssn, stream, p, flags);
                         BUG_ON(data_len > sizeof(data));
-                        AppLayerHandleTCPData(&ra_ctx->dp_ctx, p->flow, ssn,
+                        StreamTcpReassembleAppLayerData(ra_ctx, p, ssn,
                                 data, data_len, flags);
                         PACKET_PROFILING_APP_STORE(&ra_ctx->dp_ctx, p);
                         data_len = 0;
@@ -2930,7 +3118,7 @@ static int StreamTcpReassembleAppLayer (ThreadVars *tv,
         /* process what we have so far */
         STREAM_SET_FLAGS(ssn, stream, p, flags);
         BUG_ON(data_len > sizeof(data));
-        AppLayerHandleTCPData(&ra_ctx->dp_ctx, p->flow, ssn,
+        StreamTcpReassembleAppLayerData(ra_ctx, p, ssn,
                 data, data_len, flags);
         PACKET_PROFILING_APP_STORE(&ra_ctx->dp_ctx, p);
     }
@@ -3560,20 +3748,22 @@ TcpSegment* StreamTcpGetSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
     SCLogDebug("segment_pool_idx %" PRIu32 " for payload_len %" PRIu32 "",
                 idx, len);
 
-    SCMutexLock(&segment_pool_mutex[idx]);
-    TcpSegment *seg = (TcpSegment *) PoolGet(segment_pool[idx]);
+    int node = ra_ctx->segment_node;
+
+    SCMutexLock(&segment_pool_mutex[node][idx]);
+    TcpSegment *seg = (TcpSegment *) PoolGet(segment_pool[node][idx]);
 
     SCLogDebug("segment_pool[%u]->empty_list_size %u, segment_pool[%u]->alloc_"
-               "list_size %u, alloc %u", idx, segment_pool[idx]->empty_list_size,
-               idx, segment_pool[idx]->alloc_list_size,
-               segment_pool[idx]->allocated);
-    SCMutexUnlock(&segment_pool_mutex[idx]);
+               "list_size %u, alloc %u", idx, segment_pool[node][idx]->empty_list_size,
+               idx, segment_pool[node][idx]->alloc_list_size,
+               segment_pool[node][idx]->allocated);
+    SCMutexUnlock(&segment_pool_mutex[node][idx]);
 
     SCLogDebug("seg we return is %p", seg);
     if (seg == NULL) {
         SCLogDebug("segment_pool[%u]->empty_list_size %u, "
-                   "alloc %u", idx, segment_pool[idx]->empty_list_size,
-                   segment_pool[idx]->allocated);
+                   "alloc %u", idx, segment_pool[node][idx]->empty_list_size,
+                   segment_pool[node][idx]->allocated);
         /* Increment the counter to show that we are not able to serve the
            segment request due to memcap limit */
         SCPerfCounterIncr(ra_ctx->counter_tcp_segment_memcap, tv->sc_perf_pca);
@@ -407,6 +407,17 @@ void StreamTcpInitConfig(char quiet)
                 "enabled" : "disabled");
     }
 
+    int bypass = 0;
+    if ((ConfGetBool("stream.bypass", &bypass)) == 1 && bypass == 1) {
+        stream_config.flags |= STREAMTCP_INIT_FLAG_BYPASS;
+    }
+
+    if (!quiet) {
+        SCLogInfo("stream \"bypass\": %s",
+                stream_config.flags & STREAMTCP_INIT_FLAG_BYPASS ?
+                "enabled" : "disabled");
+    }
+
     int inl = 0;
 
 
@@ -4187,6 +4198,28 @@ static int StreamTcpPacket (ThreadVars *tv, Packet *p, StreamTcpThread *stt,
         {
             p->flags |= PKT_STREAM_NOPCAPLOG;
         }
+
+        /* bypassed direction: state is tracked, but nothing is inspected */
+        if ((PKT_IS_TOSERVER(p) && (ssn->client.flags & STREAMTCP_STREAM_FLAG_BYPASS)) ||
+            (PKT_IS_TOCLIENT(p) && (ssn->server.flags & STREAMTCP_STREAM_FLAG_BYPASS)))
+        {
+            DecodeSetNoPayloadInspectionFlag(p);
+            if (p->payload_len > 0) {
+                SCPerfCounterIncr(stt->counter_tcp_bypass_pkts, tv->sc_perf_pca);
+                SCPerfCounterAddUI64(stt->counter_tcp_bypass_bytes, tv->sc_perf_pca,
+                                     p->payload_len);
+            }
+        }
+
+        /* neither direction is reassembled anymore (depth reached,
+         * encrypted), so there is nothing left to do for this flow */
+        if ((stream_config.flags & STREAMTCP_INIT_FLAG_BYPASS) &&
+            (ssn->client.flags & STREAMTCP_STREAM_FLAG_NOREASSEMBLY) &&
+            (ssn->server.flags & STREAMTCP_STREAM_FLAG_NOREASSEMBLY))
+        {
+            SCLogDebug("ssn %p: bypassing flow %p", ssn, p->flow);
+            FlowSetBypassFlag(p->flow);
+        }
     }
 
     StreamTcpMemuseCounter(tv, stt);
@@ -4270,6 +4303,10 @@ TmEcode StreamTcp (ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, Packe
         return TM_ECODE_OK;
     }
 
+    /* nothing left to track for a bypassed flow */
+    if (p->flags & PKT_FLOW_BYPASSED)
+        return TM_ECODE_OK;
+
     if (stream_config.flags & STREAMTCP_INIT_FLAG_CHECKSUM_VALIDATION) {
         if (StreamTcpValidateChecksum(p) == 0) {
             SCPerfCounterIncr(stt->counter_tcp_invalid_checksum, tv->sc_perf_pca);
@@ -4332,6 +4369,12 @@ TmEcode StreamTcpThreadInit(ThreadVars *tv, void *initdata, void **data)
     stt->counter_tcp_rst = SCPerfTVRegisterCounter("tcp.rst", tv,
                                                         SC_PERF_TYPE_UINT64,
                                                         "NULL");
+    stt->counter_tcp_bypass_pkts = SCPerfTVRegisterCounter("tcp.bypass_pkts", tv,
+                                                        SC_PERF_TYPE_UINT64,
+                                                        "NULL");
+    stt->counter_tcp_bypass_bytes = SCPerfTVRegisterCounter("tcp.bypass_bytes", tv,
+                                                        SC_PERF_TYPE_UINT64,
+                                                        "NULL");
 
     /* init reassembly ctx */
     stt->ra_ctx = StreamTcpReassembleInitThreadCtx(tv);
@@ -4969,6 +5012,20 @@ void StreamTcpSetSessionNoReassemblyFlag (TcpSession *ssn, char direction)
                 (ssn->client.flags |= STREAMTCP_STREAM_FLAG_NOREASSEMBLY);
 }
 
+/** \brief  Set the bypass flag for the given direction in given TCP
+ *          session. The stream is no longer reassembled, its segments are
+ *          not stored and its packets are not payload inspected. TCP state
+ *          tracking continues as normal.
+ *
+ * \param ssn TCP Session to set the flag in
+ * \param direction direction to set the flag in: 0 toserver, 1 toclient
+ */
+void StreamTcpSetSessionBypassFlag (TcpSession *ssn, char direction)
+{
+    direction ? (ssn->server.flags |= (STREAMTCP_STREAM_FLAG_NOREASSEMBLY|STREAMTCP_STREAM_FLAG_BYPASS)) :
+                (ssn->client.flags |= (STREAMTCP_STREAM_FLAG_NOREASSEMBLY|STREAMTCP_STREAM_FLAG_BYPASS));
+}
+
 #define PSEUDO_PKT_SET_IPV4HDR(nipv4h,ipv4h) do { \
         IPV4_SET_RAW_VER(nipv4h, IPV4_GET_RAW_VER(ipv4h)); \
         IPV4_SET_RAW_HLEN(nipv4h, IPV4_GET_RAW_HLEN(ipv4h)); \
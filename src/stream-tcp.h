@@ -38,6 +38,9 @@
 /* Flag to indicate that the checksum validation for the stream engine
    has been enabled */
 #define STREAMTCP_INIT_FLAG_CHECKSUM_VALIDATION    0x01
+/* Flag to indicate that sessions are bypassed once neither direction
+   needs reassembly anymore */
+#define STREAMTCP_INIT_FLAG_BYPASS                 0x02
 
 /*global flow data*/
 typedef struct TcpStreamCnf_ {
@@ -95,6 +98,10 @@ typedef struct StreamTcpThread_ {
     uint16_t counter_tcp_synack;
     /** rst pkts */
     uint16_t counter_tcp_rst;
+    /** data pkts in bypassed streams */
+    uint16_t counter_tcp_bypass_pkts;
+    /** payload bytes in bypassed streams */
+    uint16_t counter_tcp_bypass_bytes;
 
     /** tcp reassembly thread data */
     TcpReassemblyThreadCtx *ra_ctx;
@@ -39,6 +39,7 @@
 
 #include "suricata.h"
 #include "decode.h"
+#include "decode-fast.h"
 #include "detect.h"
 #include "packet-queue.h"
 #include "threads.h"
@@ -90,6 +91,8 @@
 #include "tm-threads.h"
 
 #include "tmqh-flow.h"
+#include "tmqh-spsc.h"
+#include "tmqh-wait.h"
 
 #include "conf.h"
 #include "conf-yaml-loader.h"
@@ -109,6 +112,7 @@
 #include "log-filestore.h"
 
 #include "stream-tcp.h"
+#include "app-layer-thread.h"
 
 #include "source-nfq.h"
 #include "source-nfq-prototypes.h"
@@ -117,6 +121,7 @@
 
 #include "source-pcap.h"
 #include "source-pcap-file.h"
+#include "source-pcap-file-mmap.h"
 
 #include "source-pfring.h"
 
@@ -142,6 +147,7 @@
 #include "flow-manager.h"
 #include "flow-var.h"
 #include "flow-bit.h"
+#include "flow-bypass.h"
 #include "flow-alert-sid.h"
 #include "pkt-var.h"
 
@@ -200,6 +206,12 @@
 #include "util-ringbuffer.h"
 #include "util-mem.h"
 #include "util-memcmp.h"
+#include "util-numa.h"
+#include "util-hugepage.h"
+#include "util-mem-region.h"
+#include "util-line.h"
+#include "util-checksum.h"
+#include "util-latency.h"
 #include "util-proto-name.h"
 #include "util-spm-bm.h"
 
@@ -562,6 +574,7 @@ void usage(const char *progname)
 #ifdef HAVE_PCAP_SET_BUFF
     printf("\t--pcap-buffer-size                   : size of the pcap buffer value from 0 - %i\n",INT_MAX);
 #endif /* HAVE_SET_PCAP_BUFF */
+    printf("\t--pcap-dir <dir>                     : read the pcap files written to <dir> as they show up\n");
 #ifdef HAVE_AF_PACKET
     printf("\t--af-packet[=<dev>]                  : run in af-packet mode, no value select interfaces from suricata.yaml\n");
 #endif
@@ -649,6 +662,9 @@ void SCPrintBuildInfo(void) {
 #ifdef HAVE_LIBCAP_NG
     strlcat(features, "LIBCAP_NG ", sizeof(features));
 #endif
+#ifdef HAVE_NUMA
+    strlcat(features, "NUMA ", sizeof(features));
+#endif
 #ifdef HAVE_LIBNET11
     strlcat(features, "LIBNET1.1 ", sizeof(features));
 #endif
@@ -832,6 +848,7 @@ int main(int argc, char **argv)
         {"unix-socket", optional_argument, 0, 0},
 #endif
         {"pcap-buffer-size", required_argument, 0, 0},
+        {"pcap-dir", required_argument, 0, 0},
         {"unittest-filter", required_argument, 0, 'U'},
         {"list-app-layer-protos", 0, &list_app_layer_protocols, 1},
         {"list-unittests", 0, &list_unittests, 1},
@@ -969,6 +986,20 @@ int main(int argc, char **argv)
                     usage(argv[0]);
                     exit(EXIT_FAILURE);
                 }
+            } else if (strcmp((long_opts[option_index]).name , "pcap-dir") == 0) {
+                if (run_mode == RUNMODE_UNKNOWN) {
+                    run_mode = RUNMODE_PCAP_FILE;
+                } else {
+                    SCLogError(SC_ERR_MULTIPLE_RUN_MODE, "more than one run mode "
+                            "has been specified");
+                    usage(argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                if (ConfSet("pcap-file.file", optarg, 0) != 1 ||
+                    ConfSet("pcap-file.watch", "yes", 0) != 1) {
+                    fprintf(stderr, "ERROR: Failed to set pcap-file.watch\n");
+                    exit(EXIT_FAILURE);
+                }
             } else if(strcmp((long_opts[option_index]).name, "init-errors-fatal") == 0) {
                 if (ConfSet("engine.init-failure-fatal", "1", 0) != 1) {
                     fprintf(stderr, "ERROR: Failed to set engine init-failure-fatal.\n");
@@ -1525,6 +1556,19 @@ int main(int argc, char **argv)
 
     SCLogDebug("Default packet size set to %"PRIu32, default_packet_size);
 
+    int tunnel_in_place = 0;
+    if (ConfGetBool("tunnel-in-place", &tunnel_in_place) == 1 && tunnel_in_place) {
+        decode_tunnel_in_place = 1;
+        SCLogInfo("tunnel packets are decoded in place");
+    }
+
+    int fast_path = 0;
+    if (ConfGetBool("decoder-fast-path", &fast_path) == 0 || fast_path) {
+        decode_fast_path = 1;
+    } else {
+        SCLogInfo("decoder fast path disabled");
+    }
+
 #ifdef NFQ
     if (run_mode == RUNMODE_NFQ)
         NFQInitConfig(FALSE);
@@ -1649,6 +1693,8 @@ int main(int argc, char **argv)
 
     /* stream engine */
     TmModuleStreamTcpRegister();
+    /* app layer threads */
+    TmModuleAppLayerRegister();
     /* detection */
     TmModuleDetectRegister();
     /* respond-reject */
@@ -1704,6 +1750,9 @@ int main(int argc, char **argv)
         UtilSignalHandlerSetup(SIGUSR2, SignalHandlerSigusr2Disabled);
     }
 
+    ChecksumInit();
+    LatencyInit();
+
 #ifdef UNITTESTS
 
     if (run_mode == RUNMODE_UNITTEST) {
@@ -1736,6 +1785,7 @@ int main(int argc, char **argv)
         SCPerfRegisterTests();
         DecodePPPRegisterTests();
         DecodeVLANRegisterTests();
+        DecodeFastRegisterTests();
         HTPParserRegisterTests();
         SSLParserRegisterTests();
         SSHParserRegisterTests();
@@ -1757,7 +1807,14 @@ int main(int argc, char **argv)
         ConfRegisterTests();
         ConfYamlRegisterTests();
         TmqhFlowRegisterTests();
+        TmqhSpscRegisterTests();
+        TmqhWaitRegisterTests();
+        UtilNumaRegisterTests();
+        UtilHugepageRegisterTests();
+        MemRegionRegisterTests();
         FlowRegisterTests();
+        FlowBypassRegisterTests();
+        PcapMmapRegisterTests();
         SCSigRegisterSignatureOrderingTests();
         SCRadixRegisterTests();
         DefragRegisterTests();
@@ -1783,6 +1840,9 @@ int main(int argc, char **argv)
         DeStateRegisterTests();
         DetectRingBufferRegisterTests();
         MemcmpRegisterTests();
+        UtilLineRegisterTests();
+        UtilChecksumRegisterTests();
+        LatencyRegisterTests();
         DetectEngineHttpClientBodyRegisterTests();
         DetectEngineHttpServerBodyRegisterTests();
         DetectEngineHttpHeaderRegisterTests();
@@ -1949,6 +2009,9 @@ int main(int argc, char **argv)
     }
 #endif /* __tile__ */
 
+    UtilNumaInit();
+    UtilHugepageInit();
+    MemRegionInit();
     PacketPoolInit(max_pending_packets);
     HostInitConfig(HOST_VERBOSE);
     if (run_mode != RUNMODE_UNIX_SOCKET) {
@@ -2106,6 +2169,11 @@ printf("DEBUG: setting affinity for main\n");
     tmc_cpus_set_my_cpu(0);
 #endif
 
+    /* before the threads are set up, as the stream threads set up the
+     * segment pools of their NUMA node in their init */
+    if (run_mode != RUNMODE_UNIX_SOCKET)
+        StreamTcpInitConfig(STREAM_VERBOSE);
+
     RunModeDispatch(run_mode, runmode_custom_mode, de_ctx);
 
 #ifdef __SC_CUDA_SUPPORT__
@@ -2128,11 +2196,14 @@ printf("DEBUG: setting affinity for main\n");
             UnixManagerRegisterCommand("iface-stat", LiveDeviceIfaceStat, NULL,
                                        UNIX_CMD_TAKE_ARGS);
             UnixManagerRegisterCommand("iface-list", LiveDeviceIfaceList, NULL, 0);
+            if (run_mode == RUNMODE_PCAP_FILE && PcapFileWatchEnabled()) {
+                UnixManagerRegisterCommand("pcap-dir-stats", PcapFileDirStats,
+                                           NULL, 0);
+            }
 #endif
         }
         /* Spawn the flow manager thread */
         FlowManagerThreadSpawn();
-        StreamTcpInitConfig(STREAM_VERBOSE);
     }
 
     /* Spawn the L7 App Detect thread */
@@ -2153,6 +2224,9 @@ printf("DEBUG: setting affinity for main\n");
         exit(EXIT_FAILURE);
     }
 
+    UtilNumaReport();
+    UtilHugepageReport();
+
     (void) SC_ATOMIC_CAS(&engine_stage, SURICATA_INIT, SURICATA_RUNTIME);
 
 #ifdef __tilegx__
@@ -2177,6 +2251,14 @@ printf("DEBUG: setting affinity for main\n");
         SCLogInfo("Signature(s) loaded, Detect thread(s) activated.");
     }
 
+    /* the detection engine is built and won't change unless rules can be
+     * reloaded, so make its memory read only */
+    if (rule_reload == 0 && run_mode != RUNMODE_UNIX_SOCKET) {
+        MemRegionFreeze(MEM_REGION_MPM);
+        MemRegionFreeze(MEM_REGION_DETECT);
+    }
+    MemRegionReport();
+
 
 #ifdef DBG_MEM_ALLOC
     SCLogInfo("Memory used at startup: %"PRIdMAX, (intmax_t)global_mem);
@@ -2302,6 +2384,9 @@ printf("DEBUG: setting affinity for main\n");
 #ifndef __tile__
     /* having trouble with mspaces on tile */
     if (global_de_ctx) {
+        /* freeing the engine writes to its read only regions */
+        MemRegionThaw(MEM_REGION_MPM);
+        MemRegionThaw(MEM_REGION_DETECT);
         DetectEngineCtxFree(global_de_ctx);
     }
 #endif
@@ -351,6 +351,7 @@ extern __thread uint64_t mutex_lock_cnt;
 #define SCCondT pthread_cond_t
 #define SCCondInit pthread_cond_init
 #define SCCondSignal pthread_cond_signal
+#define SCCondBroadcast pthread_cond_broadcast
 #define SCCondTimedwait pthread_cond_timedwait
 #define SCCondDestroy pthread_cond_destroy
 
@@ -31,6 +31,7 @@ struct ThreadVars_;
 #include "tm-queues.h"
 #include "counters.h"
 #include "threads.h"
+#include "tmqh-wait.h"
 
 #if defined(__tile__) && !defined(__tilegx__)
 #include <netio/netio.h>
@@ -40,6 +41,8 @@ struct ThreadVars_;
 #endif
 
 struct TmSlot_;
+struct TmPacketBatch_;
+struct LatencyHist_;
 
 /** Thread flags set and read by threads to control the threads */
 #define THV_USE       1 /** thread is in use */
@@ -100,6 +103,8 @@ typedef struct ThreadVars_ {
     struct Packet_ * (*tmqh_in)(struct ThreadVars_ *);
     void (*InShutdownHandler)(struct ThreadVars_ *);
     void (*tmqh_out)(struct ThreadVars_ *, struct Packet_ *);
+    /** NULL if the handler puts packets one by one only */
+    void (*tmqh_out_batch)(struct ThreadVars_ *, struct Packet_ **, uint16_t);
 
 #if defined(__tile__) && !defined(__tilegx__)
     netio_queue_t netio_queue;
@@ -112,11 +117,22 @@ typedef struct ThreadVars_ {
     /** slot functions */
     void *(*tm_func)(void *);
     struct TmSlot_ *tm_slots;
+    /** receive side batch, NULL if packets are processed one by one */
+    struct TmPacketBatch_ *batch;
 
     uint8_t thread_setup_flags;
     uint16_t cpu_affinity; /** cpu or core number to set affinity to */
     int thread_priority; /** priority (real time) for this thread. Look at threads.h */
 
+    /** wait strategy and idle accounting of the input queue handler */
+    TmqhWaitCtx wait;
+
+    /** ticks packets spent in the flow queue this thread reads from */
+    struct LatencyHist_ *lat_queue;
+    /** packets to go until the next packet put in a flow queue is
+     *  stamped, 0 if latency sampling is disabled */
+    uint32_t lat_queue_countdown;
+
     /* the perf counter context and the perf counter array */
     SCPerfContext sc_perf_pctx;
     SCPerfCounterArray *sc_perf_pca;
@@ -44,6 +44,10 @@ typedef struct TmModule_ {
     /** the packet processing function */
     TmEcode (*Func)(ThreadVars *, Packet *, void *, PacketQueue *, PacketQueue *);
 
+    /** optional, processes a batch of packets at once. Modules without it
+     *  get Func called for each packet of a batch. */
+    TmEcode (*FuncBatch)(ThreadVars *, Packet **, uint16_t, void *, PacketQueue *, PacketQueue *);
+
     TmEcode (*PktAcqLoop)(ThreadVars *, void *, void *);
 
     /** global Init/DeInit */
@@ -32,9 +32,11 @@ enum {
     TMQH_NFQ,
     TMQH_PACKETPOOL,
     TMQH_FLOW,
+    TMQH_RXHASH,
     TMQH_RINGBUFFER_MRSW,
     TMQH_RINGBUFFER_SRSW,
     TMQH_RINGBUFFER_SRMW,
+    TMQH_SPSC,
 
     TMQH_SIZE,
 };
@@ -44,6 +46,8 @@ typedef struct Tmqh_ {
     Packet *(*InHandler)(ThreadVars *);
     void (*InShutdownHandler)(ThreadVars *);
     void (*OutHandler)(ThreadVars *, Packet *);
+    /** optional, puts a batch of packets */
+    void (*OutHandlerBatch)(ThreadVars *, Packet **, uint16_t);
     void *(*OutHandlerCtxSetup)(char *);
     void (*OutHandlerCtxFree)(void *);
     void (*RegisterTests)(void);
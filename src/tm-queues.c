@@ -28,8 +28,6 @@
 #include "tm-queues.h"
 #include "util-debug.h"
 
-#define TMQ_MAX_QUEUES 256
-
 static uint16_t tmq_id = 0;
 static Tmq tmqs[TMQ_MAX_QUEUES];
 
@@ -73,6 +71,13 @@ Tmq* TmqGetQueueByName(char *name) {
     return NULL;
 }
 
+Tmq* TmqGetQueueById(uint16_t id) {
+    if (id >= tmq_id)
+        return NULL;
+
+    return &tmqs[id];
+}
+
 void TmqDebugList(void) {
     uint16_t i = 0;
     for (i = 0; i < tmq_id; i++) {
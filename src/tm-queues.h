@@ -24,6 +24,8 @@
 #ifndef __TM_QUEUES_H__
 #define __TM_QUEUES_H__
 
+#define TMQ_MAX_QUEUES 256
+
 typedef struct Tmq_ {
     char *name;
     uint16_t id;
@@ -35,6 +37,7 @@ typedef struct Tmq_ {
 
 Tmq* TmqCreateQueue(char *name);
 Tmq* TmqGetQueueByName(char *name);
+Tmq* TmqGetQueueById(uint16_t id);
 
 void TmqDebugList(void);
 void TmqResetQueues(void);
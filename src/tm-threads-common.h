@@ -72,6 +72,7 @@ typedef enum {
     TMM_FILELOG,
     TMM_FILESTORE,
     TMM_STREAMTCP,
+    TMM_APPLAYER,
     TMM_DECODEIPFW,
     TMM_VERDICTIPFW,
     TMM_RECEIVEIPFW,
@@ -34,13 +34,16 @@
 #include "tm-queuehandlers.h"
 #include "tm-threads.h"
 #include "tmqh-packetpool.h"
+#include "tmqh-flow.h"
 #include "threads.h"
+#include "conf.h"
 #include "util-debug.h"
 #include "util-privs.h"
 #include "util-cpu.h"
 #include "util-optimize.h"
 #include "util-profiling.h"
 #include "util-signal.h"
+#include "util-numa.h"
 #include "queue.h"
 
 #ifdef PROFILE_LOCKING
@@ -285,7 +288,7 @@ void *TmThreadsSlot1NoIn(void *td)
         }
 
         if (TmThreadsCheckFlag(tv, THV_KILL)) {
-            SCPerfSyncCounters(tv, 0);
+            SCPerfSyncCounters(tv);
             run = 0;
         }
     } /* while (run) */
@@ -321,6 +324,7 @@ void *TmThreadsSlot1NoOut(void *td)
     Packet *p = NULL;
     char run = 1;
     TmEcode r = TM_ECODE_OK;
+    uint64_t lat_ticks = 0;
 
     /* Set the thread name */
     if (SCSetThreadName(tv->name) < 0) {
@@ -333,6 +337,9 @@ void *TmThreadsSlot1NoOut(void *td)
     /* Drop the capabilities for this thread */
     SCDropCaps(tv);
 
+    if (tv->inq != NULL)
+        TmqhWaitThreadInit(tv);
+
     if (s->SlotThreadInit != NULL) {
         void *slot_data = NULL;
         r = s->SlotThreadInit(tv, s->slot_initdata, &slot_data);
@@ -348,6 +355,9 @@ void *TmThreadsSlot1NoOut(void *td)
     memset(&s->slot_pre_pq, 0, sizeof(PacketQueue));
     memset(&s->slot_post_pq, 0, sizeof(PacketQueue));
 
+    if (tv->inq != NULL)
+        TmqhWaitThreadInitDone(tv);
+
     TmThreadsSetFlag(tv, THV_INIT_DONE);
 
 #ifdef __tilegx__
@@ -364,8 +374,10 @@ void *TmThreadsSlot1NoOut(void *td)
         p = tv->tmqh_in(tv);
 
         PACKET_PROFILING_TMM_START(p, s->tm_id);
+        LATENCY_SLOT_START(s, lat_ticks);
         r = SlotFunc(tv, p, SC_ATOMIC_GET(s->slot_data), /* no outqh no pq */ NULL,
                         /* no outqh no pq */ NULL);
+        LATENCY_SLOT_END(s, lat_ticks);
         PACKET_PROFILING_TMM_END(p, s->tm_id);
 
         /* handle error */
@@ -376,7 +388,7 @@ void *TmThreadsSlot1NoOut(void *td)
         }
 
         if (TmThreadsCheckFlag(tv, THV_KILL)) {
-            SCPerfSyncCounters(tv, 0);
+            SCPerfSyncCounters(tv);
             run = 0;
         }
     } /* while (run) */
@@ -462,7 +474,7 @@ void *TmThreadsSlot1NoInOut(void *td)
         }
 
         if (TmThreadsCheckFlag(tv, THV_KILL)) {
-            SCPerfSyncCounters(tv, 0);
+            SCPerfSyncCounters(tv);
             run = 0;
         }
     } /* while (run) */
@@ -498,6 +510,7 @@ void *TmThreadsSlot1(void *td)
     Packet *p = NULL;
     char run = 1;
     TmEcode r = TM_ECODE_OK;
+    uint64_t lat_ticks = 0;
 
     /* Set the thread name */
     if (SCSetThreadName(tv->name) < 0) {
@@ -512,6 +525,9 @@ void *TmThreadsSlot1(void *td)
 
     SCLogDebug("%s starting", tv->name);
 
+    if (tv->inq != NULL)
+        TmqhWaitThreadInit(tv);
+
     if (s->SlotThreadInit != NULL) {
         void *slot_data = NULL;
         r = s->SlotThreadInit(tv, s->slot_initdata, &slot_data);
@@ -529,6 +545,9 @@ void *TmThreadsSlot1(void *td)
     memset(&s->slot_post_pq, 0, sizeof(PacketQueue));
     SCMutexInit(&s->slot_post_pq.mutex_q, NULL);
 
+    if (tv->inq != NULL)
+        TmqhWaitThreadInitDone(tv);
+
     TmThreadsSetFlag(tv, THV_INIT_DONE);
 #ifdef __tilegx__
     MpipeRegisterPipeStage(tv);
@@ -546,8 +565,10 @@ void *TmThreadsSlot1(void *td)
         if (p != NULL) {
             TmSlotFunc SlotFunc = SC_ATOMIC_GET(s->SlotFunc);
             PACKET_PROFILING_TMM_START(p, s->tm_id);
+            LATENCY_SLOT_START(s, lat_ticks);
             r = SlotFunc(tv, p, SC_ATOMIC_GET(s->slot_data), &s->slot_pre_pq,
                             &s->slot_post_pq);
+            LATENCY_SLOT_END(s, lat_ticks);
             PACKET_PROFILING_TMM_END(p, s->tm_id);
 
             /* handle error */
@@ -587,7 +608,7 @@ void *TmThreadsSlot1(void *td)
         }
 
         if (TmThreadsCheckFlag(tv, THV_KILL)) {
-            SCPerfSyncCounters(tv, 0);
+            SCPerfSyncCounters(tv);
             run = 0;
         }
     } /* while (run) */
@@ -625,10 +646,12 @@ TmEcode TmThreadsSlotVarRun(ThreadVars *tv, Packet *p,
     TmEcode r;
     TmSlot *s;
     Packet *extra_p;
+    uint64_t lat_ticks = 0;
 
     for (s = slot; s != NULL; s = s->slot_next) {
         TmSlotFunc SlotFunc = SC_ATOMIC_GET(s->SlotFunc);
         PACKET_PROFILING_TMM_START(p, s->tm_id);
+        LATENCY_SLOT_START(s, lat_ticks);
 
         if (unlikely(s->id == 0)) {
             r = SlotFunc(tv, p, SC_ATOMIC_GET(s->slot_data), &s->slot_pre_pq, &s->slot_post_pq);
@@ -636,6 +659,7 @@ TmEcode TmThreadsSlotVarRun(ThreadVars *tv, Packet *p,
             r = SlotFunc(tv, p, SC_ATOMIC_GET(s->slot_data), &s->slot_pre_pq, NULL);
         }
 
+        LATENCY_SLOT_END(s, lat_ticks);
         PACKET_PROFILING_TMM_END(p, s->tm_id);
 
         /* handle error */
@@ -679,6 +703,329 @@ TmEcode TmThreadsSlotVarRun(ThreadVars *tv, Packet *p,
     return TM_ECODE_OK;
 }
 
+/**
+ *  \brief Prefetch what the next slot call is going to touch first.
+ */
+static inline void TmThreadsPrefetchPacket(Packet *p)
+{
+    if (p->flow != NULL)
+        SCPrefetch(p->flow);
+    else
+        SCPrefetch(GET_PKT_DATA(p));
+}
+
+/** packets a batch run holds, with the packets the slots add to it */
+#define TM_BATCH_RUN_SIZE   (TM_BATCH_SIZE_MAX * 8)
+
+/**
+ * \brief Run a packet a slot added to its pre_pq through the slots after
+ *        it and queue it, like TmThreadsSlotVarRun does.
+ */
+static TmEcode TmThreadsSlotRunExtra(ThreadVars *tv, TmSlot *s,
+                                     Packet *extra_p)
+{
+    if (s->slot_next != NULL) {
+        TmEcode r = TmThreadsSlotVarRun(tv, extra_p, s->slot_next);
+        if (unlikely(r == TM_ECODE_FAILED)) {
+            TmqhOutputPacketpool(tv, extra_p);
+            return TM_ECODE_FAILED;
+        }
+    }
+    tv->tmqh_out(tv, extra_p);
+    return TM_ECODE_OK;
+}
+
+/**
+ * \brief Put the packets a batch function added to its pre_pq in the
+ *        next run, each right before the batch packet it was set up from.
+ *
+ * Only the root of the new packets is known, those without a root in
+ * the run go first.
+ */
+static TmEcode TmThreadsBatchMergeRoots(ThreadVars *tv, TmSlot *s,
+                                        Packet **cur, uint32_t cnt,
+                                        Packet **next, uint32_t *next_cnt)
+{
+    Packet *extra[TM_BATCH_RUN_SIZE];
+    int32_t parent[TM_BATCH_RUN_SIZE];
+    uint32_t extra_cnt = 0;
+    uint32_t i, u;
+    int32_t j;
+    TmEcode r = TM_ECODE_OK;
+
+    while (s->slot_pre_pq.top != NULL) {
+        Packet *extra_p = PacketDequeue(&s->slot_pre_pq);
+        if (unlikely(extra_p == NULL))
+            continue;
+
+        /* more than the run can hold, run it right away */
+        if (unlikely(extra_cnt + cnt == TM_BATCH_RUN_SIZE)) {
+            if (TmThreadsSlotRunExtra(tv, s, extra_p) != TM_ECODE_OK)
+                r = TM_ECODE_FAILED;
+            continue;
+        }
+
+        parent[extra_cnt] = -1;
+        for (i = 0; i < cnt; i++) {
+            if (extra_p->root == cur[i]) {
+                parent[extra_cnt] = (int32_t)i;
+                break;
+            }
+        }
+        extra[extra_cnt++] = extra_p;
+    }
+
+    *next_cnt = 0;
+    for (j = -1; j < (int32_t)cnt; j++) {
+        for (u = 0; u < extra_cnt; u++) {
+            if (parent[u] == j)
+                next[(*next_cnt)++] = extra[u];
+        }
+        if (j >= 0)
+            next[(*next_cnt)++] = cur[j];
+    }
+
+    return r;
+}
+
+/**
+ * \brief Run a batch of packets through the slots, a slot at a time, then
+ *        queue them.
+ *
+ * Slots with a batch function get the whole batch, the others get called
+ * for each packet while the next one is prefetched. Packets the slots
+ * add to their pre_pq join the batch for the remaining slots right before
+ * the packet they were set up from, so every slot sees the packets in the
+ * order TmThreadsSlotVarRun would give them.
+ *
+ * \retval TM_ECODE_FAILED on failure, the packets are returned to the pool
+ */
+TmEcode TmThreadsSlotVarRunBatch(ThreadVars *tv, Packet **pkts, uint16_t cnt,
+                                 TmSlot *slot)
+{
+    Packet *run[2][TM_BATCH_RUN_SIZE];
+    Packet **cur = pkts;
+    uint32_t cur_cnt = cnt;
+    Packet **next = NULL;
+    uint32_t next_cnt = 0;
+    int nb = 0;
+    TmEcode r = TM_ECODE_OK;
+    TmSlot *s;
+    uint32_t i;
+    uint64_t lat_ticks = 0;
+#ifdef PROFILING
+    uint64_t batch_ticks = 0;
+#endif
+
+    for (s = slot; s != NULL; s = s->slot_next) {
+        TmSlotFunc SlotFunc = SC_ATOMIC_GET(s->SlotFunc);
+        PacketQueue *post_pq = (s->id == 0) ? &s->slot_post_pq : NULL;
+        int merged = 0;
+
+        next = run[nb];
+        next_cnt = 0;
+
+        /* delayed slots are swapped for the dummy func until they are
+         * activated, so respect that for the batch func as well */
+        if (s->SlotFuncBatch != NULL && SlotFunc != TmDummyFunc) {
+            /* the batch funcs take up to TM_BATCH_SIZE_MAX packets */
+            for (i = 0; i < cur_cnt && r != TM_ECODE_FAILED;
+                 i += TM_BATCH_SIZE_MAX) {
+                uint16_t n = (cur_cnt - i < TM_BATCH_SIZE_MAX) ?
+                             (uint16_t)(cur_cnt - i) : TM_BATCH_SIZE_MAX;
+
+                PACKET_PROFILING_TMM_BATCH_START(batch_ticks);
+                LATENCY_SLOT_BATCH_START(s, lat_ticks, n);
+                r = s->SlotFuncBatch(tv, cur + i, n, SC_ATOMIC_GET(s->slot_data),
+                                     &s->slot_pre_pq, post_pq);
+                LATENCY_SLOT_BATCH_END(s, lat_ticks, n);
+                PACKET_PROFILING_TMM_BATCH_END(cur + i, n, s->tm_id, batch_ticks);
+            }
+
+            if (r != TM_ECODE_FAILED && s->slot_pre_pq.top != NULL) {
+                merged = 1;
+                r = TmThreadsBatchMergeRoots(tv, s, cur, cur_cnt,
+                                             next, &next_cnt);
+                /* all of cur is in the next run now */
+                if (unlikely(r == TM_ECODE_FAILED))
+                    cur_cnt = 0;
+            }
+        } else {
+            for (i = 0; i < cur_cnt; i++) {
+                Packet *p = cur[i];
+
+                if (i + 2 < cur_cnt)
+                    SCPrefetch(cur[i + 2]);
+                if (i + 1 < cur_cnt)
+                    TmThreadsPrefetchPacket(cur[i + 1]);
+
+                PACKET_PROFILING_TMM_START(p, s->tm_id);
+                LATENCY_SLOT_START(s, lat_ticks);
+                r = SlotFunc(tv, p, SC_ATOMIC_GET(s->slot_data), &s->slot_pre_pq, post_pq);
+                LATENCY_SLOT_END(s, lat_ticks);
+                PACKET_PROFILING_TMM_END(p, s->tm_id);
+
+                if (unlikely(r == TM_ECODE_FAILED))
+                    break;
+
+                /* the packets set up from p go right before it */
+                if (s->slot_pre_pq.top != NULL && !merged) {
+                    merged = 1;
+                    memcpy(next, cur, i * sizeof(Packet *));
+                    next_cnt = i;
+                }
+                if (!merged)
+                    continue;
+
+                while (s->slot_pre_pq.top != NULL) {
+                    Packet *extra_p = PacketDequeue(&s->slot_pre_pq);
+                    if (unlikely(extra_p == NULL))
+                        continue;
+                    /* leave room for the rest of the run */
+                    if (unlikely(next_cnt + (cur_cnt - i) == TM_BATCH_RUN_SIZE)) {
+                        if (TmThreadsSlotRunExtra(tv, s, extra_p) != TM_ECODE_OK)
+                            r = TM_ECODE_FAILED;
+                        continue;
+                    }
+                    next[next_cnt++] = extra_p;
+                }
+                next[next_cnt++] = p;
+
+                if (unlikely(r == TM_ECODE_FAILED)) {
+                    i++;
+                    break;
+                }
+            }
+
+            /* what's not in the next run yet is released from cur below */
+            if (unlikely(r == TM_ECODE_FAILED) && merged) {
+                memmove(cur, cur + i, (cur_cnt - i) * sizeof(Packet *));
+                cur_cnt -= i;
+            }
+        }
+
+        /* handle error */
+        if (unlikely(r == TM_ECODE_FAILED)) {
+            TmqhReleasePacketsToPacketPool(&s->slot_pre_pq);
+
+            SCMutexLock(&s->slot_post_pq.mutex_q);
+            TmqhReleasePacketsToPacketPool(&s->slot_post_pq);
+            SCMutexUnlock(&s->slot_post_pq.mutex_q);
+
+            for (i = 0; i < cur_cnt; i++)
+                TmqhOutputPacketpool(tv, cur[i]);
+            if (merged) {
+                for (i = 0; i < next_cnt; i++)
+                    TmqhOutputPacketpool(tv, next[i]);
+            }
+
+            TmThreadsSetFlag(tv, THV_FAILED);
+            return TM_ECODE_FAILED;
+        }
+
+        if (merged) {
+            cur = next;
+            cur_cnt = next_cnt;
+            nb ^= 1;
+        }
+    }
+
+    if (tv->tmqh_out_batch != NULL) {
+        tv->tmqh_out_batch(tv, cur, (uint16_t)cur_cnt);
+    } else {
+        for (i = 0; i < cur_cnt; i++)
+            tv->tmqh_out(tv, cur[i]);
+    }
+
+    return TM_ECODE_OK;
+}
+
+/**
+ * \brief Batch version of TmThreadsSlotProcessPkt: run the packets through
+ *        the slots starting at s, then queue them.
+ */
+TmEcode TmThreadsSlotProcessBatch(ThreadVars *tv, TmSlot *s, Packet **pkts,
+                                  uint16_t cnt)
+{
+    TmEcode r = TM_ECODE_OK;
+    TmSlot *slot;
+    uint16_t i;
+
+    if (s == NULL) {
+        if (tv->tmqh_out_batch != NULL) {
+            tv->tmqh_out_batch(tv, pkts, cnt);
+        } else {
+            for (i = 0; i < cnt; i++)
+                tv->tmqh_out(tv, pkts[i]);
+        }
+        return TM_ECODE_OK;
+    }
+
+    if (TmThreadsSlotVarRunBatch(tv, pkts, cnt, s) == TM_ECODE_FAILED) {
+        for (slot = s; slot != NULL; slot = slot->slot_next) {
+            SCMutexLock(&slot->slot_post_pq.mutex_q);
+            TmqhReleasePacketsToPacketPool(&slot->slot_post_pq);
+            SCMutexUnlock(&slot->slot_post_pq.mutex_q);
+        }
+        TmThreadsSetFlag(tv, THV_FAILED);
+        return TM_ECODE_FAILED;
+    }
+
+    /* post process pq */
+    for (slot = s; slot != NULL; slot = slot->slot_next) {
+        while (slot->slot_post_pq.top != NULL) {
+            SCMutexLock(&slot->slot_post_pq.mutex_q);
+            Packet *extra_p = PacketDequeue(&slot->slot_post_pq);
+            SCMutexUnlock(&slot->slot_post_pq.mutex_q);
+
+            if (extra_p == NULL)
+                break;
+
+            if (slot->slot_next != NULL) {
+                r = TmThreadsSlotVarRun(tv, extra_p, slot->slot_next);
+                if (r == TM_ECODE_FAILED) {
+                    SCMutexLock(&slot->slot_post_pq.mutex_q);
+                    TmqhReleasePacketsToPacketPool(&slot->slot_post_pq);
+                    SCMutexUnlock(&slot->slot_post_pq.mutex_q);
+
+                    TmqhOutputPacketpool(tv, extra_p);
+                    TmThreadsSetFlag(tv, THV_FAILED);
+                    break;
+                }
+            }
+            tv->tmqh_out(tv, extra_p);
+        }
+    }
+
+    return r;
+}
+
+/**
+ * \brief Setup the receive side batch if threading.batch-size asks for one.
+ *
+ * \retval batch or NULL if packets are to be processed one by one
+ */
+TmPacketBatch *TmThreadsBatchAlloc(void)
+{
+    intmax_t size = 0;
+
+    if (ConfGetInt("threading.batch-size", &size) != 1 || size <= 1)
+        return NULL;
+
+    if (size > TM_BATCH_SIZE_MAX) {
+        SCLogWarning(SC_ERR_INVALID_ARGUMENT, "threading.batch-size %"PRIdMAX
+                " too big, using %d", size, TM_BATCH_SIZE_MAX);
+        size = TM_BATCH_SIZE_MAX;
+    }
+
+    TmPacketBatch *b = SCMalloc(sizeof(TmPacketBatch));
+    if (unlikely(b == NULL))
+        return NULL;
+    memset(b, 0, sizeof(TmPacketBatch));
+    b->size = (uint16_t)size;
+    return b;
+}
+
 /*
 
     pcap/nfq
@@ -740,6 +1087,8 @@ void *TmThreadsSlotPktAcqLoop(void *td) {
         return NULL;
     }
 
+    TmqhFlowThreadInit(tv);
+
     for (slot = s; slot != NULL; slot = slot->slot_next) {
         if (slot->SlotThreadInit != NULL) {
             void *slot_data = NULL;
@@ -764,6 +1113,8 @@ void *TmThreadsSlotPktAcqLoop(void *td) {
         SCMutexInit(&slot->slot_post_pq.mutex_q, NULL);
     }
 
+    tv->batch = TmThreadsBatchAlloc();
+
     TmThreadsSetFlag(tv, THV_INIT_DONE);
 
     while(run) {
@@ -775,6 +1126,14 @@ void *TmThreadsSlotPktAcqLoop(void *td) {
 
         r = s->PktAcqLoop(tv, SC_ATOMIC_GET(s->slot_data), s);
 
+        /* the receive loop may have returned with packets in the batch,
+         * e.g. when breaking out on suricata_ctl_flags. Run them through
+         * the slots, so they and the capture buffers they hold are
+         * released. */
+        if (TmThreadsSlotFlushBatch(tv, s->slot_next) != TM_ECODE_OK) {
+            r = TM_ECODE_FAILED;
+        }
+
         if (r == TM_ECODE_FAILED || TmThreadsCheckFlag(tv, THV_KILL)
             || suricata_ctl_flags) {
             run = 0;
@@ -783,7 +1142,13 @@ void *TmThreadsSlotPktAcqLoop(void *td) {
             run = 0;
         }
     }
-    SCPerfSyncCounters(tv, 0);
+    SCPerfSyncCounters(tv);
+
+    if (tv->batch != NULL) {
+        /* flushed after the receive loop returned, so it's empty */
+        SCFree(tv->batch);
+        tv->batch = NULL;
+    }
 
     TmThreadsSetFlag(tv, THV_RUNNING_DONE);
     TmThreadWaitForFlag(tv, THV_DEINIT);
@@ -845,6 +1210,10 @@ void *TmThreadsSlotVar(void *td)
         return NULL;
     }
 
+    if (tv->inq != NULL)
+        TmqhWaitThreadInit(tv);
+    TmqhFlowThreadInit(tv);
+
     for (; s != NULL; s = s->slot_next) {
         if (s->SlotThreadInit != NULL) {
             void *slot_data = NULL;
@@ -864,6 +1233,9 @@ void *TmThreadsSlotVar(void *td)
         SCMutexInit(&s->slot_post_pq.mutex_q, NULL);
     }
 
+    if (tv->inq != NULL)
+        TmqhWaitThreadInitDone(tv);
+
     TmThreadsSetFlag(tv, THV_INIT_DONE);
 
     s = (TmSlot *)tv->tm_slots;
@@ -936,7 +1308,7 @@ void *TmThreadsSlotVar(void *td)
             run = 0;
         }
     } /* while (run) */
-    SCPerfSyncCounters(tv, 0);
+    SCPerfSyncCounters(tv);
 
     TmThreadsSetFlag(tv, THV_RUNNING_DONE);
     TmThreadWaitForFlag(tv, THV_DEINIT);
@@ -1062,6 +1434,7 @@ static inline TmSlot * _TmSlotSetFuncAppend(ThreadVars *tv, TmModule *tm, void *
     slot->slot_initdata = data;
     SC_ATOMIC_INIT(slot->SlotFunc);
     (void)SC_ATOMIC_SET(slot->SlotFunc, tm->Func);
+    slot->SlotFuncBatch = tm->FuncBatch;
     slot->PktAcqLoop = tm->PktAcqLoop;
     slot->SlotThreadExitPrintStats = tm->ThreadExitPrintStats;
     slot->SlotThreadDeinit = tm->ThreadDeinit;
@@ -1069,6 +1442,14 @@ static inline TmSlot * _TmSlotSetFuncAppend(ThreadVars *tv, TmModule *tm, void *
      * received a TM as arg, if it didn't exist */
     slot->tm_id = TmModuleGetIDForTM(tm);
 
+    if (latency_enabled && tm->Func != NULL) {
+        slot->lat = LatencyHistNew();
+        if (slot->lat == NULL) {
+            SCFree(slot);
+            return NULL;
+        }
+    }
+
     tv->cap_flags |= tm->cap_flags;
 
     if (tv->tm_slots == NULL) {
@@ -1427,6 +1808,9 @@ TmEcode TmThreadSetupOptions(ThreadVars *tv)
     }
 #endif
 
+    /* pick the NUMA node for the allocations of the thread */
+    UtilNumaThreadSetup(tv->name);
+
     return TM_ECODE_OK;
 }
 
@@ -1497,6 +1881,14 @@ ThreadVars *TmThreadCreate(char *name, char *inq_name, char *inqh_name,
         tv->tmqh_in = tmqh->InHandler;
         tv->InShutdownHandler = tmqh->InShutdownHandler;
         SCLogDebug("tv->tmqh_in %p", tv->tmqh_in);
+
+        if (latency_enabled && (strcmp(tmqh->name, "flow") == 0 ||
+                                strcmp(tmqh->name, "rxhash") == 0 ||
+                                strcmp(tmqh->name, "spsc") == 0)) {
+            tv->lat_queue = LatencyHistNew();
+            if (tv->lat_queue == NULL)
+                goto error;
+        }
     }
 
     /* set the outgoing queue */
@@ -1508,8 +1900,15 @@ ThreadVars *TmThreadCreate(char *name, char *inq_name, char *inqh_name,
             goto error;
 
         tv->tmqh_out = tmqh->OutHandler;
+        tv->tmqh_out_batch = tmqh->OutHandlerBatch;
         tv->outqh_name = tmqh->name;
 
+        if (latency_enabled && (strcmp(tmqh->name, "flow") == 0 ||
+                                strcmp(tmqh->name, "rxhash") == 0 ||
+                                strcmp(tmqh->name, "spsc") == 0)) {
+            tv->lat_queue_countdown = latency_sample_rate;
+        }
+
         if (outq_name != NULL && strcmp(outq_name, "packetpool") != 0) {
             SCLogDebug("outq_name \"%s\"", outq_name);
 
@@ -1544,8 +1943,10 @@ ThreadVars *TmThreadCreate(char *name, char *inq_name, char *inqh_name,
 error:
     SCLogError(SC_ERR_THREAD_CREATE, "failed to setup a thread");
 
-    if (tv != NULL)
+    if (tv != NULL) {
+        LatencyHistFree(tv->lat_queue);
         SCFree(tv);
+    }
     return NULL;
 }
 
@@ -2043,8 +2444,10 @@ void TmThreadFree(ThreadVars *tv)
     while (s) {
         ps = s;
         s = s->slot_next;
+        LatencyHistFree(ps->lat);
         SCFree(ps);
     }
+    LatencyHistFree(tv->lat_queue);
     SCFree(tv);
 }
 
@@ -28,12 +28,26 @@
 #include "tmqh-packetpool.h"
 #include "tm-threads-common.h"
 #include "tm-modules.h"
+#include "util-latency.h"
 #ifdef __tile__
 #include <tmc/sync.h>
 #endif
 
 typedef TmEcode (*TmSlotFunc)(ThreadVars *, Packet *, void *, PacketQueue *,
                         PacketQueue *);
+typedef TmEcode (*TmSlotBatchFunc)(ThreadVars *, Packet **, uint16_t, void *,
+                        PacketQueue *, PacketQueue *);
+
+/** max packets in a batch, see threading.batch-size */
+#define TM_BATCH_SIZE_MAX   64
+
+/** \brief packets the receive slot collects to run through the other
+ *         slots together */
+typedef struct TmPacketBatch_ {
+    uint16_t size;      /**< run the batch when it has this many packets */
+    uint16_t cnt;
+    Packet *pkts[TM_BATCH_SIZE_MAX];
+} TmPacketBatch;
 
 typedef struct TmSlot_ {
     /* the TV holding this slot */
@@ -41,6 +55,7 @@ typedef struct TmSlot_ {
 
     /* function pointers */
     SC_ATOMIC_DECLARE(TmSlotFunc, SlotFunc);
+    TmSlotBatchFunc SlotFuncBatch;
 
     TmEcode (*PktAcqLoop)(ThreadVars *, void *, void *);
 
@@ -68,6 +83,10 @@ typedef struct TmSlot_ {
     /* slot id, only used my TmVarSlot to know what the first slot is */
     int id;
 
+    /* ticks the module spends on a packet, NULL if latency sampling is
+     * disabled */
+    LatencyHist *lat;
+
     /* linked list, only used when you have multiple slots(used by TmVarSlot) */
     struct TmSlot_ *slot_next;
 } TmSlot;
@@ -126,6 +145,9 @@ void TmThreadsUnsetFlag(ThreadVars *, uint16_t);
 void TmThreadWaitForFlag(ThreadVars *, uint16_t);
 
 TmEcode TmThreadsSlotVarRun (ThreadVars *tv, Packet *p, TmSlot *slot);
+TmEcode TmThreadsSlotVarRunBatch(ThreadVars *, Packet **, uint16_t, TmSlot *);
+TmEcode TmThreadsSlotProcessBatch(ThreadVars *, TmSlot *, Packet **, uint16_t);
+TmPacketBatch *TmThreadsBatchAlloc(void);
 
 ThreadVars *TmThreadsGetTVContainingSlot(TmSlot *);
 void TmThreadDisableThreadsWithTMS(uint8_t tm_flags);
@@ -193,4 +215,43 @@ static inline TmEcode TmThreadsSlotProcessPkt(ThreadVars *tv, TmSlot *s, Packet
     return r;
 }
 
+/**
+ *  \brief Run the queued packets of the batch through the slots.
+ *
+ *  Receive modules that use TmThreadsSlotProcessPktBatched must call this
+ *  before they block waiting for new packets. The slot runner calls it
+ *  when the receive loop returns.
+ */
+static inline TmEcode TmThreadsSlotFlushBatch(ThreadVars *tv, TmSlot *s)
+{
+    TmPacketBatch *b = tv->batch;
+
+    if (b == NULL || b->cnt == 0)
+        return TM_ECODE_OK;
+
+    uint16_t cnt = b->cnt;
+    b->cnt = 0;
+    return TmThreadsSlotProcessBatch(tv, s, b->pkts, cnt);
+}
+
+/**
+ *  \brief Queue a packet in the thread's batch, processing the batch
+ *         once it's full. Without a batch this is TmThreadsSlotProcessPkt.
+ *
+ *  On failure all packets of the batch are returned to the pool.
+ */
+static inline TmEcode TmThreadsSlotProcessPktBatched(ThreadVars *tv, TmSlot *s, Packet *p)
+{
+    TmPacketBatch *b = tv->batch;
+
+    if (b == NULL)
+        return TmThreadsSlotProcessPkt(tv, s, p);
+
+    b->pkts[b->cnt++] = p;
+    if (b->cnt < b->size)
+        return TM_ECODE_OK;
+
+    return TmThreadsSlotFlushBatch(tv, s);
+}
+
 #endif /* __TM_THREADS_H__ */
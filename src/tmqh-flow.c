@@ -25,6 +25,11 @@
  * are sent to the same queue. We support different kind of q handlers.  Have
  * a look at "autofp-scheduler" conf to further undertsand the various q
  * handlers we provide.
+ *
+ * The "rxhash" handler is for the workers runmodes that read from a file:
+ * packets are spread over the workers before they are decoded, by a hash
+ * of their addresses, so all packets of a flow, fragments included, end up
+ * in the same worker and the flow is only ever used by that thread.
  */
 
 #include "suricata.h"
@@ -35,14 +40,19 @@
 #include "tmqh-flow.h"
 
 #include "tm-queuehandlers.h"
+#include "tmqh-wait.h"
 
 #include "conf.h"
+#include "counters.h"
+#include "util-hash-lookup3.h"
+#include "util-latency.h"
 #include "util-unittest.h"
 
 Packet *TmqhInputFlow(ThreadVars *t);
 void TmqhOutputFlowHash(ThreadVars *t, Packet *p);
 void TmqhOutputFlowActivePackets(ThreadVars *t, Packet *p);
 void TmqhOutputFlowRoundRobin(ThreadVars *t, Packet *p);
+void TmqhOutputFlowRxHash(ThreadVars *t, Packet *p);
 void *TmqhOutputFlowSetupCtx(char *queue_str);
 void TmqhOutputFlowFreeCtx(void *ctx);
 void TmqhFlowRegisterTests(void);
@@ -77,34 +87,119 @@ void TmqhFlowRegister(void)
         tmqh_table[TMQH_FLOW].OutHandler = TmqhOutputFlowActivePackets;
     }
 
+    tmqh_table[TMQH_RXHASH].name = "rxhash";
+    tmqh_table[TMQH_RXHASH].InHandler = TmqhInputFlow;
+    tmqh_table[TMQH_RXHASH].OutHandler = TmqhOutputFlowRxHash;
+    tmqh_table[TMQH_RXHASH].OutHandlerCtxSetup = TmqhOutputFlowSetupCtx;
+    tmqh_table[TMQH_RXHASH].OutHandlerCtxFree = TmqhOutputFlowFreeCtx;
     return;
 }
 
+/** packets between updates of the imbalance counter */
+#define TMQH_FLOW_IMBALANCE_INTERVAL    4096
+
+/**
+ * \brief register the per thread counters of a thread that outputs
+ *        through one of the flow queue handlers
+ *
+ * Must be called before the slots of the thread are initialized, as they
+ * set up the thread's counter array.
+ */
+void TmqhFlowThreadInit(ThreadVars *tv)
+{
+    if (tv->outctx == NULL)
+        return;
+
+    /* the spsc handler may have taken over the "flow" slot */
+    if (tv->tmqh_out != TmqhOutputFlowHash &&
+        tv->tmqh_out != TmqhOutputFlowActivePackets &&
+        tv->tmqh_out != TmqhOutputFlowRoundRobin &&
+        tv->tmqh_out != TmqhOutputFlowRxHash)
+        return;
+
+    TmqhFlowCtx *ctx = (TmqhFlowCtx *)tv->outctx;
+    ctx->counter_imbalance = SCPerfTVRegisterCounter("flow_queue.imbalance",
+            tv, SC_PERF_TYPE_UINT64, "NULL");
+}
+
+/**
+ * \brief update the imbalance counter every TMQH_FLOW_IMBALANCE_INTERVAL
+ *        packets
+ *
+ * The counter is the share the busiest queue got of the average packets
+ * per queue, in percent, so 100 means all queues got the same share.
+ */
+static inline void TmqhFlowUpdateImbalance(ThreadVars *tv, TmqhFlowCtx *ctx)
+{
+    if (ctx->counter_imbalance == 0 ||
+        ++ctx->imbalance_pkts < TMQH_FLOW_IMBALANCE_INTERVAL)
+        return;
+    ctx->imbalance_pkts = 0;
+
+    uint64_t total = 0, max = 0;
+    uint16_t i;
+    for (i = 0; i < ctx->size; i++) {
+        uint64_t pkts = SC_ATOMIC_GET(ctx->queues[i].total_packets);
+        total += pkts;
+        if (pkts > max)
+            max = pkts;
+    }
+    if (total > 0) {
+        SCPerfCounterSetUI64(ctx->counter_imbalance, tv->sc_perf_pca,
+                             (max * ctx->size * 100) / total);
+    }
+}
+
+/**
+ * \brief get the autofp stage of a flow handler from its output queues
+ *
+ * With app layer threads packets pass two flow handlers. Each stage
+ * keeps its own queue id in the flow, so the number of threads of the
+ * stages can differ.
+ *
+ * \param queue_str comma separated string with output queue names
+ */
+uint8_t TmqhFlowQueuesStage(const char *queue_str)
+{
+    if (strncmp(queue_str, TMQH_FLOW_APPLAYER_QUEUE,
+                strlen(TMQH_FLOW_APPLAYER_QUEUE)) == 0)
+        return TMQH_FLOW_STAGE_APPLAYER;
+    return TMQH_FLOW_STAGE_PICKUP;
+}
+
+/** \retval qid queue id of the flow for the stage, -1 if not set yet */
+int32_t TmqhFlowGetQueueId(Flow *f, uint8_t stage)
+{
+    if (stage == TMQH_FLOW_STAGE_APPLAYER)
+        return SC_ATOMIC_GET(f->autofp_tmqh_applayer_qid);
+    return SC_ATOMIC_GET(f->autofp_tmqh_flow_qid);
+}
+
+void TmqhFlowSetQueueId(Flow *f, uint8_t stage, int32_t qid)
+{
+    if (stage == TMQH_FLOW_STAGE_APPLAYER)
+        (void) SC_ATOMIC_SET(f->autofp_tmqh_applayer_qid, qid);
+    else
+        (void) SC_ATOMIC_SET(f->autofp_tmqh_flow_qid, qid);
+}
+
 /* same as 'simple' */
 Packet *TmqhInputFlow(ThreadVars *tv)
 {
     PacketQueue *q = &trans_q[tv->inq->id];
 
-    SCPerfSyncCountersIfSignalled(tv, 0);
-
     SCMutexLock(&q->mutex_q);
     if (q->len == 0) {
         /* if we have no packets in queue, wait... */
-#ifdef __tile__
-        for (;;) {
-            if (q->len > 0 || q->cond_q)
-                break;
-            SCMutexUnlock(&q->mutex_q);
-            SCMutexLock(&q->mutex_q);
-        }
-#else
-        SCCondWait(&q->cond_q, &q->mutex_q);
-#endif
+        TmqhWaitOnQueue(tv, q);
+    } else {
+        TMQH_WAIT_NOWAIT(tv);
     }
 
     if (q->len > 0) {
         Packet *p = PacketDequeue(q);
         SCMutexUnlock(&q->mutex_q);
+        LATENCY_QUEUE_TAKE(tv, p);
         return p;
     } else {
         /* return NULL if we have no pkt. Should only happen on signals. */
@@ -192,6 +287,7 @@ void *TmqhOutputFlowSetupCtx(char *queue_str)
     } while (tstr != NULL);
 
     SC_ATOMIC_INIT(ctx->round_robin_idx);
+    ctx->stage = TmqhFlowQueuesStage(queue_str);
 
     SCFree(str);
     return (void *)ctx;
@@ -207,16 +303,26 @@ void TmqhOutputFlowFreeCtx(void *ctx)
 {
     int i;
     TmqhFlowCtx *fctx = (TmqhFlowCtx *)ctx;
+    uint64_t total = 0, max = 0;
 
     SCLogInfo("AutoFP - Total flow handler queues - %" PRIu16,
               fctx->size);
     for (i = 0; i < fctx->size; i++) {
+        uint64_t pkts = SC_ATOMIC_GET(fctx->queues[i].total_packets);
+
         SCLogInfo("AutoFP - Queue %-2"PRIu32 " - pkts: %-12"PRIu64" flows: %-12"PRIu64, i,
-                SC_ATOMIC_GET(fctx->queues[i].total_packets),
-                SC_ATOMIC_GET(fctx->queues[i].total_flows));
+                pkts, SC_ATOMIC_GET(fctx->queues[i].total_flows));
+        total += pkts;
+        if (pkts > max)
+            max = pkts;
         SC_ATOMIC_DESTROY(fctx->queues[i].total_packets);
         SC_ATOMIC_DESTROY(fctx->queues[i].total_flows);
     }
+    /* 100 means all queues got the same share */
+    if (total > 0) {
+        SCLogInfo("AutoFP - Imbalance: busiest queue got %"PRIu64"%% of the "
+                "average packets per queue", (max * fctx->size * 100) / total);
+    }
 
     SCFree(fctx->queues);
 
@@ -238,7 +344,7 @@ void TmqhOutputFlowRoundRobin(ThreadVars *tv, Packet *p)
     /* if no flow we use the first queue,
      * should be rare */
     if (p->flow != NULL) {
-        qid = SC_ATOMIC_GET(p->flow->autofp_tmqh_flow_qid);
+        qid = TmqhFlowGetQueueId(p->flow, ctx->stage);
         if (qid == -1) {
             qid = SC_ATOMIC_ADD(ctx->round_robin_idx, 1);
             if (qid >= ctx->size) {
@@ -246,7 +352,7 @@ void TmqhOutputFlowRoundRobin(ThreadVars *tv, Packet *p)
                 qid = 0;
             }
             (void) SC_ATOMIC_ADD(ctx->queues[qid].total_flows, 1);
-            (void) SC_ATOMIC_SET(p->flow->autofp_tmqh_flow_qid, qid);
+            TmqhFlowSetQueueId(p->flow, ctx->stage, qid);
         }
     } else {
         qid = ctx->last++;
@@ -255,6 +361,8 @@ void TmqhOutputFlowRoundRobin(ThreadVars *tv, Packet *p)
             ctx->last = 0;
     }
     (void) SC_ATOMIC_ADD(ctx->queues[qid].total_packets, 1);
+    TmqhFlowUpdateImbalance(tv, ctx);
+    LATENCY_QUEUE_STAMP(tv, p);
 
     PacketQueue *q = ctx->queues[qid].q;
     SCMutexLock(&q->mutex_q);
@@ -284,7 +392,7 @@ void TmqhOutputFlowActivePackets(ThreadVars *tv, Packet *p)
     /* if no flow we use the first queue,
      * should be rare */
     if (p->flow != NULL) {
-        qid = SC_ATOMIC_GET(p->flow->autofp_tmqh_flow_qid);
+        qid = TmqhFlowGetQueueId(p->flow, ctx->stage);
         if (qid == -1) {
             uint16_t i = 0;
             int lowest_id = 0;
@@ -297,7 +405,7 @@ void TmqhOutputFlowActivePackets(ThreadVars *tv, Packet *p)
                 }
             }
             qid = lowest_id;
-            (void) SC_ATOMIC_SET(p->flow->autofp_tmqh_flow_qid, lowest_id);
+            TmqhFlowSetQueueId(p->flow, ctx->stage, lowest_id);
             (void) SC_ATOMIC_ADD(ctx->queues[qid].total_flows, 1);
         }
     } else {
@@ -307,6 +415,8 @@ void TmqhOutputFlowActivePackets(ThreadVars *tv, Packet *p)
             ctx->last = 0;
     }
     (void) SC_ATOMIC_ADD(ctx->queues[qid].total_packets, 1);
+    TmqhFlowUpdateImbalance(tv, ctx);
+    LATENCY_QUEUE_STAMP(tv, p);
 
     PacketQueue *q = ctx->queues[qid].q;
     SCMutexLock(&q->mutex_q);
@@ -336,19 +446,26 @@ void TmqhOutputFlowHash(ThreadVars *tv, Packet *p)
     /* if no flow we use the first queue,
      * should be rare */
     if (p->flow != NULL) {
-        qid = SC_ATOMIC_GET(p->flow->autofp_tmqh_flow_qid);
+        qid = TmqhFlowGetQueueId(p->flow, ctx->stage);
         if (qid == -1) {
+            if (p->rxhash != 0) {
+                /* hash from the capture, spreads better than the flow
+                 * address. The queue sticks to the flow, so it doesn't
+                 * matter if the hash differs per direction. */
+                qid = p->rxhash % ctx->size;
+            } else {
 #if __WORDSIZE == 64
-            uint64_t addr = (uint64_t)p->flow;
+                uint64_t addr = (uint64_t)p->flow;
 #else
-            uint32_t addr = (uint32_t)p->flow;
+                uint32_t addr = (uint32_t)p->flow;
 #endif
-            addr >>= 7;
+                addr >>= 7;
 
-            /* we don't have to worry about possible overflow, since
-             * ctx->size will be lesser than 2 ** 31 for sure */
-            qid = addr % ctx->size;
-            (void) SC_ATOMIC_SET(p->flow->autofp_tmqh_flow_qid, qid);
+                /* we don't have to worry about possible overflow, since
+                 * ctx->size will be lesser than 2 ** 31 for sure */
+                qid = addr % ctx->size;
+            }
+            TmqhFlowSetQueueId(p->flow, ctx->stage, qid);
             (void) SC_ATOMIC_ADD(ctx->queues[qid].total_flows, 1);
         }
     } else {
@@ -358,6 +475,144 @@ void TmqhOutputFlowHash(ThreadVars *tv, Packet *p)
             ctx->last = 0;
     }
     (void) SC_ATOMIC_ADD(ctx->queues[qid].total_packets, 1);
+    TmqhFlowUpdateImbalance(tv, ctx);
+    LATENCY_QUEUE_STAMP(tv, p);
+
+    PacketQueue *q = ctx->queues[qid].q;
+    SCMutexLock(&q->mutex_q);
+    PacketEnqueue(q, p);
+#ifdef __tile__
+    q->cond_q = 1;
+#else
+    SCCondSignal(&q->cond_q);
+#endif
+    SCMutexUnlock(&q->mutex_q);
+
+    return;
+}
+
+/**
+ * \brief symmetric hash of the addresses of a raw packet
+ *
+ * A light parse of the link and IP headers, so packets can be spread by
+ * flow before they are decoded. Both directions of a flow get the same
+ * hash. Only the addresses are used: IP fragments carry no ports, and
+ * they have to end up on the same thread as the rest of their flow for
+ * defrag to feed the reassembled packet to the right flow.
+ *
+ * \param datalink link type of the packet
+ * \param pkt packet data
+ * \param len packet length
+ *
+ * \retval hash or 0 if the packet isn't IP
+ */
+uint32_t TmqhFlowRawHash(int datalink, const uint8_t *pkt, uint32_t len)
+{
+    uint32_t off = 0;
+    uint16_t type = 0;
+
+    switch (datalink) {
+        case LINKTYPE_ETHERNET:
+            if (len < ETHERNET_HEADER_LEN)
+                return 0;
+            type = (pkt[12] << 8) | pkt[13];
+            off = ETHERNET_HEADER_LEN;
+            /* up to two vlan tags */
+            if (type == ETHERNET_TYPE_VLAN && len >= off + 4) {
+                type = (pkt[off + 2] << 8) | pkt[off + 3];
+                off += 4;
+            }
+            if (type == ETHERNET_TYPE_VLAN && len >= off + 4) {
+                type = (pkt[off + 2] << 8) | pkt[off + 3];
+                off += 4;
+            }
+            break;
+        case LINKTYPE_LINUX_SLL:
+            if (len < SLL_HEADER_LEN)
+                return 0;
+            type = (pkt[14] << 8) | pkt[15];
+            off = SLL_HEADER_LEN;
+            break;
+        case LINKTYPE_RAW:
+            if (len < 1)
+                return 0;
+            type = ((pkt[0] >> 4) == 6) ? ETHERNET_TYPE_IPV6 : ETHERNET_TYPE_IP;
+            break;
+        default:
+            return 0;
+    }
+
+    pkt += off;
+    len -= off;
+
+    /* key: lower address, higher address. No proto either, as the next
+     * header of an ipv6 fragment is the fragment header. */
+    uint32_t key[8];
+    uint32_t words;
+
+    if (type == ETHERNET_TYPE_IP) {
+        if (len < IPV4_HEADER_LEN)
+            return 0;
+
+        memcpy(&key[0], pkt + 12, 4);
+        memcpy(&key[1], pkt + 16, 4);
+        words = 2;
+    } else if (type == ETHERNET_TYPE_IPV6) {
+        if (len < IPV6_HEADER_LEN)
+            return 0;
+
+        memcpy(&key[0], pkt + 8, 16);
+        memcpy(&key[4], pkt + 24, 16);
+        words = 8;
+    } else {
+        return 0;
+    }
+
+    /* put the lower address first so both directions hash the same */
+    uint32_t half = words / 2;
+    if (memcmp(&key[0], &key[half], half * sizeof(uint32_t)) > 0) {
+        uint32_t u, tmp;
+        for (u = 0; u < half; u++) {
+            tmp = key[u];
+            key[u] = key[half + u];
+            key[half + u] = tmp;
+        }
+    }
+
+    uint32_t hash = hashword(key, words, 0);
+    /* 0 means no hash */
+    return hash ? hash : 1;
+}
+
+/**
+ * \brief select the queue by a hash of the raw packet, see TmqhFlowRawHash.
+ *
+ * Used before the packet is decoded, so there is no flow yet.
+ *
+ * \param tv thread vars.
+ * \param p packet.
+ */
+void TmqhOutputFlowRxHash(ThreadVars *tv, Packet *p)
+{
+    int32_t qid = 0;
+
+    TmqhFlowCtx *ctx = (TmqhFlowCtx *)tv->outctx;
+
+    /* the capture's hash isn't necessarily the same for both directions,
+     * so always use our own */
+    p->rxhash = TmqhFlowRawHash(p->datalink, GET_PKT_DATA(p), GET_PKT_LEN(p));
+    if (p->rxhash != 0) {
+        qid = p->rxhash % ctx->size;
+    } else {
+        /* not IP, so no flow to keep together */
+        qid = ctx->last++;
+
+        if (ctx->last == ctx->size)
+            ctx->last = 0;
+    }
+    (void) SC_ATOMIC_ADD(ctx->queues[qid].total_packets, 1);
+    TmqhFlowUpdateImbalance(tv, ctx);
+    LATENCY_QUEUE_STAMP(tv, p);
 
     PacketQueue *q = ctx->queues[qid].q;
     SCMutexLock(&q->mutex_q);
@@ -510,6 +765,181 @@ end:
     return retval;
 }
 
+/** \test the app layer stage schedules flows on its own queue id */
+static int TmqhOutputFlowStageTest01(void)
+{
+    int retval = 0;
+    ThreadVars tv_pickup, tv_applayer;
+    TmqhFlowCtx *pctx = NULL, *actx = NULL;
+    Flow f[3];
+    Packet *p = NULL;
+    int i, qid;
+
+    memset(&tv_pickup, 0, sizeof(tv_pickup));
+    memset(&tv_applayer, 0, sizeof(tv_applayer));
+    memset(&f, 0, sizeof(f));
+    for (i = 0; i < 3; i++) {
+        SC_ATOMIC_INIT(f[i].autofp_tmqh_flow_qid);
+        SC_ATOMIC_SET(f[i].autofp_tmqh_flow_qid, -1);
+        SC_ATOMIC_INIT(f[i].autofp_tmqh_applayer_qid);
+        SC_ATOMIC_SET(f[i].autofp_tmqh_applayer_qid, -1);
+    }
+
+    TmqResetQueues();
+
+    pctx = TmqhOutputFlowSetupCtx("pickup1,pickup2");
+    actx = TmqhOutputFlowSetupCtx("applayer1,applayer2,applayer3");
+    if (pctx == NULL || actx == NULL)
+        goto end;
+    if (pctx->stage != TMQH_FLOW_STAGE_PICKUP ||
+        actx->stage != TMQH_FLOW_STAGE_APPLAYER) {
+        printf("wrong stages: ");
+        goto end;
+    }
+    tv_pickup.outctx = pctx;
+    tv_applayer.outctx = actx;
+
+    p = SCMalloc(SIZE_OF_PACKET);
+    if (p == NULL)
+        goto end;
+
+    for (i = 0; i < 3; i++) {
+        memset(p, 0, SIZE_OF_PACKET);
+        p->flow = &f[i];
+        TmqhOutputFlowRoundRobin(&tv_pickup, p);
+        (void)PacketDequeue(pctx->queues[SC_ATOMIC_GET(f[i].autofp_tmqh_flow_qid)].q);
+        TmqhOutputFlowRoundRobin(&tv_applayer, p);
+        (void)PacketDequeue(actx->queues[SC_ATOMIC_GET(f[i].autofp_tmqh_applayer_qid)].q);
+    }
+
+    /* 2 pickup queues, but every app layer queue got a flow */
+    for (i = 0; i < 3; i++) {
+        if (SC_ATOMIC_GET(actx->queues[i].total_flows) != 1) {
+            printf("applayer queue %d has %"PRIu64" flows: ", i,
+                   SC_ATOMIC_GET(actx->queues[i].total_flows));
+            goto end;
+        }
+    }
+
+    /* the flow sticks to its app layer queue */
+    qid = SC_ATOMIC_GET(f[1].autofp_tmqh_applayer_qid);
+    memset(p, 0, SIZE_OF_PACKET);
+    p->flow = &f[1];
+    TmqhOutputFlowRoundRobin(&tv_applayer, p);
+    if (actx->queues[qid].q->len != 1) {
+        printf("packet not on the flow's queue: ");
+        goto end;
+    }
+    (void)PacketDequeue(actx->queues[qid].q);
+
+    retval = 1;
+end:
+    if (p != NULL)
+        SCFree(p);
+    if (pctx != NULL)
+        TmqhOutputFlowFreeCtx(pctx);
+    if (actx != NULL)
+        TmqhOutputFlowFreeCtx(actx);
+    for (i = 0; i < 3; i++) {
+        SC_ATOMIC_DESTROY(f[i].autofp_tmqh_flow_qid);
+        SC_ATOMIC_DESTROY(f[i].autofp_tmqh_applayer_qid);
+    }
+    TmqResetQueues();
+    return retval;
+}
+
+/** \test raw hash is the same for both directions of a flow */
+static int TmqhFlowRawHashTest01(void)
+{
+    /* ethernet, vlan, ipv4, tcp 10.0.0.1:1024 -> 10.0.0.2:80 */
+    uint8_t pkt[] = {
+        0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x00, 0x01, 0x02, 0x03, 0x04, 0x06,
+        0x81, 0x00, 0x00, 0x0a, 0x08, 0x00,
+        0x45, 0x00, 0x00, 0x28, 0x00, 0x01, 0x00, 0x00, 0x40, 0x06, 0x00, 0x00,
+        0x0a, 0x00, 0x00, 0x01, 0x0a, 0x00, 0x00, 0x02,
+        0x04, 0x00, 0x00, 0x50, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+        0x50, 0x02, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00 };
+    uint8_t rev[sizeof(pkt)];
+    uint32_t ip = 18, tcp = 38;
+
+    /* same packet in the other direction */
+    memcpy(rev, pkt, sizeof(pkt));
+    memcpy(rev + ip + 12, pkt + ip + 16, 4);
+    memcpy(rev + ip + 16, pkt + ip + 12, 4);
+    memcpy(rev + tcp, pkt + tcp + 2, 2);
+    memcpy(rev + tcp + 2, pkt + tcp, 2);
+
+    uint32_t h1 = TmqhFlowRawHash(LINKTYPE_ETHERNET, pkt, sizeof(pkt));
+    uint32_t h2 = TmqhFlowRawHash(LINKTYPE_ETHERNET, rev, sizeof(rev));
+    if (h1 == 0 || h1 != h2) {
+        printf("hash %08x, reverse %08x: ", h1, h2);
+        return 0;
+    }
+
+    /* a non-first fragment of the flow: no ports, same hash */
+    rev[ip + 6] = 0x00;
+    rev[ip + 7] = 0x10;
+    memset(rev + tcp, 0xff, 4);
+    h2 = TmqhFlowRawHash(LINKTYPE_ETHERNET, rev, sizeof(rev));
+    if (h1 != h2) {
+        printf("fragment hash %08x, flow hash %08x: ", h2, h1);
+        return 0;
+    }
+
+    /* other addresses are another flow */
+    rev[ip + 15] = 0x03;
+    h2 = TmqhFlowRawHash(LINKTYPE_ETHERNET, rev, sizeof(rev));
+    if (h1 == h2) {
+        printf("different flows, same hash %08x: ", h1);
+        return 0;
+    }
+
+    /* truncated packets don't get a hash */
+    if (TmqhFlowRawHash(LINKTYPE_ETHERNET, pkt, 20) != 0) {
+        printf("hash for a truncated packet: ");
+        return 0;
+    }
+    return 1;
+}
+
+/** \test raw ipv6: symmetric, and fragments hash like the rest of the flow */
+static int TmqhFlowRawHashTest02(void)
+{
+    uint8_t pkt[48];
+    uint8_t rev[48];
+
+    memset(pkt, 0, sizeof(pkt));
+    pkt[0] = 0x60;
+    pkt[6] = IPPROTO_UDP;
+    pkt[8] = 0x20; pkt[9] = 0x01; pkt[23] = 0x01;   /* 2001::1 */
+    pkt[24] = 0x20; pkt[25] = 0x01; pkt[39] = 0x02; /* 2001::2 */
+    pkt[40] = 0x00; pkt[41] = 0x35;                 /* 53 */
+    pkt[42] = 0x80; pkt[43] = 0x00;                 /* 32768 */
+
+    memcpy(rev, pkt, sizeof(pkt));
+    memcpy(rev + 8, pkt + 24, 16);
+    memcpy(rev + 24, pkt + 8, 16);
+    memcpy(rev + 40, pkt + 42, 2);
+    memcpy(rev + 42, pkt + 40, 2);
+
+    uint32_t h1 = TmqhFlowRawHash(LINKTYPE_RAW, pkt, sizeof(pkt));
+    uint32_t h2 = TmqhFlowRawHash(LINKTYPE_RAW, rev, sizeof(rev));
+    if (h1 == 0 || h1 != h2) {
+        printf("hash %08x, reverse %08x: ", h1, h2);
+        return 0;
+    }
+
+    /* a fragment header instead of udp */
+    rev[6] = IPPROTO_FRAGMENT;
+    memset(rev + 40, 0, 8);
+    h2 = TmqhFlowRawHash(LINKTYPE_RAW, rev, sizeof(rev));
+    if (h1 != h2) {
+        printf("fragment hash %08x, flow hash %08x: ", h2, h1);
+        return 0;
+    }
+    return 1;
+}
+
 #endif /* UNITTESTS */
 
 void TmqhFlowRegisterTests(void)
@@ -518,6 +948,9 @@ void TmqhFlowRegisterTests(void)
     UtRegisterTest("TmqhOutputFlowSetupCtxTest01", TmqhOutputFlowSetupCtxTest01, 1);
     UtRegisterTest("TmqhOutputFlowSetupCtxTest02", TmqhOutputFlowSetupCtxTest02, 1);
     UtRegisterTest("TmqhOutputFlowSetupCtxTest03", TmqhOutputFlowSetupCtxTest03, 1);
+    UtRegisterTest("TmqhOutputFlowStageTest01", TmqhOutputFlowStageTest01, 1);
+    UtRegisterTest("TmqhFlowRawHashTest01", TmqhFlowRawHashTest01, 1);
+    UtRegisterTest("TmqhFlowRawHashTest02", TmqhFlowRawHashTest02, 1);
 #endif
 
     return;
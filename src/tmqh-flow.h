@@ -24,6 +24,15 @@
 #ifndef __TMQH_FLOW_H__
 #define __TMQH_FLOW_H__
 
+/** name prefix of the input queues of the autofp app layer threads */
+#define TMQH_FLOW_APPLAYER_QUEUE    "applayer"
+
+/** autofp stages a flow gets a queue id for */
+enum {
+    TMQH_FLOW_STAGE_PICKUP = 0,     /**< capture/decode to detect threads */
+    TMQH_FLOW_STAGE_APPLAYER,       /**< stream to app layer threads */
+};
+
 typedef struct TmqhFlowMode_ {
     PacketQueue *q;
 
@@ -37,6 +46,11 @@ typedef struct TmqhFlowMode_ {
 typedef struct TmqhFlowCtx_ {
     uint16_t size;
     uint16_t last;
+    uint8_t stage;
+
+    /** live imbalance of the queues, see TmqhFlowUpdateImbalance */
+    uint16_t counter_imbalance;
+    uint32_t imbalance_pkts;
 
     TmqhFlowMode *queues;
 
@@ -48,6 +62,11 @@ typedef struct TmqhFlowCtx_ {
 } TmqhFlowCtx;
 
 void TmqhFlowRegister (void);
+void TmqhFlowThreadInit(struct ThreadVars_ *);
+uint8_t TmqhFlowQueuesStage(const char *);
+int32_t TmqhFlowGetQueueId(struct Flow_ *, uint8_t);
+void TmqhFlowSetQueueId(struct Flow_ *, uint8_t, int32_t);
+uint32_t TmqhFlowRawHash(int, const uint8_t *, uint32_t);
 void TmqhFlowRegisterTests(void);
 
 #endif /* __TMQH_FLOW_H__ */
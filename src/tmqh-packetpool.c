@@ -26,6 +26,11 @@
  * because every thread can return packets to the pool and multiple parts
  * of the code retrieve packets (Decode, Defrag) and these can run in their
  * own threads as well.
+ *
+ * On NUMA systems there is a ringbuffer per node. The packets of a node's
+ * pool are allocated on that node, threads take packets from the pool of
+ * their own node first and packets always go back to the pool they came
+ * from.
  */
 
 #include "suricata.h"
@@ -52,6 +57,7 @@
 #include "util-debug.h"
 #include "util-error.h"
 #include "util-profiling.h"
+#include "util-numa.h"
 
 #ifdef __tile__
 #include "conf.h"
@@ -64,7 +70,19 @@
 #ifdef __tile__
 static RingBuffer16 *ringbuffer[MAX_TILERA_PIPELINES] = { NULL };
 #else
-static RingBuffer16 *ringbuffer = NULL;
+static RingBuffer16 *ringbuffer[NUMA_MAX_NODES] = { NULL };
+static int ringbuffer_cnt = 0;
+
+/** per node memory the packets of the pool are carved from */
+static uint8_t *packet_chunk[NUMA_MAX_NODES] = { NULL };
+static size_t packet_chunk_size[NUMA_MAX_NODES];
+
+/** \brief pool node of the calling thread */
+static inline int PacketPoolNode(void)
+{
+    int node = UtilNumaThreadNode();
+    return (node < ringbuffer_cnt) ? node : 0;
+}
 #endif
 
 int mica_memcpy_enabled = 0;
@@ -96,11 +114,13 @@ void TmqhPacketpoolRegister (void) {
         }
     }
 #else
-    ringbuffer = RingBufferInit();
-    if (ringbuffer == NULL) {
+    /* the node count is not known yet, PacketPoolInit adds the others */
+    ringbuffer[0] = RingBufferInit();
+    if (ringbuffer[0] == NULL) {
         SCLogError(SC_ERR_FATAL, "Error registering Packet pool handler (at ring buffer init)");
         exit(EXIT_FAILURE);
     }
+    ringbuffer_cnt = 1;
 #endif
 }
 
@@ -115,7 +135,12 @@ int PacketPoolIsEmpty(int pool) {
 }
 #else
 int PacketPoolIsEmpty(void) {
-    return RingBufferIsEmpty(ringbuffer);
+    int node;
+    for (node = 0; node < ringbuffer_cnt; node++) {
+        if (!RingBufferIsEmpty(ringbuffer[node]))
+            return 0;
+    }
+    return 1;
 }
 #endif
 
@@ -124,8 +149,14 @@ uint16_t PacketPoolSize(int pool) {
     return RingBufferSize(ringbuffer[pool]);
 }
 #else
+/** \brief number of packets available to the calling thread, so the
+ *         packets in the pools of all nodes */
 uint16_t PacketPoolSize(void) {
-    return RingBufferSize(ringbuffer);
+    uint32_t size = 0;
+    int node;
+    for (node = 0; node < ringbuffer_cnt; node++)
+        size += RingBufferSize(ringbuffer[node]);
+    return (size > 0xffff) ? 0xffff : (uint16_t)size;
 }
 #endif
 
@@ -135,7 +166,7 @@ void PacketPoolWait(int pool) {
 }
 #else
 void PacketPoolWait(void) {
-    RingBufferWait(ringbuffer);
+    RingBufferWait(ringbuffer[PacketPoolNode()]);
 }
 #endif
 
@@ -155,12 +186,14 @@ void PacketPoolStorePacket(Packet *p) {
     RingBufferMrMwPut(rb, (void *)p);
     SCLogDebug("buffersize %u", RingBufferSize(rb));
 #else
-    if (RingBufferIsFull(ringbuffer)) {
+    RingBuffer16 *rb = ringbuffer[p->pool_node];
+
+    if (RingBufferIsFull(rb)) {
         exit(1);
     }
 
-    RingBufferMrMwPut(ringbuffer, (void *)p);
-    SCLogDebug("buffersize %u", RingBufferSize(ringbuffer));
+    RingBufferMrMwPut(rb, (void *)p);
+    SCLogDebug("buffersize %u", RingBufferSize(rb));
 #endif
 }
 
@@ -178,10 +211,19 @@ Packet *PacketPoolGetPacket(int pool) {
 }
 #else
 Packet *PacketPoolGetPacket(void) {
-    if (RingBufferIsEmpty(ringbuffer))
-        return NULL;
+    int node = PacketPoolNode();
+    Packet *p = NULL;
+
+    if (!RingBufferIsEmpty(ringbuffer[node]))
+        p = RingBufferMrMwGetNoWait(ringbuffer[node]);
 
-    Packet *p = RingBufferMrMwGetNoWait(ringbuffer);
+    /* our own node ran dry, take a remote packet rather than waiting */
+    int n;
+    for (n = 0; p == NULL && n < ringbuffer_cnt; n++) {
+        if (n == node || RingBufferIsEmpty(ringbuffer[n]))
+            continue;
+        p = RingBufferMrMwGetNoWait(ringbuffer[n]);
+    }
     return p;
 }
 #endif
@@ -191,44 +233,99 @@ void PacketPoolInit(intmax_t max_pending_packets) {
     /* packet pool is maintained by mpipe on tilegx */
 }
 #else
+/** size of a packet in the pool chunks, rounded up to a cache line so
+ *  packets don't share lines */
+#define PACKET_POOL_STRIDE  ((SIZE_OF_PACKET + 63) & ~((size_t)63))
+
 void PacketPoolInit(intmax_t max_pending_packets) {
-    /* pre allocate packets */
+    int nodes = UtilNumaNodeCount();
+    int node;
+
+    for (node = 1; node < nodes; node++) {
+        ringbuffer[node] = RingBufferInit();
+        if (ringbuffer[node] == NULL) {
+            SCLogError(SC_ERR_FATAL, "Error initializing the packet pool of "
+                    "NUMA node %d", node);
+            exit(EXIT_FAILURE);
+        }
+    }
+    ringbuffer_cnt = nodes;
+
+    /* pre allocate packets, split evenly over the nodes */
     SCLogDebug("preallocating packets... packet size %" PRIuMAX "", (uintmax_t)SIZE_OF_PACKET);
-    int i = 0;
-    for (i = 0; i < max_pending_packets; i++) {
-        /* XXX pkt alloc function */
-        Packet *p = SCMalloc(SIZE_OF_PACKET);
-        if (unlikely(p == NULL)) {
+    for (node = 0; node < nodes; node++) {
+        intmax_t cnt = max_pending_packets / nodes;
+        if (node < max_pending_packets % nodes)
+            cnt++;
+        if (cnt == 0)
+            continue;
+
+        packet_chunk_size[node] = (size_t)cnt * PACKET_POOL_STRIDE;
+        packet_chunk[node] = UtilNumaAlloc(packet_chunk_size[node], node,
+                                           "packet pool");
+        if (unlikely(packet_chunk[node] == NULL)) {
             SCLogError(SC_ERR_FATAL, "Fatal error encountered while allocating a packet. Exiting...");
             exit(EXIT_FAILURE);
         }
-        PACKET_INITIALIZE(p);
 
-        PacketPoolStorePacket(p);
+        intmax_t i = 0;
+        for (i = 0; i < cnt; i++) {
+            Packet *p = (Packet *)(packet_chunk[node] + i * PACKET_POOL_STRIDE);
+            PACKET_INITIALIZE(p);
+            p->pool_node = (uint8_t)node;
+
+            PacketPoolStorePacket(p);
+        }
+        if (nodes > 1) {
+            SCLogInfo("preallocated %"PRIiMAX" packets on NUMA node %d",
+                    cnt, node);
+        }
     }
     SCLogInfo("preallocated %"PRIiMAX" packets. Total memory %"PRIuMAX"",
-            max_pending_packets, (uintmax_t)(max_pending_packets*SIZE_OF_PACKET));
+            max_pending_packets, (uintmax_t)(max_pending_packets*PACKET_POOL_STRIDE));
 }
 #endif
 
 #ifdef __tilegx__
 void PacketPoolDestroy(void) {
     /* packet pool is maintained by mpipe on tilegx */
+    PacketViewPoolDestroy();
 }
 #else
 void PacketPoolDestroy(void) {
-    if (ringbuffer == NULL) {
-        return;
-    }
+    int node;
+
+    for (node = 0; node < ringbuffer_cnt; node++) {
+        if (ringbuffer[node] == NULL)
+            continue;
+
+        size_t expected = packet_chunk_size[node] / PACKET_POOL_STRIDE;
+        size_t returned = 0;
+        Packet *p = NULL;
+        while ((p = RingBufferMrMwGetNoWait(ringbuffer[node])) != NULL) {
+            PACKET_CLEANUP(p);
+            returned++;
+        }
 
-    Packet *p = NULL;
-    while ((p = PacketPoolGetPacket()) != NULL) {
-        PACKET_CLEANUP(p);
-        SCFree(p);
+        /* packets that are still out point into the chunk and will be
+         * returned to this ring, so keep both around rather than having
+         * a late return write into freed memory */
+        if (returned < expected) {
+            SCLogWarning(SC_ERR_POOL_EMPTY, "%"PRIuMAX" packets of NUMA node "
+                    "%d still in use, not freeing its packet pool",
+                    (uintmax_t)(expected - returned), node);
+            continue;
+        }
+
+        RingBufferDestroy(ringbuffer[node]);
+        ringbuffer[node] = NULL;
+
+        UtilNumaFree(packet_chunk[node], packet_chunk_size[node], node);
+        packet_chunk[node] = NULL;
     }
+    ringbuffer_cnt = 0;
 
-    RingBufferDestroy(ringbuffer);
-    ringbuffer = NULL;
+    PacketViewPoolDestroy();
 }
 #endif
 
@@ -243,8 +340,17 @@ Packet *TmqhInputPacketpool(ThreadVars *t)
         p = RingBufferMrMwGet(rb);
     }
 #else
-    while (p == NULL && ringbuffer->shutdown == FALSE) {
-        p = RingBufferMrMwGet(ringbuffer);
+    if (ringbuffer_cnt == 1) {
+        while (p == NULL && ringbuffer[0]->shutdown == FALSE) {
+            p = RingBufferMrMwGet(ringbuffer[0]);
+        }
+    } else {
+        RingBuffer16 *rb = ringbuffer[PacketPoolNode()];
+        while (p == NULL && rb->shutdown == FALSE) {
+            p = PacketPoolGetPacket();
+            if (p == NULL)
+                RingBufferWait(rb);
+        }
     }
 #endif
 
@@ -375,7 +481,7 @@ void TmqhOutputPacketpool(ThreadVars *t, Packet *p)
 #ifdef __tile__
             MPIPE_FREE_PACKET(p->root);
 #else
-            RingBufferMrMwPut(ringbuffer, (void *)p->root);
+            RingBufferMrMwPut(ringbuffer[p->root->pool_node], (void *)p->root);
 #endif
         }
 
@@ -398,7 +504,9 @@ void TmqhOutputPacketpool(ThreadVars *t, Packet *p)
     PACKET_PROFILING_END(p);
 
     SCLogDebug("getting rid of tunnel pkt... alloc'd %s (root %p)", p->flags & PKT_ALLOC ? "true" : "false", p->root);
-    if (p->flags & PKT_ALLOC) {
+    if (p->flags & PKT_VIEW) {
+        PacketViewRelease(p);
+    } else if (p->flags & PKT_ALLOC) {
         PACKET_CLEANUP(p);
         SCFree(p);
     } else {
@@ -422,7 +530,7 @@ void TmqhOutputPacketpool(ThreadVars *t, Packet *p)
             //tmc_mem_fence();
             MPIPE_FREE_PACKET(p);
 #else
-            RingBufferMrMwPut(ringbuffer, (void *)p);
+            RingBufferMrMwPut(ringbuffer[p->pool_node], (void *)p);
 #endif
 #ifdef __tilegx__
         }
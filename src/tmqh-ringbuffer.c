@@ -101,8 +101,6 @@ Packet *TmqhInputRingBufferMrSw(ThreadVars *t)
 
     Packet *p = (Packet *)RingBufferMrSw8Get(rb);
 
-    SCPerfSyncCountersIfSignalled(t, 0);
-
     return p;
 }
 
@@ -118,8 +116,6 @@ Packet *TmqhInputRingBufferSrSw(ThreadVars *t)
 
     Packet *p = (Packet *)RingBufferSrSw8Get(rb);
 
-    SCPerfSyncCountersIfSignalled(t, 0);
-
     return p;
 }
 
@@ -135,8 +131,6 @@ Packet *TmqhInputRingBufferSrMw(ThreadVars *t)
 
     Packet *p = (Packet *)RingBufferSrMw8Get(rb);
 
-    SCPerfSyncCountersIfSignalled(t, 0);
-
     return p;
 }
 
@@ -30,6 +30,7 @@
 #include "threadvars.h"
 
 #include "tm-queuehandlers.h"
+#include "tmqh-wait.h"
 
 #ifdef __tile__
 #include <arch/cycle.h>
@@ -61,23 +62,13 @@ Packet *TmqhInputSimple(ThreadVars *t)
 {
     PacketQueue *q = &trans_q[t->inq->id];
 
-    SCPerfSyncCountersIfSignalled(t, 0);
-
     SCMutexLock(&q->mutex_q);
 
     if (unlikely(q->len == 0)) {
         /* if we have no packets in queue, wait... */
-#ifdef __tile__
-        do {
-            SCMutexUnlock(&q->mutex_q);
-            while ((q->len == 0)/* && (q->cond_q == 0)*/) {
-	            cycle_pause(300);
-            }
-            SCMutexLock(&q->mutex_q);
-        } while ((q->len == 0)/* && (q->cond_q == 0)*/);
-#else
-        SCCondWait(&q->cond_q, &q->mutex_q);
-#endif
+        TmqhWaitOnQueue(t, q);
+    } else {
+        TMQH_WAIT_NOWAIT(t);
     }
 
     if (likely(q->len > 0)) {
@@ -0,0 +1,823 @@
+/* Copyright (C) 2007-2013 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Lock free queue handler for the autofp runmodes.
+ *
+ * Alternative to the "flow" queue handler. Every producer thread
+ * gets its own bounded single producer, single consumer ring to each of
+ * its output queues, so neither side takes q->mutex_q per packet. The
+ * consumer round robins over the rings of its queue, taking up to
+ * TMQH_SPSC_BATCH packets from a ring before moving on. When idle it waits
+ * like the other input handlers (see tmqh-wait.c), but spins by default,
+ * and sleeps on the queue's condition; producers only signal when the
+ * consumer is asleep.
+ *
+ * Each queue must have a single reader, as is the case for the autofp
+ * pickup queues. Enable with "autofp-queue-handler: spsc", the
+ * runmodes then use the "spsc" handler instead of "flow". Flows are
+ * scheduled over the queues by the "autofp-scheduler".
+ */
+
+#include "suricata.h"
+#include "packet-queue.h"
+#include "decode.h"
+#include "threads.h"
+#include "threadvars.h"
+#include "conf.h"
+#include "flow.h"
+
+#include "tm-queuehandlers.h"
+#include "tm-queues.h"
+#include "tm-threads.h"
+#include "tmqh-packetpool.h"
+#include "tmqh-flow.h"
+#include "tmqh-spsc.h"
+#include "tmqh-wait.h"
+
+#include "util-atomic.h"
+#include "util-latency.h"
+#include "util-optimize.h"
+#include "util-unittest.h"
+
+#define TMQH_SPSC_RING_MASK     (TMQH_SPSC_RING_SIZE - 1)
+
+/* spins of a producer on a full ring before it starts sleeping */
+#define TMQH_SPSC_PUT_SPINS     64
+/* wait strategy of an idle consumer if threading.wait is not set */
+#define TMQH_SPSC_SPIN_CYCLES   100000
+#define TMQH_SPSC_YIELDS        16
+/* max sleep, so the thread loop gets to check its flags */
+#define TMQH_SPSC_SLEEP_USEC    1000
+
+#if defined(__x86_64__) || defined(__i386__)
+/* x86 doesn't reorder stores with stores or loads with loads */
+#define TMQH_SPSC_WMB()         cc_barrier()
+#define TMQH_SPSC_RMB()         cc_barrier()
+#else
+#define TMQH_SPSC_WMB()         hw_barrier()
+#define TMQH_SPSC_RMB()         hw_barrier()
+#endif
+
+/** \brief consumer side of a queue */
+typedef struct TmqhSpscQueue_ {
+    TmqhSpscRing *rings;    /**< rings feeding this queue */
+    TmqhSpscRing *cur;      /**< ring we're currently taking packets from */
+    uint32_t batch;         /**< packets left to take from cur */
+    uint32_t taken;         /**< packets not yet subtracted from q->len */
+    volatile int sleeping;
+} __attribute__((aligned(64))) TmqhSpscQueue;
+
+static TmqhSpscQueue spsc_queues[256];
+
+/** flow schedulers, see autofp-scheduler */
+enum {
+    TMQH_SPSC_SCHED_ACTIVE_PACKETS = 0,
+    TMQH_SPSC_SCHED_ROUND_ROBIN,
+    TMQH_SPSC_SCHED_HASH,
+};
+static int spsc_scheduler = TMQH_SPSC_SCHED_ACTIVE_PACKETS;
+
+Packet *TmqhInputSpsc(ThreadVars *);
+void TmqhOutputSpsc(ThreadVars *, Packet *);
+void TmqhOutputSpscBatch(ThreadVars *, Packet **, uint16_t);
+void TmqhInputSpscShutdownHandler(ThreadVars *);
+void *TmqhOutputSpscSetupCtx(char *);
+void TmqhOutputSpscFreeCtx(void *);
+void TmqhSpscRegisterTests(void);
+
+void TmqhSpscRegister (void)
+{
+    tmqh_table[TMQH_SPSC].name = "spsc";
+    tmqh_table[TMQH_SPSC].InHandler = TmqhInputSpsc;
+    tmqh_table[TMQH_SPSC].InShutdownHandler = TmqhInputSpscShutdownHandler;
+    tmqh_table[TMQH_SPSC].OutHandler = TmqhOutputSpsc;
+    tmqh_table[TMQH_SPSC].OutHandlerBatch = TmqhOutputSpscBatch;
+    tmqh_table[TMQH_SPSC].OutHandlerCtxSetup = TmqhOutputSpscSetupCtx;
+    tmqh_table[TMQH_SPSC].OutHandlerCtxFree = TmqhOutputSpscFreeCtx;
+    tmqh_table[TMQH_SPSC].RegisterTests = TmqhSpscRegisterTests;
+
+    memset(spsc_queues, 0, sizeof(spsc_queues));
+
+    char *handler = NULL;
+    if (ConfGet("autofp-queue-handler", &handler) == 1) {
+        if (strcasecmp(handler, "spsc") == 0) {
+            /* the runmodes pick it, see RunModeAutoFpQueueHandler() */
+            SCLogInfo("AutoFP mode using lock free \"spsc\" queue handler");
+
+            /* TmqhFlowRegister already rejected invalid values */
+            char *scheduler = NULL;
+            if (ConfGet("autofp-scheduler", &scheduler) == 1) {
+                if (strcasecmp(scheduler, "round-robin") == 0)
+                    spsc_scheduler = TMQH_SPSC_SCHED_ROUND_ROBIN;
+                else if (strcasecmp(scheduler, "hash") == 0)
+                    spsc_scheduler = TMQH_SPSC_SCHED_HASH;
+            }
+        } else if (strcasecmp(handler, "flow") != 0) {
+            SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "Invalid entry \"%s\" "
+                       "for autofp-queue-handler in conf.  Killing engine.",
+                       handler);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/** \brief free the rings, only safe once all threads are gone */
+void TmqhSpscDestroy (void)
+{
+    int i;
+
+    for (i = 0; i < 256; i++) {
+        TmqhSpscRing *r = spsc_queues[i].rings;
+        while (r != NULL) {
+            TmqhSpscRing *next = r->next;
+            SCFreeAligned(r);
+            r = next;
+        }
+    }
+    memset(spsc_queues, 0, sizeof(spsc_queues));
+}
+
+/**
+ * \brief put a packet in a ring, waiting for room if it's full
+ *
+ * Waiting on a full ring is the back pressure to the producer. We stop
+ * waiting if the thread or the engine is killed, as the consumer may be
+ * gone already.
+ *
+ * \retval 0 packet added
+ * \retval -1 ring is full and we're being killed, packet not added
+ */
+static inline int TmqhSpscRingPut(ThreadVars *tv, TmqhSpscRing *r, Packet *p)
+{
+    uint32_t w = r->write;
+
+    if (unlikely(w - r->read_cache == TMQH_SPSC_RING_SIZE)) {
+        uint32_t spins = 0;
+        while (1) {
+            r->read_cache = r->read;
+            if (w - r->read_cache != TMQH_SPSC_RING_SIZE)
+                break;
+
+            if (++spins < TMQH_SPSC_PUT_SPINS) {
+                TMQH_WAIT_RELAX();
+            } else {
+                if (TmThreadsCheckFlag(tv, THV_KILL) ||
+                    (suricata_ctl_flags & SURICATA_KILL))
+                    return -1;
+                usleep(1);
+            }
+        }
+    }
+
+    r->array[w & TMQH_SPSC_RING_MASK] = p;
+    TMQH_SPSC_WMB();
+    r->write = w + 1;
+    return 0;
+}
+
+/** \retval p packet or NULL if the ring is empty */
+static inline Packet *TmqhSpscRingGet(TmqhSpscRing *r)
+{
+    uint32_t rd = r->read;
+
+    if (rd == r->write_cache) {
+        r->write_cache = r->write;
+        TMQH_SPSC_RMB();
+        if (rd == r->write_cache)
+            return NULL;
+    }
+
+    Packet *p = r->array[rd & TMQH_SPSC_RING_MASK];
+    /* don't hand the slot back before we've read it */
+    TMQH_SPSC_WMB();
+    r->read = rd + 1;
+    return p;
+}
+
+static inline int TmqhSpscRingIsEmpty(TmqhSpscRing *r)
+{
+    return (r->read == r->write);
+}
+
+/** \brief get a packet from any of the rings of the queue */
+static Packet *TmqhSpscQueueGet(TmqhSpscQueue *sq)
+{
+    Packet *p;
+    TmqhSpscRing *r = sq->cur;
+
+    if (unlikely(r == NULL)) {
+        if (sq->rings == NULL)
+            return NULL;
+        r = sq->cur = sq->rings;
+    }
+
+    if (sq->batch > 0) {
+        p = TmqhSpscRingGet(r);
+        if (p != NULL) {
+            sq->batch--;
+            return p;
+        }
+    }
+
+    /* try every ring once, starting after the current one */
+    TmqhSpscRing *start = r;
+    do {
+        r = r->next ? r->next : sq->rings;
+        p = TmqhSpscRingGet(r);
+        if (p != NULL) {
+            sq->cur = r;
+            sq->batch = TMQH_SPSC_BATCH - 1;
+            return p;
+        }
+    } while (r != start);
+
+    sq->batch = 0;
+    return NULL;
+}
+
+static int TmqhSpscQueueIsEmpty(TmqhSpscQueue *sq)
+{
+    TmqhSpscRing *r;
+    for (r = sq->rings; r != NULL; r = r->next) {
+        if (!TmqhSpscRingIsEmpty(r))
+            return 0;
+    }
+    return 1;
+}
+
+/** \brief account the packets we took in the queue len, which the
+ *         shutdown code and the active packets scheduler look at */
+static inline void TmqhSpscQueueSyncLen(PacketQueue *q, TmqhSpscQueue *sq)
+{
+    if (sq->taken > 0) {
+        (void) SCAtomicFetchAndSub(&q->len, sq->taken);
+        sq->taken = 0;
+    }
+}
+
+Packet *TmqhInputSpsc(ThreadVars *tv)
+{
+    PacketQueue *q = &trans_q[tv->inq->id];
+    TmqhSpscQueue *sq = &spsc_queues[tv->inq->id];
+    TmqhWaitState ws;
+    Packet *p;
+
+    p = TmqhSpscQueueGet(sq);
+    if (likely(p != NULL)) {
+        if (++sq->taken == TMQH_SPSC_BATCH)
+            TmqhSpscQueueSyncLen(q, sq);
+        TMQH_WAIT_NOWAIT(tv);
+        LATENCY_QUEUE_TAKE(tv, p);
+        return p;
+    }
+
+    TmqhSpscQueueSyncLen(q, sq);
+
+    if (unlikely(!tv->wait.configured))
+        TmqhWaitSetDefaults(tv, TMQH_SPSC_SPIN_CYCLES, TMQH_SPSC_YIELDS);
+
+    TmqhWaitBegin(tv, &ws);
+    while (TmqhWaitSpin(tv, &ws)) {
+        p = TmqhSpscQueueGet(sq);
+        if (p != NULL) {
+            sq->taken++;
+            TmqhWaitEnd(tv, &ws);
+            LATENCY_QUEUE_TAKE(tv, p);
+            return p;
+        }
+    }
+
+    TmqhWaitSleep(tv, &ws);
+    SCMutexLock(&q->mutex_q);
+    sq->sleeping = 1;
+    /* pairs with the atomic op in TmqhSpscPutDone: either the producer
+     * sees us sleeping, or we see its packet */
+    hw_barrier();
+    if (TmqhSpscQueueIsEmpty(sq)) {
+        struct timeval tv_now;
+        struct timespec ts;
+
+        gettimeofday(&tv_now, NULL);
+        ts.tv_sec = tv_now.tv_sec;
+        ts.tv_nsec = (tv_now.tv_usec + TMQH_SPSC_SLEEP_USEC) * 1000;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        SCCondTimedwait(&q->cond_q, &q->mutex_q, &ts);
+    }
+    sq->sleeping = 0;
+    SCMutexUnlock(&q->mutex_q);
+    TmqhWaitEnd(tv, &ws);
+
+    /* may be NULL, on signals or timeout */
+    p = TmqhSpscQueueGet(sq);
+    if (p != NULL) {
+        sq->taken++;
+        LATENCY_QUEUE_TAKE(tv, p);
+    }
+    return p;
+}
+
+void TmqhInputSpscShutdownHandler(ThreadVars *tv)
+{
+    if (tv == NULL || tv->inq == NULL) {
+        return;
+    }
+
+    PacketQueue *q = &trans_q[tv->inq->id];
+    SCMutexLock(&q->mutex_q);
+    SCCondSignal(&q->cond_q);
+    SCMutexUnlock(&q->mutex_q);
+}
+
+/**
+ * \brief pick a queue for a new flow, like the flow queue handler's
+ *        schedulers
+ *
+ * \retval qid index of the queue in the ctx
+ */
+static int32_t TmqhSpscScheduleFlow(TmqhSpscCtx *ctx, Packet *p)
+{
+    int32_t qid = 0;
+
+    switch (spsc_scheduler) {
+        case TMQH_SPSC_SCHED_ROUND_ROBIN:
+            /* the ctx has a single producer, no need for an atomic */
+            qid = ctx->round_robin_idx++;
+            if (ctx->round_robin_idx == ctx->size)
+                ctx->round_robin_idx = 0;
+            break;
+        case TMQH_SPSC_SCHED_HASH:
+            if (p->rxhash != 0) {
+                qid = p->rxhash % ctx->size;
+            } else {
+                uintptr_t addr = (uintptr_t)p->flow;
+                qid = (addr >> 7) % ctx->size;
+            }
+            break;
+        default:
+        {
+            uint16_t i;
+            uint32_t lowest = trans_q[ctx->qids[0]].len;
+            for (i = 1; i < ctx->size; i++) {
+                if (trans_q[ctx->qids[i]].len < lowest) {
+                    lowest = trans_q[ctx->qids[i]].len;
+                    qid = i;
+                }
+            }
+            break;
+        }
+    }
+    return qid;
+}
+
+/** \retval qid index in the ctx of the queue the packet goes to */
+static inline int32_t TmqhSpscGetQueue(TmqhSpscCtx *ctx, Packet *p)
+{
+    int32_t qid = 0;
+
+    if (ctx->size > 1) {
+        /* if no flow we round robin, should be rare */
+        if (p->flow != NULL) {
+            qid = TmqhFlowGetQueueId(p->flow, ctx->stage);
+            if (qid == -1) {
+                qid = TmqhSpscScheduleFlow(ctx, p);
+                TmqhFlowSetQueueId(p->flow, ctx->stage, qid);
+            }
+        } else {
+            qid = ctx->last++;
+
+            if (ctx->last == ctx->size)
+                ctx->last = 0;
+        }
+    }
+    return qid;
+}
+
+/**
+ * \brief account the packets put on a queue in its len and wake up the
+ *        consumer if it sleeps
+ */
+static inline void TmqhSpscPutDone(uint16_t id, uint32_t cnt)
+{
+    PacketQueue *q = &trans_q[id];
+
+    /* locked op, so it also orders the puts before it with the load of
+     * 'sleeping' below */
+    (void) SCAtomicFetchAndAdd(&q->len, cnt);
+
+    if (unlikely(spsc_queues[id].sleeping)) {
+        SCMutexLock(&q->mutex_q);
+        SCCondSignal(&q->cond_q);
+        SCMutexUnlock(&q->mutex_q);
+    }
+}
+
+/**
+ * \brief put a batch of packets, the len of each queue is updated and its
+ *        consumer woken up once per batch
+ *
+ * A consumer only sleeps once all its rings are empty, so it can't leave
+ * a ring full of packets put before the wake up. The packets not yet
+ * accounted are flushed at half a ring all the same.
+ */
+void TmqhOutputSpscBatch(ThreadVars *tv, Packet **pkts, uint16_t cnt)
+{
+    TmqhSpscCtx *ctx = (TmqhSpscCtx *)tv->outctx;
+    uint16_t i;
+
+    for (i = 0; i < cnt; i++) {
+        Packet *p = pkts[i];
+        int32_t qid = TmqhSpscGetQueue(ctx, p);
+
+        /* stamp before the put, once it's in the ring the packet belongs
+         * to the consumer */
+        LATENCY_QUEUE_STAMP(tv, p);
+
+        if (unlikely(TmqhSpscRingPut(tv, ctx->rings[qid], p) < 0)) {
+            SCLogDebug("queue %"PRIu16" full while shutting down, dropping "
+                       "packet %p", ctx->qids[qid], p);
+            TmqhOutputPacketpool(tv, p);
+            continue;
+        }
+        if (unlikely(++ctx->pending[qid] == TMQH_SPSC_RING_SIZE / 2)) {
+            TmqhSpscPutDone(ctx->qids[qid], ctx->pending[qid]);
+            ctx->pending[qid] = 0;
+        }
+    }
+
+    for (i = 0; i < ctx->size; i++) {
+        if (ctx->pending[i] > 0) {
+            TmqhSpscPutDone(ctx->qids[i], ctx->pending[i]);
+            ctx->pending[i] = 0;
+        }
+    }
+}
+
+void TmqhOutputSpsc(ThreadVars *tv, Packet *p)
+{
+    TmqhOutputSpscBatch(tv, &p, 1);
+}
+
+static int TmqhSpscStoreQueue(TmqhSpscCtx *ctx, char *name)
+{
+    Tmq *tmq = TmqGetQueueByName(name);
+    if (tmq == NULL) {
+        tmq = TmqCreateQueue(SCStrdup(name));
+        if (tmq == NULL)
+            return -1;
+    }
+    tmq->writer_cnt++;
+
+    TmqhSpscRing *r = SCMallocAligned(sizeof(TmqhSpscRing), 64);
+    if (unlikely(r == NULL))
+        return -1;
+    memset(r, 0, sizeof(TmqhSpscRing));
+
+    uint16_t *qids = SCRealloc(ctx->qids, (ctx->size + 1) * sizeof(uint16_t));
+    if (unlikely(qids == NULL)) {
+        SCFreeAligned(r);
+        return -1;
+    }
+    ctx->qids = qids;
+
+    TmqhSpscRing **rings = SCRealloc(ctx->rings, (ctx->size + 1) * sizeof(TmqhSpscRing *));
+    if (unlikely(rings == NULL)) {
+        SCFreeAligned(r);
+        return -1;
+    }
+    ctx->rings = rings;
+
+    uint32_t *pending = SCRealloc(ctx->pending, (ctx->size + 1) * sizeof(uint32_t));
+    if (unlikely(pending == NULL)) {
+        SCFreeAligned(r);
+        return -1;
+    }
+    ctx->pending = pending;
+
+    ctx->qids[ctx->size] = tmq->id;
+    ctx->rings[ctx->size] = r;
+    ctx->pending[ctx->size] = 0;
+    ctx->size++;
+
+    /* hand the ring to the consumer, which may already be running */
+    TmqhSpscQueue *sq = &spsc_queues[tmq->id];
+    r->next = sq->rings;
+    TMQH_SPSC_WMB();
+    sq->rings = r;
+
+    return 0;
+}
+
+/**
+ * \brief setup the queue handlers ctx
+ *
+ * Parses a comma separated string "queuename1,queuename2,etc" and sets
+ * up a ring to each of these queues.
+ *
+ * \param queue_str comma separated string with output queue names
+ *
+ * \retval ctx queues handlers ctx or NULL in error
+ */
+void *TmqhOutputSpscSetupCtx(char *queue_str)
+{
+    if (queue_str == NULL || strlen(queue_str) == 0)
+        return NULL;
+
+    TmqhSpscCtx *ctx = SCMalloc(sizeof(TmqhSpscCtx));
+    if (unlikely(ctx == NULL))
+        return NULL;
+    memset(ctx, 0x00, sizeof(TmqhSpscCtx));
+
+    char *str = SCStrdup(queue_str);
+    if (unlikely(str == NULL)) {
+        goto error;
+    }
+    char *tstr = str;
+
+    /* parse the comma separated string */
+    do {
+        char *comma = strchr(tstr,',');
+        if (comma != NULL)
+            *comma = '\0';
+        if (TmqhSpscStoreQueue(ctx, tstr) < 0)
+            goto error;
+        tstr = comma ? (comma + 1) : comma;
+    } while (tstr != NULL);
+
+    ctx->stage = TmqhFlowQueuesStage(queue_str);
+
+    SCFree(str);
+    return (void *)ctx;
+
+error:
+    /* rings already handed to a queue stay there */
+    if (ctx->qids != NULL)
+        SCFree(ctx->qids);
+    if (ctx->rings != NULL)
+        SCFree(ctx->rings);
+    if (ctx->pending != NULL)
+        SCFree(ctx->pending);
+    SCFree(ctx);
+    if (str != NULL)
+        SCFree(str);
+    return NULL;
+}
+
+/** \brief free the ctx, the rings are owned by the queues */
+void TmqhOutputSpscFreeCtx(void *ctx)
+{
+    TmqhSpscCtx *sctx = (TmqhSpscCtx *)ctx;
+
+    SCFree(sctx->qids);
+    SCFree(sctx->rings);
+    SCFree(sctx->pending);
+    SCFree(sctx);
+}
+
+#ifdef UNITTESTS
+
+/** \test ring wraps around and keeps the order */
+static int TmqhSpscTest01(void)
+{
+    int result = 0;
+    ThreadVars tv;
+    TmqhSpscRing *r = SCMallocAligned(sizeof(TmqhSpscRing), 64);
+    if (r == NULL)
+        return 0;
+    memset(r, 0, sizeof(TmqhSpscRing));
+    memset(&tv, 0, sizeof(tv));
+
+    uintptr_t i;
+    /* start close to the index wrap */
+    r->write = r->read = r->read_cache = r->write_cache = UINT32_MAX - 10;
+
+    for (i = 1; i <= 3 * TMQH_SPSC_RING_SIZE; i++) {
+        TmqhSpscRingPut(&tv, r, (Packet *)i);
+        if (TmqhSpscRingGet(r) != (Packet *)i) {
+            printf("packet %"PRIuMAX" out of order: ", (uintmax_t)i);
+            goto end;
+        }
+    }
+    if (TmqhSpscRingGet(r) != NULL)
+        goto end;
+
+    /* fill it up completely */
+    for (i = 1; i <= TMQH_SPSC_RING_SIZE; i++)
+        TmqhSpscRingPut(&tv, r, (Packet *)i);
+    for (i = 1; i <= TMQH_SPSC_RING_SIZE; i++) {
+        if (TmqhSpscRingGet(r) != (Packet *)i)
+            goto end;
+    }
+    if (!TmqhSpscRingIsEmpty(r))
+        goto end;
+
+    /* a full ring doesn't hold up a thread that is killed */
+    for (i = 1; i <= TMQH_SPSC_RING_SIZE; i++)
+        TmqhSpscRingPut(&tv, r, (Packet *)i);
+    TmThreadsSetFlag(&tv, THV_KILL);
+    if (TmqhSpscRingPut(&tv, r, (Packet *)i) != -1) {
+        printf("packet added to a full ring: ");
+        goto end;
+    }
+    if (TmqhSpscRingGet(r) != (Packet *)1)
+        goto end;
+    if (TmqhSpscRingPut(&tv, r, (Packet *)i) != 0) {
+        printf("packet not added after making room: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    SCFreeAligned(r);
+    return result;
+}
+
+/** \test two producers to one queue, flows stick to their queue and the
+ *        queue latency of a sampled packet is accounted */
+static int TmqhSpscTest02(void)
+{
+    int result = 0;
+    ThreadVars tv1, tv2, tv3;
+    Flow f;
+    Packet *p = SCMalloc(SIZE_OF_PACKET * 3);
+    if (p == NULL)
+        return 0;
+    memset(p, 0, SIZE_OF_PACKET * 3);
+    Packet *p1 = p;
+    Packet *p2 = (Packet *)((uint8_t *)p + SIZE_OF_PACKET);
+    Packet *p3 = (Packet *)((uint8_t *)p + 2 * SIZE_OF_PACKET);
+
+    memset(&tv1, 0, sizeof(tv1));
+    memset(&tv2, 0, sizeof(tv2));
+    memset(&tv3, 0, sizeof(tv3));
+    memset(&f, 0, sizeof(f));
+    SC_ATOMIC_INIT(f.autofp_tmqh_flow_qid);
+    SC_ATOMIC_SET(f.autofp_tmqh_flow_qid, -1);
+
+    TmqResetQueues();
+    TmqhSpscDestroy();
+
+    tv1.outctx = TmqhOutputSpscSetupCtx("spsc1,spsc2");
+    tv2.outctx = TmqhOutputSpscSetupCtx("spsc1,spsc2");
+    if (tv1.outctx == NULL || tv2.outctx == NULL)
+        goto end;
+    tv3.inq = TmqGetQueueByName("spsc1");
+    if (tv3.inq == NULL)
+        goto end;
+    trans_q[tv3.inq->id].len = 0;
+    trans_q[TmqGetQueueByName("spsc2")->id].len = 0;
+
+    /* sample the first packet tv1 puts on the queue */
+    tv1.lat_queue_countdown = 1;
+    tv3.lat_queue = LatencyHistNew();
+    if (tv3.lat_queue == NULL)
+        goto end;
+
+    /* both queues empty, so the flow goes to the first */
+    p1->flow = &f;
+    p2->flow = &f;
+    TmqhOutputSpsc(&tv1, p1);
+    TmqhOutputSpsc(&tv2, p2);
+    TmqhOutputSpsc(&tv1, p3);
+
+    if (SC_ATOMIC_GET(f.autofp_tmqh_flow_qid) != 0) {
+        printf("flow not on queue 0: ");
+        goto end;
+    }
+    /* the flowless packet is round robin'd to the first queue too */
+    if (trans_q[tv3.inq->id].len != 3) {
+        printf("spsc1 len %u, expected 3: ", trans_q[tv3.inq->id].len);
+        goto end;
+    }
+
+    /* the rings are taken from in turn, each in order */
+    Packet *g[3];
+    g[0] = TmqhInputSpsc(&tv3);
+    g[1] = TmqhInputSpsc(&tv3);
+    g[2] = TmqhInputSpsc(&tv3);
+    if (!((g[0] == p1 && g[1] == p3 && g[2] == p2) ||
+          (g[0] == p1 && g[1] == p2 && g[2] == p3) ||
+          (g[0] == p2 && g[1] == p1 && g[2] == p3))) {
+        printf("didn't get p1, p2 and p3 back in order: ");
+        goto end;
+    }
+    if (tv3.lat_queue->count != 1 || p1->queue_ticks != 0) {
+        printf("sampled packet not accounted, %"PRIu64" samples: ",
+                tv3.lat_queue->count);
+        goto end;
+    }
+
+    result = 1;
+end:
+    if (tv1.outctx != NULL)
+        TmqhOutputSpscFreeCtx(tv1.outctx);
+    if (tv2.outctx != NULL)
+        TmqhOutputSpscFreeCtx(tv2.outctx);
+    LatencyHistFree(tv3.lat_queue);
+    TmqhSpscDestroy();
+    TmqResetQueues();
+    SC_ATOMIC_DESTROY(f.autofp_tmqh_flow_qid);
+    SCFree(p);
+    return result;
+}
+
+/** \test a batch put adds to the len of each queue once and keeps the
+ *        order of the packets on a queue */
+static int TmqhSpscTest03(void)
+{
+    int result = 0;
+    ThreadVars tv1, tv2;
+    Flow f1, f2;
+    Packet *p = SCMalloc(SIZE_OF_PACKET * 4);
+    if (p == NULL)
+        return 0;
+    memset(p, 0, SIZE_OF_PACKET * 4);
+    Packet *pkts[4];
+    int i;
+    for (i = 0; i < 4; i++)
+        pkts[i] = (Packet *)((uint8_t *)p + i * SIZE_OF_PACKET);
+
+    memset(&tv1, 0, sizeof(tv1));
+    memset(&tv2, 0, sizeof(tv2));
+    memset(&f1, 0, sizeof(f1));
+    memset(&f2, 0, sizeof(f2));
+    SC_ATOMIC_INIT(f1.autofp_tmqh_flow_qid);
+    SC_ATOMIC_INIT(f2.autofp_tmqh_flow_qid);
+    SC_ATOMIC_SET(f1.autofp_tmqh_flow_qid, 0);
+    SC_ATOMIC_SET(f2.autofp_tmqh_flow_qid, 1);
+
+    TmqResetQueues();
+    TmqhSpscDestroy();
+
+    tv1.outctx = TmqhOutputSpscSetupCtx("spsc1,spsc2");
+    if (tv1.outctx == NULL)
+        goto end;
+    tv2.inq = TmqGetQueueByName("spsc2");
+    if (tv2.inq == NULL)
+        goto end;
+    PacketQueue *q1 = &trans_q[TmqGetQueueByName("spsc1")->id];
+    PacketQueue *q2 = &trans_q[tv2.inq->id];
+    q1->len = 0;
+    q2->len = 0;
+
+    pkts[0]->flow = &f1;
+    pkts[1]->flow = &f2;
+    pkts[2]->flow = &f2;
+    pkts[3]->flow = &f1;
+    TmqhOutputSpscBatch(&tv1, pkts, 4);
+
+    if (q1->len != 2 || q2->len != 2) {
+        printf("len %u and %u, expected 2 and 2: ", q1->len, q2->len);
+        goto end;
+    }
+    TmqhSpscCtx *ctx = (TmqhSpscCtx *)tv1.outctx;
+    if (ctx->pending[0] != 0 || ctx->pending[1] != 0) {
+        printf("counts left pending: ");
+        goto end;
+    }
+    if (TmqhInputSpsc(&tv2) != pkts[1] || TmqhInputSpsc(&tv2) != pkts[2]) {
+        printf("didn't get the packets of spsc2 back in order: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    if (tv1.outctx != NULL)
+        TmqhOutputSpscFreeCtx(tv1.outctx);
+    TmqhSpscDestroy();
+    TmqResetQueues();
+    SC_ATOMIC_DESTROY(f1.autofp_tmqh_flow_qid);
+    SC_ATOMIC_DESTROY(f2.autofp_tmqh_flow_qid);
+    SCFree(p);
+    return result;
+}
+
+#endif /* UNITTESTS */
+
+void TmqhSpscRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("TmqhSpscTest01", TmqhSpscTest01, 1);
+    UtRegisterTest("TmqhSpscTest02", TmqhSpscTest02, 1);
+    UtRegisterTest("TmqhSpscTest03", TmqhSpscTest03, 1);
+#endif /* UNITTESTS */
+}
@@ -0,0 +1,68 @@
+/* Copyright (C) 2007-2013 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ */
+
+#ifndef __TMQH_SPSC_H__
+#define __TMQH_SPSC_H__
+
+/** number of packets per ring, must be a power of 2 */
+#define TMQH_SPSC_RING_SIZE     1024
+/** max packets taken from a ring before moving on to the next one */
+#define TMQH_SPSC_BATCH         32
+
+/** \brief bounded single producer, single consumer ring
+ *
+ *  The producer and consumer indexes live on their own cache lines. Each
+ *  side keeps a cached copy of the other side's index, so the shared
+ *  line is only read when the ring looks full (producer) or empty
+ *  (consumer). */
+typedef struct TmqhSpscRing_ {
+    /* producer */
+    volatile uint32_t write;
+    uint32_t read_cache;
+    uint8_t pad0[64 - 2 * sizeof(uint32_t)];
+
+    /* consumer */
+    volatile uint32_t read;
+    uint32_t write_cache;
+    struct TmqhSpscRing_ *next;     /**< next ring feeding the same queue */
+    uint8_t pad1[64 - 2 * sizeof(uint32_t) - sizeof(void *)];
+
+    Packet *array[TMQH_SPSC_RING_SIZE];
+} __attribute__((aligned(64))) TmqhSpscRing;
+
+/** \brief per producer ctx: one ring to each of the output queues */
+typedef struct TmqhSpscCtx_ {
+    uint16_t size;
+    uint16_t last;
+    uint16_t round_robin_idx;
+    uint8_t stage;      /**< autofp stage, see TmqhFlowQueuesStage() */
+
+    uint16_t *qids;
+    TmqhSpscRing **rings;
+    /** per queue: packets put in this batch, not yet in its len */
+    uint32_t *pending;
+} TmqhSpscCtx;
+
+void TmqhSpscRegister (void);
+void TmqhSpscDestroy (void);
+void TmqhSpscRegisterTests(void);
+
+#endif /* __TMQH_SPSC_H__ */
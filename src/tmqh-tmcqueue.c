@@ -157,8 +157,6 @@ Packet *TmqhInputTmcQueueMrSw(ThreadVars *t)
     Packet *p = (Packet *)Dequeue(q);
     tmc_spin_queued_mutex_unlock(&q->dequeue_mutex);
 
-    SCPerfSyncCountersIfSignalled(t, 0);
-
     return p;
 }
 
@@ -174,8 +172,6 @@ Packet *TmqhInputTmcQueueSrSw(ThreadVars *t)
 
     Packet *p = (Packet *)Dequeue(q);
 
-    SCPerfSyncCountersIfSignalled(t, 0);
-
     return p;
 }
 
@@ -191,8 +187,6 @@ Packet *TmqhInputTmcQueueSrMw(ThreadVars *t)
 
     Packet *p = (Packet *)Dequeue(q);
 
-    SCPerfSyncCountersIfSignalled(t, 0);
-
     return p;
 }
 
@@ -0,0 +1,356 @@
+/* Copyright (C) 2007-2013 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Wait strategy of the input queue handlers.
+ *
+ * A thread finding its input queue empty spins for a while, then yields
+ * the cpu a few times, then blocks until a packet is queued. How long it
+ * spins and yields is set in threading.wait, the default is to block right
+ * away. The cycles a thread spends busy, spinning (including yields) and
+ * blocked are counted in the wait.* counters of the thread in stats.log.
+ *
+ * On Tilera the producers don't signal the queue condition, so blocking
+ * there means polling the queue with a cycle_pause in between.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "decode.h"
+#include "threads.h"
+#include "threadvars.h"
+#include "conf.h"
+#include "counters.h"
+
+#include "tmqh-wait.h"
+
+#include "util-optimize.h"
+#include "util-unittest.h"
+
+#ifdef __tile__
+#include <arch/cycle.h>
+
+static void
+cycle_pause(unsigned int delay)
+{
+  const unsigned int start = get_cycle_count_low();
+  while (get_cycle_count_low() - start < delay)
+    ;
+}
+#endif
+
+/**
+ *  \brief read the cycle counter
+ *
+ *  Unlike UtilCpuGetTicks this doesn't serialize with cpuid, which would
+ *  be costly in the spin loop and traps in virtual machines. Elsewhere
+ *  the ticks are microseconds.
+ */
+static inline uint64_t TmqhWaitGetTicks(void)
+{
+#if defined(__tile__)
+    return get_cycle_count();
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    uint32_t a, d;
+    __asm__ __volatile__ ("rdtsc" : "=a" (a), "=d" (d));
+    return ((uint64_t)d << 32) | a;
+#else
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return ((uint64_t)now.tv_sec * 1000000) + now.tv_usec;
+#endif
+}
+
+/**
+ *  \brief set up the wait strategy and counters of a thread with an
+ *         input queue, before its modules are initialized
+ */
+void TmqhWaitThreadInit(ThreadVars *tv)
+{
+    TmqhWaitCtx *wc = &tv->wait;
+    intmax_t spin = 0;
+    intmax_t yields = 0;
+
+    memset(wc, 0, sizeof(TmqhWaitCtx));
+
+    if (ConfGetInt("threading.wait.spin-cycles", &spin) == 1) {
+        wc->configured = 1;
+        if (spin < 0) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "invalid value %"PRIdMAX
+                         " for threading.wait.spin-cycles, not spinning", spin);
+            spin = 0;
+        }
+    }
+    if (ConfGetInt("threading.wait.yields", &yields) == 1) {
+        wc->configured = 1;
+        if (yields < 0 || yields > 1000000) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "invalid value %"PRIdMAX
+                         " for threading.wait.yields, not yielding", yields);
+            yields = 0;
+        }
+    }
+    wc->spin_max = (uint64_t)spin;
+    wc->spin_limit = wc->spin_max;
+    wc->yields = (uint32_t)yields;
+
+    wc->counter_busy = SCPerfTVRegisterCounter("wait.busy_cycles", tv,
+                                               SC_PERF_TYPE_UINT64, "NULL");
+    wc->counter_spin = SCPerfTVRegisterCounter("wait.spin_cycles", tv,
+                                               SC_PERF_TYPE_UINT64, "NULL");
+    wc->counter_sleep = SCPerfTVRegisterCounter("wait.sleep_cycles", tv,
+                                                SC_PERF_TYPE_UINT64, "NULL");
+}
+
+/**
+ *  \brief called after the modules of the thread are initialized
+ *
+ *  The modules set up the counter array of the thread, including the
+ *  wait counters. If none of them uses counters, set it up here.
+ */
+void TmqhWaitThreadInitDone(ThreadVars *tv)
+{
+    if (tv->sc_perf_pca == NULL) {
+        tv->sc_perf_pca = SCPerfGetAllCountersArray(tv, &tv->sc_perf_pctx);
+        SCPerfAddToClubbedTMTable(tv->name, &tv->sc_perf_pctx);
+    }
+    tv->wait.wake = TmqhWaitGetTicks();
+}
+
+/**
+ *  \brief set the handler's own defaults, if threading.wait is not set
+ */
+void TmqhWaitSetDefaults(ThreadVars *tv, uint64_t spin_cycles, uint32_t yields)
+{
+    TmqhWaitCtx *wc = &tv->wait;
+
+    if (wc->configured)
+        return;
+    wc->configured = 1;
+    wc->spin_max = spin_cycles;
+    wc->spin_limit = spin_cycles;
+    wc->yields = yields;
+}
+
+/**
+ *  \brief start of a wait, the thread was busy since the last one
+ */
+void TmqhWaitBegin(ThreadVars *tv, TmqhWaitState *ws)
+{
+    TmqhWaitCtx *wc = &tv->wait;
+
+    ws->start = TmqhWaitGetTicks();
+    ws->sleep = 0;
+    ws->yields = 0;
+
+    if (wc->wake != 0 && ws->start > wc->wake) {
+        SCPerfCounterAddUI64(wc->counter_busy, tv->sc_perf_pca,
+                             ws->start - wc->wake);
+    }
+}
+
+/**
+ *  \brief spin or yield once
+ *
+ *  \retval 1 keep checking the queue
+ *  \retval 0 out of spins and yields, block
+ */
+int TmqhWaitSpin(ThreadVars *tv, TmqhWaitState *ws)
+{
+    TmqhWaitCtx *wc = &tv->wait;
+
+    if (wc->spin_limit > 0 && TmqhWaitGetTicks() - ws->start < wc->spin_limit) {
+        TMQH_WAIT_RELAX();
+        return 1;
+    }
+    if (ws->yields < wc->yields) {
+        ws->yields++;
+        sched_yield();
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ *  \brief the thread is about to block, spinning didn't pay off
+ */
+void TmqhWaitSleep(ThreadVars *tv, TmqhWaitState *ws)
+{
+    TmqhWaitCtx *wc = &tv->wait;
+
+    ws->sleep = TmqhWaitGetTicks();
+    SCPerfCounterAddUI64(wc->counter_spin, tv->sc_perf_pca,
+                         ws->sleep - ws->start);
+
+    if (wc->spin_limit / 2 >= wc->spin_max / TMQH_WAIT_SPIN_SHRINK)
+        wc->spin_limit /= 2;
+}
+
+/**
+ *  \brief end of a wait
+ */
+void TmqhWaitEnd(ThreadVars *tv, TmqhWaitState *ws)
+{
+    TmqhWaitCtx *wc = &tv->wait;
+    uint64_t now = TmqhWaitGetTicks();
+
+    if (ws->sleep != 0) {
+        SCPerfCounterAddUI64(wc->counter_sleep, tv->sc_perf_pca,
+                             now - ws->sleep);
+    } else {
+        SCPerfCounterAddUI64(wc->counter_spin, tv->sc_perf_pca,
+                             now - ws->start);
+        /* spinning paid off, allow a bit more next time */
+        if (wc->spin_limit < wc->spin_max) {
+            wc->spin_limit *= 2;
+            if (wc->spin_limit > wc->spin_max || wc->spin_limit == 0)
+                wc->spin_limit = wc->spin_max;
+        }
+    }
+    wc->wake = now;
+}
+
+/**
+ *  \brief count the busy cycles of a thread that didn't wait for a while
+ */
+void TmqhWaitBusySample(ThreadVars *tv)
+{
+    TmqhWaitCtx *wc = &tv->wait;
+    uint64_t now = TmqhWaitGetTicks();
+
+    if (wc->wake != 0 && now > wc->wake) {
+        SCPerfCounterAddUI64(wc->counter_busy, tv->sc_perf_pca,
+                             now - wc->wake);
+    }
+    wc->wake = now;
+}
+
+/**
+ *  \brief wait for packets on a queue of the "simple" kind
+ *
+ *  Called with q->mutex_q held and q empty, returns with q->mutex_q held.
+ *  The queue may still be empty on return, on signals.
+ */
+void TmqhWaitOnQueue(ThreadVars *tv, PacketQueue *q)
+{
+    TmqhWaitState ws;
+
+    TmqhWaitBegin(tv, &ws);
+
+    if (tv->wait.spin_max > 0 || tv->wait.yields > 0) {
+        SCMutexUnlock(&q->mutex_q);
+        /* unlocked read, just a hint */
+        while (*(volatile typeof(q->len) *)&q->len == 0) {
+            if (TmqhWaitSpin(tv, &ws) == 0)
+                break;
+        }
+        SCMutexLock(&q->mutex_q);
+    }
+
+    if (q->len == 0) {
+        TmqhWaitSleep(tv, &ws);
+#ifdef __tile__
+        do {
+            SCMutexUnlock(&q->mutex_q);
+            while (q->len == 0 && q->cond_q == 0) {
+                cycle_pause(300);
+            }
+            SCMutexLock(&q->mutex_q);
+        } while (q->len == 0 && q->cond_q == 0);
+#else
+        SCCondWait(&q->cond_q, &q->mutex_q);
+#endif
+    }
+
+    TmqhWaitEnd(tv, &ws);
+}
+
+#ifdef UNITTESTS
+
+/** \test the spin budget shrinks when the thread blocks anyway and grows
+ *        back when spinning pays off */
+static int TmqhWaitTest01(void)
+{
+    ThreadVars tv;
+    TmqhWaitState ws;
+    int i;
+
+    memset(&tv, 0, sizeof(tv));
+    TmqhWaitSetDefaults(&tv, 6400, 0);
+
+    for (i = 0; i < 10; i++) {
+        TmqhWaitBegin(&tv, &ws);
+        TmqhWaitSleep(&tv, &ws);
+        TmqhWaitEnd(&tv, &ws);
+    }
+    if (tv.wait.spin_limit != 6400 / TMQH_WAIT_SPIN_SHRINK) {
+        printf("spin limit %"PRIu64", expected %d: ", tv.wait.spin_limit,
+               6400 / TMQH_WAIT_SPIN_SHRINK);
+        return 0;
+    }
+
+    for (i = 0; i < 10; i++) {
+        TmqhWaitBegin(&tv, &ws);
+        TmqhWaitEnd(&tv, &ws);
+    }
+    if (tv.wait.spin_limit != 6400) {
+        printf("spin limit %"PRIu64", expected 6400: ", tv.wait.spin_limit);
+        return 0;
+    }
+
+    /* defaults don't override the config */
+    TmqhWaitSetDefaults(&tv, 100, 1);
+    if (tv.wait.spin_max != 6400 || tv.wait.yields != 0) {
+        printf("defaults applied twice: ");
+        return 0;
+    }
+    return 1;
+}
+
+/** \test without spin cycles or yields the thread blocks right away */
+static int TmqhWaitTest02(void)
+{
+    ThreadVars tv;
+    TmqhWaitState ws;
+
+    memset(&tv, 0, sizeof(tv));
+    TmqhWaitBegin(&tv, &ws);
+    if (TmqhWaitSpin(&tv, &ws) != 0) {
+        printf("spinning without a budget: ");
+        return 0;
+    }
+
+    TmqhWaitSetDefaults(&tv, 0, 2);
+    TmqhWaitBegin(&tv, &ws);
+    if (TmqhWaitSpin(&tv, &ws) != 1 || TmqhWaitSpin(&tv, &ws) != 1 ||
+        TmqhWaitSpin(&tv, &ws) != 0) {
+        printf("expected 2 yields: ");
+        return 0;
+    }
+    return 1;
+}
+
+#endif /* UNITTESTS */
+
+void TmqhWaitRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("TmqhWaitTest01", TmqhWaitTest01, 1);
+    UtRegisterTest("TmqhWaitTest02", TmqhWaitTest02, 1);
+#endif /* UNITTESTS */
+}
@@ -0,0 +1,89 @@
+/* Copyright (C) 2007-2013 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ */
+
+#ifndef __TMQH_WAIT_H__
+#define __TMQH_WAIT_H__
+
+struct ThreadVars_;
+struct PacketQueue_;
+
+/** a thread that gets its packets without waiting takes the time once
+ *  per this many packets, so its busy cycles show up in the stats. Must
+ *  be a power of 2. */
+#define TMQH_WAIT_BUSY_SAMPLE   64
+
+/** the spin budget doesn't shrink below spin_max / TMQH_WAIT_SPIN_SHRINK */
+#define TMQH_WAIT_SPIN_SHRINK   64
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TMQH_WAIT_RELAX()       __asm__ __volatile__("pause" ::: "memory")
+#else
+#define TMQH_WAIT_RELAX()       cc_barrier()
+#endif
+
+/** \brief per thread wait strategy and idle accounting
+ *
+ *  An idle thread spins for up to spin_limit cycles, then yields the cpu
+ *  up to yields times, then blocks. spin_limit adapts between
+ *  spin_max / TMQH_WAIT_SPIN_SHRINK and spin_max: it is halved when the
+ *  thread had to block anyway and doubled when spinning paid off. */
+typedef struct TmqhWaitCtx_ {
+    uint64_t spin_max;
+    uint64_t spin_limit;
+    uint32_t yields;
+    uint8_t configured;         /**< set from threading.wait */
+
+    uint32_t nowait;            /**< packets taken without waiting */
+    uint64_t wake;              /**< end of the last wait or busy sample */
+
+    uint16_t counter_busy;
+    uint16_t counter_spin;
+    uint16_t counter_sleep;
+} TmqhWaitCtx;
+
+/** \brief state of a single wait */
+typedef struct TmqhWaitState_ {
+    uint64_t start;
+    uint64_t sleep;             /**< when the thread blocked, 0 if it didn't */
+    uint32_t yields;
+} TmqhWaitState;
+
+/** \brief account a packet taken without waiting */
+#define TMQH_WAIT_NOWAIT(tv) do {                                       \
+        if ((++(tv)->wait.nowait & (TMQH_WAIT_BUSY_SAMPLE - 1)) == 0)   \
+            TmqhWaitBusySample((tv));                                   \
+    } while (0)
+
+void TmqhWaitThreadInit(struct ThreadVars_ *);
+void TmqhWaitThreadInitDone(struct ThreadVars_ *);
+void TmqhWaitSetDefaults(struct ThreadVars_ *, uint64_t, uint32_t);
+
+void TmqhWaitBegin(struct ThreadVars_ *, TmqhWaitState *);
+int TmqhWaitSpin(struct ThreadVars_ *, TmqhWaitState *);
+void TmqhWaitSleep(struct ThreadVars_ *, TmqhWaitState *);
+void TmqhWaitEnd(struct ThreadVars_ *, TmqhWaitState *);
+void TmqhWaitBusySample(struct ThreadVars_ *);
+
+void TmqhWaitOnQueue(struct ThreadVars_ *, struct PacketQueue_ *);
+
+void TmqhWaitRegisterTests(void);
+
+#endif /* __TMQH_WAIT_H__ */
@@ -28,6 +28,7 @@
 #include "tm-threads.h"
 #include "runmodes.h"
 #include "conf.h"
+#include "util-latency.h"
 
 #include "util-privs.h"
 #include "util-debug.h"
@@ -852,6 +853,7 @@ void *UnixManagerThread(void *td)
     UnixManagerRegisterCommand("capture-mode", UnixManagerCaptureModeCommand, &command, 0);
     UnixManagerRegisterCommand("conf-get", UnixManagerConfGetCommand, &command, UNIX_CMD_TAKE_ARGS);
     UnixManagerRegisterCommand("dump-counters", SCPerfOutputCounterSocket, NULL, 0);
+    UnixManagerRegisterCommand("dump-latency", LatencyOutputSocket, NULL, 0);
 #if 0
     UnixManagerRegisterCommand("reload-rules", UnixManagerReloadRules, NULL, 0);
 #endif
@@ -870,7 +872,7 @@ void *UnixManagerThread(void *td)
                 close(item->fd);
                 SCFree(item);
             }
-            SCPerfSyncCounters(th_v, 0);
+            SCPerfSyncCounters(th_v);
             break;
         }
 
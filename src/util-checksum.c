@@ -1,4 +1,4 @@
-/* Copyright (C) 2011-2012 Open Information Security Foundation
+/* Copyright (C) 2011-2013 Open Information Security Foundation
  *
  * You can copy, redistribute or modify this Program under the terms of
  * the GNU General Public License version 2 as published by the Free
@@ -25,7 +25,28 @@
 
 #include "suricata-common.h"
 
+#include "decode.h"
 #include "util-checksum.h"
+#include "util-unittest.h"
+
+/** kernel used for buffers of CHECKSUM_KERNEL_MIN_LEN and up, the scalar
+ *  one until ChecksumInit() picked one */
+ChecksumSumFunc checksum_sum = ChecksumSumScalar;
+static const char *checksum_kernel = "scalar";
+
+/**
+ *  \brief select the checksum kernel for this cpu
+ */
+void ChecksumInit(void)
+{
+    checksum_sum = ChecksumSelectKernel(&checksum_kernel);
+    SCLogInfo("using the %s checksum kernel", checksum_kernel);
+}
+
+const char *ChecksumKernelName(void)
+{
+    return checksum_kernel;
+}
 
 int ReCalculateChecksum(Packet *p)
 {
@@ -60,6 +81,57 @@ int ReCalculateChecksum(Packet *p)
     return 0;
 }
 
+/**
+ *  \brief update the TCP or UDP checksum for payload data that is about to
+ *         be overwritten with data of the same length
+ *
+ *  Only done if the checksum of the packet was validated, a packet with a
+ *  bad (or offloaded) checksum has to be recalculated in full.
+ *
+ *  \param p packet
+ *  \param data data in the packet that will be overwritten
+ *  \param new_data data it will be overwritten with
+ *  \param len length of both
+ *
+ *  \retval 0 checksum updated
+ *  \retval -1 not updated, use ReCalculateChecksum()
+ */
+int ChecksumUpdateReplace(Packet *p, const uint8_t *data,
+                          const uint8_t *new_data, uint32_t len)
+{
+    if (p->payload == NULL || data < p->payload ||
+        data + len > p->payload + p->payload_len)
+        return -1;
+
+    if (PKT_IS_TCP(p)) {
+        if (p->tcpvars.comp_csum == -1 ||
+            p->tcpvars.comp_csum != p->tcph->th_sum)
+            return -1;
+
+        p->tcph->th_sum = ChecksumUpdateBuffer(p->tcph->th_sum, data,
+                new_data, len, (uint32_t)(data - (uint8_t *)p->tcph));
+        p->tcpvars.comp_csum = p->tcph->th_sum;
+        return 0;
+    } else if (PKT_IS_UDP(p)) {
+        /* no checksum in use */
+        if (PKT_IS_IPV4(p) && p->udph->uh_sum == 0)
+            return 0;
+        if (p->udpvars.comp_csum == -1 ||
+            p->udpvars.comp_csum != p->udph->uh_sum)
+            return -1;
+
+        uint16_t csum = ChecksumUpdateBuffer(p->udph->uh_sum, data,
+                new_data, len, (uint32_t)(data - (uint8_t *)p->udph));
+        if (csum == 0)
+            csum = 0xFFFF;
+        p->udph->uh_sum = csum;
+        p->udpvars.comp_csum = csum;
+        return 0;
+    }
+
+    return -1;
+}
+
 /**
  *  \brief Check if the number of invalid checksums indicate checksum
  *         offloading in place.
@@ -88,3 +160,131 @@ int ChecksumAutoModeCheck(uint32_t thread_count,
     }
     return 0;
 }
+
+#ifdef UNITTESTS
+
+/** \brief reference sum, one word at a time */
+static uint32_t ChecksumSumRef(const uint8_t *buf, uint32_t len)
+{
+    uint64_t sum = 0;
+    uint32_t u;
+
+    for (u = 0; u + 1 < len; u += 2) {
+        uint16_t w;
+        memcpy(&w, buf + u, sizeof(w));
+        sum += w;
+    }
+    if (len & 1) {
+        uint16_t pad = 0;
+        *(uint8_t *)(&pad) = buf[len - 1];
+        sum += pad;
+    }
+    return ChecksumFold(sum);
+}
+
+/** \test all kernels against the reference, for all lengths up to a few
+ *        vectors and unaligned starts */
+static int ChecksumTest01(void)
+{
+    uint8_t buf[1024 + 4];
+    uint32_t len, off;
+    int i;
+
+    for (i = 0; i < (int)sizeof(buf); i++)
+        buf[i] = (uint8_t)(i * 7 + (i >> 3));
+    /* a run of 0xff to get plenty of carries */
+    memset(buf + 300, 0xff, 400);
+
+    for (off = 0; off < 4; off++) {
+        for (len = 0; len <= 1024; len++) {
+            uint32_t ref = ChecksumSumRef(buf + off, len);
+
+            if (ChecksumSumScalar(buf + off, len) != ref) {
+                printf("scalar len %u off %u: ", len, off);
+                return 0;
+            }
+#ifdef CHECKSUM_HAVE_SSE2
+            if (ChecksumSumSSE2(buf + off, len) != ref) {
+                printf("sse2 len %u off %u: ", len, off);
+                return 0;
+            }
+#endif
+#ifdef CHECKSUM_HAVE_AVX2
+            if (__builtin_cpu_supports("avx2") &&
+                ChecksumSumAVX2(buf + off, len) != ref) {
+                printf("avx2 len %u off %u: ", len, off);
+                return 0;
+            }
+#endif
+            if (ChecksumSum(buf + off, len) != ref) {
+                printf("%s len %u off %u: ", ChecksumKernelName(), len, off);
+                return 0;
+            }
+        }
+    }
+
+    /* all zeros stays 0, all ones is the other zero */
+    memset(buf, 0x00, sizeof(buf));
+    if (ChecksumSum(buf, 1024) != 0)
+        return 0;
+    memset(buf, 0xff, sizeof(buf));
+    if (ChecksumSum(buf, 1024) != 0xFFFF)
+        return 0;
+
+    return 1;
+}
+
+/** \test incremental update matches a full recalculation */
+static int ChecksumTest02(void)
+{
+    uint8_t raw_ipshdr[] = { 0x40, 0x8e, 0x7e, 0xb2, 0xc0, 0xa8, 0x01, 0x03 };
+    uint8_t tcp[20 + 64];
+    uint8_t repl[7] = { 'r', 'e', 'p', 'l', 'a', 'c', 'e' };
+    uint32_t off;
+    int i;
+
+    memset(tcp, 0x00, 20);
+    tcp[12] = 0x50;
+    for (i = 20; i < (int)sizeof(tcp); i++)
+        tcp[i] = (uint8_t)('a' + i % 26);
+
+    uint16_t csum = TCPCalculateChecksum((uint16_t *)raw_ipshdr,
+            (uint16_t *)tcp, sizeof(tcp));
+
+    /* even and odd offsets, odd and even lengths */
+    for (off = 20; off < 28; off++) {
+        uint32_t len = (off & 2) ? sizeof(repl) : sizeof(repl) - 1;
+
+        csum = ChecksumUpdateBuffer(csum, tcp + off, repl, len, off);
+        memcpy(tcp + off, repl, len);
+        repl[0]++;
+
+        uint16_t full = TCPCalculateChecksum((uint16_t *)raw_ipshdr,
+                (uint16_t *)tcp, sizeof(tcp));
+        if (csum != full) {
+            printf("off %u: %04x != %04x: ", off, csum, full);
+            return 0;
+        }
+    }
+
+    /* single word update */
+    uint16_t old_word, new_word = 0x1234;
+    memcpy(&old_word, tcp + 40, 2);
+    csum = ChecksumUpdate16(csum, old_word, new_word);
+    memcpy(tcp + 40, &new_word, 2);
+    if (csum != TCPCalculateChecksum((uint16_t *)raw_ipshdr,
+                (uint16_t *)tcp, sizeof(tcp)))
+        return 0;
+
+    return 1;
+}
+
+#endif /* UNITTESTS */
+
+void UtilChecksumRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("ChecksumTest01", ChecksumTest01, 1);
+    UtRegisterTest("ChecksumTest02", ChecksumTest02, 1);
+#endif /* UNITTESTS */
+}
@@ -1,4 +1,4 @@
-/* Copyright (C) 2011-2012 Open Information Security Foundation
+/* Copyright (C) 2011-2013 Open Information Security Foundation
  *
  * You can copy, redistribute or modify this Program under the terms of
  * the GNU General Public License version 2 as published by the Free
@@ -19,18 +19,261 @@
  * \file
  *
  * \author Eric Leblond <eric@regit.org>
+ *
+ * Ones' complement sum kernels shared by the checksum functions of the
+ * decoders, plus incremental checksum updates (RFC 1624) for packets that
+ * are modified inline.
+ *
+ * The kernels return the sum of the 16 bit words of a buffer, folded to
+ * 16 bits. Words are loaded in host order, like the header fields the
+ * result is compared with. The sum is only 0 if the buffer is all zeros,
+ * so the ~0/0 outcome of a checksum is the same as with a single 32 bit
+ * accumulator.
+ *
+ * There is a scalar, an SSE2 and an AVX2 kernel. The AVX2 one is built
+ * with a target attribute and only used if the cpu supports it, see
+ * ChecksumInit(). Like util-line.h this header only depends on libc, so
+ * it is included by the decoder headers and the benches/ programs.
  */
 
 #ifndef __UTIL_CHECKSUM_H__
 #define __UTIL_CHECKSUM_H__
 
-int ReCalculateChecksum(Packet *p);
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define CHECKSUM_HAVE_SSE2 1
+#endif
+
+#if defined(CHECKSUM_HAVE_SSE2) && !defined(__clang__) && \
+    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#include <immintrin.h>
+#define CHECKSUM_HAVE_AVX2 1
+#endif
+
+/** buffers shorter than this are summed inline, not through the kernel
+ *  picked at runtime */
+#define CHECKSUM_KERNEL_MIN_LEN 64
+
+typedef uint32_t (*ChecksumSumFunc)(const uint8_t *, uint32_t);
+
+/** kernel set up by ChecksumInit() */
+extern ChecksumSumFunc checksum_sum;
+
+struct Packet_;
+
+void ChecksumInit(void);
+const char *ChecksumKernelName(void);
+int ReCalculateChecksum(struct Packet_ *p);
+int ChecksumUpdateReplace(struct Packet_ *p, const uint8_t *,
+                          const uint8_t *, uint32_t);
 int ChecksumAutoModeCheck(uint32_t thread_count,
         unsigned int iface_count, unsigned int iface_fail);
+void UtilChecksumRegisterTests(void);
 
 /* constant linked with detection of interface with
  * invalid checksums */
 #define CHECKSUM_SAMPLE_COUNT 1000
 #define CHECKSUM_INVALID_RATIO 10
 
+/** \brief fold a sum of 16 bit words to 16 bits, keeps 0 only for 0 */
+static inline uint32_t ChecksumFold(uint64_t sum)
+{
+    sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+    sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    return (uint32_t)sum;
+}
+
+/** \brief fold and complement a sum into the checksum value */
+static inline uint16_t ChecksumFinish(uint32_t csum)
+{
+    csum = (csum >> 16) + (csum & 0x0000FFFF);
+    csum += (csum >> 16);
+
+    return (uint16_t)~csum;
+}
+
+/**
+ *  \brief scalar ones' complement sum of a buffer
+ *
+ *  A trailing odd byte is summed as if it's followed by a zero byte.
+ *
+ *  \retval sum folded sum, 0 only if all bytes are 0
+ */
+static inline uint32_t ChecksumSumScalar(const uint8_t *buf, uint32_t len)
+{
+    uint64_t sum = 0;
+
+    while (len >= 16) {
+        uint32_t w[4];
+        memcpy(w, buf, sizeof(w));
+        sum += (uint64_t)w[0] + w[1] + w[2] + w[3];
+        buf += 16;
+        len -= 16;
+    }
+    while (len >= 4) {
+        uint32_t w;
+        memcpy(&w, buf, sizeof(w));
+        sum += w;
+        buf += 4;
+        len -= 4;
+    }
+    if (len >= 2) {
+        uint16_t w;
+        memcpy(&w, buf, sizeof(w));
+        sum += w;
+        buf += 2;
+        len -= 2;
+    }
+    if (len == 1) {
+        uint16_t pad = 0;
+        *(uint8_t *)(&pad) = *buf;
+        sum += pad;
+    }
+
+    return ChecksumFold(sum);
+}
+
+#ifdef CHECKSUM_HAVE_SSE2
+/**
+ *  \brief SSE2 ones' complement sum of a buffer
+ *
+ *  32 bit words are widened to 64 bit lanes, so the lanes, and their sum,
+ *  can't overflow for any buffer size that fits an uint32_t.
+ */
+static inline uint32_t ChecksumSumSSE2(const uint8_t *buf, uint32_t len)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc0 = zero;
+    __m128i acc1 = zero;
+    uint64_t lanes[2];
+
+    while (len >= 32) {
+        __m128i a = _mm_loadu_si128((const __m128i *)buf);
+        __m128i b = _mm_loadu_si128((const __m128i *)(buf + 16));
+        acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(a, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(a, zero));
+        acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(b, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(b, zero));
+        buf += 32;
+        len -= 32;
+    }
+    acc0 = _mm_add_epi64(acc0, acc1);
+    _mm_storeu_si128((__m128i *)lanes, acc0);
+
+    return ChecksumFold(lanes[0] + lanes[1] + ChecksumSumScalar(buf, len));
+}
+#endif /* CHECKSUM_HAVE_SSE2 */
+
+#ifdef CHECKSUM_HAVE_AVX2
+/** \brief AVX2 ones' complement sum of a buffer, see ChecksumSumSSE2 */
+__attribute__((target("avx2")))
+static inline uint32_t ChecksumSumAVX2(const uint8_t *buf, uint32_t len)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc0 = zero;
+    __m256i acc1 = zero;
+    uint64_t lanes[4];
+
+    while (len >= 64) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)buf);
+        __m256i b = _mm256_loadu_si256((const __m256i *)(buf + 32));
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(a, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(a, zero));
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(b, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(b, zero));
+        buf += 64;
+        len -= 64;
+    }
+    acc0 = _mm256_add_epi64(acc0, acc1);
+    _mm256_storeu_si256((__m256i *)lanes, acc0);
+
+    return ChecksumFold(lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+                        ChecksumSumScalar(buf, len));
+}
+#endif /* CHECKSUM_HAVE_AVX2 */
+
+/**
+ *  \brief pick the fastest kernel the cpu supports
+ *
+ *  \param name set to the name of the kernel
+ */
+static inline ChecksumSumFunc ChecksumSelectKernel(const char **name)
+{
+#ifdef CHECKSUM_HAVE_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        *name = "avx2";
+        return ChecksumSumAVX2;
+    }
+#endif
+#ifdef CHECKSUM_HAVE_SSE2
+    *name = "sse2";
+    return ChecksumSumSSE2;
+#else
+    *name = "scalar";
+    return ChecksumSumScalar;
 #endif
+}
+
+/**
+ *  \brief ones' complement sum of a buffer
+ *
+ *  \retval sum folded sum, 0 only if all bytes are 0
+ */
+static inline uint32_t ChecksumSum(const uint8_t *buf, uint32_t len)
+{
+    if (len < CHECKSUM_KERNEL_MIN_LEN)
+        return ChecksumSumScalar(buf, len);
+    return checksum_sum(buf, len);
+}
+
+/**
+ *  \brief update a checksum for a changed 16 bit word (RFC 1624, eqn. 3)
+ *
+ *  \param csum checksum as stored in the header
+ *  \param old_word the word as it was
+ *  \param new_word the word as it is now
+ *
+ *  \retval csum the new checksum
+ */
+static inline uint16_t ChecksumUpdate16(uint16_t csum, uint16_t old_word,
+                                        uint16_t new_word)
+{
+    uint32_t sum = (uint16_t)~csum + (uint16_t)~old_word + new_word;
+
+    return ChecksumFinish(sum);
+}
+
+/**
+ *  \brief update a checksum for data that is overwritten in place
+ *
+ *  Call before the data is overwritten.
+ *
+ *  \param csum checksum as stored in the header
+ *  \param old_data data as it is in the packet now
+ *  \param new_data data it will be replaced with
+ *  \param len length of both
+ *  \param offset offset of the data from the start of the checksummed
+ *                header, only its parity matters
+ *
+ *  \retval csum the new checksum
+ */
+static inline uint16_t ChecksumUpdateBuffer(uint16_t csum,
+        const uint8_t *old_data, const uint8_t *new_data, uint32_t len,
+        uint32_t offset)
+{
+    uint32_t old_sum = ChecksumSum(old_data, len);
+    uint32_t new_sum = ChecksumSum(new_data, len);
+
+    if (offset & 1) {
+        /* the bytes are in the other half of the words of the packet */
+        old_sum = ((old_sum & 0xFF) << 8) | (old_sum >> 8);
+        new_sum = ((new_sum & 0xFF) << 8) | (new_sum >> 8);
+    }
+
+    return ChecksumUpdate16(csum, (uint16_t)old_sum, (uint16_t)new_sum);
+}
+
+#endif /* __UTIL_CHECKSUM_H__ */
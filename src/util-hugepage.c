@@ -0,0 +1,455 @@
+/* Copyright (C) 2007-2013 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Hugepage backed memory for the big preallocated structures: the packet
+ * pool, the flow hash, the preallocated flows and the segment payloads.
+ *
+ * With 4k pages a 64k packet pool or a few million flows touch so many
+ * pages that TLB misses show up in the profiles. Two modes are supported:
+ *
+ * - "explicit": mmap with MAP_HUGETLB, from the pages reserved in
+ *   /proc/sys/vm/nr_hugepages (2mb) or at boot (1gb).
+ * - "transparent": a 2mb aligned anonymous mapping that is marked with
+ *   madvise(MADV_HUGEPAGE), so the kernel backs it by transparent
+ *   hugepages where it can.
+ *
+ * If explicit hugepages can't be had we fall back to transparent ones, and
+ * if that fails too UtilHugepageAlloc returns NULL so the caller uses its
+ * normal allocator. Every allocation is registered, which is used to free
+ * it and for the coverage report at startup.
+ */
+
+#include "suricata-common.h"
+#include "conf.h"
+#include "threads.h"
+#include "util-hugepage.h"
+#include "util-misc.h"
+#include "util-debug.h"
+#include "util-unittest.h"
+
+#include <sys/mman.h>
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT  26
+#endif
+
+/** size transparent mappings are aligned to */
+#define HUGEPAGE_THP_SIZE   (2 * 1024 * 1024)
+
+typedef struct HugepageRegion_ {
+    uint8_t *ptr;
+    /** mapped size */
+    size_t size;
+    /** HUGEPAGE_MODE_* the region is backed by, HUGEPAGE_MODE_NO if
+     *  madvise failed and it's just normal pages */
+    int mode;
+    const char *name;
+} HugepageRegion;
+
+static int hugepage_mode = HUGEPAGE_MODE_NO;
+static uint64_t hugepage_size = HUGEPAGE_THP_SIZE;
+
+static HugepageRegion hugepage_regions[HUGEPAGE_MAX_REGIONS];
+static SCMutex hugepage_mutex;
+static int hugepage_mutex_init = 0;
+
+/** bytes requested while hugepages were enabled */
+static uint64_t hugepage_requested = 0;
+/** bytes we returned in hugepage backed regions */
+static uint64_t hugepage_covered = 0;
+/** explicit hugepages failed once, don't warn again */
+static int hugepage_explicit_failed = 0;
+
+/**
+ *  \brief set up hugepage support from the "hugepages" settings
+ *
+ *  hugepages.mode: "no" (default), "transparent" or "explicit"
+ *  hugepages.page-size: "2mb" (default) or "1gb", explicit mode only
+ */
+void UtilHugepageInit(void)
+{
+    char *mode = NULL;
+    char *size = NULL;
+
+    if (hugepage_mutex_init == 0) {
+        SCMutexInit(&hugepage_mutex, NULL);
+        hugepage_mutex_init = 1;
+    }
+
+    hugepage_mode = HUGEPAGE_MODE_NO;
+    hugepage_size = HUGEPAGE_THP_SIZE;
+    hugepage_requested = 0;
+    hugepage_covered = 0;
+    hugepage_explicit_failed = 0;
+
+    if (ConfGet("hugepages.mode", &mode) != 1 || mode == NULL)
+        return;
+
+    if (strcmp(mode, "no") == 0 || strcmp(mode, "false") == 0) {
+        return;
+    } else if (strcmp(mode, "transparent") == 0) {
+        hugepage_mode = HUGEPAGE_MODE_TRANSPARENT;
+    } else if (strcmp(mode, "explicit") == 0) {
+        hugepage_mode = HUGEPAGE_MODE_EXPLICIT;
+    } else {
+        SCLogWarning(SC_ERR_INVALID_VALUE, "invalid hugepages.mode \"%s\", "
+                "hugepages disabled", mode);
+        return;
+    }
+
+#ifndef MADV_HUGEPAGE
+    if (hugepage_mode == HUGEPAGE_MODE_TRANSPARENT) {
+        SCLogWarning(SC_ERR_INVALID_VALUE, "transparent hugepages not "
+                "supported on this system, hugepages disabled");
+        hugepage_mode = HUGEPAGE_MODE_NO;
+        return;
+    }
+#endif
+#ifndef MAP_HUGETLB
+    if (hugepage_mode == HUGEPAGE_MODE_EXPLICIT) {
+        SCLogWarning(SC_ERR_INVALID_VALUE, "explicit hugepages not supported "
+                "on this system, using transparent hugepages");
+        hugepage_mode = HUGEPAGE_MODE_TRANSPARENT;
+    }
+#endif
+
+    if (hugepage_mode == HUGEPAGE_MODE_EXPLICIT &&
+        ConfGet("hugepages.page-size", &size) == 1 && size != NULL)
+    {
+        uint64_t s = 0;
+        if (ParseSizeStringU64(size, &s) < 0 ||
+            (s != 2 * 1024 * 1024 && s != 1024 * 1024 * 1024))
+        {
+            SCLogWarning(SC_ERR_INVALID_VALUE, "invalid hugepages.page-size "
+                    "\"%s\", only 2mb and 1gb are supported. Using 2mb", size);
+        } else {
+            hugepage_size = s;
+        }
+    }
+
+    SCLogInfo("hugepage backed memory: %s, page size %"PRIu64"kb",
+            hugepage_mode == HUGEPAGE_MODE_EXPLICIT ? "explicit" : "transparent",
+            hugepage_mode == HUGEPAGE_MODE_EXPLICIT ? hugepage_size / 1024 :
+            (uint64_t)HUGEPAGE_THP_SIZE / 1024);
+}
+
+/** \retval 1 if allocations may be backed by hugepages */
+int UtilHugepageEnabled(void)
+{
+    return (hugepage_mode != HUGEPAGE_MODE_NO);
+}
+
+int UtilHugepageMode(void)
+{
+    return hugepage_mode;
+}
+
+static size_t HugepageRoundUp(size_t size, size_t page)
+{
+    return (size + page - 1) & ~(page - 1);
+}
+
+#ifdef MAP_HUGETLB
+static void *HugepageMapExplicit(size_t size)
+{
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB;
+    int shift = (hugepage_size == 1024 * 1024 * 1024) ? 30 : 21;
+    flags |= shift << MAP_HUGE_SHIFT;
+
+    void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (ptr == MAP_FAILED)
+        return NULL;
+    return ptr;
+}
+#endif
+
+/** \brief map a 2mb aligned region and ask for transparent hugepages
+ *  \param hinted set to 1 if the kernel accepted the madvise */
+static void *HugepageMapTransparent(size_t size, int *hinted)
+{
+    *hinted = 0;
+
+    /* map an extra page, so we can cut the region to a 2mb boundary */
+    size_t map_size = size + HUGEPAGE_THP_SIZE;
+    uint8_t *map = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    uint8_t *ptr = (uint8_t *)HugepageRoundUp((size_t)map, HUGEPAGE_THP_SIZE);
+    size_t head = ptr - map;
+    size_t tail = map_size - head - size;
+    if (head > 0)
+        munmap(map, head);
+    if (tail > 0)
+        munmap(ptr + size, tail);
+
+#ifdef MADV_HUGEPAGE
+    if (madvise(ptr, size, MADV_HUGEPAGE) == 0)
+        *hinted = 1;
+#endif
+    return ptr;
+}
+
+/**
+ *  \brief allocate a hugepage backed region
+ *
+ *  The memory is zeroed and page aligned, but not touched yet, so the
+ *  caller can still set a NUMA policy on it before use.
+ *
+ *  \param size size of the region
+ *  \param name name of the region for the report
+ *
+ *  \retval ptr region, free with UtilHugepageFree
+ *  \retval NULL hugepages disabled or unavailable, use the normal allocator
+ */
+void *UtilHugepageAlloc(size_t size, const char *name)
+{
+    void *ptr = NULL;
+    size_t map_size = 0;
+    int mode = HUGEPAGE_MODE_NO;
+    int i;
+
+    if (hugepage_mode == HUGEPAGE_MODE_NO || size == 0)
+        return NULL;
+
+    SCMutexLock(&hugepage_mutex);
+    hugepage_requested += size;
+
+    if (size < HUGEPAGE_MIN_SIZE)
+        goto end;
+
+    for (i = 0; i < HUGEPAGE_MAX_REGIONS; i++) {
+        if (hugepage_regions[i].ptr == NULL)
+            break;
+    }
+    if (i == HUGEPAGE_MAX_REGIONS) {
+        SCLogWarning(SC_ERR_MEM_ALLOC, "too many hugepage regions, \"%s\" "
+                "uses normal pages", name);
+        goto end;
+    }
+
+#ifdef MAP_HUGETLB
+    if (hugepage_mode == HUGEPAGE_MODE_EXPLICIT && !hugepage_explicit_failed) {
+        map_size = HugepageRoundUp(size, (size_t)hugepage_size);
+        ptr = HugepageMapExplicit(map_size);
+        if (ptr != NULL) {
+            mode = HUGEPAGE_MODE_EXPLICIT;
+        } else {
+            SCLogWarning(SC_ERR_MEM_ALLOC, "no %"PRIu64"kb hugepages left for "
+                    "\"%s\" (%"PRIuMAX" bytes): %s. Reserve more hugepages, "
+                    "using transparent hugepages for now", hugepage_size / 1024,
+                    name, (uintmax_t)map_size, strerror(errno));
+            hugepage_explicit_failed = 1;
+        }
+    }
+#endif
+    if (ptr == NULL) {
+        int hinted = 0;
+        map_size = HugepageRoundUp(size, HUGEPAGE_THP_SIZE);
+        ptr = HugepageMapTransparent(map_size, &hinted);
+        if (ptr == NULL) {
+            SCLogWarning(SC_ERR_MEM_ALLOC, "mapping %"PRIuMAX" bytes for \"%s\" "
+                    "failed: %s", (uintmax_t)map_size, name, strerror(errno));
+            goto end;
+        }
+        if (hinted)
+            mode = HUGEPAGE_MODE_TRANSPARENT;
+    }
+
+    hugepage_regions[i].ptr = ptr;
+    hugepage_regions[i].size = map_size;
+    hugepage_regions[i].mode = mode;
+    hugepage_regions[i].name = name;
+    if (mode != HUGEPAGE_MODE_NO)
+        hugepage_covered += size;
+
+    SCLogDebug("region \"%s\" %p size %"PRIuMAX" mode %d", name, ptr,
+            (uintmax_t)map_size, mode);
+end:
+    SCMutexUnlock(&hugepage_mutex);
+    return ptr;
+}
+
+/**
+ *  \brief free a region from UtilHugepageAlloc
+ *
+ *  \retval 1 freed
+ *  \retval 0 ptr is not a hugepage region
+ */
+int UtilHugepageFree(void *ptr)
+{
+    int i;
+
+    if (ptr == NULL || hugepage_mutex_init == 0)
+        return 0;
+
+    SCMutexLock(&hugepage_mutex);
+    for (i = 0; i < HUGEPAGE_MAX_REGIONS; i++) {
+        if (hugepage_regions[i].ptr == ptr) {
+            munmap(hugepage_regions[i].ptr, hugepage_regions[i].size);
+            memset(&hugepage_regions[i], 0x00, sizeof(HugepageRegion));
+            SCMutexUnlock(&hugepage_mutex);
+            return 1;
+        }
+    }
+    SCMutexUnlock(&hugepage_mutex);
+    return 0;
+}
+
+/** \retval 1 if ptr is in a region from UtilHugepageAlloc */
+int UtilHugepageContains(const void *ptr)
+{
+    const uint8_t *p = (const uint8_t *)ptr;
+    int i;
+
+    if (ptr == NULL || hugepage_mutex_init == 0)
+        return 0;
+
+    SCMutexLock(&hugepage_mutex);
+    for (i = 0; i < HUGEPAGE_MAX_REGIONS; i++) {
+        if (hugepage_regions[i].ptr != NULL && p >= hugepage_regions[i].ptr &&
+            p < hugepage_regions[i].ptr + hugepage_regions[i].size)
+        {
+            SCMutexUnlock(&hugepage_mutex);
+            return 1;
+        }
+    }
+    SCMutexUnlock(&hugepage_mutex);
+    return 0;
+}
+
+/**
+ *  \brief log the hugepage backed regions and the coverage
+ *
+ *  Called once all threads are initialized, so the per node pools that are
+ *  set up by the threads themselves are included.
+ */
+void UtilHugepageReport(void)
+{
+    int i;
+
+    if (hugepage_mode == HUGEPAGE_MODE_NO)
+        return;
+
+    SCMutexLock(&hugepage_mutex);
+    for (i = 0; i < HUGEPAGE_MAX_REGIONS; i++) {
+        if (hugepage_regions[i].ptr == NULL)
+            continue;
+
+        SCLogInfo("hugepage region \"%s\": %"PRIuMAX" bytes, %s",
+                hugepage_regions[i].name, (uintmax_t)hugepage_regions[i].size,
+                hugepage_regions[i].mode == HUGEPAGE_MODE_EXPLICIT ? "explicit" :
+                hugepage_regions[i].mode == HUGEPAGE_MODE_TRANSPARENT ?
+                "transparent" : "normal pages");
+    }
+
+    SCLogInfo("hugepage coverage: %"PRIu64" of %"PRIu64" bytes (%.1f%%)",
+            hugepage_covered, hugepage_requested, hugepage_requested ?
+            (double)hugepage_covered * 100.0 / (double)hugepage_requested : 0.0);
+    SCMutexUnlock(&hugepage_mutex);
+}
+
+#ifdef UNITTESTS
+
+/** \test disabled by default, the caller falls back */
+static int UtilHugepageTest01(void)
+{
+    ConfCreateContextBackup();
+    ConfInit();
+
+    UtilHugepageInit();
+
+    int result = (UtilHugepageEnabled() == 0 &&
+                  UtilHugepageAlloc(4 * 1024 * 1024, "test") == NULL);
+
+    ConfDeInit();
+    ConfRestoreContextBackup();
+    return result;
+}
+
+/** \test transparent region is aligned, zeroed, tracked and freed */
+static int UtilHugepageTest02(void)
+{
+    int result = 0;
+    size_t size = 3 * 1024 * 1024;
+    uint8_t *ptr = NULL;
+    size_t u;
+
+    ConfCreateContextBackup();
+    ConfInit();
+    ConfSet("hugepages.mode", "transparent", 1);
+
+    UtilHugepageInit();
+    if (!UtilHugepageEnabled()) {
+        /* no MADV_HUGEPAGE on this system */
+        result = 1;
+        goto end;
+    }
+
+    ptr = UtilHugepageAlloc(size, "test");
+    if (ptr == NULL)
+        goto end;
+    if (((uintptr_t)ptr & (HUGEPAGE_THP_SIZE - 1)) != 0) {
+        printf("not 2mb aligned: ");
+        goto end;
+    }
+    for (u = 0; u < size; u += 4096) {
+        if (ptr[u] != 0) {
+            printf("not zeroed at %"PRIuMAX": ", (uintmax_t)u);
+            goto end;
+        }
+    }
+    if (!UtilHugepageContains(ptr + size - 1) ||
+        UtilHugepageContains(ptr + 4 * 1024 * 1024))
+    {
+        printf("region lookup failed: ");
+        goto end;
+    }
+
+    /* too small to back by hugepages */
+    if (UtilHugepageAlloc(4096, "small") != NULL)
+        goto end;
+
+    if (UtilHugepageFree(ptr) != 1)
+        goto end;
+    if (UtilHugepageContains(ptr) || UtilHugepageFree(ptr) != 0)
+        goto end;
+    ptr = NULL;
+
+    result = 1;
+end:
+    if (ptr != NULL)
+        UtilHugepageFree(ptr);
+    ConfDeInit();
+    ConfRestoreContextBackup();
+    UtilHugepageInit();
+    return result;
+}
+
+#endif /* UNITTESTS */
+
+void UtilHugepageRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("UtilHugepageTest01", UtilHugepageTest01, 1);
+    UtRegisterTest("UtilHugepageTest02", UtilHugepageTest02, 1);
+#endif /* UNITTESTS */
+}
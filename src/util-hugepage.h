@@ -0,0 +1,48 @@
+/* Copyright (C) 2007-2013 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ */
+
+#ifndef __UTIL_HUGEPAGE_H__
+#define __UTIL_HUGEPAGE_H__
+
+enum {
+    HUGEPAGE_MODE_NO = 0,
+    HUGEPAGE_MODE_TRANSPARENT,
+    HUGEPAGE_MODE_EXPLICIT,
+};
+
+/** max regions we keep track of */
+#define HUGEPAGE_MAX_REGIONS    64
+
+/** smallest allocation we try to back by hugepages */
+#define HUGEPAGE_MIN_SIZE       (1024 * 1024)
+
+void UtilHugepageInit(void);
+int UtilHugepageEnabled(void);
+int UtilHugepageMode(void);
+
+void *UtilHugepageAlloc(size_t, const char *);
+int UtilHugepageFree(void *);
+int UtilHugepageContains(const void *);
+
+void UtilHugepageReport(void);
+void UtilHugepageRegisterTests(void);
+
+#endif /* __UTIL_HUGEPAGE_H__ */
@@ -0,0 +1,605 @@
+/* Copyright (C) 2007-2013 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Latency histograms of the thread modules and of the autofp queues, see
+ * util-latency.h. This file has the setup and the output: percentiles in
+ * stats.log and the histograms through the dump-latency unix command.
+ */
+
+#include "suricata-common.h"
+#include "threadvars.h"
+#include "tm-threads.h"
+#include "tm-modules.h"
+#include "tm-queues.h"
+#include "conf.h"
+
+#include "util-latency.h"
+#include "util-unittest.h"
+
+/** is latency sampling enabled? */
+int latency_enabled = 0;
+/** time one in this many packets */
+uint32_t latency_sample_rate = LATENCY_DEFAULT_SAMPLE_RATE;
+
+/** cycle counter ticks per microsecond, 0 if unknown */
+static double latency_ticks_per_usec = 0;
+
+/** percentiles in the stats.log output and the dump-latency command */
+static const double latency_percentiles[] = { 50, 90, 99, 99.9 };
+static const char *latency_percentile_names[] = { "p50", "p90", "p99", "p99.9" };
+#define LATENCY_PERCENTILES \
+    (sizeof(latency_percentiles) / sizeof(latency_percentiles[0]))
+
+/**
+ * \brief measure the speed of the cycle counter
+ *
+ * \retval ticks per microsecond
+ */
+static double LatencyCalibrate(void)
+{
+    struct timeval start_tv, end_tv;
+    struct timespec ts = { 0, 10 * 1000 * 1000 };
+
+    gettimeofday(&start_tv, NULL);
+    uint64_t start = LatencyGetTicks();
+    nanosleep(&ts, NULL);
+    uint64_t end = LatencyGetTicks();
+    gettimeofday(&end_tv, NULL);
+
+    double usecs = (end_tv.tv_sec - start_tv.tv_sec) * 1000000.0 +
+                   (end_tv.tv_usec - start_tv.tv_usec);
+    if (usecs <= 0 || end <= start)
+        return 0;
+
+    return (end - start) / usecs;
+}
+
+/**
+ * \brief set up latency sampling from the "latency" config section
+ *
+ * Needs to be called before the threads are created.
+ */
+void LatencyInit(void)
+{
+    int enabled = 0;
+    intmax_t rate = 0;
+
+    /* on unless disabled */
+    if (ConfGetBool("latency.enabled", &enabled) != 1)
+        enabled = 1;
+    latency_enabled = enabled;
+    if (!latency_enabled) {
+        SCLogInfo("latency sampling disabled");
+        return;
+    }
+
+    if (ConfGetInt("latency.sample-rate", &rate) == 1) {
+        if (rate < 1 || rate > UINT32_MAX) {
+            SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "invalid "
+                    "latency.sample-rate %"PRIdMAX", using %u", rate,
+                    LATENCY_DEFAULT_SAMPLE_RATE);
+        } else {
+            latency_sample_rate = (uint32_t)rate;
+        }
+    }
+
+    latency_ticks_per_usec = LatencyCalibrate();
+
+    if (latency_ticks_per_usec <= 0) {
+        SCLogWarning(SC_ERR_INVALID_VALUE, "couldn't calibrate the cycle "
+                "counter, latency values are reported in ticks");
+        SCLogInfo("latency sampling of 1 in %"PRIu32" packets",
+                latency_sample_rate);
+    } else {
+        SCLogInfo("latency sampling of 1 in %"PRIu32" packets, %.0f "
+                "ticks/usec", latency_sample_rate, latency_ticks_per_usec);
+    }
+}
+
+LatencyHist *LatencyHistNew(void)
+{
+    LatencyHist *h = SCMallocAligned(sizeof(LatencyHist), 64);
+    if (unlikely(h == NULL))
+        return NULL;
+    memset(h, 0, sizeof(LatencyHist));
+    h->countdown = latency_sample_rate;
+
+    return h;
+}
+
+void LatencyHistFree(LatencyHist *h)
+{
+    if (h != NULL)
+        SCFreeAligned(h);
+}
+
+/** \brief the value in the middle of a bucket */
+uint64_t LatencyBucketValue(uint32_t idx)
+{
+    if (idx < LATENCY_SUB_BUCKETS)
+        return idx;
+
+    uint32_t msb = idx / LATENCY_SUB_BUCKETS + LATENCY_SUB_BITS - 1;
+    uint32_t sub = idx % LATENCY_SUB_BUCKETS;
+    uint32_t shift = msb - LATENCY_SUB_BITS;
+
+    return ((uint64_t)(LATENCY_SUB_BUCKETS + sub) << shift) +
+           ((1ULL << shift) >> 1);
+}
+
+/**
+ * \brief convert cycle counter ticks to usecs
+ *
+ * If the calibration failed the ticks are returned unchanged, the
+ * outputs say so through LatencyUnit().
+ */
+double LatencyTicksToUsec(uint64_t ticks)
+{
+    if (latency_ticks_per_usec <= 0)
+        return (double)ticks;
+    return ticks / latency_ticks_per_usec;
+}
+
+/**
+ * \brief add a histogram that may be in use to another one
+ *
+ * Copies src first, as the thread owning it may be updating it.
+ */
+static void LatencyHistMerge(LatencyHist *dst, const LatencyHist *src)
+{
+    uint64_t buckets[LATENCY_BUCKETS];
+    uint64_t count, sum, max;
+    uint32_t seq;
+    uint32_t i;
+
+    do {
+        seq = SC_PERF_READ_BEGIN(src->seq);
+        count = SC_PERF_LOAD(src->count);
+        sum = SC_PERF_LOAD(src->sum);
+        max = SC_PERF_LOAD(src->max);
+        for (i = 0; i < LATENCY_BUCKETS; i++)
+            buckets[i] = SC_PERF_LOAD(src->buckets[i]);
+    } while (SC_PERF_READ_RETRY(src->seq, seq));
+
+    dst->count += count;
+    dst->sum += sum;
+    if (max > dst->max)
+        dst->max = max;
+    for (i = 0; i < LATENCY_BUCKETS; i++)
+        dst->buckets[i] += buckets[i];
+}
+
+/**
+ * \brief value at a percentile
+ *
+ * \param h histogram, not in use by another thread, see LatencyHistMerge()
+ * \param pct percentile, 0 - 100
+ *
+ * \retval value in ticks, 0 for an empty histogram
+ */
+uint64_t LatencyHistPercentile(const LatencyHist *h, double pct)
+{
+    uint64_t total = 0;
+    uint64_t seen = 0;
+    uint32_t i;
+
+    for (i = 0; i < LATENCY_BUCKETS; i++)
+        total += h->buckets[i];
+    if (total == 0)
+        return 0;
+
+    uint64_t rank = (uint64_t)((pct / 100.0) * total + 0.5);
+    if (rank < 1)
+        rank = 1;
+    if (rank > total)
+        rank = total;
+
+    for (i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank)
+            break;
+    }
+
+    uint64_t v = LatencyBucketValue(i);
+    /* the middle of the bucket can be above anything we've seen */
+    if (v > h->max)
+        v = h->max;
+    return v;
+}
+
+/** \brief per module and per queue histograms of all threads */
+typedef struct LatencyTotals_ {
+    LatencyHist modules[TMM_SIZE];
+    /** queue histograms by the id of the queue */
+    LatencyHist queues[TMQ_MAX_QUEUES];
+} LatencyTotals;
+
+static LatencyTotals *LatencyGetTotals(void)
+{
+    ThreadVars *tv;
+    TmSlot *s;
+    int i;
+
+    LatencyTotals *t = SCMalloc(sizeof(LatencyTotals));
+    if (unlikely(t == NULL))
+        return NULL;
+    memset(t, 0, sizeof(LatencyTotals));
+
+    SCMutexLock(&tv_root_lock);
+    for (i = 0; i < TVT_MAX; i++) {
+        for (tv = tv_root[i]; tv != NULL; tv = tv->next) {
+            for (s = tv->tm_slots; s != NULL; s = s->slot_next) {
+                if (s->lat != NULL)
+                    LatencyHistMerge(&t->modules[s->tm_id], s->lat);
+            }
+            if (tv->lat_queue != NULL && tv->inq != NULL &&
+                tv->inq->id < TMQ_MAX_QUEUES)
+                LatencyHistMerge(&t->queues[tv->inq->id], tv->lat_queue);
+        }
+    }
+    SCMutexUnlock(&tv_root_lock);
+
+    return t;
+}
+
+static void LatencyOutputStatsHist(FILE *fp, const char *name,
+                                   const LatencyHist *h)
+{
+    uint32_t u;
+
+    if (h->count == 0)
+        return;
+
+    for (u = 0; u < LATENCY_PERCENTILES; u++) {
+        char cname[32];
+        if (latency_ticks_per_usec <= 0)
+            snprintf(cname, sizeof(cname), "latency.%s.ticks",
+                    latency_percentile_names[u]);
+        else
+            snprintf(cname, sizeof(cname), "latency.%s",
+                    latency_percentile_names[u]);
+        fprintf(fp, "%-25s | %-25s | %0.2f\n", cname, name,
+                LatencyTicksToUsec(LatencyHistPercentile(h,
+                        latency_percentiles[u])));
+    }
+    fprintf(fp, "%-25s | %-25s | %0.2f\n", (latency_ticks_per_usec <= 0) ?
+            "latency.max.ticks" : "latency.max", name,
+            LatencyTicksToUsec(h->max));
+}
+
+/**
+ * \brief write the latency percentiles of the modules and queues of all
+ *        threads to the stats file, in usecs
+ *
+ * Without a calibrated cycle counter the values are ticks, and the
+ * names get a ".ticks" suffix.
+ */
+void LatencyOutputStats(FILE *fp)
+{
+    uint32_t u;
+
+    if (!latency_enabled)
+        return;
+
+    LatencyTotals *t = LatencyGetTotals();
+    if (t == NULL)
+        return;
+
+    for (u = 0; u < TMM_SIZE; u++) {
+        if (tmm_modules[u].name != NULL)
+            LatencyOutputStatsHist(fp, tmm_modules[u].name, &t->modules[u]);
+    }
+    for (u = 0; u < TMQ_MAX_QUEUES; u++) {
+        Tmq *q = TmqGetQueueById(u);
+        if (q != NULL)
+            LatencyOutputStatsHist(fp, q->name, &t->queues[u]);
+    }
+    fflush(fp);
+
+    SCFree(t);
+}
+
+#ifdef BUILD_UNIX_SOCKET
+/** \brief unit of the values LatencyTicksToUsec() returns */
+static const char *LatencyUnit(void)
+{
+    return (latency_ticks_per_usec <= 0) ? "ticks" : "usecs";
+}
+
+/**
+ * \brief json object of a histogram, values in the LatencyUnit()
+ */
+static json_t *LatencyHistJson(const LatencyHist *h)
+{
+    uint32_t u;
+
+    json_t *jh = json_object();
+    json_t *jb = json_array();
+    if (jh == NULL || jb == NULL) {
+        if (jh != NULL)
+            json_decref(jh);
+        if (jb != NULL)
+            json_decref(jb);
+        return NULL;
+    }
+
+    json_object_set_new(jh, "samples", json_integer(h->count));
+    json_object_set_new(jh, "mean", json_real(h->count ?
+                LatencyTicksToUsec(h->sum / h->count) : 0));
+    json_object_set_new(jh, "max", json_real(LatencyTicksToUsec(h->max)));
+    for (u = 0; u < LATENCY_PERCENTILES; u++) {
+        json_object_set_new(jh, latency_percentile_names[u],
+                json_real(LatencyTicksToUsec(LatencyHistPercentile(h,
+                            latency_percentiles[u]))));
+    }
+
+    /* the buckets that are in use, as [ value, count ] */
+    for (u = 0; u < LATENCY_BUCKETS; u++) {
+        if (h->buckets[u] == 0)
+            continue;
+        json_t *jv = json_array();
+        if (jv == NULL)
+            continue;
+        json_array_append_new(jv,
+                json_real(LatencyTicksToUsec(LatencyBucketValue(u))));
+        json_array_append_new(jv, json_integer(h->buckets[u]));
+        json_array_append_new(jb, jv);
+    }
+    json_object_set_new(jh, "buckets", jb);
+
+    return jh;
+}
+
+/**
+ * \brief unix socket command dumping the latency histograms
+ *
+ * Has the histograms of every thread by module, and the totals by module
+ * and by queue. Values are in usecs, or in ticks if the cycle counter
+ * couldn't be calibrated, "unit" tells which.
+ */
+TmEcode LatencyOutputSocket(json_t *cmd, json_t *answer, void *data)
+{
+    ThreadVars *tv;
+    TmSlot *s;
+    LatencyHist h;
+    uint32_t u;
+    int i;
+
+    if (!latency_enabled) {
+        json_object_set_new(answer, "message",
+                json_string("latency sampling is disabled"));
+        return TM_ECODE_FAILED;
+    }
+
+    json_t *jdata = json_object();
+    json_t *jthreads = json_object();
+    json_t *jmodules = json_object();
+    json_t *jqueues = json_object();
+    if (jdata == NULL || jthreads == NULL || jmodules == NULL ||
+        jqueues == NULL) {
+        if (jdata != NULL)
+            json_decref(jdata);
+        if (jthreads != NULL)
+            json_decref(jthreads);
+        if (jmodules != NULL)
+            json_decref(jmodules);
+        if (jqueues != NULL)
+            json_decref(jqueues);
+        json_object_set_new(answer, "message",
+                json_string("internal error at json object creation"));
+        return TM_ECODE_FAILED;
+    }
+
+    json_object_set_new(jdata, "sample-rate",
+            json_integer(latency_sample_rate));
+    json_object_set_new(jdata, "ticks-per-usec",
+            json_real(latency_ticks_per_usec));
+    json_object_set_new(jdata, "unit", json_string(LatencyUnit()));
+
+    SCMutexLock(&tv_root_lock);
+    for (i = 0; i < TVT_MAX; i++) {
+        for (tv = tv_root[i]; tv != NULL; tv = tv->next) {
+            json_t *jtv = json_object();
+            int cnt = 0;
+            if (jtv == NULL)
+                continue;
+
+            for (s = tv->tm_slots; s != NULL; s = s->slot_next) {
+                if (s->lat == NULL)
+                    continue;
+                memset(&h, 0, sizeof(h));
+                LatencyHistMerge(&h, s->lat);
+                json_t *jh = LatencyHistJson(&h);
+                if (jh != NULL) {
+                    json_object_set_new(jtv, tmm_modules[s->tm_id].name, jh);
+                    cnt++;
+                }
+            }
+            if (tv->lat_queue != NULL) {
+                memset(&h, 0, sizeof(h));
+                LatencyHistMerge(&h, tv->lat_queue);
+                json_t *jh = LatencyHistJson(&h);
+                if (jh != NULL) {
+                    json_object_set_new(jtv, "queue", jh);
+                    cnt++;
+                }
+            }
+
+            if (cnt > 0)
+                json_object_set_new(jthreads, tv->name, jtv);
+            else
+                json_decref(jtv);
+        }
+    }
+    SCMutexUnlock(&tv_root_lock);
+
+    LatencyTotals *t = LatencyGetTotals();
+    if (t != NULL) {
+        for (u = 0; u < TMM_SIZE; u++) {
+            if (tmm_modules[u].name == NULL || t->modules[u].count == 0)
+                continue;
+            json_t *jh = LatencyHistJson(&t->modules[u]);
+            if (jh != NULL)
+                json_object_set_new(jmodules, tmm_modules[u].name, jh);
+        }
+        for (u = 0; u < TMQ_MAX_QUEUES; u++) {
+            Tmq *q = TmqGetQueueById(u);
+            if (q == NULL || t->queues[u].count == 0)
+                continue;
+            json_t *jh = LatencyHistJson(&t->queues[u]);
+            if (jh != NULL)
+                json_object_set_new(jqueues, q->name, jh);
+        }
+        SCFree(t);
+    }
+
+    json_object_set_new(jdata, "threads", jthreads);
+    json_object_set_new(jdata, "modules", jmodules);
+    json_object_set_new(jdata, "queues", jqueues);
+    json_object_set_new(answer, "message", jdata);
+
+    return TM_ECODE_OK;
+}
+#endif /* BUILD_UNIX_SOCKET */
+
+/*----------------------------------Unit_Tests--------------------------------*/
+
+#ifdef UNITTESTS
+/** \test every value falls in a bucket whose middle is within 1/16 */
+static int LatencyTest01(void)
+{
+    uint64_t v;
+    uint32_t prev = 0;
+
+    for (v = 0; v < (1ULL << 20); v++) {
+        uint32_t idx = LatencyBucketIndex(v);
+        uint64_t mid = LatencyBucketValue(idx);
+
+        if (idx < prev || idx > prev + 1) {
+            printf("index %u after %u for %"PRIu64": ", idx, prev, v);
+            return 0;
+        }
+        prev = idx;
+
+        uint64_t diff = (mid > v) ? mid - v : v - mid;
+        if (diff * LATENCY_SUB_BUCKETS > v) {
+            printf("value %"PRIu64" in bucket %u of %"PRIu64": ", v, idx, mid);
+            return 0;
+        }
+    }
+
+    if (LatencyBucketIndex(1ULL << LATENCY_MAX_BITS) != LATENCY_BUCKETS - 1 ||
+        LatencyBucketIndex(UINT64_MAX) != LATENCY_BUCKETS - 1 ||
+        LatencyBucketIndex((1ULL << LATENCY_MAX_BITS) - 1) !=
+            LATENCY_BUCKETS - 1) {
+        printf("large values not in the last bucket: ");
+        return 0;
+    }
+
+    return 1;
+}
+
+/** \test percentiles of a known distribution */
+static int LatencyTest02(void)
+{
+    LatencyHist h;
+    uint64_t v;
+    int result = 0;
+
+    memset(&h, 0, sizeof(h));
+
+    /* 1000 samples of 100, 1..1000 */
+    for (v = 1; v <= 1000; v++)
+        LatencyHistAdd(&h, v * 100);
+
+    if (h.count != 1000 || h.max != 100000 || h.sum != 50050000) {
+        printf("count %"PRIu64" max %"PRIu64" sum %"PRIu64": ",
+                h.count, h.max, h.sum);
+        goto end;
+    }
+
+    uint64_t p50 = LatencyHistPercentile(&h, 50);
+    uint64_t p99 = LatencyHistPercentile(&h, 99);
+    uint64_t p100 = LatencyHistPercentile(&h, 100);
+
+    if (p50 < 50000 - 50000 / 16 || p50 > 50000 + 50000 / 16) {
+        printf("p50 %"PRIu64": ", p50);
+        goto end;
+    }
+    if (p99 < 99000 - 99000 / 16 || p99 > 99000 + 99000 / 16) {
+        printf("p99 %"PRIu64": ", p99);
+        goto end;
+    }
+    if (p100 != 100000) {
+        printf("p100 %"PRIu64": ", p100);
+        goto end;
+    }
+
+    result = 1;
+end:
+    return result;
+}
+
+/** \test only one in sample-rate starts is timed */
+static int LatencyTest03(void)
+{
+    LatencyHist h;
+    uint32_t saved = latency_sample_rate;
+    int i, sampled = 0;
+
+    memset(&h, 0, sizeof(h));
+    latency_sample_rate = 8;
+    h.countdown = latency_sample_rate;
+
+    for (i = 0; i < 64; i++) {
+        uint64_t ticks = LatencyStart(&h, 1);
+        if (ticks != 0)
+            sampled++;
+        LatencyEnd(&h, ticks, 1);
+    }
+    /* a batch of 16 counts as 16 packets */
+    for (i = 0; i < 4; i++) {
+        uint64_t ticks = LatencyStart(&h, 16);
+        if (ticks != 0)
+            sampled++;
+        LatencyEnd(&h, ticks, 16);
+    }
+
+    latency_sample_rate = saved;
+
+    if (sampled != 8 + 4 || h.count != 8 + 4) {
+        printf("sampled %d, count %"PRIu64": ", sampled, h.count);
+        return 0;
+    }
+    if (LatencyStart(NULL, 1) != 0)
+        return 0;
+
+    return 1;
+}
+#endif /* UNITTESTS */
+
+void LatencyRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("LatencyTest01", LatencyTest01, 1);
+    UtRegisterTest("LatencyTest02", LatencyTest02, 1);
+    UtRegisterTest("LatencyTest03", LatencyTest03, 1);
+#endif /* UNITTESTS */
+}
@@ -0,0 +1,200 @@
+/* Copyright (C) 2007-2013 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Latency histograms of the thread modules and of the autofp queues.
+ *
+ * Unlike packet profiling these are built in. Every slot of a thread has
+ * a histogram of the ticks its module spends on a packet, and threads
+ * reading from a flow queue have one of the ticks packets spend in the
+ * queue. Only one in sample-rate packets is timed.
+ *
+ * The histograms are log-linear: values are counted exactly up to
+ * LATENCY_SUB_BUCKETS, above that every power of two is split in
+ * LATENCY_SUB_BUCKETS buckets, so the error is at most 1/16 of the value.
+ * A histogram is only written by its thread, the output reads it while
+ * it's being updated, like the local perf counters.
+ */
+
+#ifndef __UTIL_LATENCY_H__
+#define __UTIL_LATENCY_H__
+
+#include "counters.h"
+#include "tm-threads-common.h"
+
+#ifdef __tile__
+#include <arch/cycle.h>
+#endif
+
+#define LATENCY_SUB_BITS        4
+#define LATENCY_SUB_BUCKETS     (1 << LATENCY_SUB_BITS)
+/** values of 2^LATENCY_MAX_BITS ticks and more go in the last bucket */
+#define LATENCY_MAX_BITS        40
+#define LATENCY_BUCKETS \
+    ((LATENCY_MAX_BITS - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS)
+
+#define LATENCY_DEFAULT_SAMPLE_RATE 64
+
+typedef struct LatencyHist_ {
+    /** packets to go until the next sample, only used by the owner */
+    uint32_t countdown;
+    /** odd while the owner adds a value, see SC_PERF_WRITE_BEGIN */
+    uint32_t seq;
+
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[LATENCY_BUCKETS];
+} LatencyHist;
+
+/** is latency sampling enabled? */
+extern int latency_enabled;
+extern uint32_t latency_sample_rate;
+
+void LatencyInit(void);
+LatencyHist *LatencyHistNew(void);
+void LatencyHistFree(LatencyHist *);
+uint64_t LatencyHistPercentile(const LatencyHist *, double);
+uint64_t LatencyBucketValue(uint32_t);
+double LatencyTicksToUsec(uint64_t);
+void LatencyOutputStats(FILE *);
+void LatencyRegisterTests(void);
+
+#ifdef BUILD_UNIX_SOCKET
+#include <jansson.h>
+TmEcode LatencyOutputSocket(json_t *, json_t *, void *);
+#endif
+
+/**
+ * \brief read the cycle counter
+ *
+ * Unlike UtilCpuGetTicks() the read isn't serialized with cpuid. That
+ * costs more than most of the modules we time, and a few cycles of
+ * reordering don't matter for a histogram.
+ */
+static inline uint64_t LatencyGetTicks(void)
+{
+#if defined(__tile__)
+    return get_cycle_count();
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    uint32_t a, d;
+    __asm__ __volatile__ ("rdtsc" : "=a" (a), "=d" (d));
+    return ((uint64_t)a) | (((uint64_t)d) << 32);
+#else
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return ((uint64_t)now.tv_sec * 1000000) + now.tv_usec;
+#endif
+}
+
+/** \brief index of the bucket counting value v */
+static inline uint32_t LatencyBucketIndex(uint64_t v)
+{
+    if (v < LATENCY_SUB_BUCKETS)
+        return (uint32_t)v;
+    if (v >> LATENCY_MAX_BITS)
+        return LATENCY_BUCKETS - 1;
+
+    uint32_t msb = 63 - __builtin_clzll(v);
+    uint32_t sub = (uint32_t)(v >> (msb - LATENCY_SUB_BITS)) &
+                   (LATENCY_SUB_BUCKETS - 1);
+
+    return (msb - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS + sub;
+}
+
+/** \brief add a value, only called by the thread owning the histogram */
+static inline void LatencyHistAdd(LatencyHist *h, uint64_t v)
+{
+    uint32_t i = LatencyBucketIndex(v);
+
+    SC_PERF_WRITE_BEGIN(h->seq);
+    SC_PERF_STORE(h->buckets[i], h->buckets[i] + 1);
+    SC_PERF_STORE(h->sum, h->sum + v);
+    if (v > h->max)
+        SC_PERF_STORE(h->max, v);
+    SC_PERF_STORE(h->count, h->count + 1);
+    SC_PERF_WRITE_END(h->seq);
+}
+
+/**
+ * \brief start timing if this packet is sampled
+ *
+ * \param h histogram, may be NULL
+ * \param cnt number of packets handled at once
+ *
+ * \retval ticks start ticks, 0 if not sampled
+ */
+static inline uint64_t LatencyStart(LatencyHist *h, uint32_t cnt)
+{
+    if (h == NULL)
+        return 0;
+    if (h->countdown > cnt) {
+        h->countdown -= cnt;
+        return 0;
+    }
+    h->countdown = latency_sample_rate;
+    return LatencyGetTicks();
+}
+
+/** \brief add the ticks per packet since LatencyStart() */
+static inline void LatencyEnd(LatencyHist *h, uint64_t ticks, uint32_t cnt)
+{
+    if (ticks == 0)
+        return;
+    LatencyHistAdd(h, (LatencyGetTicks() - ticks) / cnt);
+}
+
+#define LATENCY_SLOT_START(s, ticks) \
+    (ticks) = LatencyStart((s)->lat, 1)
+
+#define LATENCY_SLOT_END(s, ticks) \
+    LatencyEnd((s)->lat, (ticks), 1)
+
+#define LATENCY_SLOT_BATCH_START(s, ticks, cnt) \
+    (ticks) = LatencyStart((s)->lat, (cnt))
+
+#define LATENCY_SLOT_BATCH_END(s, ticks, cnt) \
+    LatencyEnd((s)->lat, (ticks), (cnt))
+
+/**
+ * \brief stamp a sampled packet that is put in a flow queue
+ *
+ * The countdown is in the ThreadVars of the thread writing to the queue,
+ * 0 if latency sampling is disabled.
+ */
+#define LATENCY_QUEUE_STAMP(tv, p) do {                         \
+        if ((tv)->lat_queue_countdown != 0) {                   \
+            if (--(tv)->lat_queue_countdown == 0) {             \
+                (tv)->lat_queue_countdown = latency_sample_rate; \
+                (p)->queue_ticks = LatencyGetTicks();           \
+            }                                                   \
+        }                                                       \
+    } while (0)
+
+/** \brief account the time a packet was in the queue, if it's sampled */
+#define LATENCY_QUEUE_TAKE(tv, p) do {                          \
+        if ((p)->queue_ticks != 0) {                            \
+            if ((tv)->lat_queue != NULL)                        \
+                LatencyHistAdd((tv)->lat_queue,                 \
+                        LatencyGetTicks() - (p)->queue_ticks);  \
+            (p)->queue_ticks = 0;                               \
+        }                                                       \
+    } while (0)
+
+#endif /* __UTIL_LATENCY_H__ */
@@ -0,0 +1,213 @@
+/* Copyright (C) 2007-2013 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Line splitting helpers. The scanners are inlined from util-line.h, this
+ * file holds the partial line buffer handling.
+ */
+
+#include "suricata-common.h"
+
+#include "util-line.h"
+#include "util-unittest.h"
+
+/**
+ *  \brief append data to a partial line buffer
+ *
+ *  The buffer grows geometrically so a line that is fragmented over many
+ *  chunks doesn't cause a realloc + copy of the whole line per chunk.
+ *
+ *  \param buf pointer to the buffer, may point to NULL
+ *  \param len pointer to the used length of the buffer
+ *  \param size pointer to the allocated size of the buffer
+ *  \param data data to append
+ *  \param data_len length of data
+ *
+ *  \retval 0 ok
+ *  \retval -1 allocation failure or the line would be longer than
+ *              INT32_MAX, buffer is left untouched
+ */
+int SCLineBufferAppend(uint8_t **buf, int32_t *len, uint32_t *size,
+                       const uint8_t *data, uint32_t data_len)
+{
+    if (*len < 0 || data_len > (uint32_t)(INT32_MAX - *len))
+        return -1;
+
+    uint32_t needed = (uint32_t)*len + data_len;
+
+    if (*buf == NULL || needed > *size) {
+        uint32_t new_size = (*buf == NULL) ? SC_LINE_BUFFER_MIN_SIZE : *size;
+
+        while (new_size < needed) {
+            if (new_size > (UINT32_MAX / 2)) {
+                new_size = needed;
+                break;
+            }
+            new_size *= 2;
+        }
+
+        uint8_t *ptr = SCRealloc(*buf, new_size);
+        if (ptr == NULL)
+            return -1;
+
+        *buf = ptr;
+        *size = new_size;
+    }
+
+    memcpy(*buf + *len, data, data_len);
+    *len += data_len;
+    return 0;
+}
+
+#ifdef UNITTESTS
+
+static int UtilLineTest01(void)
+{
+    uint8_t buf[] = "no line end here, padding the buffer past a vector";
+
+    if (SCLineFindLF(buf, sizeof(buf) - 1) != NULL)
+        return 0;
+    if (SCLineFindCRLF(buf, sizeof(buf) - 1) != NULL)
+        return 0;
+
+    return 1;
+}
+
+/** \test LF at every offset, to cover the vector and the tail loops */
+static int UtilLineTest02(void)
+{
+    uint8_t buf[100];
+    uint32_t i;
+
+    for (i = 0; i < sizeof(buf); i++) {
+        memset(buf, 'a', sizeof(buf));
+        buf[i] = 0x0a;
+
+        if (SCLineFindLF(buf, sizeof(buf)) != buf + i) {
+            printf("LF at %u not found: ", i);
+            return 0;
+        }
+        /* LF just outside of the scanned range */
+        if (SCLineFindLF(buf, i) != NULL) {
+            printf("LF at %u found outside of range: ", i);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static int UtilLineTest03(void)
+{
+    uint8_t buf[] = "USER a\nPASS b\r\nQUIT\r\n";
+    uint8_t *ptr = SCLineFindCRLF(buf, sizeof(buf) - 1);
+
+    if (ptr != buf + 13) {
+        printf("expected CRLF at 13: ");
+        return 0;
+    }
+
+    /* LF at the very start of the buffer has nothing before it */
+    uint8_t buf2[] = "\nabc\r\n";
+    ptr = SCLineFindCRLF(buf2, sizeof(buf2) - 1);
+    if (ptr != buf2 + 4) {
+        printf("expected CRLF at 4: ");
+        return 0;
+    }
+
+    return 1;
+}
+
+static int UtilLineTest04(void)
+{
+    int result = 0;
+    uint8_t *buf = NULL;
+    int32_t len = 0;
+    uint32_t size = 0;
+    uint8_t chunk[100];
+    int i;
+
+    memset(chunk, 'x', sizeof(chunk));
+
+    for (i = 0; i < 10; i++) {
+        if (SCLineBufferAppend(&buf, &len, &size, chunk, sizeof(chunk)) != 0)
+            goto end;
+    }
+
+    if (len != 1000) {
+        printf("len %d != 1000: ", len);
+        goto end;
+    }
+    /* 256 -> 512 -> 1024 */
+    if (size != 1024) {
+        printf("size %u != 1024: ", size);
+        goto end;
+    }
+
+    result = 1;
+end:
+    if (buf != NULL)
+        SCFree(buf);
+    return result;
+}
+
+/** \test lengths that don't fit the line length are rejected */
+static int UtilLineTest05(void)
+{
+    int result = 0;
+    uint8_t *buf = NULL;
+    int32_t len = 0;
+    uint32_t size = 0;
+    uint8_t chunk[8];
+
+    memset(chunk, 'x', sizeof(chunk));
+
+    if (SCLineBufferAppend(&buf, &len, &size, chunk, sizeof(chunk)) != 0)
+        goto end;
+
+    /* would wrap the 32 bit sum, or go past INT32_MAX */
+    if (SCLineBufferAppend(&buf, &len, &size, chunk, UINT32_MAX - 4) != -1)
+        goto end;
+    if (SCLineBufferAppend(&buf, &len, &size, chunk, INT32_MAX) != -1)
+        goto end;
+
+    if (len != 8) {
+        printf("len %d != 8: ", len);
+        goto end;
+    }
+
+    result = 1;
+end:
+    if (buf != NULL)
+        SCFree(buf);
+    return result;
+}
+
+#endif /* UNITTESTS */
+
+void UtilLineRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("UtilLineTest01", UtilLineTest01, 1);
+    UtRegisterTest("UtilLineTest02", UtilLineTest02, 1);
+    UtRegisterTest("UtilLineTest03", UtilLineTest03, 1);
+    UtRegisterTest("UtilLineTest04", UtilLineTest04, 1);
+    UtRegisterTest("UtilLineTest05", UtilLineTest05, 1);
+#endif /* UNITTESTS */
+}
@@ -0,0 +1,152 @@
+/* Copyright (C) 2007-2013 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Line splitting helpers for the line based app layer parsers (SMTP, FTP,
+ * HTTP multipart headers).
+ *
+ * The scanners are implemented for AVX2 and SSE2, with a plain memchr
+ * fallback. Like util-memcmp.h the implementation is selected at compile
+ * time and fully inlined. The scanners don't depend on anything but libc
+ * so they can be used from the benches/ programs as well.
+ */
+
+#ifndef __UTIL_LINE_H__
+#define __UTIL_LINE_H__
+
+/** smallest allocation for a partial line buffer */
+#define SC_LINE_BUFFER_MIN_SIZE 256
+
+int SCLineBufferAppend(uint8_t **, int32_t *, uint32_t *,
+                       const uint8_t *, uint32_t);
+void UtilLineRegisterTests(void);
+
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+
+/**
+ *  \brief find the first occurence of a byte in a buffer
+ *
+ *  \param buf buffer to scan
+ *  \param len length of the buffer
+ *  \param c byte to look for
+ *
+ *  \retval ptr pointer to the byte in buf
+ *  \retval NULL byte not found
+ */
+static inline uint8_t *SCLineFindByte(const uint8_t *buf, uint32_t len,
+                                      uint8_t c)
+{
+    const __m256i needle = _mm256_set1_epi8((char)c);
+    uint32_t i = 0;
+
+    for ( ; i + 32 <= len; i += 32) {
+        __m256i b = _mm256_loadu_si256((const __m256i *)(buf + i));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(b, needle));
+        if (mask != 0)
+            return (uint8_t *)buf + i + __builtin_ctz(mask);
+    }
+    /* short lines end up here, so don't leave up to 31 bytes to the
+     * byte loop */
+    if (i + 16 <= len) {
+        __m128i b = _mm_loadu_si128((const __m128i *)(buf + i));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(
+                _mm_cmpeq_epi8(b, _mm256_castsi256_si128(needle)));
+        if (mask != 0)
+            return (uint8_t *)buf + i + __builtin_ctz(mask);
+        i += 16;
+    }
+    for ( ; i < len; i++) {
+        if (buf[i] == c)
+            return (uint8_t *)buf + i;
+    }
+    return NULL;
+}
+
+#elif defined(__SSE2__)
+
+#include <emmintrin.h>
+
+static inline uint8_t *SCLineFindByte(const uint8_t *buf, uint32_t len,
+                                      uint8_t c)
+{
+    const __m128i needle = _mm_set1_epi8((char)c);
+    uint32_t i = 0;
+
+    /* two vectors per round to keep the load ports busy on long lines */
+    for ( ; i + 32 <= len; i += 32) {
+        __m128i b1 = _mm_loadu_si128((const __m128i *)(buf + i));
+        __m128i b2 = _mm_loadu_si128((const __m128i *)(buf + i + 16));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(b1, needle)) |
+                        ((uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(b2, needle)) << 16);
+        if (mask != 0)
+            return (uint8_t *)buf + i + __builtin_ctz(mask);
+    }
+    for ( ; i + 16 <= len; i += 16) {
+        __m128i b = _mm_loadu_si128((const __m128i *)(buf + i));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(b, needle));
+        if (mask != 0)
+            return (uint8_t *)buf + i + __builtin_ctz(mask);
+    }
+    for ( ; i < len; i++) {
+        if (buf[i] == c)
+            return (uint8_t *)buf + i;
+    }
+    return NULL;
+}
+
+#else
+
+static inline uint8_t *SCLineFindByte(const uint8_t *buf, uint32_t len,
+                                      uint8_t c)
+{
+    return (uint8_t *)memchr(buf, c, len);
+}
+
+#endif /* __AVX2__ / __SSE2__ */
+
+/** \brief find the first LF in a buffer */
+#define SCLineFindLF(buf, len) SCLineFindByte((buf), (len), 0x0a)
+
+/**
+ *  \brief find the first CRLF sequence in a buffer
+ *
+ *  Scans for LF and checks the byte before it, so a bare LF doesn't
+ *  terminate the search.
+ *
+ *  \retval ptr pointer to the CR of the CRLF sequence
+ *  \retval NULL no CRLF in the buffer
+ */
+static inline uint8_t *SCLineFindCRLF(const uint8_t *buf, uint32_t len)
+{
+    uint32_t offset = 0;
+
+    while (offset < len) {
+        uint8_t *lf = SCLineFindLF(buf + offset, len - offset);
+        if (lf == NULL)
+            return NULL;
+        if (lf != buf && *(lf - 1) == 0x0d)
+            return lf - 1;
+        offset = (lf - buf) + 1;
+    }
+    return NULL;
+}
+
+#endif /* __UTIL_LINE_H__ */
@@ -0,0 +1,921 @@
+/* Copyright (C) 2007-2013 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Named memory regions, the non Tilera counterpart of the global and mpm
+ * mspaces.
+ *
+ * Each region reserves one range of address space the size of its memcap
+ * up front (MAP_NORESERVE, so only the touched pages cost memory) and
+ * hands out blocks from it. Keeping a subsystem's memory together like this
+ * means fewer pages and TLB entries for the hot tables, and the range is
+ * marked for transparent hugepages if those are enabled. The mpm and detect
+ * regions are made read only once the engine is built, like the mpm mspace
+ * is frozen on Tilera.
+ *
+ * Blocks have a 16 byte header and come in size classes with their own
+ * free lists. Blocks over the largest class are page sized and kept on a
+ * first fit list when freed. There is no coalescing: the regions hold
+ * long lived tables and fixed size structures, not general purpose memory.
+ *
+ * The flow, stream and app-layer regions are used per packet, so each
+ * thread keeps a small cache of free blocks per class for them and only
+ * takes the region lock to refill or drain it. Blocks in a thread's cache
+ * count as in use.
+ *
+ * If regions are disabled, or a region could not be reserved or has been
+ * made read only, allocations go to the normal heap. MemRegionFree tells
+ * these apart by address, so pointers that didn't come from a region can
+ * be passed to it as well.
+ */
+
+#include "suricata-common.h"
+#include "conf.h"
+#include "threads.h"
+#include "threadvars.h"
+#include "counters.h"
+#include "util-mem-region.h"
+#include "util-hugepage.h"
+#include "util-misc.h"
+#include "util-debug.h"
+#include "util-unittest.h"
+#include "util-mpm.h"
+
+#include <sys/mman.h>
+
+#define MEM_REGION_MAGIC        0x4d52474eU
+#define MEM_REGION_HDR_SIZE     16
+#define MEM_REGION_PAGE_SIZE    4096
+/** class of the page sized blocks over the largest class */
+#define MEM_REGION_LARGE        0xffffffffU
+
+/** block header, MEM_REGION_HDR_SIZE bytes so blocks are 16 byte
+ *  aligned */
+typedef struct MemRegionBlock_ {
+    /** usable size */
+    uint64_t size;
+    uint32_t cls;
+    uint32_t magic;
+} MemRegionBlock;
+
+/** usable sizes of the size classes. Steps of 1.5 and 2, so at most a
+ *  third of a block is wasted. */
+static const uint32_t mem_region_classes[] = {
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048,
+    3072, 4096, 6144, 8192, 12288, 16384, 24576, 32768, 49152, 65536,
+    98304, 131072, 196608, 262144,
+};
+#define MEM_REGION_CLASSES \
+    (int)(sizeof(mem_region_classes) / sizeof(mem_region_classes[0]))
+
+/** bytes per class a thread cache holds at most. Classes over half of
+ *  this are not cached. */
+#define MEM_REGION_CACHE_SIZE   65536
+
+typedef struct MemRegion_ {
+    const char *name;
+
+    /** reserved range, NULL if the region is not in use */
+    uint8_t *base;
+    /** size of the range, which is also the memcap */
+    size_t capacity;
+    /** offset of the unused part of the range */
+    size_t top;
+
+    /** read only, no more allocations from the range */
+    int frozen;
+    /** range is marked for transparent hugepages */
+    int hugepages;
+
+    SCMutex mutex;
+    /** free blocks per class, linked through their first bytes */
+    void *free_list[MEM_REGION_CLASSES];
+    /** free page sized blocks */
+    void *large_free;
+
+    uint64_t memuse;
+    uint64_t memcap_fail;
+} MemRegion;
+
+static MemRegion mem_regions[MEM_REGION_MAX];
+
+/** free blocks of a region kept by one thread */
+typedef struct MemRegionCache_ {
+    void *free_list[MEM_REGION_CLASSES];
+    uint32_t cnt[MEM_REGION_CLASSES];
+} MemRegionCache;
+
+static __thread MemRegionCache mem_region_caches[MEM_REGION_MAX];
+
+/** regions with thread caches. Not mpm and detect: they are built once
+ *  and made read only, a free to a thread cache would race
+ *  MemRegionFreeze. */
+static const int mem_region_cached[MEM_REGION_MAX] = {
+    0,      /* mpm */
+    0,      /* detect */
+    1,      /* flow */
+    1,      /* stream */
+    1,      /* app-layer */
+};
+
+static const char *mem_region_names[MEM_REGION_MAX] = {
+    "mpm", "detect", "flow", "stream", "app-layer",
+};
+
+static const uint64_t mem_region_default_memcap[MEM_REGION_MAX] = {
+    1024ULL * 1024 * 1024,      /* mpm */
+    512ULL * 1024 * 1024,       /* detect */
+    1024ULL * 1024 * 1024,      /* flow */
+    1024ULL * 1024 * 1024,      /* stream */
+    512ULL * 1024 * 1024,       /* app-layer */
+};
+
+/** make regions read only in MemRegionFreeze */
+static int mem_region_protect = 1;
+
+static inline MemRegionBlock *MemRegionBlockOf(void *ptr)
+{
+    return (MemRegionBlock *)((uint8_t *)ptr - MEM_REGION_HDR_SIZE);
+}
+
+/** \brief reserve the range of a region
+ *  \retval 0 ok
+ *  \retval -1 the range could not be reserved */
+static int MemRegionSetup(MemRegion *r, const char *name, size_t capacity)
+{
+    memset(r, 0x00, sizeof(*r));
+    r->name = name;
+
+    capacity = (capacity + MEM_REGION_PAGE_SIZE - 1) & ~(MEM_REGION_PAGE_SIZE - 1);
+    void *base = mmap(NULL, capacity, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        SCLogWarning(SC_ERR_MEM_ALLOC, "reserving %"PRIuMAX" bytes for the "
+                "%s memory region failed: %s. Using the heap instead",
+                (uintmax_t)capacity, name, strerror(errno));
+        return -1;
+    }
+
+#ifdef MADV_HUGEPAGE
+    if (UtilHugepageEnabled() && madvise(base, capacity, MADV_HUGEPAGE) == 0)
+        r->hugepages = 1;
+#endif
+
+    SCMutexInit(&r->mutex, NULL);
+    r->base = base;
+    r->capacity = capacity;
+    return 0;
+}
+
+/** \brief find the region of a pointer
+ *  \retval r region or NULL if the pointer is not from a region */
+static inline MemRegion *MemRegionOf(const void *ptr)
+{
+    const uint8_t *p = (const uint8_t *)ptr;
+    int i;
+
+    for (i = 0; i < MEM_REGION_MAX; i++) {
+        MemRegion *r = &mem_regions[i];
+        if (r->base != NULL && p >= r->base && p < r->base + r->capacity)
+            return r;
+    }
+    return NULL;
+}
+
+/** \retval cls size class for size or -1 if it needs a page sized block */
+static int MemRegionClass(size_t size)
+{
+    int lo = 0, hi = MEM_REGION_CLASSES - 1;
+
+    if (size > mem_region_classes[hi])
+        return -1;
+
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (mem_region_classes[mid] >= size)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return lo;
+}
+
+/** \retval c calling thread's cache for class cls of r, NULL if the
+ *           region or class is not cached */
+static inline MemRegionCache *MemRegionCacheOf(MemRegion *r, int cls)
+{
+    if (cls < 0 || mem_region_classes[cls] > MEM_REGION_CACHE_SIZE / 2)
+        return NULL;
+    /* regions set up by the unittests are not in the array */
+    if (r < mem_regions || r >= mem_regions + MEM_REGION_MAX)
+        return NULL;
+
+    int region = (int)(r - mem_regions);
+    if (!mem_region_cached[region])
+        return NULL;
+    return &mem_region_caches[region];
+}
+
+/** \brief carve a new block from the unused part of the range, region
+ *         lock held
+ *  \retval b block or NULL if the memcap is reached */
+static MemRegionBlock *MemRegionCarve(MemRegion *r, int cls, size_t usable)
+{
+    if (r->top + MEM_REGION_HDR_SIZE + usable > r->capacity)
+        return NULL;
+
+    MemRegionBlock *b = (MemRegionBlock *)(r->base + r->top);
+    b->size = usable;
+    b->cls = (cls >= 0) ? (uint32_t)cls : MEM_REGION_LARGE;
+    b->magic = MEM_REGION_MAGIC;
+    r->top += MEM_REGION_HDR_SIZE + usable;
+    return b;
+}
+
+/** \brief move half a cache worth of blocks of class cls from the region
+ *         to the thread's cache
+ *  \retval cnt blocks moved, 0 if the memcap is reached */
+static uint32_t MemRegionCacheRefill(MemRegion *r, MemRegionCache *c, int cls)
+{
+    uint32_t want = MEM_REGION_CACHE_SIZE / mem_region_classes[cls] / 2;
+    uint32_t cnt = 0;
+
+    SCMutexLock(&r->mutex);
+    while (cnt < want) {
+        void *ptr = r->free_list[cls];
+        if (ptr != NULL) {
+            r->free_list[cls] = *(void **)ptr;
+        } else {
+            MemRegionBlock *b = MemRegionCarve(r, cls, mem_region_classes[cls]);
+            if (b == NULL)
+                break;
+            ptr = (uint8_t *)b + MEM_REGION_HDR_SIZE;
+        }
+        *(void **)ptr = c->free_list[cls];
+        c->free_list[cls] = ptr;
+        cnt++;
+    }
+    if (cnt == 0)
+        r->memcap_fail++;
+    r->memuse += cnt * (MEM_REGION_HDR_SIZE + mem_region_classes[cls]);
+    SCMutexUnlock(&r->mutex);
+
+    c->cnt[cls] += cnt;
+    return cnt;
+}
+
+/** \brief move half of a full thread cache of class cls back to the
+ *         region */
+static void MemRegionCacheDrain(MemRegion *r, MemRegionCache *c, int cls)
+{
+    uint32_t cnt = c->cnt[cls] / 2;
+    uint32_t i;
+
+    SCMutexLock(&r->mutex);
+    for (i = 0; i < cnt; i++) {
+        void *ptr = c->free_list[cls];
+        c->free_list[cls] = *(void **)ptr;
+
+        *(void **)ptr = r->free_list[cls];
+        r->free_list[cls] = ptr;
+    }
+    r->memuse -= cnt * (MEM_REGION_HDR_SIZE + mem_region_classes[cls]);
+    SCMutexUnlock(&r->mutex);
+
+    c->cnt[cls] -= cnt;
+}
+
+static void *MemRegionAllocFrom(MemRegion *r, size_t size)
+{
+    MemRegionBlock *b = NULL;
+    void *ptr = NULL;
+    size_t usable;
+
+    if (r->base == NULL || r->frozen) {
+        /* same alignment as the region blocks */
+        if (posix_memalign(&ptr, MEM_REGION_HDR_SIZE, size) != 0)
+            return NULL;
+        return ptr;
+    }
+
+    int cls = MemRegionClass(size);
+    MemRegionCache *c = MemRegionCacheOf(r, cls);
+    if (c != NULL) {
+        if (c->free_list[cls] == NULL && MemRegionCacheRefill(r, c, cls) == 0) {
+            errno = ENOMEM;
+            return NULL;
+        }
+        ptr = c->free_list[cls];
+        c->free_list[cls] = *(void **)ptr;
+        c->cnt[cls]--;
+        return ptr;
+    }
+
+    if (cls >= 0) {
+        usable = mem_region_classes[cls];
+    } else {
+        usable = ((size + MEM_REGION_HDR_SIZE + MEM_REGION_PAGE_SIZE - 1) &
+                  ~(MEM_REGION_PAGE_SIZE - 1)) - MEM_REGION_HDR_SIZE;
+    }
+
+    SCMutexLock(&r->mutex);
+    if (cls >= 0) {
+        if (r->free_list[cls] != NULL) {
+            ptr = r->free_list[cls];
+            r->free_list[cls] = *(void **)ptr;
+            b = MemRegionBlockOf(ptr);
+        }
+    } else {
+        /* first fit */
+        void **prev = &r->large_free;
+        while (*prev != NULL) {
+            MemRegionBlock *fb = MemRegionBlockOf(*prev);
+            if (fb->size >= usable) {
+                ptr = *prev;
+                *prev = *(void **)ptr;
+                b = fb;
+                break;
+            }
+            prev = (void **)*prev;
+        }
+    }
+
+    if (b == NULL) {
+        b = MemRegionCarve(r, cls, usable);
+        if (b == NULL) {
+            r->memcap_fail++;
+            SCMutexUnlock(&r->mutex);
+            errno = ENOMEM;
+            return NULL;
+        }
+        ptr = (uint8_t *)b + MEM_REGION_HDR_SIZE;
+    }
+    r->memuse += MEM_REGION_HDR_SIZE + b->size;
+    SCMutexUnlock(&r->mutex);
+    return ptr;
+}
+
+/** \brief return a block to its region, r is the region of the pointer */
+static void MemRegionFreeTo(MemRegion *r, void *ptr)
+{
+    MemRegionBlock *b = MemRegionBlockOf(ptr);
+
+    if (b->magic != MEM_REGION_MAGIC) {
+        SCLogDebug("%p is not the start of a block in the %s region", ptr,
+                r->name);
+#ifdef DEBUG_VALIDATION
+        BUG_ON(1);
+#endif
+        return;
+    }
+
+    if (b->cls != MEM_REGION_LARGE && !r->frozen) {
+        int cls = (int)b->cls;
+        MemRegionCache *c = MemRegionCacheOf(r, cls);
+        if (c != NULL) {
+            *(void **)ptr = c->free_list[cls];
+            c->free_list[cls] = ptr;
+            if (++c->cnt[cls] >= MEM_REGION_CACHE_SIZE / mem_region_classes[cls])
+                MemRegionCacheDrain(r, c, cls);
+            return;
+        }
+    }
+
+    SCMutexLock(&r->mutex);
+    r->memuse -= MEM_REGION_HDR_SIZE + b->size;
+    /* a read only region can't be written to, the block is lost */
+    if (!r->frozen) {
+        if (b->cls == MEM_REGION_LARGE) {
+            *(void **)ptr = r->large_free;
+            r->large_free = ptr;
+        } else {
+            *(void **)ptr = r->free_list[b->cls];
+            r->free_list[b->cls] = ptr;
+        }
+    }
+    SCMutexUnlock(&r->mutex);
+}
+
+static void *MemRegionReallocIn(MemRegion *r, void *ptr, size_t size)
+{
+    MemRegion *from = MemRegionOf(ptr);
+    if (from == NULL)
+        return realloc(ptr, size);
+
+    MemRegionBlock *b = MemRegionBlockOf(ptr);
+    if (size <= b->size)
+        return ptr;
+
+    void *n = MemRegionAllocFrom(r, size);
+    if (n == NULL)
+        return NULL;
+    memcpy(n, ptr, b->size);
+    MemRegionFreeTo(from, ptr);
+    return n;
+}
+
+static void MemRegionFreezeRegion(MemRegion *r)
+{
+    if (r->base == NULL || r->frozen)
+        return;
+
+    SCMutexLock(&r->mutex);
+    r->frozen = 1;
+    size_t size = (r->top + MEM_REGION_PAGE_SIZE - 1) & ~(MEM_REGION_PAGE_SIZE - 1);
+    if (size > 0 && mprotect(r->base, size, PROT_READ) != 0) {
+        SCLogWarning(SC_ERR_SYSCALL, "making the %s memory region read only "
+                "failed: %s", r->name, strerror(errno));
+    } else {
+        SCLogInfo("%s memory region is read only: %"PRIuMAX" bytes", r->name,
+                (uintmax_t)size);
+    }
+    SCMutexUnlock(&r->mutex);
+}
+
+static void MemRegionThawRegion(MemRegion *r)
+{
+    if (r->base == NULL || !r->frozen)
+        return;
+
+    SCMutexLock(&r->mutex);
+    size_t size = (r->top + MEM_REGION_PAGE_SIZE - 1) & ~(MEM_REGION_PAGE_SIZE - 1);
+    if (size > 0 && mprotect(r->base, size, PROT_READ | PROT_WRITE) != 0) {
+        /* leave it frozen, writes would crash */
+        SCLogWarning(SC_ERR_SYSCALL, "making the %s memory region writable "
+                "again failed: %s", r->name, strerror(errno));
+    } else {
+        r->frozen = 0;
+    }
+    SCMutexUnlock(&r->mutex);
+}
+
+/**
+ *  \brief set up the regions from the "memory-regions" settings
+ *
+ *  memory-regions.enabled: use regions, default no
+ *  memory-regions.protect: make mpm and detect read only, default yes
+ *  memory-regions.<name>.memcap: size of a region
+ */
+void MemRegionInit(void)
+{
+    int enabled = 0;
+    int i;
+
+    for (i = 0; i < MEM_REGION_MAX; i++)
+        mem_regions[i].name = mem_region_names[i];
+
+#ifdef __tile__
+    /* the Tilera build uses the global and mpm mspaces */
+    return;
+#endif
+
+    if (ConfGetBool("memory-regions.enabled", &enabled) != 1 || !enabled)
+        return;
+
+    mem_region_protect = 1;
+    (void)ConfGetBool("memory-regions.protect", &mem_region_protect);
+
+    for (i = 0; i < MEM_REGION_MAX; i++) {
+        uint64_t memcap = mem_region_default_memcap[i];
+        char name[64];
+        char *val = NULL;
+
+        snprintf(name, sizeof(name), "memory-regions.%s.memcap",
+                mem_region_names[i]);
+        if (ConfGet(name, &val) == 1 && val != NULL) {
+            if (ParseSizeStringU64(val, &memcap) < 0 || memcap == 0) {
+                SCLogError(SC_ERR_SIZE_PARSE, "Error parsing %s from conf "
+                        "file - %s. Killing engine", name, val);
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        (void)MemRegionSetup(&mem_regions[i], mem_region_names[i],
+                (size_t)memcap);
+    }
+}
+
+const char *MemRegionName(int region)
+{
+    if (region < 0 || region >= MEM_REGION_MAX)
+        return "unknown";
+    return mem_region_names[region];
+}
+
+/**
+ *  \brief allocate from a region
+ *
+ *  Use the SCRegionMalloc wrapper from util-mem.h.
+ *
+ *  \retval ptr 16 byte aligned memory
+ *  \retval NULL region memcap reached or out of memory
+ */
+void *MemRegionAlloc(int region, size_t size)
+{
+    BUG_ON(region < 0 || region >= MEM_REGION_MAX);
+    return MemRegionAllocFrom(&mem_regions[region], size);
+}
+
+/**
+ *  \brief resize memory from a region
+ *
+ *  Memory that isn't from a region is resized on the heap.
+ */
+void *MemRegionRealloc(int region, void *ptr, size_t size)
+{
+    BUG_ON(region < 0 || region >= MEM_REGION_MAX);
+
+    if (ptr == NULL)
+        return MemRegionAllocFrom(&mem_regions[region], size);
+    if (size == 0) {
+        MemRegionFree(ptr);
+        return NULL;
+    }
+    return MemRegionReallocIn(&mem_regions[region], ptr, size);
+}
+
+/** \brief free memory from MemRegionAlloc, other pointers are passed to
+ *         free() */
+void MemRegionFree(void *ptr)
+{
+    if (ptr == NULL)
+        return;
+
+    MemRegion *r = MemRegionOf(ptr);
+    if (r == NULL) {
+        free(ptr);
+        return;
+    }
+    MemRegionFreeTo(r, ptr);
+}
+
+/**
+ *  \brief make a region read only
+ *
+ *  Later allocations for the region come from the heap and blocks freed
+ *  to it are not reused.
+ */
+void MemRegionFreeze(int region)
+{
+    if (region < 0 || region >= MEM_REGION_MAX || !mem_region_protect)
+        return;
+    MemRegionFreezeRegion(&mem_regions[region]);
+}
+
+/**
+ *  \brief make a frozen region writable again
+ *
+ *  The structures in a frozen region are written to when they are freed,
+ *  so this has to be called before the detection engine is freed.
+ */
+void MemRegionThaw(int region)
+{
+    if (region < 0 || region >= MEM_REGION_MAX)
+        return;
+    MemRegionThawRegion(&mem_regions[region]);
+}
+
+uint64_t MemRegionMemuse(int region)
+{
+    uint64_t memuse = 0;
+
+    if (region < 0 || region >= MEM_REGION_MAX || mem_regions[region].base == NULL)
+        return 0;
+
+    SCMutexLock(&mem_regions[region].mutex);
+    memuse = mem_regions[region].memuse;
+    SCMutexUnlock(&mem_regions[region].mutex);
+    return memuse;
+}
+
+uint64_t MemRegionMemcap(int region)
+{
+    if (region < 0 || region >= MEM_REGION_MAX)
+        return 0;
+    return (uint64_t)mem_regions[region].capacity;
+}
+
+/** \brief register the memuse and memcap_fail counters of the regions in
+ *         use with a thread */
+void MemRegionRegisterPerfCounters(ThreadVars *tv, MemRegionPerfCounters *pc)
+{
+    char name[64];
+    int i;
+
+    memset(pc, 0x00, sizeof(*pc));
+    for (i = 0; i < MEM_REGION_MAX; i++) {
+        if (mem_regions[i].base == NULL)
+            continue;
+
+        snprintf(name, sizeof(name), "mem_region.%s.memuse", mem_region_names[i]);
+        pc->memuse[i] = SCPerfTVRegisterCounter(name, tv,
+                SC_PERF_TYPE_Q_NORMAL, "NULL");
+        snprintf(name, sizeof(name), "mem_region.%s.memcap_fail",
+                mem_region_names[i]);
+        pc->memcap_fail[i] = SCPerfTVRegisterCounter(name, tv,
+                SC_PERF_TYPE_UINT64, "NULL");
+    }
+}
+
+void MemRegionUpdatePerfCounters(ThreadVars *tv, MemRegionPerfCounters *pc)
+{
+    int i;
+
+    for (i = 0; i < MEM_REGION_MAX; i++) {
+        MemRegion *r = &mem_regions[i];
+        if (r->base == NULL || pc->memuse[i] == 0)
+            continue;
+
+        SCMutexLock(&r->mutex);
+        uint64_t memuse = r->memuse;
+        uint64_t memcap_fail = r->memcap_fail;
+        SCMutexUnlock(&r->mutex);
+
+        SCPerfCounterSetUI64(pc->memuse[i], tv->sc_perf_pca, memuse);
+        SCPerfCounterSetUI64(pc->memcap_fail[i], tv->sc_perf_pca, memcap_fail);
+    }
+}
+
+/** \brief log the regions in use */
+void MemRegionReport(void)
+{
+    int i;
+
+    for (i = 0; i < MEM_REGION_MAX; i++) {
+        MemRegion *r = &mem_regions[i];
+        if (r->base == NULL)
+            continue;
+
+        SCLogInfo("%s memory region: memcap %"PRIuMAX", memuse %"PRIu64"%s%s",
+                r->name, (uintmax_t)r->capacity, MemRegionMemuse(i),
+                r->hugepages ? ", hugepages" : "",
+                r->frozen ? ", read only" : "");
+    }
+}
+
+#ifdef UNITTESTS
+
+static void MemRegionTeardown(MemRegion *r)
+{
+    if (r->base == NULL)
+        return;
+    /* blocks cached by this thread are gone with the range */
+    if (r >= mem_regions && r < mem_regions + MEM_REGION_MAX)
+        memset(&mem_region_caches[r - mem_regions], 0x00, sizeof(MemRegionCache));
+    munmap(r->base, r->capacity);
+    SCMutexDestroy(&r->mutex);
+    memset(r, 0x00, sizeof(*r));
+}
+
+/** \test blocks are aligned, accounted and reused per size class */
+static int MemRegionTest01(void)
+{
+    MemRegion r;
+    int result = 0;
+
+    if (MemRegionSetup(&r, "test", 4 * 1024 * 1024) != 0)
+        return 0;
+
+    uint8_t *a = MemRegionAllocFrom(&r, 100);
+    uint8_t *b = MemRegionAllocFrom(&r, 300000);
+    if (a == NULL || b == NULL)
+        goto end;
+    if (((uintptr_t)a & 15) != 0 || ((uintptr_t)b & 15) != 0) {
+        printf("not 16 byte aligned: ");
+        goto end;
+    }
+    if (a < r.base || b + 300000 > r.base + r.capacity) {
+        printf("not in the region: ");
+        goto end;
+    }
+    /* 100 bytes is in the 128 class, 300000 in a page sized block */
+    if (r.memuse != MEM_REGION_HDR_SIZE + 128 + 74 * MEM_REGION_PAGE_SIZE) {
+        printf("memuse %"PRIu64": ", r.memuse);
+        goto end;
+    }
+    memset(a, 0xff, 100);
+    memset(b, 0xff, 300000);
+
+    MemRegionFreeTo(&r, a);
+    MemRegionFreeTo(&r, b);
+    if (r.memuse != 0) {
+        printf("memuse %"PRIu64" after free: ", r.memuse);
+        goto end;
+    }
+
+    /* same class and a smaller page sized block reuse the blocks */
+    if (MemRegionAllocFrom(&r, 120) != a || MemRegionAllocFrom(&r, 280000) != b) {
+        printf("freed blocks not reused: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    MemRegionTeardown(&r);
+    return result;
+}
+
+/** \test the memcap is enforced */
+static int MemRegionTest02(void)
+{
+    MemRegion r;
+    int result = 0;
+
+    if (MemRegionSetup(&r, "test", 1024 * 1024) != 0)
+        return 0;
+
+    if (MemRegionAllocFrom(&r, 600000) == NULL)
+        goto end;
+    if (MemRegionAllocFrom(&r, 600000) != NULL) {
+        printf("memcap not enforced: ");
+        goto end;
+    }
+    if (r.memcap_fail != 1)
+        goto end;
+    /* small blocks still fit */
+    if (MemRegionAllocFrom(&r, 64) == NULL)
+        goto end;
+
+    result = 1;
+end:
+    MemRegionTeardown(&r);
+    return result;
+}
+
+/** \test realloc keeps the data, a frozen region falls back to the heap */
+static int MemRegionTest03(void)
+{
+    /* MemRegionReallocIn looks up the region of the old pointer, so use
+     * one of the real regions */
+    MemRegion save = mem_regions[MEM_REGION_MPM];
+    MemRegion *r = &mem_regions[MEM_REGION_MPM];
+    int result = 0;
+    uint8_t *heap = NULL;
+    int i;
+
+    if (MemRegionSetup(r, "test", 4 * 1024 * 1024) != 0)
+        goto end;
+
+    uint8_t *p = MemRegionAllocFrom(r, 40);
+    if (p == NULL)
+        goto end;
+    for (i = 0; i < 40; i++)
+        p[i] = (uint8_t)i;
+
+    /* fits in the 48 class */
+    if (MemRegionReallocIn(r, p, 48) != p)
+        goto end;
+
+    uint8_t *n = MemRegionReallocIn(r, p, 5000);
+    if (n == NULL || n == p || MemRegionOf(n) != r)
+        goto end;
+    for (i = 0; i < 40; i++) {
+        if (n[i] != (uint8_t)i)
+            goto end;
+    }
+
+    MemRegionFreezeRegion(r);
+    heap = MemRegionAllocFrom(r, 64);
+    if (heap == NULL || MemRegionOf(heap) != NULL) {
+        printf("frozen region still allocates: ");
+        goto end;
+    }
+    /* still readable */
+    if (n[39] != 39)
+        goto end;
+
+    result = 1;
+end:
+    MemRegionFree(heap);
+    MemRegionTeardown(r);
+    mem_regions[MEM_REGION_MPM] = save;
+    return result;
+}
+
+/** \test an mpm context built in a frozen region can be destroyed once the
+ *        region is thawed */
+static int MemRegionTest04(void)
+{
+    MemRegion save = mem_regions[MEM_REGION_MPM];
+    MemRegion *r = &mem_regions[MEM_REGION_MPM];
+    int save_protect = mem_region_protect;
+    int result = 0;
+    MpmCtx mpm_ctx;
+
+    memset(&mpm_ctx, 0x00, sizeof(mpm_ctx));
+    if (MemRegionSetup(r, "test", 16 * 1024 * 1024) != 0)
+        goto end;
+    mem_region_protect = 1;
+
+    MpmInitCtx(&mpm_ctx, MPM_AC, -1);
+    if (mpm_ctx.ctx == NULL || MemRegionOf(mpm_ctx.ctx) != r) {
+        printf("ac ctx not in the mpm region: ");
+        goto end;
+    }
+    mpm_table[MPM_AC].AddPattern(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    mpm_table[MPM_AC].AddPattern(&mpm_ctx, (uint8_t *)"bcde", 4, 0, 0, 1, 1, 0);
+    mpm_table[MPM_AC].Prepare(&mpm_ctx);
+
+    MemRegionFreeze(MEM_REGION_MPM);
+    if (!r->frozen)
+        goto end;
+
+    MemRegionThaw(MEM_REGION_MPM);
+    if (r->frozen) {
+        printf("region still read only: ");
+        goto end;
+    }
+    /* writes to the ctx, crashed while the region was read only */
+    mpm_table[MPM_AC].DestroyCtx(&mpm_ctx);
+
+    result = 1;
+end:
+    MemRegionTeardown(r);
+    mem_regions[MEM_REGION_MPM] = save;
+    mem_region_protect = save_protect;
+    return result;
+}
+
+/** \test the flow region caches blocks per thread and hands them back to
+ *        the region when the cache is full */
+static int MemRegionTest05(void)
+{
+    MemRegion save = mem_regions[MEM_REGION_FLOW];
+    MemRegion *r = &mem_regions[MEM_REGION_FLOW];
+    /* 4096 bytes blocks: refills of 8, drained at 16 */
+    void *ptrs[16];
+    int result = 0;
+    int i;
+
+    if (MemRegionSetup(r, "test", 4 * 1024 * 1024) != 0)
+        goto end;
+
+    ptrs[0] = MemRegionAllocFrom(r, 4096);
+    if (ptrs[0] == NULL || MemRegionOf(ptrs[0]) != r)
+        goto end;
+    /* the refill moved 8 blocks to the cache, 7 still cached */
+    if (r->memuse != 8 * (MEM_REGION_HDR_SIZE + 4096) ||
+        mem_region_caches[MEM_REGION_FLOW].cnt[15] != 7) {
+        printf("memuse %"PRIu64" after the first alloc: ", r->memuse);
+        goto end;
+    }
+    for (i = 1; i < 16; i++) {
+        ptrs[i] = MemRegionAllocFrom(r, 4000);
+        if (ptrs[i] == NULL)
+            goto end;
+        memset(ptrs[i], 0xff, 4000);
+    }
+    if (r->memuse != 16 * (MEM_REGION_HDR_SIZE + 4096))
+        goto end;
+
+    /* the 16th free fills the cache, half goes back to the region */
+    for (i = 0; i < 16; i++)
+        MemRegionFreeTo(r, ptrs[i]);
+    if (mem_region_caches[MEM_REGION_FLOW].cnt[15] != 8 ||
+        r->free_list[15] == NULL ||
+        r->memuse != 8 * (MEM_REGION_HDR_SIZE + 4096)) {
+        printf("cache not drained, memuse %"PRIu64": ", r->memuse);
+        goto end;
+    }
+
+    /* the 8 blocks freed last went back, the cache has 7 to 0 left */
+    if (MemRegionAllocFrom(r, 4096) != ptrs[7]) {
+        printf("cached block not reused: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    MemRegionTeardown(r);
+    mem_regions[MEM_REGION_FLOW] = save;
+    return result;
+}
+
+#endif /* UNITTESTS */
+
+void MemRegionRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("MemRegionTest01", MemRegionTest01, 1);
+    UtRegisterTest("MemRegionTest02", MemRegionTest02, 1);
+    UtRegisterTest("MemRegionTest03", MemRegionTest03, 1);
+    UtRegisterTest("MemRegionTest04", MemRegionTest04, 1);
+    UtRegisterTest("MemRegionTest05", MemRegionTest05, 1);
+#endif /* UNITTESTS */
+}
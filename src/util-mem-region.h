@@ -0,0 +1,63 @@
+/* Copyright (C) 2007-2013 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Included by util-mem.h, so keep this free of other suricata headers.
+ */
+
+#ifndef __UTIL_MEM_REGION_H__
+#define __UTIL_MEM_REGION_H__
+
+enum {
+    MEM_REGION_MPM = 0,
+    MEM_REGION_DETECT,
+    MEM_REGION_FLOW,
+    MEM_REGION_STREAM,
+    MEM_REGION_APPLAYER,
+
+    MEM_REGION_MAX,
+};
+
+struct ThreadVars_;
+
+/** stats.log counters of the regions, registered by one thread */
+typedef struct MemRegionPerfCounters_ {
+    uint16_t memuse[MEM_REGION_MAX];
+    uint16_t memcap_fail[MEM_REGION_MAX];
+} MemRegionPerfCounters;
+
+void MemRegionInit(void);
+const char *MemRegionName(int);
+
+void *MemRegionAlloc(int, size_t);
+void *MemRegionRealloc(int, void *, size_t);
+void MemRegionFree(void *);
+
+void MemRegionFreeze(int);
+void MemRegionThaw(int);
+uint64_t MemRegionMemuse(int);
+uint64_t MemRegionMemcap(int);
+
+void MemRegionRegisterPerfCounters(struct ThreadVars_ *, MemRegionPerfCounters *);
+void MemRegionUpdatePerfCounters(struct ThreadVars_ *, MemRegionPerfCounters *);
+
+void MemRegionReport(void);
+void MemRegionRegisterTests(void);
+
+#endif /* __UTIL_MEM_REGION_H__ */
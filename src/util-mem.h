@@ -31,6 +31,7 @@
 #define __UTIL_MEM_H__
 
 #include "util-atomic.h"
+#include "util-mem-region.h"
 
 #ifdef __tile__
 #include <pcre.h>
@@ -79,7 +80,17 @@ SC_ATOMIC_EXTERN(unsigned int, engine_stage);
     (void*)ptrmem; \
 })
 
-#define SCMpmMalloc(tv a) SCMalloc(a)
+#define SCMpmMalloc(a) SCMalloc(a)
+
+#define SCMpmRealloc(x, a) SCRealloc((x), (a))
+
+#define SCMpmFree(a) SCFree((a))
+
+#define SCRegionMalloc(r, a) SCMalloc((a))
+
+#define SCRegionRealloc(r, x, a) SCRealloc((x), (a))
+
+#define SCRegionFree(a) SCFree((a))
 
 #define SCThreadMalloc(tv a) SCMalloc(a)
 
@@ -183,10 +194,54 @@ SC_ATOMIC_EXTERN(unsigned int, engine_stage);
     (void*)ptrmem; \
 })
 
-#define SCMpmMalloc(a) SCMalloc(a)
-
 #define SCThreadMalloc(tv, a) SCMalloc(a)
 
+/** \brief allocate from a memory region, see util-mem-region.c
+ *  \param r MEM_REGION_* region
+ *  \param a size */
+#define SCRegionMalloc(r, a) ({ \
+    void *ptrmem = NULL; \
+    \
+    ptrmem = MemRegionAlloc((r), (a)); \
+    if (ptrmem == NULL) { \
+        if (SC_ATOMIC_GET(engine_stage) == SURICATA_INIT) {\
+            SCLogError(SC_ERR_MEM_ALLOC, "SCRegionMalloc failed: %s, while trying " \
+                "to allocate %"PRIuMAX" bytes from the %s region", strerror(errno), \
+                (uintmax_t)(a), MemRegionName((r))); \
+            SCLogError(SC_ERR_FATAL, "Out of memory. The engine cannot be initialized. Exiting..."); \
+            exit(EXIT_FAILURE); \
+        } \
+    } \
+    (void*)ptrmem; \
+})
+
+#define SCRegionRealloc(r, x, a) ({ \
+    void *ptrmem = NULL; \
+    \
+    ptrmem = MemRegionRealloc((r), (x), (a)); \
+    if (ptrmem == NULL) { \
+        if (SC_ATOMIC_GET(engine_stage) == SURICATA_INIT) {\
+            SCLogError(SC_ERR_MEM_ALLOC, "SCRegionRealloc failed: %s, while trying " \
+                "to allocate %"PRIuMAX" bytes from the %s region", strerror(errno), \
+                (uintmax_t)(a), MemRegionName((r))); \
+            SCLogError(SC_ERR_FATAL, "Out of memory. The engine cannot be initialized. Exiting..."); \
+            exit(EXIT_FAILURE); \
+        } \
+    } \
+    (void*)ptrmem; \
+})
+
+/** \brief free memory from a region, memory from the heap is fine too */
+#define SCRegionFree(a) ({ \
+    MemRegionFree((a)); \
+})
+
+#define SCMpmMalloc(a) SCRegionMalloc(MEM_REGION_MPM, (a))
+
+#define SCMpmRealloc(x, a) SCRegionRealloc(MEM_REGION_MPM, (x), (a))
+
+#define SCMpmFree(a) SCRegionFree((a))
+
 #define SCRealloc(x, a) ({ \
     void *ptrmem = NULL; \
     \
@@ -546,6 +601,15 @@ extern tmc_mspace mpm_mspace;
     tmc_mspace_free((a)); \
 })
 
+#define SCMpmFree(a) SCFree((a))
+
+/* the Tilera build keeps using the global mspace for the other regions */
+#define SCRegionMalloc(r, a) SCMalloc((a))
+
+#define SCRegionRealloc(r, x, a) SCRealloc((x), (a))
+
+#define SCRegionFree(a) SCFree((a))
+
 #define SCFreeze() ({ \
 })
 
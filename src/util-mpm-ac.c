@@ -69,6 +69,15 @@
 // optionally use experimental version of SCACSearch()
 //#define EXPERIMENTAL_SCACSEARCH 1
 #endif
+#elif !defined(DBG_MEM_ALLOC)
+/* Swap in the mpm region allocator, see util-mem-region.c. Its free
+ * handles memory from the heap as well. */
+#undef SCMalloc
+#undef SCRealloc
+#undef SCFree
+#define SCMalloc SCMpmMalloc
+#define SCRealloc SCMpmRealloc
+#define SCFree SCMpmFree
 #endif
 
 void SCACInitCtx(MpmCtx *, int);
@@ -1285,8 +1285,8 @@ static inline void SCACCDedupDeltaTable(MpmCtx *mpm_ctx)
         } else {
             printf("SWAPPING in match\n");
             ctx->state_table_m8 = &l8->u8;
-	        SCFree(m8);
-	        SCFree(t8);
+	        SCMpmFree(m8);
+	        SCMpmFree(t8);
         }
 
     } else if (ctx->state_count < 32767) {
@@ -1337,8 +1337,8 @@ static inline void SCACCDedupDeltaTable(MpmCtx *mpm_ctx)
         } else {
             printf("SWAPPING in match\n");
             ctx->state_table_m16 = &l16->u16;
-	        SCFree(m16);
-	        SCFree(t16);
+	        SCMpmFree(m16);
+	        SCMpmFree(t16);
         }
 
     } else {
@@ -1389,8 +1389,8 @@ static inline void SCACCDedupDeltaTable(MpmCtx *mpm_ctx)
         } else {
             printf("SWAPPING in match\n");
             ctx->state_table_m32 = &l32->u32;
-            SCFree(m32);
-            SCFree(t32);
+            SCMpmFree(m32);
+            SCMpmFree(t32);
         }
     }
 
@@ -1735,14 +1735,14 @@ void SCACCDestroyCtx(MpmCtx *mpm_ctx)
     }
 
     if (ctx->state_table_u16 != NULL) {
-        SCFree(ctx->state_table_u16);
+        SCMpmFree(ctx->state_table_u16);
         ctx->state_table_u16 = NULL;
 
         mpm_ctx->memory_cnt++;
         mpm_ctx->memory_size -= (ctx->state_count *
                                  sizeof(SC_ACC_STATE_TYPE_U16) * ALPHABET_SIZE);
     } else if (ctx->state_table_u32 != NULL) {
-        SCFree(ctx->state_table_u32);
+        SCMpmFree(ctx->state_table_u32);
         ctx->state_table_u32 = NULL;
 
         mpm_ctx->memory_cnt++;
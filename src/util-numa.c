@@ -0,0 +1,401 @@
+/* Copyright (C) 2007-2013 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * NUMA aware memory placement.
+ *
+ * Threads are pinned by util-affinity, but the big pools are allocated by
+ * the main thread and would all end up on its node. Here we keep track of
+ * the node every pinned thread runs on, so the packet and segment pools
+ * can keep one pool per node and hand out memory that is local to the
+ * thread using it. Shared tables, like the flow hash, are interleaved over
+ * all nodes instead.
+ *
+ * Without libnuma, or on a single node system, everything is on node 0
+ * and the allocation functions fall back to the normal allocator.
+ */
+
+#include "suricata-common.h"
+#include "conf.h"
+#include "util-numa.h"
+#include "util-hugepage.h"
+#include "util-atomic.h"
+#include "util-debug.h"
+#include "util-unittest.h"
+
+#ifdef HAVE_NUMA
+#include <numa.h>
+#endif
+
+/** number of nodes we keep pools for */
+static int numa_nodes = 1;
+/** libnuma is used for the allocations */
+static int numa_active = 0;
+
+static uint64_t numa_memuse[NUMA_MAX_NODES];
+static uint32_t numa_threads[NUMA_MAX_NODES];
+
+#ifdef HAVE_NUMA
+/** node the current thread is pinned to, 0 if not pinned to one node */
+static __thread int numa_thread_node = 0;
+#endif
+
+/**
+ *  \brief set up NUMA support from the "threading.numa" setting
+ *
+ *  "auto" (default) uses NUMA placement if the system has more than one
+ *  node, "no" disables it.
+ */
+void UtilNumaInit(void)
+{
+    char *mode = "auto";
+
+    numa_nodes = 1;
+    numa_active = 0;
+
+    (void)ConfGet("threading.numa", &mode);
+    if (strcmp(mode, "no") == 0 || strcmp(mode, "false") == 0) {
+        SCLogInfo("NUMA aware memory placement disabled");
+        return;
+    }
+
+#ifdef HAVE_NUMA
+    if (numa_available() == -1) {
+        SCLogInfo("NUMA not available on this system, using a single node");
+        return;
+    }
+
+    int nodes = numa_max_node() + 1;
+    if (nodes > NUMA_MAX_NODES) {
+        SCLogWarning(SC_ERR_INVALID_VALUE, "system has %d NUMA nodes, using "
+                "pools for the first %d only", nodes, NUMA_MAX_NODES);
+        nodes = NUMA_MAX_NODES;
+    }
+    if (nodes > 1) {
+        numa_nodes = nodes;
+        numa_active = 1;
+        SCLogInfo("NUMA aware memory placement on %d nodes", numa_nodes);
+    }
+#else
+    if (strcmp(mode, "auto") != 0) {
+        SCLogWarning(SC_ERR_INVALID_VALUE, "threading.numa is set, but "
+                "suricata was built without libnuma support");
+    }
+#endif
+}
+
+/** \brief number of nodes the pools are kept for, always at least 1 */
+int UtilNumaNodeCount(void)
+{
+    return numa_nodes;
+}
+
+/** \brief get the pool node of a cpu */
+int UtilNumaNodeOfCpu(int cpu)
+{
+#ifdef HAVE_NUMA
+    if (numa_active) {
+        int node = numa_node_of_cpu(cpu);
+        if (node < 0)
+            return 0;
+        return node % numa_nodes;
+    }
+#endif
+    return 0;
+}
+
+/**
+ *  \brief set the node of the calling thread from its cpu affinity
+ *
+ *  Called after the affinity is set up. A thread that may run on cpus of
+ *  more than one node is treated as node 0.
+ *
+ *  \param name thread name for the log
+ */
+void UtilNumaThreadSetup(const char *name)
+{
+    int node = 0;
+
+#ifdef HAVE_NUMA
+    if (numa_active) {
+        cpu_set_t cs;
+        int cpu;
+
+        CPU_ZERO(&cs);
+        if (sched_getaffinity(0, sizeof(cs), &cs) == 0) {
+            node = -1;
+            for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+                if (!CPU_ISSET(cpu, &cs))
+                    continue;
+
+                int n = UtilNumaNodeOfCpu(cpu);
+                if (node == -1) {
+                    node = n;
+                } else if (node != n) {
+                    node = 0;
+                    break;
+                }
+            }
+            if (node == -1)
+                node = 0;
+        }
+
+        /* allocate from the node we run on */
+        numa_set_localalloc();
+        numa_thread_node = node;
+
+        SCLogInfo("thread \"%s\" uses NUMA node %d", name, node);
+    }
+#endif
+
+    (void) SCAtomicFetchAndAdd(&numa_threads[node], 1);
+}
+
+/** \brief get the node of the calling thread */
+int UtilNumaThreadNode(void)
+{
+#ifdef HAVE_NUMA
+    return numa_thread_node;
+#else
+    return 0;
+#endif
+}
+
+/**
+ *  \brief allocate zeroed memory on a node
+ *
+ *  Backed by hugepages if they are enabled, see util-hugepage.c.
+ *
+ *  \param size size of the memory
+ *  \param node node, or NUMA_NODE_INTERLEAVED to spread the pages over
+ *              all nodes
+ *  \param name name of the memory for the hugepage report
+ *
+ *  \retval ptr cache line aligned memory, free with UtilNumaFree
+ *  \retval NULL error
+ */
+void *UtilNumaAlloc(size_t size, int node, const char *name)
+{
+    void *ptr = UtilHugepageAlloc(size, name);
+
+#ifdef HAVE_NUMA
+    if (ptr != NULL && numa_active) {
+        /* not touched yet, so the policy decides where the pages go */
+        if (node == NUMA_NODE_INTERLEAVED)
+            numa_interleave_memory(ptr, size, numa_all_nodes_ptr);
+        else
+            numa_tonode_memory(ptr, size, node);
+    }
+
+    if (ptr == NULL && numa_active) {
+        /* page aligned and zeroed by the kernel */
+        if (node == NUMA_NODE_INTERLEAVED)
+            ptr = numa_alloc_interleaved(size);
+        else
+            ptr = numa_alloc_onnode(size, node);
+        if (ptr == NULL) {
+            SCLogError(SC_ERR_MEM_ALLOC, "NUMA allocation of %"PRIuMAX" "
+                    "bytes on node %d failed", (uintmax_t)size, node);
+            return NULL;
+        }
+    }
+#endif
+    if (ptr == NULL) {
+        ptr = SCMallocAligned(size, 64);
+        if (ptr == NULL)
+            return NULL;
+        memset(ptr, 0x00, size);
+    }
+
+    if (node == NUMA_NODE_INTERLEAVED) {
+        int n;
+        for (n = 0; n < numa_nodes; n++)
+            UtilNumaMemuseAdd(n, size / numa_nodes);
+    } else {
+        UtilNumaMemuseAdd(node, size);
+    }
+    return ptr;
+}
+
+/**
+ *  \brief free memory from UtilNumaAlloc
+ *
+ *  \param size and node must match the UtilNumaAlloc call
+ */
+void UtilNumaFree(void *ptr, size_t size, int node)
+{
+    if (ptr == NULL)
+        return;
+
+    if (node == NUMA_NODE_INTERLEAVED) {
+        int n;
+        for (n = 0; n < numa_nodes; n++)
+            UtilNumaMemuseSub(n, size / numa_nodes);
+    } else {
+        UtilNumaMemuseSub(node, size);
+    }
+
+    if (UtilHugepageFree(ptr))
+        return;
+
+#ifdef HAVE_NUMA
+    if (numa_active) {
+        numa_free(ptr, size);
+        return;
+    }
+#endif
+    SCFreeAligned(ptr);
+}
+
+/** \brief account memory allocated on a node by other means */
+void UtilNumaMemuseAdd(int node, uint64_t size)
+{
+    if (node < 0 || node >= NUMA_MAX_NODES)
+        node = 0;
+    (void) SCAtomicFetchAndAdd(&numa_memuse[node], size);
+}
+
+void UtilNumaMemuseSub(int node, uint64_t size)
+{
+    if (node < 0 || node >= NUMA_MAX_NODES)
+        node = 0;
+    (void) SCAtomicFetchAndSub(&numa_memuse[node], size);
+}
+
+/** \brief memory accounted to a node */
+uint64_t UtilNumaMemuse(int node)
+{
+    if (node < 0 || node >= NUMA_MAX_NODES)
+        return 0;
+    return SCAtomicFetchAndAdd(&numa_memuse[node], 0);
+}
+
+/**
+ *  \brief log the threads and memory per node
+ *
+ *  Called once all threads are initialized, so the per node pools that are
+ *  set up by the threads themselves are included.
+ */
+void UtilNumaReport(void)
+{
+    int node;
+
+    if (!numa_active)
+        return;
+
+    for (node = 0; node < numa_nodes; node++) {
+        SCLogInfo("NUMA node %d: %"PRIu32" threads, %"PRIu64" bytes of pool "
+                "memory", node, SCAtomicFetchAndAdd(&numa_threads[node], 0),
+                UtilNumaMemuse(node));
+    }
+}
+
+#ifdef UNITTESTS
+
+/** \test single node fallback: memory is zeroed and accounted on node 0 */
+static int UtilNumaTest01(void)
+{
+    int result = 0;
+    uint64_t memuse = UtilNumaMemuse(0);
+    uint8_t *ptr = NULL;
+    size_t u;
+
+    if (UtilNumaNodeCount() < 1 || UtilNumaNodeOfCpu(0) != 0)
+        goto end;
+
+    ptr = UtilNumaAlloc(4096, 0, "test");
+    if (ptr == NULL)
+        goto end;
+    if (((uintptr_t)ptr & 63) != 0) {
+        printf("not cache line aligned: ");
+        goto end;
+    }
+    for (u = 0; u < 4096; u++) {
+        if (ptr[u] != 0) {
+            printf("not zeroed at %"PRIuMAX": ", (uintmax_t)u);
+            goto end;
+        }
+    }
+    if (UtilNumaMemuse(0) != memuse + 4096) {
+        printf("memuse %"PRIu64", expected %"PRIu64": ",
+                UtilNumaMemuse(0), memuse + 4096);
+        goto end;
+    }
+
+    UtilNumaFree(ptr, 4096, 0);
+    ptr = NULL;
+    if (UtilNumaMemuse(0) != memuse) {
+        printf("memuse %"PRIu64" after free, expected %"PRIu64": ",
+                UtilNumaMemuse(0), memuse);
+        goto end;
+    }
+
+    result = 1;
+end:
+    if (ptr != NULL)
+        UtilNumaFree(ptr, 4096, 0);
+    return result;
+}
+
+/** \test interleaved memory is spread over the nodes in the accounting */
+static int UtilNumaTest02(void)
+{
+    int result = 0;
+    int nodes = UtilNumaNodeCount();
+    uint64_t memuse[NUMA_MAX_NODES];
+    int n;
+
+    for (n = 0; n < nodes; n++)
+        memuse[n] = UtilNumaMemuse(n);
+
+    void *ptr = UtilNumaAlloc(8192 * nodes, NUMA_NODE_INTERLEAVED, "test");
+    if (ptr == NULL)
+        goto end;
+
+    for (n = 0; n < nodes; n++) {
+        if (UtilNumaMemuse(n) != memuse[n] + 8192) {
+            printf("node %d memuse %"PRIu64", expected %"PRIu64": ", n,
+                    UtilNumaMemuse(n), memuse[n] + 8192);
+            goto end;
+        }
+    }
+
+    UtilNumaFree(ptr, 8192 * nodes, NUMA_NODE_INTERLEAVED);
+    ptr = NULL;
+    for (n = 0; n < nodes; n++) {
+        if (UtilNumaMemuse(n) != memuse[n])
+            goto end;
+    }
+
+    result = 1;
+end:
+    if (ptr != NULL)
+        UtilNumaFree(ptr, 8192 * nodes, NUMA_NODE_INTERLEAVED);
+    return result;
+}
+
+#endif /* UNITTESTS */
+
+void UtilNumaRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("UtilNumaTest01", UtilNumaTest01, 1);
+    UtRegisterTest("UtilNumaTest02", UtilNumaTest02, 1);
+#endif /* UNITTESTS */
+}
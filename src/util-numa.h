@@ -0,0 +1,47 @@
+/* Copyright (C) 2007-2013 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ */
+
+#ifndef __UTIL_NUMA_H__
+#define __UTIL_NUMA_H__
+
+/** max NUMA nodes we keep separate pools for, higher nodes are folded
+ *  onto these */
+#define NUMA_MAX_NODES          8
+
+/** node argument for memory that is interleaved over all nodes */
+#define NUMA_NODE_INTERLEAVED   -1
+
+void UtilNumaInit(void);
+int UtilNumaNodeCount(void);
+int UtilNumaNodeOfCpu(int);
+void UtilNumaThreadSetup(const char *);
+int UtilNumaThreadNode(void);
+
+void *UtilNumaAlloc(size_t, int, const char *);
+void UtilNumaFree(void *, size_t, int);
+void UtilNumaMemuseAdd(int, uint64_t);
+void UtilNumaMemuseSub(int, uint64_t);
+uint64_t UtilNumaMemuse(int);
+
+void UtilNumaReport(void);
+void UtilNumaRegisterTests(void);
+
+#endif /* __UTIL_NUMA_H__ */
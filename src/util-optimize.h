@@ -43,5 +43,12 @@
  */
 #define hw_barrier() __sync_synchronize()
 
+/** \brief hint the cpu to pull the cache line of addr in for reading */
+#ifdef __tile__
+#define SCPrefetch(addr) __insn_prefetch((addr))
+#else
+#define SCPrefetch(addr) __builtin_prefetch((addr), 0, 3)
+#endif
+
 #endif /* __UTIL_OPTIMIZE_H__ */
 
@@ -83,6 +83,9 @@ SCProfilePacketData packet_profile_app_data6[TMM_SIZE][257];
 SCProfilePacketData packet_profile_app_pd_data4[257];
 SCProfilePacketData packet_profile_app_pd_data6[257];
 
+SCProfilePacketData packet_profile_flow_data4[257];
+SCProfilePacketData packet_profile_flow_data6[257];
+
 SCProfilePacketData packet_profile_detect_data4[PROF_DETECT_SIZE][257];
 SCProfilePacketData packet_profile_detect_data6[PROF_DETECT_SIZE][257];
 
@@ -141,6 +144,8 @@ SCProfilingInit(void)
             memset(&packet_profile_app_data6, 0, sizeof(packet_profile_app_data6));
             memset(&packet_profile_app_pd_data4, 0, sizeof(packet_profile_app_pd_data4));
             memset(&packet_profile_app_pd_data6, 0, sizeof(packet_profile_app_pd_data6));
+            memset(&packet_profile_flow_data4, 0, sizeof(packet_profile_flow_data4));
+            memset(&packet_profile_flow_data6, 0, sizeof(packet_profile_flow_data6));
             memset(&packet_profile_detect_data4, 0, sizeof(packet_profile_detect_data4));
             memset(&packet_profile_detect_data6, 0, sizeof(packet_profile_detect_data6));
 
@@ -203,7 +208,7 @@ SCProfilingInit(void)
                 for (i = 0; i < ALPROTO_MAX; i++) {
                     fprintf(packet_profile_csv_fp, "%s,", TmModuleAlprotoToString(i));
                 }
-                fprintf(packet_profile_csv_fp, "STREAM (no app),proto detect,");
+                fprintf(packet_profile_csv_fp, "STREAM (no app),proto detect,flow lookup,");
                 for (i = 0; i < PROF_DETECT_SIZE; i++) {
                     fprintf(packet_profile_csv_fp, "%s,", PacketProfileDetectIdToString(i));
                 }
@@ -508,6 +513,40 @@ void SCProfilingDumpPacketStats(void) {
         }
     }
 
+    /* flow lookup output */
+    fprintf(fp, "\nFlow hash lookup stats:\n");
+
+    fprintf(fp, "\n%-20s   %-6s   %-5s   %-12s   %-12s   %-12s   %-12s   %-12s\n",
+            "Stage", "IP ver", "Proto", "cnt", "min", "max", "avg", "tot");
+    fprintf(fp, "%-20s   %-6s   %-5s   %-12s   %-12s   %-12s   %-12s   %-12s\n",
+            "--------------------", "------", "-----", "----------", "------------", "------------", "-----------", "-----------");
+    {
+        int p;
+        for (p = 0; p < 257; p++) {
+            SCProfilePacketData *pd = &packet_profile_flow_data4[p];
+
+            if (pd->cnt == 0) {
+                continue;
+            }
+
+            FormatNumber(pd->tot, totalstr, sizeof(totalstr));
+            fprintf(fp, "%-20s    IPv4     %3d  %12"PRIu64"     %12"PRIu64"   %12"PRIu64"  %12"PRIu64"  %12s\n",
+                    "Flow lookup", p, pd->cnt, pd->min, pd->max, (uint64_t)(pd->tot / pd->cnt), totalstr);
+        }
+
+        for (p = 0; p < 257; p++) {
+            SCProfilePacketData *pd = &packet_profile_flow_data6[p];
+
+            if (pd->cnt == 0) {
+                continue;
+            }
+
+            FormatNumber(pd->tot, totalstr, sizeof(totalstr));
+            fprintf(fp, "%-20s    IPv6     %3d  %12"PRIu64"     %12"PRIu64"   %12"PRIu64"  %12"PRIu64"  %12s\n",
+                    "Flow lookup", p, pd->cnt, pd->min, pd->max, (uint64_t)(pd->tot / pd->cnt), totalstr);
+        }
+    }
+
     total = 0;
     for (m = 0; m < PROF_DETECT_SIZE; m++) {
         int p;
@@ -608,6 +647,7 @@ void SCProfilingPrintPacketProfile(Packet *p) {
     fprintf(packet_profile_csv_fp, "%"PRIu64",", real_tcp);
 
     fprintf(packet_profile_csv_fp, "%"PRIu64",", p->profile.proto_detect);
+    fprintf(packet_profile_csv_fp, "%"PRIu64",", p->profile.flow_lookup);
 
     for (i = 0; i < PROF_DETECT_SIZE; i++) {
         PktProfilingDetectData *pdt = &p->profile.detect[i];
@@ -717,6 +757,28 @@ void SCProfilingUpdatePacketAppRecords(Packet *p) {
     }
 }
 
+static void SCProfilingUpdatePacketFlowRecord(Packet *p) {
+    SCProfilePacketData *pd;
+
+    if (p->profile.flow_lookup == 0)
+        return;
+
+    if (PKT_IS_IPV4(p))
+        pd = &packet_profile_flow_data4[p->proto];
+    else
+        pd = &packet_profile_flow_data6[p->proto];
+
+    if (pd->min == 0 || p->profile.flow_lookup < pd->min) {
+        pd->min = p->profile.flow_lookup;
+    }
+    if (pd->max < p->profile.flow_lookup) {
+        pd->max = p->profile.flow_lookup;
+    }
+
+    pd->tot += p->profile.flow_lookup;
+    pd->cnt ++;
+}
+
 void SCProfilingUpdatePacketTmmRecord(int module, uint8_t proto, PktProfilingTmmData *pdt, int ipver) {
     if (pdt == NULL) {
         return;
@@ -806,6 +868,7 @@ void SCProfilingAddPacket(Packet *p) {
 
             SCProfilingUpdatePacketTmmRecords(p);
             SCProfilingUpdatePacketAppRecords(p);
+            SCProfilingUpdatePacketFlowRecord(p);
             SCProfilingUpdatePacketDetectRecords(p);
 
         } else if (PKT_IS_IPV6(p)) {
@@ -838,6 +901,7 @@ void SCProfilingAddPacket(Packet *p) {
 
             SCProfilingUpdatePacketTmmRecords(p);
             SCProfilingUpdatePacketAppRecords(p);
+            SCProfilingUpdatePacketFlowRecord(p);
             SCProfilingUpdatePacketDetectRecords(p);
         }
     }
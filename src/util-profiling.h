@@ -123,6 +123,34 @@ void SCProfilingAddPacket(Packet *);
         }                                                           \
     }
 
+#define PACKET_PROFILING_FLOW_START(ticks)                          \
+    if (profiling_packets_enabled) {                                \
+        (ticks) = UtilCpuGetTicks();                                \
+    }
+
+#define PACKET_PROFILING_FLOW_END(p, ticks)                         \
+    if (profiling_packets_enabled) {                                \
+        (p)->profile.flow_lookup += UtilCpuGetTicks() - (ticks);    \
+    }
+
+/** \brief store the ticks of a batch call, spread evenly over its packets */
+#define PACKET_PROFILING_TMM_BATCH_START(ticks)                     \
+    if (profiling_packets_enabled) {                                \
+        (ticks) = UtilCpuGetTicks();                                \
+    }
+
+#define PACKET_PROFILING_TMM_BATCH_END(pkts, cnt, id, ticks)        \
+    if (profiling_packets_enabled) {                                \
+        if ((id) < TMM_SIZE && (cnt) > 0) {                         \
+            uint64_t _per_pkt = (UtilCpuGetTicks() - (ticks)) / (cnt); \
+            uint16_t _i;                                            \
+            for (_i = 0; _i < (cnt); _i++) {                        \
+                (pkts)[_i]->profile.tmm[(id)].ticks_start = (ticks); \
+                (pkts)[_i]->profile.tmm[(id)].ticks_end = (ticks) + _per_pkt; \
+            }                                                       \
+        }                                                           \
+    }
+
 #define PACKET_PROFILING_RESET(p)                                   \
     if (profiling_packets_enabled) {                                \
         memset(&(p)->profile, 0x00, sizeof(PktProfiling));          \
@@ -220,6 +248,12 @@ void SCProfilingDump(void);
 #define PACKET_PROFILING_TMM_START(p, id)
 #define PACKET_PROFILING_TMM_END(p, id)
 
+#define PACKET_PROFILING_TMM_BATCH_START(ticks)
+#define PACKET_PROFILING_TMM_BATCH_END(pkts, cnt, id, ticks)
+
+#define PACKET_PROFILING_FLOW_START(ticks)
+#define PACKET_PROFILING_FLOW_END(p, ticks)
+
 #define PACKET_PROFILING_RESET(p)
 
 #define PACKET_PROFILING_APP_START(dp, id)
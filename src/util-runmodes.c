@@ -46,6 +46,9 @@
 #include "util-affinity.h"
 #include "util-device.h"
 
+#include "app-layer-thread.h"
+#include "tmqh-flow.h"
+
 #include "util-runmodes.h"
 
 int RunModeSetLiveCaptureAuto(DetectEngineCtx *de_ctx,
@@ -393,6 +396,143 @@ int RunModeSetLiveCaptureAuto(DetectEngineCtx *de_ctx,
     return 0;
 }
 
+/**
+ * \brief Get the queue handler between the stages of the autofp runmodes
+ *
+ * \retval name "spsc" if autofp-queue-handler is set to it, "flow"
+ *              otherwise
+ */
+char *RunModeAutoFpQueueHandler(void)
+{
+    char *handler = NULL;
+
+    if (ConfGet("autofp-queue-handler", &handler) == 1 &&
+        strcasecmp(handler, "spsc") == 0)
+        return "spsc";
+    return "flow";
+}
+
+/**
+ * \brief Get the input queues of the app layer threads of the autofp
+ *        runmodes.
+ *
+ * If threading.app-layer-threads is set, the stream threads pass their
+ * packets to these queues using the autofp queue handler, so a flow always
+ * ends up in the same app layer thread. The stream engine is switched to
+ * deferring the app layer data to these threads.
+ *
+ * \param queues buffer for the comma separated list of queues
+ * \param size size of the buffer
+ *
+ * \retval cnt number of app layer threads, 0 if the app layer runs in
+ *             the stream threads
+ */
+int RunModeAutoFpAppLayerQueues(char *queues, size_t size)
+{
+    char qname[16];
+    int thread;
+    int thread_max = AppLayerThreadsGetCount();
+
+    if (thread_max == 0)
+        return 0;
+
+    queues[0] = '\0';
+    for (thread = 0; thread < thread_max; thread++) {
+        if (strlen(queues) > 0)
+            strlcat(queues, ",", size);
+
+        snprintf(qname, sizeof(qname), TMQH_FLOW_APPLAYER_QUEUE "%"PRIu16, thread+1);
+        strlcat(queues, qname, size);
+    }
+    SCLogDebug("app layer queues %s", queues);
+
+    AppLayerThreadsEnable();
+    SCLogInfo("Going to use %d app layer thread(s)", thread_max);
+    return thread_max;
+}
+
+/**
+ * \brief Create the app layer threads of the autofp runmodes
+ *
+ * The threads run the app layer parsers, detection and outputs. They
+ * should be created after the stream threads feeding them, so that at
+ * shutdown they are still around to drain their queues.
+ *
+ * \param thread_max number of threads, from RunModeAutoFpAppLayerQueues()
+ * \param outq output queue of the threads
+ * \param outqh output queue handler of the threads
+ * \param reject add the RespondReject module
+ */
+void RunModeAutoFpSetupAppLayerThreads(DetectEngineCtx *de_ctx, int thread_max,
+                                       char *outq, char *outqh, int reject)
+{
+    char tname[16];
+    char qname[16];
+    int thread;
+
+    for (thread = 0; thread < thread_max; thread++) {
+        snprintf(tname, sizeof(tname), "AppLayer%"PRIu16, thread+1);
+        snprintf(qname, sizeof(qname), TMQH_FLOW_APPLAYER_QUEUE "%"PRIu16, thread+1);
+
+        SCLogDebug("tname %s, qname %s", tname, qname);
+
+        char *thread_name = SCStrdup(tname);
+        if (unlikely(thread_name == NULL)) {
+            SCLogError(SC_ERR_MEM_ALLOC, "Can't allocate thread name");
+            exit(EXIT_FAILURE);
+        }
+        ThreadVars *tv_applayer =
+            TmThreadCreatePacketHandler(thread_name,
+                                        qname, RunModeAutoFpQueueHandler(),
+                                        outq, outqh,
+                                        "varslot");
+        if (tv_applayer == NULL) {
+            SCLogError(SC_ERR_RUNMODE, "TmThreadsCreate failed");
+            exit(EXIT_FAILURE);
+        }
+        TmModule *tm_module = TmModuleGetByName("AppLayer");
+        if (tm_module == NULL) {
+            SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName AppLayer failed");
+            exit(EXIT_FAILURE);
+        }
+        TmSlotSetFuncAppend(tv_applayer, tm_module, NULL);
+
+        tm_module = TmModuleGetByName("Detect");
+        if (tm_module == NULL) {
+            SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName Detect failed");
+            exit(EXIT_FAILURE);
+        }
+        TmSlotSetFuncAppendDelayed(tv_applayer, tm_module,
+                                   (void *)de_ctx, de_ctx->delayed_detect);
+
+        if (reject) {
+            tm_module = TmModuleGetByName("RespondReject");
+            if (tm_module == NULL) {
+                SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName RespondReject failed");
+                exit(EXIT_FAILURE);
+            }
+            TmSlotSetFuncAppend(tv_applayer, tm_module, NULL);
+        }
+
+        /* add outputs as well */
+        SetupOutputs(tv_applayer);
+
+        TmThreadSetCPU(tv_applayer, DETECT_CPU_SET);
+
+        char *thread_group_name = SCStrdup("AppLayer");
+        if (unlikely(thread_group_name == NULL)) {
+            SCLogError(SC_ERR_RUNMODE, "Error allocating memory");
+            exit(EXIT_FAILURE);
+        }
+        tv_applayer->thread_group_name = thread_group_name;
+
+        if (TmThreadSpawn(tv_applayer) != TM_ECODE_OK) {
+            SCLogError(SC_ERR_RUNMODE, "TmThreadSpawn failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
 int RunModeSetLiveCaptureAutoFp(DetectEngineCtx *de_ctx,
                               ConfigIfaceParserFunc ConfigParser,
                               ConfigIfaceThreadsCountFunc ModThreadsCount,
@@ -451,7 +591,7 @@ int RunModeSetLiveCaptureAutoFp(DetectEngineCtx *de_ctx,
             ThreadVars *tv_receive =
                 TmThreadCreatePacketHandler(thread_name,
                         "packetpool", "packetpool",
-                        queues, "flow", "pktacqloop");
+                        queues, RunModeAutoFpQueueHandler(), "pktacqloop");
             if (tv_receive == NULL) {
                 SCLogError(SC_ERR_RUNMODE, "TmThreadsCreate failed");
                 exit(EXIT_FAILURE);
@@ -514,7 +654,7 @@ int RunModeSetLiveCaptureAutoFp(DetectEngineCtx *de_ctx,
                 ThreadVars *tv_receive =
                     TmThreadCreatePacketHandler(thread_name,
                             "packetpool", "packetpool",
-                            queues, "flow", "pktacqloop");
+                            queues, RunModeAutoFpQueueHandler(), "pktacqloop");
                 if (tv_receive == NULL) {
                     SCLogError(SC_ERR_RUNMODE, "TmThreadsCreate failed");
                     exit(EXIT_FAILURE);
@@ -543,8 +683,12 @@ int RunModeSetLiveCaptureAutoFp(DetectEngineCtx *de_ctx,
         }
     }
 
+    char al_queues[2048] = "";
+    int al_threads = RunModeAutoFpAppLayerQueues(al_queues, sizeof(al_queues));
+
     for (thread = 0; thread < thread_max; thread++) {
-        snprintf(tname, sizeof(tname), "Detect%"PRIu16, thread+1);
+        snprintf(tname, sizeof(tname), "%s%"PRIu16,
+                 al_threads ? "Stream" : "Detect", thread+1);
         snprintf(qname, sizeof(qname), "pickup%"PRIu16, thread+1);
 
         SCLogDebug("tname %s, qname %s", tname, qname);
@@ -556,8 +700,9 @@ int RunModeSetLiveCaptureAutoFp(DetectEngineCtx *de_ctx,
         }
         ThreadVars *tv_detect_ncpu =
             TmThreadCreatePacketHandler(thread_name,
-                                        qname, "flow",
-                                        "packetpool", "packetpool",
+                                        qname, RunModeAutoFpQueueHandler(),
+                                        al_threads ? al_queues : "packetpool",
+                                        al_threads ? RunModeAutoFpQueueHandler() : "packetpool",
                                         "varslot");
         if (tv_detect_ncpu == NULL) {
             SCLogError(SC_ERR_RUNMODE, "TmThreadsCreate failed");
@@ -570,39 +715,47 @@ int RunModeSetLiveCaptureAutoFp(DetectEngineCtx *de_ctx,
         }
         TmSlotSetFuncAppend(tv_detect_ncpu, tm_module, NULL);
 
-        tm_module = TmModuleGetByName("Detect");
-        if (tm_module == NULL) {
-            SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName Detect failed");
-            exit(EXIT_FAILURE);
+        /* with app layer threads the rest of the work is done there */
+        if (al_threads == 0) {
+            tm_module = TmModuleGetByName("Detect");
+            if (tm_module == NULL) {
+                SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName Detect failed");
+                exit(EXIT_FAILURE);
+            }
+            TmSlotSetFuncAppendDelayed(tv_detect_ncpu, tm_module,
+                                       (void *)de_ctx, de_ctx->delayed_detect);
+
+            tm_module = TmModuleGetByName("RespondReject");
+            if (tm_module == NULL) {
+                SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName RespondReject failed");
+                exit(EXIT_FAILURE);
+            }
+            TmSlotSetFuncAppend(tv_detect_ncpu, tm_module, NULL);
+
+            /* add outputs as well */
+            SetupOutputs(tv_detect_ncpu);
         }
-        TmSlotSetFuncAppendDelayed(tv_detect_ncpu, tm_module,
-                                   (void *)de_ctx, de_ctx->delayed_detect);
 
         TmThreadSetCPU(tv_detect_ncpu, DETECT_CPU_SET);
 
-        char *thread_group_name = SCStrdup("Detect");
+        char *thread_group_name = SCStrdup(al_threads ? "Stream" : "Detect");
         if (unlikely(thread_group_name == NULL)) {
             SCLogError(SC_ERR_RUNMODE, "Error allocating memory");
             exit(EXIT_FAILURE);
         }
         tv_detect_ncpu->thread_group_name = thread_group_name;
 
-        tm_module = TmModuleGetByName("RespondReject");
-        if (tm_module == NULL) {
-            SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName RespondReject failed");
-            exit(EXIT_FAILURE);
-        }
-        TmSlotSetFuncAppend(tv_detect_ncpu, tm_module, NULL);
-
-        /* add outputs as well */
-        SetupOutputs(tv_detect_ncpu);
-
         if (TmThreadSpawn(tv_detect_ncpu) != TM_ECODE_OK) {
             SCLogError(SC_ERR_RUNMODE, "TmThreadSpawn failed");
             exit(EXIT_FAILURE);
         }
     }
 
+    if (al_threads > 0) {
+        RunModeAutoFpSetupAppLayerThreads(de_ctx, al_threads,
+                                          "packetpool", "packetpool", 1);
+    }
+
     return 0;
 }
 
@@ -736,6 +889,155 @@ int RunModeSetLiveCaptureWorkers(DetectEngineCtx *de_ctx,
     return 0;
 }
 
+/**
+ * \brief set up a workers runmode for a file source
+ *
+ * The receive threads only read the packets and hand them to the workers
+ * with the "rxhash" queue handler, which hashes the raw packet. All
+ * packets of a flow go to the same worker, which does everything from
+ * decoding to the outputs, so each flow is only ever used by one thread.
+ *
+ * \param recv_mod_name receive module, reading recv_initdata
+ * \param decode_mod_name decode module, runs in the workers
+ * \param thread_name name of the receive threads
+ * \param rx_threads number of receive threads
+ */
+int RunModeSetFileWorkers(DetectEngineCtx *de_ctx, char *recv_mod_name,
+                          char *decode_mod_name, char *thread_name,
+                          void *recv_initdata, int rx_threads)
+{
+    char tname[16];
+    char qname[16];
+    char queues[2048] = "";
+    TmModule *tm_module;
+    int thread;
+
+    /* Available cpus */
+    uint16_t ncpus = UtilCpuGetNumProcessorsOnline();
+
+    /* always create at least one worker */
+    int thread_max = TmThreadGetNbThreads(DETECT_CPU_SET);
+    if (thread_max == 0)
+        thread_max = ncpus * threading_detect_ratio;
+    if (thread_max < 1)
+        thread_max = 1;
+
+    for (thread = 0; thread < thread_max; thread++) {
+        if (strlen(queues) > 0)
+            strlcat(queues, ",", sizeof(queues));
+
+        snprintf(qname, sizeof(qname), "worker%"PRIu16, thread+1);
+        strlcat(queues, qname, sizeof(queues));
+    }
+    SCLogInfo("Going to use %d worker thread(s)", thread_max);
+
+    int rx;
+    for (rx = 0; rx < rx_threads; rx++) {
+        char *rx_name = thread_name;
+        if (rx_threads > 1) {
+            snprintf(tname, sizeof(tname), "%s%d", thread_name, rx+1);
+            rx_name = SCStrdup(tname);
+            if (unlikely(rx_name == NULL)) {
+                SCLogError(SC_ERR_MEM_ALLOC, "Can't allocate thread name");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        ThreadVars *tv_receive =
+            TmThreadCreatePacketHandler(rx_name,
+                                        "packetpool", "packetpool",
+                                        queues, "rxhash",
+                                        "pktacqloop");
+        if (tv_receive == NULL) {
+            SCLogError(SC_ERR_THREAD_CREATE, "TmThreadsCreate failed");
+            exit(EXIT_FAILURE);
+        }
+        tm_module = TmModuleGetByName(recv_mod_name);
+        if (tm_module == NULL) {
+            SCLogError(SC_ERR_INVALID_VALUE, "TmModuleGetByName failed for %s", recv_mod_name);
+            exit(EXIT_FAILURE);
+        }
+        TmSlotSetFuncAppend(tv_receive, tm_module, recv_initdata);
+
+        if (rx_threads > 1) {
+            char *thread_group_name = SCStrdup(thread_name);
+            if (unlikely(thread_group_name == NULL)) {
+                SCLogError(SC_ERR_MEM_ALLOC, "Can't allocate thread group name");
+                exit(EXIT_FAILURE);
+            }
+            tv_receive->thread_group_name = thread_group_name;
+        }
+
+        TmThreadSetCPU(tv_receive, RECEIVE_CPU_SET);
+
+        if (TmThreadSpawn(tv_receive) != TM_ECODE_OK) {
+            SCLogError(SC_ERR_THREAD_SPAWN, "TmThreadSpawn failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for (thread = 0; thread < thread_max; thread++) {
+        snprintf(tname, sizeof(tname), "Worker%"PRIu16, thread+1);
+        snprintf(qname, sizeof(qname), "worker%"PRIu16, thread+1);
+
+        char *n_thread_name = SCStrdup(tname);
+        char *n_qname = SCStrdup(qname);
+        if (unlikely(n_thread_name == NULL || n_qname == NULL)) {
+            SCLogError(SC_ERR_MEM_ALLOC, "Can't allocate thread name");
+            exit(EXIT_FAILURE);
+        }
+
+        ThreadVars *tv = TmThreadCreatePacketHandler(n_thread_name,
+                n_qname, "rxhash",
+                "packetpool", "packetpool",
+                "varslot");
+        if (tv == NULL) {
+            SCLogError(SC_ERR_THREAD_CREATE, "TmThreadsCreate failed");
+            exit(EXIT_FAILURE);
+        }
+
+        tm_module = TmModuleGetByName(decode_mod_name);
+        if (tm_module == NULL) {
+            SCLogError(SC_ERR_INVALID_VALUE, "TmModuleGetByName %s failed", decode_mod_name);
+            exit(EXIT_FAILURE);
+        }
+        TmSlotSetFuncAppend(tv, tm_module, NULL);
+
+        tm_module = TmModuleGetByName("StreamTcp");
+        if (tm_module == NULL) {
+            SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName StreamTcp failed");
+            exit(EXIT_FAILURE);
+        }
+        TmSlotSetFuncAppend(tv, tm_module, NULL);
+
+        tm_module = TmModuleGetByName("Detect");
+        if (tm_module == NULL) {
+            SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName Detect failed");
+            exit(EXIT_FAILURE);
+        }
+        TmSlotSetFuncAppendDelayed(tv, tm_module,
+                                   (void *)de_ctx, de_ctx->delayed_detect);
+
+        SetupOutputs(tv);
+
+        char *thread_group_name = SCStrdup("Worker");
+        if (unlikely(thread_group_name == NULL)) {
+            SCLogError(SC_ERR_MEM_ALLOC, "Can't allocate thread group name");
+            exit(EXIT_FAILURE);
+        }
+        tv->thread_group_name = thread_group_name;
+
+        TmThreadSetCPU(tv, DETECT_CPU_SET);
+
+        if (TmThreadSpawn(tv) != TM_ECODE_OK) {
+            SCLogError(SC_ERR_THREAD_SPAWN, "TmThreadSpawn failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    return 0;
+}
+
 int RunModeSetLiveCaptureSingle(DetectEngineCtx *de_ctx,
                               ConfigIfaceParserFunc ConfigParser,
                               ConfigIfaceThreadsCountFunc ModThreadsCount,
@@ -1024,7 +1326,7 @@ int RunModeSetIPSAutoFp(DetectEngineCtx *de_ctx,
         ThreadVars *tv_receive =
             TmThreadCreatePacketHandler(thread_name,
                     "packetpool", "packetpool",
-                    queues, "flow", "pktacqloop");
+                    queues, RunModeAutoFpQueueHandler(), "pktacqloop");
         if (tv_receive == NULL) {
             SCLogError(SC_ERR_RUNMODE, "TmThreadsCreate failed");
             exit(EXIT_FAILURE);
@@ -1051,8 +1353,12 @@ int RunModeSetIPSAutoFp(DetectEngineCtx *de_ctx,
         }
 
     }
+    char al_queues[2048] = "";
+    int al_threads = RunModeAutoFpAppLayerQueues(al_queues, sizeof(al_queues));
+
     for (thread = 0; thread < thread_max; thread++) {
-        snprintf(tname, sizeof(tname), "Detect%"PRIu16, thread+1);
+        snprintf(tname, sizeof(tname), "%s%"PRIu16,
+                 al_threads ? "Stream" : "Detect", thread+1);
         snprintf(qname, sizeof(qname), "pickup%"PRIu16, thread+1);
 
         SCLogDebug("tname %s, qname %s", tname, qname);
@@ -1064,8 +1370,9 @@ int RunModeSetIPSAutoFp(DetectEngineCtx *de_ctx,
         }
         ThreadVars *tv_detect_ncpu =
             TmThreadCreatePacketHandler(thread_name,
-                                        qname, "flow",
-                                        "verdict-queue", "simple",
+                                        qname, RunModeAutoFpQueueHandler(),
+                                        al_threads ? al_queues : "verdict-queue",
+                                        al_threads ? RunModeAutoFpQueueHandler() : "simple",
                                         "varslot");
         if (tv_detect_ncpu == NULL) {
             SCLogError(SC_ERR_RUNMODE, "TmThreadsCreate failed");
@@ -1078,19 +1385,22 @@ int RunModeSetIPSAutoFp(DetectEngineCtx *de_ctx,
         }
         TmSlotSetFuncAppend(tv_detect_ncpu, tm_module, NULL);
 
-        tm_module = TmModuleGetByName("Detect");
-        if (tm_module == NULL) {
-            SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName Detect failed");
-            exit(EXIT_FAILURE);
+        /* with app layer threads the rest of the work is done there */
+        if (al_threads == 0) {
+            tm_module = TmModuleGetByName("Detect");
+            if (tm_module == NULL) {
+                SCLogError(SC_ERR_RUNMODE, "TmModuleGetByName Detect failed");
+                exit(EXIT_FAILURE);
+            }
+            TmSlotSetFuncAppendDelayed(tv_detect_ncpu, tm_module,
+                                       (void *)de_ctx, de_ctx->delayed_detect);
+
+            SetupOutputs(tv_detect_ncpu);
         }
-        TmSlotSetFuncAppendDelayed(tv_detect_ncpu, tm_module,
-                                   (void *)de_ctx, de_ctx->delayed_detect);
 
         TmThreadSetCPU(tv_detect_ncpu, DETECT_CPU_SET);
 
-        SetupOutputs(tv_detect_ncpu);
-
-        char *thread_group_name = SCStrdup("Detect");
+        char *thread_group_name = SCStrdup(al_threads ? "Stream" : "Detect");
         if (unlikely(thread_group_name == NULL)) {
             SCLogError(SC_ERR_RUNMODE, "Error allocating memory");
             exit(EXIT_FAILURE);
@@ -1103,6 +1413,11 @@ int RunModeSetIPSAutoFp(DetectEngineCtx *de_ctx,
         }
     }
 
+    if (al_threads > 0) {
+        RunModeAutoFpSetupAppLayerThreads(de_ctx, al_threads,
+                                          "verdict-queue", "simple", 0);
+    }
+
     /* create the threads */
     for (int i = 0; i < nqueue; i++) {
         memset(tname, 0, sizeof(tname));
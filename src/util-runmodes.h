@@ -28,6 +28,11 @@ typedef void *(*ConfigIfaceParserFunc) (const char *);
 typedef void *(*ConfigIPSParserFunc) (int);
 typedef int (*ConfigIfaceThreadsCountFunc) (void *);
 
+char *RunModeAutoFpQueueHandler(void);
+int RunModeAutoFpAppLayerQueues(char *queues, size_t size);
+void RunModeAutoFpSetupAppLayerThreads(DetectEngineCtx *de_ctx, int thread_max,
+                                       char *outq, char *outqh, int reject);
+
 int RunModeSetLiveCaptureAuto(DetectEngineCtx *de_ctx,
                               ConfigIfaceParserFunc configparser,
                               ConfigIfaceThreadsCountFunc ModThreadsCount,
@@ -56,6 +61,10 @@ int RunModeSetLiveCaptureWorkers(DetectEngineCtx *de_ctx,
                               char *decode_mod_name, char *thread_name,
                               const char *live_dev);
 
+int RunModeSetFileWorkers(DetectEngineCtx *de_ctx, char *recv_mod_name,
+                          char *decode_mod_name, char *thread_name,
+                          void *recv_initdata, int rx_threads);
+
 int RunModeSetIPSAuto(DetectEngineCtx *de_ctx,
                       ConfigIPSParserFunc ConfigParser,
                       char *recv_mod_name,